@@ -0,0 +1,100 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    budget.c
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file budget.c
+ *
+ * This file contains the memory budget that bounds the bytes of file
+ * data held in memory by all save workers together.
+ */
+
+#include "client.h"
+
+
+/**
+ * Creates a new memory budget.
+ * @param total is the number of bytes that save workers may hold in
+ *        memory all together.
+ * @returns a newly allocated memory_budget_t structure.
+ */
+memory_budget_t *new_memory_budget_t(gint64 total)
+{
+    memory_budget_t *budget = NULL;
+
+    budget = (memory_budget_t *) g_malloc0(sizeof(memory_budget_t));
+    g_assert_nonnull(budget);
+
+    g_mutex_init(&budget->mutex);
+    g_cond_init(&budget->cond);
+    budget->total = total;
+    budget->available = total;
+
+    return budget;
+}
+
+
+/**
+ * Reserves some bytes in the memory budget. Waits until they are
+ * available. The reservation is limited to the total of the budget
+ * so that a single worker can never wait forever.
+ * @param budget is the memory budget shared by all save workers.
+ * @param wanted is the number of bytes wanted.
+ * @returns the number of bytes really reserved (that must be given back
+ *          with release_memory_budget()).
+ */
+gint64 reserve_memory_budget(memory_budget_t *budget, gint64 wanted)
+{
+    g_assert_nonnull(budget);
+
+    wanted = CLAMP(wanted, 0, budget->total);
+
+    g_mutex_lock(&budget->mutex);
+
+    while (budget->available < wanted)
+        {
+            g_cond_wait(&budget->cond, &budget->mutex);
+        }
+
+    budget->available = budget->available - wanted;
+
+    g_mutex_unlock(&budget->mutex);
+
+    return wanted;
+}
+
+
+/**
+ * Gives back bytes reserved with reserve_memory_budget() and wakes up
+ * workers that may be waiting for them.
+ * @param budget is the memory budget shared by all save workers.
+ * @param reserved is the number of bytes returned by
+ *        reserve_memory_budget().
+ */
+void release_memory_budget(memory_budget_t *budget, gint64 reserved)
+{
+    g_assert_nonnull(budget);
+
+    g_mutex_lock(&budget->mutex);
+    budget->available = budget->available + reserved;
+    g_cond_broadcast(&budget->cond);
+    g_mutex_unlock(&budget->mutex);
+}
@@ -0,0 +1,64 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    budget.h
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file budget.h
+ *
+ * In this file we have all definitions of the memory budget shared by
+ * the save workers.
+ */
+#ifndef _BUDGET_H_
+#define _BUDGET_H_
+
+
+/**
+ * Creates a new memory budget.
+ * @param total is the number of bytes that save workers may hold in
+ *        memory all together.
+ * @returns a newly allocated memory_budget_t structure.
+ */
+extern memory_budget_t *new_memory_budget_t(gint64 total);
+
+
+/**
+ * Reserves some bytes in the memory budget. Waits until they are
+ * available. The reservation is limited to the total of the budget
+ * so that a single worker can never wait forever.
+ * @param budget is the memory budget shared by all save workers.
+ * @param wanted is the number of bytes wanted.
+ * @returns the number of bytes really reserved (that must be given back
+ *          with release_memory_budget()).
+ */
+extern gint64 reserve_memory_budget(memory_budget_t *budget, gint64 wanted);
+
+
+/**
+ * Gives back bytes reserved with reserve_memory_budget() and wakes up
+ * workers that may be waiting for them.
+ * @param budget is the memory budget shared by all save workers.
+ * @param reserved is the number of bytes returned by
+ *        reserve_memory_budget().
+ */
+extern void release_memory_budget(memory_budget_t *budget, gint64 reserved);
+
+
+#endif /* #IFNDEF _BUDGET_H_ */
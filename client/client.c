@@ -32,25 +32,42 @@
 
 static GSList *make_regex_exclude_list(GSList *exclude_list);
 static gboolean exclude_file(GSList *regex_exclude_list, gchar *filename);
+static save_worker_t *new_save_worker_t(main_struct_t *main_struct, gchar *conn, guint number);
+static void start_save_workers(main_struct_t *main_struct, gchar *conn);
+static void save_failed_post(gpointer user_data, gchar *url, gchar *body, gsize length);
 static main_struct_t *init_main_structure(options_t *opt);
-static GList *calculate_hash_data_list_for_file(GFile *a_file, gint64 blocksize, gshort cmptype);
+static hash_data_t *make_hash_data_for_block(guchar *buffer, gssize size_read, guint8 *a_hash, compress_probe_t *probe);
+static GList *calculate_hash_data_list_for_file(reader_t *reader, GFile *a_file, gint64 blocksize, cdc_params_t *cdc_params, gshort cmptype);
 static meta_data_t *get_meta_data_from_fileinfo(file_event_t *file_event, filter_file_t *filter, options_t *opt);
-static gchar *send_meta_data_to_server(main_struct_t *main_struct, meta_data_t *meta, gboolean data_sent);
-static GList *find_hash_in_list(GList *hash_data_list, guint8 *hash);
-static GList *send_data_to_server(main_struct_t *main_struct, GList *hash_data_list, gchar *answer);
-static GList *send_all_data_to_server(main_struct_t *main_struct, GList *hash_data_list, gchar *answer);
-static void iterate_over_enum(main_struct_t *main_struct, gchar *directory, GFileEnumerator *file_enum);
+static gchar *send_meta_data_to_server(save_worker_t *worker, meta_data_t *meta, gboolean data_sent);
+static GList *send_data_to_server(save_worker_t *worker, GList *hash_data_list, gchar *answer);
+static GList *send_all_data_to_server(save_worker_t *worker, GList *hash_data_list, gchar *answer);
+static owner_cache_t *new_owner_cache_t(void);
+static void free_owner_cache_t(owner_cache_t *owners);
+static gchar *get_owner_name(owner_cache_t *owners, guint32 id, gboolean is_user);
+static gint stat_entry(gint dir_fd, const gchar *name, struct stat *st);
+static GFileInfo *get_entry_file_info(owner_cache_t *owners, gint dir_fd, const gchar *name);
+static void iterate_over_directory(main_struct_t *main_struct, gchar *directory, DIR *dir);
 static void carve_one_directory(gpointer data, gpointer user_data);
+static gboolean is_carving_stopped(main_struct_t *main_struct);
+static void push_to_carve_pool(main_struct_t *main_struct, gchar *directory);
+static void stop_carving(main_struct_t *main_struct);
 static gpointer carve_all_directories(gpointer data);
 static gpointer save_one_file_threaded(gpointer data);
 static void free_filter_file_t(filter_file_t *filter);
 static void free_file_event_t(file_event_t *file_event);
-static gint insert_array_in_root_and_send(main_struct_t *main_struct, json_t *array);
-static void process_small_file_not_in_cache(main_struct_t *main_struct, meta_data_t *meta);
-static GList *lets_send_all_that_now(main_struct_t *main_struct, GList *hash_data_list, GList *saved_list, gsize read_bytes);
-static void process_big_file_not_in_cache(main_struct_t *main_struct, meta_data_t *meta);
+static gint send_blocks_to_server(save_worker_t *worker, GList *blocks);
+static void process_small_file_not_in_cache(save_worker_t *worker, meta_data_t *meta);
+static GList *lets_send_all_that_now(save_worker_t *worker, GList *hash_data_list, GList *saved_list, gsize read_bytes);
+static void process_big_file_not_in_cache(save_worker_t *worker, meta_data_t *meta);
 static gint64 calculate_file_blocksize(options_t *opt, gint64 size);
+static gint calculate_file_buffersize(options_t *opt, gint64 size);
+static reconnect_t *new_reconnect_t(void);
+static void signal_reconnection(reconnect_t *reconnect, gboolean even_in_backoff);
+static void wake_up_reconnection(main_struct_t *main_struct);
+static gboolean wait_for_reconnection(reconnect_t *reconnect, gint64 seconds, gboolean backoff);
 static gpointer reconnected(gpointer data);
+static void stop_reconnection(main_struct_t *main_struct);
 static gboolean client_signal_handler(gpointer user_data);
 static gpointer fanotify_loop_thread(gpointer data);
 static void install_client_signal_traps(main_struct_t *main_struct);
@@ -111,6 +128,112 @@ static gboolean exclude_file(GSList *regex_exclude_list, gchar *filename)
 }
 
 
+/**
+ * Creates a new save worker. Each worker has its own database connexion
+ * and its own curl handle so that many files may be saved at the same
+ * time without any locking.
+ * @param main_struct : main structure of the program.
+ * @param conn is the connexion string to the server.
+ * @param number is the number of this worker (used to name its thread).
+ * @returns a newly allocated save_worker_t * structure whose thread is
+ *          already running.
+ */
+static save_worker_t *new_save_worker_t(main_struct_t *main_struct, gchar *conn, guint number)
+{
+    save_worker_t *worker = NULL;
+    options_t *opt = NULL;
+    gchar *name = NULL;
+
+    g_assert_nonnull(main_struct);
+    g_assert_nonnull(main_struct->opt);
+
+    opt = main_struct->opt;
+
+    worker = (save_worker_t *) g_malloc0(sizeof(save_worker_t));
+    g_assert_nonnull(worker);
+
+    worker->main_struct = main_struct;
+    worker->database = open_database(opt->dircache, opt->dbname);
+    db_set_file_cache(worker->database, main_struct->file_cache);
+    db_set_spool(worker->database, main_struct->spool);
+    db_set_durability(worker->database, opt->db_durability);
+    db_set_writer(worker->database, main_struct->writer);
+    worker->comm = init_comm_struct(conn, opt->cmptype);
+    set_comm_failure_handler(worker->comm, save_failed_post, worker);
+    if (main_struct->transport != NULL)
+        {
+            set_comm_transport(worker->comm, main_struct->transport, opt->http_in_flight);
+        }
+    worker->buffersize = opt->buffersize;
+    worker->reader = new_reader_t(opt->read_depth);
+
+    print_debug(_("Save worker %u reads files with %s\n"), number, reader_get_engine_name(worker->reader));
+
+    name = g_strdup_printf("save_one_file-%u", number);
+    worker->thread = g_thread_new(name, save_one_file_threaded, worker);
+    free_variable(name);
+
+    return worker;
+}
+
+
+/**
+ * Saves a request that a save worker could not send to the server into
+ * its database: it will be transmitted again later.
+ * @param user_data MUST be a save_worker_t * pointer. It is called from
+ *        this worker's thread so its own database may be used.
+ * @param url is the url of the request.
+ * @param body is the body of the request.
+ * @param length is the length of body.
+ */
+static void save_failed_post(gpointer user_data, gchar *url, gchar *body, gsize length)
+{
+    save_worker_t *worker = (save_worker_t *) user_data;
+
+    if (worker != NULL)
+        {
+            /* The spool keeps the body as it is (binary frames included)
+             * with its url that tells its content type when it is sent again.
+             */
+            db_save_buffer(worker->database, url, body, length);
+            signal_reconnection(worker->main_struct->reconnect, FALSE);
+        }
+}
+
+
+/**
+ * Starts opt->save_workers threads that will save files popped from
+ * save_queue concurrently.
+ * @param main_struct : main structure of the program. save_queue must
+ *        already exist.
+ * @param conn is the connexion string to the server.
+ */
+static void start_save_workers(main_struct_t *main_struct, gchar *conn)
+{
+    save_worker_t *worker = NULL;
+    guint i = 0;
+    guint nb_workers = 1;
+
+    g_assert_nonnull(main_struct);
+    g_assert_nonnull(main_struct->opt);
+
+    if (main_struct->opt->save_workers > 0)
+        {
+            nb_workers = main_struct->opt->save_workers;
+        }
+
+    main_struct->save_workers = g_ptr_array_sized_new(nb_workers);
+
+    for (i = 0; i < nb_workers; i++)
+        {
+            worker = new_save_worker_t(main_struct, conn, i);
+            g_ptr_array_add(main_struct->save_workers, worker);
+        }
+
+    print_debug(_("%u save worker(s) started\n"), nb_workers);
+}
+
+
 /**
  * Inits the main structure.
  * @note With sqlite version > 3.7.7 we should use URI filename.
@@ -131,6 +254,22 @@ static main_struct_t *init_main_structure(options_t *opt)
     g_assert_nonnull(main_struct);
 
     main_struct->database = open_database(opt->dircache, opt->dbname);
+    main_struct->file_cache = new_file_cache_t(main_struct->database);
+    db_set_file_cache(main_struct->database, main_struct->file_cache);
+    main_struct->spool = new_spool_t(opt->dircache);
+    db_set_spool(main_struct->database, main_struct->spool);
+    db_set_durability(main_struct->database, opt->db_durability);
+
+    /* Saved files are grouped into periodic transactions unless each one has to be synced */
+    if (opt->db_durability != DATABASE_DURABILITY_FULL)
+        {
+            main_struct->writer = new_db_writer_t(opt->dircache, opt->dbname, opt->db_durability);
+        }
+    else
+        {
+            main_struct->writer = NULL;
+        }
+    db_set_writer(main_struct->database, main_struct->writer);
 
     main_struct->opt = opt;
     main_struct->hostname = g_get_host_name();
@@ -138,29 +277,64 @@ static main_struct_t *init_main_structure(options_t *opt)
     if (opt->srv_conf != NULL)
         {
             conn = make_connexion_string(opt->srv_conf);
-            main_struct->comm = init_comm_struct(conn, opt->cmptype);
             main_struct->reconnected = init_comm_struct(conn, opt->cmptype);
-            free_variable(conn);
         }
     else
         {
             /* This should never happen because we have default values */
-            main_struct->comm = NULL;
+            main_struct->reconnected = NULL;
         }
 
     main_struct->fanotify_fd = start_fanotify(opt);
+    main_struct->fanotify_stop_fd = eventfd(0, EFD_CLOEXEC);
 
-    /* inits the queue that will wait for events on files */
-    main_struct->save_queue = g_async_queue_new();
+    /* inits the scheduler that will wait for events on files */
+    main_struct->save_queue = new_save_scheduler_t();
     main_struct->dir_queue = g_async_queue_new();
     main_struct->regex_exclude_list = make_regex_exclude_list(opt->exclude_list);
 
+    if (opt->cdc == TRUE)
+        {
+            main_struct->cdc_params = new_cdc_params_t(opt->cdc_min_size, opt->cdc_avg_size, opt->cdc_max_size);
+        }
+    else
+        {
+            main_struct->cdc_params = NULL;
+        }
+
+    main_struct->budget = new_memory_budget_t(opt->memory_budget);
+
+    /* Compression levels must be set before any thread compresses blocks */
+    set_compress_level(COMPRESS_ZLIB_TYPE, opt->zlib_level);
+    set_compress_level(COMPRESS_ZSTD_TYPE, opt->zstd_level);
+    set_compress_level(COMPRESS_LZ4_TYPE, opt->lz4_level);
+
+    if (opt->http_connections > 0)
+        {
+            main_struct->transport = new_transport_t(opt->http_connections);
+        }
+    else
+        {
+            main_struct->transport = NULL;
+        }
+
+    /* Spooled requests are transmitted with several uploads in flight */
+    main_struct->reconnect = new_reconnect_t();
+    set_comm_transport(main_struct->reconnected, main_struct->transport, opt->http_in_flight);
+
     /* Thread initialization */
-    main_struct->save_one_file = g_thread_new("save_one_file", save_one_file_threaded, main_struct);
+    start_save_workers(main_struct, conn);
+    g_mutex_init(&main_struct->carve_mutex);
+    main_struct->carve_stopped = FALSE;
+    main_struct->owners = new_owner_cache_t();
+    main_struct->carve_pool = g_thread_pool_new(carve_one_directory, main_struct, opt->carve_workers, FALSE, NULL);
     main_struct->carve_all_directories = g_thread_new("carve_all_directories", carve_all_directories, main_struct);
     main_struct->reconn_thread = g_thread_new("reconnected", reconnected, main_struct);
+    start_event_coalescer(main_struct);
     main_struct->fanotify_loop = g_thread_new("fanotify-loop", fanotify_loop_thread, main_struct);
 
+    free_variable(conn);
+
     /* Main loop creation (used to trap signals into main loop run) */
     main_struct->loop = g_main_loop_new(g_main_context_default(), FALSE);
 
@@ -170,65 +344,92 @@ static main_struct_t *init_main_structure(options_t *opt)
 }
 
 
+/**
+ * Makes the hash_data_t structure of a block read from a file. A block
+ * made only of zeros (a hole for instance) gets the reserved zero block
+ * hash: it is neither hashed nor compressed and its data is dropped as
+ * it will never be sent.
+ * @param buffer is the block read (it is owned by the returned
+ *        structure or freed here).
+ * @param size_read is the length of the block.
+ * @param a_hash is a HASH_LEN buffer that receives the hash (it is owned
+ *        by the returned structure).
+ * @param probe follows how well the file compresses: it gives the
+ *        compression type to be used and is updated with the result.
+ * @returns a newly allocated hash_data_t structure.
+ */
+static hash_data_t *make_hash_data_for_block(guchar *buffer, gssize size_read, guint8 *a_hash, compress_probe_t *probe)
+{
+    hash_data_t *hash_data = NULL;
+
+    if (is_zero_block(buffer, size_read) == TRUE)
+        {
+            make_zero_block_hash(a_hash, size_read);
+            hash_data = new_hash_data_t_as_is(NULL, size_read, a_hash, COMPRESS_NONE_TYPE, size_read);
+            free_variable(buffer);
+        }
+    else
+        {
+            sha256_digest(buffer, size_read, a_hash);
+
+            /* Need to save data and read in hash_data_t structure */
+            hash_data = new_hash_data_t(buffer, size_read, a_hash, probe->cmptype);
+            account_compressed_block(probe, hash_data->cmptype);
+
+            if (hash_data->data != buffer)
+                {
+                    free_variable(buffer); /* buffer has been compressed and is no longer needed in the program */
+                }
+        }
+
+    return hash_data;
+}
+
+
 /**
  * Calculates hashs for each block of blocksize bytes long on the file
  * and returns a list of all hashs in correct order stored in a binary
  * form to save space.
- * @note This technique has some limits in term of memory footprint
- *       because one file is entirely in memory at a time. Saving huge
- *       files may not be possible with this, depending on the size of
- *       the file and the size of the memory.
- * @todo Imagine a new way to checksum huge files because of limitations.
- *       May be with the local sqlite database ?
+ * @note The whole file is in memory at a time: this is only used for
+ *       files that fit into the window reserved in the memory budget
+ *       (see save_one_file()).
+ * @param reader is the reader used to read the file.
  * @param a_file is the file from which we want the hashs.
  * @param blocksize is the blocksize to be used to calculate hashs upon.
+ * @param cdc_params are the content defined chunking parameters. If NULL
+ *        blocks of blocksize bytes are used.
+ * @param cmptype is the compression type to be used.
  * @returns a GSList * list of hashs stored in a binary form.
  */
-static GList *calculate_hash_data_list_for_file(GFile *a_file, gint64 blocksize, gshort cmptype)
+static GList *calculate_hash_data_list_for_file(reader_t *reader, GFile *a_file, gint64 blocksize, cdc_params_t *cdc_params, gshort cmptype)
 {
-    GFileInputStream *stream = NULL;
+    chunker_t *chunker = NULL;
     GError *error = NULL;
     GList *hash_data_list = NULL;
     hash_data_t *hash_data = NULL;
     gssize size_read = 0;
     guchar *buffer = NULL;
-    GChecksum *checksum = NULL;
     guint8 *a_hash = NULL;
     gsize digest_len = HASH_LEN;
+    compress_probe_t probe;
 
     if (a_file != NULL)
         {
-            stream = g_file_read(a_file, NULL, &error);
-
-            if (stream != NULL && error == NULL)
+            if (reader_open(reader, a_file, &error) == TRUE)
                 {
-
-                    checksum = g_checksum_new(G_CHECKSUM_SHA256);
-                    buffer = (guchar *) g_malloc(blocksize);
+                    chunker = new_chunker_t(reader, blocksize, cdc_params);
+                    init_compress_probe(&probe, cmptype);
                     a_hash = (guint8 *) g_malloc(digest_len);
 
-                    size_read = g_input_stream_read((GInputStream *) stream, buffer, blocksize, NULL, &error);
+                    size_read = chunker_read(chunker, &buffer, &error);
 
-                    while (size_read != 0 && error == NULL)
+                    while (size_read > 0 && error == NULL)
                         {
-                            g_checksum_update(checksum, buffer, size_read);
-                            g_checksum_get_digest(checksum, a_hash, &digest_len);
-
-                            /* Need to save data and read in hash_data_t structure */
-                            hash_data = new_hash_data_t(buffer, size_read, a_hash, cmptype);
-                            if (cmptype != COMPRESS_NONE_TYPE)
-                                {
-                                    free_variable(buffer); /* buffer has been compressed and is no longer needed in the program */
-                                }
-
+                            hash_data = make_hash_data_for_block(buffer, size_read, a_hash, &probe);
                             hash_data_list = g_list_prepend(hash_data_list, hash_data);
-                            g_checksum_reset(checksum);
-                            digest_len = HASH_LEN;
-
-                            buffer = (guchar *) g_malloc(blocksize);
                             a_hash = (guint8 *) g_malloc(digest_len);
 
-                            size_read = g_input_stream_read((GInputStream *) stream, buffer, blocksize, NULL, &error);
+                            size_read = chunker_read(chunker, &buffer, &error);
                         }
 
                     if (error != NULL)
@@ -246,10 +447,8 @@ static GList *calculate_hash_data_list_for_file(GFile *a_file, gint64 blocksize,
 
                     free_variable(buffer);
                     free_variable(a_hash);
-
-                    g_checksum_free(checksum);
-                    g_input_stream_close((GInputStream *) stream, NULL, NULL);
-                    free_object(stream);
+                    free_chunker_t(chunker);
+                    reader_close(reader);
                 }
             else
                 {
@@ -357,13 +556,13 @@ static meta_data_t *get_meta_data_from_fileinfo(file_event_t *file_event, filter
 /**
  * Sends meta data to the server and returns it's answer or NULL in
  * case of an error.
- * @param main_struct : main structure of the program (contains pointers
- *        to the communication socket.
+ * @param worker : the save worker that processes this file (contains
+ *        pointers to its own communication handle and database).
  * @param meta : the meta_data_t * structure to be saved.
  * @returns a newly allocated gchar * string that may be freed when no
  *          longer needed.
  */
-static gchar *send_meta_data_to_server(main_struct_t *main_struct, meta_data_t *meta, gboolean data_sent)
+static gchar *send_meta_data_to_server(save_worker_t *worker, meta_data_t *meta, gboolean data_sent)
 {
     gchar *json_str = NULL;
     gchar *answer = NULL;
@@ -371,27 +570,29 @@ static gchar *send_meta_data_to_server(main_struct_t *main_struct, meta_data_t *
     json_t *root = NULL;
     json_t *array = NULL;
 
-    g_assert_nonnull(main_struct);
+    g_assert_nonnull(worker);
 
-    if (meta != NULL && main_struct->hostname != NULL)
+    if (meta != NULL && worker->main_struct->hostname != NULL)
         {
-            json_str = convert_meta_data_to_json_string(meta, main_struct->hostname, data_sent);
+            json_str = convert_meta_data_to_json_string(meta, worker->main_struct->hostname, data_sent);
 
             /* Sends meta data here: readbuffer is the buffer sent to server */
             print_debug(_("Sending meta data: %s\n"), json_str);
-            main_struct->comm->readbuffer = json_str;
-            success = post_url(main_struct->comm, "/Meta.json");
+            worker->comm->readbuffer = json_str;
+            success = post_url(worker->comm, "/Meta.json");
 
             if (success == CURLE_OK)
                 {
-                    answer = g_strdup(main_struct->comm->buffer);
-                    free_variable(main_struct->comm->buffer);
+                    answer = g_strdup(worker->comm->buffer);
+                    free_variable(worker->comm->buffer);
+                    wake_up_reconnection(worker->main_struct);
                 }
             else
                 {
                     /* Need to manage HTTP errors ? */
-                    /* Saving meta data that should have been sent to sqlite database */
-                    db_save_buffer(main_struct->database, "/Meta.json", main_struct->comm->readbuffer);
+                    /* Saving meta data that should have been sent into the spool */
+                    db_save_buffer(worker->database, "/Meta.json", worker->comm->readbuffer, strlen(worker->comm->readbuffer));
+                    signal_reconnection(worker->main_struct->reconnect, FALSE);
 
                     /* An error occured -> we need the whole hash list to be saved
                      * we are building a 'fake' answer with the whole hash list.
@@ -403,7 +604,7 @@ static gchar *send_meta_data_to_server(main_struct_t *main_struct, meta_data_t *
                     json_decref(root);
                 }
 
-            free_variable(main_struct->comm->readbuffer);
+            free_variable(worker->comm->readbuffer);
         }
 
     return answer;
@@ -411,78 +612,40 @@ static gchar *send_meta_data_to_server(main_struct_t *main_struct, meta_data_t *
 
 
 /**
- * Finds a hash in the hash data list and returns the hash_data_t that
- * corresponds to it. In normal operations it should always find
- * something.
- * @param hash_data_list is the list to look into for the hash 'hash'
- * @param hash is the hash to look for.
- * @returns the GList * pointer that contains hash_data_t structure that
- *          corresponds to the hash 'hash'.
+ * Sends blocks to the server in one request and then frees them. Blocks
+ * are sent as binary frames to /Data_Array.bin when the server speaks
+ * this protocol and base64 encoded into /Data_Array.json otherwise. The
+ * body is streamed from the blocks themselves: it is never built in
+ * memory. The request is sent asynchronously when the worker may have
+ * uploads in flight: if it fails it is saved into the worker's database
+ * by save_failed_post().
+ * @param worker : the save worker (with its own database and comm handles).
+ * @param blocks is a GList of hash_data_t * blocks to be sent (the list
+ *        and its blocks are freed once the request is done).
  */
-static GList *find_hash_in_list(GList *hash_data_list, guint8 *hash)
+static gint send_blocks_to_server(save_worker_t *worker, GList *blocks)
 {
-    GList *iter = hash_data_list;
-    hash_data_t *found = NULL;
-    gboolean ok = FALSE;
+    gint success = CURLE_FAILED_INIT;
+    block_stream_t *stream = NULL;
 
-    while (iter != NULL && ok == FALSE)
-        {
-            found = iter->data;
+    g_assert_nonnull(worker);
 
-            if (compare_two_hashs(hash, found->hash) == 0)
+    if (worker->comm != NULL && blocks != NULL)
+        {
+            if (does_server_speak_binary(worker->comm) == TRUE)
                 {
-                    ok = TRUE;
+                    stream = new_block_stream_t(blocks, TRUE);
+                    success = post_blocks_async(worker->comm, "/Data_Array.bin", stream);
                 }
             else
                 {
-                   iter = g_list_next(iter);
+                    stream = new_block_stream_t(blocks, FALSE);
+                    success = post_blocks_async(worker->comm, "/Data_Array.json", stream);
                 }
         }
-
-    if (ok == TRUE)
-        {
-            return iter;
-        }
     else
         {
-            return NULL;
-        }
-}
-
-
-/**
- * Inserts the array into a root json_t * structure and dumps it into a
- * buffer that is send to the server and then freed.
- * @param main_struct : main structure of the program.
- * @param array is the json_t * array to be sent to the server
- */
-static gint insert_array_in_root_and_send(main_struct_t *main_struct, json_t *array)
-{
-    json_t *root = NULL;
-    gint success = CURLE_FAILED_INIT;
-
-    g_assert_nonnull(main_struct);
-
-    if (main_struct->comm != NULL && array != NULL)
-        {
-
-            root = json_object();
-            insert_json_value_into_json_root(root, "data_array", array);
-
-            /* readbuffer is the buffer sent to server */
-            main_struct->comm->readbuffer = json_dumps(root, 0);
-
-            success = post_url(main_struct->comm, "/Data_Array.json");
-
-            if (success != CURLE_OK)
-                {
-                    db_save_buffer(main_struct->database, "/Data_Array.json", main_struct->comm->readbuffer);
-                }
-
-            free_variable(main_struct->comm->readbuffer);
-            json_decref(root);
-            free_variable(main_struct->comm->buffer);
-
+            g_list_free_full(blocks, free_hdt_struct);
         }
 
     return success;
@@ -491,34 +654,34 @@ static gint insert_array_in_root_and_send(main_struct_t *main_struct, json_t *ar
 
 /**
  * Sends data as requested by the server 'cdpfglserver' in a buffered way.
- * @param main_struct : main structure of the program.
+ * @param worker : the save worker (with its own database and comm handles).
  * @param hash_data_list : list of hash_data_t * pointers containing
  *                          all the data to be saved.
  * @param answer is the request sent back by server when we had send
  *        meta data.
- * @note using directly main_struct->comm->buffer -> not threadable as is.
+ * @note uses worker->comm->buffer directly: each worker owns its comm_t.
  */
-static GList *send_all_data_to_server(main_struct_t *main_struct, GList *hash_data_list, gchar *answer)
+static GList *send_all_data_to_server(save_worker_t *worker, GList *hash_data_list, gchar *answer)
 {
     json_t *root = NULL;
-    json_t *array = NULL;
+    GList *blocks = NULL;         /** blocks to be sent in the next request (in reverse order)                                 */
     GList *hash_list = NULL;      /** hash_list is local to this function and contains the needed hashs as answered by server */
     GList *head = NULL;
     GList *iter = NULL;
+    GHashTable *index = NULL;     /** index of hash_data_list: hash -> GList * element                                         */
     hash_data_t *found = NULL;
     hash_data_t *hash_data = NULL;
     gint bytes = 0;
-    json_t *to_insert = NULL;
     gint64 limit = 0;
     a_clock_t *elapsed = NULL;
 
-    g_assert_nonnull(main_struct);
+    g_assert_nonnull(worker);
 
-    if (answer != NULL && hash_data_list != NULL && main_struct->opt != NULL)
+    if (answer != NULL && hash_data_list != NULL && worker->main_struct->opt != NULL)
         {
             root = load_json(answer);
 
-            limit = main_struct->opt->buffersize;
+            limit = worker->buffersize;
 
             if (root != NULL)
                 {
@@ -526,54 +689,52 @@ static GList *send_all_data_to_server(main_struct_t *main_struct, GList *hash_da
                     hash_list = extract_glist_from_array(root, "hash_list", TRUE);
                     json_decref(root);
 
-                    array = json_array();
-
                     head = hash_list;
 
+                    /* hash_data_list contains all hashs and their associated data for the file
+                     * being processed: indexing it makes each lookup below O(1) */
+                    index = make_hash_data_list_index(hash_data_list);
+
                     while (hash_list != NULL)
                         {
                             hash_data = hash_list->data;
-                            /* hash_data_list contains all hashs and their associated data for the file
-                             * being processed */
-                            iter = find_hash_in_list(hash_data_list, hash_data->hash);
-                            found = iter->data;
+                            iter = g_hash_table_lookup(index, hash_data->hash);
 
-                            to_insert = convert_hash_data_t_to_json(found);
-                            json_array_append_new(array, to_insert);
-
-                            bytes = bytes + found->read;
-
-                            hash_data_list = g_list_remove_link(hash_data_list, iter);
-                            /* iter is now a single element list and we can delete
-                             * data in this element and then remove this single element list
-                             */
-                            g_list_free_full(iter, free_hdt_struct);
+                            if (iter != NULL)
+                                {
+                                    found = iter->data;
+                                    bytes = bytes + found->read;
+
+                                    /* The key is found->hash: remove it before found is freed */
+                                    g_hash_table_remove(index, hash_data->hash);
+                                    hash_data_list = g_list_remove_link(hash_data_list, iter);
+                                    /* iter is now a single element list that is moved to blocks */
+                                    blocks = g_list_concat(iter, blocks);
+                                }
 
                             if (bytes >= limit)
                                 {
                                     /* when we've got opt->buffersize bytes of data send them ! */
                                     elapsed = new_clock_t();
-                                    insert_array_in_root_and_send(main_struct, array);
-                                    array = json_array();
+                                    send_blocks_to_server(worker, g_list_reverse(blocks));
+                                    blocks = NULL;
                                     bytes = 0;
-                                    end_clock(elapsed, "insert_array_in_root_and_send");
+                                    end_clock(elapsed, "send_blocks_to_server");
                                 }
 
                             hash_list = g_list_next(hash_list);
                         }
 
-                    if (bytes > 0)
+                    if (blocks != NULL)
                         {
                             /* Send the rest of the data (less than opt->buffersize bytes) */
                             elapsed = new_clock_t();
-                            insert_array_in_root_and_send(main_struct, array);
-                            end_clock(elapsed, "insert_array_in_root_and_send");
-                        }
-                    else
-                        {
-                            json_decref(array);
+                            send_blocks_to_server(worker, g_list_reverse(blocks));
+                            end_clock(elapsed, "send_blocks_to_server");
                         }
 
+                    g_hash_table_destroy(index);
+
                     if (head != NULL)
                         {
                             g_list_free_full(head, free_hdt_struct);
@@ -591,27 +752,31 @@ static GList *send_all_data_to_server(main_struct_t *main_struct, GList *hash_da
 
 /**
  * Sends data as requested by the server 'cdpfglserver'.
- * @param main_struct : main structure of the program.
+ * @param worker : the save worker (with its own database and comm handles).
  * @param hash_data_list : list of hash_data_t * pointers containing
  *                          all the data to be saved.
  * @param answer is the request sent back by server when we had send
  *        meta data.
- * @note using directly main_struct->comm->buffer -> not threadable as is.
+ * @note uses worker->comm->buffer directly: each worker owns its comm_t.
  */
-static GList *send_data_to_server(main_struct_t *main_struct, GList *hash_data_list, gchar *answer)
+static GList *send_data_to_server(save_worker_t *worker, GList *hash_data_list, gchar *answer)
 {
     json_t *root = NULL;
     GList *hash_list = NULL;         /** hash_list is local to this function */
+    GList *blocks = NULL;            /** blocks to be sent as binary frames (in reverse order) */
     GList *head = NULL;
-    gint success = CURLE_FAILED_INIT;
     GList *iter = NULL;
+    GHashTable *index = NULL;        /** index of hash_data_list: hash -> GList * element */
     hash_data_t *found = NULL;
     hash_data_t *hash_data = NULL;
+    gboolean binary = FALSE;
 
-    g_assert_nonnull(main_struct);
+    g_assert_nonnull(worker);
 
-    if (main_struct->comm != NULL && answer != NULL &&  hash_data_list!= NULL)
+    if (worker->comm != NULL && answer != NULL &&  hash_data_list!= NULL)
         {
+            binary = does_server_speak_binary(worker->comm);
+
             root = load_json(answer);
 
             if (root != NULL)
@@ -621,34 +786,50 @@ static GList *send_data_to_server(main_struct_t *main_struct, GList *hash_data_l
                     json_decref(root);
                     head = hash_list;
 
+                    /* hash_data_list contains all hashs and their associated data */
+                    index = make_hash_data_list_index(hash_data_list);
+
                     while (hash_list != NULL)
                         {
                             hash_data = hash_list->data;
-                            /* hash_data_list contains all hashs and their associated data */
-                            iter = find_hash_in_list(hash_data_list, hash_data->hash);
-                            found = iter->data;
-
-                            /* readbuffer is the buffer sent to server  */
-                            main_struct->comm->readbuffer = convert_hash_data_t_to_string(found);
-                            success = post_url(main_struct->comm, "/Data.json");
+                            iter = g_hash_table_lookup(index, hash_data->hash);
 
-                            if (success != CURLE_OK)
+                            if (iter != NULL)
                                 {
-                                    db_save_buffer(main_struct->database, "/Data.json", main_struct->comm->readbuffer);
-                                }
+                                    found = iter->data;
 
-                            free_variable(main_struct->comm->readbuffer);
+                                    /* The key is found->hash: remove it before freeing found */
+                                    g_hash_table_remove(index, hash_data->hash);
+                                    hash_data_list = g_list_remove_link(hash_data_list, iter);
 
-                            hash_data_list = g_list_remove_link(hash_data_list, iter);
-                            /* iter is now a single element list and we can delete
-                             * data in this element and then remove this single element list
-                             */
-                            g_list_free_full(iter, free_hdt_struct);
+                                    if (binary == TRUE)
+                                        {
+                                            /* iter is now a single element list that is moved to blocks */
+                                            blocks = g_list_concat(iter, blocks);
+                                        }
+                                    else
+                                        {
+                                            /* readbuffer is the buffer sent to server  */
+                                            worker->comm->readbuffer = convert_hash_data_t_to_string(found);
+                                            post_url_async(worker->comm, "/Data.json");
+
+                                            /* iter is now a single element list and we can delete
+                                             * data in this element and then remove this single element list
+                                             */
+                                            g_list_free_full(iter, free_hdt_struct);
+                                        }
+                                }
 
-                            free_variable(main_struct->comm->buffer);
                             hash_list = g_list_next(hash_list);
                         }
 
+                    g_hash_table_destroy(index);
+
+                    if (blocks != NULL)
+                        {
+                            send_blocks_to_server(worker, g_list_reverse(blocks));
+                        }
+
                     if (head != NULL)
                         {
                             g_list_free_full(head, free_hdt_struct);
@@ -670,8 +851,10 @@ static GList *send_data_to_server(main_struct_t *main_struct, GList *hash_data_l
  *          with free_file_event_t() when no longer needed
  * @param directory is the directory where the event occured
  * @param fileinfo is fileinfo of the file on which the event occured
+ * @param carved is TRUE when the file has been found while carving
+ *        directories and FALSE when it comes from fanotify.
  */
-file_event_t *new_file_event_t(gchar *directory, GFileInfo *fileinfo)
+file_event_t *new_file_event_t(gchar *directory, GFileInfo *fileinfo, gboolean carved)
 {
     file_event_t *file_event = NULL;
 
@@ -681,6 +864,7 @@ file_event_t *new_file_event_t(gchar *directory, GFileInfo *fileinfo)
 
     file_event->directory = g_strdup(directory);
     file_event->fileinfo = g_file_info_dup(fileinfo);
+    file_event->carved = carved;
 
     return file_event;
 }
@@ -745,23 +929,29 @@ static void free_filter_file_t(filter_file_t *filter)
 
 /**
  * Threaded function that saves one file by getting it's meta-data and
- * it's data and sends them to the server in order to be saved.
- * @param data must be main_struct_t * pointer.
+ * it's data and sends them to the server in order to be saved. Many of
+ * these threads may run concurrently: each one pops file_event_t
+ * structures from the same save_queue until it is stopped.
+ * @param data must be a save_worker_t * pointer.
+ * @returns NULL.
  */
 static gpointer save_one_file_threaded(gpointer data)
 {
-    main_struct_t *main_struct = (main_struct_t *) data;
+    save_worker_t *worker = (save_worker_t *) data;
     file_event_t *file_event = NULL;
 
-    g_assert_nonnull(main_struct);
+    g_assert_nonnull(worker);
+    g_assert_nonnull(worker->main_struct);
 
-    if (main_struct->save_queue != NULL)
+    if (worker->main_struct->save_queue != NULL)
         {
-            while (1)
+            file_event = pop_from_save_scheduler(worker->main_struct->save_queue);
+
+            while (file_event != NULL)
                 {
-                    file_event = g_async_queue_pop(main_struct->save_queue);
-                    save_one_file(main_struct, file_event);
+                    save_one_file(worker, file_event);
                     free_file_event_t(file_event);
+                    file_event = pop_from_save_scheduler(worker->main_struct->save_queue);
                 }
         }
 
@@ -777,7 +967,12 @@ static gpointer save_one_file_threaded(gpointer data)
 static gint64 calculate_file_blocksize(options_t *opt, gint64 size)
 {
 
-    if (opt != NULL && opt->adaptive == TRUE)
+    if (opt != NULL && opt->cdc == TRUE)
+        {
+            /* Blocks are content defined and at most cdc_max_size bytes long */
+            return opt->cdc_max_size;
+        }
+    else if (opt != NULL && opt->adaptive == TRUE)
         {
             if (size < 32768)            /* max 64 blocks       */
                 {
@@ -801,12 +996,10 @@ static gint64 calculate_file_blocksize(options_t *opt, gint64 size)
                 }
             else if (size < 134217728)   /* max 1024 blocks     */
                 {
-                    opt->buffersize = (CLIENT_MIN_BUFFER) * 2;
                     return 131072;
                 }
             else                         /* at least 512 blocks */
                 {
-                    opt->buffersize = (CLIENT_MIN_BUFFER) * 4;
                     return 262144;
                 }
         }
@@ -823,13 +1016,43 @@ static gint64 calculate_file_blocksize(options_t *opt, gint64 size)
 }
 
 
+/**
+ * Calculates the buffer size to be used when sending a file to the
+ * server. In adaptive mode big files get a bigger buffer. The value is
+ * returned instead of being stored into opt because many save workers
+ * may run at the same time.
+ * @param opt are the selected options for the program.
+ * @param size is the size of the considered file.
+ * @returns the number of bytes to accumulate before sending them.
+ */
+static gint calculate_file_buffersize(options_t *opt, gint64 size)
+{
+    if (opt != NULL && opt->adaptive == TRUE && size >= 134217728)
+        {
+            return (CLIENT_MIN_BUFFER) * 4;
+        }
+    else if (opt != NULL && opt->adaptive == TRUE && size >= 67108864)
+        {
+            return (CLIENT_MIN_BUFFER) * 2;
+        }
+    else if (opt != NULL)
+        {
+            return opt->buffersize;
+        }
+    else
+        {
+            return CLIENT_MIN_BUFFER;
+        }
+}
+
+
 /**
  * Process the file that is not already in our local cache
- * @param main_struct : main structure of the program
+ * @param worker : the save worker (with its own database and comm handles)
  * @param meta is the meta data of the file to be processed (it does
  *             not contain any hashs at that point).
  */
-static void process_small_file_not_in_cache(main_struct_t *main_struct, meta_data_t *meta)
+static void process_small_file_not_in_cache(save_worker_t *worker, meta_data_t *meta)
 {
     GFile *a_file = NULL;
     gchar *answer = NULL;
@@ -837,11 +1060,11 @@ static void process_small_file_not_in_cache(main_struct_t *main_struct, meta_dat
     a_clock_t *mesure_time = NULL;
     gshort cmptype = COMPRESS_NONE_TYPE;
 
-    g_assert_nonnull(main_struct);
+    g_assert_nonnull(worker);
 
-    if (main_struct->opt != NULL && meta != NULL)
+    if (worker->main_struct->opt != NULL && meta != NULL)
         {
-            cmptype = main_struct->opt->cmptype;
+            cmptype = worker->main_struct->opt->cmptype;
 
             print_debug(_("Processing small file: %s\n"), meta->name);
 
@@ -851,26 +1074,26 @@ static void process_small_file_not_in_cache(main_struct_t *main_struct, meta_dat
 
                     /* Calculates hashs and takes care of data */
                     a_file = g_file_new_for_path(meta->name);
-                    meta->hash_data_list = calculate_hash_data_list_for_file(a_file, meta->blocksize, cmptype);
+                    meta->hash_data_list = calculate_hash_data_list_for_file(worker->reader, a_file, meta->blocksize, worker->main_struct->cdc_params, cmptype);
                     free_object(a_file);
 
                     end_clock(mesure_time, "calculate_hash_data_list");
                 }
 
             mesure_time = new_clock_t();
-            answer = send_meta_data_to_server(main_struct, meta, FALSE);
+            answer = send_meta_data_to_server(worker, meta, FALSE);
             end_clock(mesure_time, "send_meta_data_to_server");
 
             mesure_time = new_clock_t();
             if (meta->size < meta->blocksize)
                 {
                     /* Only one block to send (size is less than blocksize's value) */
-                     meta->hash_data_list = send_data_to_server(main_struct, meta->hash_data_list, answer);
+                     meta->hash_data_list = send_data_to_server(worker, meta->hash_data_list, answer);
                 }
             else
                 {
                     /* A least 2 blocks to send */
-                    meta->hash_data_list = send_all_data_to_server(main_struct, meta->hash_data_list, answer);
+                    meta->hash_data_list = send_all_data_to_server(worker, meta->hash_data_list, answer);
                 }
             end_clock(mesure_time, "send_(all)_data_to_server");
 
@@ -881,7 +1104,7 @@ static void process_small_file_not_in_cache(main_struct_t *main_struct, meta_dat
                     /* Everything has been transmitted so we can save meta data into the local db cache */
                     /* This is usefull for file carving to avoid sending too much things to the server  */
                     mesure_time = new_clock_t();
-                    db_save_meta_data(main_struct->database, meta, TRUE);
+                    db_save_meta_data(worker->database, meta, TRUE);
                     end_clock(mesure_time, "db_save_meta_data");
                 }
         }
@@ -938,7 +1161,16 @@ static gchar *send_hash_array_to_server(comm_t *comm, GList *hash_data_list)
 }
 
 
-static GList *lets_send_all_that_now(main_struct_t *main_struct, GList *hash_data_list, GList *saved_list, gsize read_bytes)
+/**
+ * Saves the hashs of the list, asks the server which ones it needs and
+ * sends the corresponding data.
+ * @param worker : the save worker (with its own database and comm handles)
+ * @param hash_data_list : list of hash_data_t * to be sent (freed here).
+ * @param saved_list : list of hashs already sent for this file.
+ * @param read_bytes : number of bytes read for this hash_data_list.
+ * @returns saved_list with hashs of hash_data_list prepended.
+ */
+static GList *lets_send_all_that_now(save_worker_t *worker, GList *hash_data_list, GList *saved_list, gsize read_bytes)
 {
     GList *hdl_copy = NULL;
     a_clock_t *elapsed = NULL;
@@ -951,10 +1183,10 @@ static GList *lets_send_all_that_now(main_struct_t *main_struct, GList *hash_dat
     saved_list = g_list_concat(hdl_copy, saved_list);
 
     /* 1. Send an array of hashs to Hash_Array.json server url */
-    answer = send_hash_array_to_server(main_struct->comm, hash_data_list);
+    answer = send_hash_array_to_server(worker->comm, hash_data_list);
 
     /* 2. Keep only hashs that are needed (answer from the server) */
-    hash_data_list = send_all_data_to_server(main_struct, hash_data_list, answer);
+    hash_data_list = send_all_data_to_server(worker, hash_data_list, answer);
 
     /* 3. free memory of this list if any is left */
     g_list_free_full(hash_data_list, free_hdt_struct);
@@ -967,79 +1199,69 @@ static GList *lets_send_all_that_now(main_struct_t *main_struct, GList *hash_dat
 
 /**
  * Process the file that is not already in our local cache
- * @param main_struct : main structure of the program
+ * @param worker : the save worker (with its own database and comm handles)
  * @param meta is the meta data of the file to be processed (it does
  *             not contain any hashs at that point).
  */
-static void process_big_file_not_in_cache(main_struct_t *main_struct, meta_data_t *meta)
+static void process_big_file_not_in_cache(save_worker_t *worker, meta_data_t *meta)
 {
     GFile *a_file = NULL;
     gchar *answer = NULL;
-    GFileInputStream *stream = NULL;
+    chunker_t *chunker = NULL;
     GError *error = NULL;
     GList *hash_data_list = NULL;
     GList *saved_list = NULL;
     hash_data_t *hash_data = NULL;
     gssize size_read = 0;
     guchar *buffer = NULL;
-    GChecksum *checksum = NULL;
     guint8 *a_hash = NULL;
     gsize digest_len = HASH_LEN;
+    compress_probe_t probe;
     gsize read_bytes = 0;
     a_clock_t *elapsed = NULL;
     gshort cmptype = COMPRESS_NONE_TYPE;
 
-    g_assert_nonnull(main_struct);
+    g_assert_nonnull(worker);
 
-    if (main_struct->opt != NULL && meta != NULL)
+    if (worker->main_struct->opt != NULL && meta != NULL)
         {
-            cmptype = main_struct->opt->cmptype;
+            cmptype = worker->main_struct->opt->cmptype;
 
             a_file = g_file_new_for_path(meta->name);
             print_debug(_("Processing file: %s\n"), meta->name);
 
             if (a_file != NULL)
                 {
-                    stream = g_file_read(a_file, NULL, &error);
-
-                    if (stream != NULL && error == NULL)
+                    if (reader_open(worker->reader, a_file, &error) == TRUE)
                         {
-
-                            checksum = g_checksum_new(G_CHECKSUM_SHA256);
-                            buffer = (guchar *) g_malloc(meta->blocksize);
+                            chunker = new_chunker_t(worker->reader, meta->blocksize, worker->main_struct->cdc_params);
+                            init_compress_probe(&probe, cmptype);
                             a_hash = (guint8 *) g_malloc(digest_len);
 
-                            size_read = g_input_stream_read((GInputStream *) stream, buffer, meta->blocksize, NULL, &error);
-                            read_bytes = read_bytes + size_read;
+                            size_read = chunker_read(chunker, &buffer, &error);
 
-                            while (size_read != 0 && error == NULL)
+                            while (size_read > 0 && error == NULL)
                                 {
-                                    g_checksum_update(checksum, buffer, size_read);
-                                    g_checksum_get_digest(checksum, a_hash, &digest_len);
-
                                     /* Need to save 'data', 'read' and digest hash in an hash_data_t structure */
-                                    hash_data = new_hash_data_t(buffer, size_read, a_hash, cmptype);
+                                    hash_data = make_hash_data_for_block(buffer, size_read, a_hash, &probe);
                                     hash_data_list = g_list_prepend(hash_data_list, hash_data);
-                                    if (cmptype != COMPRESS_NONE_TYPE)
+
+                                    /* Blocks of zeros hold no data in memory */
+                                    if (hash_data->data != NULL)
                                         {
-                                            free_variable(buffer); /* buffer has been compressed and is no longer needed in the program */
+                                            read_bytes = read_bytes + size_read;
                                         }
 
-                                    g_checksum_reset(checksum);
-                                    digest_len = HASH_LEN;
-
-                                    if (read_bytes >= main_struct->opt->buffersize)
+                                    if (read_bytes >= worker->buffersize)
                                         {
                                             /* Buffer is full so we need to send it to the server */
-                                            saved_list = lets_send_all_that_now(main_struct, hash_data_list, saved_list, read_bytes);
+                                            saved_list = lets_send_all_that_now(worker, hash_data_list, saved_list, read_bytes);
                                             hash_data_list = NULL;
                                             read_bytes = 0;
                                         }
 
-                                    buffer = (guchar *) g_malloc(meta->blocksize);
                                     a_hash = (guint8 *) g_malloc(digest_len);
-                                    size_read = g_input_stream_read((GInputStream *) stream, buffer, meta->blocksize, NULL, &error);
-                                    read_bytes = read_bytes + size_read;
+                                    size_read = chunker_read(chunker, &buffer, &error);
                                 }
 
                             if (error != NULL)
@@ -1051,10 +1273,10 @@ static void process_big_file_not_in_cache(main_struct_t *main_struct, meta_data_
                                 }
                             else
                                 {
-                                    if (read_bytes > 0)
+                                    if (hash_data_list != NULL)
                                         {
                                             /* Last buffer for that file : send it to the server */
-                                            saved_list = lets_send_all_that_now(main_struct, hash_data_list, saved_list, read_bytes);
+                                            saved_list = lets_send_all_that_now(worker, hash_data_list, saved_list, read_bytes);
                                             hash_data_list = NULL;
                                             read_bytes = 0;
                                         }
@@ -1065,9 +1287,8 @@ static void process_big_file_not_in_cache(main_struct_t *main_struct, meta_data_
 
                             free_variable(buffer);
                             free_variable(a_hash);
-                            g_checksum_free(checksum);
-                            g_input_stream_close((GInputStream *) stream, NULL, NULL);
-                            free_object(stream);
+                            free_chunker_t(chunker);
+                            reader_close(worker->reader);
                         }
                     else
                         {
@@ -1075,15 +1296,18 @@ static void process_big_file_not_in_cache(main_struct_t *main_struct, meta_data_
                             free_error(error);
                         }
 
+                    /* Meta data is sent once every block of the file reached the server */
+                    wait_for_async_posts(worker->comm);
+
                     meta->hash_data_list = saved_list;
-                    answer = send_meta_data_to_server(main_struct, meta, TRUE);
+                    answer = send_meta_data_to_server(worker, meta, TRUE);
 
                     if (answer != NULL)
                         {   /** @todo may be we should check that answer is something that tells that everything went Ok. */
                             /* Everything has been transmitted so we can save meta data into the local db cache */
                             /* This is usefull for file carving to avoid sending too much things to the server  */
                             elapsed = new_clock_t();
-                            db_save_meta_data(main_struct->database, meta, TRUE);
+                            db_save_meta_data(worker->database, meta, TRUE);
                             end_clock(elapsed, "db_save_meta_data");
                         }
 
@@ -1097,52 +1321,80 @@ static void process_big_file_not_in_cache(main_struct_t *main_struct, meta_data_
  * This function gets meta data and data from a file and sends them
  * to the server in order to save the file located in the directory
  * 'directory' and represented by 'fileinfo' variable.
- * @param main_struct : main structure of the program
- * @param directory is the directory we are iterating over
- * @param fileinfo is a glib structure that contains all meta data and
- *        more for a file.
- * @note This function is not threadable as is. One may have problems
- *       when writing to the database for instance.
+ * @param worker : the save worker (with its own database and comm handles)
+ * @param file_event is the event to be processed: it contains the
+ *        directory we are iterating over and the fileinfo glib
+ *        structure that contains all meta data and more for a file.
+ * @note This function is called concurrently by all save workers. It
+ *       must only use the worker's own database and comm handles.
+ *       Data of a regular file is held in memory by windows of at most
+ *       worker->buffersize bytes: files that fit into one window are
+ *       processed at once and others are streamed to the server window
+ *       after window. Every window that may be in flight is reserved
+ *       in the memory budget until all uploads of the file are done.
  */
-void save_one_file(main_struct_t *main_struct, file_event_t *file_event)
+void save_one_file(save_worker_t *worker, file_event_t *file_event)
 {
     meta_data_t *meta = NULL;
+    gint64 reserved = 0;
+    guint windows = 1;
     a_clock_t *my_clock = NULL;
     gchar *message = NULL;
     gchar *another_dir = NULL;
     filter_file_t *filter = NULL;
 
-    g_assert_nonnull(main_struct);
+    g_assert_nonnull(worker);
 
     if (file_event != NULL)
         {
             my_clock = new_clock_t();
 
             /* Get data and meta_data for a file. */
-            filter = new_filter_t(main_struct->database, main_struct->regex_exclude_list, FALSE);
-            meta = get_meta_data_from_fileinfo(file_event, filter, main_struct->opt);
+            filter = new_filter_t(worker->database, worker->main_struct->regex_exclude_list, FALSE);
+            meta = get_meta_data_from_fileinfo(file_event, filter, worker->main_struct->opt);
 
             /* We want to save all files that are not excluded ie filter->excluded not TRUE */
             if (meta != NULL && filter != NULL && filter->excluded == FALSE)
                 {
                     if (meta->in_cache == FALSE)
                         {
+                            worker->buffersize = calculate_file_buffersize(worker->main_struct->opt, meta->size);
+
+                            if (meta->file_type == G_FILE_TYPE_REGULAR)
+                                {
+                                    /* A window stays in memory until its upload is done: the
+                                     * reservation covers the windows that may be in flight
+                                     * plus the one being read.
+                                     */
+                                    windows = worker->comm->max_in_flight + 1;
+                                    reserved = reserve_memory_budget(worker->main_struct->budget, MIN(meta->size, (gint64) worker->buffersize * windows));
+
+                                    if (meta->size > worker->buffersize || reserved < meta->size)
+                                        {
+                                            worker->buffersize = MAX(reserved / windows, meta->blocksize);
+                                        }
+                                }
+
                              /* File is not in cache thus unknown thus we need to save it */
-                            if (meta->size < CLIENT_SMALL_FILE_SIZE)
+                            if (meta->size <= worker->buffersize)
                                 {
-                                    process_small_file_not_in_cache(main_struct, meta);
+                                    process_small_file_not_in_cache(worker, meta);
                                 }
                             else
                                 {
-                                    process_big_file_not_in_cache(main_struct, meta);
+                                    process_big_file_not_in_cache(worker, meta);
                                 }
+
+                            /* Blocks belong to uploads in flight until they are done */
+                            wait_for_async_posts(worker->comm);
+                            release_memory_budget(worker->main_struct->budget, reserved);
                         }
 
-                    if (meta->file_type == G_FILE_TYPE_DIRECTORY)
+                    if (meta->file_type == G_FILE_TYPE_DIRECTORY && file_event->carved == FALSE)
                         {
-                            /* This is a recursive call */
+                            /* Directories found while carving are already carved by the walkers */
                             another_dir = g_strdup(meta->name);
-                            g_async_queue_push(main_struct->dir_queue, another_dir);
+                            g_async_queue_push(worker->main_struct->dir_queue, another_dir);
 
                         }
                     message = g_strdup_printf(_("processing file %s"), meta->name);
@@ -1168,85 +1420,403 @@ void save_one_file(main_struct_t *main_struct, file_event_t *file_event)
 
 
 /**
- * Iterates over an enumerator obtained from a directory.
+ * @returns a newly allocated empty cache of user and group names that
+ *          may be freed with free_owner_cache_t().
+ */
+static owner_cache_t *new_owner_cache_t(void)
+{
+    owner_cache_t *owners = NULL;
+
+    owners = (owner_cache_t *) g_malloc0(sizeof(owner_cache_t));
+    g_assert_nonnull(owners);
+
+    g_mutex_init(&owners->mutex);
+    owners->users = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+    owners->groups = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+
+    return owners;
+}
+
+
+/**
+ * Frees a cache of user and group names.
+ * @param owners is the cache to be freed (may be NULL).
+ */
+static void free_owner_cache_t(owner_cache_t *owners)
+{
+    if (owners != NULL)
+        {
+            g_hash_table_destroy(owners->users);
+            g_hash_table_destroy(owners->groups);
+            g_mutex_clear(&owners->mutex);
+            free_variable(owners);
+        }
+}
+
+
+/**
+ * Gets the name of a user or of a group. It is looked up in the system
+ * databases only the first time its id is seen.
+ * @param owners is the cache of user and group names.
+ * @param id is the uid or the gid.
+ * @param is_user is TRUE for a uid and FALSE for a gid.
+ * @returns a newly allocated name that may be freed when no longer
+ *          needed or NULL when the id has no name.
+ */
+static gchar *get_owner_name(owner_cache_t *owners, guint32 id, gboolean is_user)
+{
+    GHashTable *names = (is_user == TRUE) ? owners->users : owners->groups;
+    gpointer name = NULL;
+    gchar *found = NULL;
+    gboolean known = FALSE;
+    struct passwd pwd;
+    struct passwd *pwd_result = NULL;
+    struct group grp;
+    struct group *grp_result = NULL;
+    gchar buffer[4096];
+
+    g_mutex_lock(&owners->mutex);
+    known = g_hash_table_lookup_extended(names, GUINT_TO_POINTER(id), NULL, &name);
+    found = g_strdup((gchar *) name);
+    g_mutex_unlock(&owners->mutex);
+
+    if (known == FALSE)
+        {
+            /* Looked up without the lock: two walkers may look the same id up */
+            if (is_user == TRUE && getpwuid_r(id, &pwd, buffer, sizeof(buffer), &pwd_result) == 0 && pwd_result != NULL)
+                {
+                    found = g_strdup(pwd.pw_name);
+                }
+            else if (is_user == FALSE && getgrgid_r(id, &grp, buffer, sizeof(buffer), &grp_result) == 0 && grp_result != NULL)
+                {
+                    found = g_strdup(grp.gr_name);
+                }
+
+            g_mutex_lock(&owners->mutex);
+            g_hash_table_replace(names, GUINT_TO_POINTER(id), g_strdup(found));
+            g_mutex_unlock(&owners->mutex);
+        }
+
+    return found;
+}
+
+
+/**
+ * Gets the status of an entry of a directory without following it if it
+ * is a symbolic link. Only the fields needed to fill meta data are asked
+ * for when statx() is available.
+ * @param dir_fd is the file descriptor of the directory.
+ * @param name is the name of the entry in this directory.
+ * @param[out] st is filled with the status of the entry.
+ * @returns 0 on success or an errno value.
+ */
+static gint stat_entry(gint dir_fd, const gchar *name, struct stat *st)
+{
+#ifdef HAVE_STATX
+    struct statx stx;
+    guint mask = STATX_TYPE | STATX_MODE | STATX_INO | STATX_UID | STATX_GID | STATX_SIZE | STATX_ATIME | STATX_MTIME | STATX_CTIME;
+
+    if (statx(dir_fd, name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, mask, &stx) == 0)
+        {
+            memset(st, 0, sizeof(struct stat));
+            st->st_mode = stx.stx_mode;
+            st->st_ino = stx.stx_ino;
+            st->st_uid = stx.stx_uid;
+            st->st_gid = stx.stx_gid;
+            st->st_size = stx.stx_size;
+            st->st_atime = stx.stx_atime.tv_sec;
+            st->st_mtime = stx.stx_mtime.tv_sec;
+            st->st_ctime = stx.stx_ctime.tv_sec;
+
+            return 0;
+        }
+#else
+    if (fstatat(dir_fd, name, st, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT) == 0)
+        {
+            return 0;
+        }
+#endif
+
+    return errno;
+}
+
+
+/**
+ * Makes the GFileInfo of an entry of a directory with the attributes of
+ * FILE_META_DATA_ATTRIBUTES as g_file_enumerate_children() does, but
+ * with one stat_entry() call and cached user and group names.
+ * @param owners is the cache of user and group names.
+ * @param dir_fd is the file descriptor of the directory.
+ * @param name is the name of the entry in this directory.
+ * @returns a newly allocated GFileInfo or NULL if the entry could not
+ *          be read (it may have been removed since the directory was
+ *          read).
+ */
+static GFileInfo *get_entry_file_info(owner_cache_t *owners, gint dir_fd, const gchar *name)
+{
+    GFileInfo *fileinfo = NULL;
+    GFileType file_type = G_FILE_TYPE_SPECIAL;
+    struct stat st;
+    gchar *owner = NULL;
+    gchar target[PATH_MAX];
+    gssize length = 0;
+    gint err = 0;
+
+    err = stat_entry(dir_fd, name, &st);
+
+    if (err == 0)
+        {
+            if (S_ISDIR(st.st_mode))
+                {
+                    file_type = G_FILE_TYPE_DIRECTORY;
+                }
+            else if (S_ISREG(st.st_mode))
+                {
+                    file_type = G_FILE_TYPE_REGULAR;
+                }
+            else if (S_ISLNK(st.st_mode))
+                {
+                    file_type = G_FILE_TYPE_SYMBOLIC_LINK;
+                }
+
+            fileinfo = g_file_info_new();
+            g_file_info_set_file_type(fileinfo, file_type);
+            g_file_info_set_name(fileinfo, name);
+            g_file_info_set_size(fileinfo, st.st_size);
+            g_file_info_set_attribute_uint64(fileinfo, G_FILE_ATTRIBUTE_UNIX_INODE, st.st_ino);
+            g_file_info_set_attribute_uint32(fileinfo, G_FILE_ATTRIBUTE_UNIX_UID, st.st_uid);
+            g_file_info_set_attribute_uint32(fileinfo, G_FILE_ATTRIBUTE_UNIX_GID, st.st_gid);
+            g_file_info_set_attribute_uint32(fileinfo, G_FILE_ATTRIBUTE_UNIX_MODE, st.st_mode);
+            g_file_info_set_attribute_uint64(fileinfo, G_FILE_ATTRIBUTE_TIME_ACCESS, st.st_atime);
+            g_file_info_set_attribute_uint64(fileinfo, G_FILE_ATTRIBUTE_TIME_CHANGED, st.st_ctime);
+            g_file_info_set_attribute_uint64(fileinfo, G_FILE_ATTRIBUTE_TIME_MODIFIED, st.st_mtime);
+
+            owner = get_owner_name(owners, st.st_uid, TRUE);
+            if (owner != NULL)
+                {
+                    g_file_info_set_attribute_string(fileinfo, G_FILE_ATTRIBUTE_OWNER_USER, owner);
+                    free_variable(owner);
+                }
+
+            owner = get_owner_name(owners, st.st_gid, FALSE);
+            if (owner != NULL)
+                {
+                    g_file_info_set_attribute_string(fileinfo, G_FILE_ATTRIBUTE_OWNER_GROUP, owner);
+                    free_variable(owner);
+                }
+
+            if (file_type == G_FILE_TYPE_SYMBOLIC_LINK)
+                {
+                    length = readlinkat(dir_fd, name, target, sizeof(target) - 1);
+
+                    if (length >= 0)
+                        {
+                            target[length] = '\0';
+                            g_file_info_set_symlink_target(fileinfo, target);
+                        }
+                }
+        }
+    else if (err != ENOENT)
+        {
+            print_error(__FILE__, __LINE__, _("Unable to get meta data for file %s: %s\n"), name, g_strerror(err));
+        }
+
+    return fileinfo;
+}
+
+
+/**
+ * Iterates over the entries of a directory. Sub directories that are not
+ * excluded are pushed into carve_pool to be carved concurrently by
+ * another walker.
  * @param main_struct : main structure of the program
  * @param directory is the directory we are iterating over
- * @param file_enum is the enumerator obtained when opening a directory
- *        to carve it.
+ * @param dir is the directory stream opened on directory to carve it.
  */
-static void iterate_over_enum(main_struct_t *main_struct, gchar *directory, GFileEnumerator *file_enum)
+static void iterate_over_directory(main_struct_t *main_struct, gchar *directory, DIR *dir)
 {
-    GError *error = NULL;
     GFileInfo *fileinfo = NULL;
     file_event_t *file_event = NULL;
+    struct dirent *entry = NULL;
+    gchar *sub_dir = NULL;
+    gint dir_fd = -1;
 
     g_assert_nonnull(main_struct);
 
-    if (file_enum != NULL)
+    if (dir != NULL)
         {
-            fileinfo = g_file_enumerator_next_file(file_enum, NULL, &error);
+            dir_fd = dirfd(dir);
+            entry = readdir(dir);
 
-            while (error == NULL && fileinfo != NULL)
+            while (entry != NULL && is_carving_stopped(main_struct) == FALSE)
                 {
-                    /* file_event is used and freed in the thread
-                     * save_one_file_threaded where the queue save_queue
-                     * is used
-                     */
-                    file_event = new_file_event_t(directory, fileinfo);
-                    g_async_queue_push(main_struct->save_queue, file_event);
+                    if (g_strcmp0(entry->d_name, ".") != 0 && g_strcmp0(entry->d_name, "..") != 0)
+                        {
+                            fileinfo = get_entry_file_info(main_struct->owners, dir_fd, entry->d_name);
+                        }
+
+                    if (fileinfo != NULL)
+                        {
+                            /* file_event is used and freed in the thread
+                             * save_one_file_threaded where the queue save_queue
+                             * is used
+                             */
+                            file_event = new_file_event_t(directory, fileinfo, TRUE);
+                            push_to_save_scheduler(main_struct->save_queue, file_event);
 
-                    free_object(fileinfo);
+                            if (g_file_info_get_file_type(fileinfo) == G_FILE_TYPE_DIRECTORY)
+                                {
+                                    sub_dir = g_build_path(G_DIR_SEPARATOR_S, directory, entry->d_name, NULL);
 
-                    fileinfo = g_file_enumerator_next_file(file_enum, NULL, &error);
+                                    if (exclude_file(main_struct->regex_exclude_list, sub_dir) == FALSE)
+                                        {
+                                            push_to_carve_pool(main_struct, sub_dir);
+                                        }
+                                    else
+                                        {
+                                            free_variable(sub_dir);
+                                        }
+                                }
+
+                            free_object(fileinfo);
+                            fileinfo = NULL;
+                        }
+
+                    entry = readdir(dir);
                 }
         }
 }
 
 
 /**
- * Call back for the g_slist_foreach function that carves one directory
- * and sub directories in a recursive way.
- * @param data is an element of opt->list ie: a gchar * that represents
- *        a directory name
+ * Carves one directory: pushes a file_event_t for each of its entries
+ * into save_queue and its sub directories into carve_pool. This is the
+ * function run by carve_pool's threads. Entries are read with readdir()
+ * (getdents64) and the attributes needed to fill meta data come from
+ * one stat_entry() call per entry.
+ * @param data is a gchar * that represents a directory name. It is
+ *        freed here.
  * @param user_data is the main_struct_t * pointer to the main structure.
  */
 static void carve_one_directory(gpointer data, gpointer user_data)
 {
     gchar *directory = (gchar *) data;
     main_struct_t *main_struct = (main_struct_t *) user_data;
-
-    GFile *a_dir = NULL;
-    GFileEnumerator *file_enum = NULL;
-    GError *error = NULL;
+    DIR *dir = NULL;
 
     g_assert_nonnull(main_struct);
 
-    if (directory != NULL)
+    if (directory != NULL && is_carving_stopped(main_struct) == TRUE)
+        {
+            /* Directories still queued when the program ends are dropped */
+            free_variable(directory);
+        }
+    else if (directory != NULL)
         {
-            a_dir = g_file_new_for_path(directory);
-            file_enum = g_file_enumerate_children(a_dir, "*", G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL, &error);
+            dir = opendir(directory);
 
-            if (error == NULL && file_enum != NULL)
+            if (dir != NULL)
                 {
-                    iterate_over_enum(main_struct, directory, file_enum);
-                    g_file_enumerator_close(file_enum, NULL, NULL);
-                    free_object(file_enum);
+                    iterate_over_directory(main_struct, directory, dir);
+                    closedir(dir);
                 }
             else
                 {
-                    print_error(__FILE__, __LINE__, _("Unable to enumerate directory %s: %s\n"), directory, error->message);
-                    free_error(error);
+                    print_error(__FILE__, __LINE__, _("Unable to enumerate directory %s: %s\n"), directory, g_strerror(errno));
+                }
+
+            free_variable(directory);
+        }
+}
+
+
+/**
+ * @param main_struct : main structure of the program.
+ * @returns TRUE when directories are no longer carved because the
+ *          program is ending.
+ */
+static gboolean is_carving_stopped(main_struct_t *main_struct)
+{
+    gboolean stopped = FALSE;
+
+    g_mutex_lock(&main_struct->carve_mutex);
+    stopped = main_struct->carve_stopped;
+    g_mutex_unlock(&main_struct->carve_mutex);
+
+    return stopped;
+}
+
+
+/**
+ * Gives a directory to carve_pool unless carving has been stopped.
+ * @param main_struct : main structure of the program.
+ * @param directory is the directory to be carved. It is freed by
+ *        carve_one_directory() or here when carving has been stopped.
+ */
+static void push_to_carve_pool(main_struct_t *main_struct, gchar *directory)
+{
+    g_mutex_lock(&main_struct->carve_mutex);
+
+    if (main_struct->carve_stopped == FALSE)
+        {
+            g_thread_pool_push(main_struct->carve_pool, directory, NULL);
+        }
+    else
+        {
+            free_variable(directory);
+        }
+
+    g_mutex_unlock(&main_struct->carve_mutex);
+}
+
+
+/**
+ * Stops carving: carve_all_directories thread ends, directories still
+ * queued in carve_pool are dropped and walkers stop at their next
+ * entry. Nothing is pushed into save_queue by carving threads once this
+ * function returns.
+ * @param main_struct : main structure of the program.
+ */
+static void stop_carving(main_struct_t *main_struct)
+{
+    gpointer directory = NULL;
+
+    g_mutex_lock(&main_struct->carve_mutex);
+    main_struct->carve_stopped = TRUE;
+    g_mutex_unlock(&main_struct->carve_mutex);
+
+    /* carve_all_directories() ends when it pops main_struct itself */
+    g_async_queue_push(main_struct->dir_queue, main_struct);
+    g_thread_join(main_struct->carve_all_directories);
+    main_struct->carve_all_directories = NULL;
+
+    /* The thread does not pop anything when directories are not scanned */
+    directory = g_async_queue_try_pop(main_struct->dir_queue);
+
+    while (directory != NULL)
+        {
+            if (directory != (gpointer) main_struct)
+                {
+                    free_variable(directory);
                 }
 
-            free_object(a_dir);
+            directory = g_async_queue_try_pop(main_struct->dir_queue);
         }
+
+    g_thread_pool_free(main_struct->carve_pool, FALSE, TRUE);
+    main_struct->carve_pool = NULL;
+
+    free_owner_cache_t(main_struct->owners);
+    main_struct->owners = NULL;
 }
 
 
 /**
  * Does carve all directories from the list in the option list.
  * This function is a thread that is run at the end of the initialisation
- * of main_struct structure.
+ * of main_struct structure. It gives directories to carve_pool: first
+ * the ones from the option list and then the ones that appear in
+ * dir_queue (directories created while the program runs).
  * @param data: main structure of the program that contains also
  *        the options structure that should have a list of directories
  *        to save.
@@ -1255,19 +1825,26 @@ static gpointer carve_all_directories(gpointer data)
 {
     main_struct_t *main_struct = (main_struct_t *) data;
     gchar *directory = NULL;
+    GSList *head = NULL;
 
     g_assert_nonnull(main_struct);
 
     if (main_struct->opt != NULL && main_struct->opt->noscan == FALSE)
         {
-            g_slist_foreach(main_struct->opt->dirname_list, carve_one_directory, main_struct);
+            head = main_struct->opt->dirname_list;
+
+            while (head != NULL)
+                {
+                    push_to_carve_pool(main_struct, g_strdup((gchar *) head->data));
+                    head = g_slist_next(head);
+                }
 
             directory = g_async_queue_pop(main_struct->dir_queue);
 
-            while (directory != NULL)
+            /* stop_carving() pushes main_struct itself to end this thread */
+            while (directory != (gpointer) main_struct)
                 {
-                    carve_one_directory(directory, main_struct);
-                    free_variable(directory);
+                    push_to_carve_pool(main_struct, directory);
                     directory = g_async_queue_pop(main_struct->dir_queue);
                 }
         }
@@ -1276,44 +1853,168 @@ static gpointer carve_all_directories(gpointer data)
 }
 
 
+/**
+ * @returns a newly allocated reconnect_t structure used to wake up the
+ *          reconnection thread.
+ */
+static reconnect_t *new_reconnect_t(void)
+{
+    reconnect_t *reconnect = NULL;
+
+    reconnect = (reconnect_t *) g_malloc0(sizeof(reconnect_t));
+    g_assert_nonnull(reconnect);
+
+    g_mutex_init(&reconnect->mutex);
+    g_cond_init(&reconnect->cond);
+    reconnect->wake_up = FALSE;
+    reconnect->backoff = FALSE;
+    reconnect->stop = FALSE;
+
+    return reconnect;
+}
+
+
+/**
+ * Wakes the reconnection thread up (or makes its next wait end at once).
+ * @param reconnect is the reconnect_t structure of the program (may be
+ *        NULL).
+ * @param even_in_backoff is TRUE to wake the thread up even when its
+ *        last tries failed. A request that has just been spooled uses
+ *        FALSE so that the backoff is kept while the server is down.
+ */
+static void signal_reconnection(reconnect_t *reconnect, gboolean even_in_backoff)
+{
+    if (reconnect != NULL)
+        {
+            g_mutex_lock(&reconnect->mutex);
+            if (reconnect->wake_up == FALSE && (even_in_backoff == TRUE || reconnect->backoff == FALSE))
+                {
+                    reconnect->wake_up = TRUE;
+                    g_cond_signal(&reconnect->cond);
+                }
+            g_mutex_unlock(&reconnect->mutex);
+        }
+}
+
+
+/**
+ * Tells the reconnection thread that a request to the server has just
+ * succeeded: if some requests are waiting in the spool they are
+ * transmitted at once instead of waiting for the end of the backoff.
+ * @param main_struct : main structure of the program.
+ */
+static void wake_up_reconnection(main_struct_t *main_struct)
+{
+    if (is_there_requests_in_spool(main_struct->spool))
+        {
+            signal_reconnection(main_struct->reconnect, TRUE);
+        }
+}
+
+
+/**
+ * Waits for some seconds or until the reconnection thread is woken up.
+ * @param reconnect is the reconnect_t structure of the program.
+ * @param seconds is the maximum number of seconds to wait.
+ * @param backoff is TRUE when the last try failed: the wait then only
+ *        ends early when a request to the server succeeds.
+ * @returns TRUE when the reconnection thread has to end.
+ */
+static gboolean wait_for_reconnection(reconnect_t *reconnect, gint64 seconds, gboolean backoff)
+{
+    gint64 end_time = 0;
+    gboolean timed_out = FALSE;
+    gboolean stop = FALSE;
+
+    end_time = g_get_monotonic_time() + seconds * G_TIME_SPAN_SECOND;
+
+    g_mutex_lock(&reconnect->mutex);
+
+    reconnect->backoff = backoff;
+    while (reconnect->wake_up == FALSE && reconnect->stop == FALSE && timed_out == FALSE)
+        {
+            timed_out = !g_cond_wait_until(&reconnect->cond, &reconnect->mutex, end_time);
+        }
+    reconnect->wake_up = FALSE;
+    stop = reconnect->stop;
+
+    g_mutex_unlock(&reconnect->mutex);
+
+    return stop;
+}
+
+
 /**
  * Manages reconnections to the server and the data that may have been
- * saved in local buffers while the server was unreachable.
+ * saved in local buffers while the server was unreachable. Tries start
+ * when a first request is spooled and are spaced with an exponential
+ * backoff (from CLIENT_RECONNECT_MIN_SLEEP_TIME to
+ * CLIENT_RECONNECT_SLEEP_TIME seconds) that is cut short as soon as a
+ * save worker succeeds in talking to the server.
  * @param data: main structure of the program that contains also
  *        the options structure.
  */
 static gpointer reconnected(gpointer data)
 {
     main_struct_t *main_struct = (main_struct_t *) data;
+    gint64 delay = CLIENT_RECONNECT_MIN_SLEEP_TIME;
+    gint64 sleep_time = 0;
+    gboolean backoff = FALSE;
+    gboolean stop = FALSE;
 
-    while (main_struct != NULL)
+    while (main_struct != NULL && stop == FALSE)
         {
             if (db_is_there_buffers_to_transmit(main_struct->database))
                 {
-                    if (is_server_alive(main_struct->reconnected))
+                    if (is_server_alive(main_struct->reconnected) && db_transmit_buffers(main_struct->database, main_struct->reconnected))
                         {
-                            print_debug(_("We have data and meta data to transmit to server\n"));
-                            /* we need to do the job: transmit again the data
-                             * sleep until we'll implement something
-                             */
-                            db_transmit_buffers(main_struct->database, main_struct->reconnected);
-                            sleep(CLIENT_RECONNECT_SLEEP_TIME);
+                            print_debug(_("Data and meta data saved while the server was unreachable have been transmitted\n"));
+                            backoff = FALSE;
+                            delay = CLIENT_RECONNECT_MIN_SLEEP_TIME;
+                            sleep_time = CLIENT_RECONNECT_MIN_SLEEP_TIME;
                         }
                     else
                         {
-                            sleep(CLIENT_RECONNECT_SLEEP_TIME);
+                            print_debug(_("Server unreachable: next try in %" G_GINT64_FORMAT " seconds\n"), delay);
+                            backoff = TRUE;
+                            sleep_time = delay;
+                            delay = MIN(delay * 2, CLIENT_RECONNECT_SLEEP_TIME);
                         }
                 }
             else
                 {
-                    sleep(CLIENT_RECONNECT_SLEEP_TIME);
+                    /* Nothing to transmit: sleeps until a request is spooled */
+                    backoff = FALSE;
+                    delay = CLIENT_RECONNECT_MIN_SLEEP_TIME;
+                    sleep_time = CLIENT_RECONNECT_SLEEP_TIME;
                 }
+
+            stop = wait_for_reconnection(main_struct->reconnect, sleep_time, backoff);
         }
 
     return NULL;
 }
 
 
+/**
+ * Ends the reconnection thread and waits for it: a transmission of the
+ * spool that is in progress is finished first.
+ * @param main_struct : main structure of the program.
+ */
+static void stop_reconnection(main_struct_t *main_struct)
+{
+    reconnect_t *reconnect = main_struct->reconnect;
+
+    g_mutex_lock(&reconnect->mutex);
+    reconnect->stop = TRUE;
+    g_cond_signal(&reconnect->cond);
+    g_mutex_unlock(&reconnect->mutex);
+
+    g_thread_join(main_struct->reconn_thread);
+    main_struct->reconn_thread = NULL;
+}
+
+
 /**
  * Signal handler function called when SIGTERM and SIGKILL are received
  * @param user_data is a gpointer that MUST be a pointer to the
@@ -1323,17 +2024,74 @@ static gpointer reconnected(gpointer data)
 static gboolean client_signal_handler(gpointer user_data)
 {
     main_struct_t *main_struct = (main_struct_t *) user_data;
+    save_worker_t *worker = NULL;
+    guint i = 0;
+
     g_assert_nonnull(main_struct);
 
     print_debug(_("\nEnding the program:\n"));
 
+    /* Producers are stopped in the order they feed each other: fanotify
+     * feeds the coalescer, both of them and carving feed save workers
+     * and save workers feed the spool that reconn_thread transmits
+     * through the transport.
+     */
+    stop_fanotify_loop(main_struct);
     stop_fanotify(main_struct->opt, main_struct->fanotify_fd);
     print_debug(_("\tNotification stopped.\n"));
 
     g_main_loop_quit(main_struct->loop);
     print_debug(_("\tMain loop exited.\n"));
 
+    stop_event_coalescer(main_struct);
+    print_debug(_("\tEvent coalescer stopped.\n"));
+
+    stop_carving(main_struct);
+    print_debug(_("\tCarving stopped.\n"));
+
+    /* Save workers have to be finished before the database writer is
+     * freed: they queue their rows to it.
+     */
+    if (main_struct->save_queue != NULL)
+        {
+            stop_save_scheduler(main_struct->save_queue);
+        }
+    for (i = 0; main_struct->save_workers != NULL && i < main_struct->save_workers->len; i++)
+        {
+            worker = g_ptr_array_index(main_struct->save_workers, i);
+            g_thread_join(worker->thread);
+            db_set_writer(worker->database, NULL);
+            free_reader_t(worker->reader);
+            worker->reader = NULL;
+            /* Before the transport that the comm may use */
+            free_comm_t(worker->comm);
+            worker->comm = NULL;
+        }
+    print_debug(_("\tSave workers stopped.\n"));
+
+    stop_reconnection(main_struct);
+    print_debug(_("\tReconnection thread stopped.\n"));
+
+    free_transport_t(main_struct->transport);
+    main_struct->transport = NULL;
+    print_debug(_("\tTransport stopped.\n"));
+
+    /* Nothing writes into the databases anymore */
+    db_set_writer(main_struct->database, NULL);
+    free_db_writer_t(main_struct->writer);
     close_database(main_struct->database);
+    for (i = 0; main_struct->save_workers != NULL && i < main_struct->save_workers->len; i++)
+        {
+            worker = g_ptr_array_index(main_struct->save_workers, i);
+            close_database(worker->database);
+            free_variable(worker);
+        }
+    if (main_struct->save_workers != NULL)
+        {
+            g_ptr_array_free(main_struct->save_workers, TRUE);
+            main_struct->save_workers = NULL;
+        }
+    free_spool_t(main_struct->spool);
     print_debug(_("\tDatabase closed.\n"));
 
     free_options_t(main_struct->opt);
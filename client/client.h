@@ -30,6 +30,11 @@
 /* Configuration from ./configure script */
 #include "config.h"
 
+/* open_by_handle_at() is needed to resolve fanotify's file handles */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -46,8 +51,13 @@
 #include <limits.h>
 #include <sys/stat.h>
 #include <sys/signalfd.h>
+#include <sys/eventfd.h>
 #include <fcntl.h>
+#include <dirent.h>
+#include <pwd.h>
+#include <grp.h>
 #include <sys/fanotify.h>
+#include <sys/vfs.h>
 
 #include "libcdpfgl.h"
 
@@ -95,26 +105,69 @@
 
 
 /**
- * @def CLIENT_SMALL_FILE_SIZE
+ * @def CLIENT_DEFAULT_MEMORY_BUDGET
  *
- * defines the size under which a file is considered as small (ie that
- * may be totaly in memory).
- * 134217728 == 128 MB.
- * 134217 == 134 KB (only for tests since there is still no command line
- * or configuration file option to set this).
+ * defines the default number of bytes of file data that all save
+ * workers together may hold in memory (64 MB). A file whose size is
+ * below the worker's buffersize is processed in memory at once and
+ * bigger ones are streamed in windows of buffersize bytes.
  */
-#define CLIENT_SMALL_FILE_SIZE (134217728)
+#define CLIENT_DEFAULT_MEMORY_BUDGET (67108864)
 
 
 /**
  * @def CLIENT_RECONNECT_SLEEP_TIME
  *
- * defines sleep times before trying to reconnect or reading the
- * database.
+ * defines the longest sleep time (in seconds) before trying to reconnect
+ * or reading the database.
  */
 #define CLIENT_RECONNECT_SLEEP_TIME (5*60)  /* Sleeps for 5 minutes */
 
 
+/**
+ * @def CLIENT_RECONNECT_MIN_SLEEP_TIME
+ *
+ * defines the first sleep time (in seconds) before trying to reconnect.
+ * It doubles after each failed try up to CLIENT_RECONNECT_SLEEP_TIME.
+ */
+#define CLIENT_RECONNECT_MIN_SLEEP_TIME (1)
+
+
+/**
+ * @def CLIENT_DEFAULT_EVENT_QUIET_PERIOD
+ * Default time (in milliseconds) without any new event on a file before
+ * saving it.
+ */
+#define CLIENT_DEFAULT_EVENT_QUIET_PERIOD (2000)
+
+
+/**
+ * @def CLIENT_DEFAULT_EVENT_MAX_DELAY
+ * Default maximum time (in milliseconds) between the first event on a
+ * file and its save even if events keep coming.
+ */
+#define CLIENT_DEFAULT_EVENT_MAX_DELAY (30000)
+
+
+/**
+ * @def CLIENT_SCHEDULER_AGING
+ * Time (in microseconds) that a file waits in its lane for each
+ * doubling of its size. Files are popped in the order of their arrival
+ * time plus this time multiplied by the base 2 logarithm of their size:
+ * small files go first but a big file is never passed by files arriving
+ * more than a few seconds after it.
+ */
+#define CLIENT_SCHEDULER_AGING (1000000)
+
+
+/**
+ * @def CLIENT_SCHEDULER_LIVE_BURST
+ * Number of files popped in a row from the live lane before one is
+ * popped from the carve lane (when both lanes have files).
+ */
+#define CLIENT_SCHEDULER_LIVE_BURST (16)
+
+
 /**
  * @struct file_event_t
  * @brief stores all the necessary things to manage an event on a file.
@@ -123,6 +176,7 @@ typedef struct
 {
     gchar *directory;
     GFileInfo *fileinfo;
+    gboolean carved;     /**< TRUE when found while carving: sub directories are carved by the walkers themselves */
 } file_event_t;
 
 
@@ -139,6 +193,114 @@ typedef struct
 } filter_file_t;
 
 
+/**
+ * @struct memory_budget_t
+ * @brief Counts bytes of file data held in memory by all save workers.
+ *        A worker reserves the size of its window before reading a file
+ *        and waits if the budget is exhausted.
+ */
+typedef struct
+{
+    GMutex mutex;        /**< protects available                                 */
+    GCond cond;          /**< signaled each time some bytes are released         */
+    gint64 total;        /**< maximum number of bytes that may be reserved       */
+    gint64 available;    /**< number of bytes that may still be reserved         */
+} memory_budget_t;
+
+
+/**
+ * @struct reconnect_t
+ * @brief Lets save workers wake up the thread that transmits the spool
+ *        when a first request is spooled and as soon as a request to
+ *        the server succeeds again.
+ */
+typedef struct
+{
+    GMutex mutex;        /**< protects wake_up, backoff and stop                        */
+    GCond cond;          /**< signaled when wake_up is set                              */
+    gboolean wake_up;    /**< TRUE when the thread has to try again at once             */
+    gboolean backoff;    /**< TRUE while tries fail: spooled requests do not wake it up */
+    gboolean stop;       /**< TRUE when the thread has to end                           */
+} reconnect_t;
+
+
+/**
+ * @struct pending_event_t
+ * @brief A file that has been modified and that waits to be saved.
+ */
+typedef struct
+{
+    gchar *path;         /**< path of the file (key in the coalescer's table)  */
+    gint64 first_seen;   /**< monotonic time of the first event not yet saved  */
+    gint64 last_seen;    /**< monotonic time of the last event                 */
+    gint64 deadline;     /**< monotonic time at which the file has to be saved */
+    GSequenceIter *iter; /**< position of the file in the coalescer's queue    */
+} pending_event_t;
+
+
+/**
+ * @struct event_coalescer_t
+ * @brief Collapses fanotify events on the same file: a file is saved
+ *        once no event has been received for quiet_period or when
+ *        max_delay has elapsed since its first event.
+ */
+typedef struct
+{
+    GMutex mutex;          /**< protects pending, queue and stop                          */
+    GCond cond;            /**< signaled when a new file is pending or when stopping      */
+    GHashTable *pending;   /**< path -> pending_event_t * (owned by the table)            */
+    GSequence *queue;      /**< the same pending_event_t * ordered by deadline            */
+    gint64 quiet_period;   /**< quiet period in microseconds                              */
+    gint64 max_delay;      /**< maximum delay in microseconds                             */
+    GThread *thread;       /**< thread that gives due files to save_queue                 */
+    gboolean stop;         /**< TRUE when the thread has to end                           */
+} event_coalescer_t;
+
+
+/**
+ * @struct scheduled_event_t
+ * @brief A file event waiting in a lane of the save scheduler.
+ */
+typedef struct
+{
+    file_event_t *file_event;   /**< the event to be given to a save worker             */
+    gint64 deadline;            /**< arrival time plus aging weighted by the file size  */
+    guint64 number;             /**< arrival order (breaks ties between deadlines)      */
+} scheduled_event_t;
+
+
+/**
+ * @struct save_scheduler_t
+ * @brief Gives file events to save workers. Live events (fanotify) have
+ *        their own lane that is served before the lane of files found
+ *        while carving directories. Within a lane small files are saved
+ *        first and aging prevents bigger files from starving.
+ */
+typedef struct
+{
+    GMutex mutex;          /**< protects lanes, number, burst and stopped                   */
+    GCond cond;            /**< signaled each time an event is pushed or when stopping      */
+    GSequence *live;       /**< scheduled_event_t * from fanotify sorted by deadline        */
+    GSequence *carve;      /**< scheduled_event_t * found while carving sorted by deadline  */
+    guint64 number;        /**< number of events pushed so far                              */
+    guint burst;           /**< number of events popped in a row from the live lane         */
+    gboolean stopped;      /**< TRUE when save workers have to stop popping events          */
+} save_scheduler_t;
+
+
+/**
+ * @struct owner_cache_t
+ * @brief Names of the users and groups of the files found while carving
+ *        directories: each uid and gid is looked up only once.
+ */
+typedef struct
+{
+    GMutex mutex;          /**< protects users and groups                                   */
+    GHashTable *users;     /**< uid -> user name (gchar *, NULL when the uid is unknown)    */
+    GHashTable *groups;    /**< gid -> group name (gchar *, NULL when the gid is unknown)   */
+} owner_cache_t;
+
+
 /**
  * @struct main_struct_t
  * @brief Structure that contains everything needed by the program.
@@ -148,39 +310,75 @@ typedef struct
     options_t *opt;                 /**< Options of the program from the command line                                                     */
     const gchar *hostname;          /**< Name of the current machine                                                                      */
     db_t *database;                 /**< Database structure that stores everything that is related to the database                        */
-    comm_t *comm;                   /**< This is used to communicate with the 'server' program                                            */
     comm_t *reconnected;            /**< Used to save modifications when the server comes back after an outage or being unreachable       */
     gint fanotify_fd;               /**< fanotify handler                                                                                 */
-    GThread *save_one_file;         /**< thread that is used to save one file at a time (directory carving and live backup runs together) */
+    gint fanotify_stop_fd;          /**< eventfd written to end the fanotify loop                                                         */
+    GPtrArray *save_workers;        /**< save_worker_t * workers that save files concurrently (directory carving and live backup)        */
     GThread *carve_all_directories; /**< thread used to carve all directories and let fanotify executing itself                           */
+    GThreadPool *carve_pool;        /**< pool of threads that carve directories concurrently (each one pushes its sub directories)        */
+    GMutex carve_mutex;             /**< protects carve_stopped: nothing is pushed into carve_pool once it is set                         */
+    gboolean carve_stopped;         /**< TRUE when directories are no longer carved (the program is ending)                               */
+    owner_cache_t *owners;          /**< Names of users and groups looked up by the walkers of carve_pool                                 */
     GThread *reconn_thread;         /**< thread used to transmit buffers saved when server was unreachable                                */
-    GAsyncQueue *save_queue;        /**< Queue where is sent all file_event_t structures upon event or while directory carving.           */
+    save_scheduler_t *save_queue;   /**< Scheduler where is sent all file_event_t structures upon event or while directory carving.       */
     GAsyncQueue *dir_queue;         /**< A queue to collect directories when carving to avoid thread collision                            */
     GSList *regex_exclude_list;     /**< List of regular expressions used to exclude directories or files.                                */
+    cdc_params_t *cdc_params;       /**< Content defined chunking parameters (NULL when blocks have a fixed or adaptive size)             */
+    file_cache_t *file_cache;       /**< Last saved state of each file, shared by all database connexions                                 */
+    spool_t *spool;                 /**< Requests that could not be sent to the server, shared by all database connexions                 */
+    reconnect_t *reconnect;         /**< Wakes reconn_thread up when the server answers again                                             */
+    db_writer_t *writer;            /**< Inserts saved files into the database in periodic transactions (NULL when each one is synced)    */
+    memory_budget_t *budget;        /**< Bytes of file data that save workers may hold in memory all together                             */
     GMainLoop* loop;                /**< Main loop in glib                                                                                */
     GThread *fanotify_loop;         /**< thread used for the infinite loop checking fanotify envents.                                     */
+    event_coalescer_t *coalescer;   /**< Collapses bursts of fanotify events on a file (NULL when each event is saved at once)            */
+    transport_t *transport;         /**< Pool of keep-alive connections shared by save workers (NULL when each one uses its own)          */
 } main_struct_t;
 
 
+/**
+ * @struct save_worker_t
+ * @brief Structure that contains everything needed by one thread that
+ *        saves files popped from main_struct->save_queue. Database and
+ *        comm handles are owned by the worker and never shared.
+ */
+typedef struct
+{
+    main_struct_t *main_struct;     /**< Main structure of the program (shared between all workers)                                       */
+    db_t *database;                 /**< Worker's own connexion to the local cache database                                               */
+    comm_t *comm;                   /**< Worker's own handle used to communicate with the 'server' program                                */
+    gint buffersize;                /**< Number of bytes to accumulate before sending them for the file being processed                   */
+    reader_t *reader;               /**< Worker's own reader (keeps several reads in flight with io_uring when available)                 */
+    GThread *thread;                /**< Thread running save_one_file_threaded() for this worker                                          */
+} save_worker_t;
+
+
 /**
  * This function gets meta data and data from a file and sends them
  * to the server in order to save the file located in the directory
  * 'directory' and represented by 'fileinfo' variable.
- * @param main_struct : main structure of the program
- * @param directory is the directory we are iterating over
- * @param fileinfo is a glib structure that contains all meta data and
- *        more for a file.
+ * @param worker : the save worker (with its own database and comm handles)
+ * @param file_event is the event to be processed: it contains the
+ *        directory we are iterating over and the fileinfo glib
+ *        structure that contains all meta data and more for a file.
  */
-extern void save_one_file(main_struct_t *main_struct, file_event_t *file_event);
+extern void save_one_file(save_worker_t *worker, file_event_t *file_event);
 
 
 /**
  * @returns a newly alloacted file_event_t * structure that must be freed
  * when no longer needed
- * @param
+ * @param directory is the directory where the event occured
+ * @param fileinfo is fileinfo of the file on which the event occured
+ * @param carved is TRUE when the file has been found while carving
+ *        directories and FALSE when it comes from fanotify.
  */
-extern file_event_t *new_file_event_t(gchar *directory, GFileInfo *fileinfo);
+extern file_event_t *new_file_event_t(gchar *directory, GFileInfo *fileinfo, gboolean carved);
 
+#include "dir_trie.h"
+#include "coalescer.h"
 #include "m_fanotify.h"
+#include "scheduler.h"
+#include "budget.h"
 
 #endif /* #IFNDEF _CLIENT_H_ */
@@ -0,0 +1,222 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    coalescer.c
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+/**
+ * @file coalescer.c
+ *
+ * This file contains the queue of files that wait for fanotify events
+ * on them to calm down before being saved. Files are kept in a table by
+ * path and in a sequence ordered by deadline so that only the head of
+ * the sequence has to be looked at to find the files that are due.
+ */
+
+#include "client.h"
+
+static gint64 get_pending_event_deadline(event_coalescer_t *coalescer, pending_event_t *pending);
+static gint compare_pending_events(gconstpointer a, gconstpointer b, gpointer user_data);
+
+
+/**
+ * Creates an events coalescer without any pending file. Its thread is
+ * not started.
+ * @param quiet_period is the time in microseconds without any event on
+ *        a file after which the file is saved.
+ * @param max_delay is the time in microseconds after the first event on
+ *        a file after which the file is saved anyway.
+ * @returns a newly allocated event_coalescer_t that must be freed with
+ *          free_event_coalescer_t() when no longer needed.
+ */
+event_coalescer_t *new_event_coalescer_t(gint64 quiet_period, gint64 max_delay)
+{
+    event_coalescer_t *coalescer = NULL;
+
+    coalescer = (event_coalescer_t *) g_malloc0(sizeof(event_coalescer_t));
+    g_assert_nonnull(coalescer);
+
+    g_mutex_init(&coalescer->mutex);
+    g_cond_init(&coalescer->cond);
+    coalescer->pending = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, free_pending_event_t);
+    coalescer->queue = g_sequence_new(NULL);
+    coalescer->quiet_period = quiet_period;
+    coalescer->max_delay = max_delay;
+    coalescer->thread = NULL;
+    coalescer->stop = FALSE;
+
+    return coalescer;
+}
+
+
+/**
+ * Frees an events coalescer and its pending files. Its thread must
+ * have ended.
+ * @param coalescer is the events coalescer to be freed.
+ */
+void free_event_coalescer_t(event_coalescer_t *coalescer)
+{
+    if (coalescer != NULL)
+        {
+            g_sequence_free(coalescer->queue);
+            g_hash_table_destroy(coalescer->pending);
+            g_cond_clear(&coalescer->cond);
+            g_mutex_clear(&coalescer->mutex);
+            free_variable(coalescer);
+        }
+}
+
+
+/**
+ * Frees a pending_event_t structure
+ * @param data is a pending_event_t * structure.
+ */
+void free_pending_event_t(gpointer data)
+{
+    pending_event_t *pending = (pending_event_t *) data;
+
+    if (pending != NULL)
+        {
+            free_variable(pending->path);
+            free_variable(pending);
+        }
+}
+
+
+/**
+ * @param coalescer is the events coalescer.
+ * @param pending is a file waiting to be saved.
+ * @returns the monotonic time at which the file has to be saved.
+ */
+static gint64 get_pending_event_deadline(event_coalescer_t *coalescer, pending_event_t *pending)
+{
+    return MIN(pending->last_seen + coalescer->quiet_period, pending->first_seen + coalescer->max_delay);
+}
+
+
+/**
+ * Compares two pending files by deadline (GCompareDataFunc of the
+ * coalescer's queue).
+ * @param a is a pending_event_t * structure.
+ * @param b is a pending_event_t * structure.
+ * @param user_data is not used.
+ * @returns a negative value if a has to be saved before b, a positive
+ *          value if b has to be saved before a and 0 otherwise.
+ */
+static gint compare_pending_events(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+    const pending_event_t *pending_a = (const pending_event_t *) a;
+    const pending_event_t *pending_b = (const pending_event_t *) b;
+
+    if (pending_a->deadline != pending_b->deadline)
+        {
+            return (pending_a->deadline < pending_b->deadline) ? -1 : 1;
+        }
+    else if (pending_a->first_seen != pending_b->first_seen)
+        {
+            return (pending_a->first_seen < pending_b->first_seen) ? -1 : 1;
+        }
+    else
+        {
+            return 0;
+        }
+}
+
+
+/**
+ * Records an event on a file. A file that is already pending only gets
+ * its last_seen time updated so a burst of events ends in one save.
+ * coalescer->mutex must be held.
+ * @param coalescer is the events coalescer.
+ * @param path is the entire path and name of the considered file.
+ * @param now is the monotonic time of the event.
+ * @returns TRUE if the file was not pending (it may be the next one to
+ *          be saved) and FALSE otherwise.
+ */
+gboolean record_pending_event(event_coalescer_t *coalescer, gchar *path, gint64 now)
+{
+    pending_event_t *pending = NULL;
+
+    pending = (pending_event_t *) g_hash_table_lookup(coalescer->pending, path);
+
+    if (pending != NULL)
+        {
+            /* The deadline may only move later: the thread does not need to wake up */
+            pending->last_seen = now;
+            pending->deadline = get_pending_event_deadline(coalescer, pending);
+            g_sequence_sort_changed(pending->iter, compare_pending_events, NULL);
+
+            return FALSE;
+        }
+    else
+        {
+            pending = (pending_event_t *) g_malloc0(sizeof(pending_event_t));
+            g_assert_nonnull(pending);
+
+            pending->path = g_strdup(path);
+            pending->first_seen = now;
+            pending->last_seen = now;
+            pending->deadline = get_pending_event_deadline(coalescer, pending);
+            pending->iter = g_sequence_insert_sorted(coalescer->queue, pending, compare_pending_events, NULL);
+            g_hash_table_insert(coalescer->pending, pending->path, pending);
+
+            return TRUE;
+        }
+}
+
+
+/**
+ * Removes the files whose deadline is reached from the coalescer.
+ * coalescer->mutex must be held.
+ * @param coalescer is the events coalescer.
+ * @param now is the current monotonic time.
+ * @param[out] next is set to the deadline of the next pending file or
+ *             to G_MAXINT64 if no file is pending anymore.
+ * @returns a list of pending_event_t * ordered by deadline to be freed
+ *          with g_slist_free_full(list, free_pending_event_t).
+ */
+GSList *pop_due_pending_events(event_coalescer_t *coalescer, gint64 now, gint64 *next)
+{
+    pending_event_t *pending = NULL;
+    GSequenceIter *first = NULL;
+    GSList *due_list = NULL;
+
+    *next = G_MAXINT64;
+
+    /* Only the files at the head of the queue are due */
+    first = g_sequence_get_begin_iter(coalescer->queue);
+
+    while (g_sequence_iter_is_end(first) == FALSE && *next == G_MAXINT64)
+        {
+            pending = (pending_event_t *) g_sequence_get(first);
+
+            if (pending->deadline <= now)
+                {
+                    g_sequence_remove(first);
+                    g_hash_table_steal(coalescer->pending, pending->path);
+                    due_list = g_slist_prepend(due_list, pending);
+                    first = g_sequence_get_begin_iter(coalescer->queue);
+                }
+            else
+                {
+                    *next = pending->deadline;
+                }
+        }
+
+    return g_slist_reverse(due_list);
+}
@@ -0,0 +1,86 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    coalescer.h
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+/**
+ * @file coalescer.h
+ *
+ * This file contains the definitions of the queue of files that wait
+ * for fanotify events on them to calm down before being saved.
+ */
+#ifndef _CLIENT_COALESCER_H_
+#define _CLIENT_COALESCER_H_
+
+
+/**
+ * Creates an events coalescer without any pending file. Its thread is
+ * not started.
+ * @param quiet_period is the time in microseconds without any event on
+ *        a file after which the file is saved.
+ * @param max_delay is the time in microseconds after the first event on
+ *        a file after which the file is saved anyway.
+ * @returns a newly allocated event_coalescer_t that must be freed with
+ *          free_event_coalescer_t() when no longer needed.
+ */
+extern event_coalescer_t *new_event_coalescer_t(gint64 quiet_period, gint64 max_delay);
+
+
+/**
+ * Frees an events coalescer and its pending files. Its thread must
+ * have ended.
+ * @param coalescer is the events coalescer to be freed.
+ */
+extern void free_event_coalescer_t(event_coalescer_t *coalescer);
+
+
+/**
+ * Frees a pending_event_t structure
+ * @param data is a pending_event_t * structure.
+ */
+extern void free_pending_event_t(gpointer data);
+
+
+/**
+ * Records an event on a file. A file that is already pending only gets
+ * its last_seen time updated so a burst of events ends in one save.
+ * coalescer->mutex must be held.
+ * @param coalescer is the events coalescer.
+ * @param path is the entire path and name of the considered file.
+ * @param now is the monotonic time of the event.
+ * @returns TRUE if the file was not pending (it may be the next one to
+ *          be saved) and FALSE otherwise.
+ */
+extern gboolean record_pending_event(event_coalescer_t *coalescer, gchar *path, gint64 now);
+
+
+/**
+ * Removes the files whose deadline is reached from the coalescer.
+ * coalescer->mutex must be held.
+ * @param coalescer is the events coalescer.
+ * @param now is the current monotonic time.
+ * @param[out] next is set to the deadline of the next pending file or
+ *             to G_MAXINT64 if no file is pending anymore.
+ * @returns a list of pending_event_t * ordered by deadline to be freed
+ *          with g_slist_free_full(list, free_pending_event_t).
+ */
+extern GSList *pop_due_pending_events(event_coalescer_t *coalescer, gint64 now, gint64 *next);
+
+
+#endif /* #ifndef _CLIENT_COALESCER_H_ */
@@ -0,0 +1,170 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    dir_trie.c
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+/**
+ * @file dir_trie.c
+ *
+ * This file contains the trie of monitored directories. Each node is a
+ * path component so that matching an event costs one lookup per
+ * component instead of a scan of every monitored directory. Components
+ * are UTF-8 casefolded as directories used to be compared.
+ */
+
+#include "client.h"
+
+
+/**
+ * Creates an empty node of the monitored directories trie.
+ * @returns a newly allocated dir_trie_t that must be freed with
+ *          free_dir_trie_t() when no longer needed.
+ */
+dir_trie_t *new_dir_trie_t(void)
+{
+    dir_trie_t *trie = NULL;
+
+    trie = (dir_trie_t *) g_malloc0(sizeof(dir_trie_t));
+    g_assert_nonnull(trie);
+
+    trie->children = g_hash_table_new_full(g_str_hash, g_str_equal, free_variable, free_dir_trie_t);
+    trie->directory = NULL;
+
+    return trie;
+}
+
+
+/**
+ * Frees a node of the monitored directories trie and all its children.
+ * @param data is a dir_trie_t * structure.
+ */
+void free_dir_trie_t(gpointer data)
+{
+    dir_trie_t *trie = (dir_trie_t *) data;
+
+    if (trie != NULL)
+        {
+            g_hash_table_destroy(trie->children);
+            free_variable(trie->directory);
+            free_variable(trie);
+        }
+}
+
+
+/**
+ * Inserts a monitored directory into the trie.
+ * @param trie is the root of the trie.
+ * @param directory is the monitored directory (an absolute path).
+ */
+void insert_into_dir_trie(dir_trie_t *trie, gchar *directory)
+{
+    gchar *casefold = NULL;
+    gchar **components = NULL;
+    dir_trie_t *node = trie;
+    dir_trie_t *child = NULL;
+    guint i = 0;
+
+    casefold = g_utf8_casefold(directory, -1);
+    components = g_strsplit(casefold, G_DIR_SEPARATOR_S, -1);
+
+    for (i = 0; components[i] != NULL; i++)
+        {
+            if (components[i][0] != '\0')
+                {
+                    child = (dir_trie_t *) g_hash_table_lookup(node->children, components[i]);
+
+                    if (child == NULL)
+                        {
+                            child = new_dir_trie_t();
+                            g_hash_table_insert(node->children, g_strdup(components[i]), child);
+                        }
+
+                    node = child;
+                }
+        }
+
+    if (node->directory == NULL)
+        {
+            node->directory = g_strdup(directory);
+        }
+
+    g_strfreev(components);
+    free_variable(casefold);
+}
+
+
+/**
+ * Finds the monitored directory that contains path. Components are
+ * compared whole and without regard to case: /home/Foo contains
+ * /home/foo/bar but not /home/foobar.
+ * @param trie is the root of the trie.
+ * @param path is the path where the event occured.
+ * @returns the monitored directory as inserted (owned by the trie) or
+ *          NULL if path is not in a monitored directory.
+ */
+gchar *find_in_dir_trie(dir_trie_t *trie, gchar *path)
+{
+    gchar *copy = NULL;
+    gchar *component = NULL;
+    gchar *slash = NULL;
+    gchar *directory = NULL;
+    dir_trie_t *node = trie;
+
+    copy = g_utf8_casefold(path, -1);
+    component = copy;
+
+    while (node != NULL && directory == NULL)
+        {
+            if (node->directory != NULL)
+                {
+                    directory = node->directory;
+                }
+            else if (component == NULL)
+                {
+                    node = NULL;
+                }
+            else
+                {
+                    slash = strchr(component, G_DIR_SEPARATOR);
+
+                    if (slash != NULL)
+                        {
+                            *slash = '\0';
+                        }
+
+                    if (component[0] != '\0')
+                        {
+                            node = (dir_trie_t *) g_hash_table_lookup(node->children, component);
+                        }
+
+                    if (slash != NULL)
+                        {
+                            component = slash + 1;
+                        }
+                    else
+                        {
+                            component = NULL;
+                        }
+                }
+        }
+
+    free_variable(copy);
+
+    return directory;
+}
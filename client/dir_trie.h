@@ -0,0 +1,82 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    dir_trie.h
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+/**
+ * @file dir_trie.h
+ *
+ * This file contains the definitions of the trie of monitored
+ * directories used to find the monitored directory where a fanotify
+ * event occured. Paths are compared once UTF-8 casefolded.
+ */
+#ifndef _CLIENT_DIR_TRIE_H_
+#define _CLIENT_DIR_TRIE_H_
+
+
+/**
+ * @struct dir_trie_t
+ * @brief Node of a trie of monitored directories: each node is a path
+ *        component. Finding the monitored directory of a path costs one
+ *        lookup per component of the path whatever the number of
+ *        monitored directories.
+ */
+typedef struct
+{
+    GHashTable *children;   /**< casefolded path component (gchar *) -> dir_trie_t *     */
+    gchar *directory;       /**< monitored directory that ends at this node or NULL       */
+} dir_trie_t;
+
+
+/**
+ * Creates an empty node of the monitored directories trie.
+ * @returns a newly allocated dir_trie_t that must be freed with
+ *          free_dir_trie_t() when no longer needed.
+ */
+extern dir_trie_t *new_dir_trie_t(void);
+
+
+/**
+ * Frees a node of the monitored directories trie and all its children.
+ * @param data is a dir_trie_t * structure.
+ */
+extern void free_dir_trie_t(gpointer data);
+
+
+/**
+ * Inserts a monitored directory into the trie.
+ * @param trie is the root of the trie.
+ * @param directory is the monitored directory (an absolute path).
+ */
+extern void insert_into_dir_trie(dir_trie_t *trie, gchar *directory);
+
+
+/**
+ * Finds the monitored directory that contains path. Components are
+ * compared whole and without regard to case: /home/Foo contains
+ * /home/foo/bar but not /home/foobar.
+ * @param trie is the root of the trie.
+ * @param path is the path where the event occured.
+ * @returns the monitored directory as inserted (owned by the trie) or
+ *          NULL if path is not in a monitored directory.
+ */
+extern gchar *find_in_dir_trie(dir_trie_t *trie, gchar *path);
+
+
+#endif /* #ifndef _CLIENT_DIR_TRIE_H_ */
@@ -32,15 +32,28 @@
 #include "client.h"
 
 static gchar *get_file_path_from_fd(gint fd);
-static char *get_program_name_from_pid(int pid);
+static gchar *read_program_name(gchar *proc_file);
+static void free_comm_entry_t(gpointer data);
+static gchar *get_program_name_from_pid(fanotify_context_t *context, gint pid);
+#ifdef FAN_REPORT_DFID_NAME
+static gint get_mount_fd(fanotify_context_t *context, gpointer fsid);
+static gchar *get_file_path_from_fid(fanotify_context_t *context, struct fanotify_event_metadata *event);
+#endif
 static void prepare_before_saving(main_struct_t *main_struct, gchar *path);
-static GSList *does_event_concerns_monitored_directory(gchar *path, GSList *dir_list);
-static gboolean filter_out_if_necessary(GSList *head, struct fanotify_event_metadata *event);
-static void event_process(main_struct_t *main_struct, struct fanotify_event_metadata *event, GSList *dir_list);
+static gboolean filter_out_if_necessary(fanotify_context_t *context, gchar *directory, struct fanotify_event_metadata *event);
+static void event_process(main_struct_t *main_struct, struct fanotify_event_metadata *event, fanotify_context_t *context);
+static fanotify_context_t *new_fanotify_context_t(options_t *opt);
+static void free_fanotify_context_t(fanotify_context_t *context);
+static void coalesce_event(main_struct_t *main_struct, gchar *path);
+static gpointer coalescer_thread(gpointer data);
 
 
 /**
- * Inits and starts fanotify notifications
+ * Inits and starts fanotify notifications. When opt->fanotify_fid is
+ * TRUE filesystems of monitored directories are marked and events
+ * report file handles. If the kernel does not support it
+ * opt->fanotify_fid is set back to FALSE and directories are marked as
+ * usual.
  * @param opt : a filled options_t * structure that contains all options
  *        by default, read into the file or selected in the command line.
  */
@@ -51,7 +64,7 @@ gint start_fanotify(options_t *opt)
 
     /** Leaving only FAN_CLOSE_WRITE for some tests */
     /* Setup fanotify notifications (FAN) mask. All these defined in linux/fanotify.h. */
-    static uint64_t event_mask =
+    uint64_t event_mask =
       (FAN_CLOSE_WRITE   |      /* Writtable file closed                                      */
        FAN_ONDIR         |      /* We want to be reported of events in the directory          */
        FAN_EVENT_ON_CHILD);     /* We want to be reported of events in files of the directory */
@@ -60,8 +73,29 @@ gint start_fanotify(options_t *opt)
 
     if (opt != NULL)
         {
+#ifdef FAN_REPORT_DFID_NAME
+            if (opt->fanotify_fid == TRUE)
+                {
+                    /* Events will report the directory's file handle and the name instead of an opened fd (linux >= 5.9) */
+                    fanotify_fd = fanotify_init(FAN_CLOEXEC | FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME, O_RDONLY | O_CLOEXEC | O_LARGEFILE);
+
+                    if (fanotify_fd < 0)
+                        {
+                            print_error(__FILE__, __LINE__, _("fanotify FID mode is not available (%s): using mount marks\n"), strerror(errno));
+                            opt->fanotify_fid = FALSE;
+                        }
+                    else
+                        {
+                            event_mask = FAN_CLOSE_WRITE;
+                            mark_flags = FAN_MARK_ADD | FAN_MARK_FILESYSTEM;
+                        }
+                }
+#else
+            opt->fanotify_fid = FALSE;
+#endif
+
             /* Create new fanotify device */
-            if ((fanotify_fd = fanotify_init(FAN_CLOEXEC, O_RDONLY | O_CLOEXEC | O_LARGEFILE)) < 0)
+            if (fanotify_fd < 0 && (fanotify_fd = fanotify_init(FAN_CLOEXEC, O_RDONLY | O_CLOEXEC | O_LARGEFILE)) < 0)
                 {
                     print_error(__FILE__, __LINE__, _("Couldn't setup new fanotify device: %s\n"), strerror(errno));
                 }
@@ -125,46 +159,188 @@ static gchar *get_file_path_from_fd(gint fd)
 }
 
 
-static char *get_program_name_from_pid(int pid)
+/**
+ * Reads a program name from a /proc file.
+ * @param proc_file is the file to read (/proc/<pid>/comm for instance).
+ * @returns a newly allocated string with the program name or NULL if
+ *          it could not be read (the process may already be gone).
+ */
+static gchar *read_program_name(gchar *proc_file)
 {
-    int fd = 0;
-    ssize_t len = 0;
-    char *aux = NULL;
-    gchar *cmd = NULL;
-    gchar *buffer = NULL;
+    gchar *comm = NULL;
 
-    /* Try to get program name by PID */
-    cmd = g_strdup_printf("/proc/%d/cmdline", pid);
+    if (g_file_get_contents(proc_file, &comm, NULL, NULL) == TRUE)
+        {
+            g_strchomp(comm);
+        }
 
-    if ((fd = open(cmd, O_RDONLY)) < 0)
+    return comm;
+}
+
+
+/**
+ * Frees a comm_entry_t structure
+ * @param data is a comm_entry_t * structure.
+ */
+static void free_comm_entry_t(gpointer data)
+{
+    comm_entry_t *entry = (comm_entry_t *) data;
+
+    if (entry != NULL)
+        {
+            free_variable(entry->comm);
+            free_variable(entry);
+        }
+}
+
+
+/**
+ * Gets the program name of a pid. Names are cached for
+ * FANOTIFY_PID_CACHE_TTL because a busy program generates many events.
+ * @param context is the fanotify loop's context.
+ * @param pid is the pid of the process that generated an event.
+ * @returns the program name (owned by the cache) or NULL if unknown.
+ */
+static gchar *get_program_name_from_pid(fanotify_context_t *context, gint pid)
+{
+    comm_entry_t *entry = NULL;
+    gchar *proc_file = NULL;
+    gint64 now = g_get_monotonic_time();
+
+    entry = (comm_entry_t *) g_hash_table_lookup(context->comms, GINT_TO_POINTER(pid));
+
+    if (entry == NULL || now - entry->time > FANOTIFY_PID_CACHE_TTL)
+        {
+            if (g_hash_table_size(context->comms) >= FANOTIFY_CACHE_MAX_ENTRIES)
+                {
+                    g_hash_table_remove_all(context->comms);
+                }
+
+            entry = (comm_entry_t *) g_malloc0(sizeof(comm_entry_t));
+            g_assert_nonnull(entry);
+
+            proc_file = g_strdup_printf("/proc/%d/comm", pid);
+            entry->comm = read_program_name(proc_file);
+            entry->time = now;
+            free_variable(proc_file);
+
+            g_hash_table_replace(context->comms, GINT_TO_POINTER(pid), entry);
+        }
+
+    return entry->comm;
+}
+
+
+#ifdef FAN_REPORT_DFID_NAME
+/**
+ * Finds an opened directory on the filesystem fsid.
+ * @param context is the fanotify loop's context.
+ * @param fsid is the filesystem id reported by the event.
+ * @returns a file descriptor usable with open_by_handle_at() or -1.
+ */
+static gint get_mount_fd(fanotify_context_t *context, gpointer fsid)
+{
+    GSList *head = context->mount_fds;
+    mount_fd_t *mount_fd = NULL;
+
+    while (head != NULL)
+        {
+            mount_fd = (mount_fd_t *) head->data;
+
+            if (memcmp(&mount_fd->fsid, fsid, sizeof(fsid_t)) == 0)
+                {
+                    return mount_fd->fd;
+                }
+
+            head = g_slist_next(head);
+        }
+
+    return -1;
+}
+
+
+/**
+ * Gets the path of the file concerned by an event that reports a
+ * directory file handle and a name (FAN_REPORT_DFID_NAME). Paths of
+ * directories are cached by file handle so that a readlink is only
+ * needed for the first event in a directory.
+ * @note a directory renamed while its handle is in the cache keeps its
+ *       old path until the cache is emptied.
+ * @param context is the fanotify loop's context.
+ * @param event is the fanotify's structure event.
+ * @returns a newly allocated path or NULL if it can not be resolved.
+ */
+static gchar *get_file_path_from_fid(fanotify_context_t *context, struct fanotify_event_metadata *event)
+{
+    struct fanotify_event_info_fid *fid = NULL;
+    struct file_handle *handle = NULL;
+    GBytes *key = NULL;
+    gchar *name = NULL;
+    gchar *directory = NULL;
+    gint mount_fd = -1;
+    gint fd = -1;
+
+    if (event->event_len < event->metadata_len + sizeof(struct fanotify_event_info_fid))
         {
             return NULL;
         }
 
-    buffer = (gchar *) g_malloc(PATH_MAX);
+    fid = (struct fanotify_event_info_fid *) ((gchar *) event + event->metadata_len);
 
-    /* Read file contents into buffer */
-    if ((len = read(fd, buffer, PATH_MAX - 1)) <= 0)
+    if (fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME)
         {
-            close (fd);
-            free_variable(buffer);
             return NULL;
         }
-    else
+
+    handle = (struct file_handle *) fid->handle;
+    name = (gchar *) (handle->f_handle + handle->handle_bytes);
+
+    /* fsid and file handle are contiguous: together they identify the directory */
+    key = g_bytes_new(&fid->fsid, sizeof(fid->fsid) + sizeof(struct file_handle) + handle->handle_bytes);
+    directory = (gchar *) g_hash_table_lookup(context->dir_handles, key);
+
+    if (directory == NULL)
         {
-            close (fd);
+            mount_fd = get_mount_fd(context, &fid->fsid);
 
-            buffer[len] = '\0';
-            aux = strstr(buffer, "^@");
+            if (mount_fd >= 0 && (fd = open_by_handle_at(mount_fd, handle, O_PATH)) >= 0)
+                {
+                    directory = get_file_path_from_fd(fd);
+                    close(fd);
+                }
 
-            if (aux)
+            if (directory != NULL)
                 {
-                    *aux = '\0';
+                    if (g_hash_table_size(context->dir_handles) >= FANOTIFY_CACHE_MAX_ENTRIES)
+                        {
+                            g_hash_table_remove_all(context->dir_handles);
+                        }
+
+                    g_hash_table_insert(context->dir_handles, key, directory);
+                    key = NULL;
                 }
+        }
+
+    if (key != NULL)
+        {
+            g_bytes_unref(key);
+        }
 
-            return buffer;
+    if (directory == NULL)
+        {
+            return NULL;
+        }
+    else if (g_strcmp0(name, ".") == 0)
+        {
+            /* The event concerns the directory itself */
+            return g_strdup(directory);
+        }
+    else
+        {
+            return g_build_filename(directory, name, NULL);
         }
 }
+#endif
 
 
 /**
@@ -185,7 +361,7 @@ static void prepare_before_saving(main_struct_t *main_struct, gchar *path)
         {
             directory = g_path_get_dirname(path);
             file = g_file_new_for_path(path);
-            fileinfo = g_file_query_info(file, "*", G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL, &error);
+            fileinfo = g_file_query_info(file, FILE_META_DATA_ATTRIBUTES, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL, &error);
 
             if (error == NULL && fileinfo != NULL)
                 {
@@ -193,8 +369,8 @@ static void prepare_before_saving(main_struct_t *main_struct, gchar *path)
                      * save_one_file_threaded where the queue save_queue
                      * is used
                      */
-                    file_event = new_file_event_t(directory, fileinfo);
-                    g_async_queue_push(main_struct->save_queue, file_event);
+                    file_event = new_file_event_t(directory, fileinfo, FALSE);
+                    push_to_save_scheduler(main_struct->save_queue, file_event);
 
                     free_object(fileinfo);
                     free_object(file);
@@ -210,43 +386,137 @@ static void prepare_before_saving(main_struct_t *main_struct, gchar *path)
 
 
 /**
- * Returns the pointer to the concerned directory if found NULL otherwise
- * @param path path where the event occured
- * @param dir_list monitored directory list
- * @returns a pointer to the monitored directory where the event occured
+ * Records an event on a file and wakes the coalescer's thread up when
+ * the file was not pending.
+ * @param main_struct : main structure of the program.
+ * @param path is the entire path and name of the considered file.
+ */
+static void coalesce_event(main_struct_t *main_struct, gchar *path)
+{
+    event_coalescer_t *coalescer = main_struct->coalescer;
+
+    g_mutex_lock(&coalescer->mutex);
+
+    if (record_pending_event(coalescer, path, g_get_monotonic_time()) == TRUE)
+        {
+            /* This file may be the next one to be saved */
+            g_cond_signal(&coalescer->cond);
+        }
+
+    g_mutex_unlock(&coalescer->mutex);
+}
+
+
+/**
+ * Thread that saves pending files when their deadline is reached.
+ * @param data : main structure of the program.
+ * @returns NULL when stop_event_coalescer() is called.
  */
-static GSList *does_event_concerns_monitored_directory(gchar *path, GSList *dir_list)
+static gpointer coalescer_thread(gpointer data)
 {
-    GSList *head = dir_list;
-    gchar *pathutf8 = NULL;   /* path where the received event occured */
-    gchar *dirutf8 = NULL;
-    gboolean found = FALSE;
+    main_struct_t *main_struct = (main_struct_t *) data;
+    event_coalescer_t *coalescer = main_struct->coalescer;
+    pending_event_t *pending = NULL;
+    GSList *due_list = NULL;
+    GSList *head = NULL;
+    gint64 next = 0;
 
-    pathutf8 = g_utf8_casefold(path, -1);
+    g_mutex_lock(&coalescer->mutex);
 
-    while (head != NULL && found == FALSE)
+    while (coalescer->stop == FALSE)
         {
-            dirutf8 = head->data;
+            due_list = pop_due_pending_events(coalescer, g_get_monotonic_time(), &next);
 
-            if (g_str_has_prefix(pathutf8, dirutf8) == TRUE)
+            if (due_list != NULL)
                 {
-                    found = TRUE;
+                    /* Saving is done without the lock so that events may still be recorded */
+                    g_mutex_unlock(&coalescer->mutex);
+
+                    head = due_list;
+
+                    while (head != NULL)
+                        {
+                            pending = (pending_event_t *) head->data;
+                            prepare_before_saving(main_struct, pending->path);
+                            head = g_slist_next(head);
+                        }
+
+                    g_slist_free_full(due_list, free_pending_event_t);
+                    due_list = NULL;
+
+                    g_mutex_lock(&coalescer->mutex);
+                }
+            else if (next == G_MAXINT64)
+                {
+                    g_cond_wait(&coalescer->cond, &coalescer->mutex);
                 }
             else
                 {
-                    head = g_slist_next(head);
+                    g_cond_wait_until(&coalescer->cond, &coalescer->mutex, next);
                 }
         }
 
-    free_variable(pathutf8);
+    g_mutex_unlock(&coalescer->mutex);
+
+    return NULL;
+}
+
 
-    if (found == TRUE)
+/**
+ * Creates the coalescer of fanotify events, stores it into
+ * main_struct->coalescer and starts its thread.
+ * @param main_struct : main structure of the program.
+ * @returns a newly allocated event_coalescer_t or NULL if events must
+ *          not be coalesced (event-quiet-period is 0).
+ */
+event_coalescer_t *start_event_coalescer(main_struct_t *main_struct)
+{
+    event_coalescer_t *coalescer = NULL;
+    options_t *opt = NULL;
+
+    g_assert_nonnull(main_struct);
+    g_assert_nonnull(main_struct->opt);
+
+    opt = main_struct->opt;
+
+    if (opt->event_quiet_period > 0)
         {
-            return head;
+            coalescer = new_event_coalescer_t((gint64) opt->event_quiet_period * 1000, (gint64) MAX(opt->event_max_delay, opt->event_quiet_period) * 1000);
+
+            main_struct->coalescer = coalescer;
+            coalescer->thread = g_thread_new("event-coalescer", coalescer_thread, main_struct);
         }
-    else
+
+    return coalescer;
+}
+
+
+/**
+ * Stops the coalescer's thread, waits for it to end and frees the
+ * coalescer. Files still pending are not saved.
+ * @param main_struct : main structure of the program
+ *        (main_struct->coalescer may be NULL).
+ */
+void stop_event_coalescer(main_struct_t *main_struct)
+{
+    event_coalescer_t *coalescer = NULL;
+
+    g_assert_nonnull(main_struct);
+
+    coalescer = main_struct->coalescer;
+
+    if (coalescer != NULL)
         {
-            return NULL;
+            g_mutex_lock(&coalescer->mutex);
+            coalescer->stop = TRUE;
+            g_cond_signal(&coalescer->cond);
+            g_mutex_unlock(&coalescer->mutex);
+
+            g_thread_join(coalescer->thread);
+
+            /* fanotify's loop has ended: nobody records events anymore */
+            main_struct->coalescer = NULL;
+            free_event_coalescer_t(coalescer);
         }
 }
 
@@ -254,23 +524,21 @@ static GSList *does_event_concerns_monitored_directory(gchar *path, GSList *dir_
 /**
  * Filters out and returns TRUE if the event concerns a file that has to
  * be saved FALSE otherwise
- * @param head is the matching monitired directory
+ * @param context is the fanotify loop's context.
+ * @param directory is the matching monitored directory (or NULL).
  * @param event is the fanotify's structure event
  */
-static gboolean filter_out_if_necessary(GSList *head, struct fanotify_event_metadata *event)
+static gboolean filter_out_if_necessary(fanotify_context_t *context, gchar *directory, struct fanotify_event_metadata *event)
 {
     gchar *progname = NULL;
 
-
-    if (head != NULL)
+    if (directory != NULL && event->pid != getpid())
         {
-            progname = get_program_name_from_pid(event->pid);
+            progname = get_program_name_from_pid(context, event->pid);
 
-            if (g_strcmp0(PROGRAM_NAME, progname) != 0)
+            if (context->own_comm == NULL || g_strcmp0(context->own_comm, progname) != 0)
                 {
                     /* Save files that does not come from our activity */
-                    free_variable(progname);
-
                     return TRUE;
                 }
         }
@@ -283,29 +551,39 @@ static gboolean filter_out_if_necessary(GSList *head, struct fanotify_event_meta
  * Processes events
  * @param main_struct is the maion structure
  * @param event is the fanotify's structure event
- * @param dir_list MUST be a list of gchar * g_utf8_casefold()
- *        transformed.
+ * @param context is the fanotify loop's context.
  */
-static void event_process(main_struct_t *main_struct, struct fanotify_event_metadata *event, GSList *dir_list)
+static void event_process(main_struct_t *main_struct, struct fanotify_event_metadata *event, fanotify_context_t *context)
 {
     gchar *path = NULL;
+    gchar *directory = NULL;
     gboolean to_save = FALSE;
-    GSList *head = NULL;
 
+#ifdef FAN_REPORT_DFID_NAME
+    if (context->fid == TRUE)
+        {
+            path = get_file_path_from_fid(context, event);
+        }
+    else
+        {
+            path = get_file_path_from_fd(event->fd);
+        }
+#else
     path = get_file_path_from_fd(event->fd);
+#endif
 
     if (path != NULL)
         {
             /* Does the event concern a monitored directory ? */
-            head = does_event_concerns_monitored_directory(path, dir_list);
+            directory = find_in_dir_trie(context->dirs, path);
 
             /* Do we need to save this file ? Is it excluded somehow ? */
-            to_save = filter_out_if_necessary(head, event);
+            to_save = filter_out_if_necessary(context, directory, event);
 
             if (to_save == TRUE)
                 {
                     print_debug(_("Received event file/directory: %s\n"), path);
-                    print_debug(_(" matching directory is: %s\n"), head->data);
+                    print_debug(_(" matching directory is: %s\n"), directory);
 
                     /* we are only watching this event so it is not necessary to print it !
                      * if (event->mask & FAN_CLOSE_WRITE)
@@ -314,13 +592,20 @@ static void event_process(main_struct_t *main_struct, struct fanotify_event_meta
                      *   }
                      */
 
-                    /* Saving the file effectively */
-                    prepare_before_saving(main_struct, path);
+                    /* Saving the file effectively (once events on it calm down) */
+                    if (main_struct->coalescer != NULL)
+                        {
+                            coalesce_event(main_struct, path);
+                        }
+                    else
+                        {
+                            prepare_before_saving(main_struct, path);
+                        }
 
                     fflush(stdout);
                 }
 
-            close(event->fd);
+            /* event->fd is closed by fanotify_loop() */
             free_variable(path);
         }
 }
@@ -336,18 +621,27 @@ void stop_fanotify(options_t *opt, int fanotify_fd)
 {
     GSList *head = NULL;
     /* Setup fanotify notifications (FAN) mask. All these defined in linux/fanotify.h.    */
-    static uint64_t event_mask =
+    uint64_t event_mask =
       (FAN_CLOSE_WRITE   |  /* Writtable file closed                                      */
        FAN_ONDIR         |  /* We want to be reported of events in the directory          */
        FAN_EVENT_ON_CHILD); /* We want to be reported of events in files of the directory */
+    unsigned int mark_flags = FAN_MARK_REMOVE | FAN_MARK_MOUNT;
 
     if (opt != NULL)
         {
+#ifdef FAN_REPORT_DFID_NAME
+            if (opt->fanotify_fid == TRUE)
+                {
+                    event_mask = FAN_CLOSE_WRITE;
+                    mark_flags = FAN_MARK_REMOVE | FAN_MARK_FILESYSTEM;
+                }
+#endif
+
             head = opt->dirname_list;
 
             while (head != NULL)
                 {
-                    fanotify_mark(fanotify_fd, FAN_MARK_REMOVE, event_mask, AT_FDCWD, head->data);
+                    fanotify_mark(fanotify_fd, mark_flags, event_mask, AT_FDCWD, head->data);
                     head = g_slist_next(head);
                 }
 
@@ -358,32 +652,96 @@ void stop_fanotify(options_t *opt, int fanotify_fd)
 
 
 /**
- * Transforms a list of directory into a list of directory ready for
- * comparison
- * @param dir_list is the list of directories to be transformed. This
- *        list is leaved untouched.
- * @returns a newly allocated list that may be freed when no longer
- *          needed.
+ * Creates the context of the fanotify loop: the trie of monitored
+ * directories, the pid cache and, in FID mode, one opened directory per
+ * filesystem to resolve file handles.
+ * @param opt is the options of the program.
+ * @returns a newly allocated fanotify_context_t.
  */
-static GSList *transform_to_utf8_casefold(GSList *dir_list)
+static fanotify_context_t *new_fanotify_context_t(options_t *opt)
 {
+    fanotify_context_t *context = NULL;
+    mount_fd_t *mount_fd = NULL;
+    struct statfs fs;
     GSList *head = NULL;
-    GSList *utf8 = NULL;
-    gchar *charutf8 = NULL;
+    gint fd = -1;
+
+    context = (fanotify_context_t *) g_malloc0(sizeof(fanotify_context_t));
+    g_assert_nonnull(context);
 
-    head = dir_list;
+    context->dirs = new_dir_trie_t();
+    context->comms = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, free_comm_entry_t);
+    context->own_comm = read_program_name("/proc/self/comm");
+    context->fid = opt->fanotify_fid;
+    context->dir_handles = g_hash_table_new_full(g_bytes_hash, g_bytes_equal, (GDestroyNotify) g_bytes_unref, free_variable);
+    context->mount_fds = NULL;
+
+    head = opt->dirname_list;
 
     while (head != NULL)
         {
-            charutf8 = g_utf8_casefold(head->data, -1);
+            insert_into_dir_trie(context->dirs, head->data);
+
+            if (context->fid == TRUE)
+                {
+                    fd = open(head->data, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
 
-            /* Order of utf8 list is not very important */
-            utf8 = g_slist_prepend(utf8, charutf8);
+                    if (fd >= 0 && fstatfs(fd, &fs) == 0)
+                        {
+                            mount_fd = (mount_fd_t *) g_malloc0(sizeof(mount_fd_t));
+                            g_assert_nonnull(mount_fd);
+
+                            mount_fd->fsid = fs.f_fsid;
+                            mount_fd->fd = fd;
+                            context->mount_fds = g_slist_prepend(context->mount_fds, mount_fd);
+                        }
+                    else
+                        {
+                            print_error(__FILE__, __LINE__, _("Unable to open directory %s: %s\n"), head->data, strerror(errno));
+
+                            if (fd >= 0)
+                                {
+                                    close(fd);
+                                }
+                        }
+                }
 
             head = g_slist_next(head);
         }
 
-    return utf8;
+    return context;
+}
+
+
+/**
+ * Frees the context of the fanotify loop and closes the directories
+ * opened to resolve file handles.
+ * @param context is the context to be freed.
+ */
+static void free_fanotify_context_t(fanotify_context_t *context)
+{
+    mount_fd_t *mount_fd = NULL;
+    GSList *head = NULL;
+
+    if (context != NULL)
+        {
+            head = context->mount_fds;
+
+            while (head != NULL)
+                {
+                    mount_fd = (mount_fd_t *) head->data;
+                    close(mount_fd->fd);
+                    free_variable(mount_fd);
+                    head = g_slist_next(head);
+                }
+
+            g_slist_free(context->mount_fds);
+            g_hash_table_destroy(context->dir_handles);
+            g_hash_table_destroy(context->comms);
+            free_dir_trie_t(context->dirs);
+            free_variable(context->own_comm);
+            free_variable(context);
+        }
 }
 
 
@@ -397,8 +755,9 @@ void fanotify_loop(main_struct_t *main_struct)
     char buffer[FANOTIFY_BUFFER_SIZE];
     ssize_t length = 0;
     struct fanotify_event_metadata *fe_mdata = NULL;
-    GSList *dir_list_utf8 = NULL;
+    fanotify_context_t *context = NULL;
     gint fanotify_fd = 0;
+    gboolean stop = FALSE;
 
 
     if (main_struct != NULL)
@@ -406,13 +765,15 @@ void fanotify_loop(main_struct_t *main_struct)
             fanotify_fd = main_struct->fanotify_fd;
 
 
-            /* Setup polling */
+            /* Setup polling: stop_fanotify_loop() writes into fanotify_stop_fd */
+            fds[FD_POLL_SIGNAL].fd = main_struct->fanotify_stop_fd;
+            fds[FD_POLL_SIGNAL].events = POLLIN;
             fds[FD_POLL_FANOTIFY].fd = fanotify_fd;
             fds[FD_POLL_FANOTIFY].events = POLLIN;
 
-            dir_list_utf8 = transform_to_utf8_casefold(main_struct->opt->dirname_list);
+            context = new_fanotify_context_t(main_struct->opt);
 
-            while (1)
+            while (stop == FALSE)
                 {
                     /* Block until there is something to be read */
                     if (poll(fds, FD_POLL_MAX, -1) < 0)
@@ -420,8 +781,12 @@ void fanotify_loop(main_struct_t *main_struct)
                             print_error(__FILE__, __LINE__, _("Couldn't poll(): '%s'\n"), strerror(errno));
                         }
 
+                    if (fds[FD_POLL_SIGNAL].revents & POLLIN)
+                        {
+                            stop = TRUE;
+                        }
                     /* fanotify event received ? */
-                    if (fds[FD_POLL_FANOTIFY].revents & POLLIN)
+                    else if (fds[FD_POLL_FANOTIFY].revents & POLLIN)
                         {
                             /* Read from the FD. It will read all events available up to
                              * the given buffer size. */
@@ -431,7 +796,7 @@ void fanotify_loop(main_struct_t *main_struct)
 
                                     while (FAN_EVENT_OK(fe_mdata, length))
                                         {
-                                            event_process(main_struct, fe_mdata, dir_list_utf8);
+                                            event_process(main_struct, fe_mdata, context);
 
                                             if (fe_mdata->fd > 0)
                                                 {
@@ -443,6 +808,34 @@ void fanotify_loop(main_struct_t *main_struct)
                                 }
                         }
                 }
+
+            free_fanotify_context_t(context);
+        }
+}
+
+
+/**
+ * Ends fanotify_loop() and waits for its thread to end. Nothing is
+ * pushed into save_queue by this thread once this function returns.
+ * @param main_struct : main structure of the program.
+ */
+void stop_fanotify_loop(main_struct_t *main_struct)
+{
+    g_assert_nonnull(main_struct);
+
+    if (main_struct->fanotify_loop != NULL)
+        {
+            if (eventfd_write(main_struct->fanotify_stop_fd, 1) < 0)
+                {
+                    print_error(__FILE__, __LINE__, _("Unable to stop fanotify's loop: %s\n"), strerror(errno));
+                }
+            else
+                {
+                    g_thread_join(main_struct->fanotify_loop);
+                    main_struct->fanotify_loop = NULL;
+                    close(main_struct->fanotify_stop_fd);
+                    main_struct->fanotify_stop_fd = -1;
+                }
         }
 }
 
@@ -30,6 +30,22 @@
 
 #define FANOTIFY_BUFFER_SIZE 49152    /* for 24 bytes events this is 2046 events */
 
+
+/**
+ * @def FANOTIFY_PID_CACHE_TTL
+ * Time (in microseconds) during which the program name of a pid is kept
+ * in cache (pids are reused by the kernel).
+ */
+#define FANOTIFY_PID_CACHE_TTL (5000000)
+
+
+/**
+ * @def FANOTIFY_CACHE_MAX_ENTRIES
+ * Maximum number of entries in the pid and directory handle caches. A
+ * cache is emptied when it reaches this size.
+ */
+#define FANOTIFY_CACHE_MAX_ENTRIES (65536)
+
 /* Enumerate list of FDs to poll */
 enum {
   FD_POLL_SIGNAL = 0,
@@ -39,7 +55,49 @@ enum {
 
 
 /**
- * Inits and starts fanotify notifications
+ * @struct comm_entry_t
+ * @brief Program name of a pid as cached by the fanotify loop.
+ */
+typedef struct
+{
+    gchar *comm;            /**< program name (/proc/<pid>/comm) or NULL if unknown        */
+    gint64 time;            /**< monotonic time when comm has been read                    */
+} comm_entry_t;
+
+
+/**
+ * @struct mount_fd_t
+ * @brief An opened monitored directory used to resolve file handles of
+ *        the filesystem it belongs to.
+ */
+typedef struct
+{
+    fsid_t fsid;            /**< filesystem id                                             */
+    gint fd;                /**< file descriptor of a directory on this filesystem         */
+} mount_fd_t;
+
+
+/**
+ * @struct fanotify_context_t
+ * @brief Everything that the fanotify loop keeps between events.
+ */
+typedef struct
+{
+    dir_trie_t *dirs;          /**< trie of monitored directories                                 */
+    GHashTable *comms;         /**< pid -> comm_entry_t *                                         */
+    gchar *own_comm;           /**< our own program name: our own events are not saved           */
+    gboolean fid;              /**< TRUE when events carry file handles (FAN_REPORT_DFID_NAME)    */
+    GHashTable *dir_handles;   /**< GBytes * (fsid + file handle) -> directory path (gchar *)    */
+    GSList *mount_fds;         /**< list of mount_fd_t * used by open_by_handle_at()             */
+} fanotify_context_t;
+
+
+/**
+ * Inits and starts fanotify notifications. When opt->fanotify_fid is
+ * TRUE filesystems of monitored directories are marked and events
+ * report file handles. If the kernel does not support it
+ * opt->fanotify_fid is set back to FALSE and directories are marked as
+ * usual.
  * @param opt : a filled options_t * structure that contains all options
  *        by default, read into the file or selected in the command line.
  */
@@ -52,10 +110,37 @@ extern gint start_fanotify(options_t *opt);
 extern void stop_fanotify(options_t *opt, int fanotify_fd);
 
 
+/**
+ * Creates the coalescer of fanotify events, stores it into
+ * main_struct->coalescer and starts its thread.
+ * @param main_struct : main structure of the program.
+ * @returns a newly allocated event_coalescer_t or NULL if events must
+ *          not be coalesced (event-quiet-period is 0).
+ */
+extern event_coalescer_t *start_event_coalescer(main_struct_t *main_struct);
+
+
+/**
+ * Stops the coalescer's thread, waits for it to end and frees the
+ * coalescer. Files still pending are not saved.
+ * @param main_struct : main structure of the program
+ *        (main_struct->coalescer may be NULL).
+ */
+extern void stop_event_coalescer(main_struct_t *main_struct);
+
+
 /**
  * fanotify main loop
  * @todo simplify code (CCN is 12 already !)
  */
 extern void fanotify_loop(main_struct_t *main_struct);
 
+
+/**
+ * Ends fanotify_loop() and waits for its thread to end. Nothing is
+ * pushed into save_queue by this thread once this function returns.
+ * @param main_struct : main structure of the program.
+ */
+extern void stop_fanotify_loop(main_struct_t *main_struct);
+
 #endif /* #IFNDEF _M_FANOTIFY_H_ */
@@ -34,6 +34,7 @@ static void read_from_group_client(options_t *opt, GKeyFile *keyfile, gchar *fil
 static void read_from_configuration_file(options_t *opt, gchar *filename);
 static void print_filelist(GSList *filelist, gchar *title);
 static void set_compression_type(options_t *opt, gshort cmptype);
+static void set_compression_level(options_t *opt, gint level);
 
 
 /**
@@ -74,7 +75,13 @@ static void print_selected_options(options_t *opt)
             print_filelist(opt->dirname_list, _("Directory list:\n"));
             print_filelist(opt->exclude_list, _("Exclude list:\n"));
 
-            if (opt->adaptive == FALSE)
+            if (opt->cdc == TRUE)
+                {
+                    blocksize = g_strdup_printf("%" G_GINT64_FORMAT "/%" G_GINT64_FORMAT "/%" G_GINT64_FORMAT, opt->cdc_min_size, opt->cdc_avg_size, opt->cdc_max_size);
+                    fprintf(stdout, _("Blocksize: content defined (min/avg/max): %s\n"), blocksize);
+                    free_variable(blocksize);
+                }
+            else if (opt->adaptive == FALSE)
                 {
                     /**
                      * We need to translate this number into a string before
@@ -93,12 +100,24 @@ static void print_selected_options(options_t *opt)
             print_string_option(_("Configuration file: %s\n"), opt->configfile);
             print_string_option(_("Cache directory: %s\n"), opt->dircache);
             print_string_option(_("Cache database name: %s\n"), opt->dbname);
+            fprintf(stdout, _("Cache database durability: %d\n"), opt->db_durability);
             if (opt->srv_conf != NULL)
                 {
                     print_string_option(_("Server's IP address: %s\n"), opt->srv_conf->ip);
                     fprintf(stdout, _("Server's port number: %d\n"), opt->srv_conf->port);
                 }
             fprintf(stdout, _("Buffersize: %d\n"), opt->buffersize);
+            fprintf(stdout, _("Save workers: %d\n"), opt->save_workers);
+            fprintf(stdout, _("Carve workers: %d\n"), opt->carve_workers);
+            fprintf(stdout, _("Memory budget: %" G_GINT64_FORMAT "\n"), opt->memory_budget);
+            fprintf(stdout, _("Read depth: %d\n"), opt->read_depth);
+            fprintf(stdout, _("Event quiet period: %d ms\n"), opt->event_quiet_period);
+            fprintf(stdout, _("Event max delay: %d ms\n"), opt->event_max_delay);
+            fprintf(stdout, _("fanotify FID mode: %s\n"), opt->fanotify_fid == TRUE ? _("yes") : _("no"));
+            fprintf(stdout, _("HTTP connections: %d\n"), opt->http_connections);
+            fprintf(stdout, _("HTTP uploads in flight: %d\n"), opt->http_in_flight);
+            fprintf(stdout, _("Compression type: %d\n"), opt->cmptype);
+            fprintf(stdout, _("Compression levels (zlib/zstd/lz4): %d/%d/%d\n"), opt->zlib_level, opt->zstd_level, opt->lz4_level);
         }
 }
 
@@ -133,19 +152,52 @@ static void read_from_group_client(options_t *opt, GKeyFile *keyfile, gchar *fil
 
             /* Reading filename of the database if any */
             opt->dbname = read_string_from_file(keyfile, filename, GN_CLIENT, KN_DB_NAME, _("Could not load cache database name"));
+            opt->db_durability = read_int_from_file(keyfile, filename, GN_CLIENT, KN_DB_DURABILITY, _("Could not load cache database durability from file"), opt->db_durability);
 
             /* Adaptative mode for blocksize ? */
             opt->adaptive = read_boolean_from_file(keyfile, filename, GN_CLIENT, KN_ADAPTIVE, _("Could not load adaptive configuration from file."));
 
+            /* Content defined chunking ? */
+            opt->cdc = read_boolean_from_file(keyfile, filename, GN_CLIENT, KN_CDC, _("Could not load content defined chunking configuration from file."));
+            opt->cdc_min_size = read_int64_from_file(keyfile, filename, GN_CLIENT, KN_CDC_MIN_SIZE, _("Could not load cdc-min-size from file"), opt->cdc_min_size);
+            opt->cdc_avg_size = read_int64_from_file(keyfile, filename, GN_CLIENT, KN_CDC_AVG_SIZE, _("Could not load cdc-avg-size from file"), opt->cdc_avg_size);
+            opt->cdc_max_size = read_int64_from_file(keyfile, filename, GN_CLIENT, KN_CDC_MAX_SIZE, _("Could not load cdc-max-size from file"), opt->cdc_max_size);
+
             /* Scanning option */
             opt->noscan = read_boolean_from_file(keyfile, filename, GN_CLIENT, KN_NOSCAN, _("Could not load scan configuration from file."));
 
             /* Buffer size to be used to send data to server */
             opt->buffersize = read_int_from_file(keyfile, filename, GN_CLIENT, KN_BUFFER_SIZE, _("Could not load buffersize from file"), CLIENT_MIN_BUFFER);
 
+            /* Number of threads used to save files */
+            opt->save_workers = read_int_from_file(keyfile, filename, GN_CLIENT, KN_SAVE_WORKERS, _("Could not load save workers number from file"), opt->save_workers);
+
+            /* Number of threads used to carve directories */
+            opt->carve_workers = read_int_from_file(keyfile, filename, GN_CLIENT, KN_CARVE_WORKERS, _("Could not load carve workers number from file"), opt->carve_workers);
+
+            /* Memory that save workers may use all together */
+            opt->memory_budget = read_int64_from_file(keyfile, filename, GN_CLIENT, KN_MEMORY_BUDGET, _("Could not load memory budget from file"), opt->memory_budget);
+
+            /* Number of reads kept in flight when reading a file */
+            opt->read_depth = read_int_from_file(keyfile, filename, GN_CLIENT, KN_READ_DEPTH, _("Could not load read depth from file"), opt->read_depth);
+
+            /* Coalescing of fanotify events */
+            opt->event_quiet_period = read_int_from_file(keyfile, filename, GN_CLIENT, KN_EVENT_QUIET_PERIOD, _("Could not load event quiet period from file"), opt->event_quiet_period);
+            opt->event_max_delay = read_int_from_file(keyfile, filename, GN_CLIENT, KN_EVENT_MAX_DELAY, _("Could not load event max delay from file"), opt->event_max_delay);
+            opt->fanotify_fid = read_boolean_from_file(keyfile, filename, GN_CLIENT, KN_FANOTIFY_FID, _("Could not load fanotify FID mode from file."));
+
+            /* Connections to the server */
+            opt->http_connections = read_int_from_file(keyfile, filename, GN_CLIENT, KN_HTTP_CONNECTIONS, _("Could not load http connections number from file"), opt->http_connections);
+            opt->http_in_flight = read_int_from_file(keyfile, filename, GN_CLIENT, KN_HTTP_IN_FLIGHT, _("Could not load http in flight number from file"), opt->http_in_flight);
+
             /* Compression type if any */
             cmptype = read_int_from_file(keyfile, filename, GN_CLIENT, KN_COMPRESSION_TYPE, _("Compression type not defined in configuration file"), opt->cmptype);
             set_compression_type(opt, cmptype);
+
+            /* Compression levels of each compression type */
+            opt->zlib_level = read_int_from_file(keyfile, filename, GN_CLIENT, KN_ZLIB_LEVEL, _("Could not load zlib compression level from file"), opt->zlib_level);
+            opt->zstd_level = read_int_from_file(keyfile, filename, GN_CLIENT, KN_ZSTD_LEVEL, _("Could not load zstd compression level from file"), opt->zstd_level);
+            opt->lz4_level = read_int_from_file(keyfile, filename, GN_CLIENT, KN_LZ4_LEVEL, _("Could not load lz4 compression level from file"), opt->lz4_level);
         }
 
 }
@@ -214,6 +266,29 @@ static void set_compression_type(options_t *opt, gshort cmptype)
 }
 
 
+/**
+ * Sets the compression level of the selected compression type (it has
+ * no effect when no compression is used).
+ * @param Structure that manage program's options
+ * @param level is the compression level to be used.
+ */
+static void set_compression_level(options_t *opt, gint level)
+{
+    if (opt->cmptype == COMPRESS_ZLIB_TYPE)
+        {
+            opt->zlib_level = level;
+        }
+    else if (opt->cmptype == COMPRESS_ZSTD_TYPE)
+        {
+            opt->zstd_level = level;
+        }
+    else if (opt->cmptype == COMPRESS_LZ4_TYPE)
+        {
+            opt->lz4_level = level;
+        }
+}
+
+
 /**
  * This function parses command line options. It sets the options in this
  * order. It means that the value used for an option is the one set in the
@@ -237,6 +312,7 @@ options_t *manage_command_line_options(int argc, char **argv)
     gboolean version = FALSE;      /** True if -v was selected on the command line            */
     gint debug = -4;               /** 0 == FALSE and other values == TRUE                    */
     gint adaptive = -1;            /** 0 == FALSE and other positive values == TRUE           */
+    gint cdc = -1;                 /** 0 == FALSE and other positive values == TRUE           */
     gchar **dirname_array = NULL;  /** array of dirnames left on the command line             */
     gchar **exclude_array = NULL;  /** array of dirnames and filenames to be excluded         */
     gchar *configfile = NULL;      /** filename for the configuration file if any             */
@@ -248,6 +324,17 @@ options_t *manage_command_line_options(int argc, char **argv)
     gint port = 0;                 /** Port number on which to send things to the server      */
     gshort cmptype = -1;           /** compression type to be used when communicating         */
     gboolean noscan = FALSE;       /** If set to TRUE then do not do the first directory scan */
+    gint save_workers = -1;        /** number of threads that save files concurrently         */
+    gint carve_workers = -1;       /** number of threads that carve directories concurrently  */
+    gint64 memory_budget = 0;      /** bytes of file data that may be held in memory          */
+    gint read_depth = -1;          /** number of reads kept in flight for each file           */
+    gint quiet_period = -1;        /** milliseconds without event before saving a file        */
+    gint max_delay = -1;           /** maximum milliseconds before saving a modified file     */
+    gint fanotify_fid = -1;        /** 0 == FALSE and other positive values == TRUE           */
+    gint http_connections = -1;    /** number of keep-alive connections to the server         */
+    gint http_in_flight = -1;      /** number of data uploads in flight for each save worker  */
+    gint db_durability = -1;       /** durability of the cache database's commits             */
+    gint cmplevel = G_MININT;      /** compression level for the selected compression type    */
     srv_conf_t *srv_conf = NULL;
 
     GOptionEntry entries[] =
@@ -257,19 +344,31 @@ options_t *manage_command_line_options(int argc, char **argv)
         { "configuration", 'c', 0, G_OPTION_ARG_STRING, &configfile, N_("Specify an alternative configuration file."), N_("FILENAME")},
         { "blocksize", 'b', 0, G_OPTION_ARG_INT64, &blocksize, N_("Fixed block SIZE used to compute hashs."), N_("SIZE")},
         { "adaptive", 'a', 0, G_OPTION_ARG_INT, &adaptive, N_("Adapative block size used to compute hashs."), N_("BOOLEAN")},
+        { "cdc", 'C', 0, G_OPTION_ARG_INT, &cdc, N_("Content defined blocks used to compute hashs."), N_("BOOLEAN")},
         { "buffersize", 's', 0, G_OPTION_ARG_INT, &buffersize, N_("SIZE of the cache used to send data to server."), N_("SIZE")},
         { "dircache", 'r', 0, G_OPTION_ARG_STRING, &dircache, N_("Directory DIRNAME where to cache files."), N_("DIRNAME")},
         { "dbname", 'f', 0, G_OPTION_ARG_STRING, &dbname, N_("Database FILENAME."), N_("FILENAME")},
+        { "db-durability", 0, 0, G_OPTION_ARG_INT, &db_durability, N_("Durability LEVEL of the cache database: 0 is fast, 1 is normal and 2 is full."), N_("LEVEL")},
         { "ip", 'i', 0, G_OPTION_ARG_STRING, &ip, N_("IP address where server program is."), "IP"},
         { "port", 'p', 0, G_OPTION_ARG_INT, &port, N_("Port NUMBER on which to listen."), N_("NUMBER")},
         { "exclude", 'x', 0, G_OPTION_ARG_FILENAME_ARRAY, &exclude_array, N_("Exclude FILENAME from being saved."), N_("FILENAME")},
         { "no-scan", 'n', 0, G_OPTION_ARG_NONE, &noscan, N_("Does not do the first directory scan."), NULL},
-        { "compression", 'z', 0, G_OPTION_ARG_INT, &cmptype, N_("Compression type to use: 0 is NONE, 1 is ZLIB"), N_("NUMBER")},
+        { "save-workers", 'w', 0, G_OPTION_ARG_INT, &save_workers, N_("NUMBER of threads used to save files (0 means one per processor)."), N_("NUMBER")},
+        { "carve-workers", 0, 0, G_OPTION_ARG_INT, &carve_workers, N_("NUMBER of threads used to carve directories (0 means one per processor)."), N_("NUMBER")},
+        { "memory-budget", 'm', 0, G_OPTION_ARG_INT64, &memory_budget, N_("SIZE in bytes of file data that may be held in memory."), N_("SIZE")},
+        { "read-depth", 0, 0, G_OPTION_ARG_INT, &read_depth, N_("NUMBER of reads kept in flight when reading a file (0 means synchronous reads)."), N_("NUMBER")},
+        { "event-quiet-period", 0, 0, G_OPTION_ARG_INT, &quiet_period, N_("MILLISECONDS without any event on a file before saving it (0 saves it at each event)."), N_("MILLISECONDS")},
+        { "event-max-delay", 0, 0, G_OPTION_ARG_INT, &max_delay, N_("Maximum MILLISECONDS between the first event on a file and its save."), N_("MILLISECONDS")},
+        { "fanotify-fid", 0, 0, G_OPTION_ARG_INT, &fanotify_fid, N_("Marks whole filesystems and resolves events with file handles (linux >= 5.9)."), N_("BOOLEAN")},
+        { "http-connections", 0, 0, G_OPTION_ARG_INT, &http_connections, N_("NUMBER of keep-alive connections to the server (0 means one per save worker)."), N_("NUMBER")},
+        { "http-in-flight", 0, 0, G_OPTION_ARG_INT, &http_in_flight, N_("NUMBER of data uploads each save worker may have in flight."), N_("NUMBER")},
+        { "compression", 'z', 0, G_OPTION_ARG_INT, &cmptype, N_("Compression type to use: 0 is NONE, 1 is ZLIB, 2 is ZSTD, 3 is LZ4"), N_("NUMBER")},
+        { "compression-level", 0, 0, G_OPTION_ARG_INT, &cmplevel, N_("Compression LEVEL used with the selected compression type."), N_("LEVEL")},
         { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &dirname_array, "", NULL},
         { NULL }
     };
 
-    summary = g_strdup(_("This program is monitoring file changes in the filesystem and is hashing\nfiles with SHA256 algorithms from Glib."));
+    summary = g_strdup(_("This program is monitoring file changes in the filesystem and is hashing\nfiles with SHA256 algorithm."));
     parse_command_line(argc, argv, entries, summary);
 
     set_debug_mode(ENABLE_DEBUG);
@@ -286,7 +385,24 @@ options_t *manage_command_line_options(int argc, char **argv)
     opt->dbname = g_strdup("filecache.db");
     opt->buffersize = -1;
     opt->adaptive = FALSE;
+    opt->cdc = FALSE;
+    opt->cdc_min_size = 0;
+    opt->cdc_avg_size = CDC_DEFAULT_AVG_SIZE;
+    opt->cdc_max_size = 0;
     opt->cmptype = 0;
+    opt->zlib_level = COMPRESS_ZLIB_DEFAULT_LEVEL;
+    opt->zstd_level = COMPRESS_ZSTD_DEFAULT_LEVEL;
+    opt->lz4_level = COMPRESS_LZ4_DEFAULT_LEVEL;
+    opt->save_workers = 0;
+    opt->carve_workers = 0;
+    opt->memory_budget = CLIENT_DEFAULT_MEMORY_BUDGET;
+    opt->read_depth = READER_DEFAULT_DEPTH;
+    opt->event_quiet_period = CLIENT_DEFAULT_EVENT_QUIET_PERIOD;
+    opt->event_max_delay = CLIENT_DEFAULT_EVENT_MAX_DELAY;
+    opt->fanotify_fid = FALSE;
+    opt->http_connections = TRANSPORT_DEFAULT_CONNECTIONS;
+    opt->http_in_flight = TRANSPORT_DEFAULT_IN_FLIGHT;
+    opt->db_durability = DATABASE_DURABILITY_NORMAL;
     opt->srv_conf = NULL;
 
     srv_conf = new_srv_conf_t();
@@ -333,6 +449,11 @@ options_t *manage_command_line_options(int argc, char **argv)
             set_compression_type(opt, cmptype);
         }
 
+    if (cmplevel != G_MININT)
+        {
+            set_compression_level(opt, cmplevel);
+        }
+
     g_strfreev(dirname_array);
     g_strfreev(exclude_array);
 
@@ -341,6 +462,12 @@ options_t *manage_command_line_options(int argc, char **argv)
             opt->blocksize = blocksize;
         }
 
+    /* Servers refuse blocks (of zeros) longer than BLOCK_MAX_SIZE */
+    if (opt->blocksize <= 0 || opt->blocksize > BLOCK_MAX_SIZE)
+        {
+            opt->blocksize = CLIENT_BLOCK_SIZE;
+        }
+
     opt->dircache = set_option_str(dircache, opt->dircache);
     opt->dbname = set_option_str(dbname, opt->dbname);
 
@@ -362,6 +489,36 @@ options_t *manage_command_line_options(int argc, char **argv)
             opt->adaptive = FALSE;
         }
 
+    if (cdc > 0)
+        {
+            opt->cdc = TRUE;
+        }
+    else if (cdc == 0)
+        {
+            opt->cdc = FALSE;
+        }
+
+    /* Sizes must be coherent: min < avg < max (see new_cdc_params_t()) */
+    if (opt->cdc_avg_size < CDC_MIN_AVG_SIZE || opt->cdc_avg_size > BLOCK_MAX_SIZE / 8)
+        {
+            opt->cdc_avg_size = CDC_DEFAULT_AVG_SIZE;
+        }
+
+    if (opt->cdc_min_size <= 0 || opt->cdc_min_size >= opt->cdc_avg_size)
+        {
+            opt->cdc_min_size = opt->cdc_avg_size / 4;
+        }
+
+    if (opt->cdc_max_size <= opt->cdc_avg_size)
+        {
+            opt->cdc_max_size = opt->cdc_avg_size * 8;
+        }
+
+    if (opt->cdc_max_size > BLOCK_MAX_SIZE)
+        {
+            opt->cdc_max_size = BLOCK_MAX_SIZE;
+        }
+
     if (buffersize > 0)
         {
             opt->buffersize = buffersize;
@@ -371,6 +528,90 @@ options_t *manage_command_line_options(int argc, char **argv)
             opt->buffersize = CLIENT_MIN_BUFFER;
         }
 
+    if (save_workers >= 0)
+        {
+            opt->save_workers = save_workers;
+        }
+
+    if (opt->save_workers <= 0)
+        {
+            opt->save_workers = g_get_num_processors();
+        }
+
+    if (carve_workers >= 0)
+        {
+            opt->carve_workers = carve_workers;
+        }
+
+    if (opt->carve_workers <= 0)
+        {
+            opt->carve_workers = g_get_num_processors();
+        }
+
+    if (quiet_period >= 0)
+        {
+            opt->event_quiet_period = quiet_period;
+        }
+
+    if (max_delay >= 0)
+        {
+            opt->event_max_delay = max_delay;
+        }
+
+    if (fanotify_fid > 0)
+        {
+            opt->fanotify_fid = TRUE;
+        }
+    else if (fanotify_fid == 0)
+        {
+            opt->fanotify_fid = FALSE;
+        }
+
+    if (http_connections >= 0)
+        {
+            opt->http_connections = http_connections;
+        }
+
+    if (http_in_flight >= 0)
+        {
+            opt->http_in_flight = http_in_flight;
+        }
+
+    if (opt->http_connections < 0)
+        {
+            opt->http_connections = 0;
+        }
+
+    if (opt->http_in_flight < 0)
+        {
+            opt->http_in_flight = 0;
+        }
+
+    if (read_depth >= 0)
+        {
+            opt->read_depth = read_depth;
+        }
+
+    if (db_durability >= 0)
+        {
+            opt->db_durability = db_durability;
+        }
+
+    if (opt->db_durability < DATABASE_DURABILITY_FAST || opt->db_durability > DATABASE_DURABILITY_FULL)
+        {
+            print_error(__FILE__, __LINE__, _("Unknown cache database durability %d: using normal durability\n"), opt->db_durability);
+            opt->db_durability = DATABASE_DURABILITY_NORMAL;
+        }
+
+    if (memory_budget > 0)
+        {
+            opt->memory_budget = memory_budget;
+        }
+    else if (opt->memory_budget <= 0)
+        {
+            opt->memory_budget = CLIENT_DEFAULT_MEMORY_BUDGET;
+        }
+
     free_variable(ip);
     free_variable(dbname);
     free_variable(dircache);
@@ -47,8 +47,25 @@ typedef struct
     srv_conf_t *srv_conf; /**< Server configuration (mainly ip and port where the server is supposed to be listening  */
     gint buffersize;      /**< buffersize is an option to choose how many bytes we may accumulate before sending them */
     gboolean adaptive;    /**< adaptive will make client compute hashs with an adaptive blocksize if TRUE             */
+    gboolean cdc;         /**< cdc will make client cut files into content defined blocks if TRUE                     */
+    gint64 cdc_min_size;  /**< minimum size in bytes of a content defined block                                       */
+    gint64 cdc_avg_size;  /**< average size in bytes of a content defined block                                       */
+    gint64 cdc_max_size;  /**< maximum size in bytes of a content defined block                                       */
     gboolean noscan;      /**< noscan will avoid the first directory scan when set to TRUE. default = FALSE           */
     gshort cmptype;       /**< compression type to be used when communicating. See compress.h for available types     */
+    gint zlib_level;      /**< compression level used with zlib                                                       */
+    gint zstd_level;      /**< compression level used with zstd                                                       */
+    gint lz4_level;       /**< compression level used with lz4 (above 1 selects lz4hc)                                */
+    gint save_workers;    /**< number of threads that save files concurrently (0 means one per processor)             */
+    gint64 memory_budget; /**< maximum bytes of file data held in memory by all save workers together                 */
+    gint carve_workers;   /**< number of threads that carve directories concurrently (0 means one per processor)     */
+    gint event_quiet_period; /**< milliseconds without event on a file before saving it (0 saves at each event)       */
+    gint event_max_delay; /**< maximum milliseconds between the first event on a file and its save                  */
+    gint read_depth;      /**< number of reads kept in flight for each file (0 or 1 means synchronous GIO reads)     */
+    gboolean fanotify_fid; /**< TRUE to mark whole filesystems and resolve events with file handles (linux >= 5.9)   */
+    gint http_connections; /**< number of keep-alive connections to the server (0 means one per thread, no transport)  */
+    gint http_in_flight;  /**< number of data uploads that a save worker may have in flight                          */
+    gint db_durability;   /**< DATABASE_DURABILITY_* durability of the cache database's commits                        */
 } options_t;
 
 
@@ -0,0 +1,253 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    scheduler.c
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file scheduler.c
+ *
+ * This file does the scheduling of files to be saved. Files modified
+ * while the program runs (live lane) are saved before the ones found
+ * while carving directories (carve lane). In each lane a file's
+ * deadline is its arrival time plus CLIENT_SCHEDULER_AGING for each
+ * doubling of its size and files are saved in deadline order: small
+ * files are protected first and a big file only waits a bounded time.
+ */
+
+#include "client.h"
+
+static gint64 get_size_weight(file_event_t *file_event);
+static gint compare_scheduled_events(gconstpointer a, gconstpointer b, gpointer user_data);
+static file_event_t *pop_first_of_lane(GSequence *lane);
+
+
+/**
+ * Creates an empty save scheduler.
+ * @returns a newly allocated save_scheduler_t that lives as long as the
+ *          program.
+ */
+save_scheduler_t *new_save_scheduler_t(void)
+{
+    save_scheduler_t *scheduler = NULL;
+
+    scheduler = (save_scheduler_t *) g_malloc0(sizeof(save_scheduler_t));
+    g_assert_nonnull(scheduler);
+
+    g_mutex_init(&scheduler->mutex);
+    g_cond_init(&scheduler->cond);
+    scheduler->live = g_sequence_new(g_free);
+    scheduler->carve = g_sequence_new(g_free);
+    scheduler->number = 0;
+    scheduler->burst = 0;
+    scheduler->stopped = FALSE;
+
+    return scheduler;
+}
+
+
+/**
+ * @param file_event is a file event.
+ * @returns the time (in microseconds) that the file waits because of
+ *          its size: CLIENT_SCHEDULER_AGING per doubling of the size.
+ */
+static gint64 get_size_weight(file_event_t *file_event)
+{
+    guint64 size = 0;
+    gint64 weight = 0;
+
+    if (file_event != NULL && file_event->fileinfo != NULL)
+        {
+            size = (guint64) g_file_info_get_size(file_event->fileinfo);
+        }
+
+    while (size > 1)
+        {
+            size = size >> 1;
+            weight = weight + CLIENT_SCHEDULER_AGING;
+        }
+
+    return weight;
+}
+
+
+/**
+ * Compares two scheduled events by deadline and then by arrival order.
+ * @param a is a scheduled_event_t *.
+ * @param b is a scheduled_event_t *.
+ * @param user_data is not used.
+ * @returns a negative value if a has to be saved before b, a positive
+ *          value otherwise (0 only when a and b are the same event).
+ */
+static gint compare_scheduled_events(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+    const scheduled_event_t *event_a = (const scheduled_event_t *) a;
+    const scheduled_event_t *event_b = (const scheduled_event_t *) b;
+
+    if (event_a->deadline != event_b->deadline)
+        {
+            return (event_a->deadline < event_b->deadline) ? -1 : 1;
+        }
+    else if (event_a->number != event_b->number)
+        {
+            return (event_a->number < event_b->number) ? -1 : 1;
+        }
+    else
+        {
+            return 0;
+        }
+}
+
+
+/**
+ * Pushes a file event into its lane: the carve lane when
+ * file_event->carved is TRUE and the live lane otherwise.
+ * @param scheduler is the save scheduler.
+ * @param file_event is the event to be saved. It is owned by the
+ *        scheduler until it is popped.
+ */
+void push_to_save_scheduler(save_scheduler_t *scheduler, file_event_t *file_event)
+{
+    push_to_save_scheduler_at(scheduler, file_event, g_get_monotonic_time());
+}
+
+
+/**
+ * Pushes a file event into its lane as if it arrived at a given time.
+ * @param scheduler is the save scheduler.
+ * @param file_event is the event to be saved. It is owned by the
+ *        scheduler until it is popped.
+ * @param now is the monotonic time of arrival of the event.
+ */
+void push_to_save_scheduler_at(save_scheduler_t *scheduler, file_event_t *file_event, gint64 now)
+{
+    scheduled_event_t *scheduled = NULL;
+
+    g_assert_nonnull(scheduler);
+    g_assert_nonnull(file_event);
+
+    scheduled = (scheduled_event_t *) g_malloc0(sizeof(scheduled_event_t));
+    g_assert_nonnull(scheduled);
+
+    scheduled->file_event = file_event;
+    scheduled->deadline = now + get_size_weight(file_event);
+
+    g_mutex_lock(&scheduler->mutex);
+
+    scheduled->number = scheduler->number;
+    scheduler->number = scheduler->number + 1;
+
+    if (file_event->carved == TRUE)
+        {
+            g_sequence_insert_sorted(scheduler->carve, scheduled, compare_scheduled_events, NULL);
+        }
+    else
+        {
+            g_sequence_insert_sorted(scheduler->live, scheduled, compare_scheduled_events, NULL);
+        }
+
+    g_cond_signal(&scheduler->cond);
+    g_mutex_unlock(&scheduler->mutex);
+}
+
+
+/**
+ * Removes the first event of a lane.
+ * @param lane is a non empty lane of the scheduler.
+ * @returns the file_event_t * of the first event of the lane.
+ */
+static file_event_t *pop_first_of_lane(GSequence *lane)
+{
+    GSequenceIter *first = NULL;
+    scheduled_event_t *scheduled = NULL;
+    file_event_t *file_event = NULL;
+
+    first = g_sequence_get_begin_iter(lane);
+    scheduled = (scheduled_event_t *) g_sequence_get(first);
+    file_event = scheduled->file_event;
+
+    /* frees scheduled (g_free is the sequence's destroy function) */
+    g_sequence_remove(first);
+
+    return file_event;
+}
+
+
+/**
+ * Pops the next file event to be saved. Waits until there is one. The
+ * live lane is served first but after CLIENT_SCHEDULER_LIVE_BURST
+ * events in a row one event is taken from the carve lane so that a
+ * storm of modifications does not stop the carving.
+ * @param scheduler is the save scheduler.
+ * @returns a file_event_t * that has to be freed by the caller or NULL
+ *          when the scheduler has been stopped.
+ */
+file_event_t *pop_from_save_scheduler(save_scheduler_t *scheduler)
+{
+    file_event_t *file_event = NULL;
+    gboolean live_waiting = FALSE;
+    gboolean carve_waiting = FALSE;
+
+    g_assert_nonnull(scheduler);
+
+    g_mutex_lock(&scheduler->mutex);
+
+    while (scheduler->stopped == FALSE && g_sequence_is_empty(scheduler->live) && g_sequence_is_empty(scheduler->carve))
+        {
+            g_cond_wait(&scheduler->cond, &scheduler->mutex);
+        }
+
+    if (scheduler->stopped == FALSE)
+        {
+            live_waiting = !g_sequence_is_empty(scheduler->live);
+            carve_waiting = !g_sequence_is_empty(scheduler->carve);
+
+            if (live_waiting == TRUE && (carve_waiting == FALSE || scheduler->burst < CLIENT_SCHEDULER_LIVE_BURST))
+                {
+                    file_event = pop_first_of_lane(scheduler->live);
+                    scheduler->burst = scheduler->burst + 1;
+                }
+            else
+                {
+                    file_event = pop_first_of_lane(scheduler->carve);
+                    scheduler->burst = 0;
+                }
+        }
+
+    g_mutex_unlock(&scheduler->mutex);
+
+    return file_event;
+}
+
+
+/**
+ * Stops the scheduler: every save worker waiting in
+ * pop_from_save_scheduler() is woken up and gets NULL. Events still in
+ * the lanes are left there.
+ * @param scheduler is the save scheduler.
+ */
+void stop_save_scheduler(save_scheduler_t *scheduler)
+{
+    g_assert_nonnull(scheduler);
+
+    g_mutex_lock(&scheduler->mutex);
+    scheduler->stopped = TRUE;
+    g_cond_broadcast(&scheduler->cond);
+    g_mutex_unlock(&scheduler->mutex);
+}
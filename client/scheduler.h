@@ -0,0 +1,80 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    scheduler.h
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file scheduler.h
+ *
+ * In this file we have all definitions of the scheduler that gives
+ * files to be saved to the save workers.
+ */
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+
+/**
+ * Creates an empty save scheduler.
+ * @returns a newly allocated save_scheduler_t that lives as long as the
+ *          program.
+ */
+extern save_scheduler_t *new_save_scheduler_t(void);
+
+
+/**
+ * Pushes a file event into its lane: the carve lane when
+ * file_event->carved is TRUE and the live lane otherwise.
+ * @param scheduler is the save scheduler.
+ * @param file_event is the event to be saved. It is owned by the
+ *        scheduler until it is popped.
+ */
+extern void push_to_save_scheduler(save_scheduler_t *scheduler, file_event_t *file_event);
+
+
+/**
+ * Pushes a file event into its lane as if it arrived at a given time.
+ * @param scheduler is the save scheduler.
+ * @param file_event is the event to be saved. It is owned by the
+ *        scheduler until it is popped.
+ * @param now is the monotonic time of arrival of the event.
+ */
+extern void push_to_save_scheduler_at(save_scheduler_t *scheduler, file_event_t *file_event, gint64 now);
+
+
+/**
+ * Pops the next file event to be saved. Waits until there is one or
+ * until the scheduler is stopped.
+ * @param scheduler is the save scheduler.
+ * @returns a file_event_t * that has to be freed by the caller or NULL
+ *          when the scheduler has been stopped.
+ */
+extern file_event_t *pop_from_save_scheduler(save_scheduler_t *scheduler);
+
+
+/**
+ * Stops the scheduler: every save worker waiting in
+ * pop_from_save_scheduler() is woken up and gets NULL. Events still in
+ * the lanes are left there.
+ * @param scheduler is the save scheduler.
+ */
+extern void stop_save_scheduler(save_scheduler_t *scheduler);
+
+
+#endif /* #IFNDEF _SCHEDULER_H_ */
@@ -0,0 +1,175 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    test_budget.c
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file test_budget.c
+ *
+ * Tests of the memory budget shared by the save workers: bytes reserved
+ * and released, reservations limited to the total of the budget and
+ * workers that wait until enough bytes are released.
+ */
+
+#include "client.h"
+
+/**
+ * @def TEST_BUDGET_TOTAL
+ * Total of the budgets of the tests.
+ */
+#define TEST_BUDGET_TOTAL (1000)
+
+/**
+ * @struct test_reservation_t
+ * @brief A reservation made by another thread.
+ */
+typedef struct
+{
+    memory_budget_t *budget;   /**< budget in which bytes are reserved             */
+    gint64 wanted;             /**< number of bytes wanted                         */
+    gint done;                 /**< set to 1 (atomically) once bytes are reserved  */
+} test_reservation_t;
+
+static void free_test_budget(memory_budget_t *budget);
+static gpointer reserve_in_thread(gpointer data);
+static void test_reserve_release(void);
+static void test_more_than_total(void);
+static void test_wait_for_release(void);
+
+
+/**
+ * Frees a budget made by new_memory_budget_t().
+ * @param budget is the budget to be freed.
+ */
+static void free_test_budget(memory_budget_t *budget)
+{
+    g_mutex_clear(&budget->mutex);
+    g_cond_clear(&budget->cond);
+    free_variable(budget);
+}
+
+
+/**
+ * Reserves bytes as a save worker does.
+ * @param data is a test_reservation_t * structure.
+ * @returns the number of bytes reserved as a pointer.
+ */
+static gpointer reserve_in_thread(gpointer data)
+{
+    test_reservation_t *reservation = (test_reservation_t *) data;
+    gint64 reserved = 0;
+
+    reserved = reserve_memory_budget(reservation->budget, reservation->wanted);
+    g_atomic_int_set(&reservation->done, 1);
+
+    return GINT_TO_POINTER((gint) reserved);
+}
+
+
+/**
+ * Bytes reserved are no longer available until they are released.
+ */
+static void test_reserve_release(void)
+{
+    memory_budget_t *budget = NULL;
+
+    budget = new_memory_budget_t(TEST_BUDGET_TOTAL);
+    g_assert_cmpint(budget->available, ==, TEST_BUDGET_TOTAL);
+
+    g_assert_cmpint(reserve_memory_budget(budget, 300), ==, 300);
+    g_assert_cmpint(budget->available, ==, TEST_BUDGET_TOTAL - 300);
+    g_assert_cmpint(reserve_memory_budget(budget, TEST_BUDGET_TOTAL - 300), ==, TEST_BUDGET_TOTAL - 300);
+    g_assert_cmpint(budget->available, ==, 0);
+
+    release_memory_budget(budget, 300);
+    g_assert_cmpint(budget->available, ==, 300);
+    release_memory_budget(budget, TEST_BUDGET_TOTAL - 300);
+    g_assert_cmpint(budget->available, ==, TEST_BUDGET_TOTAL);
+
+    free_test_budget(budget);
+}
+
+
+/**
+ * A reservation larger than the total of the budget gets the whole
+ * budget instead of waiting forever. A negative one gets nothing.
+ */
+static void test_more_than_total(void)
+{
+    memory_budget_t *budget = NULL;
+
+    budget = new_memory_budget_t(TEST_BUDGET_TOTAL);
+
+    g_assert_cmpint(reserve_memory_budget(budget, 5 * TEST_BUDGET_TOTAL), ==, TEST_BUDGET_TOTAL);
+    g_assert_cmpint(budget->available, ==, 0);
+    g_assert_cmpint(reserve_memory_budget(budget, -1), ==, 0);
+    release_memory_budget(budget, TEST_BUDGET_TOTAL);
+    g_assert_cmpint(budget->available, ==, TEST_BUDGET_TOTAL);
+
+    free_test_budget(budget);
+}
+
+
+/**
+ * A worker that wants more than what is available waits until enough
+ * bytes are released and is then woken up.
+ */
+static void test_wait_for_release(void)
+{
+    memory_budget_t *budget = NULL;
+    test_reservation_t reservation;
+    GThread *thread = NULL;
+
+    budget = new_memory_budget_t(TEST_BUDGET_TOTAL);
+    g_assert_cmpint(reserve_memory_budget(budget, 800), ==, 800);
+
+    reservation.budget = budget;
+    reservation.wanted = 500;
+    reservation.done = 0;
+    thread = g_thread_new("reserve", reserve_in_thread, &reservation);
+
+    /* Only 200 bytes are available: the thread has to wait */
+    g_usleep(G_USEC_PER_SEC / 10);
+    g_assert_cmpint(g_atomic_int_get(&reservation.done), ==, 0);
+
+    release_memory_budget(budget, 100);
+    g_usleep(G_USEC_PER_SEC / 10);
+    g_assert_cmpint(g_atomic_int_get(&reservation.done), ==, 0);
+
+    release_memory_budget(budget, 700);
+    g_assert_cmpint(GPOINTER_TO_INT(g_thread_join(thread)), ==, 500);
+    g_assert_cmpint(g_atomic_int_get(&reservation.done), ==, 1);
+    g_assert_cmpint(budget->available, ==, TEST_BUDGET_TOTAL - 500);
+
+    release_memory_budget(budget, 500);
+    free_test_budget(budget);
+}
+
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/budget/reserve_release", test_reserve_release);
+    g_test_add_func("/budget/more_than_total", test_more_than_total);
+    g_test_add_func("/budget/wait_for_release", test_wait_for_release);
+
+    return g_test_run();
+}
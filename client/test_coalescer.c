@@ -0,0 +1,181 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    test_coalescer.c
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file test_coalescer.c
+ *
+ * Tests of the queue of files that wait for fanotify events to calm
+ * down: bursts of events collapsed into one save, saves that are not
+ * delayed more than max_delay and files given back by deadline. Times
+ * are given to the coalescer so that nothing depends on the clock.
+ */
+
+#include "client.h"
+
+/**
+ * @def TEST_QUIET_PERIOD
+ * Quiet period of the coalescer of the tests.
+ *
+ * @def TEST_MAX_DELAY
+ * Maximum delay of the coalescer of the tests.
+ */
+#define TEST_QUIET_PERIOD (100)
+#define TEST_MAX_DELAY (1000)
+
+static void assert_due_paths(GSList *due_list, const gchar *first, ...) G_GNUC_NULL_TERMINATED;
+static void test_burst_collapsed(void);
+static void test_max_delay(void);
+static void test_deadline_order(void);
+
+
+/**
+ * Checks the paths of the files given back by the coalescer and frees
+ * them.
+ * @param due_list is the list of pending_event_t * given back.
+ * @param first is the first expected path followed by the others and by
+ *        NULL.
+ */
+static void assert_due_paths(GSList *due_list, const gchar *first, ...)
+{
+    GSList *head = due_list;
+    const gchar *path = first;
+    pending_event_t *pending = NULL;
+    va_list ap;
+
+    va_start(ap, first);
+
+    while (path != NULL)
+        {
+            g_assert_nonnull(head);
+            pending = (pending_event_t *) head->data;
+            g_assert_cmpstr(pending->path, ==, path);
+
+            head = g_slist_next(head);
+            path = va_arg(ap, const gchar *);
+        }
+
+    va_end(ap);
+
+    g_assert_null(head);
+    g_slist_free_full(due_list, free_pending_event_t);
+}
+
+
+/**
+ * Events on a file that is pending only move its deadline: the file is
+ * given back once, quiet_period after the last event.
+ */
+static void test_burst_collapsed(void)
+{
+    event_coalescer_t *coalescer = NULL;
+    gint64 next = 0;
+
+    coalescer = new_event_coalescer_t(TEST_QUIET_PERIOD, TEST_MAX_DELAY);
+
+    g_assert_true(record_pending_event(coalescer, "/a", 0));
+    g_assert_false(record_pending_event(coalescer, "/a", 50));
+    g_assert_false(record_pending_event(coalescer, "/a", 90));
+
+    assert_due_paths(pop_due_pending_events(coalescer, 189, &next), NULL);
+    g_assert_cmpint(next, ==, 90 + TEST_QUIET_PERIOD);
+
+    assert_due_paths(pop_due_pending_events(coalescer, 190, &next), "/a", NULL);
+    g_assert_cmpint(next, ==, G_MAXINT64);
+    g_assert_cmpuint(g_hash_table_size(coalescer->pending), ==, 0);
+
+    /* Once given back the file is pending again on its next event */
+    g_assert_true(record_pending_event(coalescer, "/a", 300));
+    assert_due_paths(pop_due_pending_events(coalescer, 400, &next), "/a", NULL);
+
+    free_event_coalescer_t(coalescer);
+}
+
+
+/**
+ * A file that never stops receiving events is given back max_delay
+ * after its first event.
+ */
+static void test_max_delay(void)
+{
+    event_coalescer_t *coalescer = NULL;
+    gint64 now = 0;
+    gint64 next = 0;
+
+    coalescer = new_event_coalescer_t(TEST_QUIET_PERIOD, TEST_MAX_DELAY);
+
+    for (now = 0; now < TEST_MAX_DELAY; now = now + TEST_QUIET_PERIOD / 2)
+        {
+            record_pending_event(coalescer, "/busy", now);
+            assert_due_paths(pop_due_pending_events(coalescer, now, &next), NULL);
+        }
+
+    g_assert_cmpint(next, ==, TEST_MAX_DELAY);
+    assert_due_paths(pop_due_pending_events(coalescer, TEST_MAX_DELAY, &next), "/busy", NULL);
+
+    free_event_coalescer_t(coalescer);
+}
+
+
+/**
+ * Files are given back by deadline whatever the order of their first
+ * event, the ones with the same deadline by order of first event, and
+ * files whose deadline is not reached stay pending.
+ */
+static void test_deadline_order(void)
+{
+    event_coalescer_t *coalescer = NULL;
+    gint64 next = 0;
+
+    coalescer = new_event_coalescer_t(TEST_QUIET_PERIOD, TEST_MAX_DELAY);
+
+    record_pending_event(coalescer, "/x", 0);    /* deadline 100 */
+    record_pending_event(coalescer, "/y", 10);   /* deadline 110 */
+    record_pending_event(coalescer, "/z", 20);   /* deadline 120 */
+    record_pending_event(coalescer, "/x", 50);   /* deadline 150 */
+    record_pending_event(coalescer, "/p", 0);
+    record_pending_event(coalescer, "/p", 60);   /* deadline 160, first seen at 0  */
+    record_pending_event(coalescer, "/q", 60);   /* deadline 160, first seen at 60 */
+    record_pending_event(coalescer, "/late", 90); /* deadline 190 */
+
+    assert_due_paths(pop_due_pending_events(coalescer, 99, &next), NULL);
+    g_assert_cmpint(next, ==, 110);
+
+    assert_due_paths(pop_due_pending_events(coalescer, 160, &next), "/y", "/z", "/x", "/p", "/q", NULL);
+    g_assert_cmpint(next, ==, 190);
+    g_assert_cmpuint(g_hash_table_size(coalescer->pending), ==, 1);
+    g_assert_cmpint(g_sequence_get_length(coalescer->queue), ==, 1);
+
+    /* Pending files are freed with the coalescer */
+    free_event_coalescer_t(coalescer);
+}
+
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/coalescer/burst_collapsed", test_burst_collapsed);
+    g_test_add_func("/coalescer/max_delay", test_max_delay);
+    g_test_add_func("/coalescer/deadline_order", test_deadline_order);
+
+    return g_test_run();
+}
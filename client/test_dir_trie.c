@@ -0,0 +1,137 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    test_dir_trie.c
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file test_dir_trie.c
+ *
+ * Tests of the trie of monitored directories: paths matched by whole
+ * components, nested monitored directories and paths compared without
+ * regard to case.
+ */
+
+#include "client.h"
+
+static dir_trie_t *new_test_trie(void);
+static void test_prefix_by_component(void);
+static void test_nested_directories(void);
+static void test_casefold(void);
+
+
+/**
+ * @returns a trie with a few monitored directories.
+ */
+static dir_trie_t *new_test_trie(void)
+{
+    dir_trie_t *trie = NULL;
+
+    trie = new_dir_trie_t();
+
+    insert_into_dir_trie(trie, "/home/foo");
+    insert_into_dir_trie(trie, "/srv/data/");
+    insert_into_dir_trie(trie, "/var//log");
+
+    return trie;
+}
+
+
+/**
+ * A monitored directory contains the paths that begin with all its
+ * components and only those: a common prefix of characters is not
+ * enough.
+ */
+static void test_prefix_by_component(void)
+{
+    dir_trie_t *trie = NULL;
+
+    trie = new_test_trie();
+
+    g_assert_cmpstr(find_in_dir_trie(trie, "/home/foo/bar"), ==, "/home/foo");
+    g_assert_cmpstr(find_in_dir_trie(trie, "/home/foo/a/b/c"), ==, "/home/foo");
+    g_assert_cmpstr(find_in_dir_trie(trie, "/home/foo"), ==, "/home/foo");
+    g_assert_cmpstr(find_in_dir_trie(trie, "/srv/data/file"), ==, "/srv/data/");
+    g_assert_cmpstr(find_in_dir_trie(trie, "/var/log/syslog"), ==, "/var//log");
+
+    g_assert_null(find_in_dir_trie(trie, "/home/foobar/file"));
+    g_assert_null(find_in_dir_trie(trie, "/home/fo/file"));
+    g_assert_null(find_in_dir_trie(trie, "/home"));
+    g_assert_null(find_in_dir_trie(trie, "/srv/database/file"));
+    g_assert_null(find_in_dir_trie(trie, "/tmp/file"));
+    g_assert_null(find_in_dir_trie(trie, "/"));
+
+    free_dir_trie_t(trie);
+}
+
+
+/**
+ * When monitored directories are nested the outermost one is found,
+ * whatever the order in which they have been inserted, and a directory
+ * inserted twice is kept once.
+ */
+static void test_nested_directories(void)
+{
+    dir_trie_t *trie = NULL;
+
+    trie = new_dir_trie_t();
+
+    insert_into_dir_trie(trie, "/home/foo/projects");
+    insert_into_dir_trie(trie, "/home/foo");
+    insert_into_dir_trie(trie, "/home/foo");
+
+    g_assert_cmpstr(find_in_dir_trie(trie, "/home/foo/projects/file"), ==, "/home/foo");
+    g_assert_cmpstr(find_in_dir_trie(trie, "/home/foo/file"), ==, "/home/foo");
+    g_assert_cmpuint(g_hash_table_size(trie->children), ==, 1);
+
+    free_dir_trie_t(trie);
+}
+
+
+/**
+ * Paths are compared UTF-8 casefolded: an event on /Home/FOO/file is in
+ * /home/foo and the directory returned is the one inserted.
+ */
+static void test_casefold(void)
+{
+    dir_trie_t *trie = NULL;
+
+    trie = new_test_trie();
+    insert_into_dir_trie(trie, "/home/\xc3\x89t\xc3\xa9"); /* E acute, t, e acute */
+
+    g_assert_cmpstr(find_in_dir_trie(trie, "/Home/FOO/file"), ==, "/home/foo");
+    g_assert_cmpstr(find_in_dir_trie(trie, "/SRV/Data/File"), ==, "/srv/data/");
+    g_assert_cmpstr(find_in_dir_trie(trie, "/home/\xc3\x89T\xc3\x89/file"), ==, "/home/\xc3\x89t\xc3\xa9");
+    g_assert_cmpstr(find_in_dir_trie(trie, "/home/\xc3\xa9t\xc3\xa9/file"), ==, "/home/\xc3\x89t\xc3\xa9");
+    g_assert_null(find_in_dir_trie(trie, "/HOME/FOOBAR/file"));
+
+    free_dir_trie_t(trie);
+}
+
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/dir_trie/prefix_by_component", test_prefix_by_component);
+    g_test_add_func("/dir_trie/nested_directories", test_nested_directories);
+    g_test_add_func("/dir_trie/casefold", test_casefold);
+
+    return g_test_run();
+}
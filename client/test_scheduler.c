@@ -0,0 +1,254 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    test_scheduler.c
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file test_scheduler.c
+ *
+ * Tests of the scheduler that gives files to the save workers: the
+ * number of live events popped for each carved one, the aging of files
+ * by the base 2 logarithm of their size and big files that are not
+ * starved by a stream of small ones. Arrival times are given to the
+ * scheduler so that nothing depends on the clock.
+ */
+
+#include "client.h"
+
+static file_event_t *new_test_event(const gchar *name, goffset size, gboolean carved);
+static void pop_test_event(save_scheduler_t *scheduler, const gchar *name, gboolean carved);
+static void test_live_burst(void);
+static void test_size_aging(void);
+static void test_no_starvation(void);
+static void test_stopped(void);
+
+
+/**
+ * @param name is the name of the file of the event.
+ * @param size is the size of that file.
+ * @param carved is TRUE when the file has been found while carving.
+ * @returns a newly allocated file event.
+ */
+static file_event_t *new_test_event(const gchar *name, goffset size, gboolean carved)
+{
+    file_event_t *file_event = NULL;
+
+    file_event = (file_event_t *) g_malloc0(sizeof(file_event_t));
+    g_assert_nonnull(file_event);
+
+    file_event->directory = g_strdup("/test");
+    file_event->fileinfo = g_file_info_new();
+    g_file_info_set_name(file_event->fileinfo, name);
+    g_file_info_set_size(file_event->fileinfo, size);
+    file_event->carved = carved;
+
+    return file_event;
+}
+
+
+/**
+ * Pops an event from the scheduler, checks that it is the expected one
+ * and frees it.
+ * @param scheduler is the save scheduler.
+ * @param name is the expected name of the file of the event.
+ * @param carved is the expected lane of the event.
+ */
+static void pop_test_event(save_scheduler_t *scheduler, const gchar *name, gboolean carved)
+{
+    file_event_t *file_event = NULL;
+
+    file_event = pop_from_save_scheduler(scheduler);
+
+    g_assert_nonnull(file_event);
+    g_assert_cmpstr(g_file_info_get_name(file_event->fileinfo), ==, name);
+    g_assert_true(file_event->carved == carved);
+
+    free_variable(file_event->directory);
+    free_object(file_event->fileinfo);
+    free_variable(file_event);
+}
+
+
+/**
+ * When both lanes have files one carved file is popped after each
+ * CLIENT_SCHEDULER_LIVE_BURST live ones. When a lane is empty the other
+ * one is popped without any limit.
+ */
+static void test_live_burst(void)
+{
+    save_scheduler_t *scheduler = NULL;
+    gchar *name = NULL;
+    guint live = 0;
+    guint carve = 0;
+    guint i = 0;
+
+    scheduler = new_save_scheduler_t();
+
+    for (i = 0; i < 2 * CLIENT_SCHEDULER_LIVE_BURST + 8; i++)
+        {
+            name = g_strdup_printf("live-%u", i);
+            push_to_save_scheduler_at(scheduler, new_test_event(name, 1, FALSE), i);
+            free_variable(name);
+        }
+
+    for (i = 0; i < 5; i++)
+        {
+            name = g_strdup_printf("carve-%u", i);
+            push_to_save_scheduler_at(scheduler, new_test_event(name, 1, TRUE), i);
+            free_variable(name);
+        }
+
+    for (i = 0; i < 2; i++)
+        {
+            /* A burst of live files then one carved file */
+            while (live < (i + 1) * CLIENT_SCHEDULER_LIVE_BURST)
+                {
+                    name = g_strdup_printf("live-%u", live);
+                    pop_test_event(scheduler, name, FALSE);
+                    free_variable(name);
+                    live++;
+                }
+
+            name = g_strdup_printf("carve-%u", carve);
+            pop_test_event(scheduler, name, TRUE);
+            free_variable(name);
+            carve++;
+        }
+
+    /* The carve lane is empty once the live one is */
+    while (live < 2 * CLIENT_SCHEDULER_LIVE_BURST + 8)
+        {
+            name = g_strdup_printf("live-%u", live);
+            pop_test_event(scheduler, name, FALSE);
+            free_variable(name);
+            live++;
+        }
+
+    while (carve < 5)
+        {
+            name = g_strdup_printf("carve-%u", carve);
+            pop_test_event(scheduler, name, TRUE);
+            free_variable(name);
+            carve++;
+        }
+
+    g_assert_true(g_sequence_is_empty(scheduler->live));
+    g_assert_true(g_sequence_is_empty(scheduler->carve));
+}
+
+
+/**
+ * A file waits CLIENT_SCHEDULER_AGING for each doubling of its size: a
+ * file of 2^10 bytes passes a file of 2^11 bytes arrived less than
+ * CLIENT_SCHEDULER_AGING before it and does not pass it otherwise. Files
+ * with the same deadline are popped in arrival order.
+ */
+static void test_size_aging(void)
+{
+    save_scheduler_t *scheduler = NULL;
+
+    scheduler = new_save_scheduler_t();
+
+    push_to_save_scheduler_at(scheduler, new_test_event("2^11", 2048, FALSE), 0);
+    push_to_save_scheduler_at(scheduler, new_test_event("2^10", 1024, FALSE), CLIENT_SCHEDULER_AGING - 1);
+    push_to_save_scheduler_at(scheduler, new_test_event("1", 1, FALSE), 11 * CLIENT_SCHEDULER_AGING - 1);
+    push_to_save_scheduler_at(scheduler, new_test_event("0", 0, FALSE), 11 * CLIENT_SCHEDULER_AGING);
+
+    pop_test_event(scheduler, "2^10", FALSE);
+    pop_test_event(scheduler, "1", FALSE);
+    pop_test_event(scheduler, "2^11", FALSE);
+    pop_test_event(scheduler, "0", FALSE);
+
+    /* 2^11 + 1 bytes weigh as much as 2^11 bytes: arrival order decides */
+    push_to_save_scheduler_at(scheduler, new_test_event("2^11", 2048, FALSE), 0);
+    push_to_save_scheduler_at(scheduler, new_test_event("2^10", 1024, FALSE), CLIENT_SCHEDULER_AGING);
+    push_to_save_scheduler_at(scheduler, new_test_event("2^11+1", 2049, FALSE), 0);
+
+    pop_test_event(scheduler, "2^11", FALSE);
+    pop_test_event(scheduler, "2^10", FALSE);
+    pop_test_event(scheduler, "2^11+1", FALSE);
+}
+
+
+/**
+ * A big file is passed by small files arrived before its deadline only:
+ * a steady stream of small files does not starve it.
+ */
+static void test_no_starvation(void)
+{
+    save_scheduler_t *scheduler = NULL;
+    gchar *name = NULL;
+    guint i = 0;
+
+    scheduler = new_save_scheduler_t();
+
+    /* 2^20 bytes: its deadline is 20 * CLIENT_SCHEDULER_AGING */
+    push_to_save_scheduler_at(scheduler, new_test_event("big", 1048576, TRUE), 0);
+
+    for (i = 0; i < 40; i++)
+        {
+            name = g_strdup_printf("small-%u", i);
+            push_to_save_scheduler_at(scheduler, new_test_event(name, 1, TRUE), (gint64) i * CLIENT_SCHEDULER_AGING);
+            free_variable(name);
+        }
+
+    for (i = 0; i < 40; i++)
+        {
+            if (i == 20)
+                {
+                    /* Same deadline as small-20 but arrived first */
+                    pop_test_event(scheduler, "big", TRUE);
+                }
+
+            name = g_strdup_printf("small-%u", i);
+            pop_test_event(scheduler, name, TRUE);
+            free_variable(name);
+        }
+}
+
+
+/**
+ * Once the scheduler is stopped it does not give any event anymore.
+ */
+static void test_stopped(void)
+{
+    save_scheduler_t *scheduler = NULL;
+
+    scheduler = new_save_scheduler_t();
+
+    push_to_save_scheduler_at(scheduler, new_test_event("file", 1, FALSE), 0);
+    stop_save_scheduler(scheduler);
+
+    g_assert_null(pop_from_save_scheduler(scheduler));
+    g_assert_cmpint(g_sequence_get_length(scheduler->live), ==, 1);
+}
+
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/scheduler/live_burst", test_live_burst);
+    g_test_add_func("/scheduler/size_aging", test_size_aging);
+    g_test_add_func("/scheduler/no_starvation", test_no_starvation);
+    g_test_add_func("/scheduler/stopped", test_stopped);
+
+    return g_test_run();
+}
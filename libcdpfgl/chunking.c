@@ -0,0 +1,397 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    chunking.c
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file chunking.c
+ * This file contains functions to cut a stream into blocks. Blocks may
+ * have a fixed size or may be content defined: in that case cut points
+ * are found with a Gear rolling hash and normalized chunking as in
+ * FastCDC. An insertion at the beginning of a file only changes the
+ * first few blocks instead of all of them.
+ */
+
+#include "libcdpfgl.h"
+
+static gpointer init_gear_table(gpointer data);
+static guint64 *get_gear_table(void);
+static guint64 make_mask(guint bits);
+static gssize fixed_chunker_read(chunker_t *chunker, guchar **buffer, GError **error);
+static gssize cdc_chunker_read(chunker_t *chunker, guchar **buffer, GError **error);
+
+
+/**
+ * Gear table: 256 pseudo random 64 bits values. It MUST be the same on
+ * all clients (and forever) otherwise cut points and hashs will differ
+ * and nothing will be deduplicated. It is generated from a fixed seed.
+ */
+static guint64 gear_table[256];
+
+
+/**
+ * Fills gear_table with splitmix64 values from a fixed seed.
+ * @param data is not used.
+ * @returns gear_table.
+ */
+static gpointer init_gear_table(gpointer data)
+{
+    guint64 seed = G_GUINT64_CONSTANT(0x6364706667436443);  /* "cdpfgCdC" */
+    guint64 z = 0;
+    guint i = 0;
+
+    for (i = 0; i < 256; i++)
+        {
+            seed = seed + G_GUINT64_CONSTANT(0x9E3779B97F4A7C15);
+            z = seed;
+            z = (z ^ (z >> 30)) * G_GUINT64_CONSTANT(0xBF58476D1CE4E5B9);
+            z = (z ^ (z >> 27)) * G_GUINT64_CONSTANT(0x94D049BB133111EB);
+            gear_table[i] = z ^ (z >> 31);
+        }
+
+    return gear_table;
+}
+
+
+/**
+ * @returns the gear table (initialized once and only once).
+ */
+static guint64 *get_gear_table(void)
+{
+    static GOnce gear_once = G_ONCE_INIT;
+
+    return (guint64 *) g_once(&gear_once, init_gear_table, NULL);
+}
+
+
+/**
+ * Makes a mask with the 'bits' most significant bits set. Gear's
+ * fingerprint is shifted left at each byte so its most significant
+ * bits depend on the largest window of bytes.
+ * @param bits is the number of bits to be set (1 to 63).
+ * @returns the mask.
+ */
+static guint64 make_mask(guint bits)
+{
+    return G_MAXUINT64 << (64 - bits);
+}
+
+
+/**
+ * Creates content defined chunking parameters.
+ * @param min_size is the minimum chunk size in bytes. If 0 or
+ *        negative avg_size / 4 is used.
+ * @param avg_size is the wanted average chunk size in bytes. It is
+ *        rounded to the nearest lower power of two.
+ * @param max_size is the maximum chunk size in bytes. If 0 or negative
+ *        avg_size * 8 is used.
+ * @returns a newly allocated cdc_params_t structure that must be freed
+ *          with free_cdc_params_t() when no longer needed.
+ */
+cdc_params_t *new_cdc_params_t(gint64 min_size, gint64 avg_size, gint64 max_size)
+{
+    cdc_params_t *params = NULL;
+    guint bits = 0;
+
+    if (avg_size < CDC_MIN_AVG_SIZE)
+        {
+            avg_size = CDC_MIN_AVG_SIZE;
+        }
+
+    while (((gint64) 1 << (bits + 1)) <= avg_size && bits < 40)
+        {
+            bits = bits + 1;
+        }
+
+    params = (cdc_params_t *) g_malloc0(sizeof(cdc_params_t));
+    g_assert_nonnull(params);
+
+    params->avg_size = (gint64) 1 << bits;
+
+    if (min_size <= 0 || min_size >= params->avg_size)
+        {
+            min_size = params->avg_size / 4;
+        }
+
+    if (max_size <= params->avg_size)
+        {
+            max_size = params->avg_size * 8;
+        }
+
+    params->min_size = min_size;
+    params->max_size = max_size;
+
+    /* Normalized chunking (level 2) concentrates chunk sizes around avg_size */
+    params->mask_s = make_mask(bits + 2);
+    params->mask_l = make_mask(bits - 2);
+
+    /* Ensures that the table is ready before any thread uses it */
+    get_gear_table();
+
+    return params;
+}
+
+
+/**
+ * Frees a cdc_params_t structure
+ * @param params is the structure to be freed.
+ */
+void free_cdc_params_t(cdc_params_t *params)
+{
+    if (params != NULL)
+        {
+            free_variable(params);
+        }
+}
+
+
+/**
+ * Finds the first cut point in buffer.
+ * @param params are the content defined chunking parameters.
+ * @param buffer is the data to be chunked.
+ * @param len is the number of bytes in buffer.
+ * @returns the size of the first chunk found in buffer (between 1 and
+ *          MIN(len, params->max_size)).
+ */
+gint64 cdc_find_cut_point(cdc_params_t *params, const guchar *buffer, gint64 len)
+{
+    guint64 *gear = get_gear_table();
+    guint64 fp = 0;
+    gint64 i = 0;
+    gint64 normal = 0;
+
+    g_assert_nonnull(params);
+
+    if (len <= params->min_size)
+        {
+            return len;
+        }
+
+    if (len > params->max_size)
+        {
+            len = params->max_size;
+        }
+
+    normal = MIN(params->avg_size, len);
+    i = params->min_size;
+
+    while (i < normal)
+        {
+            fp = (fp << 1) + gear[buffer[i]];
+
+            if ((fp & params->mask_s) == 0)
+                {
+                    return i + 1;
+                }
+
+            i = i + 1;
+        }
+
+    while (i < len)
+        {
+            fp = (fp << 1) + gear[buffer[i]];
+
+            if ((fp & params->mask_l) == 0)
+                {
+                    return i + 1;
+                }
+
+            i = i + 1;
+        }
+
+    return len;
+}
+
+
+/**
+ * Creates a new chunker on an already opened reader
+ * @param reader is the reader to read from (a file must be opened).
+ * @param blocksize is the size of blocks when params is NULL
+ * @param params are the content defined chunking parameters. When NULL
+ *        fixed size blocks are returned.
+ * @returns a newly allocated chunker_t that must be freed with
+ *          free_chunker_t() when no longer needed.
+ */
+chunker_t *new_chunker_t(reader_t *reader, gint64 blocksize, cdc_params_t *params)
+{
+    chunker_t *chunker = NULL;
+
+    chunker = (chunker_t *) g_malloc0(sizeof(chunker_t));
+    g_assert_nonnull(chunker);
+
+    chunker->reader = reader;
+    chunker->params = params;
+    chunker->blocksize = blocksize;
+    chunker->window_len = 0;
+    chunker->window_pos = 0;
+    chunker->eof = FALSE;
+
+    if (params != NULL)
+        {
+            chunker->window = (guchar *) g_malloc(params->max_size);
+            g_assert_nonnull(chunker->window);
+        }
+    else
+        {
+            chunker->window = NULL;
+        }
+
+    return chunker;
+}
+
+
+/**
+ * Frees a chunker (the reader is not closed).
+ * @param chunker is the chunker to be freed.
+ */
+void free_chunker_t(chunker_t *chunker)
+{
+    if (chunker != NULL)
+        {
+            free_variable(chunker->window);
+            free_variable(chunker);
+        }
+}
+
+
+/**
+ * Reads the next fixed size block from the chunker's reader.
+ * @param chunker is the chunker to read from.
+ * @param[out] buffer is a newly allocated buffer containing the block.
+ * @param[out] error is set when an error occured.
+ * @returns the size of the block, 0 at the end of the stream and -1
+ *          upon error.
+ */
+static gssize fixed_chunker_read(chunker_t *chunker, guchar **buffer, GError **error)
+{
+    guchar *block = NULL;
+    gsize bytes_read = 0;
+    gssize size_read = 0;
+
+    block = (guchar *) g_malloc(chunker->blocksize);
+
+    if (reader_read_all(chunker->reader, block, chunker->blocksize, &bytes_read, error) == FALSE)
+        {
+            size_read = -1;
+        }
+    else
+        {
+            size_read = (gssize) bytes_read;
+        }
+
+    if (size_read <= 0)
+        {
+            free_variable(block);
+            block = NULL;
+        }
+
+    *buffer = block;
+
+    return size_read;
+}
+
+
+/**
+ * Reads the next content defined block from the chunker's reader. The
+ * window is refilled so that it always contains at least max_size bytes
+ * (unless the end of the stream has been reached) before searching for
+ * a cut point.
+ * @param chunker is the chunker to read from.
+ * @param[out] buffer is a newly allocated buffer containing the block.
+ * @param[out] error is set when an error occured.
+ * @returns the size of the block, 0 at the end of the stream and -1
+ *          upon error.
+ */
+static gssize cdc_chunker_read(chunker_t *chunker, guchar **buffer, GError **error)
+{
+    gint64 max_size = chunker->params->max_size;
+    gint64 remaining = 0;
+    gint64 cut = 0;
+    gsize bytes_read = 0;
+    gsize wanted = 0;
+
+    *buffer = NULL;
+    remaining = chunker->window_len - chunker->window_pos;
+
+    if (chunker->eof == FALSE && remaining < max_size)
+        {
+            if (remaining > 0 && chunker->window_pos > 0)
+                {
+                    memmove(chunker->window, chunker->window + chunker->window_pos, remaining);
+                }
+
+            chunker->window_len = remaining;
+            chunker->window_pos = 0;
+            wanted = max_size - remaining;
+
+            if (reader_read_all(chunker->reader, chunker->window + remaining, wanted, &bytes_read, error) == FALSE)
+                {
+                    return -1;
+                }
+
+            chunker->window_len = chunker->window_len + bytes_read;
+
+            if (bytes_read < wanted)
+                {
+                    chunker->eof = TRUE;
+                }
+
+            remaining = chunker->window_len;
+        }
+
+    if (remaining <= 0)
+        {
+            return 0;
+        }
+
+    cut = cdc_find_cut_point(chunker->params, chunker->window + chunker->window_pos, remaining);
+
+    *buffer = (guchar *) g_malloc(cut);
+    memcpy(*buffer, chunker->window + chunker->window_pos, cut);
+    chunker->window_pos = chunker->window_pos + cut;
+
+    return (gssize) cut;
+}
+
+
+/**
+ * Reads the next block from the chunker's reader.
+ * @param chunker is the chunker to read from.
+ * @param[out] buffer is a newly allocated buffer containing the block
+ *             (NULL at the end of the stream or upon error). It has to
+ *             be freed when no longer needed.
+ * @param[out] error is set when an error occured.
+ * @returns the size of the block, 0 at the end of the stream and -1
+ *          upon error.
+ */
+gssize chunker_read(chunker_t *chunker, guchar **buffer, GError **error)
+{
+    g_assert_nonnull(chunker);
+    g_assert_nonnull(buffer);
+
+    if (chunker->params != NULL)
+        {
+            return cdc_chunker_read(chunker, buffer, error);
+        }
+    else
+        {
+            return fixed_chunker_read(chunker, buffer, error);
+        }
+}
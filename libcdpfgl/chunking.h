@@ -0,0 +1,147 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    chunking.h
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file chunking.h
+ *
+ * This file contains all definitions needed to cut a file into blocks
+ * either with a fixed size or with content defined chunking (FastCDC
+ * like algorithm using a Gear rolling hash).
+ */
+
+#ifndef _CHUNKING_H_
+#define _CHUNKING_H_
+
+/**
+ * @def CDC_DEFAULT_AVG_SIZE
+ * Default average chunk size in bytes when content defined chunking is
+ * used.
+ */
+#define CDC_DEFAULT_AVG_SIZE (16384)
+
+
+/**
+ * @def CDC_MIN_AVG_SIZE
+ * Smallest average chunk size (in bytes) that one may choose.
+ */
+#define CDC_MIN_AVG_SIZE (256)
+
+
+/**
+ * @struct cdc_params_t
+ * @brief Parameters of the content defined chunking algorithm. This
+ *        structure is read only once created and may be shared between
+ *        threads.
+ */
+typedef struct
+{
+    gint64 min_size;    /**< No cut point is searched before min_size bytes                        */
+    gint64 avg_size;    /**< Expected average chunk size (rounded to a power of 2)                 */
+    gint64 max_size;    /**< A chunk is always cut at max_size bytes                               */
+    guint64 mask_s;     /**< Mask used before avg_size: harder to match (normalized chunking)      */
+    guint64 mask_l;     /**< Mask used after avg_size: easier to match (normalized chunking)       */
+} cdc_params_t;
+
+
+/**
+ * @struct chunker_t
+ * @brief Reads a stream and returns one block at a time. Blocks have a
+ *        fixed size when params is NULL and are content defined
+ *        otherwise.
+ */
+typedef struct
+{
+    reader_t *reader;       /**< opened reader to read data from (not owned by the chunker)    */
+    cdc_params_t *params;   /**< content defined chunking parameters or NULL for fixed blocks  */
+    gint64 blocksize;       /**< size of a block when params is NULL                           */
+    guchar *window;         /**< read ahead window (max_size bytes) used in CDC mode           */
+    gint64 window_len;      /**< number of valid bytes in window                               */
+    gint64 window_pos;      /**< position of the first byte not already returned in window    */
+    gboolean eof;           /**< TRUE when the end of the stream has been reached              */
+} chunker_t;
+
+
+/**
+ * Creates content defined chunking parameters.
+ * @param min_size is the minimum chunk size in bytes. If 0 or
+ *        negative avg_size / 4 is used.
+ * @param avg_size is the wanted average chunk size in bytes. It is
+ *        rounded to the nearest lower power of two.
+ * @param max_size is the maximum chunk size in bytes. If 0 or negative
+ *        avg_size * 8 is used.
+ * @returns a newly allocated cdc_params_t structure that must be freed
+ *          with free_cdc_params_t() when no longer needed.
+ */
+extern cdc_params_t *new_cdc_params_t(gint64 min_size, gint64 avg_size, gint64 max_size);
+
+
+/**
+ * Frees a cdc_params_t structure
+ * @param params is the structure to be freed.
+ */
+extern void free_cdc_params_t(cdc_params_t *params);
+
+
+/**
+ * Finds the first cut point in buffer.
+ * @param params are the content defined chunking parameters.
+ * @param buffer is the data to be chunked.
+ * @param len is the number of bytes in buffer.
+ * @returns the size of the first chunk found in buffer (between 1 and
+ *          MIN(len, params->max_size)).
+ */
+extern gint64 cdc_find_cut_point(cdc_params_t *params, const guchar *buffer, gint64 len);
+
+
+/**
+ * Creates a new chunker on an already opened reader
+ * @param reader is the reader to read from (a file must be opened).
+ * @param blocksize is the size of blocks when params is NULL
+ * @param params are the content defined chunking parameters. When NULL
+ *        fixed size blocks are returned.
+ * @returns a newly allocated chunker_t that must be freed with
+ *          free_chunker_t() when no longer needed.
+ */
+extern chunker_t *new_chunker_t(reader_t *reader, gint64 blocksize, cdc_params_t *params);
+
+
+/**
+ * Frees a chunker (the reader is not closed).
+ * @param chunker is the chunker to be freed.
+ */
+extern void free_chunker_t(chunker_t *chunker);
+
+
+/**
+ * Reads the next block from the chunker's reader.
+ * @param chunker is the chunker to read from.
+ * @param[out] buffer is a newly allocated buffer containing the block
+ *             (NULL at the end of the stream or upon error). It has to
+ *             be freed when no longer needed.
+ * @param[out] error is set when an error occured.
+ * @returns the size of the block, 0 at the end of the stream and -1
+ *          upon error.
+ */
+extern gssize chunker_read(chunker_t *chunker, guchar **buffer, GError **error);
+
+
+#endif /* #ifndef _CHUNKING_H_ */
@@ -33,8 +33,24 @@
 
 static size_t write_data(void *buffer, size_t size, size_t nmemb, void *userp);
 static size_t read_data(char *buffer, size_t size, size_t nitems, void *userp);
-static gboolean does_url_end_with_json(gchar *url);
+static size_t read_stream_data(char *buffer, size_t size, size_t nitems, void *userp);
+static int seek_stream_data(void *userp, curl_off_t offset, int origin);
+static gboolean does_url_end_with(gchar *url, gchar *suffix);
 static struct curl_slist *append_content_type_to_header(struct curl_slist *chunk, gchar *url);
+static size_t write_transfer_data(void *buffer, size_t size, size_t nmemb, void *userp);
+static gint post_buffer(comm_t *comm, gchar *url, gsize length);
+static struct curl_slist *append_stream_length_to_header(struct curl_slist *chunk, CURL *curl_handle, block_stream_t *stream);
+static gint post_stream(comm_t *comm, gchar *url, block_stream_t *stream);
+static transfer_t *new_transfer_t(comm_t *comm, gchar *url, gchar *body, gsize length, block_stream_t *stream, gboolean owned, GAsyncQueue *reply);
+static void free_transfer_t(transfer_t *transfer);
+static void add_submitted_transfers(transport_t *transport);
+static void reply_done_transfers(transport_t *transport);
+static void abort_transfers(transport_t *transport);
+static gpointer transport_thread(gpointer data);
+static void submit_transfer(transport_t *transport, transfer_t *transfer);
+static gint post_url_with_transport(comm_t *comm, gchar *url, gsize length);
+static void collect_async_post(comm_t *comm);
+static void save_failed_stream(comm_t *comm, gchar *url, block_stream_t *stream);
 
 /**
  * Gets the version for the communication library
@@ -237,12 +253,51 @@ static size_t read_data(char *buffer, size_t size, size_t nitems, void *userp)
 }
 
 
+/**
+ * Used by libcurl to read the body of a request from a block stream
+ * @param buffer is the buffer where libcurl wants the data
+ * @param size is the size of an element in buffer
+ * @param nitems is the number of elements in buffer
+ * @param[in,out] userp MUST be a pointer to a block_stream_t structure
+ * @returns the number of bytes written into buffer (0 at the end of the
+ *          stream).
+ */
+static size_t read_stream_data(char *buffer, size_t size, size_t nitems, void *userp)
+{
+    return read_block_stream((block_stream_t *) userp, (guchar *) buffer, size * nitems);
+}
+
+
+/**
+ * Used by libcurl to rewind a block stream when it has to send a body
+ * again (on a kept alive connection that the server closed for instance)
+ * @param[in,out] userp MUST be a pointer to a block_stream_t structure
+ * @param offset is the offset to seek to.
+ * @param origin is SEEK_SET, SEEK_CUR or SEEK_END.
+ * @returns CURL_SEEKFUNC_OK when rewinding and CURL_SEEKFUNC_CANTSEEK
+ *          for any other seek.
+ */
+static int seek_stream_data(void *userp, curl_off_t offset, int origin)
+{
+    if (offset == 0 && origin == SEEK_SET)
+        {
+            rewind_block_stream((block_stream_t *) userp);
+            return CURL_SEEKFUNC_OK;
+        }
+    else
+        {
+            return CURL_SEEKFUNC_CANTSEEK;
+        }
+}
+
+
 /**
  * @param url is the url to be checked (must not be NULL)
- * @returns true if the given url finishes with .json (before parameters)
+ * @param suffix is the suffix to look for (".json" for instance)
+ * @returns true if the given url finishes with suffix (before parameters)
  * and false otherwise
  */
-static gboolean does_url_end_with_json(gchar *url)
+static gboolean does_url_end_with(gchar *url, gchar *suffix)
 {
     gchar **strings = NULL;
 
@@ -250,7 +305,7 @@ static gboolean does_url_end_with_json(gchar *url)
         {
             strings = g_strsplit(url, "?", 2);
 
-            if (g_str_has_suffix(strings[0], ".json"))
+            if (g_str_has_suffix(strings[0], suffix))
                 {
                     g_strfreev(strings);
                     return TRUE;
@@ -270,18 +325,24 @@ static gboolean does_url_end_with_json(gchar *url)
  * @param chunk is the list of chunk headers as defined by libcurl
  * @param url is the url to be checked must not be NULL
  * @returns the appended list containing a 'Content-Type' header that
- *          is application/json if the URL ends with .json and
+ *          is application/json if the URL ends with .json,
+ *          application/octet-stream if it ends with .bin and
  *          is text/plain otherwise
  */
 static struct curl_slist *append_content_type_to_header(struct curl_slist *chunk, gchar *url)
 {
     gchar *content_type = NULL;
 
-    if (does_url_end_with_json(url))
+    if (does_url_end_with(url, ".json"))
         {
             content_type = g_strconcat("Content-Type: ", CT_JSON, NULL);
             chunk = curl_slist_append(chunk, content_type);
         }
+    else if (does_url_end_with(url, ".bin"))
+        {
+            content_type = g_strconcat("Content-Type: ", CT_BINARY, NULL);
+            chunk = curl_slist_append(chunk, content_type);
+        }
     else
         {
             content_type = g_strconcat("Content-Type: ", CT_PLAIN, NULL);
@@ -343,7 +404,7 @@ gint get_url(comm_t *comm, gchar *url, gchar *header)
 
             if (success == CURLE_OK && comm->buffer != NULL)
                 {
-                    print_debug(_("Answer length: %d\n"), strlen(comm->buffer));
+                    print_debug(_("Answer length: %" G_GUINT64_FORMAT "\n"), comm->pos);
                 }
             else
                 {
@@ -363,7 +424,8 @@ gint get_url(comm_t *comm, gchar *url, gchar *header)
  * Uses curl to send a POST command to the http server url
  * @param comm a comm_t * structure that must contain an initialized
  *        curl_handle (must not be NULL). buffer field of this structure
- *        is sent as data in the POST command.
+ *        is sent as data in the POST command. When comm has a transport
+ *        the request goes through the transport's connections.
  * @param url a gchar * url where to send the command to. It must NOT
  *        contain the http://ip:port string. And must contain the first '/'
  *        ie to get 'http://127.0.0.1:5468/Version' url must be '/Version'.
@@ -374,6 +436,32 @@ gint get_url(comm_t *comm, gchar *url, gchar *header)
  * @todo manage errors codes
  */
 gint post_url(comm_t *comm, gchar *url)
+{
+    gint success = CURLE_FAILED_INIT;
+
+    if (comm != NULL && comm->readbuffer != NULL)
+        {
+            /* readbuffer here should be plain base64 encoded text */
+            success = post_buffer(comm, url, strlen(comm->readbuffer));
+        }
+
+    return success;
+}
+
+
+/**
+ * Sends the length first bytes of comm->readbuffer with a POST command
+ * to the http server url (readbuffer may contain binary data).
+ * @param comm a comm_t * structure that must contain an initialized
+ *        curl_handle (must not be NULL). When comm has a transport the
+ *        request goes through the transport's connections.
+ * @param url a gchar * url where to send the command to. It must NOT
+ *        contain the http://ip:port string.
+ * @param length is the number of bytes of comm->readbuffer to be sent.
+ * @returns a CURLcode. When CURLE_OK is returned, the data that the
+ *          server sent is in the comm->buffer gchar * string.
+ */
+static gint post_buffer(comm_t *comm, gchar *url, gsize length)
 {
     gint success = CURLE_FAILED_INIT;
     gchar *real_url = NULL;
@@ -381,7 +469,13 @@ gint post_url(comm_t *comm, gchar *url)
     gchar *len = NULL;
     struct curl_slist *chunk = NULL;
 
-    if (comm != NULL && url != NULL && comm->curl_handle != NULL && comm->conn != NULL && comm->readbuffer != NULL)
+    if (comm != NULL && url != NULL && comm->transport != NULL && comm->conn != NULL && comm->readbuffer != NULL)
+        {
+            comm->seq = 0;
+            comm->pos = 0;
+            success = post_url_with_transport(comm, url, length);
+        }
+    else if (comm != NULL && url != NULL && comm->curl_handle != NULL && comm->conn != NULL && comm->readbuffer != NULL)
         {
 
             error_buf = (gchar *) g_malloc(CURL_ERROR_SIZE + 1);
@@ -389,9 +483,8 @@ gint post_url(comm_t *comm, gchar *url)
             comm->pos = 0;
             real_url = g_strdup_printf("%s%s", comm->conn, url);
 
-            /* readbuffer here should be plain base64 encoded text */
-            comm->uncomp_len = strlen(comm->readbuffer);
-            comm->length = strlen(comm->readbuffer);
+            comm->uncomp_len = length;
+            comm->length = length;
 
 
             curl_easy_reset(comm->curl_handle);
@@ -434,6 +527,654 @@ gint post_url(comm_t *comm, gchar *url)
 }
 
 
+/**
+ * Tells libcurl the length of a block stream's body when it is known
+ * and makes it use chunked transfer encoding otherwise.
+ * @param chunk is the list of chunk headers as defined by libcurl
+ * @param curl_handle is the easy handle that will send the stream.
+ * @param stream is the block stream to be sent.
+ * @returns the appended list of headers.
+ */
+static struct curl_slist *append_stream_length_to_header(struct curl_slist *chunk, CURL *curl_handle, block_stream_t *stream)
+{
+    gssize length = 0;
+
+    length = get_block_stream_length(stream);
+
+    if (length >= 0)
+        {
+            curl_easy_setopt(curl_handle, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t) length);
+        }
+    else
+        {
+            chunk = curl_slist_append(chunk, "Transfer-Encoding: chunked");
+        }
+
+    return chunk;
+}
+
+
+/**
+ * Sends a block stream with a POST command to the http server url with
+ * comm's own curl handle. The body is read from the stream while it is
+ * sent.
+ * @param comm a comm_t * structure that must contain an initialized
+ *        curl_handle (must not be NULL).
+ * @param url a gchar * url where to send the command to. It must NOT
+ *        contain the http://ip:port string.
+ * @param stream is the block stream to be sent.
+ * @returns a CURLcode. When CURLE_OK is returned, the data that the
+ *          server sent is in the comm->buffer gchar * string.
+ */
+static gint post_stream(comm_t *comm, gchar *url, block_stream_t *stream)
+{
+    gint success = CURLE_FAILED_INIT;
+    gchar *real_url = NULL;
+    gchar *error_buf = NULL;
+    struct curl_slist *chunk = NULL;
+
+    if (comm->curl_handle != NULL)
+        {
+            error_buf = (gchar *) g_malloc0(CURL_ERROR_SIZE + 1);
+            comm->seq = 0;
+            comm->pos = 0;
+            real_url = g_strdup_printf("%s%s", comm->conn, url);
+            rewind_block_stream(stream);
+
+            curl_easy_reset(comm->curl_handle);
+            curl_easy_setopt(comm->curl_handle, CURLOPT_POST, 1);
+            curl_easy_setopt(comm->curl_handle, CURLOPT_READFUNCTION, read_stream_data);
+            curl_easy_setopt(comm->curl_handle, CURLOPT_READDATA, stream);
+            curl_easy_setopt(comm->curl_handle, CURLOPT_SEEKFUNCTION, seek_stream_data);
+            curl_easy_setopt(comm->curl_handle, CURLOPT_SEEKDATA, stream);
+            curl_easy_setopt(comm->curl_handle, CURLOPT_URL, real_url);
+            curl_easy_setopt(comm->curl_handle, CURLOPT_WRITEFUNCTION, write_data);
+            curl_easy_setopt(comm->curl_handle, CURLOPT_WRITEDATA, comm);
+            curl_easy_setopt(comm->curl_handle, CURLOPT_ERRORBUFFER, error_buf);
+
+            chunk = append_stream_length_to_header(chunk, comm->curl_handle, stream);
+            chunk = append_content_type_to_header(chunk, url);
+            curl_easy_setopt(comm->curl_handle, CURLOPT_HTTPHEADER, chunk);
+
+            success = curl_easy_perform(comm->curl_handle);
+
+            if (success != CURLE_OK)
+                {
+                    print_error(__FILE__, __LINE__, _("Error while sending POST command (to \"%s\"): %s\n"), real_url, error_buf);
+                    comm->buffer = NULL;
+                }
+            else if (comm->buffer != NULL)
+                {
+                    print_debug(_("Answer is: \"%s\"\n"), comm->buffer);
+                }
+
+            free_variable(real_url);
+            free_variable(error_buf);
+            curl_slist_free_all(chunk);
+        }
+
+    return success;
+}
+
+
+/**
+ * Used by libcurl to give the answer of a transfer made by a transport
+ * @param buffer is the buffer where received data are written by libcurl
+ * @param size is the size of an element in buffer
+ * @param nmemb is the number of elements in buffer
+ * @param[in,out] userp MUST be a pointer to a transfer_t structure
+ * @returns the size of the data taken into account.
+ */
+static size_t write_transfer_data(void *buffer, size_t size, size_t nmemb, void *userp)
+{
+    transfer_t *transfer = (transfer_t *) userp;
+
+    if (transfer != NULL)
+        {
+            g_string_append_len(transfer->answer, buffer, size * nmemb);
+        }
+
+    return (size * nmemb);
+}
+
+
+/**
+ * Creates a POST request to be performed by a transport.
+ * @param comm is the comm_t structure that sends the request.
+ * @param url is the url of the request (without http://ip:port).
+ * @param body is the body of the request (NULL when stream is used).
+ * @param length is the number of bytes of body.
+ * @param stream is a block stream from which the body is read while it
+ *        is sent (NULL when body is used). It is freed with the transfer.
+ * @param owned is TRUE when body has to be freed with the transfer.
+ * @param reply is the queue where the transfer is pushed once done.
+ * @returns a newly allocated transfer_t structure that may be freed
+ *          with free_transfer_t() when no longer needed.
+ */
+static transfer_t *new_transfer_t(comm_t *comm, gchar *url, gchar *body, gsize length, block_stream_t *stream, gboolean owned, GAsyncQueue *reply)
+{
+    transfer_t *transfer = NULL;
+
+    transfer = (transfer_t *) g_malloc0(sizeof(transfer_t));
+    g_assert_nonnull(transfer);
+
+    transfer->easy = curl_easy_init();
+    transfer->url = g_strdup(url);
+    transfer->real_url = g_strdup_printf("%s%s", comm->conn, url);
+    transfer->body = body;
+    transfer->length = length;
+    transfer->stream = stream;
+    transfer->owned = owned;
+    transfer->answer = g_string_new(NULL);
+    transfer->error_buf = (gchar *) g_malloc0(CURL_ERROR_SIZE + 1);
+    transfer->result = CURLE_FAILED_INIT;
+    transfer->reply = reply;
+    transfer->headers = append_content_type_to_header(NULL, url);
+
+    curl_easy_setopt(transfer->easy, CURLOPT_URL, transfer->real_url);
+    curl_easy_setopt(transfer->easy, CURLOPT_POST, 1L);
+
+    if (stream != NULL)
+        {
+            curl_easy_setopt(transfer->easy, CURLOPT_READFUNCTION, read_stream_data);
+            curl_easy_setopt(transfer->easy, CURLOPT_READDATA, stream);
+            curl_easy_setopt(transfer->easy, CURLOPT_SEEKFUNCTION, seek_stream_data);
+            curl_easy_setopt(transfer->easy, CURLOPT_SEEKDATA, stream);
+            transfer->headers = append_stream_length_to_header(transfer->headers, transfer->easy, stream);
+        }
+    else
+        {
+            curl_easy_setopt(transfer->easy, CURLOPT_POSTFIELDS, transfer->body);
+            curl_easy_setopt(transfer->easy, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t) transfer->length);
+        }
+
+    curl_easy_setopt(transfer->easy, CURLOPT_HTTPHEADER, transfer->headers);
+    curl_easy_setopt(transfer->easy, CURLOPT_WRITEFUNCTION, write_transfer_data);
+    curl_easy_setopt(transfer->easy, CURLOPT_WRITEDATA, transfer);
+    curl_easy_setopt(transfer->easy, CURLOPT_ERRORBUFFER, transfer->error_buf);
+    curl_easy_setopt(transfer->easy, CURLOPT_PRIVATE, transfer);
+
+    return transfer;
+}
+
+
+/**
+ * Frees a transfer (and its body when it owns it).
+ * @param transfer is the transfer to be freed.
+ */
+static void free_transfer_t(transfer_t *transfer)
+{
+    if (transfer != NULL)
+        {
+            curl_easy_cleanup(transfer->easy);
+            curl_slist_free_all(transfer->headers);
+            g_string_free(transfer->answer, TRUE);
+            free_variable(transfer->url);
+            free_variable(transfer->real_url);
+            free_variable(transfer->error_buf);
+            free_block_stream_t(transfer->stream);
+
+            if (transfer->owned == TRUE)
+                {
+                    free_variable(transfer->body);
+                }
+
+            free_variable(transfer);
+        }
+}
+
+
+/**
+ * Adds transfers submitted to the transport to its multi handle.
+ * @param transport is the transport (called from its thread).
+ */
+static void add_submitted_transfers(transport_t *transport)
+{
+    transfer_t *transfer = NULL;
+
+    transfer = g_async_queue_try_pop(transport->submitted);
+
+    while (transfer != NULL)
+        {
+            curl_multi_add_handle(transport->multi, transfer->easy);
+            transport->active = g_slist_prepend(transport->active, transfer);
+            transfer = g_async_queue_try_pop(transport->submitted);
+        }
+}
+
+
+/**
+ * Gives back transfers that are done to their senders.
+ * @param transport is the transport (called from its thread).
+ */
+static void reply_done_transfers(transport_t *transport)
+{
+    CURLMsg *msg = NULL;
+    transfer_t *transfer = NULL;
+    gint left = 0;
+
+    msg = curl_multi_info_read(transport->multi, &left);
+
+    while (msg != NULL)
+        {
+            if (msg->msg == CURLMSG_DONE)
+                {
+                    curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **) &transfer);
+                    transfer->result = msg->data.result;
+                    curl_multi_remove_handle(transport->multi, msg->easy_handle);
+                    transport->active = g_slist_remove(transport->active, transfer);
+                    g_async_queue_push(transfer->reply, transfer);
+                }
+
+            msg = curl_multi_info_read(transport->multi, &left);
+        }
+}
+
+
+/**
+ * Aborts every transfer still in flight or waiting when the transport
+ * stops: they are given back with CURLE_ABORTED_BY_CALLBACK.
+ * @param transport is the transport (called from its thread).
+ */
+static void abort_transfers(transport_t *transport)
+{
+    transfer_t *transfer = NULL;
+    GSList *iter = NULL;
+
+    add_submitted_transfers(transport);
+
+    for (iter = transport->active; iter != NULL; iter = g_slist_next(iter))
+        {
+            transfer = iter->data;
+            curl_multi_remove_handle(transport->multi, transfer->easy);
+            transfer->result = CURLE_ABORTED_BY_CALLBACK;
+            g_async_queue_push(transfer->reply, transfer);
+        }
+
+    g_slist_free(transport->active);
+    transport->active = NULL;
+}
+
+
+/**
+ * Thread that performs every transfer of a transport: it adds newly
+ * submitted transfers to the multi handle, lets libcurl perform them
+ * over its pool of connections and gives back the ones that are done.
+ * @param data MUST be a transport_t * pointer.
+ * @returns NULL
+ */
+static gpointer transport_thread(gpointer data)
+{
+    transport_t *transport = (transport_t *) data;
+    gint running = 0;
+
+    g_assert_nonnull(transport);
+
+    while (g_atomic_int_get(&transport->stop) == 0)
+        {
+            add_submitted_transfers(transport);
+            curl_multi_perform(transport->multi, &running);
+            reply_done_transfers(transport);
+
+            /* Returns on network activity, on curl_multi_wakeup() or after the timeout */
+            curl_multi_poll(transport->multi, NULL, 0, TRANSPORT_POLL_TIMEOUT, NULL);
+        }
+
+    abort_transfers(transport);
+
+    return NULL;
+}
+
+
+/**
+ * Hands a transfer to a transport.
+ * @param transport is the transport that will perform the transfer.
+ * @param transfer is the transfer to be performed.
+ */
+static void submit_transfer(transport_t *transport, transfer_t *transfer)
+{
+    g_async_queue_push(transport->submitted, transfer);
+    curl_multi_wakeup(transport->multi);
+}
+
+
+/**
+ * Creates a transport and starts its thread.
+ * @param connections is the maximum number of connections opened to the
+ *        server (they are kept alive and reused between requests).
+ * @returns a newly allocated transport_t structure that may be freed
+ *          with free_transport_t().
+ */
+transport_t *new_transport_t(guint connections)
+{
+    transport_t *transport = NULL;
+
+    transport = (transport_t *) g_malloc0(sizeof(transport_t));
+    g_assert_nonnull(transport);
+
+    if (connections == 0)
+        {
+            connections = TRANSPORT_DEFAULT_CONNECTIONS;
+        }
+
+    transport->connections = connections;
+    transport->multi = curl_multi_init();
+    transport->submitted = g_async_queue_new();
+    transport->active = NULL;
+    transport->stop = 0;
+
+    /* Requests above the limit wait inside libcurl for a free connection */
+    curl_multi_setopt(transport->multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, (glong) connections);
+    curl_multi_setopt(transport->multi, CURLMOPT_MAX_HOST_CONNECTIONS, (glong) connections);
+    curl_multi_setopt(transport->multi, CURLMOPT_MAXCONNECTS, (glong) connections);
+
+    transport->thread = g_thread_new("transport", transport_thread, transport);
+
+    print_debug(_("Transport started with %u connection(s) to the server\n"), connections);
+
+    return transport;
+}
+
+
+/**
+ * Stops the transport's thread and frees the transport. Requests still
+ * in flight are aborted. No comm_t may use it anymore.
+ * @param transport is the transport to be freed.
+ */
+void free_transport_t(transport_t *transport)
+{
+    if (transport != NULL)
+        {
+            g_atomic_int_set(&transport->stop, 1);
+            curl_multi_wakeup(transport->multi);
+            g_thread_join(transport->thread);
+
+            curl_multi_cleanup(transport->multi);
+            g_async_queue_unref(transport->submitted);
+            free_variable(transport);
+        }
+}
+
+
+/**
+ * Makes comm send its POST requests through transport.
+ * @param comm a comm_t * structure.
+ * @param transport is the transport to be used (NULL to use comm's own
+ *        curl handle).
+ * @param max_in_flight is the number of asynchronous requests that comm
+ *        may have in flight (0 makes post_url_async() synchronous).
+ */
+void set_comm_transport(comm_t *comm, transport_t *transport, guint max_in_flight)
+{
+    if (comm != NULL)
+        {
+            wait_for_async_posts(comm);
+            comm->transport = transport;
+            comm->max_in_flight = max_in_flight;
+        }
+}
+
+
+/**
+ * Sets the function called with requests sent by post_url_async() that
+ * failed (to save them for later for instance).
+ * @param comm a comm_t * structure.
+ * @param save_failed is the function called with user_data, the url,
+ *        the body of the failed request and its length.
+ * @param user_data is passed to save_failed.
+ */
+void set_comm_failure_handler(comm_t *comm, void (*save_failed)(gpointer user_data, gchar *url, gchar *body, gsize length), gpointer user_data)
+{
+    if (comm != NULL)
+        {
+            comm->save_failed = save_failed;
+            comm->failed_data = user_data;
+        }
+}
+
+
+/**
+ * Sends comm->readbuffer through comm's transport and waits for the
+ * answer. Other requests (from other comm_t or asynchronous ones) are
+ * performed meanwhile on the transport's pool of connections.
+ * @param comm a comm_t * structure with a transport.
+ * @param url a gchar * url where to send the command to.
+ * @param length is the number of bytes of comm->readbuffer to be sent.
+ * @returns a CURLcode. When CURLE_OK is returned, the data that the
+ *          server sent is in the comm->buffer gchar * string.
+ */
+static gint post_url_with_transport(comm_t *comm, gchar *url, gsize length)
+{
+    transfer_t *transfer = NULL;
+    gint success = CURLE_FAILED_INIT;
+
+    comm->uncomp_len = length;
+    comm->length = length;
+
+    transfer = new_transfer_t(comm, url, comm->readbuffer, length, NULL, FALSE, comm->replies);
+    submit_transfer(comm->transport, transfer);
+
+    /* Only one synchronous request at a time for a comm_t */
+    transfer = g_async_queue_pop(comm->replies);
+    success = transfer->result;
+
+    if (success != CURLE_OK)
+        {
+            print_error(__FILE__, __LINE__, _("Error while sending POST command (to \"%s\"): %s\n"), transfer->real_url, transfer->error_buf);
+            comm->buffer = NULL;
+        }
+    else
+        {
+            comm->buffer = g_strndup(transfer->answer->str, transfer->answer->len);
+            print_debug(_("Answer is: \"%s\"\n"), comm->buffer);
+        }
+
+    free_transfer_t(transfer);
+
+    return success;
+}
+
+
+/**
+ * Waits for one asynchronous request of comm to be done. If it failed
+ * it is given to comm->save_failed.
+ * @param comm a comm_t * structure with at least one pending request.
+ */
+static void collect_async_post(comm_t *comm)
+{
+    transfer_t *transfer = NULL;
+
+    transfer = g_async_queue_pop(comm->completed);
+    comm->pending = comm->pending - 1;
+
+    if (transfer->result != CURLE_OK)
+        {
+            print_error(__FILE__, __LINE__, _("Error while sending POST command (to \"%s\"): %s\n"), transfer->real_url, transfer->error_buf);
+
+            if (transfer->stream != NULL)
+                {
+                    save_failed_stream(comm, transfer->url, transfer->stream);
+                }
+            else if (comm->save_failed != NULL)
+                {
+                    comm->save_failed(comm->failed_data, transfer->url, transfer->body, transfer->length);
+                }
+        }
+
+    free_transfer_t(transfer);
+}
+
+
+/**
+ * Gives a block stream that could not be sent to comm->save_failed.
+ * Only then its body is built in memory.
+ * @param comm a comm_t * structure.
+ * @param url is the url of the failed request.
+ * @param stream is the block stream of the failed request.
+ */
+static void save_failed_stream(comm_t *comm, gchar *url, block_stream_t *stream)
+{
+    guchar *body = NULL;
+    gsize length = 0;
+
+    if (comm->save_failed != NULL)
+        {
+            body = read_whole_block_stream(stream, &length);
+            comm->save_failed(comm->failed_data, url, (gchar *) body, length);
+            free_variable(body);
+        }
+}
+
+
+/**
+ * Sends comm->readbuffer with a POST command to the http server url
+ * without waiting for the answer. comm->readbuffer is taken by this
+ * function (it is set to NULL). When comm has no transport or no
+ * asynchronous request allowed it behaves like post_url(). Requests
+ * that fail are given to comm->save_failed in the calling thread.
+ * @param comm a comm_t * structure. If comm->max_in_flight requests
+ *        are already in flight this function waits for one of them.
+ * @param url a gchar * url where to send the command to. It must NOT
+ *        contain the http://ip:port string.
+ * @returns CURLE_OK if the request has been handed to the transport
+ *          (or sent) and an other CURLcode otherwise.
+ */
+gint post_url_async(comm_t *comm, gchar *url)
+{
+    gint success = CURLE_FAILED_INIT;
+
+    if (comm != NULL && comm->readbuffer != NULL)
+        {
+            success = post_buffer_async(comm, url, strlen(comm->readbuffer));
+        }
+
+    return success;
+}
+
+
+/**
+ * Same as post_url_async() but comm->readbuffer may contain binary data:
+ * its length is given instead of being computed with strlen().
+ * @param comm a comm_t * structure.
+ * @param url a gchar * url where to send the command to. It must NOT
+ *        contain the http://ip:port string.
+ * @param length is the number of bytes of comm->readbuffer to be sent.
+ * @returns CURLE_OK if the request has been handed to the transport
+ *          (or sent) and an other CURLcode otherwise.
+ */
+gint post_buffer_async(comm_t *comm, gchar *url, gsize length)
+{
+    gint success = CURLE_FAILED_INIT;
+    transfer_t *transfer = NULL;
+
+    if (comm != NULL && url != NULL && comm->conn != NULL && comm->readbuffer != NULL)
+        {
+            if (comm->transport != NULL && comm->max_in_flight > 0)
+                {
+                    while (comm->pending >= comm->max_in_flight)
+                        {
+                            collect_async_post(comm);
+                        }
+
+                    transfer = new_transfer_t(comm, url, comm->readbuffer, length, NULL, TRUE, comm->completed);
+                    comm->readbuffer = NULL;
+                    comm->pending = comm->pending + 1;
+                    submit_transfer(comm->transport, transfer);
+                    success = CURLE_OK;
+                }
+            else
+                {
+                    success = post_buffer(comm, url, length);
+
+                    if (success != CURLE_OK && comm->save_failed != NULL)
+                        {
+                            comm->save_failed(comm->failed_data, url, comm->readbuffer, length);
+                        }
+
+                    free_variable(comm->readbuffer);
+                    free_variable(comm->buffer);
+                    comm->readbuffer = NULL;
+                    comm->buffer = NULL;
+                }
+        }
+
+    return success;
+}
+
+
+/**
+ * Sends the blocks of a block stream with a POST command to the http
+ * server url without waiting for the answer. The body is read from the
+ * stream while it is sent (chunked transfer encoding when its length is
+ * not known) so it is never built in memory. It behaves like
+ * post_url_async() otherwise.
+ * @param comm a comm_t * structure.
+ * @param url a gchar * url where to send the command to. It must NOT
+ *        contain the http://ip:port string.
+ * @param stream is the block stream to be sent. It is taken by this
+ *        function and freed once the request is done.
+ * @returns CURLE_OK if the request has been handed to the transport
+ *          (or sent) and an other CURLcode otherwise.
+ */
+gint post_blocks_async(comm_t *comm, gchar *url, block_stream_t *stream)
+{
+    gint success = CURLE_FAILED_INIT;
+    transfer_t *transfer = NULL;
+
+    if (comm != NULL && url != NULL && comm->conn != NULL && stream != NULL)
+        {
+            if (comm->transport != NULL && comm->max_in_flight > 0)
+                {
+                    while (comm->pending >= comm->max_in_flight)
+                        {
+                            collect_async_post(comm);
+                        }
+
+                    transfer = new_transfer_t(comm, url, NULL, 0, stream, FALSE, comm->completed);
+                    comm->pending = comm->pending + 1;
+                    submit_transfer(comm->transport, transfer);
+                    success = CURLE_OK;
+                }
+            else
+                {
+                    success = post_stream(comm, url, stream);
+
+                    if (success != CURLE_OK)
+                        {
+                            save_failed_stream(comm, url, stream);
+                        }
+
+                    free_block_stream_t(stream);
+                    free_variable(comm->buffer);
+                    comm->buffer = NULL;
+                }
+        }
+    else
+        {
+            free_block_stream_t(stream);
+        }
+
+    return success;
+}
+
+
+/**
+ * Waits for all asynchronous requests of comm to be done. Failed ones
+ * are given to comm->save_failed.
+ * @param comm a comm_t * structure.
+ */
+void wait_for_async_posts(comm_t *comm)
+{
+    if (comm != NULL)
+        {
+            while (comm->pending > 0)
+                {
+                    collect_async_post(comm);
+                }
+        }
+}
+
+
 /**
  * Checks wether the server is alive or not and checks its version
  * @param comm a comm_t * structure that must contain an initialized
@@ -486,6 +1227,47 @@ gboolean is_server_alive(comm_t *comm)
 }
 
 
+/**
+ * Tells whether blocks may be exchanged with the server as binary frames.
+ * The server is asked once (with /Version.json) and its answer is kept
+ * in comm->protocol. Servers that do not advertise PROTOCOL_BINARY (older
+ * ones) are spoken to with JSON.
+ * @param comm a comm_t * structure that must contain an initialized
+ *        curl_handle (must not be NULL).
+ * @returns TRUE if the server speaks PROTOCOL_BINARY, FALSE otherwise
+ *          (FALSE also when the server could not be reached: it will be
+ *          asked again next time).
+ */
+gboolean does_server_speak_binary(comm_t *comm)
+{
+    gint success = CURLE_FAILED_INIT;
+
+    if (comm != NULL && comm->protocol == COMM_PROTOCOL_UNKNOWN)
+        {
+            success = get_url(comm, "/Version.json", NULL);
+
+            if (success == CURLE_OK && comm->buffer != NULL)
+                {
+                    if (is_protocol_in_json_version(comm->buffer, PROTOCOL_BINARY) == TRUE)
+                        {
+                            comm->protocol = COMM_PROTOCOL_BINARY;
+                        }
+                    else
+                        {
+                            comm->protocol = COMM_PROTOCOL_JSON;
+                        }
+
+                    print_debug(_("Server at %s speaks protocol %d\n"), comm->conn, comm->protocol);
+                }
+
+            free_variable(comm->buffer);
+            comm->buffer = NULL;
+        }
+
+    return (comm != NULL && comm->protocol == COMM_PROTOCOL_BINARY);
+}
+
+
 /**
  * Creates a new communication comm_t * structure.
  * @param conn a gchar * connection string that should be some url like
@@ -511,6 +1293,14 @@ comm_t *init_comm_struct(gchar *conn, gshort cmptype)
     comm->length = 0;
     comm->uncomp_len = 0;
     comm->cmptype = cmptype;
+    comm->transport = NULL;
+    comm->replies = g_async_queue_new();
+    comm->completed = g_async_queue_new();
+    comm->pending = 0;
+    comm->max_in_flight = 0;
+    comm->save_failed = NULL;
+    comm->failed_data = NULL;
+    comm->protocol = COMM_PROTOCOL_UNKNOWN;
 
     return comm;
 }
@@ -524,6 +1314,9 @@ void free_comm_t(comm_t *comm)
 {
     if (comm != NULL)
         {
+            wait_for_async_posts(comm);
+            g_async_queue_unref(comm->replies);
+            g_async_queue_unref(comm->completed);
             curl_easy_cleanup(comm->curl_handle);
             free_variable(comm->buffer);
             free_variable(comm->readbuffer);
@@ -30,6 +30,7 @@
 #define _COMMUNIQUE_H_
 
 #include "options.h"
+#include "framing.h"
 
 /**
  * @def X_GET_HASH_ARRAY
@@ -53,9 +54,77 @@
  *
  * @def CT_PLAIN
  * Defines the Content-Type HTTP header for plain text requests / answers
+ *
+ * @def CT_BINARY
+ * Defines the Content-Type HTTP header for framed binary requests /
+ * answers (urls ending with .bin)
  */
 #define CT_JSON ("application/json; charset=utf-8")
 #define CT_PLAIN ("text/plain; charset=utf-8")
+#define CT_BINARY ("application/octet-stream")
+
+
+/**
+ * @def PROTOCOL_JSON
+ * Name of the protocol where blocks are base64 encoded into JSON
+ * messages (urls ending with .json). Every server speaks it.
+ *
+ * @def PROTOCOL_BINARY
+ * Name of the protocol where blocks are sent as binary frames (urls
+ * ending with .bin). See framing.h.
+ */
+#define PROTOCOL_JSON ("json")
+#define PROTOCOL_BINARY ("binary")
+
+
+/**
+ * @def COMM_PROTOCOL_UNKNOWN
+ * The protocols spoken by the server have not been asked yet.
+ *
+ * @def COMM_PROTOCOL_JSON
+ * The server only speaks PROTOCOL_JSON.
+ *
+ * @def COMM_PROTOCOL_BINARY
+ * The server also speaks PROTOCOL_BINARY.
+ */
+#define COMM_PROTOCOL_UNKNOWN (0)
+#define COMM_PROTOCOL_JSON (1)
+#define COMM_PROTOCOL_BINARY (2)
+
+
+/**
+ * @def TRANSPORT_DEFAULT_CONNECTIONS
+ * Default number of keep-alive connections that a transport keeps open
+ * to the server.
+ *
+ * @def TRANSPORT_DEFAULT_IN_FLIGHT
+ * Default number of asynchronous POST requests that one comm_t may have
+ * in flight at the same time.
+ *
+ * @def TRANSPORT_POLL_TIMEOUT
+ * Maximum time in milliseconds the transport's thread waits for network
+ * activity before looking for new requests.
+ */
+#define TRANSPORT_DEFAULT_CONNECTIONS (8)
+#define TRANSPORT_DEFAULT_IN_FLIGHT (4)
+#define TRANSPORT_POLL_TIMEOUT (1000)
+
+
+/**
+ * @struct transport_t
+ * @brief A libcurl multi handle driven by its own thread. It keeps a
+ *        pool of keep-alive connections to the server that all comm_t
+ *        attached to it share and performs their requests concurrently.
+ */
+typedef struct
+{
+    CURLM *multi;              /**< multi handle (only used by thread once started)          */
+    GThread *thread;           /**< thread that performs the transfers                       */
+    GAsyncQueue *submitted;    /**< transfer_t * waiting to be added to the multi handle     */
+    GSList *active;            /**< transfer_t * being performed (only used by thread)       */
+    gint stop;                 /**< set to 1 to stop the thread                              */
+    guint connections;         /**< maximum number of connections to the server              */
+} transport_t;
 
 
 /**
@@ -78,9 +147,38 @@ typedef struct
     size_t length;     /**< length of buffer                                 */
     size_t uncomp_len; /**< length of uncompressed buffer                    */
     gshort cmptype;    /**< Compression type (COMPRESS_NONE_TYPE by default) */
+    transport_t *transport;    /**< Shared transport used to POST requests (NULL to use curl_handle) */
+    GAsyncQueue *replies;      /**< Where the transport gives back this comm's synchronous requests  */
+    GAsyncQueue *completed;    /**< Where the transport gives back this comm's asynchronous requests */
+    guint pending;             /**< Number of asynchronous requests not collected yet                */
+    guint max_in_flight;       /**< Maximum number of asynchronous requests in flight (0 means none) */
+    void (*save_failed)(gpointer user_data, gchar *url, gchar *body, gsize length); /**< Called with asynchronous requests that failed */
+    gpointer failed_data;      /**< user_data passed to save_failed                                  */
+    gint protocol;             /**< COMM_PROTOCOL_* negotiated with the server                       */
 } comm_t;
 
 
+/**
+ * @struct transfer_t
+ * @brief One POST request handed to a transport and its answer.
+ */
+typedef struct
+{
+    CURL *easy;                /**< easy handle of this request                              */
+    gchar *url;                /**< url of the request (without http://ip:port)             */
+    gchar *real_url;           /**< whole url of the request                                 */
+    gchar *body;               /**< body of the request                                      */
+    gsize length;              /**< length of body (it may contain \0 bytes)                 */
+    block_stream_t *stream;    /**< when not NULL the body is read from this stream (owned)  */
+    gboolean owned;            /**< TRUE if body has to be freed with the transfer           */
+    GString *answer;           /**< answer of the server                                     */
+    struct curl_slist *headers; /**< HTTP headers of the request                             */
+    gchar *error_buf;          /**< CURL_ERROR_SIZE buffer for libcurl's error message       */
+    gint result;               /**< CURLcode of the request once done                        */
+    GAsyncQueue *reply;        /**< where the transfer is pushed once done                   */
+} transfer_t;
+
+
 /**
  * gets the version for the communication library (ZMQ for now)
  * @returns a newly allocated string that contains the version and that
@@ -146,6 +244,100 @@ extern gint get_url(comm_t *comm, gchar *url, gchar *header);
 extern gint post_url(comm_t *comm, gchar *url);
 
 
+/**
+ * Sends comm->readbuffer with a POST command to the http server url
+ * without waiting for the answer. comm->readbuffer is taken by this
+ * function (it is set to NULL). When comm has no transport or no
+ * asynchronous request allowed it behaves like post_url(). Requests
+ * that fail are given to comm->save_failed in the calling thread.
+ * @param comm a comm_t * structure. If comm->max_in_flight requests
+ *        are already in flight this function waits for one of them.
+ * @param url a gchar * url where to send the command to. It must NOT
+ *        contain the http://ip:port string.
+ * @returns CURLE_OK if the request has been handed to the transport
+ *          (or sent) and an other CURLcode otherwise.
+ */
+extern gint post_url_async(comm_t *comm, gchar *url);
+
+
+/**
+ * Same as post_url_async() but comm->readbuffer may contain binary data:
+ * its length is given instead of being computed with strlen().
+ * @param comm a comm_t * structure.
+ * @param url a gchar * url where to send the command to. It must NOT
+ *        contain the http://ip:port string.
+ * @param length is the number of bytes of comm->readbuffer to be sent.
+ * @returns CURLE_OK if the request has been handed to the transport
+ *          (or sent) and an other CURLcode otherwise.
+ */
+extern gint post_buffer_async(comm_t *comm, gchar *url, gsize length);
+
+
+/**
+ * Sends the blocks of a block stream with a POST command to the http
+ * server url without waiting for the answer. The body is read from the
+ * stream while it is sent (chunked transfer encoding when its length is
+ * not known) so it is never built in memory. It behaves like
+ * post_url_async() otherwise.
+ * @param comm a comm_t * structure.
+ * @param url a gchar * url where to send the command to. It must NOT
+ *        contain the http://ip:port string.
+ * @param stream is the block stream to be sent. It is taken by this
+ *        function and freed once the request is done.
+ * @returns CURLE_OK if the request has been handed to the transport
+ *          (or sent) and an other CURLcode otherwise.
+ */
+extern gint post_blocks_async(comm_t *comm, gchar *url, block_stream_t *stream);
+
+
+/**
+ * Waits for all asynchronous requests of comm to be done. Failed ones
+ * are given to comm->save_failed.
+ * @param comm a comm_t * structure.
+ */
+extern void wait_for_async_posts(comm_t *comm);
+
+
+/**
+ * Creates a transport and starts its thread.
+ * @param connections is the maximum number of connections opened to the
+ *        server (they are kept alive and reused between requests).
+ * @returns a newly allocated transport_t structure that may be freed
+ *          with free_transport_t().
+ */
+extern transport_t *new_transport_t(guint connections);
+
+
+/**
+ * Stops the transport's thread and frees the transport. Requests still
+ * in flight are aborted. No comm_t may use it anymore.
+ * @param transport is the transport to be freed.
+ */
+extern void free_transport_t(transport_t *transport);
+
+
+/**
+ * Makes comm send its POST requests through transport.
+ * @param comm a comm_t * structure.
+ * @param transport is the transport to be used (NULL to use comm's own
+ *        curl handle).
+ * @param max_in_flight is the number of asynchronous requests that comm
+ *        may have in flight (0 makes post_url_async() synchronous).
+ */
+extern void set_comm_transport(comm_t *comm, transport_t *transport, guint max_in_flight);
+
+
+/**
+ * Sets the function called with requests sent by post_url_async() that
+ * failed (to save them for later for instance).
+ * @param comm a comm_t * structure.
+ * @param save_failed is the function called with user_data, the url,
+ *        the body of the failed request and its length.
+ * @param user_data is passed to save_failed.
+ */
+extern void set_comm_failure_handler(comm_t *comm, void (*save_failed)(gpointer user_data, gchar *url, gchar *body, gsize length), gpointer user_data);
+
+
 /**
  * Checks wether the server is alive or not and checks its version
  * @param comm a comm_t * structure that must contain an initialized
@@ -156,6 +348,20 @@ extern gint post_url(comm_t *comm, gchar *url);
 extern gboolean is_server_alive(comm_t *comm);
 
 
+/**
+ * Tells whether blocks may be exchanged with the server as binary frames.
+ * The server is asked once (with /Version.json) and its answer is kept
+ * in comm->protocol. Servers that do not advertise PROTOCOL_BINARY (older
+ * ones) are spoken to with JSON.
+ * @param comm a comm_t * structure that must contain an initialized
+ *        curl_handle (must not be NULL).
+ * @returns TRUE if the server speaks PROTOCOL_BINARY, FALSE otherwise
+ *          (FALSE also when the server could not be reached: it will be
+ *          asked again next time).
+ */
+extern gboolean does_server_speak_binary(comm_t *comm);
+
+
 /**
  * Frees and releases a comm_t *structure
  * @param comm a comm_t * structure to be freed
@@ -22,7 +22,8 @@
 
 /**
  * @file compress.c
- * This file is here to manage compression libraries (at least zlib)
+ * This file is here to manage compression libraries (at least zlib and
+ * zstd and lz4 when they are available at compile time)
  */
 
 #include "libcdpfgl.h"
@@ -31,6 +32,33 @@
 static void zlib_print_error(char *filename, int lineno, int ret);
 static compress_t *zlib_compress_buffer(compress_t *comp, guchar *buffer, guint size);
 static compress_t *zlib_uncompress_buffer(compress_t *comp, guint64 len);
+#ifdef HAVE_ZSTD
+static void free_zstd_cctx(gpointer data);
+static void free_zstd_dctx(gpointer data);
+static compress_t *zstd_compress_buffer(compress_t *comp, guchar *buffer, guint size);
+static compress_t *zstd_uncompress_buffer(compress_t *comp, guint64 len);
+#endif
+#ifdef HAVE_LZ4
+static compress_t *lz4_compress_buffer(compress_t *comp, guchar *buffer, guint size);
+static compress_t *lz4_uncompress_buffer(compress_t *comp, guint64 len);
+#endif
+
+
+/**
+ * Compression level of each compression type (indexed by type). Levels
+ * are set once at startup before any thread compresses anything.
+ */
+static gint compress_levels[] = {0, COMPRESS_ZLIB_DEFAULT_LEVEL, COMPRESS_ZSTD_DEFAULT_LEVEL, COMPRESS_LZ4_DEFAULT_LEVEL};
+
+
+#ifdef HAVE_ZSTD
+/**
+ * zstd contexts are expensive to create: each thread keeps its own
+ * compression and decompression contexts.
+ */
+static GPrivate zstd_cctx = G_PRIVATE_INIT(free_zstd_cctx);
+static GPrivate zstd_dctx = G_PRIVATE_INIT(free_zstd_dctx);
+#endif
 
 
 /**
@@ -71,11 +99,54 @@ void free_compress_t(compress_t *comp)
 }
 
 
+/**
+ * Sets the compression level used for a compression type.
+ * @param type is the compression type (COMPRESS_ZLIB_TYPE,
+ *        COMPRESS_ZSTD_TYPE or COMPRESS_LZ4_TYPE).
+ * @param level is the level to be used with this type. For zlib it
+ *        ranges from 0 to 9 (-1 being zlib's default), for zstd from
+ *        ZSTD_minCLevel() to ZSTD_maxCLevel() and for lz4 a level
+ *        greater than 1 selects lz4hc, 0 or 1 the default fast
+ *        compression and negative values lz4's acceleration.
+ * @note this is not thread safe: it must be called before compressing
+ *       anything.
+ */
+void set_compress_level(gshort type, gint level)
+{
+    if (type == COMPRESS_ZLIB_TYPE)
+        {
+            compress_levels[type] = CLAMP(level, Z_DEFAULT_COMPRESSION, Z_BEST_COMPRESSION);
+        }
+    else if (type == COMPRESS_ZSTD_TYPE || type == COMPRESS_LZ4_TYPE)
+        {
+            compress_levels[type] = level;
+        }
+}
+
+
+/**
+ * @param type is the compression type.
+ * @returns the level used to compress with this type.
+ */
+gint get_compress_level(gshort type)
+{
+    if (type > COMPRESS_NONE_TYPE && type <= COMPRESS_LZ4_TYPE)
+        {
+            return compress_levels[type];
+        }
+    else
+        {
+            return 0;
+        }
+}
+
+
 /**
  * Compress buffer and returns a compressed text
  * @param buffer is the plain buffer text to be compressed
  *        this buffer must be \0 terminated.
- * @param type is the compression type to use (COMPRESS_ZLIB_TYPE).
+ * @param type is the compression type to use (COMPRESS_ZLIB_TYPE,
+ *        COMPRESS_ZSTD_TYPE or COMPRESS_LZ4_TYPE).
  * @returns a compress_t structure containing a compressed text
  *          buffer.
  */
@@ -89,6 +160,18 @@ compress_t *compress_buffer(guchar *buffer, guint size, gint type)
         {
             comp = zlib_compress_buffer(comp, buffer, size);
         }
+#ifdef HAVE_ZSTD
+    else if (type == COMPRESS_ZSTD_TYPE && comp != NULL)
+        {
+            comp = zstd_compress_buffer(comp, buffer, size);
+        }
+#endif
+#ifdef HAVE_LZ4
+    else if (type == COMPRESS_LZ4_TYPE && comp != NULL)
+        {
+            comp = lz4_compress_buffer(comp, buffer, size);
+        }
+#endif
 
     return comp;
 }
@@ -152,8 +235,7 @@ static compress_t *zlib_compress_buffer(compress_t *comp, guchar *buffer, guint
 
     if (destbuffer != NULL)
         {
-            /* Default zlib compression level is set to best (9) */
-            ret = compress2(destbuffer, &destlen, (const Bytef *) buffer, (uLong) srclen, 9);
+            ret = compress2(destbuffer, &destlen, (const Bytef *) buffer, (uLong) srclen, compress_levels[COMPRESS_ZLIB_TYPE]);
 
             if (ret != Z_OK)
                 {
@@ -187,7 +269,8 @@ static compress_t *zlib_compress_buffer(compress_t *comp, guchar *buffer, guint
  * @param buffer is the compressed buffer to be uncompressed
  * @param cmplen is the len of the above compressed buffer
  * @param textlen is the len of the uncompressed data
- * @param type is the compression type to use (COMPRESS_ZLIB_TYPE).
+ * @param type is the compression type to use (COMPRESS_ZLIB_TYPE,
+ *        COMPRESS_ZSTD_TYPE or COMPRESS_LZ4_TYPE).
  * @returns a compress_t structure containing a compressed text
  *          buffer.
  */
@@ -206,6 +289,24 @@ compress_t *uncompress_buffer(guchar *buffer, guint64 cmplen, guint64 textlen, g
             comp->comp = TRUE;
             comp = zlib_uncompress_buffer(comp, textlen);
         }
+#ifdef HAVE_ZSTD
+    else if (type == COMPRESS_ZSTD_TYPE)
+        {
+            comp->text = buffer;
+            comp->len = cmplen;
+            comp->comp = TRUE;
+            comp = zstd_uncompress_buffer(comp, textlen);
+        }
+#endif
+#ifdef HAVE_LZ4
+    else if (type == COMPRESS_LZ4_TYPE)
+        {
+            comp->text = buffer;
+            comp->len = cmplen;
+            comp->comp = TRUE;
+            comp = lz4_uncompress_buffer(comp, textlen);
+        }
+#endif
 
     return comp;
 }
@@ -244,6 +345,8 @@ static compress_t *zlib_uncompress_buffer(compress_t *comp, guint64 len)
                     if (ret != Z_BUF_ERROR)
                         {
                             zlib_print_error(__FILE__, __LINE__, ret);
+                            free_variable(destbuffer);
+                            comp->text = NULL;  /* the compressed buffer belongs to the caller */
                             free_compress_t(comp);
                             comp = NULL;
                         }
@@ -268,8 +371,323 @@ static compress_t *zlib_uncompress_buffer(compress_t *comp, guint64 len)
 }
 
 
+#ifdef HAVE_ZSTD
+/**
+ * Frees a thread's zstd compression context when the thread exits.
+ * @param data is a ZSTD_CCtx *.
+ */
+static void free_zstd_cctx(gpointer data)
+{
+    ZSTD_freeCCtx((ZSTD_CCtx *) data);
+}
+
+
+/**
+ * Frees a thread's zstd decompression context when the thread exits.
+ * @param data is a ZSTD_DCtx *.
+ */
+static void free_zstd_dctx(gpointer data)
+{
+    ZSTD_freeDCtx((ZSTD_DCtx *) data);
+}
+
+
+/**
+ * Compress buffer using zstd.
+ * @param comp is the compress_t structure that may contain
+ *        the compressed data
+ * @param buffer is the plain text buffer to be compressed
+ * @param size is the length of buffer.
+ * @returns a compress_t structure with compressed data in it
+ *          or NULL in case that something went wrong.
+ */
+static compress_t *zstd_compress_buffer(compress_t *comp, guchar *buffer, guint size)
+{
+    ZSTD_CCtx *cctx = g_private_get(&zstd_cctx);
+    guchar *destbuffer = NULL;
+    gsize destlen = 0;
+    gsize ret = 0;
+
+    if (cctx == NULL)
+        {
+            cctx = ZSTD_createCCtx();
+            g_assert_nonnull(cctx);
+            g_private_set(&zstd_cctx, cctx);
+        }
+
+    destlen = ZSTD_compressBound(size);
+    destbuffer = (guchar *) g_malloc(destlen);
+
+    ret = ZSTD_compressCCtx(cctx, destbuffer, destlen, buffer, size, compress_levels[COMPRESS_ZSTD_TYPE]);
+
+    if (ZSTD_isError(ret))
+        {
+            print_error(__FILE__, __LINE__, _("Error while compressing with zstd: %s\n"), ZSTD_getErrorName(ret));
+            free_variable(destbuffer);
+            free_compress_t(comp);
+            comp = NULL;
+        }
+    else
+        {
+            comp->text = destbuffer;
+            comp->len = ret;
+            comp->comp = TRUE;
+        }
+
+    return comp;
+}
+
+
+/**
+ * Uncompress buffer using zstd
+ * @param comp is the compress_t structure that contains the compressed
+ *        data and that will contain the uncompressed data.
+ * @param len is the len of the uncompressed data
+ * @returns a compress_t structure with uncompressed data in it
+ *          or NULL in case that something went wrong.
+ */
+static compress_t *zstd_uncompress_buffer(compress_t *comp, guint64 len)
+{
+    ZSTD_DCtx *dctx = g_private_get(&zstd_dctx);
+    guchar *destbuffer = NULL;
+    gsize ret = 0;
+
+    if (dctx == NULL)
+        {
+            dctx = ZSTD_createDCtx();
+            g_assert_nonnull(dctx);
+            g_private_set(&zstd_dctx, dctx);
+        }
+
+    destbuffer = (guchar *) g_malloc0(len + 1);
+
+    ret = ZSTD_decompressDCtx(dctx, destbuffer, len, comp->text, comp->len);
+
+    if (ZSTD_isError(ret))
+        {
+            print_error(__FILE__, __LINE__, _("Error while uncompressing with zstd: %s\n"), ZSTD_getErrorName(ret));
+            free_variable(destbuffer);
+            comp->text = NULL;  /* the compressed buffer belongs to the caller */
+            free_compress_t(comp);
+            comp = NULL;
+        }
+    else
+        {
+            comp->text = destbuffer;
+            comp->text[ret] = '\0';
+            comp->len = ret;
+            comp->comp = FALSE;
+        }
+
+    return comp;
+}
+#endif
+
+
+#ifdef HAVE_LZ4
+/**
+ * Compress buffer using lz4 (lz4hc when the level is greater than 1).
+ * @param comp is the compress_t structure that may contain
+ *        the compressed data
+ * @param buffer is the plain text buffer to be compressed
+ * @param size is the length of buffer.
+ * @returns a compress_t structure with compressed data in it
+ *          or NULL in case that something went wrong.
+ */
+static compress_t *lz4_compress_buffer(compress_t *comp, guchar *buffer, guint size)
+{
+    gint level = compress_levels[COMPRESS_LZ4_TYPE];
+    guchar *destbuffer = NULL;
+    gint destlen = 0;
+    gint ret = 0;
+
+    destlen = LZ4_compressBound((gint) size);
+    destbuffer = (guchar *) g_malloc(destlen);
+
+    if (level > 1)
+        {
+            ret = LZ4_compress_HC((const char *) buffer, (char *) destbuffer, (gint) size, destlen, level);
+        }
+    else if (level < 0)
+        {
+            ret = LZ4_compress_fast((const char *) buffer, (char *) destbuffer, (gint) size, destlen, -level);
+        }
+    else
+        {
+            ret = LZ4_compress_default((const char *) buffer, (char *) destbuffer, (gint) size, destlen);
+        }
+
+    if (ret <= 0)
+        {
+            print_error(__FILE__, __LINE__, _("Error while compressing with lz4.\n"));
+            free_variable(destbuffer);
+            free_compress_t(comp);
+            comp = NULL;
+        }
+    else
+        {
+            comp->text = destbuffer;
+            comp->len = ret;
+            comp->comp = TRUE;
+        }
+
+    return comp;
+}
+
+
+/**
+ * Uncompress buffer using lz4
+ * @param comp is the compress_t structure that contains the compressed
+ *        data and that will contain the uncompressed data.
+ * @param len is the len of the uncompressed data
+ * @returns a compress_t structure with uncompressed data in it
+ *          or NULL in case that something went wrong.
+ */
+static compress_t *lz4_uncompress_buffer(compress_t *comp, guint64 len)
+{
+    guchar *destbuffer = NULL;
+    gint ret = 0;
+
+    destbuffer = (guchar *) g_malloc0(len + 1);
+
+    ret = LZ4_decompress_safe((const char *) comp->text, (char *) destbuffer, (gint) comp->len, (gint) len);
+
+    if (ret < 0)
+        {
+            print_error(__FILE__, __LINE__, _("Error while uncompressing with lz4: invalid data.\n"));
+            free_variable(destbuffer);
+            comp->text = NULL;  /* the compressed buffer belongs to the caller */
+            free_compress_t(comp);
+            comp = NULL;
+        }
+    else
+        {
+            comp->text = destbuffer;
+            comp->text[ret] = '\0';
+            comp->len = ret;
+            comp->comp = FALSE;
+        }
+
+    return comp;
+}
+#endif
+
+
+/**
+ * Guesses whether a buffer is worth compressing by looking at the
+ * distribution of the bytes of a sample of it. The sample is considered
+ * incompressible when the sum of the squares of each byte value count
+ * is so small that the collision entropy (a lower bound of Shannon's
+ * entropy) is above log2(COMPRESS_ENTROPY_FACTOR) bits per byte.
+ * @param buffer is the buffer to be tested.
+ * @param size is the number of bytes of buffer.
+ * @returns FALSE when the buffer looks like random data (already
+ *          compressed or encrypted) and TRUE otherwise.
+ */
+gboolean is_buffer_compressible(guchar *buffer, gsize size)
+{
+    guint counts[256];
+    guint64 sum = 0;
+    guint64 n = 0;
+    gsize stride = 0;
+    gsize chunk_len = 0;
+    gsize i = 0;
+    gsize j = 0;
+
+    memset(counts, 0, sizeof(counts));
+
+    if (buffer != NULL && size <= COMPRESS_SAMPLE_SIZE)
+        {
+            for (i = 0; i < size; i++)
+                {
+                    counts[buffer[i]]++;
+                }
+            n = size;
+        }
+    else if (buffer != NULL)
+        {
+            /* size > COMPRESS_SAMPLE_SIZE so that stride >= chunk_len */
+            stride = size / COMPRESS_SAMPLE_CHUNKS;
+            chunk_len = COMPRESS_SAMPLE_SIZE / COMPRESS_SAMPLE_CHUNKS;
+
+            for (i = 0; i < COMPRESS_SAMPLE_CHUNKS; i++)
+                {
+                    for (j = 0; j < chunk_len; j++)
+                        {
+                            counts[buffer[i * stride + j]]++;
+                        }
+                }
+            n = COMPRESS_SAMPLE_CHUNKS * chunk_len;
+        }
+
+    for (i = 0; i < 256; i++)
+        {
+            sum = sum + (guint64) counts[i] * counts[i];
+        }
+
+    return (sum * COMPRESS_ENTROPY_FACTOR > n * n);
+}
+
+
+/**
+ * Inits a probe at the beginning of a file.
+ * @param[out] probe is the probe to be initialized.
+ * @param cmptype is the compression type selected by the user.
+ */
+void init_compress_probe(compress_probe_t *probe, gshort cmptype)
+{
+    if (probe != NULL)
+        {
+            probe->cmptype = cmptype;
+            probe->tried = 0;
+            probe->kept = 0;
+        }
+}
+
+
+/**
+ * Accounts a block made with probe->cmptype. Once COMPRESS_PROBE_BLOCKS
+ * blocks went through compression without any of them being kept
+ * compressed probe->cmptype becomes COMPRESS_NONE_TYPE.
+ * @param probe is the probe of the file the block belongs to.
+ * @param cmptype is the compression type of the block as finally stored.
+ */
+void account_compressed_block(compress_probe_t *probe, gshort cmptype)
+{
+    if (probe != NULL && probe->cmptype != COMPRESS_NONE_TYPE)
+        {
+            probe->tried = probe->tried + 1;
+
+            if (cmptype != COMPRESS_NONE_TYPE)
+                {
+                    probe->kept = probe->kept + 1;
+                }
+
+            if (probe->tried >= COMPRESS_PROBE_BLOCKS && probe->kept == 0)
+                {
+                    print_debug(_("File does not compress: its remaining blocks will not be compressed.\n"));
+                    probe->cmptype = COMPRESS_NONE_TYPE;
+                }
+        }
+}
+
+
 /**
- * Verify if a compress type is allowed
+ * Tells whether a compress type is known (whatever it is available in
+ * this build or not). Data compressed with a known type may be stored
+ * as is even if it can not be uncompressed here.
+ * @param cmptype is a gshort that should represents the compression type
+ * @returns a boolean: True if the compression type is known, False
+ *          otherwise.
+ */
+gboolean is_compress_type_known(gshort cmptype)
+{
+    return (cmptype >= COMPRESS_NONE_TYPE && cmptype <= COMPRESS_LZ4_TYPE);
+}
+
+
+/**
+ * Verify if a compress type is allowed (ie available in this build)
  * @param cmptype is a gshort that should represents the compression type
  * @returns a boolean: True if we know the compression type, False otherwise.
  */
@@ -279,6 +697,18 @@ gboolean is_compress_type_allowed(gshort cmptype)
         {
             return TRUE;
         }
+#ifdef HAVE_ZSTD
+    else if (cmptype == COMPRESS_ZSTD_TYPE)
+        {
+            return TRUE;
+        }
+#endif
+#ifdef HAVE_LZ4
+    else if (cmptype == COMPRESS_LZ4_TYPE)
+        {
+            return TRUE;
+        }
+#endif
     else
         {
             return FALSE;
@@ -292,10 +722,22 @@ gboolean is_compress_type_allowed(gshort cmptype)
  */
 gchar *get_compress_type_string(void)
 {
+    gchar *types = NULL;
+    gchar *old = NULL;
 
-    return g_strdup_printf("%d, %d", COMPRESS_NONE_TYPE, COMPRESS_ZLIB_TYPE);
-
-}
+    types = g_strdup_printf("%d (none), %d (zlib)", COMPRESS_NONE_TYPE, COMPRESS_ZLIB_TYPE);
 
+#ifdef HAVE_ZSTD
+    old = types;
+    types = g_strdup_printf("%s, %d (zstd)", old, COMPRESS_ZSTD_TYPE);
+    free_variable(old);
+#endif
 
+#ifdef HAVE_LZ4
+    old = types;
+    types = g_strdup_printf("%s, %d (lz4)", old, COMPRESS_LZ4_TYPE);
+    free_variable(old);
+#endif
 
+    return types;
+}
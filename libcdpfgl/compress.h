@@ -23,7 +23,7 @@
 /**
  * @file compress.h
  * This file contains all headers and public functions to manage
- * compression libraries such as zlib.
+ * compression libraries such as zlib, zstd and lz4.
  */
 
 #ifndef _COMPRESS_H_
@@ -41,6 +41,70 @@
  */
 #define COMPRESS_ZLIB_TYPE (1)
 
+/**
+ * @def COMPRESS_ZSTD_TYPE
+ * Defines that ZSTD is to be used to compress data (only available
+ * when compiled with libzstd)
+ */
+#define COMPRESS_ZSTD_TYPE (2)
+
+/**
+ * @def COMPRESS_LZ4_TYPE
+ * Defines that LZ4 is to be used to compress data (only available
+ * when compiled with liblz4)
+ */
+#define COMPRESS_LZ4_TYPE (3)
+
+
+/**
+ * @def COMPRESS_ZLIB_DEFAULT_LEVEL
+ * Default zlib compression level (0 to 9)
+ *
+ * @def COMPRESS_ZSTD_DEFAULT_LEVEL
+ * Default zstd compression level (fast compression that still has a
+ * better ratio than zlib)
+ *
+ * @def COMPRESS_LZ4_DEFAULT_LEVEL
+ * Default lz4 compression level (0 is lz4's default fast compression,
+ * levels above 1 use lz4hc and negative levels are accelerations)
+ */
+#define COMPRESS_ZLIB_DEFAULT_LEVEL (6)
+#define COMPRESS_ZSTD_DEFAULT_LEVEL (1)
+#define COMPRESS_LZ4_DEFAULT_LEVEL (0)
+
+
+/**
+ * @def COMPRESS_SAMPLE_SIZE
+ * Number of bytes of a buffer looked at to guess whether it is worth
+ * compressing it. Buffers bigger than that are sampled by
+ * COMPRESS_SAMPLE_CHUNKS chunks spread over the whole buffer.
+ *
+ * @def COMPRESS_SAMPLE_CHUNKS
+ * Number of chunks sampled in a buffer bigger than COMPRESS_SAMPLE_SIZE.
+ *
+ * @def COMPRESS_ENTROPY_FACTOR
+ * A sample whose bytes are so evenly distributed that its collision
+ * entropy is above log2(COMPRESS_ENTROPY_FACTOR) bits per byte (7.5) is
+ * considered incompressible (media files, archives, encrypted data...).
+ */
+#define COMPRESS_SAMPLE_SIZE (4096)
+#define COMPRESS_SAMPLE_CHUNKS (16)
+#define COMPRESS_ENTROPY_FACTOR (181)
+
+
+/**
+ * @def COMPRESS_MIN_GAIN
+ * A compressed block is kept only if it saves at least 1/COMPRESS_MIN_GAIN
+ * of the block's size (3%). Otherwise the block is kept uncompressed.
+ *
+ * @def COMPRESS_PROBE_BLOCKS
+ * When none of the first COMPRESS_PROBE_BLOCKS blocks of a file that
+ * have been compressed has been kept compressed the remaining blocks of
+ * that file are not compressed at all.
+ */
+#define COMPRESS_MIN_GAIN (32)
+#define COMPRESS_PROBE_BLOCKS (4)
+
 
 /**
  * @struct compress_t
@@ -54,6 +118,19 @@ typedef struct
 } compress_t;
 
 
+/**
+ * @struct compress_probe_t
+ * @brief Follows how well the blocks of one file compress in order to
+ *        give up compressing files that do not compress.
+ */
+typedef struct
+{
+    gshort cmptype;  /**< compression type for the next blocks (COMPRESS_NONE_TYPE once given up) */
+    guint tried;     /**< number of blocks that went through compression                          */
+    guint kept;      /**< number of those blocks that have been kept compressed                    */
+} compress_probe_t;
+
+
 /**
  * Inits compress_t structure with default values.
  */
@@ -68,6 +145,24 @@ extern compress_t *init_compress_t(void);
 extern void free_compress_t(compress_t *comp);
 
 
+/**
+ * Sets the compression level used for a compression type.
+ * @param type is the compression type (COMPRESS_ZLIB_TYPE,
+ *        COMPRESS_ZSTD_TYPE or COMPRESS_LZ4_TYPE).
+ * @param level is the level to be used with this type.
+ * @note this is not thread safe: it must be called before compressing
+ *       anything.
+ */
+extern void set_compress_level(gshort type, gint level);
+
+
+/**
+ * @param type is the compression type.
+ * @returns the level used to compress with this type.
+ */
+extern gint get_compress_level(gshort type);
+
+
 /**
  * Compress buffer and returns a compressed text
  * @param buffer is the plain buffer text to be compressed
@@ -84,7 +179,8 @@ extern compress_t *compress_buffer(guchar *buffer, guint size, gint type);
  * @param buffer is the compressed buffer to be uncompressed
  * @param cmplen is the len of the above compressed buffer
  * @param textlen is the len of the uncompressed data
- * @param type is the compression type to use (COMPRESS_ZLIB_TYPE).
+ * @param type is the compression type to use (COMPRESS_ZLIB_TYPE,
+ *        COMPRESS_ZSTD_TYPE or COMPRESS_LZ4_TYPE).
  * @returns a compress_t structure containing a compressed text
  *          buffer.
  */
@@ -92,7 +188,46 @@ extern compress_t *uncompress_buffer(guchar *buffer, guint64 cmplen, guint64 tex
 
 
 /**
- * Verify if a compress type is allowed
+ * Guesses whether a buffer is worth compressing by looking at the
+ * distribution of the bytes of a sample of it.
+ * @param buffer is the buffer to be tested.
+ * @param size is the number of bytes of buffer.
+ * @returns FALSE when the buffer looks like random data (already
+ *          compressed or encrypted) and TRUE otherwise.
+ */
+extern gboolean is_buffer_compressible(guchar *buffer, gsize size);
+
+
+/**
+ * Inits a probe at the beginning of a file.
+ * @param[out] probe is the probe to be initialized.
+ * @param cmptype is the compression type selected by the user.
+ */
+extern void init_compress_probe(compress_probe_t *probe, gshort cmptype);
+
+
+/**
+ * Accounts a block made with probe->cmptype. Once COMPRESS_PROBE_BLOCKS
+ * blocks went through compression without any of them being kept
+ * compressed probe->cmptype becomes COMPRESS_NONE_TYPE.
+ * @param probe is the probe of the file the block belongs to.
+ * @param cmptype is the compression type of the block as finally stored.
+ */
+extern void account_compressed_block(compress_probe_t *probe, gshort cmptype);
+
+
+/**
+ * Tells whether a compress type is known (whatever it is available in
+ * this build or not).
+ * @param cmptype is a gshort that should represents the compression type
+ * @returns a boolean: True if the compression type is known, False
+ *          otherwise.
+ */
+extern gboolean is_compress_type_known(gshort cmptype);
+
+
+/**
+ * Verify if a compress type is allowed (ie available in this build)
  * @param cmptype is a gshort that should represents the compression type
  * @returns a boolean: True if we know the compression type, False otherwise.
  */
@@ -55,6 +55,10 @@
   * Defines the group name for all preferences related to server's
   * backend named file_backend that stores everything into flat files.
   *
+  * @def GN_PACK_BACKEND
+  * Defines the group name for all preferences related to server's
+  * backend named pack_backend that appends blocks to segment files.
+  *
   * @def GN_VERSION
   * Defines the group name that will keep version information for
   * the database in the client's cache directory (for now).
@@ -63,6 +67,7 @@
 #define GN_SERVER ("Server")
 #define GN_ALL ("All")
 #define GN_FILE_BACKEND ("File_Backend")
+#define GN_PACK_BACKEND ("Pack_Backend")
 #define GN_VERSION ("Version")
 
 
@@ -92,6 +97,27 @@
 #define KN_ADAPTIVE ("adaptive")
 
 
+/**
+ * @def KN_CDC
+ * Defines the key name for the content defined chunking option. When
+ * TRUE blocks boundaries are determined by the content of the file
+ * (adaptive and blocksize options are then ignored).
+ *
+ * @def KN_CDC_MIN_SIZE
+ * Defines the key name for the minimum size of a content defined block.
+ *
+ * @def KN_CDC_AVG_SIZE
+ * Defines the key name for the average size of a content defined block.
+ *
+ * @def KN_CDC_MAX_SIZE
+ * Defines the key name for the maximum size of a content defined block.
+ */
+#define KN_CDC ("content-defined-chunking")
+#define KN_CDC_MIN_SIZE ("cdc-min-size")
+#define KN_CDC_AVG_SIZE ("cdc-avg-size")
+#define KN_CDC_MAX_SIZE ("cdc-max-size")
+
+
 /**
  * @def KN_NOSCAN
  * Defines the key name for the no-scan option that prevent the first
@@ -109,6 +135,75 @@
 #define KN_BUFFER_SIZE ("buffersize")
 
 
+/**
+ * @def KN_SAVE_WORKERS
+ * Defines the key name for the number of threads that will save files
+ * concurrently. 0 (or no value) means one thread per processor.
+ */
+#define KN_SAVE_WORKERS ("save-workers")
+
+
+/**
+ * @def KN_MEMORY_BUDGET
+ * Defines the key name for the maximum number of bytes of file data
+ * that all save workers together may hold in memory.
+ */
+#define KN_MEMORY_BUDGET ("memory-budget")
+
+
+/**
+ * @def KN_CARVE_WORKERS
+ * Defines the key name for the number of threads that carve directories
+ * concurrently when scanning them.
+ */
+#define KN_CARVE_WORKERS ("carve-workers")
+
+
+/**
+ * @def KN_READ_DEPTH
+ * Defines the key name for the number of reads kept in flight when the
+ * client reads a file.
+ */
+#define KN_READ_DEPTH ("read-depth")
+
+
+/**
+ * @def KN_EVENT_QUIET_PERIOD
+ * Defines the key name for the time (in milliseconds) without any event
+ * on a file before the client saves it.
+ */
+#define KN_EVENT_QUIET_PERIOD ("event-quiet-period")
+
+
+/**
+ * @def KN_EVENT_MAX_DELAY
+ * Defines the key name for the maximum time (in milliseconds) between
+ * the first event on a file and its save.
+ */
+#define KN_EVENT_MAX_DELAY ("event-max-delay")
+
+
+/**
+ * @def KN_FANOTIFY_FID
+ * Defines the key name for the fanotify mode where whole filesystems are
+ * marked and events report file handles instead of opened files.
+ */
+#define KN_FANOTIFY_FID ("fanotify-fid")
+
+
+/**
+ * @def KN_HTTP_CONNECTIONS
+ * Defines the key name for the number of keep-alive connections opened
+ * to the server (0 means that each thread uses its own connection).
+ *
+ * @def KN_HTTP_IN_FLIGHT
+ * Defines the key name for the number of data uploads that each thread
+ * may have in flight while it goes on reading files.
+ */
+#define KN_HTTP_CONNECTIONS ("http-connections")
+#define KN_HTTP_IN_FLIGHT ("http-in-flight")
+
+
 /**
  * @def KN_DIR_LIST
  * Defines a list of directories that we want to watch.
@@ -139,16 +234,42 @@
 #define KN_DB_NAME ("cache-db-name")
 
 
+/**
+ * @def KN_DB_DURABILITY
+ * Defines the key name for the durability of the local cache's commits
+ * (0 is fast, 1 is normal and 2 is full).
+ */
+#define KN_DB_DURABILITY ("cache-db-durability")
+
+
 /**
  * @def KN_COMPRESSION_TYPE
  * Defines compression type to use (should be the same than the one
  * found in libcdpfgl/compress.h :
  * . 0  COMPRESS_NONE_TYPE (no compression at all
  * . 1  COMPRESS_ZLIB_TYPE (zlib compression)
+ * . 2  COMPRESS_ZSTD_TYPE (zstd compression)
+ * . 3  COMPRESS_LZ4_TYPE (lz4 compression)
  */
 #define KN_COMPRESSION_TYPE ("compression-type")
 
 
+/**
+ * @def KN_ZLIB_LEVEL
+ * Defines the key name for the compression level used with zlib.
+ *
+ * @def KN_ZSTD_LEVEL
+ * Defines the key name for the compression level used with zstd.
+ *
+ * @def KN_LZ4_LEVEL
+ * Defines the key name for the compression level used with lz4 (levels
+ * above 1 use lz4hc).
+ */
+#define KN_ZLIB_LEVEL ("zlib-level")
+#define KN_ZSTD_LEVEL ("zstd-level")
+#define KN_LZ4_LEVEL ("lz4-level")
+
+
 /**
  * @def KN_SERVER_IP
  * Defines server's IP address for the client.
@@ -165,6 +286,44 @@
 #define KN_SERVER_PORT ("server-port")
 
 
+/**
+ * @def KN_HTTP_THREADS
+ * Defines the key name for the number of libmicrohttpd threads that poll
+ * connections with epoll (0 means one thread per connection).
+ *
+ * @def KN_REQUEST_WORKERS
+ * Defines the key name for the number of threads that process GET and
+ * POST requests when libmicrohttpd uses epoll threads.
+ *
+ * @def KN_CONNECTION_MEMORY_LIMIT
+ * Defines the key name for the number of bytes that libmicrohttpd may
+ * use for each connection.
+ *
+ * @def KN_CONNECTION_TIMEOUT
+ * Defines the key name for the number of seconds after which an
+ * inactive connection is closed.
+ */
+#define KN_HTTP_THREADS ("http-threads")
+#define KN_REQUEST_WORKERS ("request-workers")
+#define KN_CONNECTION_MEMORY_LIMIT ("connection-memory-limit")
+#define KN_CONNECTION_TIMEOUT ("connection-timeout")
+
+
+/**
+ * @def KN_DATA_WRITERS
+ * Defines the key name for the number of threads that store blocks.
+ */
+#define KN_DATA_WRITERS ("data-writers")
+
+
+/**
+ * @def KN_BACKEND
+ * Defines the key name for the backend that stores data ("file" or
+ * "pack").
+ */
+#define KN_BACKEND ("backend")
+
+
 /** Below you'll find some definitions for the server's backends */
 /**
  * @def KN_FILE_DIRECTORY
@@ -182,6 +341,23 @@
 #define KN_DIR_LEVEL ("dir-level")
 
 
+/**
+ * @def KN_PACK_DIRECTORY
+ * Defines where pack_backend might store its data
+ *
+ * @def KN_SEGMENT_SIZE
+ * Defines the size in bytes above which pack_backend starts a new
+ * segment file.
+ *
+ * @def KN_INDEX_SLOTS
+ * Defines the number of slots (a power of 2) that the index of
+ * pack_backend begins with when it is rebuilt.
+ */
+#define KN_PACK_DIRECTORY ("pack-directory")
+#define KN_SEGMENT_SIZE ("segment-size")
+#define KN_INDEX_SLOTS ("index-slots")
+
+
 /** Below you'll find some definitions for the version cache file */
 /**
  * @def KN_CLIENT_DATABASE
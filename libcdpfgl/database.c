@@ -42,13 +42,24 @@ static void check_and_create_object(db_t *database, gchar *name, gint type, gcha
 static void check_and_create_table(db_t *database, gchar *tablename, gchar *sql_creation_cmd, gchar *err_msg);
 static void check_and_create_index(db_t *database, gchar *indexname, gchar *sql_creation_cmd, gchar *err_msg);
 static void verify_if_tables_exists(db_t *database);
+static guint64 hash_file_name(const gchar *name);
+static void insert_file_state(file_cache_t *cache, file_state_t *state);
+static void update_file_cache(file_cache_t *cache, meta_data_t *meta);
+static meta_data_t *copy_meta_data_for_writer(meta_data_t *meta);
+static db_write_t *new_db_write_t(meta_data_t *meta, gboolean only_meta, guint64 cache_time);
+static void free_db_write_t(db_write_t *row);
+static gint insert_meta_data(db_t *database, meta_data_t *meta, gboolean only_meta, guint64 cache_time);
+static gpointer db_writer_thread(gpointer data);
+static gboolean is_file_in_file_cache(file_cache_t *cache, meta_data_t *meta);
 static file_row_t *get_file_id(db_t *database, meta_data_t *meta);
 static file_row_t *new_file_row_t(void);
 static void free_file_row_t(file_row_t *row);
+static void buffers_failed_post(gpointer user_data, gchar *url, gchar *body, gsize length);
 static int transmit_callback(void *userp, int nb_col, char **data, char **name_col);
 static transmited_t *new_transmited_t(db_t *database, comm_t *comm);
 static int delete_transmited_callback(void *userp, int nb_col, char **data, char **name_col);
 static int delete_transmited_buffers(db_t *database);
+static void delete_handed_buffers(db_t *database, transmited_t *trans);
 static void bind_guint64_value(sqlite3 *db, sqlite3_stmt *stmt, const gchar *name, guint64 value);
 static void bind_guint_value(sqlite3 *db, sqlite3_stmt *stmt, const gchar *name, guint value);
 static void bind_text_value(sqlite3 *db, sqlite3_stmt *stmt, const gchar *name, gchar *value);
@@ -448,7 +459,222 @@ static void verify_if_tables_exists(db_t *database)
 
 
 /**
- * Says whether a file is in already in the cache or not
+ * Hashes a file name with 64 bits FNV-1a. Collisions are harmless: a
+ * file is only considered as unchanged if its inode, times, size, mode
+ * and owners are also the same.
+ * @param name is the file's name.
+ * @returns a 64 bits hash of name.
+ */
+static guint64 hash_file_name(const gchar *name)
+{
+    guint64 hash = G_GUINT64_CONSTANT(14695981039346656037);
+    const guchar *p = (const guchar *) name;
+
+    while (p != NULL && *p != '\0')
+        {
+            hash = hash ^ *p;
+            hash = hash * G_GUINT64_CONSTANT(1099511628211);
+            p++;
+        }
+
+    return hash;
+}
+
+
+/**
+ * Inserts (or replaces) a state into the file cache.
+ * @param cache is the file cache.
+ * @param state is the state to be inserted. It is owned by the cache.
+ */
+static void insert_file_state(file_cache_t *cache, file_state_t *state)
+{
+    g_mutex_lock(&cache->mutex);
+    g_hash_table_replace(cache->table, &state->name_hash, state);
+    g_mutex_unlock(&cache->mutex);
+}
+
+
+/**
+ * Loads the last saved state of every file of the 'files' table into
+ * a new file cache.
+ * @param database is the structure that contains everything that is
+ *        related to the database (it's connexion for instance).
+ * @returns a newly allocated file_cache_t that has to be attached to
+ *          each database connexion with db_set_file_cache() and freed
+ *          with free_file_cache_t() when no longer needed.
+ */
+file_cache_t *new_file_cache_t(db_t *database)
+{
+    file_cache_t *cache = NULL;
+    file_state_t *state = NULL;
+    sqlite3_stmt *stmt = NULL;
+    gint result = 0;
+
+    cache = (file_cache_t *) g_malloc0(sizeof(file_cache_t));
+    g_assert_nonnull(cache);
+
+    g_mutex_init(&cache->mutex);
+    cache->table = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, free_variable);
+
+    if (database != NULL && database->db != NULL)
+        {
+            /* Ordered by file_id so that the last saved state of a file wins */
+            result = sqlite3_prepare_v2(database->db, "SELECT name, inode, type, uid, gid, ctime, mtime, mode, size FROM files ORDER BY file_id;", -1, &stmt, NULL);
+            print_on_db_error(database->db, result, "new_file_cache_t");
+
+            if (result == SQLITE_OK)
+                {
+                    result = sqlite3_step(stmt);
+
+                    while (result == SQLITE_ROW)
+                        {
+                            state = (file_state_t *) g_malloc(sizeof(file_state_t));
+                            g_assert_nonnull(state);
+
+                            state->name_hash = hash_file_name((const gchar *) sqlite3_column_text(stmt, 0));
+                            state->inode = sqlite3_column_int64(stmt, 1);
+                            state->file_type = sqlite3_column_int(stmt, 2);
+                            state->uid = sqlite3_column_int64(stmt, 3);
+                            state->gid = sqlite3_column_int64(stmt, 4);
+                            state->ctime = sqlite3_column_int64(stmt, 5);
+                            state->mtime = sqlite3_column_int64(stmt, 6);
+                            state->mode = sqlite3_column_int64(stmt, 7);
+                            state->size = sqlite3_column_int64(stmt, 8);
+
+                            insert_file_state(cache, state);
+
+                            result = sqlite3_step(stmt);
+                        }
+
+                    print_on_db_error(database->db, result, "new_file_cache_t");
+                }
+
+            sqlite3_finalize(stmt);
+        }
+
+    print_debug(_("File cache loaded with %u files\n"), g_hash_table_size(cache->table));
+
+    return cache;
+}
+
+
+/**
+ * Frees a file cache.
+ * @param cache is the file cache to be freed.
+ */
+void free_file_cache_t(file_cache_t *cache)
+{
+    if (cache != NULL)
+        {
+            g_hash_table_destroy(cache->table);
+            g_mutex_clear(&cache->mutex);
+            free_variable(cache);
+        }
+}
+
+
+/**
+ * Attaches a file cache to a database connexion: is_file_in_cache()
+ * will look into it first and db_save_meta_data() will update it.
+ * @param database is the database connexion.
+ * @param cache is the file cache (may be shared between connexions).
+ */
+void db_set_file_cache(db_t *database, file_cache_t *cache)
+{
+    if (database != NULL)
+        {
+            database->cache = cache;
+        }
+}
+
+
+/**
+ * Attaches a spool to a database connexion: buffers saved with
+ * db_save_buffer() are appended to it instead of the 'buffers' table.
+ * @param database is the database connexion.
+ * @param spool is the spool (may be shared between connexions).
+ */
+void db_set_spool(db_t *database, spool_t *spool)
+{
+    if (database != NULL)
+        {
+            database->spool = spool;
+        }
+}
+
+
+/**
+ * Stores the state of a file that has just been saved into the file
+ * cache (write through).
+ * @param cache is the file cache (may be NULL).
+ * @param meta is the file's metadata that has been saved.
+ */
+static void update_file_cache(file_cache_t *cache, meta_data_t *meta)
+{
+    file_state_t *state = NULL;
+
+    if (cache != NULL && meta != NULL)
+        {
+            state = (file_state_t *) g_malloc(sizeof(file_state_t));
+            g_assert_nonnull(state);
+
+            state->name_hash = hash_file_name(meta->name);
+            state->inode = meta->inode;
+            state->file_type = meta->file_type;
+            state->uid = meta->uid;
+            state->gid = meta->gid;
+            state->ctime = meta->ctime;
+            state->mtime = meta->mtime;
+            state->mode = meta->mode;
+            state->size = meta->size;
+
+            insert_file_state(cache, state);
+        }
+}
+
+
+/**
+ * Says whether the last saved state of a file is the one described by
+ * meta.
+ * @param cache is the file cache (may be NULL).
+ * @param meta is the file's metadata.
+ * @returns TRUE if the file is known with exactly the same state and
+ *          FALSE otherwise (the file may still have been saved in an
+ *          older state: only the database knows).
+ */
+static gboolean is_file_in_file_cache(file_cache_t *cache, meta_data_t *meta)
+{
+    file_state_t *state = NULL;
+    guint64 name_hash = 0;
+    gboolean found = FALSE;
+
+    if (cache != NULL && meta != NULL)
+        {
+            name_hash = hash_file_name(meta->name);
+
+            g_mutex_lock(&cache->mutex);
+
+            state = (file_state_t *) g_hash_table_lookup(cache->table, &name_hash);
+
+            if (state != NULL)
+                {
+                    found = (state->inode == meta->inode && state->file_type == meta->file_type &&
+                             state->uid == meta->uid && state->gid == meta->gid &&
+                             state->ctime == meta->ctime && state->mtime == meta->mtime &&
+                             state->mode == meta->mode && state->size == meta->size);
+                }
+
+            g_mutex_unlock(&cache->mutex);
+        }
+
+    return found;
+}
+
+
+/**
+ * Says whether a file is in already in the cache or not. The file cache
+ * (if any) is looked up first and the database is only queried when the
+ * file is not found in it with the same state.
  * @param database is the structure that contains everything that is
  *        related to the database (it's connexion for instance).
  * @param meta is the file's metadata that we want to know if it's already
@@ -462,6 +688,10 @@ gboolean is_file_in_cache(db_t *database, meta_data_t *meta)
 
     if (meta != NULL && database != NULL)
         {
+            if (is_file_in_file_cache(database->cache, meta) == TRUE)
+                {
+                    return TRUE;
+                }
 
             row = get_file_id(database, meta);
 
@@ -570,14 +800,23 @@ static void free_file_row_t(file_row_t *row)
  * @param only_meta : a gboolean that when set to TRUE only meta_data will
  *        be saved and hashs data will not ! FALSE means that something
  *        went wrong with server and that all data will be cached localy.
+ * @note When a background writer is attached to the connexion the file
+ *       is only given to it: it is committed within
+ *       DATABASE_WRITER_INTERVAL milliseconds.
  */
 void db_save_meta_data(db_t *database, meta_data_t *meta, gboolean only_meta)
 {
     guint64 cache_time = 0;
     gint result = 0;
-    sqlite3_stmt *stmt = NULL;
 
-    if (meta != NULL && database != NULL && database->stmts != NULL)
+    if (meta != NULL && database != NULL && database->writes != NULL)
+        {
+            /* The file cache answers for this file until the writer commits it */
+            cache_time = g_get_real_time();
+            update_file_cache(database->cache, meta);
+            g_async_queue_push(database->writes, new_db_write_t(copy_meta_data_for_writer(meta), only_meta, cache_time));
+        }
+    else if (meta != NULL && database != NULL && database->stmts != NULL)
         {
             cache_time = g_get_real_time();
 
@@ -585,35 +824,294 @@ void db_save_meta_data(db_t *database, meta_data_t *meta, gboolean only_meta)
             sql_begin(database);
 
             /* Inserting the file into the files table */
-            stmt = database->stmts->save_meta_stmt;
-            if (stmt != NULL)
+            result = insert_meta_data(database, meta, only_meta, cache_time);
+
+            if (result == SQLITE_DONE)
                 {
-                    bind_values_to_save_meta_data(database->db, stmt, meta, only_meta, cache_time);
-                    result = sqlite3_step(stmt);
-                    print_on_db_error(database->db, result, "sqlite3_step");
+                    update_file_cache(database->cache, meta);
                 }
 
             /* ending the transaction here */
             sql_commit(database);
+        }
+}
+
+
+/**
+ * Inserts a file into the 'files' table (within the current
+ * transaction if any).
+ * @param database is the structure that contains everything that is
+ *        related to the database (it's connexion for instance).
+ * @param meta is the file's metadata to be inserted.
+ * @param only_meta is the value of the 'transmitted' column.
+ * @param cache_time is the time at which the file has been saved.
+ * @returns the result of sqlite3_step() (SQLITE_DONE upon success).
+ */
+static gint insert_meta_data(db_t *database, meta_data_t *meta, gboolean only_meta, guint64 cache_time)
+{
+    sqlite3_stmt *stmt = NULL;
+    gint result = SQLITE_ERROR;
+
+    stmt = database->stmts->save_meta_stmt;
+    if (stmt != NULL)
+        {
+            bind_values_to_save_meta_data(database->db, stmt, meta, only_meta, cache_time);
+            result = sqlite3_step(stmt);
+            print_on_db_error(database->db, result, "sqlite3_step");
             sqlite3_reset(stmt);
         }
+
+    return result;
+}
+
+
+/**
+ * Copies what the 'files' table needs from a file's meta data.
+ * @param meta is the file's metadata.
+ * @returns a newly allocated meta_data_t without any block that may be
+ *          freed with free_meta_data_t(meta, TRUE).
+ */
+static meta_data_t *copy_meta_data_for_writer(meta_data_t *meta)
+{
+    meta_data_t *copy = NULL;
+
+    copy = new_meta_data_t();
+
+    copy->file_type = meta->file_type;
+    copy->inode = meta->inode;
+    copy->mode = meta->mode;
+    copy->atime = meta->atime;
+    copy->ctime = meta->ctime;
+    copy->mtime = meta->mtime;
+    copy->size = meta->size;
+    copy->owner = g_strdup(meta->owner);
+    copy->group = g_strdup(meta->group);
+    copy->uid = meta->uid;
+    copy->gid = meta->gid;
+    copy->name = g_strdup(meta->name);
+    copy->link = g_strdup(meta->link);
+
+    return copy;
+}
+
+
+/**
+ * @param meta is the copy of the file's meta data (taken by the
+ *        returned structure) or NULL to end the writer.
+ * @param only_meta is the value of the 'transmitted' column.
+ * @param cache_time is the time at which the file has been saved.
+ * @returns a newly allocated db_write_t to be given to a background
+ *          writer.
+ */
+static db_write_t *new_db_write_t(meta_data_t *meta, gboolean only_meta, guint64 cache_time)
+{
+    db_write_t *row = NULL;
+
+    row = (db_write_t *) g_malloc0(sizeof(db_write_t));
+    g_assert_nonnull(row);
+
+    row->meta = meta;
+    row->only_meta = only_meta;
+    row->cache_time = cache_time;
+
+    return row;
+}
+
+
+/**
+ * Frees a db_write_t structure and its copy of meta data.
+ * @param row is the structure to be freed.
+ */
+static void free_db_write_t(db_write_t *row)
+{
+    if (row != NULL)
+        {
+            free_meta_data_t(row->meta, TRUE);
+            free_variable(row);
+        }
+}
+
+
+/**
+ * Background writer's thread: each transaction begins with the first
+ * file waiting in the queue and is committed after DATABASE_WRITER_BATCH
+ * files or DATABASE_WRITER_INTERVAL milliseconds.
+ * @param data MUST be a db_writer_t * pointer.
+ * @returns NULL.
+ */
+static gpointer db_writer_thread(gpointer data)
+{
+    db_writer_t *writer = (db_writer_t *) data;
+    db_write_t *row = NULL;
+    gint64 end_time = 0;
+    gint64 remaining = 0;
+    guint count = 0;
+    gboolean running = TRUE;
+
+    while (running == TRUE)
+        {
+            row = g_async_queue_pop(writer->queue);
+            end_time = g_get_monotonic_time() + DATABASE_WRITER_INTERVAL * G_TIME_SPAN_MILLISECOND;
+            count = 0;
+
+            sql_begin(writer->database);
+
+            while (row != NULL)
+                {
+                    if (row->meta != NULL)
+                        {
+                            insert_meta_data(writer->database, row->meta, row->only_meta, row->cache_time);
+                            free_db_write_t(row);
+                            count = count + 1;
+
+                            remaining = MAX(end_time - g_get_monotonic_time(), 0);
+                            if (count < DATABASE_WRITER_BATCH)
+                                {
+                                    row = g_async_queue_timeout_pop(writer->queue, remaining);
+                                }
+                            else
+                                {
+                                    row = NULL;
+                                }
+                        }
+                    else
+                        {
+                            /* Every file given before the end has been inserted */
+                            free_db_write_t(row);
+                            row = NULL;
+                            running = FALSE;
+                        }
+                }
+
+            sql_commit(writer->database);
+            g_atomic_int_inc(&writer->commits);
+            print_debug(_("Background writer committed %u files\n"), count);
+        }
+
+    return NULL;
+}
+
+
+/**
+ * Starts a background writer with its own connexion to the database.
+ * @param dirname is the name of the directory where the database is
+ *        located.
+ * @param filename is the filename of the file that contains the
+ *        database.
+ * @param durability is the durability of the writer's commits
+ *        (DATABASE_DURABILITY_FAST or DATABASE_DURABILITY_NORMAL).
+ * @returns a newly allocated db_writer_t that has to be attached to each
+ *          database connexion with db_set_writer() and freed with
+ *          free_db_writer_t() or NULL if the database can not be opened.
+ */
+db_writer_t *new_db_writer_t(gchar *dirname, gchar *filename, gint durability)
+{
+    db_writer_t *writer = NULL;
+    db_t *database = NULL;
+
+    database = open_database(dirname, filename);
+
+    if (database != NULL)
+        {
+            db_set_durability(database, durability);
+
+            writer = (db_writer_t *) g_malloc0(sizeof(db_writer_t));
+            g_assert_nonnull(writer);
+
+            writer->database = database;
+            writer->queue = g_async_queue_new();
+            writer->thread = g_thread_new("db-writer", db_writer_thread, writer);
+        }
+
+    return writer;
+}
+
+
+/**
+ * Commits every file given to the background writer, stops it and
+ * frees it.
+ * @param writer is the background writer to be freed.
+ */
+void free_db_writer_t(db_writer_t *writer)
+{
+    if (writer != NULL)
+        {
+            g_async_queue_push(writer->queue, new_db_write_t(NULL, FALSE, 0));
+            g_thread_join(writer->thread);
+
+            g_async_queue_unref(writer->queue);
+            close_database(writer->database);
+            free_variable(writer);
+        }
 }
 
 
 /**
- * Saves buffers that could not be sent to server
+ * Attaches a background writer to a database connexion:
+ * db_save_meta_data() will give it the files to be inserted instead of
+ * inserting them itself.
+ * @param database is the database connexion.
+ * @param writer is the background writer (may be shared between
+ *        connexions).
+ */
+void db_set_writer(db_t *database, db_writer_t *writer)
+{
+    if (database != NULL && writer != NULL)
+        {
+            database->writes = writer->queue;
+        }
+    else if (database != NULL)
+        {
+            database->writes = NULL;
+        }
+}
+
+
+/**
+ * Sets how much the commits of a database connexion are synced to disk.
+ * @param database is the database connexion.
+ * @param durability is one of DATABASE_DURABILITY_FAST,
+ *        DATABASE_DURABILITY_NORMAL or DATABASE_DURABILITY_FULL.
+ */
+void db_set_durability(db_t *database, gint durability)
+{
+    if (durability == DATABASE_DURABILITY_FAST)
+        {
+            exec_sql_cmd(database, "PRAGMA synchronous=OFF;", _("(%d - %d) Error while setting synchronous mode: %s\n"));
+        }
+    else if (durability == DATABASE_DURABILITY_NORMAL)
+        {
+            exec_sql_cmd(database, "PRAGMA synchronous=NORMAL;", _("(%d - %d) Error while setting synchronous mode: %s\n"));
+        }
+    else
+        {
+            exec_sql_cmd(database, "PRAGMA synchronous=FULL;", _("(%d - %d) Error while setting synchronous mode: %s\n"));
+        }
+}
+
+
+/**
+ * Saves buffers that could not be sent to server into the spool when
+ * one is attached to the connexion and into table 'buffers' otherwise.
  * @param database is the structure that contains everything that is
  *        related to the database (it's connexion for instance).
  * @param url is the url where buffer should have been POSTed
  * @param buffer is the buffer containing data that should have been
- *        POSTed to server but couldn't.
+ *        POSTed to server but couldn't. It may contain binary data when
+ *        the connexion has a spool (the 'buffers' table only keeps \0
+ *        terminated text).
+ * @param length is the number of bytes of buffer.
  */
-void db_save_buffer(db_t *database, gchar *url, gchar *buffer)
+void db_save_buffer(db_t *database, gchar *url, gchar *buffer, gsize length)
 {
     sqlite3_stmt *stmt = NULL;
     gint result = 0;
 
-    if (database != NULL && url != NULL && buffer != NULL && database->stmts != NULL)
+    if (database != NULL && url != NULL && buffer != NULL && database->spool != NULL)
+        {
+            append_to_spool(database->spool, url, buffer, length);
+        }
+    else if (database != NULL && url != NULL && buffer != NULL && database->stmts != NULL)
         {
             sql_begin(database);
 
@@ -631,11 +1129,12 @@ void db_save_buffer(db_t *database, gchar *url, gchar *buffer)
 
 
 /**
- * This function says if the table 'buffers' is empty or not, that is
- * to say whether we have to transmit unsaved data or not.
+ * This function says if the spool or the table 'buffers' is empty or
+ * not, that is to say whether we have to transmit unsaved data or not.
  * @param database is the structure that contains everything that is
  *        related to the database (it's connexion for instance).
- * @returns TRUE if table 'buffers' is not empty and FALSE otherwise
+ * @returns TRUE if the spool or table 'buffers' is not empty and FALSE
+ *          otherwise
  */
 gboolean db_is_there_buffers_to_transmit(db_t *database)
 {
@@ -643,7 +1142,11 @@ gboolean db_is_there_buffers_to_transmit(db_t *database)
     int result = 0;
     int *i = NULL;               /** int *i is used to count the number of row */
 
-    if (database != NULL && database->db != NULL)
+    if (database != NULL && is_there_requests_in_spool(database->spool))
+        {
+            return TRUE;
+        }
+    else if (database != NULL && database->db != NULL)
         {
             i = (int *) g_malloc0(sizeof(int));
             *i = 0;
@@ -672,37 +1175,83 @@ gboolean db_is_there_buffers_to_transmit(db_t *database)
 
 
 /**
- * Transmits each row found in the database
+ * Called with the rows of the 'buffers' table that the server did not
+ * acknowledge: the transmission stops and the request is appended to
+ * the spool when the connexion has one. Without spool the rows of the
+ * batch are kept in the table to be transmited again.
+ * @param user_data is the transmited_t * structure of the transmission.
+ * @param url is the url of the failed request.
+ * @param body is the body of the failed request.
+ * @param length is the length of body.
+ */
+static void buffers_failed_post(gpointer user_data, gchar *url, gchar *body, gsize length)
+{
+    transmited_t *trans = (transmited_t *) user_data;
+
+    if (trans != NULL)
+        {
+            trans->failed = TRUE;
+
+            if (trans->database->spool != NULL)
+                {
+                    append_to_spool(trans->database->spool, url, body, length);
+                }
+        }
+}
+
+
+/**
+ * Hands each row found in the database to the server without waiting
+ * for its answer. Handed rows are only remembered here: they are
+ * deleted by delete_handed_buffers() once the answers of the batch have
+ * been received.
  * @param userp is a pointer to a transmited_t * structure that must contain
  *        a comm_t * pointer and a db_t * pointer.
  * @param nb_col gives the number of columns in this row.
  * @param data contains the data of each column.
  * @param name_col contains the name of each column.
- * @returns always 0.
+ * @returns 0 to go on and 1 to stop sqlite3_exec() once a row has not
+ *          been transmited.
  */
 static int transmit_callback(void *userp, int nb_col, char **data, char **name_col)
 {
     transmited_t *trans = (transmited_t *) userp;
-    gchar *sql_command = NULL;
     gint success = 0;
 
-    if (trans != NULL && data != NULL && trans->comm != NULL && trans->database != NULL)
+    if (trans != NULL && data != NULL && trans->comm != NULL && trans->database != NULL && trans->failed == FALSE)
         {
-            trans->comm->readbuffer = data[2];         /** data[2] is the data column in buffers table of the database */
-            success = post_url(trans->comm, data[1]);  /** data[1] is the url column in buffers table of the database  */
+            trans->last_id = g_ascii_strtoll(data[0], NULL, 10);
+            trans->rows = trans->rows + 1;
 
-            if (success == CURLE_OK)
+            /* data[2] is the data column and data[1] the url column of the buffers table */
+            trans->comm->readbuffer = g_strdup(data[2]);
+            success = post_url_async(trans->comm, data[1]);
+
+            if (trans->comm->readbuffer == NULL)
                 {
-                    sql_begin(trans->database);
-                    sql_command = g_strdup_printf("INSERT INTO transmited (buffer_id) VALUES ('%s');", data[0]);
-                    exec_sql_cmd(trans->database, sql_command,  _("(%d - %d) Error while inserting into the table 'transmited': %s\n"));
-                    sql_commit(trans->database);
-                    free_variable(sql_command);
+                    /* The request has been handed to the server (or to buffers_failed_post()) */
+                    g_array_append_val(trans->handed, trans->last_id);
+                }
+            else
+                {
+                    free_variable(trans->comm->readbuffer);
+                    trans->comm->readbuffer = NULL;
+                }
+
+            if (success != CURLE_OK)
+                {
+                    trans->failed = TRUE;
                 }
-            /** @todo use the result of post to be able to manage errors */
         }
 
-    return 0;
+    if (trans == NULL || trans->failed == TRUE)
+        {
+            return 1;
+        }
+    else
+        {
+            return 0;
+        }
 }
 
 
@@ -712,7 +1261,7 @@ static int transmit_callback(void *userp, int nb_col, char **data, char **name_c
  * @param database is the pointer to the db_t * structure.
  * @param comm_t is the pointer to the comm_t * structure.
  * @returns a newly allocated transmited_t * structure that may be freed
- *          when no longer needed.
+ *          when no longer needed (with its handed array).
  */
 static transmited_t *new_transmited_t(db_t *database, comm_t *comm)
 {
@@ -723,6 +1272,7 @@ static transmited_t *new_transmited_t(db_t *database, comm_t *comm)
 
     trans->database = database;
     trans->comm = comm;
+    trans->handed = g_array_sized_new(FALSE, FALSE, sizeof(gint64), DATABASE_TRANSMIT_BATCH);
 
     return trans;
 }
@@ -744,10 +1294,8 @@ static int delete_transmited_callback(void *userp, int nb_col, char **data, char
 
     if (database != NULL && data != NULL)
         {
-            sql_begin(database);
             sql_command = g_strdup_printf("DELETE FROM buffers WHERE buffer_id='%s';", data[0]);
             exec_sql_cmd(database, sql_command,  _("(%d - %d) Error while deleting from table 'buffers': %s\n"));
-            sql_commit(database);
             free_variable(sql_command);
         }
 
@@ -768,49 +1316,145 @@ static int delete_transmited_buffers(db_t *database)
     if (database != NULL && database->db != NULL)
         {
             /* This should select every buffer_id that where transmited and not deleted (that are still present in buffers table) */
+            sql_begin(database);
             result = sqlite3_exec(database->db, "SELECT transmited.buffer_id FROM transmited INNER JOIN buffers ON transmited.buffer_id = buffers.buffer_id;", delete_transmited_callback, database, &error_message);
+            sql_commit(database);
+
+            if (error_message != NULL)
+                {
+                    print_error(__FILE__, __LINE__, _("Error while deleting transmited buffers: %s\n"), error_message);
+                    sqlite3_free(error_message);
+                }
         }
 
     return result;
 }
 
 
+/**
+ * Deletes the rows of a batch that have been handed to the server from
+ * the 'buffers' table in one short transaction. The answers of the
+ * batch must have been received: rows are kept when one of them failed
+ * and the connexion has no spool to keep the failed requests.
+ * @param database is the pointer to the db_t * structure.
+ * @param trans is the transmited_t * structure of the batch. Its array of
+ *        handed rows is emptied here.
+ */
+static void delete_handed_buffers(db_t *database, transmited_t *trans)
+{
+    sqlite3_stmt *stmt = NULL;
+    int result = 0;
+    guint i = 0;
+
+    if (trans->handed->len > 0 && (trans->failed == FALSE || database->spool != NULL))
+        {
+            result = sqlite3_prepare_v2(database->db, "DELETE FROM buffers WHERE buffer_id=:buffer_id;", -1, &stmt, NULL);
+            print_on_db_error(database->db, result, "delete_handed_buffers");
+
+            if (result == SQLITE_OK)
+                {
+                    sql_begin(database);
+
+                    for (i = 0; i < trans->handed->len; i++)
+                        {
+                            bind_guint64_value(database->db, stmt, ":buffer_id", g_array_index(trans->handed, gint64, i));
+                            result = sqlite3_step(stmt);
+                            print_on_db_error(database->db, result, "delete_handed_buffers");
+                            sqlite3_reset(stmt);
+                        }
+
+                    sql_commit(database);
+                }
+
+            sqlite3_finalize(stmt);
+        }
+
+    g_array_set_size(trans->handed, 0);
+}
+
+
 /**
  * This function transferts the 'buffers' that are stored in the database
+ * (left there by older versions) and then the requests of the spool.
+ * Rows are handed to the server without waiting for each answer as the
+ * requests of the spool are.
  * @param database is the structure that contains everything that is
  *        related to the database (it's connexion for instance).
  * @param comm a comm_t * structure that must contain an initialized
- *        curl_handle (must not be NULL).
- * @returns TRUE if table 'buffers' is not empty and FALSE otherwise
+ *        curl_handle (must not be NULL). Its failure handler is
+ *        replaced while the rows are transmited.
+ * @returns TRUE if everything has been transmited and FALSE otherwise
  */
 gboolean db_transmit_buffers(db_t *database, comm_t *comm)
 {
     char *error_message = NULL;
-    int result = 0;
+    gchar *sql_command = NULL;
+    int result = SQLITE_OK;
+    int deleted = SQLITE_OK;
     transmited_t *trans = NULL;
+    gboolean failed = FALSE;
+    gboolean spooled = TRUE;
+    void (*save_failed)(gpointer, gchar *, gchar *, gsize) = NULL;
+    gpointer failed_data = NULL;
 
     if (database != NULL && comm != NULL)
         {
+            /* Rows acknowledged by an older version are deleted first */
+            deleted = delete_transmited_buffers(database);
+
             trans = new_transmited_t(database, comm);
 
-            /* This should select only the rows in buffers that are not in transmited based on the primary key buffer_id */
-            result = sqlite3_exec(database->db, "SELECT * FROM buffers WHERE buffers.buffer_id NOT IN (SELECT transmited.buffer_id FROM transmited INNER JOIN buffers ON transmited.buffer_id = buffers.buffer_id);", transmit_callback, trans, &error_message);
+            wait_for_async_posts(comm);
+            save_failed = comm->save_failed;
+            failed_data = comm->failed_data;
+            set_comm_failure_handler(comm, buffers_failed_post, trans);
+
+            /* Rows are sent by batches of DATABASE_TRANSMIT_BATCH rows in buffer_id
+             * order without any transaction. The answers of a batch are waited
+             * for before its rows are deleted and the next batch begins.
+             */
+            do
+                {
+                    trans->rows = 0;
+                    sql_command = g_strdup_printf("SELECT * FROM buffers WHERE buffer_id > %" G_GINT64_FORMAT " ORDER BY buffer_id LIMIT %d;", trans->last_id, DATABASE_TRANSMIT_BATCH);
+                    result = sqlite3_exec(database->db, sql_command, transmit_callback, trans, &error_message);
+                    free_variable(sql_command);
+
+                    wait_for_async_posts(comm);
+                    delete_handed_buffers(database, trans);
+                }
+            while (result == SQLITE_OK && trans->failed == FALSE && trans->rows == DATABASE_TRANSMIT_BATCH);
 
-            g_free(trans);
+            set_comm_failure_handler(comm, save_failed, failed_data);
 
-            delete_transmited_buffers(database);
-            /** @todo Catch the return value of this function and do something with it */
+            if (error_message != NULL)
+                {
+                    /* Stopping on a failed row is not an sqlite error */
+                    if (trans->failed == FALSE)
+                        {
+                            print_error(__FILE__, __LINE__, _("Error while transmiting buffers: %s\n"), error_message);
+                        }
+                    sqlite3_free(error_message);
+                }
 
+            failed = trans->failed;
+            g_array_free(trans->handed, TRUE);
+            free_variable(trans);
+
+            if (database->spool != NULL && result == SQLITE_OK && failed == FALSE)
+                {
+                    spooled = transmit_spool(database->spool, comm);
+                }
         }
 
-    if (result == SQLITE_OK)
+    if (deleted == SQLITE_OK && result == SQLITE_OK && failed == FALSE && spooled == TRUE)
         {
-            /* Table exists and buffers has been transmited to the server */
+            /* Buffers and requests of the spool have been transmited to the server */
             return TRUE;
         }
     else
         {
-            /* result is not SQLITE_OK : something went wrong but buffers may have been transmited to the server */
+            /* something went wrong but some buffers may have been transmited to the server */
             return FALSE;
         }
 }
@@ -1186,6 +1830,10 @@ db_t *open_database(gchar *dirname, gchar *filename)
                     database->version_filename = g_strdup_printf("%s.version", database_name);
                     database->db = db;
                     sqlite3_extended_result_codes(db, 1);
+                    sqlite3_busy_timeout(db, DATABASE_BUSY_TIMEOUT);
+
+                    /* Readers do not block the writer and commits append to the log */
+                    exec_sql_cmd(database, "PRAGMA journal_mode=WAL;", _("(%d - %d) Error while setting WAL journal mode: %s\n"));
 
                     verify_if_tables_exists(database);
                     database->stmts = new_stmts(db);
@@ -58,6 +58,56 @@
 #define DATABASE_SCHEMA_VERSION (1)
 
 
+/**
+ * @def DATABASE_BUSY_TIMEOUT
+ * Defines the time (in milliseconds) a connexion waits for a lock held
+ * by another connexion to the same database (many threads may have
+ * their own connexion).
+ */
+#define DATABASE_BUSY_TIMEOUT (30000)
+
+
+/**
+ * @def DATABASE_TRANSMIT_BATCH
+ * Number of rows of the 'buffers' table handed to the server before the
+ * answers are waited for and the transmited rows are deleted. No
+ * transaction is held while rows are sent to the server.
+ */
+#define DATABASE_TRANSMIT_BATCH (64)
+
+
+/**
+ * @def DATABASE_DURABILITY_FAST
+ * Commits are never synced to disk (synchronous=OFF): the last saves
+ * may be lost and the cache may be damaged if the machine crashes.
+ *
+ * @def DATABASE_DURABILITY_NORMAL
+ * Commits are only synced at WAL checkpoints (synchronous=NORMAL): the
+ * last saves may be lost if the machine crashes but the cache stays
+ * consistent. This is the default.
+ *
+ * @def DATABASE_DURABILITY_FULL
+ * Each save is committed and synced before it ends (synchronous=FULL)
+ * and no background writer is used.
+ */
+#define DATABASE_DURABILITY_FAST (0)
+#define DATABASE_DURABILITY_NORMAL (1)
+#define DATABASE_DURABILITY_FULL (2)
+
+
+/**
+ * @def DATABASE_WRITER_BATCH
+ * Maximum number of files inserted by the background writer in one
+ * transaction.
+ *
+ * @def DATABASE_WRITER_INTERVAL
+ * Maximum time (in milliseconds) a file waits in the background writer
+ * before its transaction is committed.
+ */
+#define DATABASE_WRITER_BATCH (1024)
+#define DATABASE_WRITER_INTERVAL (1000)
+
+
 /**
  * @struct stmt_t
  * @brief structure to hold all statements needed for the programs.
@@ -70,6 +120,39 @@
  } stmt_t;
 
 
+/**
+ * @struct file_state_t
+ * @brief Compact state of a file as saved in the 'files' table. The name
+ *        is only kept as a 64 bits hash.
+ */
+typedef struct
+{
+    guint64 name_hash;   /**< hash of the file's name (key of the file cache)   */
+    guint64 inode;       /**< file's inode                                      */
+    guint64 ctime;       /**< changed time                                      */
+    guint64 mtime;       /**< modified time                                     */
+    guint64 size;        /**< size of the file                                  */
+    guint32 mode;        /**< UNIX mode of the file                             */
+    guint32 uid;         /**< uid (owner)                                       */
+    guint32 gid;         /**< gid (group owner)                                 */
+    guint8 file_type;    /**< type of the file : FILE, DIR, SYMLINK...          */
+} file_state_t;
+
+
+/**
+ * @struct file_cache_t
+ * @brief In memory copy of the last saved state of each file of the
+ *        'files' table. It is shared by all database connexions of a
+ *        program and answers is_file_in_cache() without any query for
+ *        files that did not change.
+ */
+typedef struct
+{
+    GMutex mutex;        /**< protects table                                              */
+    GHashTable *table;   /**< name_hash (guint64 *) -> file_state_t * (owned by the table) */
+} file_cache_t;
+
+
 /**
  * @struct db_t
  * @brief Structure to store everything that is needed for the database.
@@ -80,9 +163,40 @@ typedef struct
     stmt_t *stmts;
     gint64 version;
     gchar *version_filename;
+    file_cache_t *cache;  /**< file cache shared with other connexions (not owned) or NULL */
+    spool_t *spool;       /**< spool shared with other connexions (not owned) or NULL      */
+    GAsyncQueue *writes;  /**< queue of a background writer (not owned) or NULL            */
 } db_t;
 
 
+/**
+ * @struct db_write_t
+ * @brief A file to be inserted into the 'files' table by the background
+ *        writer.
+ */
+typedef struct
+{
+    meta_data_t *meta;    /**< copy of the file's meta data without its blocks (NULL ends the writer) */
+    gboolean only_meta;   /**< value of the 'transmitted' column                                       */
+    guint64 cache_time;   /**< time at which the file has been saved                                   */
+} db_write_t;
+
+
+/**
+ * @struct db_writer_t
+ * @brief Background writer that inserts the files saved by every
+ *        database connexion of a program with its own connexion and
+ *        groups them into periodic transactions.
+ */
+typedef struct
+{
+    db_t *database;       /**< connexion used by the writer (owned)    */
+    GAsyncQueue *queue;   /**< db_write_t * files to be inserted        */
+    GThread *thread;      /**< thread that inserts the files            */
+    gint commits;         /**< number of transactions committed (atomic) */
+} db_writer_t;
+
+
 /**
  * Function template definition to be used when upgrading the local database.
  */
@@ -108,6 +222,10 @@ typedef struct
 {
     db_t *database;
     comm_t *comm;
+    gint64 last_id;      /**< buffer_id of the last row of the batch                     */
+    guint rows;          /**< number of rows of the batch                                */
+    GArray *handed;      /**< buffer_id (gint64) of the rows handed to the server        */
+    gboolean failed;     /**< TRUE when a row could not be transmited                    */
 } transmited_t;
 
 
@@ -140,6 +258,86 @@ extern gchar *db_version(void);
 extern db_t *open_database(gchar *dirname, gchar *filename);
 
 
+/**
+ * Loads the last saved state of every file of the 'files' table into
+ * a new file cache.
+ * @param database is the structure that contains everything that is
+ *        related to the database (it's connexion for instance).
+ * @returns a newly allocated file_cache_t that has to be attached to
+ *          each database connexion with db_set_file_cache() and freed
+ *          with free_file_cache_t() when no longer needed.
+ */
+extern file_cache_t *new_file_cache_t(db_t *database);
+
+
+/**
+ * Frees a file cache.
+ * @param cache is the file cache to be freed.
+ */
+extern void free_file_cache_t(file_cache_t *cache);
+
+
+/**
+ * Attaches a file cache to a database connexion: is_file_in_cache()
+ * will look into it first and db_save_meta_data() will update it.
+ * @param database is the database connexion.
+ * @param cache is the file cache (may be shared between connexions).
+ */
+extern void db_set_file_cache(db_t *database, file_cache_t *cache);
+
+
+/**
+ * Attaches a spool to a database connexion: buffers saved with
+ * db_save_buffer() are appended to it instead of the 'buffers' table.
+ * @param database is the database connexion.
+ * @param spool is the spool (may be shared between connexions).
+ */
+extern void db_set_spool(db_t *database, spool_t *spool);
+
+
+/**
+ * Sets how much the commits of a database connexion are synced to disk.
+ * @param database is the database connexion.
+ * @param durability is one of DATABASE_DURABILITY_FAST,
+ *        DATABASE_DURABILITY_NORMAL or DATABASE_DURABILITY_FULL.
+ */
+extern void db_set_durability(db_t *database, gint durability);
+
+
+/**
+ * Starts a background writer with its own connexion to the database.
+ * @param dirname is the name of the directory where the database is
+ *        located.
+ * @param filename is the filename of the file that contains the
+ *        database.
+ * @param durability is the durability of the writer's commits
+ *        (DATABASE_DURABILITY_FAST or DATABASE_DURABILITY_NORMAL).
+ * @returns a newly allocated db_writer_t that has to be attached to each
+ *          database connexion with db_set_writer() and freed with
+ *          free_db_writer_t() or NULL if the database can not be opened.
+ */
+extern db_writer_t *new_db_writer_t(gchar *dirname, gchar *filename, gint durability);
+
+
+/**
+ * Commits every file given to the background writer, stops it and
+ * frees it.
+ * @param writer is the background writer to be freed.
+ */
+extern void free_db_writer_t(db_writer_t *writer);
+
+
+/**
+ * Attaches a background writer to a database connexion:
+ * db_save_meta_data() will give it the files to be inserted instead of
+ * inserting them itself.
+ * @param database is the database connexion.
+ * @param writer is the background writer (may be shared between
+ *        connexions).
+ */
+extern void db_set_writer(db_t *database, db_writer_t *writer);
+
+
 /**
  * Says whether a file is in already in the cache or not
  * @param database is the structure that contains everything that is
@@ -161,38 +359,47 @@ extern gboolean is_file_in_cache(db_t *database, meta_data_t *meta);
  *        cache.
  * @param only_meta : a gboolean that when set to TRUE only meta_data will
  *        be saved and hashs data will not !
+ * @note When a background writer is attached to the connexion the file
+ *       is only given to it: it is committed within
+ *       DATABASE_WRITER_INTERVAL milliseconds.
  */
 extern void db_save_meta_data(db_t *database, meta_data_t *meta, gboolean only_meta);
 
 
 /**
- * This function says if the table 'buffers' is empty or not, that is
- * to say whether we have to transmit unsaved data or not.
+ * This function says if the spool or the table 'buffers' is empty or
+ * not, that is to say whether we have to transmit unsaved data or not.
  * @param database is the structure that contains everything that is
  *        related to the database (it's connexion for instance).
- * @returns TRUE if table 'buffers' is not empty and FALSE otherwise
+ * @returns TRUE if the spool or table 'buffers' is not empty and FALSE
+ *          otherwise
  */
 extern gboolean db_is_there_buffers_to_transmit(db_t *database);
 
 
 /**
- * Saves buffers that could not be sent to server
+ * Saves buffers that could not be sent to server into the spool when
+ * one is attached to the connexion and into table 'buffers' otherwise.
  * @param database is the structure that contains everything that is
  *        related to the database (it's connexion for instance).
  * @param url is the url where buffer should have been POSTed
  * @param buffer is the buffer containing data that should have been
- *        POSTed to server but couldn't.
+ *        POSTed to server but couldn't. It may contain binary data when
+ *        the connexion has a spool (the 'buffers' table only keeps \0
+ *        terminated text).
+ * @param length is the number of bytes of buffer.
  */
-extern void db_save_buffer(db_t *database, gchar *url, gchar *buffer);
+extern void db_save_buffer(db_t *database, gchar *url, gchar *buffer, gsize length);
 
 
 /**
  * This function transferts the 'buffers' that are stored in the database
+ * (left there by older versions) and then the requests of the spool.
  * @param database is the structure that contains everything that is
  *        related to the database (it's connexion for instance).
  * @param comm a comm_t * structure that must contain an initialized
  *        curl_handle (must not be NULL).
- * @returns TRUE if table 'buffers' is not empty and FALSE otherwise
+ * @returns TRUE if everything has been transmited and FALSE otherwise
  */
 extern gboolean db_transmit_buffers(db_t *database, comm_t *comm);
 
@@ -577,7 +577,7 @@ guint64 get_file_size(GFile *file)
 
     if (file != NULL)
         {
-            fileinfo = g_file_query_info(file, "*", G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL, &error);
+            fileinfo = g_file_query_info(file, G_FILE_ATTRIBUTE_STANDARD_SIZE, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL, &error);
             size = g_file_info_get_attribute_uint64(fileinfo, G_FILE_ATTRIBUTE_STANDARD_SIZE);
             free_object(fileinfo);
         }
@@ -607,6 +607,53 @@ gboolean file_exists(gchar *filename)
 }
 
 
+/**
+ * Flushes a directory to disk so that the files just created, renamed
+ * or removed in it survive a crash.
+ * @param dirname is the directory.
+ */
+void sync_directory(gchar *dirname)
+{
+    gint fd = -1;
+
+    fd = open(dirname, O_RDONLY | O_DIRECTORY);
+
+    if (fd >= 0)
+        {
+            fsync(fd);
+            close(fd);
+        }
+}
+
+
+/**
+ * Flushes to disk every file of the filesystem that contains a
+ * directory (and only that filesystem) with syncfs().
+ * @param dirname is a directory of that filesystem.
+ * @returns TRUE if the filesystem has been flushed and FALSE otherwise.
+ */
+gboolean sync_filesystem(gchar *dirname)
+{
+    gint fd = -1;
+    gboolean done = FALSE;
+
+    fd = open(dirname, O_RDONLY | O_DIRECTORY);
+
+    if (fd >= 0)
+        {
+            done = syncfs(fd) == 0;
+            close(fd);
+        }
+
+    if (done == FALSE)
+        {
+            print_error(__FILE__, __LINE__, _("Unable to sync filesystem of %s: %s\n"), dirname, g_strerror(errno));
+        }
+
+    return done;
+}
+
+
 /**
  * Searchs for a filename that doesn't exists yet
  * @param all_versions is true when we want to save all versions of a
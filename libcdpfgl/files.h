@@ -28,6 +28,20 @@
 #ifndef _FILES_H_
 #define _FILES_H_
 
+/**
+ * @def FILE_META_DATA_ATTRIBUTES
+ * GIO attributes needed to fill a meta_data_t structure. Querying only
+ * them instead of "*" avoids costly ones such as content type sniffing.
+ */
+#define FILE_META_DATA_ATTRIBUTES (G_FILE_ATTRIBUTE_STANDARD_TYPE "," G_FILE_ATTRIBUTE_STANDARD_NAME ","              \
+                                   G_FILE_ATTRIBUTE_STANDARD_SIZE "," G_FILE_ATTRIBUTE_STANDARD_SYMLINK_TARGET ","    \
+                                   G_FILE_ATTRIBUTE_UNIX_INODE "," G_FILE_ATTRIBUTE_UNIX_UID ","                      \
+                                   G_FILE_ATTRIBUTE_UNIX_GID "," G_FILE_ATTRIBUTE_UNIX_MODE ","                       \
+                                   G_FILE_ATTRIBUTE_OWNER_USER "," G_FILE_ATTRIBUTE_OWNER_GROUP ","                   \
+                                   G_FILE_ATTRIBUTE_TIME_ACCESS "," G_FILE_ATTRIBUTE_TIME_CHANGED ","                 \
+                                   G_FILE_ATTRIBUTE_TIME_MODIFIED)
+
+
 /**
  * @struct meta_data_t
  * @brief Stores file's meta data.
@@ -295,6 +309,23 @@ extern void file_create_directory(gchar *save_dir, gchar *sub_dir);
  */
 extern gboolean file_exists(gchar *filename);
 
+
+/**
+ * Flushes a directory to disk so that the files just created, renamed
+ * or removed in it survive a crash.
+ * @param dirname is the directory.
+ */
+extern void sync_directory(gchar *dirname);
+
+
+/**
+ * Flushes to disk every file of the filesystem that contains a
+ * directory (and only that filesystem) with syncfs().
+ * @param dirname is a directory of that filesystem.
+ * @returns TRUE if the filesystem has been flushed and FALSE otherwise.
+ */
+extern gboolean sync_filesystem(gchar *dirname);
+
 /**
  * Searchs for a filename that doesn't exists yet
  * @param all_versions is true when we want to save all versions of a
@@ -0,0 +1,527 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    framing.c
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file framing.c
+ * This file contains functions to write and read blocks as binary
+ * frames. Unlike JSON messages blocks are neither base64 encoded nor
+ * parsed: a frame is copied as is from and to the block's buffer.
+ * Block streams serialize a list of blocks piece by piece.
+ */
+
+#include "libcdpfgl.h"
+
+static gsize get_frame_data_length(hash_data_t *hash_data);
+static hash_data_t *read_frame(guchar *buffer, gsize length, gsize *used);
+static void next_block_stream_piece(block_stream_t *stream);
+
+
+/**
+ * @param hash_data is a block.
+ * @returns the number of bytes of data carried by the block's frame
+ *          (0 for a block of zeros whose data is not kept).
+ */
+static gsize get_frame_data_length(hash_data_t *hash_data)
+{
+    if (hash_data->data != NULL && hash_data->read > 0)
+        {
+            return (gsize) hash_data->read;
+        }
+    else
+        {
+            return 0;
+        }
+}
+
+
+/**
+ * @param hash_data is a block (its data may be NULL for a block of
+ *        zeros).
+ * @returns the number of bytes of the frame of this block.
+ */
+gsize get_frame_length(hash_data_t *hash_data)
+{
+    gsize length = 0;
+
+    if (hash_data != NULL)
+        {
+            length = FRAME_HEADER_LEN + get_frame_data_length(hash_data);
+        }
+
+    return length;
+}
+
+
+/**
+ * Writes the preamble of a framed body.
+ * @param[out] dest is a buffer of at least FRAMES_PREAMBLE_LEN bytes.
+ * @returns the number of bytes written (FRAMES_PREAMBLE_LEN).
+ */
+gsize write_frames_preamble(guchar *dest)
+{
+    guint32 version = GUINT32_TO_BE(FRAMES_VERSION);
+
+    memcpy(dest, FRAMES_MAGIC, 4);
+    memcpy(dest + 4, &version, 4);
+
+    return FRAMES_PREAMBLE_LEN;
+}
+
+
+/**
+ * Writes the header of the frame of a block (without its data).
+ * @param[out] dest is a buffer of at least FRAME_HEADER_LEN bytes.
+ * @param hash_data is the block.
+ * @returns the number of bytes written.
+ */
+gsize write_frame_header(guchar *dest, hash_data_t *hash_data)
+{
+    guint16 cmptype = 0;
+    guint64 uncmplen = 0;
+    guint64 datalen = 0;
+    gsize len = 0;
+
+    if (dest != NULL && hash_data != NULL && hash_data->hash != NULL)
+        {
+            cmptype = GUINT16_TO_BE((guint16) hash_data->cmptype);
+            uncmplen = GUINT64_TO_BE((guint64) hash_data->uncmplen);
+            datalen = GUINT64_TO_BE((guint64) get_frame_data_length(hash_data));
+
+            memcpy(dest, hash_data->hash, HASH_LEN);
+            memcpy(dest + HASH_LEN, &cmptype, 2);
+            memcpy(dest + HASH_LEN + 2, &uncmplen, 8);
+            memcpy(dest + HASH_LEN + 10, &datalen, 8);
+
+            len = FRAME_HEADER_LEN;
+        }
+
+    return len;
+}
+
+
+/**
+ * Writes the frame of a block.
+ * @param[out] dest is a buffer of at least get_frame_length(hash_data)
+ *        bytes.
+ * @param hash_data is the block to be written.
+ * @returns the number of bytes written.
+ */
+gsize write_frame(guchar *dest, hash_data_t *hash_data)
+{
+    gsize len = 0;
+    gsize datalen = 0;
+
+    len = write_frame_header(dest, hash_data);
+
+    if (len > 0)
+        {
+            datalen = get_frame_data_length(hash_data);
+
+            if (datalen > 0)
+                {
+                    memcpy(dest + FRAME_HEADER_LEN, hash_data->data, datalen);
+                }
+
+            len = len + datalen;
+        }
+
+    return len;
+}
+
+
+/**
+ * Makes a framed body with all blocks of a list.
+ * @param hash_data_list is a GList of hash_data_t * blocks.
+ * @param[out] length is the length of the returned buffer.
+ * @returns a newly allocated buffer that may be freed with
+ *          free_variable() when no longer needed.
+ */
+guchar *convert_hash_data_list_to_frames(GList *hash_data_list, gsize *length)
+{
+    GList *iter = NULL;
+    guchar *buffer = NULL;
+    gsize total = FRAMES_PREAMBLE_LEN;
+    gsize pos = 0;
+
+    for (iter = hash_data_list; iter != NULL; iter = g_list_next(iter))
+        {
+            total = total + get_frame_length(iter->data);
+        }
+
+    buffer = (guchar *) g_malloc(total);
+    g_assert_nonnull(buffer);
+
+    pos = write_frames_preamble(buffer);
+
+    for (iter = hash_data_list; iter != NULL; iter = g_list_next(iter))
+        {
+            pos = pos + write_frame(buffer + pos, iter->data);
+        }
+
+    if (length != NULL)
+        {
+            *length = pos;
+        }
+
+    return buffer;
+}
+
+
+/**
+ * Reads one frame.
+ * @param buffer points to the beginning of the frame.
+ * @param length is the number of bytes available from buffer.
+ * @param[out] used is the number of bytes of the frame.
+ * @returns a newly allocated hash_data_t with a copy of the frame's hash
+ *          and data or NULL if the frame is truncated or invalid (a
+ *          frame without data whose hash is not the one of a block of
+ *          zeros for instance).
+ */
+static hash_data_t *read_frame(guchar *buffer, gsize length, gsize *used)
+{
+    hash_data_t *hash_data = NULL;
+    guint8 *hash = NULL;
+    guchar *data = NULL;
+    guint16 cmptype = 0;
+    guint64 uncmplen = 0;
+    guint64 datalen = 0;
+
+    if (length >= FRAME_HEADER_LEN)
+        {
+            memcpy(&cmptype, buffer + HASH_LEN, 2);
+            memcpy(&uncmplen, buffer + HASH_LEN + 2, 8);
+            memcpy(&datalen, buffer + HASH_LEN + 10, 8);
+            cmptype = GUINT16_FROM_BE(cmptype);
+            uncmplen = GUINT64_FROM_BE(uncmplen);
+            datalen = GUINT64_FROM_BE(datalen);
+
+            /* Only a block of zeros may come without data: its length is in its hash */
+            if (datalen <= length - FRAME_HEADER_LEN && uncmplen <= G_MAXSSIZE && is_compress_type_known((gshort) cmptype) == TRUE && (datalen > 0 || (is_zero_block_hash(buffer) == TRUE && (gssize) uncmplen == get_zero_block_hash_length(buffer))))
+                {
+                    hash = (guint8 *) g_malloc(HASH_LEN);
+                    memcpy(hash, buffer, HASH_LEN);
+
+                    if (datalen > 0)
+                        {
+                            /* One more byte: some code expects data to be \0 terminated */
+                            data = (guchar *) g_malloc(datalen + 1);
+                            memcpy(data, buffer + FRAME_HEADER_LEN, datalen);
+                            data[datalen] = '\0';
+                            hash_data = new_hash_data_t_as_is(data, (gssize) datalen, hash, (gshort) cmptype, (gssize) uncmplen);
+                        }
+                    else
+                        {
+                            /* A block of zeros: read is its length as for blocks made by the client */
+                            hash_data = new_hash_data_t_as_is(NULL, (gssize) uncmplen, hash, COMPRESS_NONE_TYPE, (gssize) uncmplen);
+                        }
+
+                    *used = FRAME_HEADER_LEN + datalen;
+                }
+        }
+
+    return hash_data;
+}
+
+
+/**
+ * Reads every frame of a framed body.
+ * @param buffer is the framed body.
+ * @param length is the length of buffer.
+ * @returns a GList of newly allocated hash_data_t * blocks in the order
+ *          of the frames or NULL if buffer is not a valid framed body.
+ */
+GList *convert_frames_to_hash_data_list(guchar *buffer, gsize length)
+{
+    GList *hash_data_list = NULL;
+    hash_data_t *hash_data = NULL;
+    guint32 version = 0;
+    gsize pos = 0;
+    gsize used = 0;
+    gboolean valid = FALSE;
+
+    if (buffer != NULL && length >= FRAMES_PREAMBLE_LEN && memcmp(buffer, FRAMES_MAGIC, 4) == 0)
+        {
+            memcpy(&version, buffer + 4, 4);
+            valid = (GUINT32_FROM_BE(version) == FRAMES_VERSION);
+            pos = FRAMES_PREAMBLE_LEN;
+        }
+
+    while (valid == TRUE && pos < length)
+        {
+            hash_data = read_frame(buffer + pos, length - pos, &used);
+
+            if (hash_data != NULL)
+                {
+                    hash_data_list = g_list_prepend(hash_data_list, hash_data);
+                    pos = pos + used;
+                }
+            else
+                {
+                    valid = FALSE;
+                }
+        }
+
+    if (valid == FALSE)
+        {
+            print_error(__FILE__, __LINE__, _("Invalid framed body (%zu bytes)\n"), length);
+            g_list_free_full(hash_data_list, free_hdt_struct);
+            hash_data_list = NULL;
+        }
+
+    return g_list_reverse(hash_data_list);
+}
+
+
+/**
+ * Creates a block stream.
+ * @param blocks is a GList of hash_data_t * blocks. The stream owns it
+ *        and frees it with its blocks.
+ * @param binary is TRUE to serialize blocks as binary frames and FALSE
+ *        to serialize them as a JSON "data_array".
+ * @returns a newly allocated block_stream_t that may be freed with
+ *          free_block_stream_t() when no longer needed.
+ */
+block_stream_t *new_block_stream_t(GList *blocks, gboolean binary)
+{
+    block_stream_t *stream = NULL;
+
+    stream = (block_stream_t *) g_malloc0(sizeof(block_stream_t));
+    g_assert_nonnull(stream);
+
+    stream->blocks = blocks;
+    stream->binary = binary;
+    stream->owned = NULL;
+    rewind_block_stream(stream);
+
+    return stream;
+}
+
+
+/**
+ * Frees a block stream, its list and its blocks.
+ * @param stream is the block stream to be freed.
+ */
+void free_block_stream_t(block_stream_t *stream)
+{
+    if (stream != NULL)
+        {
+            g_list_free_full(stream->blocks, free_hdt_struct);
+            free_variable(stream->owned);
+            free_variable(stream);
+        }
+}
+
+
+/**
+ * Makes the stream start again from its beginning.
+ * @param stream is a block stream.
+ */
+void rewind_block_stream(block_stream_t *stream)
+{
+    if (stream != NULL)
+        {
+            free_variable(stream->owned);
+            stream->owned = NULL;
+            stream->current = stream->blocks;
+            stream->step = BLOCK_STREAM_HEAD;
+            stream->data_next = FALSE;
+            stream->piece = NULL;
+            stream->piece_len = 0;
+            stream->piece_pos = 0;
+        }
+}
+
+
+/**
+ * Prepares the next piece of a block stream: the preamble, a frame
+ * header, a block's data (not copied) or a block as JSON.
+ * @param stream is a block stream whose current piece has been read.
+ */
+static void next_block_stream_piece(block_stream_t *stream)
+{
+    hash_data_t *hash_data = NULL;
+    gchar *json_str = NULL;
+
+    free_variable(stream->owned);
+    stream->owned = NULL;
+    stream->piece = NULL;
+    stream->piece_len = 0;
+    stream->piece_pos = 0;
+
+    if (stream->step == BLOCK_STREAM_HEAD)
+        {
+            if (stream->binary == TRUE)
+                {
+                    stream->piece_len = write_frames_preamble(stream->scratch);
+                    stream->piece = stream->scratch;
+                }
+            else
+                {
+                    stream->piece = (guchar *) JSON_DATA_ARRAY_HEAD;
+                    stream->piece_len = strlen(JSON_DATA_ARRAY_HEAD);
+                }
+
+            stream->step = BLOCK_STREAM_BLOCKS;
+        }
+    else if (stream->step == BLOCK_STREAM_BLOCKS && stream->current != NULL)
+        {
+            hash_data = stream->current->data;
+
+            if (stream->binary == TRUE && stream->data_next == FALSE)
+                {
+                    stream->piece_len = write_frame_header(stream->scratch, hash_data);
+                    stream->piece = stream->scratch;
+                    stream->data_next = TRUE;
+                }
+            else if (stream->binary == TRUE)
+                {
+                    /* Data is read from the block itself */
+                    stream->piece = hash_data->data;
+                    stream->piece_len = get_frame_data_length(hash_data);
+                    stream->data_next = FALSE;
+                    stream->current = g_list_next(stream->current);
+                }
+            else
+                {
+                    json_str = convert_hash_data_t_to_string(hash_data);
+
+                    if (stream->current != stream->blocks)
+                        {
+                            stream->owned = g_strconcat(",", json_str, NULL);
+                            free_variable(json_str);
+                        }
+                    else
+                        {
+                            stream->owned = json_str;
+                        }
+
+                    stream->piece = (guchar *) stream->owned;
+                    stream->piece_len = strlen(stream->owned);
+                    stream->current = g_list_next(stream->current);
+                }
+        }
+    else
+        {
+            /* Every block has been serialized */
+            if (stream->binary == FALSE)
+                {
+                    stream->piece = (guchar *) JSON_DATA_ARRAY_TAIL;
+                    stream->piece_len = strlen(JSON_DATA_ARRAY_TAIL);
+                }
+
+            stream->step = BLOCK_STREAM_DONE;
+        }
+}
+
+
+/**
+ * Reads the next bytes of a block stream.
+ * @param stream is a block stream.
+ * @param[out] dest is where to copy the bytes.
+ * @param size is the maximum number of bytes to copy into dest.
+ * @returns the number of bytes copied. 0 means that the whole stream has
+ *          been read.
+ */
+gsize read_block_stream(block_stream_t *stream, guchar *dest, gsize size)
+{
+    gsize copied = 0;
+    gsize len = 0;
+
+    if (stream != NULL && dest != NULL)
+        {
+            while (copied < size && (stream->piece_pos < stream->piece_len || stream->step != BLOCK_STREAM_DONE))
+                {
+                    if (stream->piece_pos < stream->piece_len)
+                        {
+                            len = MIN(size - copied, stream->piece_len - stream->piece_pos);
+                            memcpy(dest + copied, stream->piece + stream->piece_pos, len);
+                            stream->piece_pos = stream->piece_pos + len;
+                            copied = copied + len;
+                        }
+                    else
+                        {
+                            next_block_stream_piece(stream);
+                        }
+                }
+        }
+
+    return copied;
+}
+
+
+/**
+ * @param stream is a block stream.
+ * @returns the number of bytes of the serialized stream or -1 when it
+ *          is not known without serializing it (JSON streams).
+ */
+gssize get_block_stream_length(block_stream_t *stream)
+{
+    GList *iter = NULL;
+    gssize length = -1;
+
+    if (stream != NULL && stream->binary == TRUE)
+        {
+            length = FRAMES_PREAMBLE_LEN;
+
+            for (iter = stream->blocks; iter != NULL; iter = g_list_next(iter))
+                {
+                    length = length + get_frame_length(iter->data);
+                }
+        }
+
+    return length;
+}
+
+
+/**
+ * Reads a whole block stream from its beginning into a buffer.
+ * @param stream is a block stream.
+ * @param[out] length is the length of the returned buffer.
+ * @returns a newly allocated \0 terminated buffer that may be freed with
+ *          free_variable() when no longer needed.
+ */
+guchar *read_whole_block_stream(block_stream_t *stream, gsize *length)
+{
+    GByteArray *whole = NULL;
+    guchar chunk[FRAMES_READ_CHUNK];
+    gsize len = 0;
+
+    whole = g_byte_array_new();
+    rewind_block_stream(stream);
+
+    do
+        {
+            len = read_block_stream(stream, chunk, FRAMES_READ_CHUNK);
+            g_byte_array_append(whole, chunk, len);
+        }
+    while (len > 0);
+
+    if (length != NULL)
+        {
+            *length = whole->len;
+        }
+
+    /* \0 terminated as JSON streams are given to functions expecting strings */
+    g_byte_array_append(whole, (guchar *) "", 1);
+
+    return g_byte_array_free(whole, FALSE);
+}
@@ -0,0 +1,231 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    framing.h
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file framing.h
+ *
+ * This file contains definitions of the binary framing used to transmit
+ * blocks between programs without JSON nor base64. A body is made of a
+ * preamble (FRAMES_MAGIC and FRAMES_VERSION) followed by frames. Each
+ * frame is the binary hash of a block, its compression type, its
+ * uncompressed length and the length of its data followed by the data
+ * itself. Integers are big endian.
+ *
+ * A block stream serializes a list of blocks (as frames or as a JSON
+ * "data_array") piece by piece so that a request body can be sent
+ * without ever being built in memory.
+ */
+
+#ifndef _FRAMING_H_
+#define _FRAMING_H_
+
+
+/**
+ * @def FRAMES_MAGIC
+ * Four bytes that begin every framed body.
+ *
+ * @def FRAMES_VERSION
+ * Version of the framing (32 bits) that follows FRAMES_MAGIC.
+ *
+ * @def FRAMES_PREAMBLE_LEN
+ * Length in bytes of FRAMES_MAGIC followed by FRAMES_VERSION.
+ */
+#define FRAMES_MAGIC ("CDPF")
+#define FRAMES_VERSION (1)
+#define FRAMES_PREAMBLE_LEN (8)
+
+
+/**
+ * @def FRAME_HEADER_LEN
+ * Length in bytes of a frame's header: hash (HASH_LEN bytes), cmptype
+ * (16 bits), uncompressed length (64 bits) and data length (64 bits).
+ */
+#define FRAME_HEADER_LEN (HASH_LEN + 2 + 8 + 8)
+
+
+/**
+ * @def BLOCK_STREAM_HEAD
+ * The stream has to send its preamble (or the beginning of the JSON
+ * message).
+ *
+ * @def BLOCK_STREAM_BLOCKS
+ * The stream is sending its blocks.
+ *
+ * @def BLOCK_STREAM_DONE
+ * Everything has been serialized (the last piece may still be unsent).
+ */
+#define BLOCK_STREAM_HEAD (0)
+#define BLOCK_STREAM_BLOCKS (1)
+#define BLOCK_STREAM_DONE (2)
+
+
+/**
+ * @def FRAMES_READ_CHUNK
+ * Number of bytes read at once from a block stream when it is read
+ * whole.
+ */
+#define FRAMES_READ_CHUNK (65536)
+
+
+/**
+ * @def JSON_DATA_ARRAY_HEAD
+ * Beginning of a JSON /Data_Array.json message.
+ *
+ * @def JSON_DATA_ARRAY_TAIL
+ * End of a JSON /Data_Array.json message.
+ */
+#define JSON_DATA_ARRAY_HEAD ("{\"data_array\": [")
+#define JSON_DATA_ARRAY_TAIL ("]}")
+
+
+/**
+ * @struct block_stream_t
+ * @brief Serializes a list of blocks piece by piece: binary frames are
+ *        read directly from the blocks' buffers and a JSON "data_array"
+ *        is made one block at a time.
+ */
+typedef struct
+{
+    GList *blocks;          /**< hash_data_t * blocks of the stream (owned by the stream)   */
+    GList *current;         /**< next block to be serialized                                 */
+    gboolean binary;        /**< TRUE for binary frames, FALSE for a JSON "data_array"       */
+    gint step;              /**< BLOCK_STREAM_* step of the serialization                    */
+    gboolean data_next;     /**< TRUE when current block's data follows its frame header    */
+    guchar scratch[FRAMES_PREAMBLE_LEN + FRAME_HEADER_LEN]; /**< preamble or frame header    */
+    guchar *piece;          /**< bytes being read (in scratch, in a block or in owned)       */
+    gsize piece_len;        /**< length of piece                                             */
+    gsize piece_pos;        /**< number of bytes of piece already read                       */
+    gchar *owned;           /**< piece to be freed once read (a block as JSON)               */
+} block_stream_t;
+
+
+/**
+ * @param hash_data is a block (its data may be NULL for a block of
+ *        zeros).
+ * @returns the number of bytes of the frame of this block.
+ */
+extern gsize get_frame_length(hash_data_t *hash_data);
+
+
+/**
+ * Writes the preamble of a framed body.
+ * @param[out] dest is a buffer of at least FRAMES_PREAMBLE_LEN bytes.
+ * @returns the number of bytes written (FRAMES_PREAMBLE_LEN).
+ */
+extern gsize write_frames_preamble(guchar *dest);
+
+
+/**
+ * Writes the header of the frame of a block (without its data).
+ * @param[out] dest is a buffer of at least FRAME_HEADER_LEN bytes.
+ * @param hash_data is the block.
+ * @returns the number of bytes written.
+ */
+extern gsize write_frame_header(guchar *dest, hash_data_t *hash_data);
+
+
+/**
+ * Writes the frame of a block.
+ * @param[out] dest is a buffer of at least get_frame_length(hash_data)
+ *        bytes.
+ * @param hash_data is the block to be written.
+ * @returns the number of bytes written.
+ */
+extern gsize write_frame(guchar *dest, hash_data_t *hash_data);
+
+
+/**
+ * Makes a framed body with all blocks of a list.
+ * @param hash_data_list is a GList of hash_data_t * blocks.
+ * @param[out] length is the length of the returned buffer.
+ * @returns a newly allocated buffer that may be freed with
+ *          free_variable() when no longer needed.
+ */
+extern guchar *convert_hash_data_list_to_frames(GList *hash_data_list, gsize *length);
+
+
+/**
+ * Reads every frame of a framed body.
+ * @param buffer is the framed body.
+ * @param length is the length of buffer.
+ * @returns a GList of newly allocated hash_data_t * blocks in the order
+ *          of the frames or NULL if buffer is not a valid framed body.
+ */
+extern GList *convert_frames_to_hash_data_list(guchar *buffer, gsize length);
+
+
+/**
+ * Creates a block stream.
+ * @param blocks is a GList of hash_data_t * blocks. The stream owns it
+ *        and frees it with its blocks.
+ * @param binary is TRUE to serialize blocks as binary frames and FALSE
+ *        to serialize them as a JSON "data_array".
+ * @returns a newly allocated block_stream_t that may be freed with
+ *          free_block_stream_t() when no longer needed.
+ */
+extern block_stream_t *new_block_stream_t(GList *blocks, gboolean binary);
+
+
+/**
+ * Frees a block stream, its list and its blocks.
+ * @param stream is the block stream to be freed.
+ */
+extern void free_block_stream_t(block_stream_t *stream);
+
+
+/**
+ * Makes the stream start again from its beginning.
+ * @param stream is a block stream.
+ */
+extern void rewind_block_stream(block_stream_t *stream);
+
+
+/**
+ * Reads the next bytes of a block stream.
+ * @param stream is a block stream.
+ * @param[out] dest is where to copy the bytes.
+ * @param size is the maximum number of bytes to copy into dest.
+ * @returns the number of bytes copied. 0 means that the whole stream has
+ *          been read.
+ */
+extern gsize read_block_stream(block_stream_t *stream, guchar *dest, gsize size);
+
+
+/**
+ * @param stream is a block stream.
+ * @returns the number of bytes of the serialized stream or -1 when it
+ *          is not known without serializing it (JSON streams).
+ */
+extern gssize get_block_stream_length(block_stream_t *stream);
+
+
+/**
+ * Reads a whole block stream from its beginning into a buffer.
+ * @param stream is a block stream.
+ * @param[out] length is the length of the returned buffer.
+ * @returns a newly allocated \0 terminated buffer that may be freed with
+ *          free_variable() when no longer needed.
+ */
+extern guchar *read_whole_block_stream(block_stream_t *stream, gsize *length);
+
+
+#endif /* #ifndef _FRAMING_H_ */
@@ -88,6 +88,69 @@ gint compare_two_hashs(gconstpointer a, gconstpointer b)
         }
 }
 
+/**
+ * Hash function to be used with GHashTable whose keys are hashs in a
+ * binary form (guint8 * of HASH_LEN bytes). Hashs are already uniformly
+ * distributed so the first bytes are enough.
+ * @param key is a hash in a binary form.
+ * @returns a guint made of the first bytes of the hash.
+ */
+guint hash_digest_hash(gconstpointer key)
+{
+    const guint8 *hash = (const guint8 *) key;
+
+    return ((guint) hash[0] << 24) | ((guint) hash[1] << 16) | ((guint) hash[2] << 8) | (guint) hash[3];
+}
+
+
+/**
+ * Equality function to be used with GHashTable whose keys are hashs in a
+ * binary form (guint8 * of HASH_LEN bytes).
+ * @param a is a hash in a binary form
+ * @param b is a hash in a binary form to be compared with a.
+ * @returns TRUE if a and b are the same hash, FALSE otherwise.
+ */
+gboolean hash_digest_equal(gconstpointer a, gconstpointer b)
+{
+    return memcmp(a, b, HASH_LEN) == 0;
+}
+
+
+/**
+ * Makes an index of a hash_data_t list: keys are the hashs (binary
+ * form) and values are the GList * elements of hash_data_list that
+ * contain them. When a hash appears more than once in the list the
+ * first element is indexed. Blocks of zeros are not indexed: they are
+ * never sent.
+ * @param hash_data_list is a list of hash_data_t * structures.
+ * @returns a newly created GHashTable that must be destroyed with
+ *          g_hash_table_destroy() when no longer needed. Keys and
+ *          values are not owned by the table: an entry must be removed
+ *          before its GList element is freed.
+ */
+GHashTable *make_hash_data_list_index(GList *hash_data_list)
+{
+    GHashTable *index = NULL;
+    hash_data_t *hash_data = NULL;
+
+    index = g_hash_table_new(hash_digest_hash, hash_digest_equal);
+
+    while (hash_data_list != NULL)
+        {
+            hash_data = hash_data_list->data;
+
+            if (hash_data != NULL && hash_data->hash != NULL && is_zero_block_hash(hash_data->hash) == FALSE && g_hash_table_contains(index, hash_data->hash) == FALSE)
+                {
+                    g_hash_table_insert(index, hash_data->hash, hash_data_list);
+                }
+
+            hash_data_list = g_list_next(hash_data_list);
+        }
+
+    return index;
+}
+
+
 /**
  * Transforms a binary hashs into a printable string (gchar *)
  * @param a_hash is a hash in a binary form that we want to transform into
@@ -236,8 +299,17 @@ void free_hdt_struct(gpointer data)
 
 
 /**
- * Inits and returns a newly hash_data_t structure.
- * @returns a newly hash_data_t structure.
+ * Inits and returns a newly hash_data_t structure. Data is compressed
+ * only if it looks compressible (see is_buffer_compressible()) and is
+ * kept compressed only if compression saves at least 1/COMPRESS_MIN_GAIN
+ * of its size. Otherwise it is stored as is with COMPRESS_NONE_TYPE.
+ * @param data is the data of the block.
+ * @param size_read is the length of data.
+ * @param hash is the hash of data (owned by the returned structure).
+ * @param cmptype is the compression type wanted.
+ * @returns a newly hash_data_t structure. When its data field is not
+ *          'data' (it has been compressed) 'data' has to be freed by
+ *          the caller.
  */
 hash_data_t *new_hash_data_t(guchar *data, gssize size_read, guint8 *hash, gshort cmptype)
 {
@@ -247,24 +319,31 @@ hash_data_t *new_hash_data_t(guchar *data, gssize size_read, guint8 *hash, gshor
     hash_data = (hash_data_t *) g_malloc(sizeof(hash_data_t));
     g_assert_nonnull(hash_data);
 
-    if (cmptype != COMPRESS_NONE_TYPE && data != NULL)
+    if (cmptype != COMPRESS_NONE_TYPE && data != NULL && is_buffer_compressible(data, size_read) == TRUE)
         {
             compress = compress_buffer(data, size_read, (gint) cmptype);
+        }
+
+    if (compress != NULL && compress->text != NULL && (gssize) compress->len <= size_read - size_read / COMPRESS_MIN_GAIN)
+        {
             hash_data->data = compress->text;
             hash_data->read = compress->len;
             hash_data->uncmplen = size_read;
+            hash_data->cmptype = cmptype;
             free_variable(compress); /* do not free compress->text as its reference is now used in hash_data->data. */
             /* data variable is not used anymore (it has been replaced by compress->text) it has to be freed by the caller */
         }
     else
         {
+            /* Not compressed or compression did not save enough: the block is kept as is */
+            free_compress_t(compress);
             hash_data->data = data;
             hash_data->read = size_read;
             hash_data->uncmplen = size_read;
+            hash_data->cmptype = COMPRESS_NONE_TYPE;
         }
 
     hash_data->hash = hash;
-    hash_data->cmptype = cmptype;
 
     return hash_data;
 }
@@ -360,7 +439,7 @@ hash_extract_t *new_hash_extract_t(void)
  *        hashs and one pointer to a gchar * string that contains thoses
  *        hashs, base64 encoded and comma separated.
  * @param max is a gint that represents the maximum number of hashs to
- *        convert.
+ *        convert. Conversion also stops before a block of zeros.
  * @returns a correctly filled gchar *string
  */
 gchar *convert_max_hashs_from_hash_list_to_gchar(hash_extract_t *hash_extract, gint max)
@@ -377,7 +456,8 @@ gchar *convert_max_hashs_from_hash_list_to_gchar(hash_extract_t *hash_extract, g
             head = hash_extract->hash_list;
         }
 
-    while (head != NULL && i < max)
+    /* Blocks of zeros are not stored: the caller has to deal with them */
+    while (head != NULL && i < max && is_zero_block_hash(((hash_data_t *) head->data)->hash) == FALSE)
         {
             hash_data = head->data;
             base64 = g_base64_encode(hash_data->hash, HASH_LEN);
@@ -565,16 +645,172 @@ gpointer copy_only_hash(gconstpointer src, gpointer user_data)
  */
 guint8 *calculate_hash_for_string(guchar *buffer, guint size)
 {
-    GChecksum *digest = NULL;
     guint8 *a_hash = NULL;
-    gsize digest_len = HASH_LEN;
 
     /* Calculates cheksum for final_buffer */
-    a_hash = (guint8 *) g_malloc(digest_len);
-    digest = g_checksum_new(G_CHECKSUM_SHA256);
-    g_checksum_update(digest, (const guchar *) buffer, size);
-    g_checksum_get_digest(digest, a_hash, &digest_len);
-    g_checksum_free(digest);
+    a_hash = (guint8 *) g_malloc(HASH_LEN);
+    sha256_digest((const guchar *) buffer, size, a_hash);
 
     return a_hash;
 }
+
+
+/**
+ * Tells whether a buffer is only made of zeros
+ * @param buffer is the buffer to be tested.
+ * @param size is the number of bytes of buffer.
+ * @returns TRUE if size is not 0 and all bytes of buffer are zeros,
+ *          FALSE otherwise.
+ */
+gboolean is_zero_block(guchar *buffer, gsize size)
+{
+    if (buffer == NULL || size == 0 || buffer[0] != 0)
+        {
+            return FALSE;
+        }
+
+    /* buffer[0] is 0 so every byte equals the next one only if all are 0 */
+    return memcmp(buffer, buffer + 1, size - 1) == 0;
+}
+
+
+/**
+ * Fills a_hash with the reserved hash of a block of size zeros.
+ * @param[out] a_hash is a buffer of HASH_LEN bytes.
+ * @param size is the length of the block.
+ */
+void make_zero_block_hash(guint8 *a_hash, gssize size)
+{
+    guint64 len = GUINT64_TO_BE((guint64) size);
+
+    memset(a_hash, 0, ZERO_BLOCK_PREFIX_LEN);
+    memcpy(a_hash + ZERO_BLOCK_PREFIX_LEN, &len, HASH_LEN - ZERO_BLOCK_PREFIX_LEN);
+}
+
+
+/**
+ * Tells whether a hash is the reserved hash of a block of zeros.
+ * @param a_hash is a hash in a binary form.
+ * @returns TRUE if a_hash represents a block of zeros, FALSE otherwise.
+ */
+gboolean is_zero_block_hash(guint8 *a_hash)
+{
+    guint i = 0;
+
+    if (a_hash == NULL)
+        {
+            return FALSE;
+        }
+
+    while (i < ZERO_BLOCK_PREFIX_LEN && a_hash[i] == 0)
+        {
+            i = i + 1;
+        }
+
+    return (i == ZERO_BLOCK_PREFIX_LEN && get_zero_block_hash_length(a_hash) > 0);
+}
+
+
+/**
+ * @param a_hash is the reserved hash of a block of zeros.
+ * @returns the length in bytes of the block of zeros represented by
+ *          a_hash.
+ */
+gssize get_zero_block_hash_length(guint8 *a_hash)
+{
+    guint64 len = 0;
+
+    memcpy(&len, a_hash + ZERO_BLOCK_PREFIX_LEN, HASH_LEN - ZERO_BLOCK_PREFIX_LEN);
+
+    return (gssize) GUINT64_FROM_BE(len);
+}
+
+
+/**
+ * @param a_hash is the reserved hash of a block of zeros.
+ * @returns TRUE if the block of zeros represented by a_hash is at most
+ *          BLOCK_MAX_SIZE bytes long and FALSE otherwise.
+ */
+gboolean is_zero_block_length_valid(guint8 *a_hash)
+{
+    gssize size = get_zero_block_hash_length(a_hash);
+
+    return (size > 0 && size <= BLOCK_MAX_SIZE);
+}
+
+
+/**
+ * Makes the data of a block of zeros from its reserved hash.
+ * @param a_hash is the reserved hash of a block of zeros (it is copied).
+ * @returns a newly allocated hash_data_t structure with uncompressed
+ *          zeros that must be freed with free_hash_data_t() or NULL if
+ *          the block is longer than BLOCK_MAX_SIZE.
+ */
+hash_data_t *new_zero_block_hash_data_t(guint8 *a_hash)
+{
+    gssize size = get_zero_block_hash_length(a_hash);
+    guchar *data = NULL;
+    guint8 *hash = NULL;
+
+    if (is_zero_block_length_valid(a_hash) == FALSE)
+        {
+            return NULL;
+        }
+
+    data = (guchar *) g_malloc0(size);
+    g_assert_nonnull(data);
+
+    hash = (guint8 *) g_malloc(HASH_LEN);
+    g_assert_nonnull(hash);
+    memcpy(hash, a_hash, HASH_LEN);
+
+    return new_hash_data_t_as_is(data, size, hash, COMPRESS_NONE_TYPE, size);
+}
+
+
+/**
+ * Moves a stream being written forward by the length of a block of
+ * zeros instead of writing them: seeking after the end of the file
+ * makes a hole there.
+ * @param stream is the stream of the file being written.
+ * @param a_hash is the reserved hash of a block of zeros.
+ * @returns TRUE if the stream has been moved forward and FALSE otherwise.
+ */
+gboolean skip_zero_block_in_stream(GFileOutputStream *stream, guint8 *a_hash)
+{
+    GError *error = NULL;
+    gboolean done = FALSE;
+
+    done = g_seekable_seek((GSeekable *) stream, get_zero_block_hash_length(a_hash), G_SEEK_CUR, NULL, &error);
+
+    if (done == FALSE)
+        {
+            print_error(__FILE__, __LINE__, _("Error while making a hole: %s\n"), error->message);
+            free_error(error);
+        }
+
+    return done;
+}
+
+
+/**
+ * Sets the size of a file that ends with blocks skipped by
+ * skip_zero_block_in_stream(): nothing has been written to set it.
+ * @param stream is the stream of the file being written.
+ * @returns TRUE if the size of the file has been set and FALSE otherwise.
+ */
+gboolean end_stream_with_hole(GFileOutputStream *stream)
+{
+    GError *error = NULL;
+    gboolean done = FALSE;
+
+    done = g_seekable_truncate((GSeekable *) stream, g_seekable_tell((GSeekable *) stream), NULL, &error);
+
+    if (done == FALSE)
+        {
+            print_error(__FILE__, __LINE__, _("Error while setting file's size: %s\n"), error->message);
+            free_error(error);
+        }
+
+    return done;
+}
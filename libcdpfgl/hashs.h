@@ -34,6 +34,26 @@
  */
 #define HASH_LEN (32)
 
+
+/**
+ * @def ZERO_BLOCK_PREFIX_LEN
+ * A block made only of zeros (a hole in a sparse file for instance) is
+ * not hashed: its hash is ZERO_BLOCK_PREFIX_LEN zero bytes followed by
+ * the length of the block (64 bits, big endian). Such hashs are reserved:
+ * their data is never transmitted nor stored.
+ */
+#define ZERO_BLOCK_PREFIX_LEN (24)
+
+
+/**
+ * @def BLOCK_MAX_SIZE
+ * Largest block (fixed size or content defined) that a client cuts
+ * (64 MB). A block of zeros whose hash tells a greater length is
+ * refused: the hash comes from the network and rebuilding such a block
+ * would allocate that much memory.
+ */
+#define BLOCK_MAX_SIZE (67108864)
+
 /**
  * @struct hash_data_t
  * @brief Structure to store a hash and the corresponding data
@@ -70,6 +90,38 @@ typedef struct
 extern gint compare_two_hashs(gconstpointer a, gconstpointer b);
 
 
+/**
+ * Hash function to be used with GHashTable whose keys are hashs in a
+ * binary form (guint8 * of HASH_LEN bytes).
+ * @param key is a hash in a binary form.
+ * @returns a guint made of the first bytes of the hash.
+ */
+extern guint hash_digest_hash(gconstpointer key);
+
+
+/**
+ * Equality function to be used with GHashTable whose keys are hashs in a
+ * binary form (guint8 * of HASH_LEN bytes).
+ * @returns TRUE if a and b are the same hash, FALSE otherwise.
+ */
+extern gboolean hash_digest_equal(gconstpointer a, gconstpointer b);
+
+
+/**
+ * Makes an index of a hash_data_t list: keys are the hashs (binary
+ * form) and values are the GList * elements of hash_data_list that
+ * contain them. When a hash appears more than once in the list the
+ * first element is indexed. Blocks of zeros are not indexed: they are
+ * never sent.
+ * @param hash_data_list is a list of hash_data_t * structures.
+ * @returns a newly created GHashTable that must be destroyed with
+ *          g_hash_table_destroy() when no longer needed. Keys and
+ *          values are not owned by the table: an entry must be removed
+ *          before its GList element is freed.
+ */
+extern GHashTable *make_hash_data_list_index(GList *hash_data_list);
+
+
 /**
  * Transforms a binary hashs into a printable string (gchar *)
  * @param a_hash is a hash in a binary form that we want to transform into
@@ -106,8 +158,10 @@ extern void free_hdt_struct(gpointer data);
 
 /**
  * Inits and returns a newly hash_data_t structure. (and compresses data if cmptype is
- * a compression type such as COMPRESS_ZLIB_TYPE.
- * @returns a newly created hash_data_t structure.
+ * a compression type such as COMPRESS_ZLIB_TYPE and if data compresses: otherwise
+ * data is kept as is with COMPRESS_NONE_TYPE).
+ * @returns a newly created hash_data_t structure. When its data field is not
+ *          'data' (it has been compressed) 'data' has to be freed by the caller.
  */
 extern hash_data_t *new_hash_data_t(guchar * data, gssize read, guint8 *hash, gshort cmptype);
 
@@ -195,7 +249,7 @@ extern hash_extract_t *new_hash_extract_t(void);
  *        hashs and one pointer to a gchar * string that contains thoses
  *        hashs, base64 encoded and comma separated.
  * @param max is a gint that represents the maximum number of hashs to
- *        convert.
+ *        convert. Conversion also stops before a block of zeros.
  * @returns a correctly filled gchar *string
  */
 extern gchar *convert_max_hashs_from_hash_list_to_gchar(hash_extract_t *hash_extract, gint max);
@@ -211,4 +265,76 @@ extern gchar *convert_max_hashs_from_hash_list_to_gchar(hash_extract_t *hash_ext
  */
 extern guint8 *calculate_hash_for_string(guchar *buffer, guint size);
 
+
+/**
+ * Tells whether a buffer is only made of zeros
+ * @param buffer is the buffer to be tested.
+ * @param size is the number of bytes of buffer.
+ * @returns TRUE if size is not 0 and all bytes of buffer are zeros,
+ *          FALSE otherwise.
+ */
+extern gboolean is_zero_block(guchar *buffer, gsize size);
+
+
+/**
+ * Fills a_hash with the reserved hash of a block of size zeros.
+ * @param[out] a_hash is a buffer of HASH_LEN bytes.
+ * @param size is the length of the block.
+ */
+extern void make_zero_block_hash(guint8 *a_hash, gssize size);
+
+
+/**
+ * Tells whether a hash is the reserved hash of a block of zeros.
+ * @param a_hash is a hash in a binary form.
+ * @returns TRUE if a_hash represents a block of zeros, FALSE otherwise.
+ */
+extern gboolean is_zero_block_hash(guint8 *a_hash);
+
+
+/**
+ * @param a_hash is the reserved hash of a block of zeros.
+ * @returns the length in bytes of the block of zeros represented by
+ *          a_hash.
+ */
+extern gssize get_zero_block_hash_length(guint8 *a_hash);
+
+
+/**
+ * @param a_hash is the reserved hash of a block of zeros.
+ * @returns TRUE if the block of zeros represented by a_hash is at most
+ *          BLOCK_MAX_SIZE bytes long and FALSE otherwise.
+ */
+extern gboolean is_zero_block_length_valid(guint8 *a_hash);
+
+
+/**
+ * Makes the data of a block of zeros from its reserved hash.
+ * @param a_hash is the reserved hash of a block of zeros (it is copied).
+ * @returns a newly allocated hash_data_t structure with uncompressed
+ *          zeros that must be freed with free_hash_data_t() or NULL if
+ *          the block is longer than BLOCK_MAX_SIZE.
+ */
+extern hash_data_t *new_zero_block_hash_data_t(guint8 *a_hash);
+
+
+/**
+ * Moves a stream being written forward by the length of a block of
+ * zeros instead of writing them: seeking after the end of the file
+ * makes a hole there.
+ * @param stream is the stream of the file being written.
+ * @param a_hash is the reserved hash of a block of zeros.
+ * @returns TRUE if the stream has been moved forward and FALSE otherwise.
+ */
+extern gboolean skip_zero_block_in_stream(GFileOutputStream *stream, guint8 *a_hash);
+
+
+/**
+ * Sets the size of a file that ends with blocks skipped by
+ * skip_zero_block_in_stream(): nothing has been written to set it.
+ * @param stream is the stream of the file being written.
+ * @returns TRUE if the size of the file has been set and FALSE otherwise.
+ */
+extern gboolean end_stream_with_hole(GFileOutputStream *stream);
+
 #endif /* #ifndef _HASHS_H_ */
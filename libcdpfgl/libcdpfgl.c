@@ -164,7 +164,7 @@ gchar *buffer_libraries_versions(gchar *name)
                     free_variable(buffer);
                 }
 
-            buffer = g_strdup_printf(_("%s\t. %s version: %s\n\t. JANSSON version: %d.%d.%d\n\t. ZLIB version: %s"), buf1, DATABASE_NAME, db_version(), JANSSON_MAJOR_VERSION, JANSSON_MINOR_VERSION, JANSSON_MICRO_VERSION, ZLIB_VERSION);
+            buffer = g_strdup_printf(_("%s\t. %s version: %s\n\t. JANSSON version: %d.%d.%d\n\t. ZLIB version: %s\n\t. SHA256 engine: %s"), buf1, DATABASE_NAME, db_version(), JANSSON_MAJOR_VERSION, JANSSON_MINOR_VERSION, JANSSON_MICRO_VERSION, ZLIB_VERSION, sha256_get_engine_name());
             free_variable(buf1);
         }
 
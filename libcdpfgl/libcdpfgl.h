@@ -32,6 +32,11 @@
 /* Configuration from ./configure script */
 #include "config.h"
 
+/* SEEK_DATA and SEEK_HOLE are needed to find holes in sparse files */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #define MHD_PLATFORM_H
 #include <stdio.h>
 #include <stdlib.h>
@@ -51,16 +56,36 @@
 #include <curl/curl.h>
 #include <ctype.h>
 #include <zlib.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
 
 #include "configuration.h"
 #include "files.h"
 #include "hashs.h"
 #include "communique.h"
+#include "spool.h"
 #include "database.h"
 #include "packing.h"
 #include "query.h"
 #include "clock.h"
 #include "compress.h"
+#include "reader.h"
+#include "chunking.h"
+#include "framing.h"
+#include "sha256.h"
 #include "options.h"
 
 /**
@@ -458,7 +458,8 @@ json_t *convert_meta_data_list_to_json_array(GList *list, gchar *hostname, gbool
 
 
 /**
- * Converts to a json gchar * string. Used only by server's program
+ * Converts to a json gchar * string. Used only by server's program.
+ * The "protocols" array tells clients which protocols the server speaks.
  * @param name : name of the program of which we want to print the version.
  * @param date : publication date of this version
  * @param version : version of the program.
@@ -473,6 +474,7 @@ gchar *convert_version_to_json(gchar *name, gchar *date, gchar *version, gchar *
     json_t *libs = NULL;    /** json_t *libs is the array that will contain all libraries and versions */
     json_t *auths = NULL;   /** json_t *auths is the array containing all authors                      */
     json_t *objs = NULL;    /** json_t *objs will store version of libraries                           */
+    json_t *protos = NULL;  /** json_t *protos is the array of protocols spoken by the server          */
     gchar *buffer = NULL;
     gchar *json_str = NULL; /** gchar *json_str is the string to be returned at the end                */
 
@@ -534,6 +536,12 @@ gchar *convert_version_to_json(gchar *name, gchar *date, gchar *version, gchar *
 
     insert_json_value_into_json_root(root, "librairies", libs);
 
+    /* Clients that do not know this array keep on using JSON */
+    protos = json_array();
+    json_array_append_new(protos, json_string(PROTOCOL_JSON));
+    json_array_append_new(protos, json_string(PROTOCOL_BINARY));
+    insert_json_value_into_json_root(root, "protocols", protos);
+
     json_str = json_dumps(root, 0);
 
     json_decref(root);
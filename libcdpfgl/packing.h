@@ -316,7 +316,20 @@ extern gchar *get_json_version(gchar *json_str);
 
 
 /**
- * Converts to a json gchar * string. Used only by server's program
+ * Tells whether a version json string as returned by server's server
+ * advertises a protocol in its "protocols" array.
+ * @param json_str : a gchar * containing the JSON formated string.
+ * @param protocol : the name of the protocol (PROTOCOL_BINARY for
+ *        instance).
+ * @returns TRUE if protocol is in the array and FALSE otherwise (older
+ *          servers have no such array).
+ */
+extern gboolean is_protocol_in_json_version(gchar *json_str, gchar *protocol);
+
+
+/**
+ * Converts to a json gchar * string. Used only by server's program.
+ * The "protocols" array tells clients which protocols the server speaks.
  * @param name : name of the program of which we want to print the version.
  * @param date : publication date of this version
  * @param version : version of the program.
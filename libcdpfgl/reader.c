@@ -0,0 +1,819 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    reader.c
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file reader.c
+ * This file contains functions to read files sequentially. With io_uring
+ * the file is read by slots of READER_SLOT_SIZE bytes and up to 'depth'
+ * slots are read in advance while the caller consumes the first one.
+ * Slots are used in a circular way and always consumed in file order
+ * whatever the order in which reads complete.
+ */
+
+#include "libcdpfgl.h"
+
+static void set_reader_error(GError **error, gint err, gchar *filename);
+static gboolean is_sparse(struct stat *st);
+#ifdef HAVE_LIBURING
+static gboolean submit_slot_read(reader_t *reader, guint index);
+static void fill_reader_ring(reader_t *reader);
+static gint wait_reader_completion(reader_t *reader);
+static void drain_reader_ring(reader_t *reader);
+static gboolean uring_read_all(reader_t *reader, guchar *buffer, gsize count, gsize *bytes_read, GError **error);
+static gboolean uring_skip_hole(reader_t *reader, gint64 target, GError **error);
+#endif
+static gboolean read_data(reader_t *reader, guchar *buffer, gsize count, gsize *bytes_read, GError **error);
+static void locate_hole(reader_t *reader);
+static gboolean skip_hole(reader_t *reader, gsize count, GError **error);
+static gboolean sparse_read_all(reader_t *reader, guchar *buffer, gsize count, gsize *bytes_read, GError **error);
+
+
+/**
+ * Sets error from an errno value.
+ * @param[out] error is the GError to be set (may be NULL).
+ * @param err is an errno value.
+ * @param filename is the name of the file concerned (may be NULL).
+ */
+static void set_reader_error(GError **error, gint err, gchar *filename)
+{
+    if (filename != NULL)
+        {
+            g_set_error(error, G_IO_ERROR, g_io_error_from_errno(err), _("Error with file '%s': %s"), filename, g_strerror(err));
+        }
+    else
+        {
+            g_set_error(error, G_IO_ERROR, g_io_error_from_errno(err), "%s", g_strerror(err));
+        }
+}
+
+
+/**
+ * Tells whether a file may have holes: less blocks are allocated than
+ * what its size needs.
+ * @param st is the stat structure of the file.
+ * @returns TRUE if the file is sparse, FALSE otherwise.
+ */
+static gboolean is_sparse(struct stat *st)
+{
+    /* st_blocks is always in 512 bytes units */
+    return (st->st_blocks * 512 < st->st_size);
+}
+
+
+/**
+ * Creates a new reader.
+ * @param depth is the number of reads that may be kept in flight. 0 or
+ *        1 means that files will be read with GIO one block at a time.
+ * @returns a newly allocated reader_t that must be freed with
+ *          free_reader_t() when no longer needed.
+ */
+reader_t *new_reader_t(guint depth)
+{
+    reader_t *reader = NULL;
+#ifdef HAVE_LIBURING
+    guint i = 0;
+    gint ret = 0;
+#endif
+
+    reader = (reader_t *) g_malloc0(sizeof(reader_t));
+    g_assert_nonnull(reader);
+
+    reader->depth = MAX(depth, 1);
+    reader->uring = FALSE;
+    reader->slots = NULL;
+    reader->fd = -1;
+    reader->stream = NULL;
+    reader->sparse_fd = -1;
+
+#ifdef HAVE_LIBURING
+    if (reader->depth > 1)
+        {
+            ret = io_uring_queue_init(reader->depth, &reader->ring, 0);
+
+            if (ret == 0)
+                {
+                    reader->uring = TRUE;
+                    reader->slots = (reader_slot_t *) g_malloc0(reader->depth * sizeof(reader_slot_t));
+                    g_assert_nonnull(reader->slots);
+
+                    for (i = 0; i < reader->depth; i++)
+                        {
+                            reader->slots[i].buffer = (guchar *) g_malloc(READER_SLOT_SIZE);
+                            g_assert_nonnull(reader->slots[i].buffer);
+                            reader->slots[i].state = READER_SLOT_FREE;
+                        }
+                }
+            else
+                {
+                    /* Old kernel or io_uring forbidden (seccomp, sysctl...) */
+                    print_debug(_("io_uring not available (%s): using GIO to read files\n"), g_strerror(-ret));
+                }
+        }
+#endif
+
+    return reader;
+}
+
+
+/**
+ * Frees a reader and closes the file that it may have opened.
+ * @param reader is the reader to be freed.
+ */
+void free_reader_t(reader_t *reader)
+{
+    guint i = 0;
+
+    if (reader != NULL)
+        {
+            reader_close(reader);
+
+            if (reader->slots != NULL)
+                {
+                    for (i = 0; i < reader->depth; i++)
+                        {
+                            free_variable(reader->slots[i].buffer);
+                        }
+                    free_variable(reader->slots);
+                }
+
+#ifdef HAVE_LIBURING
+            if (reader->uring == TRUE)
+                {
+                    io_uring_queue_exit(&reader->ring);
+                }
+#endif
+
+            free_variable(reader);
+        }
+}
+
+
+#ifdef HAVE_LIBURING
+/**
+ * Submits (without calling io_uring_submit) a read for the missing part
+ * of a slot. slot->offset and slot->len must already be set.
+ * @param reader is the reader.
+ * @param index is the index of the slot in reader->slots.
+ * @returns TRUE if the read has been queued, FALSE if the ring is full.
+ */
+static gboolean submit_slot_read(reader_t *reader, guint index)
+{
+    struct io_uring_sqe *sqe = NULL;
+    reader_slot_t *slot = &reader->slots[index];
+
+    sqe = io_uring_get_sqe(&reader->ring);
+
+    if (sqe != NULL)
+        {
+            io_uring_prep_read(sqe, reader->fd, slot->buffer + slot->len, READER_SLOT_SIZE - slot->len, slot->offset + slot->len);
+            io_uring_sqe_set_data(sqe, GUINT_TO_POINTER(index));
+            slot->state = READER_SLOT_PENDING;
+            reader->in_flight = reader->in_flight + 1;
+
+            return TRUE;
+        }
+    else
+        {
+            return FALSE;
+        }
+}
+
+
+/**
+ * Submits reads for all free slots following the ones already in use.
+ * Nothing is read after the size that the file had when it was opened
+ * except one read when every slot has been consumed: it tells whether
+ * the file has grown or if the end of the file has really been reached.
+ * @param reader is the reader.
+ */
+static void fill_reader_ring(reader_t *reader)
+{
+    reader_slot_t *slot = NULL;
+    guint index = reader->current;
+    guint count = 0;
+    guint submitted = 0;
+    gboolean stop = FALSE;
+
+    while (count < reader->depth && reader->eof == FALSE && stop == FALSE)
+        {
+            slot = &reader->slots[index];
+
+            if (slot->state == READER_SLOT_FREE)
+                {
+                    if (reader->next_offset >= reader->size_hint && index != reader->current)
+                        {
+                            stop = TRUE;
+                        }
+                    else
+                        {
+                            slot->offset = reader->next_offset;
+                            slot->len = 0;
+                            slot->err = 0;
+
+                            if (submit_slot_read(reader, index) == TRUE)
+                                {
+                                    reader->next_offset = reader->next_offset + READER_SLOT_SIZE;
+                                    submitted = submitted + 1;
+                                }
+                            else
+                                {
+                                    stop = TRUE;
+                                }
+                        }
+                }
+
+            index = (index + 1) % reader->depth;
+            count = count + 1;
+        }
+
+    if (submitted > 0)
+        {
+            io_uring_submit(&reader->ring);
+        }
+}
+
+
+/**
+ * Waits for one read to complete and updates its slot. A short read
+ * before the end of the file is resubmitted for its missing part.
+ * @param reader is the reader.
+ * @returns 0 on success or an errno value if waiting failed.
+ */
+static gint wait_reader_completion(reader_t *reader)
+{
+    struct io_uring_cqe *cqe = NULL;
+    reader_slot_t *slot = NULL;
+    guint index = 0;
+    gint res = 0;
+    gint ret = 0;
+
+    do
+        {
+            ret = io_uring_wait_cqe(&reader->ring, &cqe);
+        }
+    while (ret == -EINTR);
+
+    if (ret < 0)
+        {
+            return -ret;
+        }
+
+    index = GPOINTER_TO_UINT(io_uring_cqe_get_data(cqe));
+    res = cqe->res;
+    io_uring_cqe_seen(&reader->ring, cqe);
+
+    reader->in_flight = reader->in_flight - 1;
+    slot = &reader->slots[index];
+
+    if (res == -EINTR || res == -EAGAIN)
+        {
+            submit_slot_read(reader, index);
+            io_uring_submit(&reader->ring);
+        }
+    else if (res < 0)
+        {
+            slot->err = -res;
+            slot->state = READER_SLOT_DONE;
+        }
+    else
+        {
+            slot->len = slot->len + res;
+
+            if (res == 0 || slot->len == READER_SLOT_SIZE || slot->offset + (gint64) slot->len >= reader->size_hint)
+                {
+                    slot->state = READER_SLOT_DONE;
+                }
+            else
+                {
+                    /* Short read in the middle of the file: reads the rest */
+                    submit_slot_read(reader, index);
+                    io_uring_submit(&reader->ring);
+                }
+        }
+
+    return 0;
+}
+
+
+/**
+ * Waits for all reads in flight and frees every slot: data already read
+ * is thrown away.
+ * @param reader is the reader.
+ */
+static void drain_reader_ring(reader_t *reader)
+{
+    guint i = 0;
+
+    /* Buffers may not be reused while the kernel still writes into them */
+    while (reader->in_flight > 0 && wait_reader_completion(reader) == 0)
+        {
+            /* Only waiting: data is thrown away */
+        }
+
+    for (i = 0; i < reader->depth; i++)
+        {
+            reader->slots[i].state = READER_SLOT_FREE;
+        }
+
+    reader->current = 0;
+    reader->pos = 0;
+}
+
+
+/**
+ * Reads count bytes from slots filled by io_uring.
+ * @param reader is the reader to read from.
+ * @param buffer is a buffer of at least count bytes.
+ * @param count is the number of bytes wanted.
+ * @param[out] bytes_read is the number of bytes copied into buffer.
+ * @param[out] error is set when an error occured.
+ * @returns TRUE on success and FALSE on error.
+ */
+static gboolean uring_read_all(reader_t *reader, guchar *buffer, gsize count, gsize *bytes_read, GError **error)
+{
+    reader_slot_t *slot = NULL;
+    gsize total = 0;
+    gsize n = 0;
+    gint err = 0;
+
+    while (total < count && reader->eof == FALSE)
+        {
+            slot = &reader->slots[reader->current];
+
+            if (slot->state == READER_SLOT_FREE)
+                {
+                    fill_reader_ring(reader);
+                }
+
+            while (slot->state == READER_SLOT_PENDING && err == 0)
+                {
+                    err = wait_reader_completion(reader);
+                }
+
+            if (err != 0 || slot->err != 0)
+                {
+                    set_reader_error(error, err != 0 ? err : slot->err, NULL);
+                    *bytes_read = total;
+                    return FALSE;
+                }
+
+            if (slot->state == READER_SLOT_FREE)
+                {
+                    /* Nothing could be submitted */
+                    reader->eof = TRUE;
+                }
+            else
+                {
+                    n = MIN(slot->len - reader->pos, count - total);
+                    memcpy(buffer + total, slot->buffer + reader->pos, n);
+                    reader->pos = reader->pos + n;
+                    total = total + n;
+
+                    if (reader->pos >= slot->len)
+                        {
+                            if (slot->len < READER_SLOT_SIZE)
+                                {
+                                    reader->eof = TRUE;
+                                }
+
+                            slot->state = READER_SLOT_FREE;
+                            reader->pos = 0;
+                            reader->current = (reader->current + 1) % reader->depth;
+                            fill_reader_ring(reader);
+                        }
+                }
+        }
+
+    *bytes_read = total;
+
+    return TRUE;
+}
+
+
+/**
+ * Moves the slots of the ring to target, a position in the hole that
+ * begins at reader->offset. Slots that are entirely in the hole are
+ * thrown away (the ones still in flight are waited for as their buffer
+ * is reused). When every slot has been thrown away the next reads are
+ * submitted from the end of the hole (the SEEK_DATA position) so that
+ * nothing else in the hole is read. Slots after the hole are kept.
+ * @param reader is the reader.
+ * @param target is the position where reading resumes.
+ * @param[out] error is set when an error occured.
+ * @returns TRUE on success and FALSE on error.
+ */
+static gboolean uring_skip_hole(reader_t *reader, gint64 target, GError **error)
+{
+    reader_slot_t *slot = &reader->slots[reader->current];
+    gint err = 0;
+
+    while (slot->state != READER_SLOT_FREE && slot->offset + READER_SLOT_SIZE <= target && err == 0)
+        {
+            while (slot->state == READER_SLOT_PENDING && err == 0)
+                {
+                    err = wait_reader_completion(reader);
+                }
+
+            if (err == 0)
+                {
+                    slot->state = READER_SLOT_FREE;
+                    reader->pos = 0;
+                    reader->current = (reader->current + 1) % reader->depth;
+                    slot = &reader->slots[reader->current];
+                }
+        }
+
+    while (slot->state == READER_SLOT_PENDING && slot->offset < target && err == 0)
+        {
+            /* target is in this slot: its length is needed */
+            err = wait_reader_completion(reader);
+        }
+
+    if (err != 0 || (slot->state == READER_SLOT_DONE && slot->err != 0))
+        {
+            set_reader_error(error, err != 0 ? err : slot->err, NULL);
+            return FALSE;
+        }
+
+    if (slot->state == READER_SLOT_FREE)
+        {
+            /* Every read submitted was in the hole */
+            reader->next_offset = MAX(reader->hole_end, target);
+            reader->eof = FALSE;
+            fill_reader_ring(reader);
+        }
+    else if (slot->offset + (gint64) reader->pos < target)
+        {
+            reader->pos = MIN((gsize) (target - slot->offset), slot->len);
+        }
+
+    return TRUE;
+}
+#endif
+
+
+/**
+ * Opens a file to be read. Any previously opened file is closed.
+ * @param reader is the reader to use.
+ * @param a_file is the file to be read.
+ * @param[out] error is set when the file can not be opened.
+ * @returns TRUE on success and FALSE on error.
+ */
+gboolean reader_open(reader_t *reader, GFile *a_file, GError **error)
+{
+    GFileInputStream *stream = NULL;
+    gchar *filename = NULL;
+    struct stat st;
+#ifdef HAVE_LIBURING
+    gint err = 0;
+#endif
+
+    g_assert_nonnull(reader);
+    g_assert_nonnull(a_file);
+
+    reader_close(reader);
+
+    filename = g_file_get_path(a_file);
+    reader->size_hint = 0;
+    reader->offset = 0;
+    reader->hole_end = 0;
+    reader->data_end = 0;
+
+#ifdef HAVE_LIBURING
+    if (reader->uring == TRUE && filename != NULL)
+        {
+            reader->fd = open(filename, O_RDONLY | O_CLOEXEC);
+
+            if (reader->fd < 0)
+                {
+                    err = errno;
+                    set_reader_error(error, err, filename);
+                    free_variable(filename);
+                    return FALSE;
+                }
+
+            if (fstat(reader->fd, &st) == 0)
+                {
+                    reader->size_hint = st.st_size;
+
+                    if (is_sparse(&st) == TRUE)
+                        {
+                            reader->sparse_fd = reader->fd;
+                        }
+                }
+
+            posix_fadvise(reader->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+            reader->next_offset = 0;
+            reader->current = 0;
+            reader->pos = 0;
+            reader->in_flight = 0;
+            reader->eof = FALSE;
+            fill_reader_ring(reader);
+
+            free_variable(filename);
+
+            return TRUE;
+        }
+#endif
+
+    stream = g_file_read(a_file, NULL, error);
+
+    if (stream != NULL)
+        {
+            reader->stream = (GInputStream *) stream;
+
+            if (filename != NULL && stat(filename, &st) == 0)
+                {
+                    reader->size_hint = st.st_size;
+
+                    if (is_sparse(&st) == TRUE)
+                        {
+                            /* Only used with SEEK_DATA and SEEK_HOLE: the stream is used to read */
+                            reader->sparse_fd = open(filename, O_RDONLY | O_CLOEXEC);
+                        }
+                }
+
+            free_variable(filename);
+
+            return TRUE;
+        }
+    else
+        {
+            free_variable(filename);
+
+            return FALSE;
+        }
+}
+
+
+/**
+ * Reads count bytes of data from the opened file into buffer.
+ * @param reader is the reader to read from.
+ * @param buffer is a buffer of at least count bytes.
+ * @param count is the number of bytes wanted.
+ * @param[out] bytes_read is the number of bytes copied into buffer.
+ * @param[out] error is set when an error occured.
+ * @returns TRUE on success and FALSE on error.
+ */
+static gboolean read_data(reader_t *reader, guchar *buffer, gsize count, gsize *bytes_read, GError **error)
+{
+    if (reader->stream != NULL)
+        {
+            return g_input_stream_read_all(reader->stream, buffer, count, bytes_read, NULL, error);
+        }
+#ifdef HAVE_LIBURING
+    else if (reader->fd >= 0)
+        {
+            return uring_read_all(reader, buffer, count, bytes_read, error);
+        }
+#endif
+    else
+        {
+            set_reader_error(error, EBADF, NULL);
+            return FALSE;
+        }
+}
+
+
+/**
+ * Finds the hole that begins at reader->offset (if any) and the data
+ * that follows it.
+ * @param reader is a reader on a sparse file.
+ */
+static void locate_hole(reader_t *reader)
+{
+    off_t data = 0;
+    off_t hole = 0;
+
+    data = lseek(reader->sparse_fd, reader->offset, SEEK_DATA);
+
+    if (data < 0)
+        {
+            if (errno == ENXIO)
+                {
+                    /* No more data: the end of the file is a hole */
+                    reader->hole_end = MAX(reader->size_hint, reader->offset);
+                }
+            else
+                {
+                    /* SEEK_DATA not supported by the filesystem: everything is data */
+                    reader->hole_end = reader->offset;
+                }
+
+            reader->data_end = G_MAXINT64;
+        }
+    else
+        {
+            hole = lseek(reader->sparse_fd, data, SEEK_HOLE);
+            reader->hole_end = data;
+
+            if (hole > data)
+                {
+                    reader->data_end = hole;
+                }
+            else
+                {
+                    reader->data_end = G_MAXINT64;
+                }
+        }
+}
+
+
+/**
+ * Moves the read position count bytes forward without reading anything.
+ * @param reader is the reader.
+ * @param count is the number of bytes to skip.
+ * @param[out] error is set when an error occured.
+ * @returns TRUE on success and FALSE on error.
+ */
+static gboolean skip_hole(reader_t *reader, gsize count, GError **error)
+{
+    gssize skipped = 0;
+
+    if (reader->stream != NULL)
+        {
+            do
+                {
+                    skipped = g_input_stream_skip(reader->stream, count, NULL, error);
+
+                    if (skipped > 0)
+                        {
+                            count = count - skipped;
+                        }
+                }
+            while (count > 0 && skipped > 0);
+
+            return (skipped >= 0);
+        }
+#ifdef HAVE_LIBURING
+    else if (reader->fd >= 0)
+        {
+            return uring_skip_hole(reader, reader->offset + count, error);
+        }
+#endif
+    else
+        {
+            set_reader_error(error, EBADF, NULL);
+            return FALSE;
+        }
+}
+
+
+/**
+ * Reads count bytes from a sparse file: holes are skipped and filled
+ * with zeros in buffer.
+ * @param reader is a reader on a sparse file.
+ * @param buffer is a buffer of at least count bytes.
+ * @param count is the number of bytes wanted.
+ * @param[out] bytes_read is the number of bytes copied into buffer.
+ * @param[out] error is set when an error occured.
+ * @returns TRUE on success and FALSE on error.
+ */
+static gboolean sparse_read_all(reader_t *reader, guchar *buffer, gsize count, gsize *bytes_read, GError **error)
+{
+    gsize total = 0;
+    gsize wanted = 0;
+    gsize got = 0;
+    gboolean success = TRUE;
+    gboolean eof = FALSE;
+
+    while (total < count && success == TRUE && eof == FALSE)
+        {
+            if (reader->offset >= reader->hole_end && reader->offset >= reader->data_end)
+                {
+                    locate_hole(reader);
+                }
+
+            got = 0;
+
+            if (reader->offset < reader->hole_end)
+                {
+                    wanted = MIN((guint64) (reader->hole_end - reader->offset), count - total);
+                    success = skip_hole(reader, wanted, error);
+
+                    if (success == TRUE)
+                        {
+                            memset(buffer + total, 0, wanted);
+                            got = wanted;
+                        }
+                }
+            else
+                {
+                    wanted = MIN((guint64) (reader->data_end - reader->offset), count - total);
+                    success = read_data(reader, buffer + total, wanted, &got, error);
+
+                    if (got < wanted)
+                        {
+                            eof = TRUE;
+                        }
+                }
+
+            total = total + got;
+            reader->offset = reader->offset + got;
+        }
+
+    *bytes_read = total;
+
+    return success;
+}
+
+
+/**
+ * Reads count bytes from the opened file into buffer. Less than count
+ * bytes are read only when the end of the file is reached.
+ * @param reader is the reader to read from.
+ * @param buffer is a buffer of at least count bytes.
+ * @param count is the number of bytes wanted.
+ * @param[out] bytes_read is the number of bytes copied into buffer.
+ * @param[out] error is set when an error occured.
+ * @returns TRUE on success and FALSE on error.
+ */
+gboolean reader_read_all(reader_t *reader, guchar *buffer, gsize count, gsize *bytes_read, GError **error)
+{
+    g_assert_nonnull(reader);
+    g_assert_nonnull(bytes_read);
+
+    *bytes_read = 0;
+
+    if (reader->sparse_fd >= 0)
+        {
+            return sparse_read_all(reader, buffer, count, bytes_read, error);
+        }
+    else
+        {
+            return read_data(reader, buffer, count, bytes_read, error);
+        }
+}
+
+
+/**
+ * Closes the file opened by the reader. Reads still in flight are
+ * waited for before returning.
+ * @param reader is the reader whose file has to be closed.
+ */
+void reader_close(reader_t *reader)
+{
+    if (reader != NULL)
+        {
+            if (reader->sparse_fd >= 0 && reader->sparse_fd != reader->fd)
+                {
+                    close(reader->sparse_fd);
+                }
+
+            reader->sparse_fd = -1;
+
+            if (reader->stream != NULL)
+                {
+                    g_input_stream_close(reader->stream, NULL, NULL);
+                    free_object(reader->stream);
+                    reader->stream = NULL;
+                }
+
+#ifdef HAVE_LIBURING
+            if (reader->fd >= 0)
+                {
+                    drain_reader_ring(reader);
+                    close(reader->fd);
+                    reader->fd = -1;
+                }
+#endif
+        }
+}
+
+
+/**
+ * @param reader is a reader.
+ * @returns a constant string with the name of the engine used by
+ *          reader. It must not be freed.
+ */
+const gchar *reader_get_engine_name(reader_t *reader)
+{
+    if (reader != NULL && reader->uring == TRUE)
+        {
+            return "io_uring";
+        }
+    else
+        {
+            return "GIO";
+        }
+}
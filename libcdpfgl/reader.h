@@ -0,0 +1,167 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    reader.h
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file reader.h
+ *
+ * This file contains definitions of the reader used to read files
+ * sequentially. When compiled with liburing and if the kernel allows it
+ * several reads are kept in flight with io_uring so that disk latency
+ * overlaps with hashing and compression. Otherwise GIO is used.
+ * Holes of sparse files are found with SEEK_DATA / SEEK_HOLE and are
+ * returned as zeros without being read.
+ */
+
+#ifndef _READER_H_
+#define _READER_H_
+
+
+/**
+ * @def READER_DEFAULT_DEPTH
+ * Default number of reads kept in flight by a reader.
+ */
+#define READER_DEFAULT_DEPTH (8)
+
+
+/**
+ * @def READER_SLOT_SIZE
+ * Size in bytes of each read submitted to io_uring (256 KB).
+ */
+#define READER_SLOT_SIZE (262144)
+
+
+/**
+ * @def READER_SLOT_FREE
+ * The slot is not used
+ *
+ * @def READER_SLOT_PENDING
+ * A read has been submitted and is not completed yet
+ *
+ * @def READER_SLOT_DONE
+ * The read is completed and data may be consumed
+ */
+#define READER_SLOT_FREE (0)
+#define READER_SLOT_PENDING (1)
+#define READER_SLOT_DONE (2)
+
+
+/**
+ * @struct reader_slot_t
+ * @brief One read submitted to io_uring and its buffer.
+ */
+typedef struct
+{
+    guchar *buffer;     /**< READER_SLOT_SIZE bytes buffer                           */
+    gint64 offset;      /**< offset in the file of the first byte of buffer          */
+    gsize len;          /**< number of valid bytes in buffer                         */
+    gint state;         /**< READER_SLOT_FREE, READER_SLOT_PENDING or READER_SLOT_DONE */
+    gint err;           /**< errno value if the read failed (0 otherwise)            */
+} reader_slot_t;
+
+
+/**
+ * @struct reader_t
+ * @brief Reads files one after the other. A reader is meant to be used
+ *        by only one thread and reused for every file this thread
+ *        reads (the ring and buffers are allocated only once).
+ */
+typedef struct
+{
+    guint depth;             /**< number of slots (reads that may be in flight)              */
+    gboolean uring;          /**< TRUE when io_uring is used, FALSE when GIO is used          */
+#ifdef HAVE_LIBURING
+    struct io_uring ring;    /**< io_uring instance (only valid when uring is TRUE)           */
+#endif
+    reader_slot_t *slots;    /**< depth slots used in a circular way                          */
+    gint fd;                 /**< file descriptor of the opened file (io_uring) or -1         */
+    GInputStream *stream;    /**< stream of the opened file (GIO) or NULL                     */
+    gint64 size_hint;        /**< size of the file when opened: reads are not submitted after */
+    gint64 next_offset;      /**< offset of the next read to be submitted                     */
+    guint current;           /**< slot being consumed                                         */
+    gsize pos;               /**< position of the next byte to be consumed in current slot   */
+    guint in_flight;         /**< number of submitted reads not yet completed                 */
+    gboolean eof;            /**< TRUE once a read returned less than what was asked          */
+    gint sparse_fd;          /**< descriptor used to find holes (-1 when the file is not sparse) */
+    gint64 offset;           /**< offset of the next byte returned when the file is sparse    */
+    gint64 hole_end;         /**< end of the hole that contains offset (offset if none)       */
+    gint64 data_end;         /**< end of the data that follows the hole (start of next hole)  */
+} reader_t;
+
+
+/**
+ * Creates a new reader.
+ * @param depth is the number of reads that may be kept in flight. 0 or
+ *        1 means that files will be read with GIO one block at a time.
+ * @returns a newly allocated reader_t that must be freed with
+ *          free_reader_t() when no longer needed.
+ */
+extern reader_t *new_reader_t(guint depth);
+
+
+/**
+ * Frees a reader and closes the file that it may have opened.
+ * @param reader is the reader to be freed.
+ */
+extern void free_reader_t(reader_t *reader);
+
+
+/**
+ * Opens a file to be read. Any previously opened file is closed.
+ * @param reader is the reader to use.
+ * @param a_file is the file to be read.
+ * @param[out] error is set when the file can not be opened.
+ * @returns TRUE on success and FALSE on error.
+ */
+extern gboolean reader_open(reader_t *reader, GFile *a_file, GError **error);
+
+
+/**
+ * Reads count bytes from the opened file into buffer. Less than count
+ * bytes are read only when the end of the file is reached. Holes are
+ * filled with zeros without any read.
+ * @param reader is the reader to read from.
+ * @param buffer is a buffer of at least count bytes.
+ * @param count is the number of bytes wanted.
+ * @param[out] bytes_read is the number of bytes copied into buffer.
+ * @param[out] error is set when an error occured.
+ * @returns TRUE on success and FALSE on error.
+ */
+extern gboolean reader_read_all(reader_t *reader, guchar *buffer, gsize count, gsize *bytes_read, GError **error);
+
+
+/**
+ * Closes the file opened by the reader. Reads still in flight are
+ * waited for before returning.
+ * @param reader is the reader whose file has to be closed.
+ */
+extern void reader_close(reader_t *reader);
+
+
+/**
+ * @param reader is a reader.
+ * @returns a constant string with the name of the engine used by
+ *          reader. It must not be freed.
+ */
+extern const gchar *reader_get_engine_name(reader_t *reader);
+
+
+#endif /* #ifndef _READER_H_ */
@@ -0,0 +1,421 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    sha256.c
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file sha256.c
+ * This file contains the SHA256 engine used to hash blocks. Hashing is
+ * the main CPU consumer of the client so the compression function is
+ * selected once at runtime: x86 SHA extensions when the CPU has them
+ * and a portable C implementation otherwise. Padding and finalization
+ * are shared by all implementations.
+ */
+
+#include "libcdpfgl.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SHA256_HAVE_SHANI_CODE (1)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+
+/**
+ * Function template of a compression function: it processes 'blocks'
+ * blocks of 64 bytes from data and updates state.
+ */
+typedef void (* sha256_compress_func) (guint32 *state, const guchar *data, gsize blocks);
+
+
+/**
+ * @struct sha256_engine_t
+ * @brief Selected engine (filled once and only once)
+ */
+typedef struct
+{
+    gint engine;                   /**< SHA256_ENGINE_PORTABLE or SHA256_ENGINE_SHANI */
+    sha256_compress_func compress; /**< compression function of that engine           */
+} sha256_engine_t;
+
+
+static void sha256_portable_compress(guint32 *state, const guchar *data, gsize blocks);
+#ifdef SHA256_HAVE_SHANI_CODE
+static gboolean cpu_has_sha_extensions(void);
+static void sha256_shani_compress(guint32 *state, const guchar *data, gsize blocks);
+#endif
+static gpointer select_engine(gpointer data);
+static sha256_engine_t *get_engine(void);
+static void digest_with_compress(sha256_compress_func compress, const guchar *data, gsize len, guint8 *digest);
+
+
+/**
+ * SHA256 round constants
+ */
+static const guint32 sha256_k[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+
+/**
+ * SHA256 initial hash values
+ */
+static const guint32 sha256_iv[8] =
+{
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+
+/**
+ * Portable compression function.
+ * @param state is the current state (8 words) to be updated.
+ * @param data contains 'blocks' blocks of 64 bytes.
+ * @param blocks is the number of blocks to process.
+ */
+static void sha256_portable_compress(guint32 *state, const guchar *data, gsize blocks)
+{
+    guint32 w[64];
+    guint32 a, b, c, d, e, f, g, h;
+    guint32 s0, s1, t1, t2;
+    guint i = 0;
+
+    while (blocks > 0)
+        {
+            for (i = 0; i < 16; i++)
+                {
+                    w[i] = ((guint32) data[4*i] << 24) | ((guint32) data[4*i + 1] << 16) | ((guint32) data[4*i + 2] << 8) | ((guint32) data[4*i + 3]);
+                }
+
+            for (i = 16; i < 64; i++)
+                {
+                    s0 = ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+                    s1 = ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+                    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+                }
+
+            a = state[0];
+            b = state[1];
+            c = state[2];
+            d = state[3];
+            e = state[4];
+            f = state[5];
+            g = state[6];
+            h = state[7];
+
+            for (i = 0; i < 64; i++)
+                {
+                    s1 = ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25);
+                    t1 = h + s1 + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+                    s0 = ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22);
+                    t2 = s0 + ((a & b) ^ (a & c) ^ (b & c));
+                    h = g;
+                    g = f;
+                    f = e;
+                    e = d + t1;
+                    d = c;
+                    c = b;
+                    b = a;
+                    a = t1 + t2;
+                }
+
+            state[0] += a;
+            state[1] += b;
+            state[2] += c;
+            state[3] += d;
+            state[4] += e;
+            state[5] += f;
+            state[6] += g;
+            state[7] += h;
+
+            data = data + 64;
+            blocks = blocks - 1;
+        }
+}
+
+
+#ifdef SHA256_HAVE_SHANI_CODE
+/**
+ * Says whether the running CPU has SHA extensions (and SSSE3 and
+ * SSE4.1 that are needed by sha256_shani_compress()).
+ * @returns TRUE if sha256_shani_compress() may be used.
+ */
+static gboolean cpu_has_sha_extensions(void)
+{
+    unsigned int eax = 0;
+    unsigned int ebx = 0;
+    unsigned int ecx = 0;
+    unsigned int edx = 0;
+
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0)
+        {
+            return FALSE;
+        }
+
+    if ((ecx & bit_SSSE3) == 0 || (ecx & bit_SSE4_1) == 0)
+        {
+            return FALSE;
+        }
+
+    if (__get_cpuid_max(0, NULL) < 7)
+        {
+            return FALSE;
+        }
+
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+    /* SHA extensions are reported in bit 29 of ebx */
+    return ((ebx >> 29) & 1) == 1;
+}
+
+
+/**
+ * Compression function using x86 SHA extensions.
+ * @param state is the current state (8 words) to be updated.
+ * @param data contains 'blocks' blocks of 64 bytes.
+ * @param blocks is the number of blocks to process.
+ */
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha256_shani_compress(guint32 *state, const guchar *data, gsize blocks)
+{
+    __m128i state0, state1, msg, tmp;
+    __m128i abef_save, cdgh_save;
+    __m128i w[4];
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    guint j = 0;
+
+    /* Loads state and reorders it as ABEF / CDGH as needed by sha256rnds2 */
+    tmp = _mm_loadu_si128((const __m128i *) &state[0]);
+    state1 = _mm_loadu_si128((const __m128i *) &state[4]);
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);
+    state1 = _mm_shuffle_epi32(state1, 0x1B);
+    state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    while (blocks > 0)
+        {
+            abef_save = state0;
+            cdgh_save = state1;
+
+            /* 16 groups of 4 rounds. w[j % 4] holds message words 4j to 4j+3 */
+            for (j = 0; j < 16; j++)
+                {
+                    if (j < 4)
+                        {
+                            w[j] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 16 * j)), mask);
+                        }
+                    else
+                        {
+                            tmp = _mm_sha256msg1_epu32(w[j % 4], w[(j + 1) % 4]);
+                            tmp = _mm_add_epi32(tmp, _mm_alignr_epi8(w[(j + 3) % 4], w[(j + 2) % 4], 4));
+                            w[j % 4] = _mm_sha256msg2_epu32(tmp, w[(j + 3) % 4]);
+                        }
+
+                    msg = _mm_add_epi32(w[j % 4], _mm_loadu_si128((const __m128i *) &sha256_k[4 * j]));
+                    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+                    msg = _mm_shuffle_epi32(msg, 0x0E);
+                    state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+                }
+
+            state0 = _mm_add_epi32(state0, abef_save);
+            state1 = _mm_add_epi32(state1, cdgh_save);
+
+            data = data + 64;
+            blocks = blocks - 1;
+        }
+
+    /* Reorders ABEF / CDGH back to ABCD / EFGH */
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+
+    _mm_storeu_si128((__m128i *) &state[0], state0);
+    _mm_storeu_si128((__m128i *) &state[4], state1);
+}
+#endif
+
+
+/**
+ * Selects the fastest engine available on the running CPU.
+ * @param data is not used.
+ * @returns a pointer to the selected sha256_engine_t.
+ */
+static gpointer select_engine(gpointer data)
+{
+    static sha256_engine_t engine;
+
+    engine.engine = SHA256_ENGINE_PORTABLE;
+    engine.compress = sha256_portable_compress;
+
+#ifdef SHA256_HAVE_SHANI_CODE
+    if (cpu_has_sha_extensions() == TRUE)
+        {
+            engine.engine = SHA256_ENGINE_SHANI;
+            engine.compress = sha256_shani_compress;
+        }
+#endif
+
+    return &engine;
+}
+
+
+/**
+ * @returns the selected engine (selection is done once and only once).
+ */
+static sha256_engine_t *get_engine(void)
+{
+    static GOnce engine_once = G_ONCE_INIT;
+
+    return (sha256_engine_t *) g_once(&engine_once, select_engine, NULL);
+}
+
+
+/**
+ * Calculates the SHA256 digest of data with a compression function.
+ * @param compress is the compression function of an engine.
+ * @param data is the buffer to be hashed (may contain \0 bytes).
+ * @param len is the number of bytes of data to be hashed.
+ * @param[out] digest is a buffer of at least HASH_LEN bytes where the
+ *             binary digest will be written.
+ */
+static void digest_with_compress(sha256_compress_func compress, const guchar *data, gsize len, guint8 *digest)
+{
+    guint32 state[8];
+    guchar last[128];
+    gsize full_blocks = len / 64;
+    gsize rest = len % 64;
+    gsize last_len = 0;
+    guint64 bit_len = (guint64) len * 8;
+    guint i = 0;
+
+    memcpy(state, sha256_iv, sizeof(state));
+
+    if (full_blocks > 0)
+        {
+            compress(state, data, full_blocks);
+        }
+
+    /* Padding: 0x80, zeros and the length in bits (big endian) */
+    memset(last, 0, sizeof(last));
+    if (rest > 0)
+        {
+            memcpy(last, data + full_blocks * 64, rest);
+        }
+    last[rest] = 0x80;
+    last_len = (rest < 56) ? 64 : 128;
+
+    for (i = 0; i < 8; i++)
+        {
+            last[last_len - 1 - i] = (guchar) (bit_len >> (8 * i));
+        }
+
+    compress(state, last, last_len / 64);
+
+    for (i = 0; i < 8; i++)
+        {
+            digest[4*i] = (guint8) (state[i] >> 24);
+            digest[4*i + 1] = (guint8) (state[i] >> 16);
+            digest[4*i + 2] = (guint8) (state[i] >> 8);
+            digest[4*i + 3] = (guint8) state[i];
+        }
+}
+
+
+/**
+ * Calculates the SHA256 digest of data.
+ * @param data is the buffer to be hashed (may contain \0 bytes).
+ * @param len is the number of bytes of data to be hashed.
+ * @param[out] digest is a buffer of at least HASH_LEN bytes where the
+ *             binary digest will be written.
+ */
+void sha256_digest(const guchar *data, gsize len, guint8 *digest)
+{
+    digest_with_compress(get_engine()->compress, data, len, digest);
+}
+
+
+/**
+ * Calculates the SHA256 digest of data with a given engine instead of
+ * the one selected at runtime (to compare engines).
+ * @param engine is SHA256_ENGINE_PORTABLE or SHA256_ENGINE_SHANI.
+ * @param data is the buffer to be hashed (may contain \0 bytes).
+ * @param len is the number of bytes of data to be hashed.
+ * @param[out] digest is a buffer of at least HASH_LEN bytes where the
+ *             binary digest will be written.
+ * @returns TRUE if the digest has been calculated and FALSE if the
+ *          running CPU can not use this engine.
+ */
+gboolean sha256_digest_with_engine(gint engine, const guchar *data, gsize len, guint8 *digest)
+{
+    gboolean done = FALSE;
+
+    if (engine == SHA256_ENGINE_PORTABLE)
+        {
+            digest_with_compress(sha256_portable_compress, data, len, digest);
+            done = TRUE;
+        }
+#ifdef SHA256_HAVE_SHANI_CODE
+    else if (engine == SHA256_ENGINE_SHANI && cpu_has_sha_extensions() == TRUE)
+        {
+            digest_with_compress(sha256_shani_compress, data, len, digest);
+            done = TRUE;
+        }
+#endif
+
+    return done;
+}
+
+
+/**
+ * @returns the engine selected at runtime (SHA256_ENGINE_PORTABLE or
+ *          SHA256_ENGINE_SHANI).
+ */
+gint sha256_get_engine(void)
+{
+    return get_engine()->engine;
+}
+
+
+/**
+ * @returns a constant string with the name of the engine selected at
+ *          runtime. It must not be freed.
+ */
+const gchar *sha256_get_engine_name(void)
+{
+    if (sha256_get_engine() == SHA256_ENGINE_SHANI)
+        {
+            return "SHA-NI";
+        }
+    else
+        {
+            return "portable";
+        }
+}
@@ -0,0 +1,87 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    sha256.h
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file sha256.h
+ *
+ * This file contains definitions of the SHA256 engine used to hash
+ * blocks. The fastest implementation available on the running CPU is
+ * selected at runtime (SHA extensions on x86 or a portable one).
+ */
+
+#ifndef _SHA256_H_
+#define _SHA256_H_
+
+
+/**
+ * @def SHA256_ENGINE_PORTABLE
+ * Portable C implementation (used on every CPU)
+ */
+#define SHA256_ENGINE_PORTABLE (0)
+
+
+/**
+ * @def SHA256_ENGINE_SHANI
+ * Implementation using x86 SHA extensions (SHA-NI)
+ */
+#define SHA256_ENGINE_SHANI (1)
+
+
+/**
+ * Calculates the SHA256 digest of data.
+ * @param data is the buffer to be hashed (may contain \0 bytes).
+ * @param len is the number of bytes of data to be hashed.
+ * @param[out] digest is a buffer of at least HASH_LEN bytes where the
+ *             binary digest will be written.
+ */
+extern void sha256_digest(const guchar *data, gsize len, guint8 *digest);
+
+
+/**
+ * Calculates the SHA256 digest of data with a given engine instead of
+ * the one selected at runtime (to compare engines).
+ * @param engine is SHA256_ENGINE_PORTABLE or SHA256_ENGINE_SHANI.
+ * @param data is the buffer to be hashed (may contain \0 bytes).
+ * @param len is the number of bytes of data to be hashed.
+ * @param[out] digest is a buffer of at least HASH_LEN bytes where the
+ *             binary digest will be written.
+ * @returns TRUE if the digest has been calculated and FALSE if the
+ *          running CPU can not use this engine.
+ */
+extern gboolean sha256_digest_with_engine(gint engine, const guchar *data, gsize len, guint8 *digest);
+
+
+/**
+ * @returns the engine selected at runtime (SHA256_ENGINE_PORTABLE or
+ *          SHA256_ENGINE_SHANI).
+ */
+extern gint sha256_get_engine(void);
+
+
+/**
+ * @returns a constant string with the name of the engine selected at
+ *          runtime. It must not be freed.
+ */
+extern const gchar *sha256_get_engine_name(void);
+
+
+#endif /* #ifndef _SHA256_H_ */
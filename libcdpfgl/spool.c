@@ -0,0 +1,765 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    spool.c
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file spool.c
+ * This file contains functions to keep requests that could not be sent
+ * to the server into append only segment files and to transmit them in
+ * order when the server is reachable again. Writing a request is a
+ * single append and a segment is removed with one unlink once all its
+ * requests have been transmitted.
+ */
+
+#include "libcdpfgl.h"
+
+static gint compare_segments(gconstpointer a, gconstpointer b);
+static GArray *list_spool_segments(spool_t *spool);
+static void load_spool_index(spool_t *spool);
+static void save_spool_index(spool_t *spool);
+static guint32 compute_record_crc(gchar *url, gsize url_len, gchar *body, gsize length);
+static gboolean write_all(gint fd, guchar *buffer, gsize length);
+static gboolean read_all(gint fd, guchar *buffer, gsize length, guint64 offset);
+static void close_segment(spool_t *spool);
+static void spool_failed_post(gpointer user_data, gchar *url, gchar *body, gsize length);
+static gboolean transmit_segment(spool_drain_t *drain, comm_t *comm, guint64 seq);
+
+
+/**
+ * @param spool is the spool.
+ * @param seq is the sequence number of a segment.
+ * @returns a newly allocated filename for this segment that may be
+ *          freed when no longer needed.
+ */
+gchar *get_spool_segment_filename(spool_t *spool, guint64 seq)
+{
+    gchar *basename = NULL;
+    gchar *filename = NULL;
+
+    basename = g_strdup_printf("%016" G_GINT64_MODIFIER "x%s", seq, SPOOL_SEGMENT_SUFFIX);
+    filename = g_build_filename(spool->dirname, basename, NULL);
+    free_variable(basename);
+
+    return filename;
+}
+
+
+/**
+ * Compares two sequence numbers (for g_array_sort).
+ * @param a is a guint64 * sequence number.
+ * @param b is a guint64 * sequence number.
+ * @returns a negative value if a < b, 0 if a == b and a positive value
+ *          otherwise.
+ */
+static gint compare_segments(gconstpointer a, gconstpointer b)
+{
+    guint64 seq_a = *(guint64 *) a;
+    guint64 seq_b = *(guint64 *) b;
+
+    if (seq_a < seq_b)
+        {
+            return -1;
+        }
+    else if (seq_a > seq_b)
+        {
+            return 1;
+        }
+    else
+        {
+            return 0;
+        }
+}
+
+
+/**
+ * Lists the segments that are in the spool's directory.
+ * @param spool is the spool.
+ * @returns a newly allocated GArray of guint64 sequence numbers sorted
+ *          in increasing order. It may be freed with g_array_free().
+ */
+static GArray *list_spool_segments(spool_t *spool)
+{
+    GArray *segments = NULL;
+    GDir *dir = NULL;
+    GError *error = NULL;
+    const gchar *name = NULL;
+    guint64 seq = 0;
+
+    segments = g_array_new(FALSE, FALSE, sizeof(guint64));
+    dir = g_dir_open(spool->dirname, 0, &error);
+
+    if (dir != NULL)
+        {
+            name = g_dir_read_name(dir);
+            while (name != NULL)
+                {
+                    if (g_str_has_suffix(name, SPOOL_SEGMENT_SUFFIX))
+                        {
+                            seq = g_ascii_strtoull(name, NULL, 16);
+                            g_array_append_val(segments, seq);
+                        }
+                    name = g_dir_read_name(dir);
+                }
+            g_dir_close(dir);
+            g_array_sort(segments, compare_segments);
+        }
+    else
+        {
+            print_error(__FILE__, __LINE__, _("Unable to open spool directory %s: %s\n"), spool->dirname, error->message);
+            free_error(error);
+        }
+
+    return segments;
+}
+
+
+/**
+ * Reads the position of the first request that has not been transmitted
+ * from the index file. A missing or unreadable index means that no
+ * request of any segment has been transmitted.
+ * @param spool is the spool.
+ */
+static void load_spool_index(spool_t *spool)
+{
+    gchar *contents = NULL;
+    guint64 seq = 0;
+    guint64 offset = 0;
+
+    spool->read_seq = 0;
+    spool->read_offset = 0;
+
+    if (g_file_get_contents(spool->index_filename, &contents, NULL, NULL) == TRUE)
+        {
+            if (sscanf(contents, "%" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT, &seq, &offset) == 2)
+                {
+                    spool->read_seq = seq;
+                    spool->read_offset = offset;
+                }
+            free_variable(contents);
+        }
+}
+
+
+/**
+ * Saves the position of the first request that has not been transmitted
+ * into the index file (the file is replaced atomically).
+ * @param spool is the spool.
+ */
+static void save_spool_index(spool_t *spool)
+{
+    gchar *contents = NULL;
+    GError *error = NULL;
+
+    contents = g_strdup_printf("%" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT "\n", spool->read_seq, spool->read_offset);
+
+    if (g_file_set_contents(spool->index_filename, contents, -1, &error) == FALSE)
+        {
+            print_error(__FILE__, __LINE__, _("Unable to save spool index %s: %s\n"), spool->index_filename, error->message);
+            free_error(error);
+        }
+
+    free_variable(contents);
+}
+
+
+/**
+ * @param url is the url of a request.
+ * @param url_len is the length of url.
+ * @param body is the body of the request.
+ * @param length is the length of body.
+ * @returns the crc32 of url followed by body.
+ */
+static guint32 compute_record_crc(gchar *url, gsize url_len, gchar *body, gsize length)
+{
+    uLong crc = 0;
+    gsize done = 0;
+    gsize len = 0;
+
+    crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, (Bytef *) url, (uInt) url_len);
+
+    while (done < length)
+        {
+            len = MIN(length - done, G_MAXINT);
+            crc = crc32(crc, (Bytef *) body + done, (uInt) len);
+            done = done + len;
+        }
+
+    return (guint32) crc;
+}
+
+
+/**
+ * Writes a whole buffer into a file descriptor.
+ * @param fd is the file descriptor.
+ * @param buffer is the buffer to be written.
+ * @param length is the length of buffer.
+ * @returns TRUE if everything has been written and FALSE otherwise.
+ */
+static gboolean write_all(gint fd, guchar *buffer, gsize length)
+{
+    gsize done = 0;
+    ssize_t written = 0;
+    gboolean ok = TRUE;
+
+    while (ok == TRUE && done < length)
+        {
+            written = write(fd, buffer + done, length - done);
+
+            if (written > 0)
+                {
+                    done = done + written;
+                }
+            else if (written < 0 && errno != EINTR)
+                {
+                    ok = FALSE;
+                }
+        }
+
+    return ok;
+}
+
+
+/**
+ * Reads length bytes of a file descriptor at a given offset.
+ * @param fd is the file descriptor.
+ * @param[out] buffer is where to copy the bytes.
+ * @param length is the number of bytes to be read.
+ * @param offset is the offset of the first byte to be read.
+ * @returns TRUE if the length bytes have been read and FALSE otherwise.
+ */
+static gboolean read_all(gint fd, guchar *buffer, gsize length, guint64 offset)
+{
+    gsize done = 0;
+    ssize_t nread = 0;
+    gboolean ok = TRUE;
+
+    while (ok == TRUE && done < length)
+        {
+            nread = pread(fd, buffer + done, length - done, offset + done);
+
+            if (nread > 0)
+                {
+                    done = done + nread;
+                }
+            else if (nread == 0 || errno != EINTR)
+                {
+                    ok = FALSE;
+                }
+        }
+
+    return ok;
+}
+
+
+/**
+ * Closes the segment being written (if any): the next request will be
+ * appended to a new segment. spool->mutex must be locked.
+ * @param spool is the spool.
+ */
+static void close_segment(spool_t *spool)
+{
+    if (spool->fd >= 0)
+        {
+            close(spool->fd);
+            spool->fd = -1;
+
+            if (spool->write_size > 0)
+                {
+                    spool->closed = spool->closed + 1;
+                }
+
+            spool->write_seq = spool->write_seq + 1;
+            spool->write_size = 0;
+        }
+}
+
+
+/**
+ * Opens (and creates if needed) the spool of a cache directory. Segments
+ * left by a previous run are kept in order to be transmitted.
+ * @param dirname is the cache directory of the program.
+ * @returns a newly allocated spool_t that has to be attached to each
+ *          database connexion with db_set_spool() and freed with
+ *          free_spool_t() when no longer needed.
+ */
+spool_t *new_spool_t(gchar *dirname)
+{
+    spool_t *spool = NULL;
+    GArray *segments = NULL;
+    gchar *filename = NULL;
+    struct stat buf;
+    guint64 seq = 0;
+    guint i = 0;
+
+    if (dirname != NULL)
+        {
+            spool = (spool_t *) g_malloc0(sizeof(spool_t));
+            g_assert_nonnull(spool);
+
+            g_mutex_init(&spool->mutex);
+            spool->dirname = g_build_filename(dirname, SPOOL_DIRECTORY, NULL);
+            spool->index_filename = g_build_filename(spool->dirname, SPOOL_INDEX_FILENAME, NULL);
+            spool->fd = -1;
+            spool->write_seq = 1;
+            spool->write_size = 0;
+            spool->closed = 0;
+
+            create_directory(spool->dirname);
+            load_spool_index(spool);
+
+            /* A previous run may have left segments: they are all closed
+             * (the last one may end with a torn record) and new requests
+             * go to a new segment.
+             */
+            segments = list_spool_segments(spool);
+            for (i = 0; i < segments->len; i++)
+                {
+                    seq = g_array_index(segments, guint64, i);
+                    filename = get_spool_segment_filename(spool, seq);
+
+                    if (stat(filename, &buf) == 0 && buf.st_size == 0)
+                        {
+                            unlink(filename);
+                        }
+                    else
+                        {
+                            spool->closed = spool->closed + 1;
+                        }
+
+                    if (seq >= spool->write_seq)
+                        {
+                            spool->write_seq = seq + 1;
+                        }
+
+                    free_variable(filename);
+                }
+            g_array_free(segments, TRUE);
+
+            /* A sequence number is never used again once transmitted */
+            if (spool->read_seq >= spool->write_seq)
+                {
+                    spool->write_seq = spool->read_seq + 1;
+                }
+
+            print_debug(_("Spool %s opened with %u segment(s) to transmit\n"), spool->dirname, spool->closed);
+        }
+
+    return spool;
+}
+
+
+/**
+ * Closes the spool and frees its memory. Segments are kept on disk.
+ * @param spool is the spool to be freed.
+ */
+void free_spool_t(spool_t *spool)
+{
+    if (spool != NULL)
+        {
+            g_mutex_lock(&spool->mutex);
+            close_segment(spool);
+            g_mutex_unlock(&spool->mutex);
+
+            g_mutex_clear(&spool->mutex);
+            free_variable(spool->dirname);
+            free_variable(spool->index_filename);
+            free_variable(spool);
+        }
+}
+
+
+/**
+ * Appends a request to the spool.
+ * @param spool is the spool.
+ * @param url is the url where the request should have been POSTed.
+ * @param body is the body of the request.
+ * @param length is the length of body.
+ * @returns TRUE if the request has been written and FALSE otherwise.
+ */
+gboolean append_to_spool(spool_t *spool, gchar *url, gchar *body, gsize length)
+{
+    guchar header[SPOOL_RECORD_HEADER_LEN];
+    gchar *filename = NULL;
+    gsize url_len = 0;
+    guint32 url_len_be = 0;
+    guint64 length_be = 0;
+    guint32 crc_be = 0;
+    gboolean ok = FALSE;
+
+    if (spool != NULL && url != NULL && body != NULL)
+        {
+            url_len = strlen(url);
+            url_len_be = GUINT32_TO_BE((guint32) url_len);
+            length_be = GUINT64_TO_BE((guint64) length);
+            crc_be = GUINT32_TO_BE(compute_record_crc(url, url_len, body, length));
+
+            memcpy(header, SPOOL_RECORD_MAGIC, 4);
+            memcpy(header + 4, &url_len_be, 4);
+            memcpy(header + 8, &length_be, 8);
+            memcpy(header + 16, &crc_be, 4);
+
+            g_mutex_lock(&spool->mutex);
+
+            if (spool->fd < 0)
+                {
+                    filename = get_spool_segment_filename(spool, spool->write_seq);
+                    spool->fd = open(filename, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+                    spool->write_size = 0;
+
+                    if (spool->fd < 0)
+                        {
+                            print_error(__FILE__, __LINE__, _("Unable to open spool segment %s: %s\n"), filename, g_strerror(errno));
+                        }
+
+                    free_variable(filename);
+                }
+
+            if (spool->fd >= 0)
+                {
+                    ok = write_all(spool->fd, header, SPOOL_RECORD_HEADER_LEN) &&
+                         write_all(spool->fd, (guchar *) url, url_len) &&
+                         write_all(spool->fd, (guchar *) body, length);
+
+                    if (ok == TRUE)
+                        {
+                            spool->write_size = spool->write_size + SPOOL_RECORD_HEADER_LEN + url_len + length;
+
+                            if (spool->write_size >= SPOOL_SEGMENT_SIZE)
+                                {
+                                    close_segment(spool);
+                                }
+                        }
+                    else
+                        {
+                            /* Removes what may have been written of this record */
+                            print_error(__FILE__, __LINE__, _("Unable to write a request into spool: %s\n"), g_strerror(errno));
+                            if (ftruncate(spool->fd, spool->write_size) != 0)
+                                {
+                                    close_segment(spool);
+                                }
+                        }
+                }
+
+            g_mutex_unlock(&spool->mutex);
+        }
+
+    return ok;
+}
+
+
+/**
+ * @param spool is the spool.
+ * @returns TRUE if the spool contains requests that have not been
+ *          transmitted yet and FALSE otherwise.
+ */
+gboolean is_there_requests_in_spool(spool_t *spool)
+{
+    gboolean there_is = FALSE;
+
+    if (spool != NULL)
+        {
+            g_mutex_lock(&spool->mutex);
+            there_is = (spool->closed > 0 || spool->write_size > 0);
+            g_mutex_unlock(&spool->mutex);
+        }
+
+    return there_is;
+}
+
+
+/**
+ * Reads the record that begins at offset in a segment and checks it.
+ * @param fd is the file descriptor of the segment.
+ * @param offset is the offset of the record.
+ * @param size is the size of the segment.
+ * @param[out] url is the newly allocated url of the request.
+ * @param[out] body is the newly allocated \0 terminated body of the
+ *             request (it may contain binary data).
+ * @param[out] length is the length of body.
+ * @param[out] next is the offset of the next record.
+ * @returns TRUE if the record is complete and its crc32 is correct and
+ *          FALSE otherwise (url and body are then NULL).
+ */
+gboolean read_spool_record(gint fd, guint64 offset, guint64 size, gchar **url, gchar **body, gsize *length, guint64 *next)
+{
+    guchar header[SPOOL_RECORD_HEADER_LEN];
+    guint32 url_len = 0;
+    guint64 body_len = 0;
+    guint32 crc = 0;
+    gboolean ok = FALSE;
+
+    *url = NULL;
+    *body = NULL;
+    *length = 0;
+
+    if (offset + SPOOL_RECORD_HEADER_LEN <= size && read_all(fd, header, SPOOL_RECORD_HEADER_LEN, offset) && memcmp(header, SPOOL_RECORD_MAGIC, 4) == 0)
+        {
+            memcpy(&url_len, header + 4, 4);
+            memcpy(&body_len, header + 8, 8);
+            memcpy(&crc, header + 16, 4);
+            url_len = GUINT32_FROM_BE(url_len);
+            body_len = GUINT64_FROM_BE(body_len);
+            crc = GUINT32_FROM_BE(crc);
+            offset = offset + SPOOL_RECORD_HEADER_LEN;
+
+            if (url_len > 0 && url_len <= SPOOL_MAX_URL_LEN && offset + url_len <= size && body_len <= size - offset - url_len)
+                {
+                    *url = (gchar *) g_malloc0(url_len + 1);
+                    g_assert_nonnull(*url);
+                    *body = (gchar *) g_malloc(body_len + 1);
+                    g_assert_nonnull(*body);
+                    (*body)[body_len] = '\0';
+
+                    ok = read_all(fd, (guchar *) *url, url_len, offset) &&
+                         read_all(fd, (guchar *) *body, body_len, offset + url_len) &&
+                         compute_record_crc(*url, url_len, *body, body_len) == crc;
+
+                    *length = body_len;
+                    *next = offset + url_len + body_len;
+                }
+        }
+
+    if (ok == FALSE)
+        {
+            free_variable(*url);
+            free_variable(*body);
+            *url = NULL;
+            *body = NULL;
+            *length = 0;
+        }
+
+    return ok;
+}
+
+
+/**
+ * Failure handler of the comm_t used while the spool is transmitted: no
+ * other request is handed to the server. The request is not appended
+ * again to the spool: it is still in its segment after the position
+ * saved in the index and will be transmitted next time.
+ * @param user_data MUST be a spool_drain_t * pointer.
+ * @param url is the url of the request.
+ * @param body is the body of the request.
+ * @param length is the length of body.
+ */
+static void spool_failed_post(gpointer user_data, gchar *url, gchar *body, gsize length)
+{
+    spool_drain_t *drain = (spool_drain_t *) user_data;
+
+    if (drain != NULL)
+        {
+            drain->failed = TRUE;
+        }
+}
+
+
+/**
+ * Saves the position of the first request of a segment that has not
+ * been acknowledged yet. Every request before it has been transmitted.
+ * @param spool is the spool.
+ * @param seq is the sequence number of the segment.
+ * @param offset is the offset of that request in the segment.
+ */
+void acknowledge_spool(spool_t *spool, guint64 seq, guint64 offset)
+{
+    spool->read_seq = seq;
+    spool->read_offset = offset;
+    save_spool_index(spool);
+}
+
+
+/**
+ * Transmits the requests of a closed segment and deletes the segment
+ * when all of them have been transmitted. Requests are handed to the
+ * server without waiting for each answer and the index is saved every
+ * SPOOL_ACK_BATCH requests once the requests in flight are done so that
+ * an interrupted transmission resumes where it stopped. When a request
+ * fails the index is left at the first request of its batch: requests of
+ * that batch are transmitted again next time.
+ * @param drain is the state of the transmission.
+ * @param comm a comm_t * structure that must contain an initialized
+ *        curl_handle.
+ * @param seq is the sequence number of the segment.
+ * @returns TRUE if the segment has been transmitted and deleted and
+ *          FALSE otherwise.
+ */
+static gboolean transmit_segment(spool_drain_t *drain, comm_t *comm, guint64 seq)
+{
+    spool_t *spool = drain->spool;
+    gchar *filename = NULL;
+    gchar *url = NULL;
+    gchar *body = NULL;
+    gsize length = 0;
+    struct stat buf;
+    guint64 offset = 0;
+    guint64 acked = 0;
+    guint64 next = 0;
+    guint handed = 0;
+    gint fd = -1;
+
+    filename = get_spool_segment_filename(spool, seq);
+    fd = open(filename, O_RDONLY | O_CLOEXEC);
+
+    if (fd >= 0 && fstat(fd, &buf) == 0)
+        {
+            if (seq == spool->read_seq)
+                {
+                    offset = spool->read_offset;
+                }
+            acked = offset;
+
+            while (drain->failed == FALSE && offset < (guint64) buf.st_size)
+                {
+                    if (read_spool_record(fd, offset, buf.st_size, &url, &body, &length, &next) == TRUE)
+                        {
+                            /* body is taken by post_buffer_async(): it is
+                             * sent as it was saved, binary frames included.
+                             */
+                            comm->readbuffer = body;
+                            post_buffer_async(comm, url, length);
+                            free_variable(url);
+                            offset = next;
+                            handed = handed + 1;
+
+                            if (handed % SPOOL_ACK_BATCH == 0)
+                                {
+                                    wait_for_async_posts(comm);
+
+                                    if (drain->failed == FALSE)
+                                        {
+                                            acknowledge_spool(spool, seq, offset);
+                                            acked = offset;
+                                        }
+                                }
+                        }
+                    else
+                        {
+                            /* A torn or corrupted record: nothing after it can be trusted */
+                            print_error(__FILE__, __LINE__, _("Corrupted record in spool segment %s at offset %" G_GUINT64_FORMAT ": end of segment is dropped\n"), filename, offset);
+                            offset = buf.st_size;
+                        }
+                }
+
+            close(fd);
+            wait_for_async_posts(comm);
+
+            if (drain->failed == FALSE)
+                {
+                    unlink(filename);
+
+                    /* The position saved in this segment must not be used
+                     * in a segment that would later get the same number */
+                    acknowledge_spool(spool, seq + 1, 0);
+
+                    g_mutex_lock(&spool->mutex);
+                    if (spool->closed > 0)
+                        {
+                            spool->closed = spool->closed - 1;
+                        }
+                    g_mutex_unlock(&spool->mutex);
+                }
+            else
+                {
+                    acknowledge_spool(spool, seq, acked);
+                }
+        }
+    else
+        {
+            print_error(__FILE__, __LINE__, _("Unable to open spool segment %s: %s\n"), filename, g_strerror(errno));
+            if (fd >= 0)
+                {
+                    close(fd);
+                }
+            drain->failed = TRUE;
+        }
+
+    free_variable(filename);
+
+    return !drain->failed;
+}
+
+
+/**
+ * Transmits every request of the spool in order. Only one thread may
+ * call this function at a time. When comm has a transport up to
+ * comm->max_in_flight requests are in flight at once. The transmission
+ * stops at the first request that fails and resumes next time at the
+ * first request that has not been acknowledged.
+ * @param spool is the spool.
+ * @param comm a comm_t * structure that must contain an initialized
+ *        curl_handle. Its failure handler is replaced while requests are
+ *        transmitted.
+ * @returns TRUE if every request has been transmitted and FALSE if the
+ *          transmission stopped on an error.
+ */
+gboolean transmit_spool(spool_t *spool, comm_t *comm)
+{
+    spool_drain_t drain;
+    GArray *segments = NULL;
+    void (*save_failed)(gpointer, gchar *, gchar *, gsize) = NULL;
+    gpointer failed_data = NULL;
+    guint64 last = 0;
+    guint64 seq = 0;
+    guint i = 0;
+
+    if (spool != NULL && comm != NULL)
+        {
+            /* Requests appended from now on go to a new segment that
+             * will be transmitted next time.
+             */
+            g_mutex_lock(&spool->mutex);
+            if (spool->write_size > 0)
+                {
+                    close_segment(spool);
+                }
+            last = spool->write_seq;
+            g_mutex_unlock(&spool->mutex);
+
+            drain.spool = spool;
+            drain.failed = FALSE;
+
+            wait_for_async_posts(comm);
+            save_failed = comm->save_failed;
+            failed_data = comm->failed_data;
+            set_comm_failure_handler(comm, spool_failed_post, &drain);
+
+            segments = list_spool_segments(spool);
+            for (i = 0; drain.failed == FALSE && i < segments->len; i++)
+                {
+                    seq = g_array_index(segments, guint64, i);
+
+                    if (seq < last)
+                        {
+                            transmit_segment(&drain, comm, seq);
+                        }
+                }
+            g_array_free(segments, TRUE);
+
+            set_comm_failure_handler(comm, save_failed, failed_data);
+
+            return !drain.failed;
+        }
+    else
+        {
+            return FALSE;
+        }
+}
@@ -0,0 +1,208 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    spool.h
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file spool.h
+ *
+ * This file contains definitions of the spool where requests that could
+ * not be sent to the server are kept until it comes back. Requests are
+ * appended to segment files (SPOOL_SEGMENT_SIZE bytes at most) as
+ * records made of a header (SPOOL_RECORD_MAGIC, url length, body length
+ * and a crc32 of the url and body), the url and the body. Integers are
+ * big endian. The position of the first request that has not been
+ * transmitted yet is kept in a small index file and a segment is deleted
+ * as soon as all its requests have been transmitted. Requests are
+ * transmitted with several uploads in flight when the comm_t used has a
+ * transport and the index is saved once per batch of requests.
+ */
+
+#ifndef _SPOOL_H_
+#define _SPOOL_H_
+
+
+/**
+ * @def SPOOL_DIRECTORY
+ * Name of the directory (in the cache directory) of the spool.
+ *
+ * @def SPOOL_INDEX_FILENAME
+ * Name of the index file of the spool.
+ *
+ * @def SPOOL_SEGMENT_SUFFIX
+ * Suffix of segment files. Segments are named with their sequence
+ * number in hexadecimal followed by this suffix.
+ */
+#define SPOOL_DIRECTORY ("spool")
+#define SPOOL_INDEX_FILENAME ("spool.index")
+#define SPOOL_SEGMENT_SUFFIX (".seg")
+
+
+/**
+ * @def SPOOL_SEGMENT_SIZE
+ * Size in bytes (64 MB) above which a new segment is started.
+ */
+#define SPOOL_SEGMENT_SIZE (67108864)
+
+
+/**
+ * @def SPOOL_ACK_BATCH
+ * Number of requests handed to the server between two saves of the
+ * index (each save waits for the uploads in flight to be done).
+ */
+#define SPOOL_ACK_BATCH (64)
+
+
+/**
+ * @def SPOOL_RECORD_MAGIC
+ * Four bytes that begin every record.
+ *
+ * @def SPOOL_RECORD_HEADER_LEN
+ * Length in bytes of a record's header: magic, url length (32 bits),
+ * body length (64 bits) and crc32 (32 bits).
+ *
+ * @def SPOOL_MAX_URL_LEN
+ * Longest url accepted when a record is read back.
+ */
+#define SPOOL_RECORD_MAGIC ("CDPS")
+#define SPOOL_RECORD_HEADER_LEN (4 + 4 + 8 + 4)
+#define SPOOL_MAX_URL_LEN (4096)
+
+
+/**
+ * @struct spool_t
+ * @brief Append only spool of requests that could not be sent. It is
+ *        shared by all database connexions of a program.
+ */
+typedef struct
+{
+    GMutex mutex;           /**< protects fd, write_seq, write_size and closed            */
+    gchar *dirname;         /**< directory of the segments                                */
+    gchar *index_filename;  /**< file where read_seq and read_offset are kept             */
+    gint fd;                /**< segment being written or -1 when there is none           */
+    guint64 write_seq;      /**< sequence number of the segment being written             */
+    guint64 write_size;     /**< number of bytes written in that segment                  */
+    guint closed;           /**< number of closed segments not yet transmitted            */
+    guint64 read_seq;       /**< segment of the first request not transmitted             */
+    guint64 read_offset;    /**< offset of that request in its segment                    */
+} spool_t;
+
+
+/**
+ * @struct spool_drain_t
+ * @brief State of a transmission of the spool. It is given to the
+ *        failure handler of the comm_t used to transmit requests.
+ */
+typedef struct
+{
+    spool_t *spool;      /**< spool being transmitted                           */
+    gboolean failed;     /**< TRUE once a request could not be transmitted      */
+} spool_drain_t;
+
+
+/**
+ * Opens (and creates if needed) the spool of a cache directory. Segments
+ * left by a previous run are kept in order to be transmitted.
+ * @param dirname is the cache directory of the program.
+ * @returns a newly allocated spool_t that has to be attached to each
+ *          database connexion with db_set_spool() and freed with
+ *          free_spool_t() when no longer needed.
+ */
+extern spool_t *new_spool_t(gchar *dirname);
+
+
+/**
+ * Closes the spool and frees its memory. Segments are kept on disk.
+ * @param spool is the spool to be freed.
+ */
+extern void free_spool_t(spool_t *spool);
+
+
+/**
+ * @param spool is the spool.
+ * @param seq is the sequence number of a segment.
+ * @returns a newly allocated filename for this segment that may be
+ *          freed when no longer needed.
+ */
+extern gchar *get_spool_segment_filename(spool_t *spool, guint64 seq);
+
+
+/**
+ * Appends a request to the spool.
+ * @param spool is the spool.
+ * @param url is the url where the request should have been POSTed.
+ * @param body is the body of the request.
+ * @param length is the length of body.
+ * @returns TRUE if the request has been written and FALSE otherwise.
+ */
+extern gboolean append_to_spool(spool_t *spool, gchar *url, gchar *body, gsize length);
+
+
+/**
+ * @param spool is the spool.
+ * @returns TRUE if the spool contains requests that have not been
+ *          transmitted yet and FALSE otherwise.
+ */
+extern gboolean is_there_requests_in_spool(spool_t *spool);
+
+
+/**
+ * Reads the record that begins at offset in a segment and checks it.
+ * @param fd is the file descriptor of the segment.
+ * @param offset is the offset of the record.
+ * @param size is the size of the segment.
+ * @param[out] url is the newly allocated url of the request.
+ * @param[out] body is the newly allocated \0 terminated body of the
+ *             request (it may contain binary data).
+ * @param[out] length is the length of body.
+ * @param[out] next is the offset of the next record.
+ * @returns TRUE if the record is complete and its crc32 is correct and
+ *          FALSE otherwise (url and body are then NULL).
+ */
+extern gboolean read_spool_record(gint fd, guint64 offset, guint64 size, gchar **url, gchar **body, gsize *length, guint64 *next);
+
+
+/**
+ * Saves the position of the first request of a segment that has not
+ * been acknowledged yet. Every request before it has been transmitted.
+ * @param spool is the spool.
+ * @param seq is the sequence number of the segment.
+ * @param offset is the offset of that request in the segment.
+ */
+extern void acknowledge_spool(spool_t *spool, guint64 seq, guint64 offset);
+
+
+/**
+ * Transmits every request of the spool in order. Only one thread may
+ * call this function at a time. When comm has a transport up to
+ * comm->max_in_flight requests are in flight at once. The transmission
+ * stops at the first request that fails and resumes next time at the
+ * first request that has not been acknowledged.
+ * @param spool is the spool.
+ * @param comm a comm_t * structure that must contain an initialized
+ *        curl_handle. Its failure handler is replaced while requests are
+ *        transmitted.
+ * @returns TRUE if every request has been transmitted and FALSE if the
+ *          transmission stopped on an error.
+ */
+extern gboolean transmit_spool(spool_t *spool, comm_t *comm);
+
+
+#endif /* #ifndef _SPOOL_H_ */
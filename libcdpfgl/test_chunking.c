@@ -0,0 +1,298 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    test_chunking.c
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file test_chunking.c
+ *
+ * Tests of the content defined chunking: parameters, bounds of the
+ * chunks, cut points that must never change (they are shared by all
+ * clients) and cut points that resynchronize after an insertion.
+ */
+
+#include "libcdpfgl.h"
+
+/**
+ * @def TEST_BUFFER_LEN
+ * Length of the pseudo random buffers that are chunked (4 MB).
+ */
+#define TEST_BUFFER_LEN (4194304)
+
+static guchar *new_test_buffer(gsize len, guint64 seed);
+static GArray *get_cut_points(cdc_params_t *params, const guchar *buffer, gint64 len);
+static gboolean is_cut_point(GArray *cuts, gint64 offset);
+static void test_cdc_params(void);
+static void test_chunk_bounds(void);
+static void test_stable_cut_points(void);
+static void test_zeros_cut_at_max_size(void);
+static void test_insertion_resynchronizes(void);
+
+
+/**
+ * Fills a buffer with xorshift64 values so that it is the same on every
+ * machine.
+ * @param len is the length of the buffer.
+ * @param seed is the (non zero) seed of the generator.
+ * @returns a newly allocated buffer of len bytes.
+ */
+static guchar *new_test_buffer(gsize len, guint64 seed)
+{
+    guchar *buffer = NULL;
+    gsize i = 0;
+
+    buffer = (guchar *) g_malloc(len);
+    g_assert_nonnull(buffer);
+
+    for (i = 0; i < len; i++)
+        {
+            seed = seed ^ (seed << 13);
+            seed = seed ^ (seed >> 7);
+            seed = seed ^ (seed << 17);
+            buffer[i] = (guchar) (seed >> 56);
+        }
+
+    return buffer;
+}
+
+
+/**
+ * Cuts a whole buffer into chunks.
+ * @param params are the content defined chunking parameters.
+ * @param buffer is the buffer to be cut.
+ * @param len is the length of buffer.
+ * @returns a newly allocated GArray of the gint64 offsets where each
+ *          chunk ends (the last one is len).
+ */
+static GArray *get_cut_points(cdc_params_t *params, const guchar *buffer, gint64 len)
+{
+    GArray *cuts = NULL;
+    gint64 offset = 0;
+
+    cuts = g_array_new(FALSE, FALSE, sizeof(gint64));
+
+    while (offset < len)
+        {
+            offset = offset + cdc_find_cut_point(params, buffer + offset, len - offset);
+            g_array_append_val(cuts, offset);
+        }
+
+    return cuts;
+}
+
+
+/**
+ * @param cuts is a GArray of gint64 offsets in increasing order.
+ * @param offset is the offset to look for.
+ * @returns TRUE if offset is in cuts and FALSE otherwise.
+ */
+static gboolean is_cut_point(GArray *cuts, gint64 offset)
+{
+    guint i = 0;
+
+    while (i < cuts->len && g_array_index(cuts, gint64, i) < offset)
+        {
+            i = i + 1;
+        }
+
+    return (i < cuts->len && g_array_index(cuts, gint64, i) == offset);
+}
+
+
+/**
+ * The average size is rounded down to a power of two and the minimum
+ * and maximum sizes default to a quarter and eight times of it.
+ */
+static void test_cdc_params(void)
+{
+    cdc_params_t *params = NULL;
+
+    params = new_cdc_params_t(0, 20000, 0);
+    g_assert_cmpint(params->avg_size, ==, 16384);
+    g_assert_cmpint(params->min_size, ==, 4096);
+    g_assert_cmpint(params->max_size, ==, 131072);
+    free_cdc_params_t(params);
+
+    params = new_cdc_params_t(1000, 8192, 50000);
+    g_assert_cmpint(params->avg_size, ==, 8192);
+    g_assert_cmpint(params->min_size, ==, 1000);
+    g_assert_cmpint(params->max_size, ==, 50000);
+    free_cdc_params_t(params);
+
+    /* Too small an average and inconsistent bounds */
+    params = new_cdc_params_t(9999, 10, 5);
+    g_assert_cmpint(params->avg_size, ==, CDC_MIN_AVG_SIZE);
+    g_assert_cmpint(params->min_size, ==, CDC_MIN_AVG_SIZE / 4);
+    g_assert_cmpint(params->max_size, ==, CDC_MIN_AVG_SIZE * 8);
+    free_cdc_params_t(params);
+}
+
+
+/**
+ * Every chunk but the last one is longer than min_size and no chunk is
+ * longer than max_size. Chunks are avg_size long on average.
+ */
+static void test_chunk_bounds(void)
+{
+    cdc_params_t *params = NULL;
+    guchar *buffer = NULL;
+    GArray *cuts = NULL;
+    gint64 previous = 0;
+    gint64 offset = 0;
+    gint64 average = 0;
+    guint i = 0;
+
+    params = new_cdc_params_t(0, CDC_DEFAULT_AVG_SIZE, 0);
+    buffer = new_test_buffer(TEST_BUFFER_LEN, G_GUINT64_CONSTANT(0x1234567890ABCDEF));
+    cuts = get_cut_points(params, buffer, TEST_BUFFER_LEN);
+
+    for (i = 0; i < cuts->len; i++)
+        {
+            offset = g_array_index(cuts, gint64, i);
+
+            if (i + 1 < cuts->len)
+                {
+                    g_assert_cmpint(offset - previous, >, params->min_size);
+                }
+
+            g_assert_cmpint(offset - previous, <=, params->max_size);
+            previous = offset;
+        }
+
+    g_assert_cmpint(previous, ==, TEST_BUFFER_LEN);
+
+    average = TEST_BUFFER_LEN / cuts->len;
+    g_assert_cmpint(average, >, params->avg_size / 2);
+    g_assert_cmpint(average, <, params->avg_size * 2);
+
+    g_array_free(cuts, TRUE);
+    free_variable(buffer);
+    free_cdc_params_t(params);
+}
+
+
+/**
+ * Cut points depend only on the data and on the gear table: they must
+ * stay the same forever or blocks saved by older clients would no
+ * longer be deduplicated.
+ */
+static void test_stable_cut_points(void)
+{
+    static const gint64 expected[] = {19160, 25065, 47589, 65249, 84627, 102191, 119429, 136156};
+    cdc_params_t *params = NULL;
+    guchar *buffer = NULL;
+    GArray *cuts = NULL;
+    guint i = 0;
+
+    params = new_cdc_params_t(0, CDC_DEFAULT_AVG_SIZE, 0);
+    buffer = new_test_buffer(TEST_BUFFER_LEN, G_GUINT64_CONSTANT(0x1234567890ABCDEF));
+    cuts = get_cut_points(params, buffer, TEST_BUFFER_LEN);
+
+    g_assert_cmpuint(cuts->len, >=, G_N_ELEMENTS(expected));
+
+    for (i = 0; i < G_N_ELEMENTS(expected); i++)
+        {
+            g_assert_cmpint(g_array_index(cuts, gint64, i), ==, expected[i]);
+        }
+
+    g_array_free(cuts, TRUE);
+    free_variable(buffer);
+    free_cdc_params_t(params);
+}
+
+
+/**
+ * A buffer of zeros has no cut point: it is cut at max_size.
+ */
+static void test_zeros_cut_at_max_size(void)
+{
+    cdc_params_t *params = NULL;
+    guchar *buffer = NULL;
+
+    params = new_cdc_params_t(0, CDC_DEFAULT_AVG_SIZE, 0);
+    buffer = (guchar *) g_malloc0(params->max_size * 2);
+
+    g_assert_cmpint(cdc_find_cut_point(params, buffer, params->max_size * 2), ==, params->max_size);
+    g_assert_cmpint(cdc_find_cut_point(params, buffer, params->min_size), ==, params->min_size);
+
+    free_variable(buffer);
+    free_cdc_params_t(params);
+}
+
+
+/**
+ * Bytes inserted at the beginning of a buffer only change the first
+ * chunks: afterwards cut points are found at the same places in the
+ * data.
+ */
+static void test_insertion_resynchronizes(void)
+{
+    cdc_params_t *params = NULL;
+    guchar *buffer = NULL;
+    guchar *inserted = NULL;
+    GArray *cuts = NULL;
+    GArray *inserted_cuts = NULL;
+    gint64 offset = 0;
+    guint shared = 0;
+    guint i = 0;
+
+    params = new_cdc_params_t(0, CDC_DEFAULT_AVG_SIZE, 0);
+    buffer = new_test_buffer(TEST_BUFFER_LEN, G_GUINT64_CONSTANT(0xFEDCBA0987654321));
+
+    inserted = (guchar *) g_malloc(TEST_BUFFER_LEN + 100);
+    memset(inserted, 'x', 100);
+    memcpy(inserted + 100, buffer, TEST_BUFFER_LEN);
+
+    cuts = get_cut_points(params, buffer, TEST_BUFFER_LEN);
+    inserted_cuts = get_cut_points(params, inserted, TEST_BUFFER_LEN + 100);
+
+    /* Only the first few chunks may differ */
+    for (i = 0; i < cuts->len; i++)
+        {
+            offset = g_array_index(cuts, gint64, i);
+
+            if (is_cut_point(inserted_cuts, offset + 100) == TRUE)
+                {
+                    shared = shared + 1;
+                }
+        }
+
+    g_assert_cmpuint(shared, >=, cuts->len - 3);
+
+    g_array_free(inserted_cuts, TRUE);
+    g_array_free(cuts, TRUE);
+    free_variable(inserted);
+    free_variable(buffer);
+    free_cdc_params_t(params);
+}
+
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/chunking/cdc_params", test_cdc_params);
+    g_test_add_func("/chunking/chunk_bounds", test_chunk_bounds);
+    g_test_add_func("/chunking/stable_cut_points", test_stable_cut_points);
+    g_test_add_func("/chunking/zeros_cut_at_max_size", test_zeros_cut_at_max_size);
+    g_test_add_func("/chunking/insertion_resynchronizes", test_insertion_resynchronizes);
+
+    return g_test_run();
+}
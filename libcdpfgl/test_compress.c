@@ -0,0 +1,447 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    test_compress.c
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file test_compress.c
+ *
+ * Tests of the compression codecs: buffers compressed and uncompressed
+ * with each type available in this build, zstd contexts kept by each
+ * thread, compression levels and corrupted compressed data. Tests of
+ * what is worth compressing: the guess made from a sample of a buffer,
+ * blocks kept compressed only when it saves 1/COMPRESS_MIN_GAIN of their
+ * size and files whose compression is given up.
+ */
+
+#include "libcdpfgl.h"
+
+/**
+ * @def TEST_BUFFER_SIZE
+ * Length of the buffers compressed by the tests.
+ *
+ * @def TEST_THREADS
+ * Number of threads that compress at once.
+ *
+ * @def TEST_ROUNDS
+ * Number of buffers each of those threads compresses.
+ */
+#define TEST_BUFFER_SIZE (65536)
+#define TEST_THREADS (4)
+#define TEST_ROUNDS (32)
+
+static const gshort test_types[] = {COMPRESS_ZLIB_TYPE, COMPRESS_ZSTD_TYPE, COMPRESS_LZ4_TYPE};
+
+static guchar *new_test_text(gsize len, guint seed);
+static guchar *new_test_random(gsize len, guint32 seed, gdouble zero_ratio);
+static gshort make_test_block(guchar *buffer, gsize len, compress_probe_t *probe);
+static void assert_round_trip(guchar *buffer, gsize len, gshort type);
+static gpointer compress_test_buffers(gpointer user_data);
+static void test_round_trip(void);
+static void test_zlib_level(void);
+static void test_contexts_per_thread(void);
+static void test_corrupted_input(void);
+static void test_compressible(void);
+static void test_min_gain(void);
+static void test_probe(void);
+
+
+/**
+ * @param len is the length of the buffer.
+ * @param seed makes buffers of the same length different.
+ * @returns a newly allocated buffer of text that compresses well.
+ */
+static guchar *new_test_text(gsize len, guint seed)
+{
+    guchar *buffer = NULL;
+    gsize i = 0;
+
+    buffer = (guchar *) g_malloc(len);
+    g_assert_nonnull(buffer);
+
+    for (i = 0; i < len; i++)
+        {
+            buffer[i] = 'a' + (i / 7 + seed) % 26;
+        }
+
+    return buffer;
+}
+
+
+/**
+ * @param len is the length of the buffer.
+ * @param seed is the seed of the random generator.
+ * @param zero_ratio is the probability of a byte to be 0 instead of
+ *        any random value.
+ * @returns a newly allocated buffer of random bytes.
+ */
+static guchar *new_test_random(gsize len, guint32 seed, gdouble zero_ratio)
+{
+    GRand *rand = NULL;
+    guchar *buffer = NULL;
+    gsize i = 0;
+
+    rand = g_rand_new_with_seed(seed);
+    buffer = (guchar *) g_malloc(len);
+    g_assert_nonnull(buffer);
+
+    for (i = 0; i < len; i++)
+        {
+            if (g_rand_double(rand) < zero_ratio)
+                {
+                    buffer[i] = 0;
+                }
+            else
+                {
+                    buffer[i] = (guchar) g_rand_int_range(rand, 0, 256);
+                }
+        }
+
+    g_rand_free(rand);
+
+    return buffer;
+}
+
+
+/**
+ * Makes a block of a file as the client does: it is compressed with the
+ * type of the probe that is then updated.
+ * @param buffer is the data of the block. It is freed here.
+ * @param len is the length of buffer.
+ * @param probe is the probe of the file.
+ * @returns the compression type of the block as it would be stored.
+ */
+static gshort make_test_block(guchar *buffer, gsize len, compress_probe_t *probe)
+{
+    hash_data_t *hash_data = NULL;
+    gshort cmptype = COMPRESS_NONE_TYPE;
+
+    hash_data = new_hash_data_t(buffer, len, (guint8 *) g_malloc0(HASH_LEN), probe->cmptype);
+    account_compressed_block(probe, hash_data->cmptype);
+    cmptype = hash_data->cmptype;
+
+    if (hash_data->data != buffer)
+        {
+            free_variable(buffer);
+        }
+    free_hash_data_t(hash_data);
+
+    return cmptype;
+}
+
+
+/**
+ * Asserts that a buffer is compressed with type and that it is the same
+ * once uncompressed.
+ * @param buffer is the buffer to be compressed.
+ * @param len is the length of buffer.
+ * @param type is the compression type.
+ */
+static void assert_round_trip(guchar *buffer, gsize len, gshort type)
+{
+    compress_t *comp = NULL;
+    compress_t *uncomp = NULL;
+
+    comp = compress_buffer(buffer, len, type);
+    g_assert_nonnull(comp);
+    g_assert(comp->comp == TRUE);
+    g_assert_cmpuint(comp->len, <, len);
+
+    uncomp = uncompress_buffer(comp->text, comp->len, len, type);
+    g_assert_nonnull(uncomp);
+    g_assert(uncomp->comp == FALSE);
+    g_assert_cmpuint(uncomp->len, ==, len);
+    g_assert(memcmp(uncomp->text, buffer, len) == 0);
+
+    free_compress_t(uncomp);
+    free_compress_t(comp);
+}
+
+
+/**
+ * Compresses and uncompresses TEST_ROUNDS buffers with every type
+ * available: each thread uses its own zstd contexts again and again.
+ * @param user_data is the seed of the buffers of the thread
+ *        (GUINT_TO_POINTER).
+ * @returns NULL.
+ */
+static gpointer compress_test_buffers(gpointer user_data)
+{
+    guchar *buffer = NULL;
+    guint seed = GPOINTER_TO_UINT(user_data);
+    guint round = 0;
+    guint i = 0;
+
+    for (round = 0; round < TEST_ROUNDS; round++)
+        {
+            buffer = new_test_text(TEST_BUFFER_SIZE, seed + round);
+
+            for (i = 0; i < G_N_ELEMENTS(test_types); i++)
+                {
+                    if (is_compress_type_allowed(test_types[i]) == TRUE)
+                        {
+                            assert_round_trip(buffer, TEST_BUFFER_SIZE, test_types[i]);
+                        }
+                }
+
+            free_variable(buffer);
+        }
+
+    return NULL;
+}
+
+
+/**
+ * Every compression type available in this build gives back the
+ * buffer it compressed, whatever its length.
+ */
+static void test_round_trip(void)
+{
+    gsize lengths[] = {1024, 4096, TEST_BUFFER_SIZE};
+    guchar *buffer = NULL;
+    guint i = 0;
+    guint j = 0;
+
+    g_assert(is_compress_type_allowed(COMPRESS_ZLIB_TYPE) == TRUE);
+
+    for (i = 0; i < G_N_ELEMENTS(test_types); i++)
+        {
+            if (is_compress_type_allowed(test_types[i]) == TRUE)
+                {
+                    for (j = 0; j < G_N_ELEMENTS(lengths); j++)
+                        {
+                            buffer = new_test_text(lengths[j], j);
+                            assert_round_trip(buffer, lengths[j], test_types[i]);
+                            free_variable(buffer);
+                        }
+                }
+            else
+                {
+                    g_test_message("compression type %d is not available in this build", test_types[i]);
+                }
+        }
+}
+
+
+/**
+ * zlib compresses with level 6 unless told otherwise and its levels are
+ * kept between zlib's default and its best compression.
+ */
+static void test_zlib_level(void)
+{
+    guchar *buffer = NULL;
+
+    g_assert_cmpint(COMPRESS_ZLIB_DEFAULT_LEVEL, ==, 6);
+    g_assert_cmpint(get_compress_level(COMPRESS_ZLIB_TYPE), ==, COMPRESS_ZLIB_DEFAULT_LEVEL);
+
+    set_compress_level(COMPRESS_ZLIB_TYPE, 12);
+    g_assert_cmpint(get_compress_level(COMPRESS_ZLIB_TYPE), ==, 9);
+
+    buffer = new_test_text(TEST_BUFFER_SIZE, 0);
+    assert_round_trip(buffer, TEST_BUFFER_SIZE, COMPRESS_ZLIB_TYPE);
+    free_variable(buffer);
+
+    set_compress_level(COMPRESS_ZLIB_TYPE, -5);
+    g_assert_cmpint(get_compress_level(COMPRESS_ZLIB_TYPE), ==, -1);
+
+    set_compress_level(COMPRESS_ZLIB_TYPE, COMPRESS_ZLIB_DEFAULT_LEVEL);
+}
+
+
+/**
+ * Threads that compress at once (each with its own zstd contexts that
+ * it reuses for every buffer) all get their buffers back.
+ */
+static void test_contexts_per_thread(void)
+{
+    GThread *threads[TEST_THREADS];
+    guint i = 0;
+
+    for (i = 0; i < TEST_THREADS; i++)
+        {
+            threads[i] = g_thread_new("compress_test_buffers", compress_test_buffers, GUINT_TO_POINTER(i * TEST_ROUNDS));
+        }
+
+    for (i = 0; i < TEST_THREADS; i++)
+        {
+            g_thread_join(threads[i]);
+        }
+}
+
+
+/**
+ * Corrupted compressed data never gives back the original buffer and the
+ * compressed buffer still belongs to the caller when it is refused.
+ */
+static void test_corrupted_input(void)
+{
+    compress_t *comp = NULL;
+    compress_t *uncomp = NULL;
+    guchar *buffer = NULL;
+    guchar *corrupted = NULL;
+    gsize i = 0;
+    guint j = 0;
+
+    buffer = new_test_text(TEST_BUFFER_SIZE, 0);
+
+    for (j = 0; j < G_N_ELEMENTS(test_types); j++)
+        {
+            if (is_compress_type_allowed(test_types[j]) == TRUE)
+                {
+                    comp = compress_buffer(buffer, TEST_BUFFER_SIZE, test_types[j]);
+                    g_assert_nonnull(comp);
+
+                    corrupted = (guchar *) g_malloc(comp->len);
+                    g_assert_nonnull(corrupted);
+                    memcpy(corrupted, comp->text, comp->len);
+
+                    for (i = comp->len / 4; i < comp->len / 2; i++)
+                        {
+                            corrupted[i] = ~corrupted[i];
+                        }
+
+                    uncomp = uncompress_buffer(corrupted, comp->len, TEST_BUFFER_SIZE, test_types[j]);
+                    g_assert(uncomp == NULL || uncomp->len != TEST_BUFFER_SIZE || memcmp(uncomp->text, buffer, TEST_BUFFER_SIZE) != 0);
+
+                    free_compress_t(uncomp);
+                    free_variable(corrupted);
+                    free_compress_t(comp);
+                }
+        }
+
+    free_variable(buffer);
+}
+
+
+/**
+ * Random data does not look compressible while text, constant data and
+ * data that is only partly random do, whether the whole buffer or a
+ * sample of it is looked at.
+ */
+static void test_compressible(void)
+{
+    gsize lengths[] = {COMPRESS_SAMPLE_SIZE, TEST_BUFFER_SIZE};
+    guchar *buffer = NULL;
+    guint i = 0;
+
+    for (i = 0; i < G_N_ELEMENTS(lengths); i++)
+        {
+            buffer = new_test_random(lengths[i], i, 0.0);
+            g_assert(is_buffer_compressible(buffer, lengths[i]) == FALSE);
+
+            /* Half of it made of zeros */
+            memset(buffer, 0, lengths[i] / 2);
+            g_assert(is_buffer_compressible(buffer, lengths[i]) == TRUE);
+
+            memset(buffer, 'x', lengths[i]);
+            g_assert(is_buffer_compressible(buffer, lengths[i]) == TRUE);
+            free_variable(buffer);
+
+            buffer = new_test_text(lengths[i], i);
+            g_assert(is_buffer_compressible(buffer, lengths[i]) == TRUE);
+            free_variable(buffer);
+        }
+}
+
+
+/**
+ * A block is only kept compressed when compression saves at least
+ * 1/COMPRESS_MIN_GAIN of its size. Data where 5% of the bytes are 0
+ * looks compressible but zlib saves less than that on it.
+ */
+static void test_min_gain(void)
+{
+    compress_probe_t probe;
+    compress_t *comp = NULL;
+    guchar *buffer = NULL;
+
+    buffer = new_test_random(TEST_BUFFER_SIZE, 42, 0.05);
+    g_assert(is_buffer_compressible(buffer, TEST_BUFFER_SIZE) == TRUE);
+
+    comp = compress_buffer(buffer, TEST_BUFFER_SIZE, COMPRESS_ZLIB_TYPE);
+    g_assert_nonnull(comp);
+    g_assert_cmpuint(comp->len, >, TEST_BUFFER_SIZE - TEST_BUFFER_SIZE / COMPRESS_MIN_GAIN);
+    free_compress_t(comp);
+
+    init_compress_probe(&probe, COMPRESS_ZLIB_TYPE);
+    g_assert_cmpint(make_test_block(buffer, TEST_BUFFER_SIZE, &probe), ==, COMPRESS_NONE_TYPE);
+
+    init_compress_probe(&probe, COMPRESS_ZLIB_TYPE);
+    buffer = new_test_text(TEST_BUFFER_SIZE, 0);
+    g_assert_cmpint(make_test_block(buffer, TEST_BUFFER_SIZE, &probe), ==, COMPRESS_ZLIB_TYPE);
+}
+
+
+/**
+ * Compression of a file is given up once its COMPRESS_PROBE_BLOCKS first
+ * blocks were not kept compressed: its next blocks are not compressed
+ * even if they could be. One block kept compressed among them keeps
+ * compression for the whole file.
+ */
+static void test_probe(void)
+{
+    compress_probe_t probe;
+    guint i = 0;
+
+    init_compress_probe(&probe, COMPRESS_ZLIB_TYPE);
+
+    for (i = 0; i < COMPRESS_PROBE_BLOCKS; i++)
+        {
+            g_assert_cmpint(probe.cmptype, ==, COMPRESS_ZLIB_TYPE);
+            g_assert_cmpint(make_test_block(new_test_random(TEST_BUFFER_SIZE, i, 0.0), TEST_BUFFER_SIZE, &probe), ==, COMPRESS_NONE_TYPE);
+        }
+
+    g_assert_cmpint(probe.cmptype, ==, COMPRESS_NONE_TYPE);
+    g_assert_cmpint(make_test_block(new_test_text(TEST_BUFFER_SIZE, 0), TEST_BUFFER_SIZE, &probe), ==, COMPRESS_NONE_TYPE);
+    g_assert_cmpint(probe.cmptype, ==, COMPRESS_NONE_TYPE);
+
+    init_compress_probe(&probe, COMPRESS_ZLIB_TYPE);
+
+    for (i = 0; i < COMPRESS_PROBE_BLOCKS - 1; i++)
+        {
+            g_assert_cmpint(make_test_block(new_test_random(TEST_BUFFER_SIZE, i, 0.0), TEST_BUFFER_SIZE, &probe), ==, COMPRESS_NONE_TYPE);
+        }
+
+    g_assert_cmpint(make_test_block(new_test_text(TEST_BUFFER_SIZE, 0), TEST_BUFFER_SIZE, &probe), ==, COMPRESS_ZLIB_TYPE);
+
+    for (i = 0; i < 2 * COMPRESS_PROBE_BLOCKS; i++)
+        {
+            g_assert_cmpint(make_test_block(new_test_random(TEST_BUFFER_SIZE, i, 0.0), TEST_BUFFER_SIZE, &probe), ==, COMPRESS_NONE_TYPE);
+        }
+
+    g_assert_cmpint(probe.cmptype, ==, COMPRESS_ZLIB_TYPE);
+    g_assert_cmpint(make_test_block(new_test_text(TEST_BUFFER_SIZE, 1), TEST_BUFFER_SIZE, &probe), ==, COMPRESS_ZLIB_TYPE);
+}
+
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/compress/round_trip", test_round_trip);
+    g_test_add_func("/compress/zlib_level", test_zlib_level);
+    g_test_add_func("/compress/contexts_per_thread", test_contexts_per_thread);
+    g_test_add_func("/compress/corrupted_input", test_corrupted_input);
+    g_test_add_func("/compress/compressible", test_compressible);
+    g_test_add_func("/compress/min_gain", test_min_gain);
+    g_test_add_func("/compress/probe", test_probe);
+
+    return g_test_run();
+}
@@ -0,0 +1,254 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    test_database.c
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file test_database.c
+ *
+ * Tests of the client's database: the file cache that answers
+ * is_file_in_cache() for files that the background writer has not
+ * committed yet and the transactions of the background writer.
+ */
+
+#include "libcdpfgl.h"
+#include "test_helpers.h"
+
+/**
+ * @def TEST_DIRECTORY
+ * Template of the name of the temporary directory of each test.
+ */
+#define TEST_DIRECTORY ("cdpfgl-database-XXXXXX")
+
+/**
+ * @def TEST_DATABASE
+ * Filename of the database of the tests.
+ */
+#define TEST_DATABASE ("test.db")
+
+/**
+ * @def TEST_WAIT_STEPS
+ * Number of times (every 10 ms) the database is looked into before
+ * giving up waiting for a commit of the background writer.
+ */
+#define TEST_WAIT_STEPS (1000)
+
+static meta_data_t *new_test_meta(guint number);
+static void close_test_database(db_t *database);
+static void assert_files_in_database(db_t *database, guint first, guint count);
+static void test_cache_before_commit(void);
+static void test_writer_batches(void);
+
+
+/**
+ * @param number makes the files of a test different.
+ * @returns a newly allocated meta_data_t of a regular file.
+ */
+static meta_data_t *new_test_meta(guint number)
+{
+    meta_data_t *meta = NULL;
+
+    meta = new_meta_data_t();
+
+    meta->file_type = G_FILE_TYPE_REGULAR;
+    meta->inode = 1000 + number;
+    meta->mode = 0644;
+    meta->atime = 1500000000;
+    meta->ctime = 1500000000 + number;
+    meta->mtime = 1500000000 + number;
+    meta->size = 4096 * number;
+    meta->owner = g_strdup("user");
+    meta->group = g_strdup("group");
+    meta->uid = 1000;
+    meta->gid = 1000;
+    meta->name = g_strdup_printf("/test/file-%u", number);
+    meta->link = g_strdup("");
+
+    return meta;
+}
+
+
+/**
+ * Closes a database connexion opened by open_database() and frees it.
+ * @param database is the database connexion.
+ */
+static void close_test_database(db_t *database)
+{
+    close_database(database);
+    free_variable(database->version_filename);
+    free_variable(database);
+}
+
+
+/**
+ * Asserts that numbered files are in the database.
+ * @param database is a database connexion without file cache.
+ * @param first is the number of the first file.
+ * @param count is the number of files.
+ */
+static void assert_files_in_database(db_t *database, guint first, guint count)
+{
+    meta_data_t *meta = NULL;
+    guint i = 0;
+
+    for (i = first; i < first + count; i++)
+        {
+            meta = new_test_meta(i);
+            g_assert(is_file_in_cache(database, meta) == TRUE);
+            free_meta_data_t(meta, TRUE);
+        }
+}
+
+
+/**
+ * A file given to the background writer is in the cache at once: the
+ * file cache answers while the database does not have it yet. A file
+ * whose state changed is not in the cache.
+ */
+static void test_cache_before_commit(void)
+{
+    db_t *database = NULL;
+    db_t *other = NULL;
+    db_writer_t writer;
+    db_write_t *row = NULL;
+    file_cache_t *cache = NULL;
+    meta_data_t *meta = NULL;
+    gchar *dirname = NULL;
+
+    dirname = make_test_directory(TEST_DIRECTORY);
+    database = open_database(dirname, TEST_DATABASE);
+    g_assert_nonnull(database);
+    other = open_database(dirname, TEST_DATABASE);
+    g_assert_nonnull(other);
+
+    cache = new_file_cache_t(database);
+    db_set_file_cache(database, cache);
+
+    /* A writer that never commits: only its queue is used */
+    writer.database = NULL;
+    writer.queue = g_async_queue_new();
+    writer.thread = NULL;
+    writer.commits = 0;
+    db_set_writer(database, &writer);
+
+    meta = new_test_meta(1);
+    g_assert(is_file_in_cache(database, meta) == FALSE);
+
+    db_save_meta_data(database, meta, TRUE);
+    g_assert_cmpint(g_async_queue_length(writer.queue), ==, 1);
+
+    g_assert(is_file_in_cache(database, meta) == TRUE);
+    g_assert(is_file_in_cache(other, meta) == FALSE);
+
+    meta->mtime = meta->mtime + 1;
+    g_assert(is_file_in_cache(database, meta) == FALSE);
+
+    row = g_async_queue_pop(writer.queue);
+    g_assert_cmpstr(row->meta->name, ==, meta->name);
+    free_meta_data_t(row->meta, TRUE);
+    free_variable(row);
+
+    db_set_writer(database, NULL);
+    g_async_queue_unref(writer.queue);
+    free_meta_data_t(meta, TRUE);
+    close_test_database(other);
+    close_test_database(database);
+    free_file_cache_t(cache);
+    remove_test_directory(dirname);
+    free_variable(dirname);
+}
+
+
+/**
+ * The background writer commits DATABASE_WRITER_BATCH files in each
+ * transaction and free_db_writer_t() commits every file still queued.
+ */
+static void test_writer_batches(void)
+{
+    db_t *database = NULL;
+    db_t *other = NULL;
+    db_writer_t *writer = NULL;
+    meta_data_t *meta = NULL;
+    gchar *dirname = NULL;
+    gboolean found = FALSE;
+    guint total = 2 * DATABASE_WRITER_BATCH;
+    guint i = 0;
+
+    dirname = make_test_directory(TEST_DIRECTORY);
+    writer = new_db_writer_t(dirname, TEST_DATABASE, DATABASE_DURABILITY_FAST);
+    g_assert_nonnull(writer);
+    database = open_database(dirname, TEST_DATABASE);
+    g_assert_nonnull(database);
+    other = open_database(dirname, TEST_DATABASE);
+    g_assert_nonnull(other);
+    db_set_writer(database, writer);
+
+    for (i = 0; i < total; i++)
+        {
+            meta = new_test_meta(i);
+            db_save_meta_data(database, meta, TRUE);
+            free_meta_data_t(meta, TRUE);
+        }
+
+    /* The last file of the second batch is committed with it */
+    meta = new_test_meta(total - 1);
+    for (i = 0; i < TEST_WAIT_STEPS && found == FALSE; i++)
+        {
+            found = is_file_in_cache(other, meta);
+
+            if (found == FALSE)
+                {
+                    g_usleep(10 * G_TIME_SPAN_MILLISECOND);
+                }
+        }
+    free_meta_data_t(meta, TRUE);
+
+    g_assert(found == TRUE);
+    g_assert_cmpint(g_atomic_int_get(&writer->commits), ==, 2);
+    assert_files_in_database(other, 0, total);
+
+    /* Queued and not committed before the writer is freed */
+    for (i = total; i < total + 10; i++)
+        {
+            meta = new_test_meta(i);
+            db_save_meta_data(database, meta, TRUE);
+            free_meta_data_t(meta, TRUE);
+        }
+
+    db_set_writer(database, NULL);
+    free_db_writer_t(writer);
+    assert_files_in_database(other, total, 10);
+
+    close_test_database(other);
+    close_test_database(database);
+    remove_test_directory(dirname);
+    free_variable(dirname);
+}
+
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/database/cache_before_commit", test_cache_before_commit);
+    g_test_add_func("/database/writer_batches", test_writer_batches);
+
+    return g_test_run();
+}
@@ -0,0 +1,320 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    test_framing.c
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file test_framing.c
+ *
+ * Tests of the binary framing: frames written and read back, block
+ * streams read piece by piece and bodies that have to be refused.
+ */
+
+#include "libcdpfgl.h"
+#include "test_helpers.h"
+
+static hash_data_t *new_test_zero_block(gssize len);
+static GList *new_test_blocks(void);
+static void assert_same_blocks(GList *expected, GList *got);
+static void test_frames_round_trip(void);
+static void test_block_stream_pieces(void);
+static void test_truncated_body(void);
+static void test_bad_preamble(void);
+static void test_frame_without_data(void);
+static void test_unknown_cmptype(void);
+
+
+/**
+ * @param len is the length of the block of zeros.
+ * @returns a newly allocated block of zeros as the client makes them
+ *          (without data).
+ */
+static hash_data_t *new_test_zero_block(gssize len)
+{
+    guint8 *a_hash = NULL;
+
+    a_hash = (guint8 *) g_malloc(HASH_LEN);
+    make_zero_block_hash(a_hash, len);
+
+    return new_hash_data_t_as_is(NULL, len, a_hash, COMPRESS_NONE_TYPE, len);
+}
+
+
+/**
+ * @returns a list of blocks with data and blocks of zeros.
+ */
+static GList *new_test_blocks(void)
+{
+    GList *blocks = NULL;
+
+    blocks = g_list_append(blocks, new_test_block(1000, 'a'));
+    blocks = g_list_append(blocks, new_test_zero_block(65536));
+    blocks = g_list_append(blocks, new_test_block(1, 'z'));
+    blocks = g_list_append(blocks, new_test_block(70000, 'A'));
+
+    return blocks;
+}
+
+
+/**
+ * Asserts that two lists of blocks are the same.
+ * @param expected is the list of blocks that were framed.
+ * @param got is the list of blocks read from the frames.
+ */
+static void assert_same_blocks(GList *expected, GList *got)
+{
+    hash_data_t *a = NULL;
+    hash_data_t *b = NULL;
+
+    g_assert_cmpuint(g_list_length(expected), ==, g_list_length(got));
+
+    while (expected != NULL && got != NULL)
+        {
+            a = expected->data;
+            b = got->data;
+
+            g_assert(memcmp(a->hash, b->hash, HASH_LEN) == 0);
+            g_assert_cmpint(a->read, ==, b->read);
+            g_assert_cmpint(a->uncmplen, ==, b->uncmplen);
+            g_assert_cmpint(a->cmptype, ==, b->cmptype);
+
+            if (a->data != NULL)
+                {
+                    g_assert_nonnull(b->data);
+                    g_assert(memcmp(a->data, b->data, a->read) == 0);
+                }
+            else
+                {
+                    g_assert_null(b->data);
+                }
+
+            expected = g_list_next(expected);
+            got = g_list_next(got);
+        }
+}
+
+
+/**
+ * Frames written by convert_hash_data_list_to_frames() are read back as
+ * the same blocks.
+ */
+static void test_frames_round_trip(void)
+{
+    GList *blocks = NULL;
+    GList *read_back = NULL;
+    guchar *body = NULL;
+    gsize length = 0;
+
+    blocks = new_test_blocks();
+    body = convert_hash_data_list_to_frames(blocks, &length);
+
+    g_assert_cmpuint(length, ==, FRAMES_PREAMBLE_LEN + 4 * FRAME_HEADER_LEN + 1000 + 1 + 70000);
+    g_assert(memcmp(body, FRAMES_MAGIC, 4) == 0);
+
+    read_back = convert_frames_to_hash_data_list(body, length);
+    assert_same_blocks(blocks, read_back);
+
+    g_list_free_full(read_back, free_hdt_struct);
+    g_list_free_full(blocks, free_hdt_struct);
+    free_variable(body);
+}
+
+
+/**
+ * A binary block stream read by small pieces gives the same bytes as
+ * convert_hash_data_list_to_frames() and the announced length.
+ */
+static void test_block_stream_pieces(void)
+{
+    block_stream_t *stream = NULL;
+    GByteArray *pieces = NULL;
+    guchar *body = NULL;
+    guchar *whole = NULL;
+    guchar chunk[7];
+    gsize length = 0;
+    gsize whole_len = 0;
+    gsize len = 0;
+
+    stream = new_block_stream_t(new_test_blocks(), TRUE);
+    body = convert_hash_data_list_to_frames(stream->blocks, &length);
+    pieces = g_byte_array_new();
+
+    do
+        {
+            len = read_block_stream(stream, chunk, sizeof(chunk));
+            g_byte_array_append(pieces, chunk, len);
+        }
+    while (len > 0);
+
+    g_assert_cmpuint(pieces->len, ==, length);
+    g_assert(memcmp(pieces->data, body, length) == 0);
+    g_assert_cmpint(get_block_stream_length(stream), ==, (gssize) length);
+
+    /* Rewound streams are read again from their beginning */
+    whole = read_whole_block_stream(stream, &whole_len);
+    g_assert_cmpuint(whole_len, ==, length);
+    g_assert(memcmp(whole, body, length) == 0);
+
+    free_variable(whole);
+    g_byte_array_free(pieces, TRUE);
+    free_variable(body);
+    free_block_stream_t(stream);
+}
+
+
+/**
+ * A body cut anywhere but between two frames is refused.
+ */
+static void test_truncated_body(void)
+{
+    GList *blocks = NULL;
+    GList *read_back = NULL;
+    guchar *body = NULL;
+    gsize length = 0;
+    gsize first_frame_end = 0;
+    gsize cuts[4];
+    guint i = 0;
+
+    blocks = new_test_blocks();
+    body = convert_hash_data_list_to_frames(blocks, &length);
+    first_frame_end = FRAMES_PREAMBLE_LEN + get_frame_length(blocks->data);
+
+    /* In the header, right after it, in the data and one byte short */
+    cuts[0] = FRAMES_PREAMBLE_LEN + 1;
+    cuts[1] = FRAMES_PREAMBLE_LEN + FRAME_HEADER_LEN;
+    cuts[2] = FRAMES_PREAMBLE_LEN + FRAME_HEADER_LEN + 500;
+    cuts[3] = first_frame_end - 1;
+
+    for (i = 0; i < 4; i++)
+        {
+            read_back = convert_frames_to_hash_data_list(body, cuts[i]);
+            g_assert_null(read_back);
+        }
+
+    read_back = convert_frames_to_hash_data_list(body, first_frame_end);
+    g_assert_cmpuint(g_list_length(read_back), ==, 1);
+    g_list_free_full(read_back, free_hdt_struct);
+
+    read_back = convert_frames_to_hash_data_list(body, length - 1);
+    g_assert_null(read_back);
+
+    g_list_free_full(blocks, free_hdt_struct);
+    free_variable(body);
+}
+
+
+/**
+ * Bodies with a wrong magic or an unknown version are refused.
+ */
+static void test_bad_preamble(void)
+{
+    GList *blocks = NULL;
+    GList *read_back = NULL;
+    guchar *body = NULL;
+    gsize length = 0;
+
+    blocks = new_test_blocks();
+    body = convert_hash_data_list_to_frames(blocks, &length);
+
+    body[0] = 'X';
+    read_back = convert_frames_to_hash_data_list(body, length);
+    g_assert_null(read_back);
+
+    body[0] = FRAMES_MAGIC[0];
+    body[7] = FRAMES_VERSION + 1;
+    read_back = convert_frames_to_hash_data_list(body, length);
+    g_assert_null(read_back);
+
+    g_list_free_full(blocks, free_hdt_struct);
+    free_variable(body);
+}
+
+
+/**
+ * Only a block of zeros whose length is the one of its hash may come
+ * without data.
+ */
+static void test_frame_without_data(void)
+{
+    hash_data_t *hash_data = NULL;
+    GList *blocks = NULL;
+    GList *read_back = NULL;
+    guchar *body = NULL;
+    guint64 uncmplen = 0;
+    gsize length = 0;
+
+    /* A block with data announced without any */
+    hash_data = new_test_block(10, 'b');
+    blocks = g_list_append(NULL, hash_data);
+    body = convert_hash_data_list_to_frames(blocks, &length);
+    memset(body + FRAMES_PREAMBLE_LEN + HASH_LEN + 10, 0, 8);
+    read_back = convert_frames_to_hash_data_list(body, FRAMES_PREAMBLE_LEN + FRAME_HEADER_LEN);
+    g_assert_null(read_back);
+    g_list_free_full(blocks, free_hdt_struct);
+    free_variable(body);
+
+    /* A block of zeros whose length is not the one of its hash */
+    hash_data = new_test_zero_block(4096);
+    blocks = g_list_append(NULL, hash_data);
+    body = convert_hash_data_list_to_frames(blocks, &length);
+    uncmplen = GUINT64_TO_BE(8192);
+    memcpy(body + FRAMES_PREAMBLE_LEN + HASH_LEN + 2, &uncmplen, 8);
+    read_back = convert_frames_to_hash_data_list(body, length);
+    g_assert_null(read_back);
+    g_list_free_full(blocks, free_hdt_struct);
+    free_variable(body);
+}
+
+
+/**
+ * Frames with an unknown compression type are refused.
+ */
+static void test_unknown_cmptype(void)
+{
+    GList *blocks = NULL;
+    GList *read_back = NULL;
+    guchar *body = NULL;
+    gsize length = 0;
+
+    blocks = g_list_append(NULL, new_test_block(10, 'c'));
+    body = convert_hash_data_list_to_frames(blocks, &length);
+    body[FRAMES_PREAMBLE_LEN + HASH_LEN] = 0x7f;
+
+    read_back = convert_frames_to_hash_data_list(body, length);
+    g_assert_null(read_back);
+
+    g_list_free_full(blocks, free_hdt_struct);
+    free_variable(body);
+}
+
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/framing/round_trip", test_frames_round_trip);
+    g_test_add_func("/framing/block_stream_pieces", test_block_stream_pieces);
+    g_test_add_func("/framing/truncated_body", test_truncated_body);
+    g_test_add_func("/framing/bad_preamble", test_bad_preamble);
+    g_test_add_func("/framing/frame_without_data", test_frame_without_data);
+    g_test_add_func("/framing/unknown_cmptype", test_unknown_cmptype);
+
+    return g_test_run();
+}
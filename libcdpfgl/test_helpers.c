@@ -0,0 +1,238 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    test_helpers.c
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file test_helpers.c
+ *
+ * Helpers shared by the unit tests: temporary directories, blocks made
+ * of known data and a stub server that answers POST requests.
+ */
+
+#include "libcdpfgl.h"
+#include <glib/gstdio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "test_helpers.h"
+
+static int answer_test_http_stub(void *cls, struct MHD_Connection *connection, const char *url, const char *method, const char *version, const char *upload_data, size_t *upload_data_size, void **con_cls);
+
+
+/**
+ * Makes a new temporary directory.
+ * @param tmpl is the template of its name (it must end with XXXXXX).
+ * @returns a newly allocated name of the new directory.
+ */
+gchar *make_test_directory(const gchar *tmpl)
+{
+    gchar *dirname = NULL;
+
+    dirname = g_dir_make_tmp(tmpl, NULL);
+    g_assert_nonnull(dirname);
+
+    return dirname;
+}
+
+
+/**
+ * Removes a directory and everything in it.
+ * @param dirname is the directory to be removed.
+ */
+void remove_test_directory(gchar *dirname)
+{
+    GDir *dir = NULL;
+    const gchar *name = NULL;
+    gchar *filename = NULL;
+
+    dir = g_dir_open(dirname, 0, NULL);
+
+    if (dir != NULL)
+        {
+            name = g_dir_read_name(dir);
+            while (name != NULL)
+                {
+                    filename = g_build_filename(dirname, name, NULL);
+
+                    if (g_file_test(filename, G_FILE_TEST_IS_DIR) == TRUE)
+                        {
+                            remove_test_directory(filename);
+                        }
+                    else
+                        {
+                            g_unlink(filename);
+                        }
+
+                    free_variable(filename);
+                    name = g_dir_read_name(dir);
+                }
+            g_dir_close(dir);
+        }
+
+    g_rmdir(dirname);
+}
+
+
+/**
+ * @param len is the length of the block's data.
+ * @param fill is the byte used to make the data.
+ * @returns a newly allocated block (not compressed) with its hash.
+ */
+hash_data_t *new_test_block(gsize len, guchar fill)
+{
+    guchar *data = NULL;
+    gsize i = 0;
+
+    data = (guchar *) g_malloc(len);
+    g_assert_nonnull(data);
+
+    for (i = 0; i < len; i++)
+        {
+            data[i] = fill + (guchar) (i % 7);
+        }
+
+    return new_hash_data_t_as_is(data, (gssize) len, calculate_hash_for_string(data, len), COMPRESS_NONE_TYPE, (gssize) len);
+}
+
+
+/**
+ * Access handler of the stub server: the body of a request is read and
+ * dropped and the request is answered (or fails) once it is complete.
+ * @param cls is the test_http_stub_t * stub.
+ * @param connection is the connection of the request.
+ * @param url is the url of the request.
+ * @param method is the method of the request (unused).
+ * @param version is the HTTP version of the request (unused).
+ * @param upload_data is a part of the body of the request.
+ * @param upload_data_size is the length of upload_data.
+ * @param con_cls is set once the first call for a request is done.
+ * @returns MHD_YES while the request goes on and MHD_NO to close the
+ *          connection without answering.
+ */
+static int answer_test_http_stub(void *cls, struct MHD_Connection *connection, const char *url, const char *method, const char *version, const char *upload_data, size_t *upload_data_size, void **con_cls)
+{
+    test_http_stub_t *stub = (test_http_stub_t *) cls;
+    struct MHD_Response *response = NULL;
+    gboolean fail = FALSE;
+    int success = MHD_YES;
+
+    if (*con_cls == NULL)
+        {
+            /* First call: only the headers of the request are known */
+            *con_cls = stub;
+        }
+    else if (*upload_data_size > 0)
+        {
+            *upload_data_size = 0;
+        }
+    else
+        {
+            g_mutex_lock(&stub->mutex);
+            fail = stub->fail_after >= 0 && stub->urls->len >= (guint) stub->fail_after;
+
+            if (fail == FALSE)
+                {
+                    g_ptr_array_add(stub->urls, g_strdup(url));
+                }
+            g_mutex_unlock(&stub->mutex);
+
+            if (fail == FALSE)
+                {
+                    response = MHD_create_response_from_buffer(0, "", MHD_RESPMEM_PERSISTENT);
+                    success = MHD_queue_response(connection, MHD_HTTP_OK, response);
+                    MHD_destroy_response(response);
+                }
+            else
+                {
+                    success = MHD_NO;
+                }
+        }
+
+    return success;
+}
+
+
+/**
+ * Starts a stub server on a free port of the loopback interface.
+ * @returns a newly allocated test_http_stub_t that answers every
+ *          request.
+ */
+test_http_stub_t *start_test_http_stub(void)
+{
+    test_http_stub_t *stub = NULL;
+    const union MHD_DaemonInfo *info = NULL;
+    struct sockaddr_in address;
+    socklen_t address_len = sizeof(address);
+
+    stub = (test_http_stub_t *) g_malloc0(sizeof(test_http_stub_t));
+    g_assert_nonnull(stub);
+
+    g_mutex_init(&stub->mutex);
+    stub->urls = g_ptr_array_new_with_free_func(g_free);
+    stub->fail_after = -1;
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+
+    stub->d = MHD_start_daemon(MHD_USE_SELECT_INTERNALLY, 0, NULL, NULL, &answer_test_http_stub, stub, MHD_OPTION_SOCK_ADDR, (struct sockaddr *) &address, MHD_OPTION_END);
+    g_assert_nonnull(stub->d);
+
+    info = MHD_get_daemon_info(stub->d, MHD_DAEMON_INFO_LISTEN_FD);
+    g_assert_nonnull(info);
+    g_assert_cmpint(getsockname(info->listen_fd, (struct sockaddr *) &address, &address_len), ==, 0);
+    stub->conn = g_strdup_printf("http://127.0.0.1:%d", ntohs(address.sin_port));
+
+    return stub;
+}
+
+
+/**
+ * Tells the stub to fail the requests after a number of others have
+ * been answered. The requests already answered are forgotten.
+ * @param stub is the stub server.
+ * @param fail_after is the number of requests answered before every
+ *        other one fails (-1 to answer them all).
+ */
+void set_test_http_stub_failure(test_http_stub_t *stub, gint fail_after)
+{
+    g_mutex_lock(&stub->mutex);
+    g_ptr_array_set_size(stub->urls, 0);
+    stub->fail_after = fail_after;
+    g_mutex_unlock(&stub->mutex);
+}
+
+
+/**
+ * Stops the stub server and frees it.
+ * @param stub is the stub server (may be NULL).
+ */
+void stop_test_http_stub(test_http_stub_t *stub)
+{
+    if (stub != NULL)
+        {
+            MHD_stop_daemon(stub->d);
+            g_ptr_array_free(stub->urls, TRUE);
+            g_mutex_clear(&stub->mutex);
+            free_variable(stub->conn);
+            free_variable(stub);
+        }
+}
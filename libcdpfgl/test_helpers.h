@@ -0,0 +1,101 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    test_helpers.h
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file test_helpers.h
+ *
+ * This file contains the definitions of the helpers shared by the unit
+ * tests of libcdpfgl and of the programs: temporary directories, blocks
+ * made of known data and a stub server that answers POST requests. They
+ * are only built for "make check".
+ */
+
+#ifndef _TEST_HELPERS_H_
+#define _TEST_HELPERS_H_
+
+
+/**
+ * @struct test_http_stub_t
+ * @brief A server on the loopback interface that answers every POST
+ *        request with an empty 200 answer until it is told to fail:
+ *        it then closes the connection of every request instead.
+ */
+typedef struct
+{
+    struct MHD_Daemon *d;   /**< libmicrohttpd daemon of the stub                          */
+    gchar *conn;            /**< connexion string of the stub (http://127.0.0.1:port)      */
+    GMutex mutex;           /**< protects everything below                                 */
+    GPtrArray *urls;        /**< urls of the requests answered, in order                   */
+    gint fail_after;        /**< number of requests answered before every other one fails
+                             *   (-1 to answer them all)                                   */
+} test_http_stub_t;
+
+
+/**
+ * Makes a new temporary directory.
+ * @param tmpl is the template of its name (it must end with XXXXXX).
+ * @returns a newly allocated name of the new directory.
+ */
+extern gchar *make_test_directory(const gchar *tmpl);
+
+
+/**
+ * Removes a directory and everything in it.
+ * @param dirname is the directory to be removed.
+ */
+extern void remove_test_directory(gchar *dirname);
+
+
+/**
+ * @param len is the length of the block's data.
+ * @param fill is the byte used to make the data.
+ * @returns a newly allocated block (not compressed) with its hash.
+ */
+extern hash_data_t *new_test_block(gsize len, guchar fill);
+
+
+/**
+ * Starts a stub server on a free port of the loopback interface.
+ * @returns a newly allocated test_http_stub_t that answers every
+ *          request.
+ */
+extern test_http_stub_t *start_test_http_stub(void);
+
+
+/**
+ * Tells the stub to fail the requests after a number of others have
+ * been answered. The requests already answered are forgotten.
+ * @param stub is the stub server.
+ * @param fail_after is the number of requests answered before every
+ *        other one fails (-1 to answer them all).
+ */
+extern void set_test_http_stub_failure(test_http_stub_t *stub, gint fail_after);
+
+
+/**
+ * Stops the stub server and frees it.
+ * @param stub is the stub server (may be NULL).
+ */
+extern void stop_test_http_stub(test_http_stub_t *stub);
+
+
+#endif /* #ifndef _TEST_HELPERS_H_ */
@@ -0,0 +1,300 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    test_reader.c
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file test_reader.c
+ *
+ * Tests of the reader: files of sizes around READER_SLOT_SIZE and sparse
+ * files with holes at their beginning, in their middle and at their end
+ * are read by GIO (depth 1) and by io_uring (depth > 1) and both must
+ * return the same bytes. io_uring tests are skipped when the kernel does
+ * not allow it.
+ */
+
+#include "libcdpfgl.h"
+#include "test_helpers.h"
+
+/**
+ * @def TEST_DIRECTORY
+ * Template of the name of the temporary directory of each test.
+ */
+#define TEST_DIRECTORY ("cdpfgl-reader-XXXXXX")
+
+/**
+ * @def TEST_READ_SIZE
+ * Number of bytes asked by each read: not a divisor of READER_SLOT_SIZE
+ * so that reads cross the slots.
+ */
+#define TEST_READ_SIZE (100000)
+
+/**
+ * @def TEST_HOLE_SIZE
+ * Length of the holes of the sparse file (a multiple of the block size
+ * of any filesystem).
+ */
+#define TEST_HOLE_SIZE (4 * READER_SLOT_SIZE)
+
+static guchar *new_test_contents(gsize size, guint seed);
+static gchar *write_test_file(gchar *dirname, guchar *contents, gsize size);
+static void write_test_data(gint fd, guchar *contents, gsize offset, gsize length);
+static reader_t *new_test_reader(guint depth);
+static void assert_read(reader_t *reader, gchar *filename, guchar *expected, gsize size);
+static void test_sizes(gconstpointer data);
+static void test_sparse(gconstpointer data);
+
+
+/**
+ * @param size is the length of the contents.
+ * @param seed makes contents of the same length different.
+ * @returns newly allocated contents with no zero byte so that they can
+ *          not be mistaken for a hole.
+ */
+static guchar *new_test_contents(gsize size, guint seed)
+{
+    guchar *contents = NULL;
+    gsize i = 0;
+
+    contents = (guchar *) g_malloc(MAX(size, 1));
+    g_assert_nonnull(contents);
+
+    for (i = 0; i < size; i++)
+        {
+            contents[i] = (guchar) (1 + (i * 31 + seed) % 255);
+        }
+
+    return contents;
+}
+
+
+/**
+ * Writes a file in a directory.
+ * @param dirname is the directory.
+ * @param contents is what the file contains.
+ * @param size is the length of contents.
+ * @returns the newly allocated name of the file.
+ */
+static gchar *write_test_file(gchar *dirname, guchar *contents, gsize size)
+{
+    gchar *name = NULL;
+    gchar *filename = NULL;
+
+    name = g_strdup_printf("file_%" G_GSIZE_FORMAT, size);
+    filename = g_build_filename(dirname, name, NULL);
+    g_assert(g_file_set_contents(filename, (gchar *) contents, size, NULL) == TRUE);
+
+    free_variable(name);
+
+    return filename;
+}
+
+
+/**
+ * Writes a part of contents at the same offset in a file.
+ * @param fd is the file descriptor of the file.
+ * @param contents is what the file will contain.
+ * @param offset is the offset of the part to be written.
+ * @param length is the length of this part.
+ */
+static void write_test_data(gint fd, guchar *contents, gsize offset, gsize length)
+{
+    g_assert_cmpint(pwrite(fd, contents + offset, length, offset), ==, (gssize) length);
+}
+
+
+/**
+ * @param depth is the number of reads in flight.
+ * @returns a newly allocated reader or NULL when the test is skipped:
+ *          io_uring is wanted (depth > 1) and is not available.
+ */
+static reader_t *new_test_reader(guint depth)
+{
+    reader_t *reader = NULL;
+
+    reader = new_reader_t(depth);
+
+    if (depth > 1 && reader->uring == FALSE)
+        {
+            free_reader_t(reader);
+            reader = NULL;
+            g_test_skip("io_uring is not available");
+        }
+    else
+        {
+            g_assert(reader->uring == (depth > 1));
+        }
+
+    return reader;
+}
+
+
+/**
+ * Asserts that a file is read as expected by TEST_READ_SIZE reads.
+ * @param reader is the reader used (it is reused by every call).
+ * @param filename is the file to be read.
+ * @param expected is what has to be read.
+ * @param size is the length of expected.
+ */
+static void assert_read(reader_t *reader, gchar *filename, guchar *expected, gsize size)
+{
+    GFile *a_file = NULL;
+    GError *error = NULL;
+    guchar *buffer = NULL;
+    gsize total = 0;
+    gsize bytes_read = 0;
+
+    a_file = g_file_new_for_path(filename);
+    buffer = (guchar *) g_malloc(TEST_READ_SIZE);
+    g_assert(reader_open(reader, a_file, &error) == TRUE);
+    g_assert_no_error(error);
+
+    do
+        {
+            g_assert(reader_read_all(reader, buffer, TEST_READ_SIZE, &bytes_read, &error) == TRUE);
+            g_assert_no_error(error);
+            g_assert_cmpuint(total + bytes_read, <=, size);
+            g_assert(memcmp(buffer, expected + total, bytes_read) == 0);
+            total = total + bytes_read;
+        }
+    while (bytes_read == TEST_READ_SIZE);
+
+    g_assert_cmpuint(total, ==, size);
+
+    /* Nothing more once the end of the file is reached */
+    g_assert(reader_read_all(reader, buffer, TEST_READ_SIZE, &bytes_read, &error) == TRUE);
+    g_assert_cmpuint(bytes_read, ==, 0);
+
+    reader_close(reader);
+    free_variable(buffer);
+    free_object(a_file);
+}
+
+
+/**
+ * Files of 0, READER_SLOT_SIZE - 1, READER_SLOT_SIZE and
+ * READER_SLOT_SIZE + 1 bytes are read as written: by GIO and by the
+ * reader of the test when it uses io_uring.
+ * @param data is the depth of the reader of the test.
+ */
+static void test_sizes(gconstpointer data)
+{
+    reader_t *reader = NULL;
+    reader_t *gio = NULL;
+    gchar *dirname = NULL;
+    gchar *filename = NULL;
+    guchar *contents = NULL;
+    gsize sizes[] = {0, READER_SLOT_SIZE - 1, READER_SLOT_SIZE, READER_SLOT_SIZE + 1};
+    guint i = 0;
+
+    reader = new_test_reader(GPOINTER_TO_UINT(data));
+
+    if (reader != NULL)
+        {
+            dirname = make_test_directory(TEST_DIRECTORY);
+            gio = new_reader_t(1);
+
+            for (i = 0; i < G_N_ELEMENTS(sizes); i++)
+                {
+                    contents = new_test_contents(sizes[i], i);
+                    filename = write_test_file(dirname, contents, sizes[i]);
+
+                    assert_read(gio, filename, contents, sizes[i]);
+                    assert_read(reader, filename, contents, sizes[i]);
+
+                    free_variable(filename);
+                    free_variable(contents);
+                }
+
+            free_reader_t(gio);
+            free_reader_t(reader);
+            remove_test_directory(dirname);
+            free_variable(dirname);
+        }
+}
+
+
+/**
+ * A sparse file that begins with a hole, has a hole between two parts of
+ * data and ends with a hole is read with zeros in its holes: by GIO and
+ * by the reader of the test when it uses io_uring.
+ * @param data is the depth of the reader of the test.
+ */
+static void test_sparse(gconstpointer data)
+{
+    reader_t *reader = NULL;
+    reader_t *gio = NULL;
+    gchar *dirname = NULL;
+    gchar *filename = NULL;
+    guchar *contents = NULL;
+    gsize first = TEST_HOLE_SIZE;
+    gsize first_len = READER_SLOT_SIZE + 12345;
+    gsize second = 0;
+    gsize second_len = 5000;
+    gsize size = 0;
+    gint fd = -1;
+
+    reader = new_test_reader(GPOINTER_TO_UINT(data));
+
+    if (reader != NULL)
+        {
+            dirname = make_test_directory(TEST_DIRECTORY);
+            filename = g_build_filename(dirname, "sparse", NULL);
+
+            second = first + first_len + TEST_HOLE_SIZE;
+            size = second + second_len + TEST_HOLE_SIZE + 123;
+
+            contents = new_test_contents(size, 7);
+            memset(contents, 0, first);
+            memset(contents + first + first_len, 0, second - first - first_len);
+            memset(contents + second + second_len, 0, size - second - second_len);
+
+            fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+            g_assert_cmpint(fd, >=, 0);
+            write_test_data(fd, contents, first, first_len);
+            write_test_data(fd, contents, second, second_len);
+            g_assert_cmpint(ftruncate(fd, size), ==, 0);
+            close(fd);
+
+            gio = new_reader_t(1);
+            assert_read(gio, filename, contents, size);
+            assert_read(reader, filename, contents, size);
+
+            free_reader_t(gio);
+            free_reader_t(reader);
+            free_variable(contents);
+            free_variable(filename);
+            remove_test_directory(dirname);
+            free_variable(dirname);
+        }
+}
+
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_data_func("/reader/sizes/gio", GUINT_TO_POINTER(1), test_sizes);
+    g_test_add_data_func("/reader/sizes/uring", GUINT_TO_POINTER(READER_DEFAULT_DEPTH), test_sizes);
+    g_test_add_data_func("/reader/sparse/gio", GUINT_TO_POINTER(1), test_sparse);
+    g_test_add_data_func("/reader/sparse/uring", GUINT_TO_POINTER(READER_DEFAULT_DEPTH), test_sparse);
+
+    return g_test_run();
+}
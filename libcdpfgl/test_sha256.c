@@ -0,0 +1,188 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    test_sha256.c
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file test_sha256.c
+ *
+ * Tests of the SHA256 engine: known digests, digests of every length
+ * around the padding boundaries compared to GLib's GChecksum and the
+ * SHA-NI engine compared to the portable one.
+ */
+
+#include "libcdpfgl.h"
+
+static gchar *digest_to_hex(guint8 *digest);
+static guchar *new_test_buffer(gsize len);
+static void assert_digest(const guchar *data, gsize len, const gchar *expected);
+static void test_known_digests(void);
+static void test_same_as_gchecksum(void);
+static void test_engines_agree(void);
+
+
+/**
+ * @param digest is a binary digest of HASH_LEN bytes.
+ * @returns a newly allocated hexadecimal string of digest.
+ */
+static gchar *digest_to_hex(guint8 *digest)
+{
+    GString *hex = NULL;
+    guint i = 0;
+
+    hex = g_string_new("");
+
+    for (i = 0; i < HASH_LEN; i++)
+        {
+            g_string_append_printf(hex, "%02x", digest[i]);
+        }
+
+    return g_string_free(hex, FALSE);
+}
+
+
+/**
+ * @param len is the length of the buffer.
+ * @returns a newly allocated buffer of len bytes that are not all the
+ *          same.
+ */
+static guchar *new_test_buffer(gsize len)
+{
+    guchar *buffer = NULL;
+    gsize i = 0;
+
+    buffer = (guchar *) g_malloc(len + 1);
+    g_assert_nonnull(buffer);
+
+    for (i = 0; i < len; i++)
+        {
+            buffer[i] = (guchar) ((i * 131 + (i >> 8)) & 0xff);
+        }
+
+    return buffer;
+}
+
+
+/**
+ * Asserts that sha256_digest() of data is expected.
+ * @param data is the buffer to be hashed.
+ * @param len is the length of data.
+ * @param expected is the expected digest in hexadecimal.
+ */
+static void assert_digest(const guchar *data, gsize len, const gchar *expected)
+{
+    guint8 digest[HASH_LEN];
+    gchar *hex = NULL;
+
+    sha256_digest(data, len, digest);
+    hex = digest_to_hex(digest);
+    g_assert_cmpstr(hex, ==, expected);
+
+    free_variable(hex);
+}
+
+
+/**
+ * Digests of FIPS 180-2 examples.
+ */
+static void test_known_digests(void)
+{
+    guchar *million = NULL;
+
+    assert_digest((const guchar *) "", 0, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    assert_digest((const guchar *) "abc", 3, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    assert_digest((const guchar *) "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 56, "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+
+    million = (guchar *) g_malloc(1000000);
+    memset(million, 'a', 1000000);
+    assert_digest(million, 1000000, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+    free_variable(million);
+}
+
+
+/**
+ * Digests of every length from 0 to 1100 bytes (every padding case)
+ * are the ones computed by GLib.
+ */
+static void test_same_as_gchecksum(void)
+{
+    GChecksum *checksum = NULL;
+    guchar *buffer = NULL;
+    gsize len = 0;
+
+    buffer = new_test_buffer(1100);
+
+    for (len = 0; len <= 1100; len++)
+        {
+            checksum = g_checksum_new(G_CHECKSUM_SHA256);
+            g_checksum_update(checksum, buffer, len);
+            assert_digest(buffer, len, g_checksum_get_string(checksum));
+            g_checksum_free(checksum);
+        }
+
+    free_variable(buffer);
+}
+
+
+/**
+ * SHA-NI and portable engines give the same digests for every length
+ * up to 64 blocks. Skipped when the CPU has no SHA extensions.
+ */
+static void test_engines_agree(void)
+{
+    guint8 portable[HASH_LEN];
+    guint8 shani[HASH_LEN];
+    guchar *buffer = NULL;
+    gsize len = 0;
+
+    g_assert(sha256_digest_with_engine(SHA256_ENGINE_PORTABLE, (const guchar *) "abc", 3, portable) == TRUE);
+
+    if (sha256_digest_with_engine(SHA256_ENGINE_SHANI, (const guchar *) "abc", 3, shani) == TRUE)
+        {
+            g_assert_cmpint(sha256_get_engine(), ==, SHA256_ENGINE_SHANI);
+            buffer = new_test_buffer(64 * 64);
+
+            for (len = 0; len <= 64 * 64; len++)
+                {
+                    g_assert(sha256_digest_with_engine(SHA256_ENGINE_PORTABLE, buffer, len, portable) == TRUE);
+                    g_assert(sha256_digest_with_engine(SHA256_ENGINE_SHANI, buffer, len, shani) == TRUE);
+                    g_assert(memcmp(portable, shani, HASH_LEN) == 0);
+                }
+
+            free_variable(buffer);
+        }
+    else
+        {
+            g_assert_cmpint(sha256_get_engine(), ==, SHA256_ENGINE_PORTABLE);
+            g_test_skip("CPU has no SHA extensions");
+        }
+}
+
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/sha256/known_digests", test_known_digests);
+    g_test_add_func("/sha256/same_as_gchecksum", test_same_as_gchecksum);
+    g_test_add_func("/sha256/engines_agree", test_engines_agree);
+
+    return g_test_run();
+}
@@ -0,0 +1,499 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    test_spool.c
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file test_spool.c
+ *
+ * Tests of the spool's segment files: records read back, crc32 checks,
+ * torn records left by a crash and what is recovered when a spool is
+ * opened again. Spools are transmitted to a stub server.
+ */
+
+#include "libcdpfgl.h"
+#include "test_helpers.h"
+
+/**
+ * @def TEST_DIRECTORY
+ * Template of the name of the temporary directory of each test.
+ */
+#define TEST_DIRECTORY ("cdpfgl-spool-XXXXXX")
+
+/**
+ * @def TEST_URL_FORMAT
+ * Format of the url of the numbered requests (all urls have the same
+ * length).
+ *
+ * @def TEST_BODY
+ * Body of the numbered requests.
+ */
+#define TEST_URL_FORMAT ("/Test_%04u.json")
+#define TEST_BODY ("{}")
+
+/**
+ * @def TEST_RECORD_LEN
+ * Length of a numbered record in a segment.
+ */
+#define TEST_RECORD_LEN (SPOOL_RECORD_HEADER_LEN + strlen("/Test_0000.json") + strlen(TEST_BODY))
+
+static void append_test_records(spool_t *spool);
+static void append_numbered_records(spool_t *spool, guint first, guint count);
+static void assert_stub_urls(test_http_stub_t *stub, guint first, guint count);
+static void count_failed_post(gpointer user_data, gchar *url, gchar *body, gsize length);
+static void assert_record(gint fd, guint64 offset, guint64 size, gchar *url, gchar *body, gsize length, guint64 *next);
+static void assert_no_record(gint fd, guint64 offset, guint64 size);
+static void test_records_read_back(void);
+static void test_crc_mismatch(void);
+static void test_torn_record(void);
+static void test_empty_segment_removed(void);
+static void test_spool_index(void);
+static void test_drained_spool_reopened(void);
+static void test_resume_after_failure(void);
+
+
+/**
+ * Appends three requests to the spool: a JSON one, a binary one (with
+ * \0 bytes) and one with an empty body.
+ * @param spool is the spool.
+ */
+static void append_test_records(spool_t *spool)
+{
+    g_assert(append_to_spool(spool, "/Meta.json", "{\"a\": 1}", 8) == TRUE);
+    g_assert(append_to_spool(spool, "/Data_Array.bin", "ab\0cd", 5) == TRUE);
+    g_assert(append_to_spool(spool, "/Data.json", "", 0) == TRUE);
+}
+
+
+/**
+ * Appends numbered requests to the spool (see TEST_URL_FORMAT).
+ * @param spool is the spool.
+ * @param first is the number of the first request.
+ * @param count is the number of requests to be appended.
+ */
+static void append_numbered_records(spool_t *spool, guint first, guint count)
+{
+    gchar *url = NULL;
+    guint i = 0;
+
+    for (i = first; i < first + count; i++)
+        {
+            url = g_strdup_printf(TEST_URL_FORMAT, i);
+            g_assert(append_to_spool(spool, url, TEST_BODY, strlen(TEST_BODY)) == TRUE);
+            free_variable(url);
+        }
+}
+
+
+/**
+ * Asserts that the stub answered exactly numbered requests in order.
+ * @param stub is the stub server.
+ * @param first is the number of the first request expected.
+ * @param count is the number of requests expected.
+ */
+static void assert_stub_urls(test_http_stub_t *stub, guint first, guint count)
+{
+    gchar *url = NULL;
+    guint i = 0;
+
+    g_assert_cmpuint(stub->urls->len, ==, count);
+
+    for (i = 0; i < count; i++)
+        {
+            url = g_strdup_printf(TEST_URL_FORMAT, first + i);
+            g_assert_cmpstr(g_ptr_array_index(stub->urls, i), ==, url);
+            free_variable(url);
+        }
+}
+
+
+/**
+ * Failure handler of the comm_t of the tests: counts the requests that
+ * failed.
+ * @param user_data is a guint * counter.
+ * @param url is the url of the request.
+ * @param body is the body of the request.
+ * @param length is the length of body.
+ */
+static void count_failed_post(gpointer user_data, gchar *url, gchar *body, gsize length)
+{
+    guint *failed = (guint *) user_data;
+
+    *failed = *failed + 1;
+}
+
+
+/**
+ * Asserts that a valid record is at offset.
+ * @param fd is the file descriptor of the segment.
+ * @param offset is the offset of the record.
+ * @param size is the size of the segment.
+ * @param url is the expected url.
+ * @param body is the expected body.
+ * @param length is the length of body.
+ * @param[out] next is the offset of the next record.
+ */
+static void assert_record(gint fd, guint64 offset, guint64 size, gchar *url, gchar *body, gsize length, guint64 *next)
+{
+    gchar *read_url = NULL;
+    gchar *read_body = NULL;
+    gsize read_length = 0;
+
+    g_assert(read_spool_record(fd, offset, size, &read_url, &read_body, &read_length, next) == TRUE);
+    g_assert_cmpstr(read_url, ==, url);
+    g_assert_cmpuint(read_length, ==, length);
+    g_assert(memcmp(read_body, body, length) == 0);
+    g_assert_cmpuint(*next, ==, offset + SPOOL_RECORD_HEADER_LEN + strlen(url) + length);
+
+    free_variable(read_url);
+    free_variable(read_body);
+}
+
+
+/**
+ * Asserts that no valid record is at offset.
+ * @param fd is the file descriptor of the segment.
+ * @param offset is the offset where a record is refused.
+ * @param size is the size of the segment.
+ */
+static void assert_no_record(gint fd, guint64 offset, guint64 size)
+{
+    gchar *read_url = NULL;
+    gchar *read_body = NULL;
+    gsize read_length = 0;
+    guint64 next = 0;
+
+    g_assert(read_spool_record(fd, offset, size, &read_url, &read_body, &read_length, &next) == FALSE);
+    g_assert_null(read_url);
+    g_assert_null(read_body);
+}
+
+
+/**
+ * Requests appended to a spool are read back from its segment once the
+ * spool has been opened again.
+ */
+static void test_records_read_back(void)
+{
+    gchar *dirname = NULL;
+    gchar *filename = NULL;
+    spool_t *spool = NULL;
+    struct stat buf;
+    guint64 next = 0;
+    gint fd = -1;
+
+    dirname = make_test_directory(TEST_DIRECTORY);
+
+    spool = new_spool_t(dirname);
+    g_assert(is_there_requests_in_spool(spool) == FALSE);
+    append_test_records(spool);
+    g_assert(is_there_requests_in_spool(spool) == TRUE);
+    free_spool_t(spool);
+
+    /* The segment of the previous run is closed and kept */
+    spool = new_spool_t(dirname);
+    g_assert_cmpuint(spool->closed, ==, 1);
+    g_assert_cmpuint(spool->write_seq, ==, 2);
+    g_assert(is_there_requests_in_spool(spool) == TRUE);
+
+    filename = get_spool_segment_filename(spool, 1);
+    fd = open(filename, O_RDONLY);
+    g_assert_cmpint(fd, >=, 0);
+    g_assert_cmpint(fstat(fd, &buf), ==, 0);
+
+    assert_record(fd, 0, buf.st_size, "/Meta.json", "{\"a\": 1}", 8, &next);
+    assert_record(fd, next, buf.st_size, "/Data_Array.bin", "ab\0cd", 5, &next);
+    assert_record(fd, next, buf.st_size, "/Data.json", "", 0, &next);
+    g_assert_cmpuint(next, ==, (guint64) buf.st_size);
+
+    close(fd);
+    free_variable(filename);
+    free_spool_t(spool);
+    remove_test_directory(dirname);
+    free_variable(dirname);
+}
+
+
+/**
+ * A record whose body does not match its crc32 is refused.
+ */
+static void test_crc_mismatch(void)
+{
+    gchar *dirname = NULL;
+    gchar *filename = NULL;
+    spool_t *spool = NULL;
+    struct stat buf;
+    guint64 next = 0;
+    guint64 second = 0;
+    gint fd = -1;
+
+    dirname = make_test_directory(TEST_DIRECTORY);
+    spool = new_spool_t(dirname);
+    append_test_records(spool);
+
+    filename = get_spool_segment_filename(spool, spool->write_seq);
+    free_spool_t(spool);
+
+    /* Changes the first byte of the second record's body */
+    second = SPOOL_RECORD_HEADER_LEN + strlen("/Meta.json") + 8;
+    fd = open(filename, O_RDWR);
+    g_assert_cmpint(fd, >=, 0);
+    g_assert_cmpint(pwrite(fd, "X", 1, second + SPOOL_RECORD_HEADER_LEN + strlen("/Data_Array.bin")), ==, 1);
+    g_assert_cmpint(fstat(fd, &buf), ==, 0);
+
+    assert_record(fd, 0, buf.st_size, "/Meta.json", "{\"a\": 1}", 8, &next);
+    g_assert_cmpuint(next, ==, second);
+    assert_no_record(fd, second, buf.st_size);
+
+    close(fd);
+    free_variable(filename);
+    remove_test_directory(dirname);
+    free_variable(dirname);
+}
+
+
+/**
+ * A record cut by a crash (in its header or in its body) is refused
+ * while the records before it are still read.
+ */
+static void test_torn_record(void)
+{
+    gchar *dirname = NULL;
+    gchar *filename = NULL;
+    spool_t *spool = NULL;
+    struct stat buf;
+    guint64 next = 0;
+    guint64 third = 0;
+    gint fd = -1;
+
+    dirname = make_test_directory(TEST_DIRECTORY);
+    spool = new_spool_t(dirname);
+    g_assert(append_to_spool(spool, "/Meta.json", "{\"a\": 1}", 8) == TRUE);
+    g_assert(append_to_spool(spool, "/Data_Array.bin", "ab\0cd", 5) == TRUE);
+    g_assert(append_to_spool(spool, "/Meta.json", "{\"b\": 2}", 8) == TRUE);
+
+    filename = get_spool_segment_filename(spool, spool->write_seq);
+    free_spool_t(spool);
+
+    fd = open(filename, O_RDWR);
+    g_assert_cmpint(fd, >=, 0);
+    g_assert_cmpint(fstat(fd, &buf), ==, 0);
+    third = buf.st_size - (SPOOL_RECORD_HEADER_LEN + strlen("/Meta.json") + 8);
+
+    /* Body of the last record cut */
+    g_assert_cmpint(ftruncate(fd, buf.st_size - 3), ==, 0);
+    assert_record(fd, 0, buf.st_size - 3, "/Meta.json", "{\"a\": 1}", 8, &next);
+    assert_record(fd, next, buf.st_size - 3, "/Data_Array.bin", "ab\0cd", 5, &next);
+    g_assert_cmpuint(next, ==, third);
+    assert_no_record(fd, third, buf.st_size - 3);
+
+    /* Header of the last record cut */
+    g_assert_cmpint(ftruncate(fd, third + 6), ==, 0);
+    assert_no_record(fd, third, third + 6);
+
+    close(fd);
+    free_variable(filename);
+    remove_test_directory(dirname);
+    free_variable(dirname);
+}
+
+
+/**
+ * An empty segment left by a previous run is removed and new requests
+ * go to a segment after the last one found.
+ */
+static void test_empty_segment_removed(void)
+{
+    gchar *dirname = NULL;
+    gchar *spooldir = NULL;
+    gchar *basename = NULL;
+    gchar *filename = NULL;
+    spool_t *spool = NULL;
+
+    dirname = make_test_directory(TEST_DIRECTORY);
+    spooldir = g_build_filename(dirname, SPOOL_DIRECTORY, NULL);
+    g_assert_cmpint(g_mkdir_with_parents(spooldir, 0700), ==, 0);
+    basename = g_strconcat("0000000000000005", SPOOL_SEGMENT_SUFFIX, NULL);
+    filename = g_build_filename(spooldir, basename, NULL);
+    g_assert(g_file_set_contents(filename, "", 0, NULL) == TRUE);
+
+    spool = new_spool_t(dirname);
+    g_assert(g_file_test(filename, G_FILE_TEST_EXISTS) == FALSE);
+    g_assert_cmpuint(spool->closed, ==, 0);
+    g_assert_cmpuint(spool->write_seq, ==, 6);
+    g_assert(is_there_requests_in_spool(spool) == FALSE);
+
+    free_spool_t(spool);
+    free_variable(filename);
+    free_variable(basename);
+    free_variable(spooldir);
+    remove_test_directory(dirname);
+    free_variable(dirname);
+}
+
+
+/**
+ * The position of the first request not transmitted is kept between
+ * runs and an unreadable index means that nothing has been transmitted.
+ */
+static void test_spool_index(void)
+{
+    gchar *dirname = NULL;
+    spool_t *spool = NULL;
+
+    dirname = make_test_directory(TEST_DIRECTORY);
+
+    spool = new_spool_t(dirname);
+    acknowledge_spool(spool, 3, 42);
+    free_spool_t(spool);
+
+    spool = new_spool_t(dirname);
+    g_assert_cmpuint(spool->read_seq, ==, 3);
+    g_assert_cmpuint(spool->read_offset, ==, 42);
+    g_assert(g_file_set_contents(spool->index_filename, "garbage", -1, NULL) == TRUE);
+    free_spool_t(spool);
+
+    spool = new_spool_t(dirname);
+    g_assert_cmpuint(spool->read_seq, ==, 0);
+    g_assert_cmpuint(spool->read_offset, ==, 0);
+    free_spool_t(spool);
+
+    remove_test_directory(dirname);
+    free_variable(dirname);
+}
+
+
+/**
+ * Once every segment has been transmitted and deleted, a spool opened
+ * again transmits its new requests from their beginning: the position
+ * saved while the last segment was transmitted is not used in a new
+ * segment.
+ */
+static void test_drained_spool_reopened(void)
+{
+    test_http_stub_t *stub = NULL;
+    comm_t *comm = NULL;
+    gchar *dirname = NULL;
+    gchar *filename = NULL;
+    spool_t *spool = NULL;
+
+    dirname = make_test_directory(TEST_DIRECTORY);
+    stub = start_test_http_stub();
+    comm = init_comm_struct(stub->conn, COMPRESS_NONE_TYPE);
+
+    spool = new_spool_t(dirname);
+    append_numbered_records(spool, 0, SPOOL_ACK_BATCH + 10);
+    filename = get_spool_segment_filename(spool, spool->write_seq);
+    g_assert(transmit_spool(spool, comm) == TRUE);
+    assert_stub_urls(stub, 0, SPOOL_ACK_BATCH + 10);
+    g_assert(g_file_test(filename, G_FILE_TEST_EXISTS) == FALSE);
+    g_assert(is_there_requests_in_spool(spool) == FALSE);
+    free_spool_t(spool);
+
+    spool = new_spool_t(dirname);
+    g_assert_cmpuint(spool->closed, ==, 0);
+    append_numbered_records(spool, 100, 3);
+    set_test_http_stub_failure(stub, -1);
+    g_assert(transmit_spool(spool, comm) == TRUE);
+    assert_stub_urls(stub, 100, 3);
+    free_spool_t(spool);
+
+    free_variable(filename);
+    free_comm_t(comm);
+    stop_test_http_stub(stub);
+    remove_test_directory(dirname);
+    free_variable(dirname);
+}
+
+
+/**
+ * A transmission that fails keeps the position of the last batch of
+ * SPOOL_ACK_BATCH requests that were all transmitted: the segment is
+ * kept and the next transmission (after a restart) resumes from there.
+ * Failed requests go to the spool and not to the failure handler of the
+ * comm_t, which is given back afterwards.
+ */
+static void test_resume_after_failure(void)
+{
+    test_http_stub_t *stub = NULL;
+    comm_t *comm = NULL;
+    gchar *dirname = NULL;
+    gchar *filename = NULL;
+    spool_t *spool = NULL;
+    guint failed = 0;
+
+    dirname = make_test_directory(TEST_DIRECTORY);
+    stub = start_test_http_stub();
+    comm = init_comm_struct(stub->conn, COMPRESS_NONE_TYPE);
+    set_comm_failure_handler(comm, count_failed_post, &failed);
+
+    spool = new_spool_t(dirname);
+    append_numbered_records(spool, 0, 100);
+    filename = get_spool_segment_filename(spool, spool->write_seq);
+
+    /* Fails in the middle of the second batch */
+    set_test_http_stub_failure(stub, SPOOL_ACK_BATCH + 6);
+    g_assert(transmit_spool(spool, comm) == FALSE);
+    g_assert_cmpuint(spool->read_offset, ==, SPOOL_ACK_BATCH * TEST_RECORD_LEN);
+    g_assert(g_file_test(filename, G_FILE_TEST_EXISTS) == TRUE);
+    g_assert(is_there_requests_in_spool(spool) == TRUE);
+    g_assert_cmpuint(failed, ==, 0);
+    g_assert(comm->save_failed == count_failed_post);
+    free_spool_t(spool);
+
+    spool = new_spool_t(dirname);
+    g_assert_cmpuint(spool->read_offset, ==, SPOOL_ACK_BATCH * TEST_RECORD_LEN);
+    set_test_http_stub_failure(stub, -1);
+    g_assert(transmit_spool(spool, comm) == TRUE);
+    assert_stub_urls(stub, SPOOL_ACK_BATCH, 100 - SPOOL_ACK_BATCH);
+    g_assert(g_file_test(filename, G_FILE_TEST_EXISTS) == FALSE);
+    g_assert(is_there_requests_in_spool(spool) == FALSE);
+    g_assert_cmpuint(failed, ==, 0);
+    free_spool_t(spool);
+
+    free_variable(filename);
+    free_comm_t(comm);
+    stop_test_http_stub(stub);
+    remove_test_directory(dirname);
+    free_variable(dirname);
+}
+
+
+int main(int argc, char **argv)
+{
+    gint result = 0;
+
+    g_test_init(&argc, &argv, NULL);
+    ignore_sigpipe();
+    curl_global_init(CURL_GLOBAL_ALL);
+
+    g_test_add_func("/spool/records_read_back", test_records_read_back);
+    g_test_add_func("/spool/crc_mismatch", test_crc_mismatch);
+    g_test_add_func("/spool/torn_record", test_torn_record);
+    g_test_add_func("/spool/empty_segment_removed", test_empty_segment_removed);
+    g_test_add_func("/spool/index", test_spool_index);
+    g_test_add_func("/spool/drained_spool_reopened", test_drained_spool_reopened);
+    g_test_add_func("/spool/resume_after_failure", test_resume_after_failure);
+
+    result = g_test_run();
+    curl_global_cleanup();
+
+    return result;
+}
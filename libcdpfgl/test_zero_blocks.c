@@ -0,0 +1,258 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    test_zero_blocks.c
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file test_zero_blocks.c
+ *
+ * Tests of blocks of zeros: the reserved hash that encodes their length,
+ * the lengths accepted, the index of a list of blocks that leaves them
+ * out and the holes they make in a restored file, including one at its
+ * end.
+ */
+
+#include "libcdpfgl.h"
+#include "test_helpers.h"
+
+/**
+ * @def TEST_DIRECTORY
+ * Template of the name of the directory where files are restored.
+ *
+ * @def TEST_HOLE_LEN
+ * Length of the hole made in the middle of the restored file.
+ *
+ * @def TEST_END_HOLE_LEN
+ * Length of the hole made at the end of the restored file.
+ */
+#define TEST_DIRECTORY ("cdpfgl-zero-blocks-XXXXXX")
+#define TEST_HOLE_LEN (1048576)
+#define TEST_END_HOLE_LEN (65536)
+
+static void test_hash_encoding(void);
+static void test_length_validity(void);
+static void test_list_index(void);
+static void test_holes(void);
+static void write_test_string(GFileOutputStream *stream, const gchar *string);
+
+
+/**
+ * The reserved hash is ZERO_BLOCK_PREFIX_LEN zero bytes followed by the
+ * length of the block as a big endian 64 bits integer.
+ */
+static void test_hash_encoding(void)
+{
+    guint8 a_hash[HASH_LEN];
+    guint8 expected[HASH_LEN];
+    hash_data_t *block = NULL;
+
+    memset(expected, 0, HASH_LEN);
+    expected[HASH_LEN - 3] = 0x01;
+    expected[HASH_LEN - 2] = 0x02;
+    expected[HASH_LEN - 1] = 0x03;
+
+    make_zero_block_hash(a_hash, 0x010203);
+    g_assert_cmpmem(a_hash, HASH_LEN, expected, HASH_LEN);
+    g_assert_true(is_zero_block_hash(a_hash));
+    g_assert_cmpint(get_zero_block_hash_length(a_hash), ==, 0x010203);
+
+    make_zero_block_hash(a_hash, BLOCK_MAX_SIZE);
+    g_assert_true(is_zero_block_hash(a_hash));
+    g_assert_cmpint(get_zero_block_hash_length(a_hash), ==, BLOCK_MAX_SIZE);
+
+    /* A length of 0 is not a block: 32 zero bytes are not a reserved hash */
+    make_zero_block_hash(a_hash, 0);
+    g_assert_false(is_zero_block_hash(a_hash));
+
+    /* A hash with something in its prefix is a real hash */
+    make_zero_block_hash(a_hash, 4096);
+    a_hash[0] = 0x01;
+    g_assert_false(is_zero_block_hash(a_hash));
+
+    block = new_test_block(4096, 'a');
+    g_assert_false(is_zero_block_hash(block->hash));
+    free_hash_data_t(block);
+}
+
+
+/**
+ * Blocks of zeros are at most BLOCK_MAX_SIZE bytes long: a longer one
+ * is not made into data.
+ */
+static void test_length_validity(void)
+{
+    guint8 a_hash[HASH_LEN];
+    hash_data_t *block = NULL;
+    guchar zeros[4096];
+
+    memset(zeros, 0, sizeof(zeros));
+    g_assert_true(is_zero_block(zeros, sizeof(zeros)));
+    g_assert_false(is_zero_block(zeros, 0));
+    zeros[sizeof(zeros) - 1] = 0x01;
+    g_assert_false(is_zero_block(zeros, sizeof(zeros)));
+
+    make_zero_block_hash(a_hash, 4096);
+    g_assert_true(is_zero_block_length_valid(a_hash));
+
+    block = new_zero_block_hash_data_t(a_hash);
+    g_assert_nonnull(block);
+    g_assert_cmpint(block->read, ==, 4096);
+    g_assert_cmpint(block->uncmplen, ==, 4096);
+    g_assert_cmpint(block->cmptype, ==, COMPRESS_NONE_TYPE);
+    g_assert_true(is_zero_block(block->data, block->read));
+    g_assert_cmpmem(block->hash, HASH_LEN, a_hash, HASH_LEN);
+    free_hash_data_t(block);
+
+    make_zero_block_hash(a_hash, BLOCK_MAX_SIZE + 1);
+    g_assert_true(is_zero_block_hash(a_hash));
+    g_assert_false(is_zero_block_length_valid(a_hash));
+    g_assert_null(new_zero_block_hash_data_t(a_hash));
+}
+
+
+/**
+ * The index of a list of blocks leaves blocks of zeros out and only
+ * points to the first of the blocks that have the same hash.
+ */
+static void test_list_index(void)
+{
+    GList *hash_data_list = NULL;
+    GHashTable *index = NULL;
+    hash_data_t *first = NULL;
+    hash_data_t *again = NULL;
+    hash_data_t *other = NULL;
+    hash_data_t *zero = NULL;
+    guint8 *a_hash = NULL;
+    GList *found = NULL;
+
+    a_hash = (guint8 *) g_malloc(HASH_LEN);
+    make_zero_block_hash(a_hash, 4096);
+    zero = new_hash_data_t_as_is(NULL, 0, a_hash, COMPRESS_NONE_TYPE, 4096);
+
+    first = new_test_block(4096, 'a');
+    again = new_test_block(4096, 'a');
+    other = new_test_block(4096, 'b');
+
+    hash_data_list = g_list_append(hash_data_list, zero);
+    hash_data_list = g_list_append(hash_data_list, first);
+    hash_data_list = g_list_append(hash_data_list, again);
+    hash_data_list = g_list_append(hash_data_list, other);
+
+    index = make_hash_data_list_index(hash_data_list);
+
+    g_assert_cmpuint(g_hash_table_size(index), ==, 2);
+    g_assert_false(g_hash_table_contains(index, zero->hash));
+
+    found = g_hash_table_lookup(index, again->hash);
+    g_assert_true(found == g_list_nth(hash_data_list, 1));
+    g_assert_true(found->data == first);
+
+    found = g_hash_table_lookup(index, other->hash);
+    g_assert_true(found == g_list_nth(hash_data_list, 3));
+
+    g_hash_table_destroy(index);
+    g_list_free_full(hash_data_list, free_hdt_struct);
+}
+
+
+/**
+ * Writes a string to a stream and checks that it has been written.
+ * @param stream is the stream of the file being written.
+ * @param string is the string to be written.
+ */
+static void write_test_string(GFileOutputStream *stream, const gchar *string)
+{
+    GError *error = NULL;
+    gsize written = 0;
+
+    g_assert_true(g_output_stream_write_all((GOutputStream *) stream, string, strlen(string), &written, NULL, &error));
+    g_assert_no_error(error);
+    g_assert_cmpuint(written, ==, strlen(string));
+}
+
+
+/**
+ * Blocks of zeros are skipped when a file is restored: the file gets
+ * holes instead of zeros written to disk and its size is set when it
+ * ends with one.
+ */
+static void test_holes(void)
+{
+    gchar *dirname = NULL;
+    gchar *filename = NULL;
+    GFile *file = NULL;
+    GFileOutputStream *stream = NULL;
+    GError *error = NULL;
+    guint8 a_hash[HASH_LEN];
+    gchar *contents = NULL;
+    gsize length = 0;
+    struct stat st;
+
+    dirname = make_test_directory(TEST_DIRECTORY);
+    filename = g_build_filename(dirname, "sparse", NULL);
+    file = g_file_new_for_path(filename);
+
+    stream = g_file_replace(file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, &error);
+    g_assert_no_error(error);
+
+    write_test_string(stream, "abc");
+    make_zero_block_hash(a_hash, TEST_HOLE_LEN);
+    g_assert_true(skip_zero_block_in_stream(stream, a_hash));
+    write_test_string(stream, "def");
+    make_zero_block_hash(a_hash, TEST_END_HOLE_LEN);
+    g_assert_true(skip_zero_block_in_stream(stream, a_hash));
+    g_assert_true(end_stream_with_hole(stream));
+
+    g_assert_true(g_output_stream_close((GOutputStream *) stream, NULL, &error));
+    g_assert_no_error(error);
+
+    g_assert_true(g_file_get_contents(filename, &contents, &length, &error));
+    g_assert_no_error(error);
+    g_assert_cmpuint(length, ==, 3 + TEST_HOLE_LEN + 3 + TEST_END_HOLE_LEN);
+    g_assert_cmpmem(contents, 3, "abc", 3);
+    g_assert_true(is_zero_block((guchar *) contents + 3, TEST_HOLE_LEN));
+    g_assert_cmpmem(contents + 3 + TEST_HOLE_LEN, 3, "def", 3);
+    g_assert_true(is_zero_block((guchar *) contents + 6 + TEST_HOLE_LEN, TEST_END_HOLE_LEN));
+
+    /* Holes do not use any space on disk */
+    g_assert_cmpint(stat(filename, &st), ==, 0);
+    g_assert_cmpint(st.st_size, ==, (off_t) length);
+    g_assert_cmpint((gint64) st.st_blocks * 512, <, (gint64) st.st_size);
+
+    free_variable(contents);
+    g_object_unref(stream);
+    g_object_unref(file);
+    free_variable(filename);
+    remove_test_directory(dirname);
+    free_variable(dirname);
+}
+
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/zero_blocks/hash_encoding", test_hash_encoding);
+    g_test_add_func("/zero_blocks/length_validity", test_length_validity);
+    g_test_add_func("/zero_blocks/list_index", test_list_index);
+    g_test_add_func("/zero_blocks/holes", test_holes);
+
+    return g_test_run();
+}
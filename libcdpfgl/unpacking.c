@@ -291,6 +291,47 @@ gchar *get_json_version(gchar *json_str)
 }
 
 
+/**
+ * Tells whether a version json string as returned by server's server
+ * advertises a protocol in its "protocols" array.
+ * @param json_str : a gchar * containing the JSON formated string.
+ * @param protocol : the name of the protocol (PROTOCOL_BINARY for
+ *        instance).
+ * @returns TRUE if protocol is in the array and FALSE otherwise (older
+ *          servers have no such array).
+ */
+gboolean is_protocol_in_json_version(gchar *json_str, gchar *protocol)
+{
+    json_t *root = NULL;     /** json_t *root is the json tree from which we will extract protocols */
+    json_t *array = NULL;    /** json_t *array is the "protocols" array                              */
+    json_t *value = NULL;    /** json_t *value : value = array[index] when iterating                 */
+    size_t index = 0;
+    gboolean found = FALSE;
+
+    if (json_str != NULL && protocol != NULL)
+        {
+            root = load_json(json_str);
+
+            if (root != NULL)
+                {
+                    array = json_object_get(root, "protocols");
+
+                    json_array_foreach(array, index, value)
+                        {
+                            if (g_strcmp0(json_string_value(value), protocol) == 0)
+                                {
+                                    found = TRUE;
+                                }
+                        }
+
+                    json_decref(root);
+                }
+        }
+
+    return found;
+}
+
+
 /**
  * This function returns a list of hash_data_t * from an json array
  * @param root is the root json string that may contain an array named "name"
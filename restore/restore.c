@@ -40,6 +40,8 @@ static GSList *get_files_from_server(res_struct_t *res_struct, query_t *query);
 static void print_list_of_smeta(GSList *list);
 static void print_all_files(res_struct_t *res_struct, query_t *query);
 static void print_all_versions(res_struct_t *res_struct, query_t *query);
+static gboolean write_frames_to_stream(GFileOutputStream *stream, guchar *buffer, gsize length);
+static void restore_blocks_to_stream(res_struct_t *res_struct, GFileOutputStream *stream, hash_extract_t *hash_extract, gint max);
 static void restore_data_to_stream(res_struct_t *res_struct, GFileOutputStream *stream, GList *hash_list, gint max);
 static void create_file(res_struct_t *res_struct, meta_data_t *meta);
 static void print_debug_file_info(meta_data_t *meta);
@@ -463,23 +465,175 @@ static void print_all_versions(res_struct_t *res_struct, query_t *query)
 
 
 /**
- * Writes data obtained from the server with the hash_list hashs
- * to the stream.
+ * Writes the blocks of a framed answer (see framing.h) to the stream.
+ * Blocks come as the server stores them: compressed ones are
+ * uncompressed here.
  * @param stream is the stream where we are writing data (MUST be opened
  *        and not NULL)
- * @param hash_list list of hashs of the file to be restored
+ * @param buffer is the framed answer of the server.
+ * @param length is the length of buffer.
+ * @returns TRUE if every block has been written and FALSE otherwise.
+ */
+static gboolean write_frames_to_stream(GFileOutputStream *stream, guchar *buffer, gsize length)
+{
+    GList *frames = NULL;
+    GList *iter = NULL;
+    hash_data_t *hash_data = NULL;
+    hash_data_t *zeros = NULL;
+    compress_t *compress = NULL;
+    GError *error = NULL;
+    gboolean written = FALSE;
+
+    frames = convert_frames_to_hash_data_list(buffer, length);
+    written = (frames != NULL);
+
+    for (iter = frames; iter != NULL && written == TRUE; iter = g_list_next(iter))
+        {
+            hash_data = iter->data;
+
+            if (hash_data->data == NULL)
+                {
+                    /* A block of zeros carries no data */
+                    zeros = new_zero_block_hash_data_t(hash_data->hash);
+
+                    if (zeros != NULL)
+                        {
+                            g_output_stream_write((GOutputStream *) stream, zeros->data, zeros->read, NULL, &error);
+                            free_hash_data_t(zeros);
+                        }
+                    else
+                        {
+                            print_error(__FILE__, __LINE__, _("Error: invalid block of zeros.\n"));
+                            written = FALSE;
+                        }
+                }
+            else if (hash_data->cmptype == COMPRESS_NONE_TYPE)
+                {
+                    g_output_stream_write((GOutputStream *) stream, hash_data->data, hash_data->read, NULL, &error);
+                }
+            else
+                {
+                    compress = uncompress_buffer(hash_data->data, hash_data->read, hash_data->uncmplen, hash_data->cmptype);
+
+                    if (compress != NULL)
+                        {
+                            g_output_stream_write((GOutputStream *) stream, compress->text, compress->len, NULL, &error);
+                            free_compress_t(compress);
+                        }
+                    else
+                        {
+                            print_error(__FILE__, __LINE__, _("Error while uncompressing one block.\n"));
+                            written = FALSE;
+                        }
+                }
+
+            if (error != NULL)
+                {
+                    print_error(__FILE__, __LINE__, _("Error while writing data: %s\n"), error->message);
+                    free_error(error);
+                    error = NULL;
+                    written = FALSE;
+                }
+        }
+
+    g_list_free_full(frames, free_hdt_struct);
+
+    return written;
+}
+
+
+/**
+ * Gets from the server the data of at most max hashs of hash_extract's
+ * list (it stops before a block of zeros) and writes it to the stream.
+ * Blocks are asked as binary frames when the server speaks this protocol
+ * and as one base64 encoded JSON block otherwise.
+ * @param res_struct is the main structure for cdpfglrestore program.
+ * @param stream is the stream where we are writing data (MUST be opened
+ *        and not NULL)
+ * @param hash_extract contains the list of hashs still to be restored.
+ *        Its list is moved after the hashs that have been requested.
  * @param max is the maximum number of hashs to include into the header
- * @todo error management.
  */
-static void restore_data_to_stream(res_struct_t *res_struct, GFileOutputStream *stream, GList *hash_list, gint max)
+static void restore_blocks_to_stream(res_struct_t *res_struct, GFileOutputStream *stream, hash_extract_t *hash_extract, gint max)
 {
     gchar *hash = NULL;
     hash_data_t *hash_data = NULL;
-    hash_extract_t *hash_extract = NULL;
     GError *error = NULL;
     gchar *request = NULL;
     gchar *header = NULL;
     gint res = CURLE_FAILED_INIT;
+    gboolean binary = FALSE;
+
+    binary = does_server_speak_binary(res_struct->comm);
+    header = create_x_get_hash_array_http_header(hash_extract, max);
+
+    if (binary == TRUE)
+        {
+            request = g_strdup_printf("/Data/Hash_Array.bin");
+        }
+    else
+        {
+            request = g_strdup_printf("/Data/Hash_Array.json");
+        }
+
+    print_debug(_("Query is: %s with header %s\n"), request, header);
+    res = get_url(res_struct->comm, request, header);
+
+    if (res == CURLE_OK && binary == TRUE)
+        {
+            if (write_frames_to_stream(stream, (guchar *) res_struct->comm->buffer, res_struct->comm->pos) == FALSE)
+                {
+                    print_error(__FILE__, __LINE__, _("Error while trying to restore blocks from %s\n"), request);
+                }
+
+            free_variable(res_struct->comm->buffer);
+            res_struct->comm->buffer = NULL;
+        }
+    else if (res == CURLE_OK)
+        {
+            /** We need to save the retrieved buffer */
+            if (res_struct->comm->buffer != NULL)
+                {
+                    hash_data = convert_string_to_hash_data(res_struct->comm->buffer);
+                    free_variable(res_struct->comm->buffer);
+                    res_struct->comm->buffer = NULL; /* This is a way to know that this variable has been freed */
+
+                    if (hash_data != NULL)
+                        {
+                            g_output_stream_write((GOutputStream *) stream, hash_data->data, hash_data->read, NULL, &error);
+                            free_hash_data_t(hash_data);
+                        }
+                    else
+                        {
+                            print_error(__FILE__, __LINE__, _("Error while trying to restore %s hash\n"), hash);
+                        }
+                }
+        }
+    else
+        {
+            print_error(__FILE__, __LINE__, _("Error while getting hash %s"), hash);
+        }
+
+    free_variable(request);
+    free_variable(header);
+}
+
+
+/**
+ * Writes data obtained from the server with the hash_list hashs
+ * to the stream. Blocks of zeros are not asked to the server: the
+ * stream is moved forward instead so that they become holes.
+ * @param stream is the stream where we are writing data (MUST be opened
+ *        and not NULL)
+ * @param hash_list list of hashs of the file to be restored
+ * @param max is the maximum number of hashs to include into the header
+ * @todo error management.
+ */
+static void restore_data_to_stream(res_struct_t *res_struct, GFileOutputStream *stream, GList *hash_list, gint max)
+{
+    hash_data_t *block = NULL;
+    hash_extract_t *hash_extract = NULL;
+    gboolean hole = FALSE;
 
     if (stream != NULL)
         {
@@ -488,39 +642,24 @@ static void restore_data_to_stream(res_struct_t *res_struct, GFileOutputStream *
 
             while (hash_extract->hash_list != NULL)
                 {
+                    block = hash_extract->hash_list->data;
 
-                    header = create_x_get_hash_array_http_header(hash_extract, max);
-                    request = g_strdup_printf("/Data/Hash_Array.json");
-                    print_debug(_("Query is: %s with header %s\n"), request, header);
-                    res = get_url(res_struct->comm, request, header);
-
-                    if (res == CURLE_OK)
+                    if (is_zero_block_hash(block->hash) == TRUE)
                         {
-                            /** We need to save the retrieved buffer */
-                            if (res_struct->comm->buffer != NULL)
-                                {
-                                    hash_data = convert_string_to_hash_data(res_struct->comm->buffer);
-                                    free_variable(res_struct->comm->buffer);
-                                    res_struct->comm->buffer = NULL; /* This is a way to know that this variable has been freed */
-
-                                    if (hash_data != NULL)
-                                        {
-                                            g_output_stream_write((GOutputStream *) stream, hash_data->data, hash_data->read, NULL, &error);
-                                            free_hash_data_t(hash_data);
-                                        }
-                                    else
-                                        {
-                                            print_error(__FILE__, __LINE__, _("Error while trying to restore %s hash\n"), hash);
-                                        }
-                                }
+                            skip_zero_block_in_stream(stream, block->hash);
+                            hole = TRUE;
+                            hash_extract->hash_list = g_list_next(hash_extract->hash_list);
                         }
                     else
                         {
-                            print_error(__FILE__, __LINE__, _("Error while getting hash %s"), hash);
+                            hole = FALSE;
+                            restore_blocks_to_stream(res_struct, stream, hash_extract, max);
                         }
+                }
 
-                    free_variable(request);
-                    free_variable(header);
+            if (hole == TRUE)
+                {
+                    end_stream_with_hole(stream);
                 }
         }
 }
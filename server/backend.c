@@ -38,9 +38,11 @@
  * @param build_needed_hash_list a function that must build a GSList * needed hash list
  * @param get_list_of_files gets the list of saved files
  * @param retrieve_data retrieves data from a specified hash.
+ * @param terminate_backend flushes and frees the backend when the
+ *        server ends.
  * @returns a newly created backend_t structure initialized to nothing !
  */
-backend_t *init_backend_structure(void *store_smeta, void *store_data, void *init_backend, void *build_needed_hash_list, void *get_list_of_files, void * retrieve_data)
+backend_t *init_backend_structure(void *store_smeta, void *store_data, void *init_backend, void *build_needed_hash_list, void *get_list_of_files, void * retrieve_data, void *terminate_backend)
 {
     backend_t *backend = NULL;
 
@@ -53,6 +55,7 @@ backend_t *init_backend_structure(void *store_smeta, void *store_data, void *ini
     backend->build_needed_hash_list = build_needed_hash_list;
     backend->get_list_of_files = get_list_of_files;
     backend->retrieve_data = retrieve_data;
+    backend->terminate_backend = terminate_backend;
 
     return backend;
 }
@@ -43,9 +43,10 @@ typedef void (* store_smeta_func) (void *, server_meta_data_t *);   /**< Stores
 typedef void (* store_data_func) (void *, hash_data_t *);            /**< Stores a hash_data_t structure according to the backend                                    */
 typedef GList * (* build_needed_hash_list_func) (void *, GList *);   /**< A function that will check if a hash is already known and build a list
                                                                       *   of needed hashs that the client may send                                                   */
-typedef void (* init_backend_func) (void *);                         /**< A function that will initialize the backend if needed                                      */
+typedef gboolean (* init_backend_func) (void *);                     /**< A function that will initialize the backend if needed (FALSE when it fails)                */
 typedef gchar * (* get_list_of_files_func) (void *, query_t *);      /**< A function that returns a JSON formatted string of saved files corresponding to the query  */
 typedef hash_data_t * (* retrieve_data_func) (void *, gchar *);      /**< A function that returns the buffer associated to a specific hash                           */
+typedef void (* terminate_backend_func) (void *);                    /**< A function that flushes and frees the backend once nothing is stored anymore               */
 
 
 /**
@@ -60,6 +61,7 @@ typedef struct
     init_backend_func init_backend;
     get_list_of_files_func get_list_of_files;
     retrieve_data_func retrieve_data;
+    terminate_backend_func terminate_backend;
     void *user_data;                                     /**< user_data should be used by backends to store their own internal structure */
 } backend_t;
 
@@ -73,9 +75,11 @@ typedef struct
  * @param build_needed_hash_list a function that must build a GSList * needed hash list
  * @param get_list_of_files gets the list of saved files
  * @param retrieve_data retrieves data from a specified hash.
+ * @param terminate_backend flushes and frees the backend when the
+ *        server ends.
  * @returns a newly created backend_t structure initialized to nothing !
  */
-extern backend_t *init_backend_structure(void *store_smeta, void *store_data, void *init_backend, void *build_needed_hash_list, void *get_list_of_files, void * retrieve_data);
+extern backend_t *init_backend_structure(void *store_smeta, void *store_data, void *init_backend, void *build_needed_hash_list, void *get_list_of_files, void * retrieve_data, void *terminate_backend);
 
 
 
@@ -40,9 +40,9 @@ static void read_one_buffer(buffer_t *a_buffer);
 static gchar *extract_one_line_from_buffer(buffer_t *a_buffer);
 static meta_data_t *extract_from_line(gchar *line, GRegex *a_regex, query_t *query);
 static GList *get_file_list_from_regex_and_query(GFileInputStream *stream, GRegex *a_regex, query_t *query);
-static gshort get_cmptype_from_file_meta(gchar *filename);
-static gssize get_uncmplen_from_file_meta(gchar *filename);
-static void set_metadata_to_file_meta(gchar *filename, gssize uncmplen, gshort cmptype);
+static gboolean is_block_stored(file_backend_t *file_backend, gchar *prefix, guint8 *hash);
+static guint migrate_data_directory(gchar *path, guint depth);
+static void migrate_data_directory_in_pool(gpointer data, gpointer user_data);
 
 /**
  * Stores meta data into a flat file. A file is created for each host that
@@ -58,28 +58,45 @@ static void set_metadata_to_file_meta(gchar *filename, gssize uncmplen, gshort c
  * @todo prefix should be set as a configuration's option.
  */
 void file_store_smeta(server_struct_t *server_struct, server_meta_data_t *smeta)
+{
+    file_backend_t *file_backend = NULL;
+
+    if (server_struct != NULL && server_struct->backend != NULL && server_struct->backend->user_data != NULL)
+        {
+            file_backend = server_struct->backend->user_data;
+            store_smeta_into_directory(file_backend->prefix, smeta);
+        }
+}
+
+
+/**
+ * Appends meta data to the flat file of the host that sent them in the
+ * "meta" sub directory of a backend's directory.
+ * @param directory is the directory of the backend.
+ * @param smeta the server's structure for file meta data. It contains the
+ *        hostname that sent it.
+ */
+void store_smeta_into_directory(gchar *directory, server_meta_data_t *smeta)
 {
     GFile *meta_file = NULL;
     gchar *filename = NULL;
     GFileOutputStream *stream = NULL;
     GError *error = NULL;
     gsize count = 0;
-    gssize written = 0;
+    gsize written = 0;
     gchar *string_written = NULL;
     gchar *buffer = NULL;
     gchar *hash_list = NULL;
     meta_data_t *meta = NULL;
     gchar *prefix = NULL;
-    file_backend_t *file_backend = NULL;
     gchar *name64 = NULL;
     gchar *link64 = NULL;
 
 
-    if (server_struct != NULL && server_struct->backend != NULL && server_struct->backend->user_data != NULL && smeta != NULL)
+    if (directory != NULL && smeta != NULL)
         {
             meta = smeta->meta;
-            file_backend = server_struct->backend->user_data;
-            prefix = g_build_filename((gchar *) file_backend->prefix, "meta", NULL);
+            prefix = g_build_filename(directory, "meta", NULL);
 
             if (smeta->hostname != NULL && meta != NULL)
                 {
@@ -153,7 +170,8 @@ void file_store_smeta(server_struct_t *server_struct, server_meta_data_t *smeta)
  * Builds the filename of a block represented by a hash
  * @param path is the whole path.
  * @param hex_hash the hash to be stored / retrieved.
- * @param cmptype is the compression type (COMPRESS_NONE_TYPE, COMPRESS_ZLIB_TYPE).
+ * @param cmptype is the compression type (COMPRESS_NONE_TYPE, COMPRESS_ZLIB_TYPE,
+ *        COMPRESS_ZSTD_TYPE or COMPRESS_LZ4_TYPE).
  * @param level is the level chosen to store hashs.
  */
 static gchar *build_filename_from_hash(gchar *path, gchar *hex_hash, guint level)
@@ -172,158 +190,234 @@ static gchar *build_filename_from_hash(gchar *path, gchar *hex_hash, guint level
 
 
 /**
- * Gets cmptype from meta hash file.
+ * Gets cmptype and uncmplen (the uncompressed len of the block) from the
+ * .meta file of a block.
  * @param filename is the filename of the hash. The meta file has the
  *        same name but ends with .meta
- * @returns cmptype if possible or COMPRESS_NONE_TYPE.
+ * @param[out] cmptype the compression type of the block or
+ *             COMPRESS_NONE_TYPE.
+ * @param[out] uncmplen the len of the uncompressed block or 0.
+ * @returns TRUE if the block has a .meta file and FALSE otherwise.
  */
-static gshort get_cmptype_from_file_meta(gchar *filename)
+gboolean get_values_from_file_meta(gchar *filename, gshort *cmptype, gssize *uncmplen)
 {
     gchar *filename_meta = NULL;
     GKeyFile *keyfile = NULL;
     GError *error = NULL;
-    gshort cmptype = COMPRESS_NONE_TYPE;
+    gboolean has_meta = FALSE;
 
     filename_meta = g_strdup_printf("%s.meta", filename);
-    keyfile = g_key_file_new();
+    *cmptype = COMPRESS_NONE_TYPE;
+    *uncmplen = 0;
 
-    if (g_key_file_load_from_file(keyfile, filename_meta, G_KEY_FILE_KEEP_COMMENTS, &error))
+    /* Most blocks have no .meta file: a stat is far cheaper than
+     * failing to load a keyfile. */
+    if (g_file_test(filename_meta, G_FILE_TEST_EXISTS) == TRUE)
         {
-            cmptype = (gshort) read_int_from_file(keyfile, filename_meta, GN_META, KN_CMPTYPE, _("Error while reading cmptype value"), COMPRESS_NONE_TYPE);
+            keyfile = g_key_file_new();
+
+            if (g_key_file_load_from_file(keyfile, filename_meta, G_KEY_FILE_KEEP_COMMENTS, &error))
+                {
+                    *cmptype = (gshort) read_int_from_file(keyfile, filename_meta, GN_META, KN_CMPTYPE, _("Error while reading cmptype value"), COMPRESS_NONE_TYPE);
+                    *uncmplen = read_int64_from_file(keyfile, filename_meta, GN_META, KN_UNCMPLEN, _("Error while reading uncmplen value"), 0);
+                    has_meta = TRUE;
+                }
+
+            g_key_file_free(keyfile);
+            free_error(error);
         }
 
-    g_key_file_free(keyfile);
+    free_variable(filename_meta);
 
-    if (is_compress_type_allowed(cmptype) == FALSE)
+    if (is_compress_type_known(*cmptype) == FALSE)
         {
-            cmptype = COMPRESS_NONE_TYPE;
+            *cmptype = COMPRESS_NONE_TYPE;
         }
 
-    return cmptype;
+    return has_meta;
 }
 
 
 /**
- * Gets uncmplen: The uncompressed len of hash file from meta hash file.
- * @param filename is the filename of the hash. The meta file has the
- *        same name but ends with .meta
- * @returns the len of the uncompressed hash file or 0.
+ * Encodes the header that begins a block file.
+ * @param[out] header is a buffer of FILE_BLOCK_HEADER_LEN bytes.
+ * @param cmptype the compression type used to store this block.
+ * @param uncmplen the len of the uncompressed block.
  */
-static gssize get_uncmplen_from_file_meta(gchar *filename)
+void encode_block_header(guchar *header, gshort cmptype, gssize uncmplen)
 {
-    gchar *filename_meta = NULL;
-    GKeyFile *keyfile = NULL;
-    GError *error = NULL;
-    gssize uncmplen = 0;
+    guint16 be_cmptype = 0;
+    guint64 be_uncmplen = 0;
 
-    filename_meta = g_strdup_printf("%s.meta", filename);
-    keyfile = g_key_file_new();
-
-    if (g_key_file_load_from_file(keyfile, filename_meta, G_KEY_FILE_KEEP_COMMENTS, &error))
+    if (is_compress_type_known(cmptype) == FALSE)
         {
-            uncmplen = read_int64_from_file(keyfile, filename_meta, GN_META, KN_UNCMPLEN, _("Error while reading uncmplen value"), 0);
+            cmptype = COMPRESS_NONE_TYPE;
         }
 
-    g_key_file_free(keyfile);
+    be_cmptype = GUINT16_TO_BE((guint16) cmptype);
+    be_uncmplen = GUINT64_TO_BE((guint64) uncmplen);
 
-    return uncmplen;
+    memset(header, 0, FILE_BLOCK_HEADER_LEN);
+    memcpy(header, FILE_BLOCK_MAGIC, 4);
+    memcpy(header + 4, &be_cmptype, 2);
+    memcpy(header + 8, &be_uncmplen, 8);
 }
 
+
 /**
- * Sets cmptype and uncmplen in meta hash file.
- * @param filename is the filename of the hash. The meta file has the
- *        same name but ends with .meta
- * @param uncmplen the len of the uncompressed hash file.
- * @param cmptype the compression type used to store this hash file.
+ * Decodes the header that begins a block file. The magic alone does not
+ * make a header: the unused bytes must be 0 and the compression type
+ * must be a known one.
+ * @param header is the beginning of the block file.
+ * @param length is the number of bytes in header.
+ * @param[out] cmptype the compression type of the block.
+ * @param[out] uncmplen the len of the uncompressed block.
+ * @returns TRUE if the file begins with a header and FALSE otherwise (a
+ *          block stored with a .meta file).
  */
-static void set_metadata_to_file_meta(gchar *filename, gssize uncmplen, gshort cmptype)
+gboolean decode_block_header(guchar *header, gsize length, gshort *cmptype, gssize *uncmplen)
 {
-    gchar *filename_meta = NULL;
-    GKeyFile *keyfile = NULL;
-    GError *error = NULL;
+    guint16 be_cmptype = 0;
+    guint64 be_uncmplen = 0;
 
-    filename_meta = g_strdup_printf("%s.meta", filename);
-    keyfile = g_key_file_new();
-
-    if (is_compress_type_allowed(cmptype) == FALSE)
+    if (length < FILE_BLOCK_HEADER_LEN || memcmp(header, FILE_BLOCK_MAGIC, 4) != 0 || header[6] != 0 || header[7] != 0)
         {
-            cmptype = COMPRESS_NONE_TYPE;
+            return FALSE;
         }
 
-    g_key_file_set_int64(keyfile, GN_META, KN_UNCMPLEN, uncmplen);
-    g_key_file_set_integer(keyfile, GN_META, KN_CMPTYPE, cmptype);
+    memcpy(&be_cmptype, header + 4, 2);
+    memcpy(&be_uncmplen, header + 8, 8);
+    *cmptype = (gshort) GUINT16_FROM_BE(be_cmptype);
+    *uncmplen = (gssize) GUINT64_FROM_BE(be_uncmplen);
 
-    g_key_file_save_to_file(keyfile, filename_meta, &error);
+    return is_compress_type_known(*cmptype);
+}
 
-    g_key_file_free(keyfile);
-    free_variable(filename_meta);
+
+/**
+ * Says whether a block file that has a .meta file begins with a header
+ * written from that .meta file by migrate_block_file() (that was
+ * interrupted before removing it). Data of blocks stored with a .meta
+ * file may begin with anything so any other header is data.
+ * @param header is the beginning of the block file.
+ * @param length is the number of bytes in header.
+ * @param cmptype the compression type read from the .meta file.
+ * @param uncmplen the uncompressed len read from the .meta file.
+ * @returns TRUE if the file begins with such a header, FALSE otherwise.
+ */
+gboolean is_block_header_as_in_meta(guchar *header, gsize length, gshort cmptype, gssize uncmplen)
+{
+    gshort header_cmptype = 0;
+    gssize header_uncmplen = 0;
+
+    if (decode_block_header(header, length, &header_cmptype, &header_uncmplen) == TRUE)
+        {
+            return (header_cmptype == cmptype && header_uncmplen == uncmplen);
+        }
+    else
+        {
+            return FALSE;
+        }
 }
 
 
 /**
  * Stores data into a flat file. The file is named by its hash in hex
- * representation (one should easily check that the sha256sum of such a
- * file gives its name !).
+ * representation and begins with a header (FILE_BLOCK_MAGIC, cmptype and
+ * uncmplen) followed by the data as sent by the client.
  * @param server_struct is the server's main structure where all
  *        informations needed by the program are stored.
  * @param hash_data is a hash_data_t * structure that contains the hash and
  *        the corresponding data in a binary form and a 'read' field that
- *        contains the number of bytes in 'data' field.
+ *        contains the number of bytes in 'data' field. Blocks of zeros
+ *        are dropped (see is_zero_block_hash()).
  * @todo return errors when they occurs
  */
 void file_store_data(server_struct_t *server_struct, hash_data_t *hash_data)
 {
     GFile *data_file = NULL;
     gchar *filename = NULL;
+    gchar *filename_meta = NULL;
     GFileOutputStream *stream = NULL;
     GError *error = NULL;
-    gssize written = 0;
+    gsize written = 0;
     gchar *string_written = NULL;
     gchar *hex_hash = NULL;
     gchar *path = NULL;
     gchar *prefix = NULL;
     file_backend_t *file_backend = NULL;
+    guchar header[FILE_BLOCK_HEADER_LEN];
 
     if (server_struct != NULL && server_struct->backend != NULL && server_struct->backend->user_data != NULL)
         {
             file_backend = server_struct->backend->user_data;
             prefix = g_build_filename((gchar *) file_backend->prefix, "data", NULL);
 
-            if (hash_data != NULL && hash_data->hash != NULL && hash_data->data != NULL)
+            if (hash_data != NULL && is_zero_block_hash(hash_data->hash) == TRUE)
+                {
+                    /* Blocks of zeros are rebuilt from their hash: they are never stored */
+                    free_hash_data_t(hash_data);
+                }
+            else if (hash_data != NULL && hash_data->hash != NULL && hash_data->data != NULL)
                 {
                     path = make_path_from_hash(prefix, hash_data->hash, file_backend->level);
                     hex_hash = hash_to_string(hash_data->hash);
 
                     filename = build_filename_from_hash(path, hex_hash, file_backend->level);
-                    set_metadata_to_file_meta(filename, hash_data->uncmplen, hash_data->cmptype);
+                    filename_meta = g_strdup_printf("%s.meta", filename);
 
-                    data_file = g_file_new_for_path(filename);
-                    stream = g_file_replace(data_file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, &error);
-
-                    if (stream != NULL)
+                    if (file_backend->migrated == FALSE && g_file_test(filename_meta, G_FILE_TEST_EXISTS) == TRUE)
                         {
-                            written = g_output_stream_write((GOutputStream *) stream, hash_data->data, hash_data->read, NULL, &error);
-
-                            if (error != NULL)
-                                {
-                                    string_written = g_strdup_printf("%"G_GSSIZE_FORMAT, written);
-                                    print_error(__FILE__, __LINE__, _("Error: unable to write to file %s (%s bytes written).\n"), filename, string_written);
-                                    free_variable(string_written);
-                                }
-
-                            g_output_stream_close((GOutputStream *) stream, NULL, &error);
-
-                            g_object_unref(stream);
-                            free_variable(hash_data->data);
-                            free_variable(hash_data->hash);
-                            free_variable(hash_data);
+                            /* Already stored with a .meta file (not converted yet by
+                             * --migrate-blocks): rewriting it would make this .meta
+                             * file describe a file that begins with a header. */
+                            insert_into_hash_index(file_backend->index, hash_data->hash);
                         }
                     else
                         {
-                            print_error(__FILE__, __LINE__, _("Error: unable to open file %s to write data in it.\n"), filename);
+                            encode_block_header(header, hash_data->cmptype, hash_data->uncmplen);
+
+                            data_file = g_file_new_for_path(filename);
+                            stream = g_file_replace(data_file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, &error);
+
+                            if (stream != NULL)
+                                {
+                                    if (g_output_stream_write_all((GOutputStream *) stream, header, FILE_BLOCK_HEADER_LEN, NULL, NULL, &error) == TRUE)
+                                        {
+                                            g_output_stream_write_all((GOutputStream *) stream, hash_data->data, hash_data->read, &written, NULL, &error);
+                                        }
+
+                                    if (error != NULL)
+                                        {
+                                            string_written = g_strdup_printf("%"G_GSIZE_FORMAT, written);
+                                            print_error(__FILE__, __LINE__, _("Error: unable to write to file %s (%s bytes written).\n"), filename, string_written);
+                                            free_variable(string_written);
+                                            free_error(error);
+                                            g_output_stream_close((GOutputStream *) stream, NULL, NULL);
+                                        }
+                                    else if (g_output_stream_close((GOutputStream *) stream, NULL, &error) == TRUE && written == hash_data->read)
+                                        {
+                                            /* Only a block fully written and closed may be announced as stored */
+                                            insert_into_hash_index(file_backend->index, hash_data->hash);
+                                        }
+                                    else
+                                        {
+                                            print_error(__FILE__, __LINE__, _("Error: unable to close file %s.\n"), filename);
+                                            free_error(error);
+                                        }
+
+                                    g_object_unref(stream);
+                                }
+                            else
+                                {
+                                    print_error(__FILE__, __LINE__, _("Error: unable to open file %s to write data in it.\n"), filename);
+                                    free_error(error);
+                                }
                         }
 
+                    free_hash_data_t(hash_data);
                     free_object(data_file);
+                    free_variable(filename_meta);
                     free_variable(filename);
                     free_variable(hex_hash);
                     free_variable(path);
@@ -331,6 +425,7 @@ void file_store_data(server_struct_t *server_struct, hash_data_t *hash_data)
             else
                 {
                     print_error(__FILE__, __LINE__, _("Error: no hash_data_t structure or hash in it or missing data in it.\n"));
+                    free_hash_data_t(hash_data);
                 }
 
             free_variable(prefix);
@@ -338,6 +433,45 @@ void file_store_data(server_struct_t *server_struct, hash_data_t *hash_data)
 }
 
 
+/**
+ * Says whether a block is stored. The hash index answers in memory and
+ * the data tree is only looked at when there is no index.
+ * @param file_backend is the file backend structure.
+ * @param prefix is the "data" directory of the backend.
+ * @param hash is the hash of the block in binary form.
+ * @returns TRUE if the block is stored and FALSE otherwise.
+ */
+static gboolean is_block_stored(file_backend_t *file_backend, gchar *prefix, guint8 *hash)
+{
+    GFile *data_file = NULL;
+    gchar *hex_hash = NULL;
+    gchar *filename = NULL;
+    gchar *path = NULL;
+    gboolean stored = FALSE;
+
+    if (file_backend->index != NULL)
+        {
+            stored = is_hash_in_index(file_backend->index, hash);
+        }
+    else
+        {
+            path = make_path_from_hash(prefix, hash, file_backend->level);
+            hex_hash = hash_to_string(hash);
+            filename = build_filename_from_hash(path, hex_hash, file_backend->level);
+            data_file = g_file_new_for_path(filename);
+
+            stored = g_file_query_exists(data_file, NULL);
+
+            free_object(data_file);
+            free_variable(filename);
+            free_variable(hex_hash);
+            free_variable(path);
+        }
+
+    return stored;
+}
+
+
 /**
  * Builds a list of hashs that cdpfglerver's server needs.
  * @param server_struct is the server's main structure where all
@@ -348,12 +482,9 @@ void file_store_data(server_struct_t *server_struct, hash_data_t *hash_data)
  */
 GList *file_build_needed_hash_list(server_struct_t *server_struct, GList *hash_data_list)
 {
-    GFile *data_file = NULL;
     GList *head = hash_data_list;
     GList *needed = NULL;
-    gchar *hex_hash = NULL;
-    gchar *filename = NULL;
-    gchar *path = NULL;
+    GHashTable *asked = NULL;
     gchar *prefix = NULL;
     file_backend_t *file_backend = NULL;
     hash_data_t *hash_data = NULL;
@@ -366,34 +497,34 @@ GList *file_build_needed_hash_list(server_struct_t *server_struct, GList *hash_d
 
             prefix = g_build_filename((gchar *) file_backend->prefix, "data", NULL);
 
+            /* Hashs already looked at (a hash may appear many times in the list) */
+            asked = g_hash_table_new(hash_digest_hash, hash_digest_equal);
+
             while (head != NULL)
                 {
                     hash_data = head->data;
-                    path = make_path_from_hash(prefix, hash_data->hash, file_backend->level);
-                    hex_hash = hash_to_string(hash_data->hash);
-                    filename = build_filename_from_hash(path, hex_hash, file_backend->level);
-                    data_file = g_file_new_for_path(filename);
 
                     /* @todo : do we need to request compressed hash if we have an uncompressed version ?
                      * Also : how can the program thy to answer this without knowing that the hash will be compressed or not ? */
 
-                    if (g_file_query_exists(data_file, NULL) == FALSE && hash_data_is_in_list(hash_data, needed) == FALSE)
+                    if (g_hash_table_contains(asked, hash_data->hash) == FALSE)
                         {
-                            /* file does not exists and is not in the needed list so we need it!
-                             * thus putting it it the needed list
-                             */
-                            needed_hash_data = copy_only_hash(hash_data, NULL);
-                            needed = g_list_prepend(needed, needed_hash_data);
-                        }
+                            g_hash_table_add(asked, hash_data->hash);
 
-                    free_object(data_file);
-                    free_variable(filename);
-                    free_variable(hex_hash);
-                    free_variable(path);
+                            if (is_block_stored(file_backend, prefix, hash_data->hash) == FALSE)
+                                {
+                                    /* block is not stored and is not in the needed list so we need it!
+                                     * thus putting it it the needed list
+                                     */
+                                    needed_hash_data = copy_only_hash(hash_data, NULL);
+                                    needed = g_list_prepend(needed, needed_hash_data);
+                                }
+                        }
 
                     head = g_list_next(head);
                 }
 
+            g_hash_table_destroy(asked);
             needed = g_list_reverse(needed);
             free_variable(prefix);
         }
@@ -529,11 +660,14 @@ static void read_from_group_file_backend(file_backend_t *file_backend, gchar *fi
  * indirections
  * @param server_struct is the server's main structure where all
  *        informations needed by the program are stored.
+ * @returns TRUE if the backend is ready and FALSE otherwise. Without
+ *          its hash index the backend looks into the data tree.
  */
-void file_init_backend(server_struct_t *server_struct)
+gboolean file_init_backend(server_struct_t *server_struct)
 {
     file_backend_t *file_backend = NULL;
     gchar *path = NULL;
+    gboolean ready = FALSE;
 
     if (server_struct != NULL && server_struct->backend != NULL)
         {
@@ -560,14 +694,33 @@ void file_init_backend(server_struct_t *server_struct)
                     fprintf(stdout, _("Please wait while creating directories\n"));
                     make_all_subdirectories(file_backend);
                     fprintf(stdout, _("Finished !\n"));
+
+                    if (file_exists(path) == TRUE)
+                        {
+                            /* A new tree: its blocks will never have a .meta file */
+                            free_variable(path);
+                            path = g_build_filename(file_backend->prefix, "data", FILE_BACKEND_MIGRATED, NULL);
+                            create_directory(path);
+                        }
                 }
             free_variable(path);
 
+            path = g_build_filename(file_backend->prefix, "data", FILE_BACKEND_MIGRATED, NULL);
+            file_backend->migrated = file_exists(path);
+            free_variable(path);
+
+            path = g_build_filename(file_backend->prefix, "data", NULL);
+            file_backend->index = open_hash_index(file_backend->prefix, path, file_backend->level);
+            free_variable(path);
+
+            ready = TRUE;
         }
     else
         {
             print_error(__FILE__, __LINE__, _("Error: no server structure or no backend structure.\n"));
         }
+
+    return ready;
 }
 
 
@@ -878,8 +1031,30 @@ static GList *get_file_list_from_regex_and_query(GFileInputStream *stream, GRege
  */
 gchar *file_get_list_of_files(server_struct_t *server_struct, query_t *query)
 {
-    gchar *filename = NULL;
     file_backend_t *file_backend = NULL;
+    gchar *directory = NULL;
+
+    if (server_struct != NULL && server_struct->backend != NULL &&  server_struct->backend->user_data != NULL)
+        {
+            file_backend = server_struct->backend->user_data;
+            directory = file_backend->prefix;
+        }
+
+    return get_list_of_files_from_directory(directory, query);
+}
+
+
+/**
+ * Gets the list of saved files from the "meta" sub directory of a
+ * backend's directory.
+ * @param directory is the directory of the backend.
+ * @param query is the structure that contains everything about the
+ *        requested query.
+ * @returns a JSON string containing all filenames requested
+ */
+gchar *get_list_of_files_from_directory(gchar *directory, query_t *query)
+{
+    gchar *filename = NULL;
     GFile *the_file = NULL;
     GFileInputStream *stream = NULL;
     GError *error = NULL;
@@ -890,14 +1065,13 @@ gchar *file_get_list_of_files(server_struct_t *server_struct, query_t *query)
     GList *file_list = NULL;
 
 
-    if (server_struct != NULL && server_struct->backend != NULL &&  server_struct->backend->user_data != NULL && query != NULL)
+    if (directory != NULL && query != NULL)
         {
             print_debug(_("file_backend: filter is: %s && %s && %s && %s\n"), query->filename, query->date, query->afterdate, query->beforedate);
 
             a_regex = g_regex_new(query->filename, G_REGEX_CASELESS, 0, &error);
 
-            file_backend = server_struct->backend->user_data;
-            filename =  g_build_filename(file_backend->prefix, "meta", query->hostname, NULL);
+            filename =  g_build_filename(directory, "meta", query->hostname, NULL);
             the_file = g_file_new_for_path(filename);
 
             print_debug(_("file_backend: Reading in %s\n"), filename);
@@ -955,8 +1129,11 @@ gchar *file_get_list_of_files(server_struct_t *server_struct, query_t *query)
 
 /**
  * Retrieves data from a flat file. The file is named by its hash in hex
- * representation (one should easily check that the sha256sum of such a
- * file gives its name !).
+ * representation and begins with a header that tells how the block is
+ * compressed. Blocks stored before this header existed (and not
+ * converted with --migrate-blocks) have no valid header and get this
+ * information from their .meta file that is only looked for in trees
+ * that may still have some (see FILE_BACKEND_MIGRATED).
  * @param server_struct is the server's main structure where all
  *        informations needed by the program are stored.
  * @param hex_hash is a gchar * hash in hexadecimal format as retrieved
@@ -964,21 +1141,18 @@ gchar *file_get_list_of_files(server_struct_t *server_struct, query_t *query)
  */
 hash_data_t *file_retrieve_data(server_struct_t *server_struct, gchar *hex_hash)
 {
-    GFile *data_file = NULL;
     gchar *filename = NULL;
-    GFileInputStream *stream = NULL;
     GError *error = NULL;
-    gssize size_read = 0;
-    gchar *string_read = NULL;
     gchar *path = NULL;
     gchar *prefix = NULL;
     file_backend_t *file_backend = NULL;
     hash_data_t *hash_data = NULL;
-    guchar *data = NULL;
+    gchar *contents = NULL;
+    gsize length = 0;
     guint8 *hash = NULL;
-    guint64 filesize = 0;
     gshort cmptype = 0;
     gssize uncmplen = 0;
+    gboolean has_header = FALSE;
 
 
     if (server_struct != NULL && server_struct->backend != NULL && server_struct->backend->user_data != NULL)
@@ -988,44 +1162,42 @@ hash_data_t *file_retrieve_data(server_struct_t *server_struct, gchar *hex_hash)
             hash = string_to_hash(hex_hash);
             path = make_path_from_hash(prefix, hash, file_backend->level);
             filename = build_filename_from_hash(path, hex_hash, file_backend->level);
-            cmptype = get_cmptype_from_file_meta(filename);
-            data_file = g_file_new_for_path(filename);
-            stream = g_file_read(data_file, NULL, &error);
 
-            if (stream != NULL)
+            /* we can do this because files here are blocks and
+             * may not be too big: as large as the biggest CLIENT_BUFFER_SIZE. */
+            if (g_file_get_contents(filename, &contents, &length, &error) == TRUE)
                 {
-                    filesize = get_file_size(data_file);
-                    /* we can do this because files here are blocks and
-                     * may not be too big: as large as the biggest CLIENT_BUFFER_SIZE. */
-                    data = (guchar *) g_malloc(filesize + 1);   /* No need to do g_malloc0  because data is binary data */
-
-                    size_read = g_input_stream_read((GInputStream *) stream, data, filesize, NULL, &error);
-
-                    if (error != NULL)
+                    /* sets COMPRESS_NONE_TYPE and 0 without a .meta file */
+                    if (file_backend->migrated == TRUE || get_values_from_file_meta(filename, &cmptype, &uncmplen) == FALSE)
                         {
-                            string_read = g_strdup_printf("%"G_GSSIZE_FORMAT, size_read);
-                            print_error(__FILE__, __LINE__, _("Error: unable to read from file %s (%s bytes read): %s.\n"), filename, string_read, error->message);
-                            free_variable(string_read);
-                            free_error(error);
+                            has_header = decode_block_header((guchar *) contents, length, &cmptype, &uncmplen);
                         }
                     else
                         {
-                            /* We need to know the compression type directly from the stored filename */
-                            uncmplen = get_uncmplen_from_file_meta(filename);
+                            /* Data of a block stored with a .meta file may begin
+                             * like a header: it is only one when it has been
+                             * written from this .meta file by an interrupted
+                             * migrate_block_file().
+                             */
+                            has_header = is_block_header_as_in_meta((guchar *) contents, length, cmptype, uncmplen);
+                        }
 
-                            /* see retreive_data() in server.c */
-                            hash_data = new_hash_data_t_as_is(data, size_read, hash, cmptype, uncmplen);
+                    if (has_header == TRUE)
+                        {
+                            length = length - FILE_BLOCK_HEADER_LEN;
+                            memmove(contents, contents + FILE_BLOCK_HEADER_LEN, length);
                         }
 
-                    g_input_stream_close((GInputStream *) stream, NULL, &error);
-                    g_object_unref(stream);
+                    /* see retreive_data() in server.c */
+                    hash_data = new_hash_data_t_as_is((guchar *) contents, length, hash, cmptype, uncmplen);
                 }
             else
                 {
-                     print_error(__FILE__, __LINE__, _("Error: unable to open file %s to read data from it.\n"), filename);
+                    print_error(__FILE__, __LINE__, _("Error: unable to read file %s: %s.\n"), filename, error->message);
+                    free_error(error);
+                    free_variable(hash);
                 }
 
-            free_object(data_file);
             free_variable(filename);
             free_variable(path);
             free_variable(prefix);
@@ -1033,3 +1205,247 @@ hash_data_t *file_retrieve_data(server_struct_t *server_struct, gchar *hex_hash)
 
     return hash_data;
 }
+
+
+/**
+ * Converts a block file that has a .meta file: its compression type
+ * and uncompressed length are written in a header at the beginning of
+ * the file (the file is replaced atomically) and the .meta file is
+ * removed. The .meta file is only removed once the file begins with a
+ * header written from it: either here or by a previous conversion that
+ * was interrupted before removing it.
+ * @param filename is the block file.
+ * @returns TRUE if the block has been converted and FALSE otherwise.
+ */
+gboolean migrate_block_file(gchar *filename)
+{
+    GError *error = NULL;
+    gchar *filename_meta = NULL;
+    gchar *contents = NULL;
+    gchar *converted = NULL;
+    gsize length = 0;
+    gshort cmptype = 0;
+    gssize uncmplen = 0;
+    gboolean done = FALSE;
+
+    filename_meta = g_strdup_printf("%s.meta", filename);
+
+    if (get_values_from_file_meta(filename, &cmptype, &uncmplen) == TRUE && g_file_get_contents(filename, &contents, &length, &error) == TRUE)
+        {
+            if (is_block_header_as_in_meta((guchar *) contents, length, cmptype, uncmplen) == TRUE)
+                {
+                    done = TRUE;
+                }
+            else
+                {
+                    converted = (gchar *) g_malloc(length + FILE_BLOCK_HEADER_LEN);
+                    encode_block_header((guchar *) converted, cmptype, uncmplen);
+                    memcpy(converted + FILE_BLOCK_HEADER_LEN, contents, length);
+
+                    done = g_file_set_contents(filename, converted, length + FILE_BLOCK_HEADER_LEN, &error);
+                    free_variable(converted);
+                }
+        }
+
+    if (done == TRUE)
+        {
+            unlink(filename_meta);
+        }
+    else if (error != NULL)
+        {
+            print_error(__FILE__, __LINE__, _("Error: unable to convert block file %s: %s\n"), filename, error->message);
+            free_error(error);
+        }
+
+    free_variable(contents);
+    free_variable(filename_meta);
+
+    return done;
+}
+
+
+/**
+ * Converts every block file of a directory of the data tree that has a
+ * .meta file.
+ * @param path is the directory to be converted.
+ * @param depth is the number of directory levels below path.
+ * @returns the number of block files (or directories) that could not
+ *          be converted.
+ */
+static guint migrate_data_directory(gchar *path, guint depth)
+{
+    GDir *dir = NULL;
+    GError *error = NULL;
+    const gchar *name = NULL;
+    gchar *sub_path = NULL;
+    gchar *block_path = NULL;
+    guint failures = 0;
+
+    dir = g_dir_open(path, 0, &error);
+
+    if (dir != NULL)
+        {
+            name = g_dir_read_name(dir);
+
+            while (name != NULL)
+                {
+                    sub_path = g_build_filename(path, name, NULL);
+
+                    if (depth > 0 && g_file_test(sub_path, G_FILE_TEST_IS_DIR) == TRUE)
+                        {
+                            failures = failures + migrate_data_directory(sub_path, depth - 1);
+                        }
+                    else if (depth == 0 && g_str_has_suffix(name, ".meta") == TRUE)
+                        {
+                            block_path = g_strndup(sub_path, strlen(sub_path) - strlen(".meta"));
+
+                            if (file_exists(block_path) == TRUE && migrate_block_file(block_path) == FALSE)
+                                {
+                                    failures = failures + 1;
+                                }
+
+                            free_variable(block_path);
+                        }
+
+                    free_variable(sub_path);
+                    name = g_dir_read_name(dir);
+                }
+
+            g_dir_close(dir);
+        }
+    else
+        {
+            print_error(__FILE__, __LINE__, _("Unable to open directory %s: %s\n"), path, error->message);
+            free_error(error);
+            failures = failures + 1;
+        }
+
+    return failures;
+}
+
+
+/**
+ * Converts a directory of the first level of the data tree. This is the
+ * function run by the threads of file_migrate_blocks().
+ * @param data is a gchar * path of the directory that is freed here.
+ * @param user_data is the migration_t * structure shared by the threads.
+ */
+static void migrate_data_directory_in_pool(gpointer data, gpointer user_data)
+{
+    gchar *path = (gchar *) data;
+    migration_t *migration = (migration_t *) user_data;
+    guint failures = 0;
+
+    if (path != NULL)
+        {
+            failures = migrate_data_directory(path, migration->depth);
+            g_atomic_int_add(&migration->failures, (gint) failures);
+            free_variable(path);
+        }
+}
+
+
+/**
+ * Converts the blocks stored with a .meta file (by older versions of
+ * this backend) to block files that begin with a header. Directories of
+ * the first level of the data tree are converted concurrently. The
+ * server must not be running on the same directory meanwhile. Once every
+ * block has been converted the tree is marked with FILE_BACKEND_MIGRATED
+ * so that .meta files are no longer looked for.
+ * @param server_struct is the server's main structure. The file backend
+ *        must have been initialized.
+ */
+void file_migrate_blocks(server_struct_t *server_struct)
+{
+    file_backend_t *file_backend = NULL;
+    GThreadPool *pool = NULL;
+    GDir *dir = NULL;
+    const gchar *name = NULL;
+    gchar *prefix = NULL;
+    gchar *path = NULL;
+    migration_t migration;
+
+    if (server_struct != NULL && server_struct->backend != NULL && server_struct->backend->user_data != NULL)
+        {
+            file_backend = server_struct->backend->user_data;
+            prefix = g_build_filename(file_backend->prefix, "data", NULL);
+            migration.depth = file_backend->level - 1;
+            migration.failures = 0;
+            dir = g_dir_open(prefix, 0, NULL);
+
+            if (dir != NULL)
+                {
+                    fprintf(stdout, _("Please wait while converting block files\n"));
+
+                    pool = g_thread_pool_new(migrate_data_directory_in_pool, &migration, g_get_num_processors(), FALSE, NULL);
+                    name = g_dir_read_name(dir);
+
+                    while (name != NULL)
+                        {
+                            if (strlen(name) == 2 && g_ascii_isxdigit(name[0]) && g_ascii_isxdigit(name[1]))
+                                {
+                                    g_thread_pool_push(pool, g_build_filename(prefix, name, NULL), NULL);
+                                }
+
+                            name = g_dir_read_name(dir);
+                        }
+
+                    /* Waits for every directory to be converted */
+                    g_thread_pool_free(pool, FALSE, TRUE);
+                    g_dir_close(dir);
+
+                    if (migration.failures == 0)
+                        {
+                            path = g_build_filename(prefix, FILE_BACKEND_MIGRATED, NULL);
+                            create_directory(path);
+                            file_backend->migrated = file_exists(path);
+                            free_variable(path);
+                            fprintf(stdout, _("Finished !\n"));
+                        }
+                    else
+                        {
+                            print_error(__FILE__, __LINE__, _("%d block files could not be converted: run --migrate-blocks again\n"), migration.failures);
+                        }
+                }
+            else
+                {
+                    print_error(__FILE__, __LINE__, _("Unable to open directory %s\n"), prefix);
+                }
+
+            free_variable(prefix);
+        }
+}
+
+
+/**
+ * Flushes the blocks stored to disk, closes the hash index cleanly and
+ * frees the backend. Nothing must be stored anymore.
+ * @param server_struct is the server's main structure.
+ */
+void file_terminate_backend(server_struct_t *server_struct)
+{
+    file_backend_t *file_backend = NULL;
+    gchar *data_dir = NULL;
+
+    if (server_struct != NULL && server_struct->backend != NULL && server_struct->backend->user_data != NULL)
+        {
+            file_backend = (file_backend_t *) server_struct->backend->user_data;
+
+            /* Block files are not synced one by one: the index may only
+             * be marked clean once all of them are on disk. Only the
+             * filesystem of the data tree is flushed (sync() flushes
+             * every filesystem and is only used when syncfs() fails).
+             */
+            data_dir = g_build_filename(file_backend->prefix, "data", NULL);
+            if (sync_filesystem(data_dir) == FALSE)
+                {
+                    sync();
+                }
+            free_variable(data_dir);
+
+            free_hash_index_t(file_backend->index);
+            free_variable(file_backend->prefix);
+            free_variable(file_backend);
+            server_struct->backend->user_data = NULL;
+        }
+}
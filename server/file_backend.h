@@ -45,7 +45,27 @@
 #define FILE_BACKEND_LEVEL (2)
 
 /**
- * To store meta data of the hash file.
+ * @def FILE_BACKEND_MIGRATED
+ * Name of the directory, in the data directory, that tells that no block
+ * has a .meta file: trees created by this version of the backend and
+ * trees fully converted by --migrate-blocks.
+ */
+#define FILE_BACKEND_MIGRATED (".migrated")
+
+/**
+ * @def FILE_BLOCK_MAGIC
+ * Four bytes that begin every block file.
+ *
+ * @def FILE_BLOCK_HEADER_LEN
+ * Length in bytes of the header of a block file: magic, cmptype (16
+ * bits, big endian), 2 unused bytes and uncmplen (64 bits, big endian).
+ */
+#define FILE_BLOCK_MAGIC ("CDPF")
+#define FILE_BLOCK_HEADER_LEN (16)
+
+/**
+ * To read meta data of the hash file from the .meta files of blocks
+ * stored before block files had a header.
  */
 #define GN_META ("Meta")
 #define KN_UNCMPLEN ("uncmplen")
@@ -65,11 +85,24 @@
  */
 typedef struct
 {
-    gchar *prefix; /**< Prefix for the path where data are located */
-    guint level;   /**< level of directories defaults to 3 */
+    gchar *prefix;        /**< Prefix for the path where data are located                 */
+    guint level;          /**< level of directories defaults to 3                         */
+    hash_index_t *index;  /**< index of stored hashs (NULL when it could not be opened)   */
+    gboolean migrated;    /**< TRUE when no block has a .meta file (see FILE_BACKEND_MIGRATED) */
 } file_backend_t;
 
 
+/**
+ * @struct migration_t
+ * @brief Shared by the threads of file_migrate_blocks().
+ */
+typedef struct
+{
+    guint depth;      /**< number of directory levels below the directories converted  */
+    gint failures;    /**< number of block files not converted (atomically updated)    */
+} migration_t;
+
+
 
 /**
  * @struct buffer_t
@@ -100,6 +133,15 @@ typedef struct
  */
 extern void file_store_smeta(server_struct_t *server_struct, server_meta_data_t *smeta);
 
+/**
+ * Appends meta data to the flat file of the host that sent them in the
+ * "meta" sub directory of a backend's directory. Used by the backends
+ * that keep meta data as the file backend does.
+ * @param directory is the directory of the backend.
+ * @param smeta the server's structure for file meta data. It contains the
+ *        hostname that sent it.
+ */
+extern void store_smeta_into_directory(gchar *directory, server_meta_data_t *smeta);
 
 /**
  * Inits the backend : takes care of the directories we want to write to.
@@ -107,23 +149,24 @@ extern void file_store_smeta(server_struct_t *server_struct, server_meta_data_t
  * prefix path where to store data.
  * @param server_struct is the server's main structure where all
  *        informations needed by the program are stored.
+ * @returns TRUE if the backend is ready and FALSE otherwise. Without
+ *          its hash index the backend looks into the data tree.
  */
-extern void file_init_backend(server_struct_t *server_struct);
-
+extern gboolean file_init_backend(server_struct_t *server_struct);
 
 /**
  * Stores data into a flat file. The file is named by its hash in hex
- * representation (one should easily check that the sha256sum of such a
- * file gives its name !).
+ * representation and begins with a header (FILE_BLOCK_MAGIC, cmptype and
+ * uncmplen) followed by the data as sent by the client.
  * @param server_struct is the server's main structure where all
  *        informations needed by the program are stored.
  * @param hash_data is a hash_data_t * structure that contains the hash and
  *        the corresponding data in a binary form and a 'read' field that
- *        contains the number of bytes in 'data' field.
+ *        contains the number of bytes in 'data' field. Blocks of zeros
+ *        are dropped (see is_zero_block_hash()).
  */
 extern void file_store_data(server_struct_t *server_struct, hash_data_t *hash_data);
 
-
 /**
  * Builds a list of hashs that server's server needs.
  * @param server_struct is the server's main structure where all
@@ -132,7 +175,6 @@ extern void file_store_data(server_struct_t *server_struct, hash_data_t *hash_da
  */
 extern GList *file_build_needed_hash_list(server_struct_t *server_struct, GList *hash_list);
 
-
 /**
  * Gets the list of all saved files
  * @param server_struct is the structure that contains all data for the
@@ -143,11 +185,22 @@ extern GList *file_build_needed_hash_list(server_struct_t *server_struct, GList
  */
 extern gchar *file_get_list_of_files(server_struct_t *server_struct, query_t *query);
 
+/**
+ * Gets the list of saved files from the "meta" sub directory of a
+ * backend's directory.
+ * @param directory is the directory of the backend (may be NULL: the
+ *        list is then empty).
+ * @param query is the structure that contains everything about the
+ *        requested query.
+ * @returns a JSON string containing all filenames requested
+ */
+extern gchar *get_list_of_files_from_directory(gchar *directory, query_t *query);
 
 /**
  * Retrieves data from a flat file. The file is named by its hash in hex
- * representation (one should easily check that the sha256sum of such a
- * file gives its name !).
+ * representation and begins with a header that tells how the block is
+ * compressed (blocks stored with a .meta file are still read in trees
+ * not marked with FILE_BACKEND_MIGRATED).
  * @param server_struct is the server's main structure where all
  *        informations needed by the program are stored.
  * @param hex_hash is a gchar * hash in hexadecimal format as retrieved
@@ -155,4 +208,81 @@ extern gchar *file_get_list_of_files(server_struct_t *server_struct, query_t *qu
  */
 extern hash_data_t *file_retrieve_data(server_struct_t *server_struct, gchar *hex_hash);
 
+/**
+ * Converts the blocks stored with a .meta file (by older versions of
+ * this backend) to block files that begin with a header. Directories of
+ * the first level of the data tree are converted concurrently. The
+ * server must not be running on the same directory meanwhile. Once every
+ * block has been converted the tree is marked with FILE_BACKEND_MIGRATED
+ * so that .meta files are no longer looked for.
+ * @param server_struct is the server's main structure. The file backend
+ *        must have been initialized.
+ */
+extern void file_migrate_blocks(server_struct_t *server_struct);
+
+/**
+ * Flushes the blocks stored to disk, closes the hash index cleanly and
+ * frees the backend. Nothing must be stored anymore.
+ * @param server_struct is the server's main structure.
+ */
+extern void file_terminate_backend(server_struct_t *server_struct);
+
+/**
+ * Gets cmptype and uncmplen (the uncompressed len of the block) from the
+ * .meta file of a block.
+ * @param filename is the filename of the hash. The meta file has the
+ *        same name but ends with .meta
+ * @param[out] cmptype the compression type of the block or
+ *             COMPRESS_NONE_TYPE.
+ * @param[out] uncmplen the len of the uncompressed block or 0.
+ * @returns TRUE if the block has a .meta file and FALSE otherwise.
+ */
+extern gboolean get_values_from_file_meta(gchar *filename, gshort *cmptype, gssize *uncmplen);
+
+/**
+ * Encodes the header that begins a block file.
+ * @param[out] header is a buffer of FILE_BLOCK_HEADER_LEN bytes.
+ * @param cmptype the compression type used to store this block.
+ * @param uncmplen the len of the uncompressed block.
+ */
+extern void encode_block_header(guchar *header, gshort cmptype, gssize uncmplen);
+
+/**
+ * Decodes the header that begins a block file. The magic alone does not
+ * make a header: the unused bytes must be 0 and the compression type
+ * must be a known one.
+ * @param header is the beginning of the block file.
+ * @param length is the number of bytes in header.
+ * @param[out] cmptype the compression type of the block.
+ * @param[out] uncmplen the len of the uncompressed block.
+ * @returns TRUE if the file begins with a header and FALSE otherwise (a
+ *          block stored with a .meta file).
+ */
+extern gboolean decode_block_header(guchar *header, gsize length, gshort *cmptype, gssize *uncmplen);
+
+/**
+ * Says whether a block file that has a .meta file begins with a header
+ * written from that .meta file by migrate_block_file() (that was
+ * interrupted before removing it). Data of blocks stored with a .meta
+ * file may begin with anything so any other header is data.
+ * @param header is the beginning of the block file.
+ * @param length is the number of bytes in header.
+ * @param cmptype the compression type read from the .meta file.
+ * @param uncmplen the uncompressed len read from the .meta file.
+ * @returns TRUE if the file begins with such a header, FALSE otherwise.
+ */
+extern gboolean is_block_header_as_in_meta(guchar *header, gsize length, gshort cmptype, gssize uncmplen);
+
+/**
+ * Converts a block file that has a .meta file: its compression type
+ * and uncompressed length are written in a header at the beginning of
+ * the file (the file is replaced atomically) and the .meta file is
+ * removed. The .meta file is only removed once the file begins with a
+ * header written from it: either here or by a previous conversion that
+ * was interrupted before removing it.
+ * @param filename is the block file.
+ * @returns TRUE if the block has been converted and FALSE otherwise.
+ */
+extern gboolean migrate_block_file(gchar *filename);
+
 #endif /* #ifndef _SERVER_FILE_BACKEND_H_ */
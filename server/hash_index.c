@@ -0,0 +1,1147 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    hash_index.c
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+/**
+ * @file hash_index.c
+ *
+ * This file contains the index of the hashs of the blocks stored by the
+ * backends. It answers whether a block is stored (and where for the pack
+ * backend) without touching the stored blocks. The index may miss a
+ * block (after a crash for instance) in which case the block is only
+ * asked once more to a client.
+ */
+
+#include "server.h"
+
+static guint64 get_first_slot(guint64 slots, guint8 *hash);
+static gboolean is_slot_empty(guchar *slot);
+static guchar *get_slot(hash_index_t *index, guint64 position);
+static gboolean find_slot(hash_index_t *index, guint8 *hash, guint64 *position);
+static void write_hash_index_header(hash_index_t *index);
+static gboolean check_hash_index_header(hash_index_t *index, guchar *map, gsize map_len, guint64 *slots, guint64 *count);
+static gboolean map_hash_index_file(hash_index_t *index, gchar *filename, guint64 slots, gboolean create);
+static void unmap_hash_index_file(hash_index_t *index);
+static void set_hash_index_clean(hash_index_t *index, gboolean clean);
+static gboolean sync_hash_index_file(hash_index_t *index, gchar *filename);
+static gboolean replace_hash_index_file(hash_index_t *index, gchar *tmp_filename, gchar *filename);
+static hash_index_t *new_hash_index_t(gchar *filename, guint value_len);
+static void put_hash_into_slots(hash_index_t *index, guint8 *hash, guchar *value);
+static void copy_hash_index_slots(hash_index_t *index, hash_index_t *grown);
+static gboolean grow_hash_index(hash_index_t *index);
+static void remove_slot(hash_index_t *index, guint64 position);
+static gboolean is_hex_string(const gchar *string, gsize length);
+static void scan_data_directory(hash_index_t *index, gchar *path, gchar *hex, guint depth);
+static void scan_data_directory_in_pool(gpointer data, gpointer user_data);
+static void rebuild_hash_index(hash_index_t *index, gchar *data_dir, guint level);
+
+
+/**
+ * @param slots is the number of slots of the index (a power of 2).
+ * @param hash is a hash in binary form.
+ * @returns the first slot where the hash may be. Hashs are uniformly
+ *          distributed so their first bytes are enough.
+ */
+static guint64 get_first_slot(guint64 slots, guint8 *hash)
+{
+    guint64 value = 0;
+
+    memcpy(&value, hash, sizeof(guint64));
+
+    return GUINT64_FROM_BE(value) & (slots - 1);
+}
+
+
+/**
+ * @param slot is a slot of the index (HASH_LEN bytes).
+ * @returns TRUE if the slot is empty (only zeros) and FALSE otherwise.
+ */
+static gboolean is_slot_empty(guchar *slot)
+{
+    static const guchar empty[HASH_LEN] = {0};
+
+    return memcmp(slot, empty, HASH_LEN) == 0;
+}
+
+
+/**
+ * @param index is a mapped hash index.
+ * @param position is the number of a slot.
+ * @returns a pointer to that slot: the hash followed by its value
+ *          (index->value_len bytes).
+ */
+static guchar *get_slot(hash_index_t *index, guint64 position)
+{
+    return index->map + HASH_INDEX_HEADER_LEN + position * (HASH_LEN + index->value_len);
+}
+
+
+/**
+ * Looks for a hash in the slots.
+ * @param index is a mapped hash index.
+ * @param hash is a hash in binary form.
+ * @param[out] position is the slot of the hash when it is found or the
+ *             empty slot where it has to be inserted otherwise.
+ * @returns TRUE if the hash is in the slots and FALSE otherwise.
+ */
+static gboolean find_slot(hash_index_t *index, guint8 *hash, guint64 *position)
+{
+    guchar *slot = NULL;
+    guint64 slots = index->slots;
+    guint64 i = 0;
+    guint64 probes = 0;
+    gboolean found = FALSE;
+    gboolean empty = FALSE;
+
+    i = get_first_slot(slots, hash);
+
+    while (found == FALSE && empty == FALSE && probes < slots)
+        {
+            slot = get_slot(index, i);
+
+            if (is_slot_empty(slot) == TRUE)
+                {
+                    empty = TRUE;
+                }
+            else if (memcmp(slot, hash, HASH_LEN) == 0)
+                {
+                    found = TRUE;
+                }
+            else
+                {
+                    i = (i + 1) & (slots - 1);
+                    probes = probes + 1;
+                }
+        }
+
+    *position = i;
+
+    return found;
+}
+
+
+/**
+ * Writes the header of the index.
+ * @param index is a mapped hash index.
+ */
+static void write_hash_index_header(hash_index_t *index)
+{
+    guint32 version = GUINT32_TO_BE(HASH_INDEX_VERSION);
+    guint64 be_slots = GUINT64_TO_BE(index->slots);
+    guint64 be_count = GUINT64_TO_BE(index->count);
+    guint32 be_value_len = GUINT32_TO_BE(index->value_len);
+
+    memcpy(index->map, HASH_INDEX_MAGIC, 4);
+    memcpy(index->map + 4, &version, 4);
+    memcpy(index->map + 8, &be_slots, 8);
+    memcpy(index->map + 16, &be_count, 8);
+    memcpy(index->map + 24, &be_value_len, 4);
+}
+
+
+/**
+ * Checks the header of a mapped index file.
+ * @param index is the hash index that the file should be (only its
+ *        value_len is used).
+ * @param map is the mapped index file.
+ * @param map_len is the length of the file.
+ * @param[out] slots is the number of slots of the index.
+ * @param[out] count is the number of hashs in the index.
+ * @returns TRUE if the header is valid and matches the length of the
+ *          file and FALSE otherwise.
+ */
+static gboolean check_hash_index_header(hash_index_t *index, guchar *map, gsize map_len, guint64 *slots, guint64 *count)
+{
+    guint32 version = 0;
+    guint32 value_len = 0;
+
+    if (map_len < HASH_INDEX_HEADER_LEN || memcmp(map, HASH_INDEX_MAGIC, 4) != 0)
+        {
+            return FALSE;
+        }
+
+    memcpy(&version, map + 4, 4);
+    memcpy(slots, map + 8, 8);
+    memcpy(count, map + 16, 8);
+    memcpy(&value_len, map + 24, 4);
+    *slots = GUINT64_FROM_BE(*slots);
+    *count = GUINT64_FROM_BE(*count);
+
+    return GUINT32_FROM_BE(version) == HASH_INDEX_VERSION && GUINT32_FROM_BE(value_len) == index->value_len && *slots > 0 && (*slots & (*slots - 1)) == 0 && *count < *slots && map_len == HASH_INDEX_HEADER_LEN + *slots * (HASH_LEN + index->value_len);
+}
+
+
+/**
+ * Opens and maps an index file into index.
+ * @param index is the hash index whose fd, map, map_len, slots and count
+ *        are filled.
+ * @param filename is the index file.
+ * @param slots is the number of slots of a created index (not used when
+ *        create is FALSE).
+ * @param create is TRUE to create an empty index (any existing file is
+ *        truncated) and FALSE to open an existing one.
+ * @returns TRUE if the file has been mapped and is a valid index and
+ *          FALSE otherwise.
+ */
+static gboolean map_hash_index_file(hash_index_t *index, gchar *filename, guint64 slots, gboolean create)
+{
+    struct stat st;
+    gint fd = -1;
+    gsize len = 0;
+    guchar *map = NULL;
+    guint64 count = 0;
+    guint32 flag = 0;
+
+    if (create == TRUE)
+        {
+            len = HASH_INDEX_HEADER_LEN + slots * (HASH_LEN + index->value_len);
+            fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0640);
+
+            if (fd < 0 || ftruncate(fd, len) != 0)
+                {
+                    print_error(__FILE__, __LINE__, _("Unable to create hash index %s: %s\n"), filename, strerror(errno));
+                }
+        }
+    else
+        {
+            fd = open(filename, O_RDWR);
+
+            if (fd >= 0 && fstat(fd, &st) == 0)
+                {
+                    len = st.st_size;
+                }
+        }
+
+    if (fd >= 0 && len >= HASH_INDEX_HEADER_LEN)
+        {
+            map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+            if (map == MAP_FAILED)
+                {
+                    print_error(__FILE__, __LINE__, _("Unable to map hash index %s: %s\n"), filename, strerror(errno));
+                    map = NULL;
+                }
+            else if (create == FALSE && check_hash_index_header(index, map, len, &slots, &count) == FALSE)
+                {
+                    print_error(__FILE__, __LINE__, _("Invalid hash index %s\n"), filename);
+                    munmap(map, len);
+                    map = NULL;
+                }
+        }
+
+    if (map != NULL)
+        {
+            index->fd = fd;
+            index->map = map;
+            index->map_len = len;
+            index->slots = slots;
+            index->count = count;
+            index->clean = FALSE;
+
+            if (create == TRUE)
+                {
+                    write_hash_index_header(index);
+                }
+            else
+                {
+                    memcpy(&flag, map + HASH_INDEX_CLEAN_OFFSET, 4);
+                    index->clean = GUINT32_FROM_BE(flag) == HASH_INDEX_CLEAN;
+                }
+
+            /* Until free_hash_index_t() the file may not be what is in memory */
+            set_hash_index_clean(index, FALSE);
+        }
+    else if (fd >= 0)
+        {
+            close(fd);
+        }
+
+    return map != NULL;
+}
+
+
+/**
+ * Unmaps and closes the index file.
+ * @param index is the hash index.
+ */
+static void unmap_hash_index_file(hash_index_t *index)
+{
+    if (index->map != NULL)
+        {
+            munmap(index->map, index->map_len);
+            close(index->fd);
+            index->map = NULL;
+            index->fd = -1;
+        }
+}
+
+
+/**
+ * Sets the clean flag of the header and flushes the header to the file.
+ * @param index is a mapped hash index.
+ * @param clean is TRUE once every slot has been flushed to the file and
+ *        FALSE before the index is modified.
+ */
+static void set_hash_index_clean(hash_index_t *index, gboolean clean)
+{
+    guint32 flag = 0;
+
+    if (clean == TRUE)
+        {
+            flag = GUINT32_TO_BE(HASH_INDEX_CLEAN);
+        }
+
+    memcpy(index->map + HASH_INDEX_CLEAN_OFFSET, &flag, 4);
+
+    if (msync(index->map, HASH_INDEX_HEADER_LEN, MS_SYNC) != 0)
+        {
+            print_error(__FILE__, __LINE__, _("Unable to sync hash index header: %s\n"), strerror(errno));
+        }
+}
+
+
+/**
+ * Flushes a temporary index that has been filled and its directory so
+ * that it may replace the index file.
+ * @param index is the mapped temporary index.
+ * @param filename is the temporary file of index.
+ * @returns TRUE if the file is on disk and FALSE otherwise.
+ */
+static gboolean sync_hash_index_file(hash_index_t *index, gchar *filename)
+{
+    gchar *dirname = NULL;
+    gboolean done = FALSE;
+
+    if (msync(index->map, index->map_len, MS_SYNC) != 0 || fsync(index->fd) != 0)
+        {
+            print_error(__FILE__, __LINE__, _("Unable to sync hash index %s: %s\n"), filename, strerror(errno));
+        }
+    else
+        {
+            dirname = g_path_get_dirname(filename);
+            sync_directory(dirname);
+            free_variable(dirname);
+            done = TRUE;
+        }
+
+    return done;
+}
+
+
+/**
+ * Replaces an index file by a temporary one that has been filled. The
+ * temporary file and its directory are flushed first so that the index
+ * file is never replaced by a file whose slots are not on disk.
+ * @param index is the mapped temporary index.
+ * @param tmp_filename is the temporary file of index.
+ * @param filename is the index file to be replaced.
+ * @returns TRUE if the index file has been replaced and FALSE otherwise.
+ */
+static gboolean replace_hash_index_file(hash_index_t *index, gchar *tmp_filename, gchar *filename)
+{
+    gchar *dirname = NULL;
+    gboolean done = FALSE;
+
+    dirname = g_path_get_dirname(filename);
+
+    if (sync_hash_index_file(index, tmp_filename) == TRUE)
+        {
+            if (rename(tmp_filename, filename) == 0)
+                {
+                    sync_directory(dirname);
+                    done = TRUE;
+                }
+            else
+                {
+                    print_error(__FILE__, __LINE__, _("Unable to replace hash index %s: %s\n"), filename, strerror(errno));
+                }
+        }
+
+    free_variable(dirname);
+
+    return done;
+}
+
+
+/**
+ * Allocates a hash index that is not mapped yet.
+ * @param filename is the index file.
+ * @param value_len is the number of bytes kept with each hash.
+ * @returns a newly allocated hash_index_t.
+ */
+static hash_index_t *new_hash_index_t(gchar *filename, guint value_len)
+{
+    hash_index_t *index = NULL;
+
+    index = (hash_index_t *) g_malloc0(sizeof(hash_index_t));
+    g_assert_nonnull(index);
+
+    g_mutex_init(&index->grow_mutex);
+    g_rw_lock_init(&index->lock);
+    index->filename = g_strdup(filename);
+    index->path = g_strdup(filename);
+    index->fd = -1;
+    index->map = NULL;
+    index->value_len = value_len;
+    index->clean = FALSE;
+
+    return index;
+}
+
+
+/**
+ * Flushes the index to its file, marks it as closed cleanly, unmaps it
+ * and frees the index.
+ * @param index is the hash index to be freed (may be NULL).
+ */
+void free_hash_index_t(hash_index_t *index)
+{
+    if (index != NULL)
+        {
+            if (index->map != NULL)
+                {
+                    /* The flag is set only once every slot is on disk */
+                    if (msync(index->map, index->map_len, MS_SYNC) == 0)
+                        {
+                            set_hash_index_clean(index, TRUE);
+                        }
+                    else
+                        {
+                            print_error(__FILE__, __LINE__, _("Unable to sync hash index %s: %s\n"), index->filename, strerror(errno));
+                        }
+                }
+
+            unmap_hash_index_file(index);
+            g_rw_lock_clear(&index->lock);
+            g_mutex_clear(&index->grow_mutex);
+            free_variable(index->path);
+            free_variable(index->filename);
+            free_variable(index);
+        }
+}
+
+
+/**
+ * Puts a hash into a free slot (the write lock must be held and the
+ * index must have room for it). A hash that is already in the index
+ * keeps its value.
+ * @param index is the hash index.
+ * @param hash is a hash in binary form.
+ * @param value is the value kept with the hash (index->value_len bytes)
+ *        or NULL for a value made of zeros.
+ */
+static void put_hash_into_slots(hash_index_t *index, guint8 *hash, guchar *value)
+{
+    guint64 position = 0;
+    guchar *slot = NULL;
+
+    if (find_slot(index, hash, &position) == FALSE)
+        {
+            slot = get_slot(index, position);
+
+            if (value != NULL && index->value_len > 0)
+                {
+                    memcpy(slot + HASH_LEN, value, index->value_len);
+                }
+
+            memcpy(slot, hash, HASH_LEN);
+            index->count = index->count + 1;
+            index->changes = index->changes + 1;
+            write_hash_index_header(index);
+        }
+}
+
+
+/**
+ * Copies every hash of the index into an empty grown index (a lock on
+ * index must be held).
+ * @param index is the hash index.
+ * @param grown is the mapped grown index.
+ */
+static void copy_hash_index_slots(hash_index_t *index, hash_index_t *grown)
+{
+    guchar *slot = NULL;
+    guint64 i = 0;
+
+    for (i = 0; i < index->slots; i++)
+        {
+            slot = get_slot(index, i);
+
+            if (is_slot_empty(slot) == FALSE)
+                {
+                    put_hash_into_slots(grown, slot, slot + HASH_LEN);
+                }
+        }
+}
+
+
+/**
+ * Doubles the number of slots of the index when it is more than
+ * HASH_INDEX_MAX_LOAD percent full. The new index is written in a
+ * temporary file under the read lock (lookups go on) and flushed to disk
+ * without any lock. The write lock is only held to replace the mapped
+ * file (index->path: the file of an index being rebuilt is not the index
+ * file yet) and swap the mappings. Hashs inserted or removed while the file
+ * was flushed are copied again under the write lock: they reach the disk
+ * as any other change does.
+ * @param index is the hash index.
+ * @returns TRUE if the index has room enough (it may have been grown by
+ *          an other thread) and FALSE if it could not grow.
+ */
+static gboolean grow_hash_index(hash_index_t *index)
+{
+    hash_index_t grown;
+    gchar *tmp_filename = NULL;
+    gchar *dirname = NULL;
+    guint64 changes = 0;
+    gboolean needed = FALSE;
+    gboolean mapped = FALSE;
+    gboolean done = FALSE;
+
+    memset(&grown, 0, sizeof(hash_index_t));
+    grown.value_len = index->value_len;
+    tmp_filename = g_strdup_printf("%s.tmp", index->path);
+
+    g_mutex_lock(&index->grow_mutex);
+
+    g_rw_lock_reader_lock(&index->lock);
+    needed = (index->count + 1) * 100 > index->slots * HASH_INDEX_MAX_LOAD;
+
+    if (needed == TRUE)
+        {
+            mapped = map_hash_index_file(&grown, tmp_filename, index->slots * 2, TRUE);
+
+            if (mapped == TRUE)
+                {
+                    copy_hash_index_slots(index, &grown);
+                    changes = index->changes;
+                }
+        }
+    g_rw_lock_reader_unlock(&index->lock);
+
+    if (mapped == TRUE && sync_hash_index_file(&grown, tmp_filename) == TRUE)
+        {
+            g_rw_lock_writer_lock(&index->lock);
+
+            if (index->changes != changes)
+                {
+                    memset(grown.map + HASH_INDEX_HEADER_LEN, 0, grown.map_len - HASH_INDEX_HEADER_LEN);
+                    grown.count = 0;
+                    copy_hash_index_slots(index, &grown);
+                }
+
+            if (rename(tmp_filename, index->path) == 0)
+                {
+                    unmap_hash_index_file(index);
+                    index->fd = grown.fd;
+                    index->map = grown.map;
+                    index->map_len = grown.map_len;
+                    index->slots = grown.slots;
+                    index->count = grown.count;
+                    done = TRUE;
+                }
+            else
+                {
+                    print_error(__FILE__, __LINE__, _("Unable to replace hash index %s: %s\n"), index->path, strerror(errno));
+                }
+
+            g_rw_lock_writer_unlock(&index->lock);
+        }
+
+    if (done == TRUE)
+        {
+            dirname = g_path_get_dirname(index->path);
+            sync_directory(dirname);
+            free_variable(dirname);
+        }
+    else if (mapped == TRUE)
+        {
+            unmap_hash_index_file(&grown);
+            unlink(tmp_filename);
+        }
+
+    g_mutex_unlock(&index->grow_mutex);
+
+    free_variable(tmp_filename);
+
+    return done || needed == FALSE;
+}
+
+
+/**
+ * Inserts the hash of a block that has just been stored. The index
+ * doubles its size when it is HASH_INDEX_MAX_LOAD percent full.
+ * @param index is the hash index.
+ * @param hash is a hash in binary form.
+ * @returns TRUE if the hash is in the index and FALSE if it could not be
+ *          inserted.
+ */
+gboolean insert_into_hash_index(hash_index_t *index, guint8 *hash)
+{
+    return insert_value_into_hash_index(index, hash, NULL);
+}
+
+
+/**
+ * Inserts the hash of a block that has just been stored with a value
+ * (where the block is for instance). A hash already in the index keeps
+ * its first value. The index is grown (see grow_hash_index()) without
+ * holding the write lock.
+ * @param index is the hash index.
+ * @param hash is a hash in binary form.
+ * @param value is index->value_len bytes to be kept with the hash or
+ *        NULL for zeros.
+ * @returns TRUE if the hash is in the index and FALSE if it could not be
+ *          inserted (the index is full and could not grow).
+ */
+gboolean insert_value_into_hash_index(hash_index_t *index, guint8 *hash, guchar *value)
+{
+    gboolean inserted = FALSE;
+    gboolean full = FALSE;
+
+    if (index != NULL && hash != NULL && is_zero_block_hash(hash) == FALSE)
+        {
+            g_rw_lock_reader_lock(&index->lock);
+            full = (index->count + 1) * 100 > index->slots * HASH_INDEX_MAX_LOAD;
+            g_rw_lock_reader_unlock(&index->lock);
+
+            if (full == TRUE && grow_hash_index(index) == FALSE)
+                {
+                    print_error(__FILE__, __LINE__, _("Unable to grow hash index %s\n"), index->filename);
+                }
+
+            g_rw_lock_writer_lock(&index->lock);
+
+            /* Keeps at least one empty slot so that a lookup always ends */
+            if (index->count + 1 < index->slots)
+                {
+                    put_hash_into_slots(index, hash, value);
+                    inserted = TRUE;
+                }
+
+            g_rw_lock_writer_unlock(&index->lock);
+
+            if (inserted == FALSE)
+                {
+                    print_error(__FILE__, __LINE__, _("Hash index %s is full: a hash has not been inserted\n"), index->filename);
+                }
+        }
+    else if (index != NULL && hash != NULL)
+        {
+            /* Blocks of zeros are never stored: they are always known */
+            inserted = TRUE;
+        }
+
+    return inserted;
+}
+
+
+/**
+ * @param index is the hash index.
+ * @param hash is a hash in binary form.
+ * @returns TRUE if a block with this hash has been stored and FALSE
+ *          otherwise.
+ */
+gboolean is_hash_in_index(hash_index_t *index, guint8 *hash)
+{
+    return get_value_from_hash_index(index, hash, NULL);
+}
+
+
+/**
+ * Gets the value kept with a hash.
+ * @param index is the hash index.
+ * @param hash is a hash in binary form.
+ * @param[out] value is a buffer of index->value_len bytes where the
+ *             value is copied when the hash is found (may be NULL).
+ * @returns TRUE if the hash is in the index and FALSE otherwise.
+ */
+gboolean get_value_from_hash_index(hash_index_t *index, guint8 *hash, guchar *value)
+{
+    guint64 position = 0;
+    gboolean found = FALSE;
+
+    if (index != NULL && hash != NULL)
+        {
+            g_rw_lock_reader_lock(&index->lock);
+            found = find_slot(index, hash, &position);
+
+            if (found == TRUE && value != NULL && index->value_len > 0)
+                {
+                    memcpy(value, get_slot(index, position) + HASH_LEN, index->value_len);
+                }
+
+            g_rw_lock_reader_unlock(&index->lock);
+        }
+
+    return found;
+}
+
+
+/**
+ * Empties a slot (the write lock must be held). The hashs that follow it
+ * in the same run of used slots are moved back so that find_slot() still
+ * finds them.
+ * @param index is the hash index.
+ * @param position is the slot to be emptied.
+ */
+static void remove_slot(hash_index_t *index, guint64 position)
+{
+    guint64 mask = index->slots - 1;
+    guint64 next = position;
+    guint64 first = 0;
+    guint slot_len = HASH_LEN + index->value_len;
+    guchar *slot = NULL;
+    gboolean end = FALSE;
+
+    while (end == FALSE)
+        {
+            next = (next + 1) & mask;
+            slot = get_slot(index, next);
+
+            if (is_slot_empty(slot) == TRUE)
+                {
+                    end = TRUE;
+                }
+            else
+                {
+                    first = get_first_slot(index->slots, slot);
+
+                    /* The hash may move back to position only if it is not
+                     * probed from a slot in (position, next] */
+                    if (((next - first) & mask) >= ((next - position) & mask))
+                        {
+                            memcpy(get_slot(index, position), slot, slot_len);
+                            position = next;
+                        }
+                }
+        }
+
+    memset(get_slot(index, position), 0, slot_len);
+    index->count = index->count - 1;
+    index->changes = index->changes + 1;
+}
+
+
+/**
+ * Removes from the index every entry for which filter returns TRUE.
+ * @param index is the hash index.
+ * @param filter is called with each entry of the index.
+ * @param user_data is passed to filter.
+ * @returns the number of entries removed.
+ */
+guint64 remove_from_hash_index_if(hash_index_t *index, hash_index_filter_func filter, gpointer user_data)
+{
+    GArray *hashs = NULL;
+    guchar *slot = NULL;
+    guint64 position = 0;
+    guint64 i = 0;
+
+    if (index != NULL && filter != NULL)
+        {
+            g_rw_lock_writer_lock(&index->lock);
+
+            /* Hashs are collected first because removing a slot moves
+             * the ones that follow it */
+            hashs = g_array_new(FALSE, FALSE, HASH_LEN);
+
+            for (i = 0; i < index->slots; i++)
+                {
+                    slot = get_slot(index, i);
+
+                    if (is_slot_empty(slot) == FALSE && filter(slot, slot + HASH_LEN, user_data) == TRUE)
+                        {
+                            g_array_append_vals(hashs, slot, 1);
+                        }
+                }
+
+            for (i = 0; i < hashs->len; i++)
+                {
+                    if (find_slot(index, (guint8 *) hashs->data + i * HASH_LEN, &position) == TRUE)
+                        {
+                            remove_slot(index, position);
+                        }
+                }
+
+            write_hash_index_header(index);
+            i = hashs->len;
+            g_array_free(hashs, TRUE);
+
+            g_rw_lock_writer_unlock(&index->lock);
+        }
+
+    return i;
+}
+
+
+/**
+ * Flushes the mapped index to its file so that every hash inserted so
+ * far survives a crash of the system.
+ * @param index is the hash index.
+ * @returns TRUE if the index is on disk and FALSE otherwise.
+ */
+gboolean sync_hash_index(hash_index_t *index)
+{
+    gboolean done = FALSE;
+
+    if (index != NULL)
+        {
+            g_rw_lock_writer_lock(&index->lock);
+
+            if (index->map != NULL && msync(index->map, index->map_len, MS_SYNC) == 0)
+                {
+                    done = TRUE;
+                }
+            else
+                {
+                    print_error(__FILE__, __LINE__, _("Unable to sync hash index %s: %s\n"), index->filename, strerror(errno));
+                }
+
+            g_rw_lock_writer_unlock(&index->lock);
+        }
+
+    return done;
+}
+
+
+/**
+ * @param string is a string.
+ * @param length is the number of characters expected in string.
+ * @returns TRUE if string is made of exactly length hexadecimal
+ *          characters and FALSE otherwise.
+ */
+static gboolean is_hex_string(const gchar *string, gsize length)
+{
+    gsize i = 0;
+
+    while (i < length && g_ascii_isxdigit(string[i]))
+        {
+            i = i + 1;
+        }
+
+    return i == length && string[i] == '\0';
+}
+
+
+/**
+ * Inserts into the index every block of a directory of the data tree.
+ * Block files are named with the end of their hash in hex (the
+ * beginning is the path of their directory). Other files (.meta files
+ * for instance) are ignored.
+ * @param index is the hash index.
+ * @param path is the directory to be scanned.
+ * @param hex is the beginning of the hashs of that directory in hex.
+ * @param depth is the number of directory levels below path.
+ */
+static void scan_data_directory(hash_index_t *index, gchar *path, gchar *hex, guint depth)
+{
+    GDir *dir = NULL;
+    GError *error = NULL;
+    const gchar *name = NULL;
+    gchar *sub_path = NULL;
+    gchar *sub_hex = NULL;
+    guint8 *hash = NULL;
+    gsize hex_len = 0;
+
+    dir = g_dir_open(path, 0, &error);
+    hex_len = strlen(hex);
+
+    if (dir != NULL)
+        {
+            name = g_dir_read_name(dir);
+
+            while (name != NULL)
+                {
+                    if (depth > 0 && is_hex_string(name, 2) == TRUE)
+                        {
+                            sub_path = g_build_filename(path, name, NULL);
+                            sub_hex = g_strconcat(hex, name, NULL);
+                            scan_data_directory(index, sub_path, sub_hex, depth - 1);
+                            free_variable(sub_hex);
+                            free_variable(sub_path);
+                        }
+                    else if (depth == 0 && hex_len < HASH_LEN * 2 && is_hex_string(name, HASH_LEN * 2 - hex_len) == TRUE)
+                        {
+                            sub_hex = g_strconcat(hex, name, NULL);
+                            hash = string_to_hash(sub_hex);
+                            insert_into_hash_index(index, hash);
+                            free_variable(hash);
+                            free_variable(sub_hex);
+                        }
+
+                    name = g_dir_read_name(dir);
+                }
+
+            g_dir_close(dir);
+        }
+    else
+        {
+            print_error(__FILE__, __LINE__, _("Unable to open directory %s: %s\n"), path, error->message);
+            free_error(error);
+        }
+}
+
+
+/**
+ * Scans a directory of the data tree. This is the function run by the
+ * threads that rebuild the index.
+ * @param data is a hash_index_scan_t * that is freed here.
+ * @param user_data is the hash_index_t * index being rebuilt.
+ */
+static void scan_data_directory_in_pool(gpointer data, gpointer user_data)
+{
+    hash_index_scan_t *scan = (hash_index_scan_t *) data;
+    hash_index_t *index = (hash_index_t *) user_data;
+
+    if (scan != NULL)
+        {
+            scan_data_directory(index, scan->path, scan->hex, scan->depth);
+            free_variable(scan->path);
+            free_variable(scan->hex);
+            free_variable(scan);
+        }
+}
+
+
+/**
+ * Opens an existing index file. The file is marked as not closed
+ * cleanly until free_hash_index_t() and index->clean tells whether it
+ * was closed cleanly the last time.
+ * @param filename is the index file.
+ * @param value_len is the number of bytes kept with each hash.
+ * @returns a newly allocated hash_index_t or NULL if the file is missing
+ *          or is not a valid index with such values.
+ */
+hash_index_t *open_hash_index_file(gchar *filename, guint value_len)
+{
+    hash_index_t *index = NULL;
+
+    if (filename != NULL && file_exists(filename) == TRUE)
+        {
+            index = new_hash_index_t(filename, value_len);
+
+            if (map_hash_index_file(index, filename, 0, FALSE) == TRUE)
+                {
+                    print_debug(_("Hash index %s opened (%" G_GUINT64_FORMAT " hashs, clean: %d)\n"), filename, index->count, index->clean);
+                }
+            else
+                {
+                    free_hash_index_t(index);
+                    index = NULL;
+                }
+        }
+
+    return index;
+}
+
+
+/**
+ * Creates an empty index file. An existing file is replaced.
+ * @param filename is the index file.
+ * @param slots is the number of slots of the index (a power of 2).
+ * @param value_len is the number of bytes kept with each hash.
+ * @returns a newly allocated hash_index_t or NULL if the file could not
+ *          be created.
+ */
+hash_index_t *create_hash_index_file(gchar *filename, guint64 slots, guint value_len)
+{
+    hash_index_t *index = NULL;
+
+    if (filename != NULL && slots > 1 && (slots & (slots - 1)) == 0)
+        {
+            index = new_hash_index_t(filename, value_len);
+
+            if (map_hash_index_file(index, filename, slots, TRUE) == FALSE)
+                {
+                    free_hash_index_t(index);
+                    index = NULL;
+                }
+        }
+
+    return index;
+}
+
+
+/**
+ * Creates an empty index that is filled before replacing the index
+ * file with finish_hash_index_rebuild(). Until then it lives in a
+ * temporary file (filename followed by ".rebuild") where it also grows.
+ * @param filename is the index file.
+ * @param slots is the number of slots the index begins with (a power of
+ *        2, HASH_INDEX_MIN_SLOTS for instance).
+ * @param value_len is the number of bytes kept with each hash.
+ * @returns a newly allocated hash_index_t or NULL if the temporary file
+ *          could not be created.
+ */
+hash_index_t *new_hash_index_to_rebuild(gchar *filename, guint64 slots, guint value_len)
+{
+    hash_index_t *index = NULL;
+
+    if (filename != NULL && slots > 1 && (slots & (slots - 1)) == 0)
+        {
+            index = new_hash_index_t(filename, value_len);
+            free_variable(index->path);
+            index->path = g_strdup_printf("%s.rebuild", filename);
+
+            if (map_hash_index_file(index, index->path, slots, TRUE) == FALSE)
+                {
+                    free_hash_index_t(index);
+                    index = NULL;
+                }
+        }
+
+    return index;
+}
+
+
+/**
+ * Replaces the index file by an index created with
+ * new_hash_index_to_rebuild() once it has been filled.
+ * @param index is the rebuilt index.
+ * @returns TRUE if the index file has been replaced and FALSE otherwise
+ *          (the index is then unmapped and should be freed).
+ */
+gboolean finish_hash_index_rebuild(hash_index_t *index)
+{
+    gboolean done = FALSE;
+
+    if (index != NULL && index->map != NULL)
+        {
+            /* The index may have grown: index->path is what is mapped */
+            if (replace_hash_index_file(index, index->path, index->filename) == TRUE)
+                {
+                    fprintf(stdout, _("Finished ! (%" G_GUINT64_FORMAT " hashs)\n"), index->count);
+                    free_variable(index->path);
+                    index->path = g_strdup(index->filename);
+                    done = TRUE;
+                }
+            else
+                {
+                    unmap_hash_index_file(index);
+                    unlink(index->path);
+                }
+        }
+
+    return done;
+}
+
+
+/**
+ * Fills the index from the data tree. Each directory of the first level
+ * is scanned by a thread of a pool.
+ * @param index is an index created by new_hash_index_to_rebuild().
+ * @param data_dir is the "data" directory of the file backend.
+ * @param level is the number of directory levels of the data tree.
+ */
+static void rebuild_hash_index(hash_index_t *index, gchar *data_dir, guint level)
+{
+    GThreadPool *pool = NULL;
+    GDir *dir = NULL;
+    const gchar *name = NULL;
+    hash_index_scan_t *scan = NULL;
+
+    fprintf(stdout, _("Please wait while rebuilding hash index\n"));
+
+    dir = g_dir_open(data_dir, 0, NULL);
+
+    if (level > 0 && dir != NULL)
+        {
+            pool = g_thread_pool_new(scan_data_directory_in_pool, index, g_get_num_processors(), FALSE, NULL);
+            name = g_dir_read_name(dir);
+
+            while (name != NULL)
+                {
+                    if (is_hex_string(name, 2) == TRUE)
+                        {
+                            scan = (hash_index_scan_t *) g_malloc0(sizeof(hash_index_scan_t));
+                            g_assert_nonnull(scan);
+
+                            scan->path = g_build_filename(data_dir, name, NULL);
+                            scan->hex = g_strdup(name);
+                            scan->depth = level - 1;
+                            g_thread_pool_push(pool, scan, NULL);
+                        }
+
+                    name = g_dir_read_name(dir);
+                }
+
+            /* Waits for every directory to be scanned */
+            g_thread_pool_free(pool, FALSE, TRUE);
+        }
+    else if (dir != NULL)
+        {
+            scan_data_directory(index, data_dir, "", 0);
+        }
+
+    if (dir != NULL)
+        {
+            g_dir_close(dir);
+        }
+}
+
+
+/**
+ * Opens the index of the blocks stored in a data tree. The index is
+ * rebuilt (scanning the sub directories concurrently) when its file is
+ * missing, invalid or was not closed cleanly.
+ * @param prefix is the directory where the index file is.
+ * @param data_dir is the "data" directory of the file backend.
+ * @param level is the number of directory levels of the data tree.
+ * @returns a newly allocated hash_index_t or NULL if the index could not
+ *          be opened nor rebuilt.
+ */
+hash_index_t *open_hash_index(gchar *prefix, gchar *data_dir, guint level)
+{
+    hash_index_t *index = NULL;
+    gchar *filename = NULL;
+
+    filename = g_build_filename(prefix, HASH_INDEX_FILENAME, NULL);
+    index = open_hash_index_file(filename, 0);
+
+    if (index != NULL && index->clean == FALSE)
+        {
+            /* Blocks stored since the last flush may be missing or hashs
+             * may be there whose blocks never reached the disk */
+            print_error(__FILE__, __LINE__, _("Hash index %s was not closed cleanly\n"), filename);
+            unmap_hash_index_file(index);
+            free_hash_index_t(index);
+            index = NULL;
+        }
+
+    if (index == NULL)
+        {
+            index = new_hash_index_to_rebuild(filename, HASH_INDEX_MIN_SLOTS, 0);
+
+            if (index != NULL)
+                {
+                    rebuild_hash_index(index, data_dir, level);
+
+                    if (finish_hash_index_rebuild(index) == FALSE)
+                        {
+                            free_hash_index_t(index);
+                            index = NULL;
+                        }
+                }
+        }
+
+    free_variable(filename);
+
+    return index;
+}
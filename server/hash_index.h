@@ -0,0 +1,260 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    hash_index.h
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+/**
+ * @file hash_index.h
+ *
+ * This file contains the definitions of the index of the hashs of the
+ * blocks stored by the backends. The index is a file mapped in memory: a
+ * header (HASH_INDEX_MAGIC, version, number of slots, number of hashs,
+ * length of the values and a clean flag, integers are big endian)
+ * followed by an open
+ * addressing table (linear probing) of binary hashs (HASH_LEN bytes),
+ * each followed by a fixed length value (none for the file backend, the
+ * place of the block for the pack backend). An empty slot begins with
+ * zeros: such a hash is a block of zeros that is never stored.
+ */
+#ifndef _SERVER_HASH_INDEX_H_
+#define _SERVER_HASH_INDEX_H_
+
+/**
+ * @def HASH_INDEX_FILENAME
+ * Name of the index file (in the file backend's prefix directory).
+ *
+ * @def HASH_INDEX_MAGIC
+ * Four bytes that begin the index file.
+ *
+ * @def HASH_INDEX_VERSION
+ * Version of the index file format.
+ *
+ * @def HASH_INDEX_HEADER_LEN
+ * Length in bytes of the header (slots begin right after it).
+ *
+ * @def HASH_INDEX_CLEAN_OFFSET
+ * Place in the header of the clean flag: HASH_INDEX_CLEAN once the index
+ * has been flushed and closed and 0 while it is opened. An index that
+ * was not closed cleanly may miss hashs or keep hashs of blocks that
+ * never reached the disk.
+ *
+ * @def HASH_INDEX_CLEAN
+ * Value of the clean flag of an index closed cleanly.
+ */
+#define HASH_INDEX_FILENAME ("hash.index")
+#define HASH_INDEX_MAGIC ("CDPI")
+#define HASH_INDEX_VERSION (1)
+#define HASH_INDEX_HEADER_LEN (64)
+#define HASH_INDEX_CLEAN_OFFSET (28)
+#define HASH_INDEX_CLEAN (1)
+
+
+/**
+ * @def HASH_INDEX_MIN_SLOTS
+ * Number of slots of a new index (a power of 2: 32 MB of slots).
+ *
+ * @def HASH_INDEX_MAX_LOAD
+ * Percentage of used slots above which the index doubles its size.
+ */
+#define HASH_INDEX_MIN_SLOTS (1048576)
+#define HASH_INDEX_MAX_LOAD (70)
+
+
+/**
+ * @struct hash_index_t
+ * @brief Index of the hashs of stored blocks mapped in memory. Lookups
+ *        may run concurrently and insertions are exclusive.
+ */
+typedef struct
+{
+    GMutex grow_mutex;  /**< lets only one thread grow the index at a time    */
+    GRWLock lock;       /**< protects everything below                        */
+    gchar *filename;    /**< file of the index                                */
+    gchar *path;        /**< file that is mapped: filename or, while the index
+                         *   is rebuilt, the temporary file that will replace
+                         *   it                                               */
+    gint fd;            /**< file descriptor of path                          */
+    guchar *map;        /**< the file mapped in memory (header and slots)     */
+    gsize map_len;      /**< length of map                                    */
+    guint64 slots;      /**< number of slots (a power of 2)                   */
+    guint64 count;      /**< number of hashs in the index                     */
+    guint64 changes;    /**< number of hashs inserted or removed so far       */
+    guint value_len;    /**< number of bytes kept with each hash              */
+    gboolean clean;     /**< TRUE if the file had been closed cleanly when it
+                         *   was opened                                       */
+} hash_index_t;
+
+
+/**
+ * Function that tells whether an entry of the index has to be removed
+ * (see remove_from_hash_index_if()).
+ * @param hash is the hash of the entry in binary form.
+ * @param value is the value kept with that hash.
+ * @param user_data is the pointer given to remove_from_hash_index_if().
+ * @returns TRUE if the entry has to be removed and FALSE otherwise.
+ */
+typedef gboolean (* hash_index_filter_func) (guint8 *hash, guchar *value, gpointer user_data);
+
+
+/**
+ * @struct hash_index_scan_t
+ * @brief A directory of the data tree to be scanned while the index is
+ *        rebuilt.
+ */
+typedef struct
+{
+    gchar *path;        /**< path of the directory                                */
+    gchar *hex;         /**< beginning of the hashs (in hex) of that directory    */
+    guint depth;        /**< number of directory levels below this directory      */
+} hash_index_scan_t;
+
+
+/**
+ * Opens the index of the blocks stored in a data tree. The index is
+ * rebuilt (scanning the sub directories concurrently) when its file is
+ * missing, invalid or was not closed cleanly.
+ * @param prefix is the directory where the index file is.
+ * @param data_dir is the "data" directory of the file backend.
+ * @param level is the number of directory levels of the data tree.
+ * @returns a newly allocated hash_index_t or NULL if the index could not
+ *          be opened nor rebuilt.
+ */
+extern hash_index_t *open_hash_index(gchar *prefix, gchar *data_dir, guint level);
+
+
+/**
+ * Opens an existing index file. The file is marked as not closed
+ * cleanly until free_hash_index_t() and index->clean tells whether it
+ * was closed cleanly the last time.
+ * @param filename is the index file.
+ * @param value_len is the number of bytes kept with each hash.
+ * @returns a newly allocated hash_index_t or NULL if the file is missing
+ *          or is not a valid index with such values.
+ */
+extern hash_index_t *open_hash_index_file(gchar *filename, guint value_len);
+
+
+/**
+ * Creates an empty index file. An existing file is replaced.
+ * @param filename is the index file.
+ * @param slots is the number of slots of the index (a power of 2).
+ * @param value_len is the number of bytes kept with each hash.
+ * @returns a newly allocated hash_index_t or NULL if the file could not
+ *          be created.
+ */
+extern hash_index_t *create_hash_index_file(gchar *filename, guint64 slots, guint value_len);
+
+
+/**
+ * Creates an empty index that is filled before replacing the index
+ * file with finish_hash_index_rebuild(). Until then it lives in a
+ * temporary file (filename followed by ".rebuild") where it also grows.
+ * @param filename is the index file.
+ * @param slots is the number of slots the index begins with (a power of
+ *        2, HASH_INDEX_MIN_SLOTS for instance).
+ * @param value_len is the number of bytes kept with each hash.
+ * @returns a newly allocated hash_index_t or NULL if the temporary file
+ *          could not be created.
+ */
+extern hash_index_t *new_hash_index_to_rebuild(gchar *filename, guint64 slots, guint value_len);
+
+
+/**
+ * Replaces the index file by an index created with
+ * new_hash_index_to_rebuild() once it has been filled.
+ * @param index is the rebuilt index.
+ * @returns TRUE if the index file has been replaced and FALSE otherwise
+ *          (the index is then unmapped and should be freed).
+ */
+extern gboolean finish_hash_index_rebuild(hash_index_t *index);
+
+
+/**
+ * Flushes the index to its file, marks it as closed cleanly, unmaps it
+ * and frees the index.
+ * @param index is the hash index to be freed (may be NULL).
+ */
+extern void free_hash_index_t(hash_index_t *index);
+
+
+/**
+ * @param index is the hash index.
+ * @param hash is a hash in binary form.
+ * @returns TRUE if a block with this hash has been stored and FALSE
+ *          otherwise.
+ */
+extern gboolean is_hash_in_index(hash_index_t *index, guint8 *hash);
+
+
+/**
+ * Inserts the hash of a block that has just been stored. The index
+ * doubles its size when it is HASH_INDEX_MAX_LOAD percent full.
+ * @param index is the hash index.
+ * @param hash is a hash in binary form.
+ * @returns TRUE if the hash is in the index and FALSE if it could not be
+ *          inserted.
+ */
+extern gboolean insert_into_hash_index(hash_index_t *index, guint8 *hash);
+
+
+/**
+ * Inserts the hash of a block that has just been stored with a value
+ * (where the block is for instance). A hash already in the index keeps
+ * its first value. The index is grown without holding the write lock.
+ * @param index is the hash index.
+ * @param hash is a hash in binary form.
+ * @param value is index->value_len bytes to be kept with the hash or
+ *        NULL for zeros.
+ * @returns TRUE if the hash is in the index and FALSE if it could not be
+ *          inserted (the index is full and could not grow).
+ */
+extern gboolean insert_value_into_hash_index(hash_index_t *index, guint8 *hash, guchar *value);
+
+
+/**
+ * Gets the value kept with a hash.
+ * @param index is the hash index.
+ * @param hash is a hash in binary form.
+ * @param[out] value is a buffer of index->value_len bytes where the
+ *             value is copied when the hash is found (may be NULL).
+ * @returns TRUE if the hash is in the index and FALSE otherwise.
+ */
+extern gboolean get_value_from_hash_index(hash_index_t *index, guint8 *hash, guchar *value);
+
+
+/**
+ * Removes from the index every entry for which filter returns TRUE.
+ * @param index is the hash index.
+ * @param filter is called with each entry of the index.
+ * @param user_data is passed to filter.
+ * @returns the number of entries removed.
+ */
+extern guint64 remove_from_hash_index_if(hash_index_t *index, hash_index_filter_func filter, gpointer user_data);
+
+
+/**
+ * Flushes the mapped index to its file so that every hash inserted so
+ * far survives a crash of the system.
+ * @param index is the hash index.
+ * @returns TRUE if the index is on disk and FALSE otherwise.
+ */
+extern gboolean sync_hash_index(hash_index_t *index);
+
+
+#endif /* #ifndef _SERVER_HASH_INDEX_H_ */
@@ -0,0 +1,104 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    main.c
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2014 - 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file main.c
+ * This file contains the main function of the cdpfglserver program: it
+ * initializes the server, starts it and runs the main loop until a
+ * signal ends the program.
+ */
+
+#include "server.h"
+
+
+/**
+ * Main function
+ * @param argc : number of arguments given on the command line.
+ * @param argv : an array of strings that contains command line arguments.
+ * @returns 0 on success and 1 on error.
+ */
+int main(int argc, char **argv)
+{
+    server_struct_t *server_struct = NULL;  /** main structure for 'server' program.           */
+    int migrate_status = 0;                 /** exit status of --migrate-blocks.               */
+
+
+    #if !GLIB_CHECK_VERSION(2, 36, 0)
+        g_type_init();  /** g_type_init() is deprecated since glib 2.36 */
+    #endif
+
+    ignore_sigpipe(); /** into order to get libmicrohttpd portable */
+
+    init_international_languages();
+
+    server_struct = init_server_main_structure(argc, argv);
+
+    if (server_struct != NULL && server_struct->opt != NULL && server_struct->backend != NULL)
+        {
+            server_struct->loop = g_main_loop_new(g_main_context_default(), FALSE);
+
+            install_server_signal_traps(server_struct);
+
+            /* Initializing the choosen backend by calling it's function */
+            if (server_struct->backend->init_backend != NULL && server_struct->backend->init_backend(server_struct) == FALSE)
+                {
+                    print_error(__FILE__, __LINE__, _("Error: unable to initialize the backend.\n"));
+                    return 1;
+                }
+
+            if (server_struct->opt->migrate_blocks == TRUE)
+                {
+                    /* Only the file backend has block files to be converted */
+                    if (server_struct->backend->init_backend == (init_backend_func) file_init_backend)
+                        {
+                            file_migrate_blocks(server_struct);
+                        }
+                    else
+                        {
+                            print_error(__FILE__, __LINE__, _("Error: --migrate-blocks is only needed by the file backend.\n"));
+                            migrate_status = 1;
+                        }
+
+                    server_struct->backend->terminate_backend(server_struct);
+
+                    return migrate_status;
+                }
+
+            if (start_server(server_struct) == FALSE)
+                {
+                    return 1;
+                }
+
+            /**
+             * main program stops here (until we exit main loop)
+             * somewhere else in the program.
+             */
+            g_main_loop_run(server_struct->loop);
+
+        }
+    else
+        {
+            print_error(__FILE__, __LINE__, _("Error: initialization failed.\n"));
+        }
+
+    return 0;
+}
@@ -30,6 +30,7 @@
 
 static void print_selected_options(options_t *opt);
 static void read_from_configuration_file(options_t *opt, gchar *filename);
+static void read_http_from_group_server(options_t *opt, GKeyFile *keyfile, gchar *filename);
 
 /**
  * Frees the options structure if necessary.
@@ -40,6 +41,7 @@ void free_options_t(options_t *opt)
 
     if (opt != NULL)
         {
+            free_variable(opt->backend);
             free_variable(opt);
         }
 
@@ -63,6 +65,13 @@ static void print_selected_options(options_t *opt)
                 {
                     fprintf(stdout, _("Port number: %d\n"), opt->port);
                 }
+
+            fprintf(stdout, _("HTTP threads: %d\n"), opt->http_threads);
+            fprintf(stdout, _("Request workers: %d\n"), opt->request_workers);
+            fprintf(stdout, _("Connection memory limit: %" G_GINT64_FORMAT " bytes\n"), opt->connection_memory_limit);
+            fprintf(stdout, _("Connection timeout: %d s\n"), opt->connection_timeout);
+            fprintf(stdout, _("Data writers: %d\n"), opt->data_writers);
+            print_string_option(_("Backend: %s\n"), opt->backend);
         }
 }
 
@@ -95,12 +104,44 @@ gchar *buffer_selected_option(options_t *opt)
                     free_variable(buffer);
                     buffer = buf1;
                 }
+
+            buf1 = g_strdup_printf(_("%sHTTP threads: %d\nRequest workers: %d\nConnection memory limit: %" G_GINT64_FORMAT " bytes\nConnection timeout: %d s\nData writers: %d\nBackend: %s\n"), buffer, opt->http_threads, opt->request_workers, opt->connection_memory_limit, opt->connection_timeout, opt->data_writers, opt->backend);
+            free_variable(buffer);
+            buffer = buf1;
         }
 
     return buffer;
 }
 
 
+/**
+ * Reads the keys that tune libmicrohttpd, the writers and the backend in
+ * the server group
+ * @param[in,out] opt : options_t * structure to store options read from the
+ *                configuration file "filename"
+ * @param keyfile is the GKeyFile structure that is used by glib to read
+ *        groups and keys from.
+ * @param filename : the filename of the configuration file to read from
+ */
+static void read_http_from_group_server(options_t *opt, GKeyFile *keyfile, gchar *filename)
+{
+    if (keyfile != NULL && filename != NULL && g_key_file_has_group(keyfile, GN_SERVER) == TRUE)
+        {
+            opt->http_threads = read_int_from_file(keyfile, filename, GN_SERVER, KN_HTTP_THREADS, _("Could not load http threads number from file"), opt->http_threads);
+            opt->request_workers = read_int_from_file(keyfile, filename, GN_SERVER, KN_REQUEST_WORKERS, _("Could not load request workers number from file"), opt->request_workers);
+            opt->connection_memory_limit = read_int64_from_file(keyfile, filename, GN_SERVER, KN_CONNECTION_MEMORY_LIMIT, _("Could not load connection memory limit from file"), opt->connection_memory_limit);
+            opt->connection_timeout = read_int_from_file(keyfile, filename, GN_SERVER, KN_CONNECTION_TIMEOUT, _("Could not load connection timeout from file"), opt->connection_timeout);
+            opt->data_writers = read_int_from_file(keyfile, filename, GN_SERVER, KN_DATA_WRITERS, _("Could not load data writers number from file"), opt->data_writers);
+
+            if (g_key_file_has_key(keyfile, GN_SERVER, KN_BACKEND, NULL) == TRUE)
+                {
+                    free_variable(opt->backend);
+                    opt->backend = read_string_from_file(keyfile, filename, GN_SERVER, KN_BACKEND, _("Could not load backend name from file"));
+                }
+        }
+}
+
+
 /**
  * Reads from the configuration file "filename"
  * @param[in,out] opt : options_t * structure to store options read from the
@@ -130,6 +171,7 @@ static void read_from_configuration_file(options_t *opt, gchar *filename)
                 {
                     srv_conf = read_from_group_server(keyfile, filename);
                     opt->port = srv_conf ->port;
+                    read_http_from_group_server(opt, keyfile, filename);
                     read_debug_mode_from_file(keyfile, filename);
                 }
             else if (error != NULL)
@@ -163,6 +205,13 @@ options_t *manage_command_line_options(int argc, char **argv)
     gint cmdl_debug = -4;           /** debug mode as specified on the command line                                        */
     gchar *configfile = NULL;       /** Filename for the configuration file if any                                         */
     gint port = 0;                  /** Port number on which to listen                                                     */
+    gint http_threads = -1;         /** Number of libmicrohttpd epoll threads                                              */
+    gint request_workers = -1;      /** Number of threads that process GET and POST requests                               */
+    gint64 memory_limit = -1;       /** Bytes that libmicrohttpd may use for each connection                               */
+    gint timeout = -1;              /** Seconds after which an inactive connection is closed                               */
+    gint data_writers = -1;         /** Number of threads that store blocks                                                */
+    gchar *backend = NULL;          /** Name of the backend that stores data                                               */
+    gboolean migrate_blocks = FALSE; /** TRUE to convert the file backend's block files and exit                           */
 
     GOptionEntry entries[] =
     {
@@ -170,6 +219,13 @@ options_t *manage_command_line_options(int argc, char **argv)
         { "debug", 'd', 0,  G_OPTION_ARG_INT, &cmdl_debug, N_("Activates (1) or deactivates (0) debug mode."), N_("BOOLEAN")},
         { "configuration", 'c', 0, G_OPTION_ARG_STRING, &configfile, N_("Specify an alternative configuration file."), N_("FILENAME")},
         { "port", 'p', 0, G_OPTION_ARG_INT, &port, N_("Port NUMBER on which to listen."), N_("NUMBER")},
+        { "http-threads", 0, 0, G_OPTION_ARG_INT, &http_threads, N_("NUMBER of threads polling connections with epoll (0 means one thread per connection)."), N_("NUMBER")},
+        { "request-workers", 0, 0, G_OPTION_ARG_INT, &request_workers, N_("NUMBER of threads processing GET and POST requests when http-threads is not 0."), N_("NUMBER")},
+        { "connection-memory-limit", 0, 0, G_OPTION_ARG_INT64, &memory_limit, N_("Number of BYTES that each connection may use."), N_("BYTES")},
+        { "connection-timeout", 0, 0, G_OPTION_ARG_INT, &timeout, N_("Number of SECONDS after which an inactive connection is closed."), N_("SECONDS")},
+        { "data-writers", 0, 0, G_OPTION_ARG_INT, &data_writers, N_("NUMBER of threads that store blocks."), N_("NUMBER")},
+        { "backend", 0, 0, G_OPTION_ARG_STRING, &backend, N_("NAME of the backend that stores data (file or pack)."), N_("NAME")},
+        { "migrate-blocks", 0, 0, G_OPTION_ARG_NONE, &migrate_blocks, N_("Converts the block files of the file backend that have a .meta file and exits."), NULL},
         { NULL }
     };
 
@@ -200,6 +256,12 @@ options_t *manage_command_line_options(int argc, char **argv)
 
     opt->configfile = NULL;
     opt->port = SERVER_PORT;
+    opt->http_threads = SERVER_DEFAULT_HTTP_THREADS;
+    opt->request_workers = g_get_num_processors();
+    opt->connection_memory_limit = SERVER_DEFAULT_CONNECTION_MEMORY_LIMIT;
+    opt->connection_timeout = SERVER_DEFAULT_CONNECTION_TIMEOUT;
+    opt->data_writers = g_get_num_processors();
+    opt->backend = g_strdup(SERVER_DEFAULT_BACKEND);
 
 
     /* 1) Reading options from default configuration file */
@@ -208,6 +270,7 @@ options_t *manage_command_line_options(int argc, char **argv)
     free_variable(defaultconfigfilename);
 
     opt->version = version; /* only TRUE if -v or --version was invoked */
+    opt->migrate_blocks = migrate_blocks;
 
 
     /* 2) Reading the configuration from the configuration file specified
@@ -228,6 +291,60 @@ options_t *manage_command_line_options(int argc, char **argv)
             opt->port = port;
         }
 
+    if (http_threads >= 0)
+        {
+            opt->http_threads = http_threads;
+        }
+
+    if (request_workers > 0)
+        {
+            opt->request_workers = request_workers;
+        }
+
+    if (memory_limit > 0)
+        {
+            opt->connection_memory_limit = memory_limit;
+        }
+
+    if (timeout >= 0)
+        {
+            opt->connection_timeout = timeout;
+        }
+
+    if (data_writers > 0)
+        {
+            opt->data_writers = data_writers;
+        }
+
+    if (backend != NULL)
+        {
+            free_variable(opt->backend);
+            opt->backend = backend;
+        }
+
+    /* Values read from a configuration file may be out of range */
+    if (opt->http_threads < 0)
+        {
+            opt->http_threads = 0;
+        }
+
+    if (opt->request_workers <= 0)
+        {
+            opt->request_workers = 1;
+        }
+
+    if (opt->connection_memory_limit <= 0)
+        {
+            opt->connection_memory_limit = SERVER_DEFAULT_CONNECTION_MEMORY_LIMIT;
+        }
+
+    if (opt->connection_timeout < 0)
+        {
+            opt->connection_timeout = SERVER_DEFAULT_CONNECTION_TIMEOUT;
+        }
+
+    opt->data_writers = CLAMP(opt->data_writers, 1, SERVER_DATA_WRITERS_MAX);
+
     g_option_context_free(context);
     free_variable(bugreport);
     free_variable(summary);
@@ -39,9 +39,16 @@
  */
 typedef struct
 {
-    gboolean version;   /**< TRUE if we have to display program's version                             */
-    gchar *configfile;  /**< filename for the configuration file specified on the command line        */
-    gint port;          /**< port number on which the cdpfglserver program will listen for connexions */
+    gboolean version;               /**< TRUE if we have to display program's version                              */
+    gchar *configfile;              /**< filename for the configuration file specified on the command line         */
+    gint port;                      /**< port number on which the cdpfglserver program will listen for connexions  */
+    gint http_threads;              /**< number of libmicrohttpd epoll threads (0 means one thread per connection) */
+    gint request_workers;           /**< number of threads that process requests when http_threads is set          */
+    gint64 connection_memory_limit; /**< bytes that libmicrohttpd may use for each connection                      */
+    gint connection_timeout;        /**< seconds after which an inactive connection is closed                      */
+    gint data_writers;              /**< number of threads that store blocks (sharded by hash)                     */
+    gchar *backend;                 /**< name of the backend that stores data ("file" or "pack")                   */
+    gboolean migrate_blocks;        /**< TRUE to convert the file backend's block files and exit                   */
 } options_t;
 
 
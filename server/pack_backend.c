@@ -0,0 +1,1232 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    pack_backend.c
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+/**
+ * @file server/pack_backend.c
+ *
+ * This file contains all the functions for the backend that appends
+ * blocks to segment files instead of writing one file (and one .meta
+ * file) per block as file_backend does.
+ * @note to translators: pack_backend is the name of the backend please
+ *       do not translate it.
+ */
+
+#include "server.h"
+
+static gint compare_segments(gconstpointer a, gconstpointer b);
+static GArray *list_pack_segments(pack_backend_t *pack_backend);
+static gboolean write_all(gint fd, guchar *buffer, gsize length, guint64 offset);
+static gboolean read_all(gint fd, guchar *buffer, gsize length, guint64 offset);
+static void write_pack_checkpoint(pack_backend_t *pack_backend, guint64 seq);
+static void set_pending_records_state(GSList *records, gint state);
+static void sync_pending_records(pack_backend_t *pack_backend);
+static void close_segment(pack_backend_t *pack_backend);
+static gboolean append_record(pack_backend_t *pack_backend, hash_data_t *hash_data);
+static guint64 scan_segment(pack_backend_t *pack_backend, guint64 seq);
+static void scan_segment_in_pool(gpointer data, gpointer user_data);
+static void rebuild_pack_index(pack_backend_t *pack_backend, GArray *segments);
+static gboolean is_location_past_end(guint8 *hash, guchar *value, gpointer user_data);
+static void check_segments(pack_backend_t *pack_backend, GArray *segments);
+static void read_from_group_pack_backend(pack_backend_t *pack_backend, gchar *filename);
+
+
+/**
+ * Builds the filename of a segment of the pack backend.
+ * @param pack_backend is the pack backend structure.
+ * @param seq is the sequence number of a segment.
+ * @returns a newly allocated filename for this segment that may be
+ *          freed when no longer needed.
+ */
+gchar *get_pack_segment_filename(pack_backend_t *pack_backend, guint64 seq)
+{
+    gchar *basename = NULL;
+    gchar *filename = NULL;
+
+    basename = g_strdup_printf("%016" G_GINT64_MODIFIER "x%s", seq, PACK_SEGMENT_SUFFIX);
+    filename = g_build_filename(pack_backend->dirname, basename, NULL);
+    free_variable(basename);
+
+    return filename;
+}
+
+
+/**
+ * Compares two sequence numbers (for g_array_sort).
+ * @param a is a guint64 * sequence number.
+ * @param b is a guint64 * sequence number.
+ * @returns a negative value if a < b, 0 if a == b and a positive value
+ *          otherwise.
+ */
+static gint compare_segments(gconstpointer a, gconstpointer b)
+{
+    guint64 seq_a = *((guint64 *) a);
+    guint64 seq_b = *((guint64 *) b);
+
+    if (seq_a < seq_b)
+        {
+            return -1;
+        }
+    else if (seq_a > seq_b)
+        {
+            return 1;
+        }
+    else
+        {
+            return 0;
+        }
+}
+
+
+/**
+ * Lists the segments that are in the pack backend's directory.
+ * @param pack_backend is the pack backend structure.
+ * @returns a newly allocated GArray of guint64 sequence numbers sorted
+ *          in increasing order. It may be freed with g_array_free().
+ */
+static GArray *list_pack_segments(pack_backend_t *pack_backend)
+{
+    GArray *segments = NULL;
+    GDir *dir = NULL;
+    GError *error = NULL;
+    const gchar *name = NULL;
+    guint64 seq = 0;
+
+    segments = g_array_new(FALSE, FALSE, sizeof(guint64));
+    dir = g_dir_open(pack_backend->dirname, 0, &error);
+
+    if (dir != NULL)
+        {
+            name = g_dir_read_name(dir);
+            while (name != NULL)
+                {
+                    if (g_str_has_suffix(name, PACK_SEGMENT_SUFFIX))
+                        {
+                            seq = g_ascii_strtoull(name, NULL, 16);
+                            g_array_append_val(segments, seq);
+                        }
+                    name = g_dir_read_name(dir);
+                }
+            g_dir_close(dir);
+            g_array_sort(segments, compare_segments);
+        }
+    else
+        {
+            print_error(__FILE__, __LINE__, _("Unable to open pack directory %s: %s\n"), pack_backend->dirname, error->message);
+            free_error(error);
+        }
+
+    return segments;
+}
+
+
+/**
+ * Encodes a location into the value kept with a hash in the index.
+ * @param location is the location of a block.
+ * @param[out] value is a buffer of PACK_INDEX_VALUE_LEN bytes.
+ */
+void encode_pack_location(pack_location_t *location, guchar *value)
+{
+    guint64 be_segment = GUINT64_TO_BE(location->segment);
+    guint64 be_offset = GUINT64_TO_BE(location->offset);
+    guint32 be_length = GUINT32_TO_BE(location->length);
+    guint16 be_cmptype = GUINT16_TO_BE((guint16) location->cmptype);
+    guint64 be_uncmplen = GUINT64_TO_BE(location->uncmplen);
+
+    memset(value, 0, PACK_INDEX_VALUE_LEN);
+    memcpy(value, &be_segment, 8);
+    memcpy(value + 8, &be_offset, 8);
+    memcpy(value + 16, &be_length, 4);
+    memcpy(value + 20, &be_cmptype, 2);
+    memcpy(value + 24, &be_uncmplen, 8);
+}
+
+
+/**
+ * Decodes the value kept with a hash in the index.
+ * @param value is a buffer of PACK_INDEX_VALUE_LEN bytes.
+ * @param[out] location is the location of the block.
+ */
+void decode_pack_location(guchar *value, pack_location_t *location)
+{
+    guint64 be_segment = 0;
+    guint64 be_offset = 0;
+    guint32 be_length = 0;
+    guint16 be_cmptype = 0;
+    guint64 be_uncmplen = 0;
+
+    memcpy(&be_segment, value, 8);
+    memcpy(&be_offset, value + 8, 8);
+    memcpy(&be_length, value + 16, 4);
+    memcpy(&be_cmptype, value + 20, 2);
+    memcpy(&be_uncmplen, value + 24, 8);
+
+    location->segment = GUINT64_FROM_BE(be_segment);
+    location->offset = GUINT64_FROM_BE(be_offset);
+    location->length = GUINT32_FROM_BE(be_length);
+    location->cmptype = (gshort) GUINT16_FROM_BE(be_cmptype);
+    location->uncmplen = GUINT64_FROM_BE(be_uncmplen);
+}
+
+
+/**
+ * Encodes the header of the record of a block.
+ * @param hash_data is the block (hash, data, read, cmptype and uncmplen).
+ * @param[out] header is a buffer of PACK_RECORD_HEADER_LEN bytes.
+ */
+void encode_record_header(hash_data_t *hash_data, guchar *header)
+{
+    guint32 crc = 0;
+    guint64 length = 0;
+    guint64 uncmplen = 0;
+    guint16 cmptype = 0;
+
+    crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, (Bytef *) hash_data->data, (uInt) hash_data->read);
+    crc = GUINT32_TO_BE(crc);
+    length = GUINT64_TO_BE((guint64) hash_data->read);
+    uncmplen = GUINT64_TO_BE((guint64) hash_data->uncmplen);
+    cmptype = GUINT16_TO_BE((guint16) hash_data->cmptype);
+
+    memset(header, 0, PACK_RECORD_HEADER_LEN);
+    memcpy(header, PACK_RECORD_MAGIC, 4);
+    memcpy(header + 4, &crc, 4);
+    memcpy(header + 8, &length, 8);
+    memcpy(header + 16, &uncmplen, 8);
+    memcpy(header + 24, &cmptype, 2);
+    memcpy(header + 32, hash_data->hash, HASH_LEN);
+}
+
+
+/**
+ * Decodes the header of a record.
+ * @param header is a buffer of PACK_RECORD_HEADER_LEN bytes.
+ * @param[out] hash is a buffer of HASH_LEN bytes for the hash of the
+ *             block.
+ * @param[out] crc is the crc32 of the data.
+ * @param[out] location gets the length, cmptype and uncmplen of the
+ *             block (segment and offset are left untouched).
+ * @returns TRUE if header begins with PACK_RECORD_MAGIC and FALSE
+ *          otherwise.
+ */
+gboolean decode_record_header(guchar *header, guint8 *hash, guint32 *crc, pack_location_t *location)
+{
+    guint64 length = 0;
+    guint64 uncmplen = 0;
+    guint16 cmptype = 0;
+
+    if (memcmp(header, PACK_RECORD_MAGIC, 4) != 0)
+        {
+            return FALSE;
+        }
+
+    memcpy(crc, header + 4, 4);
+    memcpy(&length, header + 8, 8);
+    memcpy(&uncmplen, header + 16, 8);
+    memcpy(&cmptype, header + 24, 2);
+    memcpy(hash, header + 32, HASH_LEN);
+
+    *crc = GUINT32_FROM_BE(*crc);
+    length = GUINT64_FROM_BE(length);
+    location->uncmplen = GUINT64_FROM_BE(uncmplen);
+    location->cmptype = (gshort) GUINT16_FROM_BE(cmptype);
+
+    /* A block is never larger than a few megabytes */
+    location->length = (guint32) length;
+
+    return length <= G_MAXUINT32;
+}
+
+
+/**
+ * Writes length bytes of buffer to a file descriptor at a given offset.
+ * @param fd is the file descriptor.
+ * @param buffer is the buffer to be written.
+ * @param length is the number of bytes to be written.
+ * @param offset is the offset where the first byte is written.
+ * @returns TRUE if everything has been written and FALSE otherwise.
+ */
+static gboolean write_all(gint fd, guchar *buffer, gsize length, guint64 offset)
+{
+    gsize done = 0;
+    ssize_t written = 0;
+    gboolean ok = TRUE;
+
+    while (ok == TRUE && done < length)
+        {
+            written = pwrite(fd, buffer + done, length - done, offset + done);
+
+            if (written > 0)
+                {
+                    done = done + written;
+                }
+            else if (written < 0 && errno != EINTR)
+                {
+                    ok = FALSE;
+                }
+        }
+
+    return ok;
+}
+
+
+/**
+ * Reads length bytes of a file descriptor at a given offset.
+ * @param fd is the file descriptor.
+ * @param[out] buffer is where to copy the bytes.
+ * @param length is the number of bytes to be read.
+ * @param offset is the offset of the first byte to be read.
+ * @returns TRUE if the length bytes have been read and FALSE otherwise.
+ */
+static gboolean read_all(gint fd, guchar *buffer, gsize length, guint64 offset)
+{
+    gsize done = 0;
+    ssize_t nread = 0;
+    gboolean ok = TRUE;
+
+    while (ok == TRUE && done < length)
+        {
+            nread = pread(fd, buffer + done, length - done, offset + done);
+
+            if (nread > 0)
+                {
+                    done = done + nread;
+                }
+            else if (nread == 0 || errno != EINTR)
+                {
+                    ok = FALSE;
+                }
+        }
+
+    return ok;
+}
+
+
+/**
+ * Reads the checkpoint of the index (see write_pack_checkpoint()).
+ * @param pack_backend is the pack backend structure.
+ * @returns the sequence number of the first segment that is not known to
+ *          be in the index file (0 when there is no checkpoint: every
+ *          segment has to be checked).
+ */
+guint64 read_pack_checkpoint(pack_backend_t *pack_backend)
+{
+    gchar *filename = NULL;
+    gchar *contents = NULL;
+    guint64 seq = 0;
+
+    filename = g_build_filename(pack_backend->dirname, PACK_CHECKPOINT_FILENAME, NULL);
+
+    if (g_file_get_contents(filename, &contents, NULL, NULL) == TRUE)
+        {
+            seq = g_ascii_strtoull(contents, NULL, 16);
+            free_variable(contents);
+        }
+
+    free_variable(filename);
+
+    return seq;
+}
+
+
+/**
+ * Flushes the index to disk and then records that every block of the
+ * segments before seq is in the index file. The checkpoint is written to
+ * a temporary file that replaces the checkpoint file once it is on disk.
+ * Nothing is recorded when the index could not be flushed.
+ * @param pack_backend is the pack backend structure.
+ * @param seq is the sequence number of the first segment whose blocks
+ *        may be missing from the index file.
+ */
+static void write_pack_checkpoint(pack_backend_t *pack_backend, guint64 seq)
+{
+    gchar *filename = NULL;
+    gchar *tmp_filename = NULL;
+    gchar *contents = NULL;
+    gint fd = -1;
+    gboolean ok = FALSE;
+
+    if (sync_hash_index(pack_backend->index) == TRUE)
+        {
+            filename = g_build_filename(pack_backend->dirname, PACK_CHECKPOINT_FILENAME, NULL);
+            tmp_filename = g_strdup_printf("%s.tmp", filename);
+            contents = g_strdup_printf("%016" G_GINT64_MODIFIER "x\n", seq);
+
+            fd = open(tmp_filename, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+
+            if (fd >= 0)
+                {
+                    ok = write_all(fd, (guchar *) contents, strlen(contents), 0) && fsync(fd) == 0;
+                    close(fd);
+                }
+
+            if (ok == TRUE && rename(tmp_filename, filename) == 0)
+                {
+                    sync_directory(pack_backend->dirname);
+                }
+            else
+                {
+                    print_error(__FILE__, __LINE__, _("Unable to write pack checkpoint %s: %s\n"), filename, strerror(errno));
+                    unlink(tmp_filename);
+                }
+
+            free_variable(contents);
+            free_variable(tmp_filename);
+            free_variable(filename);
+        }
+}
+
+
+/**
+ * Sets the state of records that were waiting for a sync.
+ * @param records is a GSList of pack_pending_t * records.
+ * @param state is PACK_RECORD_INDEXED or PACK_RECORD_FAILED.
+ */
+static void set_pending_records_state(GSList *records, gint state)
+{
+    GSList *head = records;
+    pack_pending_t *record = NULL;
+
+    while (head != NULL)
+        {
+            record = head->data;
+            record->state = state;
+            head = g_slist_next(head);
+        }
+}
+
+
+/**
+ * Syncs the segment being written with one fdatasync() and then indexes
+ * the whole group of records appended since the previous sync. The
+ * mutex is released meanwhile so that the other data writers append the
+ * records of the next group. When the sync fails the segment is closed
+ * and the records that wait for a sync are not indexed. Records that the
+ * index could not take are failed too.
+ * pack_backend->mutex must be locked, pack_backend->pending must not be
+ * empty and no other data writer may be syncing.
+ * @param pack_backend is the pack backend structure.
+ */
+static void sync_pending_records(pack_backend_t *pack_backend)
+{
+    GSList *group = NULL;
+    GSList *head = NULL;
+    GSList *unindexed = NULL;
+    pack_pending_t *record = NULL;
+    guint64 seq = 0;
+    gint fd = -1;
+    gboolean ok = FALSE;
+
+    group = pack_backend->pending;
+    pack_backend->pending = NULL;
+    pack_backend->syncing = TRUE;
+    fd = pack_backend->fd;
+    seq = pack_backend->write_seq;
+
+    g_mutex_unlock(&pack_backend->mutex);
+
+    ok = fdatasync(fd) == 0;
+
+    if (ok == TRUE)
+        {
+            head = group;
+            while (head != NULL)
+                {
+                    record = head->data;
+
+                    if (insert_value_into_hash_index(pack_backend->index, record->hash, record->value) == FALSE)
+                        {
+                            unindexed = g_slist_prepend(unindexed, record);
+                        }
+
+                    head = g_slist_next(head);
+                }
+        }
+    else
+        {
+            print_error(__FILE__, __LINE__, _("Unable to sync segment %" G_GUINT64_FORMAT ": %s\n"), seq, strerror(errno));
+        }
+
+    g_mutex_lock(&pack_backend->mutex);
+
+    if (ok == TRUE)
+        {
+            set_pending_records_state(group, PACK_RECORD_INDEXED);
+            set_pending_records_state(unindexed, PACK_RECORD_FAILED);
+            g_slist_free(unindexed);
+        }
+    else
+        {
+            /* Records appended during the sync are in the same segment */
+            set_pending_records_state(group, PACK_RECORD_FAILED);
+            set_pending_records_state(pack_backend->pending, PACK_RECORD_FAILED);
+            g_slist_free(pack_backend->pending);
+            pack_backend->pending = NULL;
+        }
+
+    g_slist_free(group);
+    pack_backend->syncing = FALSE;
+
+    if (ok == FALSE)
+        {
+            close_segment(pack_backend);
+        }
+
+    g_cond_broadcast(&pack_backend->synced);
+}
+
+
+/**
+ * Closes the segment being written (if any) once its records are synced
+ * and indexed: the next block will be appended to a new segment. The
+ * index is then flushed and the checkpoint moves after that segment.
+ * pack_backend->mutex must be locked.
+ * @param pack_backend is the pack backend structure.
+ */
+static void close_segment(pack_backend_t *pack_backend)
+{
+    while (pack_backend->syncing == TRUE || pack_backend->pending != NULL)
+        {
+            if (pack_backend->syncing == TRUE)
+                {
+                    g_cond_wait(&pack_backend->synced, &pack_backend->mutex);
+                }
+            else
+                {
+                    sync_pending_records(pack_backend);
+                }
+        }
+
+    if (pack_backend->fd >= 0)
+        {
+            close(pack_backend->fd);
+            pack_backend->fd = -1;
+            pack_backend->write_seq = pack_backend->write_seq + 1;
+            pack_backend->write_size = 0;
+            write_pack_checkpoint(pack_backend, pack_backend->write_seq);
+        }
+}
+
+
+/**
+ * Appends the record of a block to the segment being written and
+ * indexes it. A new segment is started when this one would grow above
+ * segment_size. Records are not synced one by one: the data writer
+ * waits until one of the data writers syncs the segment with every
+ * record appended so far (group commit, see sync_pending_records()) so
+ * that the index never tells about a block that a crash may lose.
+ * Records are written at their offset: a record torn by a failed write
+ * is overwritten by the next one or skipped when the segment is scanned.
+ * @param pack_backend is the pack backend structure.
+ * @param hash_data is the block to be appended.
+ * @returns TRUE if the record is on disk and in the index and FALSE
+ *          otherwise.
+ */
+static gboolean append_record(pack_backend_t *pack_backend, hash_data_t *hash_data)
+{
+    pack_pending_t record;
+    pack_location_t location;
+    guchar header[PACK_RECORD_HEADER_LEN];
+    gchar *filename = NULL;
+    guint64 record_len = 0;
+
+    encode_record_header(hash_data, header);
+    record_len = PACK_RECORD_HEADER_LEN + hash_data->read;
+    record.hash = hash_data->hash;
+    record.state = PACK_RECORD_FAILED;
+
+    g_mutex_lock(&pack_backend->mutex);
+
+    if (pack_backend->write_size > 0 && pack_backend->write_size + record_len > pack_backend->segment_size)
+        {
+            close_segment(pack_backend);
+        }
+
+    if (pack_backend->fd < 0)
+        {
+            filename = get_pack_segment_filename(pack_backend, pack_backend->write_seq);
+            pack_backend->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+            pack_backend->write_size = 0;
+
+            if (pack_backend->fd < 0)
+                {
+                    print_error(__FILE__, __LINE__, _("Unable to create segment %s: %s\n"), filename, strerror(errno));
+                    pack_backend->write_seq = pack_backend->write_seq + 1;
+                }
+            else
+                {
+                    sync_directory(pack_backend->dirname);
+                }
+
+            free_variable(filename);
+        }
+
+    if (pack_backend->fd >= 0)
+        {
+            location.segment = pack_backend->write_seq;
+            location.offset = pack_backend->write_size;
+            location.length = (guint32) hash_data->read;
+            location.cmptype = hash_data->cmptype;
+            location.uncmplen = hash_data->uncmplen;
+
+            if (write_all(pack_backend->fd, header, PACK_RECORD_HEADER_LEN, location.offset) == TRUE && write_all(pack_backend->fd, hash_data->data, hash_data->read, location.offset + PACK_RECORD_HEADER_LEN) == TRUE)
+                {
+                    pack_backend->write_size = pack_backend->write_size + record_len;
+                    encode_pack_location(&location, record.value);
+                    record.state = PACK_RECORD_PENDING;
+                    pack_backend->pending = g_slist_prepend(pack_backend->pending, &record);
+                }
+            else
+                {
+                    print_error(__FILE__, __LINE__, _("Unable to write to segment %" G_GUINT64_FORMAT ": %s\n"), pack_backend->write_seq, strerror(errno));
+                    close_segment(pack_backend);
+                }
+        }
+
+    /* The first data writer that finds no sync running syncs the group */
+    while (record.state == PACK_RECORD_PENDING)
+        {
+            if (pack_backend->syncing == FALSE)
+                {
+                    sync_pending_records(pack_backend);
+                }
+            else
+                {
+                    g_cond_wait(&pack_backend->synced, &pack_backend->mutex);
+                }
+        }
+
+    g_mutex_unlock(&pack_backend->mutex);
+
+    return record.state == PACK_RECORD_INDEXED;
+}
+
+
+/**
+ * Stores meta data into a flat file as file_store_smeta() does.
+ * @param server_struct is the server's main structure where all
+ *        informations needed by the program are stored.
+ * @param smeta the server's structure for file meta data. It contains the
+ *        hostname that sent it.
+ */
+void pack_store_smeta(server_struct_t *server_struct, server_meta_data_t *smeta)
+{
+    pack_backend_t *pack_backend = NULL;
+
+    if (server_struct != NULL && server_struct->backend != NULL && server_struct->backend->user_data != NULL)
+        {
+            pack_backend = server_struct->backend->user_data;
+            store_smeta_into_directory(pack_backend->prefix, smeta);
+        }
+}
+
+
+/**
+ * Appends a block to the segment being written and records where it is
+ * in the index once it is on disk. Blocks already stored and blocks of
+ * zeros are dropped. Blocks of the same hash always go to the same data
+ * writer (see push_to_data_writer()) and a data writer only returns once
+ * its block is indexed so a block is never appended twice.
+ * @param server_struct is the server's main structure where all
+ *        informations needed by the program are stored.
+ * @param hash_data is a hash_data_t * structure that contains the hash and
+ *        the corresponding data in a binary form. It is freed here.
+ */
+void pack_store_data(server_struct_t *server_struct, hash_data_t *hash_data)
+{
+    pack_backend_t *pack_backend = NULL;
+
+    if (server_struct != NULL && server_struct->backend != NULL && server_struct->backend->user_data != NULL)
+        {
+            pack_backend = server_struct->backend->user_data;
+
+            if (hash_data != NULL && is_zero_block_hash(hash_data->hash) == TRUE)
+                {
+                    /* Blocks of zeros are rebuilt from their hash: they are never stored */
+                    free_hash_data_t(hash_data);
+                }
+            else if (hash_data != NULL && hash_data->hash != NULL && hash_data->data != NULL)
+                {
+                    if (is_hash_in_index(pack_backend->index, hash_data->hash) == FALSE)
+                        {
+                            append_record(pack_backend, hash_data);
+                        }
+
+                    free_hash_data_t(hash_data);
+                }
+            else
+                {
+                    print_error(__FILE__, __LINE__, _("Error: no hash_data_t structure or hash in it or missing data in it.\n"));
+                    free_hash_data_t(hash_data);
+                }
+        }
+}
+
+
+/**
+ * Builds a list of hashs that the server needs (those that are not in
+ * the index).
+ * @param server_struct is the server's main structure where all
+ *        informations needed by the program are stored.
+ * @param hash_data_list is the list of hashs that we have to check for.
+ * @returns a list of hashs in no specific order for which the server
+ *          needs the data.
+ */
+GList *pack_build_needed_hash_list(server_struct_t *server_struct, GList *hash_data_list)
+{
+    GList *head = hash_data_list;
+    GList *needed = NULL;
+    GHashTable *asked = NULL;
+    pack_backend_t *pack_backend = NULL;
+    hash_data_t *hash_data = NULL;
+
+    if (server_struct != NULL && server_struct->backend != NULL && server_struct->backend->user_data != NULL)
+        {
+            pack_backend = server_struct->backend->user_data;
+
+            /* Hashs already looked at (a hash may appear many times in the list) */
+            asked = g_hash_table_new(hash_digest_hash, hash_digest_equal);
+
+            while (head != NULL)
+                {
+                    hash_data = head->data;
+
+                    if (g_hash_table_contains(asked, hash_data->hash) == FALSE)
+                        {
+                            g_hash_table_add(asked, hash_data->hash);
+
+                            if (is_hash_in_index(pack_backend->index, hash_data->hash) == FALSE)
+                                {
+                                    needed = g_list_prepend(needed, copy_only_hash(hash_data, NULL));
+                                }
+                        }
+
+                    head = g_list_next(head);
+                }
+
+            g_hash_table_destroy(asked);
+            needed = g_list_reverse(needed);
+        }
+
+    return needed;
+}
+
+
+/**
+ * Gets the list of all saved files as file_get_list_of_files() does.
+ * @param server_struct is the structure that contains all data for the
+ *        server.
+ * @param query is the structure that contains everything about the
+ *        requested query.
+ * @returns a JSON string containing all filenames requested
+ */
+gchar *pack_get_list_of_files(server_struct_t *server_struct, query_t *query)
+{
+    pack_backend_t *pack_backend = NULL;
+    gchar *directory = NULL;
+
+    if (server_struct != NULL && server_struct->backend != NULL && server_struct->backend->user_data != NULL)
+        {
+            pack_backend = server_struct->backend->user_data;
+            directory = pack_backend->prefix;
+        }
+
+    return get_list_of_files_from_directory(directory, query);
+}
+
+
+/**
+ * Retrieves a block from its segment. Each call opens the segment on its
+ * own so that any number of readers (and the writer) work concurrently.
+ * The record's header must match the index and the data its crc32.
+ * @param server_struct is the server's main structure where all
+ *        informations needed by the program are stored.
+ * @param hex_hash is a gchar * hash in hexadecimal format as retrieved
+ *        from the url.
+ * @returns a newly allocated hash_data_t or NULL if the block is not
+ *          stored or could not be read.
+ */
+hash_data_t *pack_retrieve_data(server_struct_t *server_struct, gchar *hex_hash)
+{
+    pack_backend_t *pack_backend = NULL;
+    pack_location_t location;
+    pack_location_t recorded;
+    guchar value[PACK_INDEX_VALUE_LEN];
+    guchar header[PACK_RECORD_HEADER_LEN];
+    guint8 recorded_hash[HASH_LEN];
+    guint32 crc = 0;
+    gchar *filename = NULL;
+    guint8 *hash = NULL;
+    guchar *data = NULL;
+    hash_data_t *hash_data = NULL;
+    gint fd = -1;
+
+    if (server_struct != NULL && server_struct->backend != NULL && server_struct->backend->user_data != NULL && hex_hash != NULL)
+        {
+            pack_backend = server_struct->backend->user_data;
+            hash = string_to_hash(hex_hash);
+
+            if (get_value_from_hash_index(pack_backend->index, hash, value) == TRUE)
+                {
+                    decode_pack_location(value, &location);
+                    filename = get_pack_segment_filename(pack_backend, location.segment);
+                    fd = open(filename, O_RDONLY);
+
+                    if (fd >= 0 && read_all(fd, header, PACK_RECORD_HEADER_LEN, location.offset) == TRUE && decode_record_header(header, recorded_hash, &crc, &recorded) == TRUE && recorded.length == location.length && memcmp(recorded_hash, hash, HASH_LEN) == 0)
+                        {
+                            /* No need to do g_malloc0  because data is binary data */
+                            data = (guchar *) g_malloc(location.length + 1);
+
+                            if (read_all(fd, data, location.length, location.offset + PACK_RECORD_HEADER_LEN) == TRUE && crc32(crc32(0L, Z_NULL, 0), (Bytef *) data, (uInt) location.length) == crc)
+                                {
+                                    /* see retreive_data() in server.c */
+                                    hash_data = new_hash_data_t_as_is(data, location.length, hash, location.cmptype, location.uncmplen);
+                                }
+                            else
+                                {
+                                    print_error(__FILE__, __LINE__, _("Error: block %s is corrupted in segment %s.\n"), hex_hash, filename);
+                                    free_variable(data);
+                                }
+                        }
+                    else
+                        {
+                            print_error(__FILE__, __LINE__, _("Error: unable to read block %s from segment %s.\n"), hex_hash, filename);
+                        }
+
+                    if (fd >= 0)
+                        {
+                            close(fd);
+                        }
+
+                    free_variable(filename);
+                }
+            else
+                {
+                    print_error(__FILE__, __LINE__, _("Error: block %s is not stored.\n"), hex_hash);
+                }
+
+            if (hash_data == NULL)
+                {
+                    free_variable(hash);
+                }
+        }
+
+    return hash_data;
+}
+
+
+/**
+ * Inserts into the index every block of a segment. The scan stops at the
+ * first record that is incomplete or whose crc32 is wrong (the end of a
+ * segment that was being written when the server stopped).
+ * @param pack_backend is the pack backend structure whose index is being
+ *        rebuilt or checked.
+ * @param seq is the sequence number of the segment.
+ * @returns the offset right after the last valid record of the segment.
+ */
+static guint64 scan_segment(pack_backend_t *pack_backend, guint64 seq)
+{
+    struct stat st;
+    pack_location_t location;
+    guchar header[PACK_RECORD_HEADER_LEN];
+    guchar value[PACK_INDEX_VALUE_LEN];
+    guint8 hash[HASH_LEN];
+    guint32 crc = 0;
+    gchar *filename = NULL;
+    guchar *data = NULL;
+    guint64 offset = 0;
+    gint fd = -1;
+    gboolean valid = TRUE;
+
+    filename = get_pack_segment_filename(pack_backend, seq);
+    fd = open(filename, O_RDONLY);
+
+    if (fd >= 0 && fstat(fd, &st) == 0)
+        {
+            while (valid == TRUE && offset + PACK_RECORD_HEADER_LEN <= (guint64) st.st_size)
+                {
+                    valid = read_all(fd, header, PACK_RECORD_HEADER_LEN, offset) && decode_record_header(header, hash, &crc, &location) && offset + PACK_RECORD_HEADER_LEN + location.length <= (guint64) st.st_size;
+
+                    if (valid == TRUE)
+                        {
+                            data = (guchar *) g_malloc(location.length + 1);
+                            valid = read_all(fd, data, location.length, offset + PACK_RECORD_HEADER_LEN) && crc32(crc32(0L, Z_NULL, 0), (Bytef *) data, (uInt) location.length) == crc;
+                            free_variable(data);
+                        }
+
+                    if (valid == TRUE)
+                        {
+                            location.segment = seq;
+                            location.offset = offset;
+                            encode_pack_location(&location, value);
+                            insert_value_into_hash_index(pack_backend->index, hash, value);
+                            offset = offset + PACK_RECORD_HEADER_LEN + location.length;
+                        }
+                }
+
+            if (valid == FALSE)
+                {
+                    print_error(__FILE__, __LINE__, _("Segment %s ends with an invalid record at offset %" G_GUINT64_FORMAT "\n"), filename, offset);
+                }
+        }
+    else
+        {
+            print_error(__FILE__, __LINE__, _("Unable to read segment %s: %s\n"), filename, strerror(errno));
+        }
+
+    if (fd >= 0)
+        {
+            close(fd);
+        }
+
+    free_variable(filename);
+
+    return offset;
+}
+
+
+/**
+ * Scans a segment. This is the function run by the threads that rebuild
+ * the index.
+ * @param data is a guint64 * sequence number that is freed here.
+ * @param user_data is the pack_backend_t * structure.
+ */
+static void scan_segment_in_pool(gpointer data, gpointer user_data)
+{
+    guint64 *seq = (guint64 *) data;
+    pack_backend_t *pack_backend = (pack_backend_t *) user_data;
+
+    if (seq != NULL)
+        {
+            scan_segment(pack_backend, *seq);
+            free_variable(seq);
+        }
+}
+
+
+/**
+ * Rebuilds the index from the segments, each segment being scanned by a
+ * thread of a pool. The index is built (and grows) in a temporary file
+ * that becomes the index file once it is complete.
+ * @param pack_backend is the pack backend structure (its index is set).
+ * @param segments is the sorted array of the segments' sequence numbers.
+ */
+static void rebuild_pack_index(pack_backend_t *pack_backend, GArray *segments)
+{
+    GThreadPool *pool = NULL;
+    gchar *filename = NULL;
+    guint64 *seq = NULL;
+    guint i = 0;
+
+    filename = g_build_filename(pack_backend->dirname, PACK_INDEX_FILENAME, NULL);
+    pack_backend->index = new_hash_index_to_rebuild(filename, pack_backend->index_slots, PACK_INDEX_VALUE_LEN);
+
+    if (pack_backend->index != NULL)
+        {
+            fprintf(stdout, _("Please wait while rebuilding pack index\n"));
+
+            pool = g_thread_pool_new(scan_segment_in_pool, pack_backend, g_get_num_processors(), FALSE, NULL);
+
+            for (i = 0; i < segments->len; i++)
+                {
+                    seq = (guint64 *) g_malloc0(sizeof(guint64));
+                    g_assert_nonnull(seq);
+
+                    *seq = g_array_index(segments, guint64, i);
+                    g_thread_pool_push(pool, seq, NULL);
+                }
+
+            /* Waits for every segment to be scanned */
+            g_thread_pool_free(pool, FALSE, TRUE);
+
+            if (finish_hash_index_rebuild(pack_backend->index) == FALSE)
+                {
+                    free_hash_index_t(pack_backend->index);
+                    pack_backend->index = NULL;
+                }
+        }
+
+    free_variable(filename);
+}
+
+
+/**
+ * Tells whether an entry of the index is past the end of the valid
+ * records of its segment (see check_segments()).
+ * @param hash is the hash of the entry (unused).
+ * @param value is the pack location of the block in the index.
+ * @param user_data is a GArray of pack_location_t whose segment and
+ *        offset are the end of the valid records of each segment that
+ *        has been checked (sorted, the last one is the last segment).
+ * @returns TRUE if the block is past the end of its segment or in a
+ *          segment after the last one and FALSE otherwise.
+ */
+static gboolean is_location_past_end(guint8 *hash, guchar *value, gpointer user_data)
+{
+    GArray *ends = (GArray *) user_data;
+    pack_location_t *end = NULL;
+    pack_location_t location;
+    gboolean past_end = FALSE;
+    guint i = 0;
+
+    decode_pack_location(value, &location);
+
+    if (ends->len > 0)
+        {
+            past_end = location.segment > g_array_index(ends, pack_location_t, ends->len - 1).segment;
+
+            for (i = 0; past_end == FALSE && i < ends->len; i++)
+                {
+                    end = &g_array_index(ends, pack_location_t, i);
+                    past_end = location.segment == end->segment && location.offset >= end->offset;
+                }
+        }
+
+    return past_end;
+}
+
+
+/**
+ * Checks an index opened from its file against the segments written
+ * since the checkpoint: the index file may miss blocks that were not
+ * flushed before a crash and the last segment may end with records
+ * lost or torn while the index still tells about them. The valid
+ * records of those segments are inserted into the index and the entries
+ * past their last valid record are removed. The checkpoint then moves
+ * after the last segment.
+ * @param pack_backend is the pack backend structure.
+ * @param segments is the sorted array of the segments' sequence numbers.
+ */
+static void check_segments(pack_backend_t *pack_backend, GArray *segments)
+{
+    GArray *ends = NULL;
+    pack_location_t end;
+    guint64 checkpoint = 0;
+    guint64 removed = 0;
+    guint i = 0;
+
+    ends = g_array_new(FALSE, FALSE, sizeof(pack_location_t));
+    checkpoint = read_pack_checkpoint(pack_backend);
+    memset(&end, 0, sizeof(pack_location_t));
+
+    for (i = 0; i < segments->len; i++)
+        {
+            end.segment = g_array_index(segments, guint64, i);
+
+            if (end.segment >= checkpoint)
+                {
+                    end.offset = scan_segment(pack_backend, end.segment);
+                    g_array_append_val(ends, end);
+                }
+        }
+
+    if (ends->len == 0)
+        {
+            /* Nothing after the checkpoint: no entry may be past its end */
+            end.segment = pack_backend->write_seq;
+            end.offset = 0;
+            g_array_append_val(ends, end);
+        }
+
+    removed = remove_from_hash_index_if(pack_backend->index, is_location_past_end, ends);
+
+    if (removed > 0)
+        {
+            print_error(__FILE__, __LINE__, _("%" G_GUINT64_FORMAT " blocks past the end of their segment removed from pack index\n"), removed);
+        }
+
+    g_array_free(ends, TRUE);
+    write_pack_checkpoint(pack_backend, pack_backend->write_seq);
+}
+
+
+/**
+ * Reads keys from the pack backend group in the configuration file and
+ * fills the pack_backend structure accordingly.
+ * @param[in,out] pack_backend: pack_backend_t * structure to store
+ *                options read from the configuration file "filename".
+ * @param filename : the filename of the configuration file to read from
+ */
+static void read_from_group_pack_backend(pack_backend_t *pack_backend, gchar *filename)
+{
+    GKeyFile *keyfile = NULL;      /** Configuration file parser */
+    GError *error = NULL;          /** Glib error handling       */
+    gchar *prefix = NULL;
+    gint64 segment_size = 0;
+    gint64 index_slots = 0;
+
+    keyfile = g_key_file_new();
+
+    if (g_key_file_load_from_file(keyfile, filename, G_KEY_FILE_KEEP_COMMENTS, &error))
+        {
+            if (g_key_file_has_group(keyfile, GN_PACK_BACKEND) == TRUE)
+                {
+                    prefix = read_string_from_file(keyfile, filename, GN_PACK_BACKEND, KN_PACK_DIRECTORY, _("Could not load [pack_backend] pack-directory from file."));
+                    segment_size = read_int64_from_file(keyfile, filename, GN_PACK_BACKEND, KN_SEGMENT_SIZE, _("Could not load [pack_backend] segment-size from file."), PACK_DEFAULT_SEGMENT_SIZE);
+                    index_slots = read_int64_from_file(keyfile, filename, GN_PACK_BACKEND, KN_INDEX_SLOTS, _("Could not load [pack_backend] index-slots from file."), HASH_INDEX_MIN_SLOTS);
+                }
+        }
+    else if (error != NULL)
+        {
+            print_error(__FILE__, __LINE__,  _("Failed to open %s configuration file: %s\n"), filename, error->message);
+            free_error(error);
+        }
+
+    if (prefix != NULL)
+        {
+            free_variable(pack_backend->prefix);
+            pack_backend->prefix = normalize_directory(prefix);
+        }
+
+    free_variable(prefix);
+
+    if (segment_size >= PACK_MIN_SEGMENT_SIZE)
+        {
+            pack_backend->segment_size = segment_size;
+        }
+
+    if (index_slots > 1 && (index_slots & (index_slots - 1)) == 0)
+        {
+            pack_backend->index_slots = index_slots;
+        }
+
+    g_key_file_free(keyfile);
+}
+
+
+/**
+ * Inits the backend: creates its directories, opens its index (and
+ * checks it against the segments written since the checkpoint) or
+ * rebuilds it from the segments and starts a new segment after the last
+ * one (the end of the last one may be an incomplete record).
+ * user_data of the backend structure is a pack_backend_t structure.
+ * @param server_struct is the server's main structure where all
+ *        informations needed by the program are stored.
+ * @returns TRUE if the backend is ready and FALSE when its index could
+ *          be neither opened nor rebuilt.
+ */
+gboolean pack_init_backend(server_struct_t *server_struct)
+{
+    pack_backend_t *pack_backend = NULL;
+    GArray *segments = NULL;
+    gchar *filename = NULL;
+    gboolean ready = FALSE;
+
+    if (server_struct != NULL && server_struct->backend != NULL)
+        {
+            pack_backend = (pack_backend_t *) g_malloc0(sizeof(pack_backend_t));
+            g_assert_nonnull(pack_backend);
+
+            /* default values */
+            pack_backend->prefix = g_strdup("/var/tmp/cdpfgl/server");
+            pack_backend->segment_size = PACK_DEFAULT_SEGMENT_SIZE;
+            pack_backend->index_slots = HASH_INDEX_MIN_SLOTS;
+
+            if (server_struct->opt != NULL && server_struct->opt->configfile != NULL)
+                {
+                    /* Values from the config file */
+                    read_from_group_pack_backend(pack_backend, server_struct->opt->configfile);
+                }
+
+            g_mutex_init(&pack_backend->mutex);
+            g_cond_init(&pack_backend->synced);
+            pack_backend->fd = -1;
+            pack_backend->write_size = 0;
+            pack_backend->pending = NULL;
+            pack_backend->syncing = FALSE;
+            pack_backend->dirname = g_build_filename(pack_backend->prefix, PACK_BACKEND_DIRECTORY, NULL);
+
+            server_struct->backend->user_data = pack_backend;
+
+            file_create_directory(pack_backend->prefix, "meta");
+            file_create_directory(pack_backend->prefix, PACK_BACKEND_DIRECTORY);
+
+            segments = list_pack_segments(pack_backend);
+
+            if (segments->len > 0)
+                {
+                    pack_backend->write_seq = g_array_index(segments, guint64, segments->len - 1) + 1;
+                }
+
+            filename = g_build_filename(pack_backend->dirname, PACK_INDEX_FILENAME, NULL);
+            pack_backend->index = open_hash_index_file(filename, PACK_INDEX_VALUE_LEN);
+
+            if (pack_backend->index != NULL)
+                {
+                    check_segments(pack_backend, segments);
+                }
+            else
+                {
+                    rebuild_pack_index(pack_backend, segments);
+
+                    if (pack_backend->index != NULL)
+                        {
+                            write_pack_checkpoint(pack_backend, pack_backend->write_seq);
+                        }
+                }
+
+            if (pack_backend->index != NULL)
+                {
+                    ready = TRUE;
+                }
+            else
+                {
+                    print_error(__FILE__, __LINE__, _("Error: unable to open nor rebuild pack index %s.\n"), filename);
+                }
+
+            free_variable(filename);
+            g_array_free(segments, TRUE);
+        }
+    else
+        {
+            print_error(__FILE__, __LINE__, _("Error: no server structure or no backend structure.\n"));
+        }
+
+    return ready;
+}
+
+
+/**
+ * Syncs and closes the segment being written, writes the checkpoint,
+ * closes the index cleanly and frees the backend. Nothing must be stored
+ * anymore.
+ * @param server_struct is the server's main structure.
+ */
+void pack_terminate_backend(server_struct_t *server_struct)
+{
+    pack_backend_t *pack_backend = NULL;
+
+    if (server_struct != NULL && server_struct->backend != NULL && server_struct->backend->user_data != NULL)
+        {
+            pack_backend = (pack_backend_t *) server_struct->backend->user_data;
+
+            g_mutex_lock(&pack_backend->mutex);
+            close_segment(pack_backend);
+            g_mutex_unlock(&pack_backend->mutex);
+
+            free_hash_index_t(pack_backend->index);
+            g_cond_clear(&pack_backend->synced);
+            g_mutex_clear(&pack_backend->mutex);
+            free_variable(pack_backend->dirname);
+            free_variable(pack_backend->prefix);
+            free_variable(pack_backend);
+            server_struct->backend->user_data = NULL;
+        }
+}
@@ -0,0 +1,299 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    pack_backend.h
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+/**
+ * @file server/pack_backend.h
+ *
+ * This file contains all definitions for the pack backend. Blocks are
+ * appended to segment files (PACK_DEFAULT_SEGMENT_SIZE bytes at most) as
+ * records made of a header (PACK_RECORD_MAGIC, crc32 of the data, length
+ * of the data, uncompressed length, compression type and hash) followed
+ * by the data. Integers are big endian. A hash index (see hash_index.h)
+ * tells in which segment, at which offset and how each block is stored.
+ * It is rebuilt from the segments when it is missing. A checkpoint file
+ * tells the first segment whose blocks may be missing from the index
+ * file after a crash: that segment and the following ones are scanned
+ * again when the backend starts. Meta data are stored as the file
+ * backend does.
+ */
+
+#ifndef _SERVER_PACK_BACKEND_H_
+#define _SERVER_PACK_BACKEND_H_
+
+
+/**
+ * @def PACK_BACKEND_DIRECTORY
+ * Name of the directory (in the pack backend's prefix) of the segments
+ * and of their index.
+ *
+ * @def PACK_INDEX_FILENAME
+ * Name of the hash index of the pack backend.
+ *
+ * @def PACK_CHECKPOINT_FILENAME
+ * Name of the file that contains the sequence number (in hexadecimal)
+ * of the first segment that is not known to be in the index file on
+ * disk.
+ *
+ * @def PACK_SEGMENT_SUFFIX
+ * Suffix of segment files. Segments are named with their sequence
+ * number in hexadecimal followed by this suffix.
+ */
+#define PACK_BACKEND_DIRECTORY ("packs")
+#define PACK_INDEX_FILENAME ("pack.index")
+#define PACK_CHECKPOINT_FILENAME ("pack.checkpoint")
+#define PACK_SEGMENT_SUFFIX (".pack")
+
+
+/**
+ * @def PACK_DEFAULT_SEGMENT_SIZE
+ * Default size in bytes (1 GB) above which a new segment is started.
+ *
+ * @def PACK_MIN_SEGMENT_SIZE
+ * Smallest segment size accepted from the configuration file (1 MB).
+ */
+#define PACK_DEFAULT_SEGMENT_SIZE (1073741824)
+#define PACK_MIN_SEGMENT_SIZE (1048576)
+
+
+/**
+ * @def PACK_RECORD_MAGIC
+ * Four bytes that begin every record.
+ *
+ * @def PACK_RECORD_HEADER_LEN
+ * Length in bytes of a record's header: magic, crc32 (32 bits), length
+ * (64 bits), uncmplen (64 bits), cmptype (16 bits), 6 unused bytes and
+ * the hash (HASH_LEN bytes).
+ *
+ * @def PACK_INDEX_VALUE_LEN
+ * Number of bytes kept with each hash in the index: segment (64 bits),
+ * offset of the record (64 bits), length (32 bits), cmptype (16 bits), 2
+ * unused bytes and uncmplen (64 bits).
+ */
+#define PACK_RECORD_MAGIC ("CDPB")
+#define PACK_RECORD_HEADER_LEN (32 + HASH_LEN)
+#define PACK_INDEX_VALUE_LEN (32)
+
+
+/**
+ * @struct pack_location_t
+ * @brief Where and how a block is stored (the value of its hash in the
+ *        index).
+ */
+typedef struct
+{
+    guint64 segment;     /**< sequence number of the segment              */
+    guint64 offset;      /**< offset of the record in the segment         */
+    guint32 length;      /**< length of the (compressed) data             */
+    gshort cmptype;      /**< compression type of the data                */
+    guint64 uncmplen;    /**< length of the uncompressed data             */
+} pack_location_t;
+
+
+/**
+ * @def PACK_RECORD_PENDING
+ * State of a record written to its segment that waits for the next
+ * fdatasync().
+ *
+ * @def PACK_RECORD_INDEXED
+ * State of a record that is on disk and in the index.
+ *
+ * @def PACK_RECORD_FAILED
+ * State of a record that could not be synced to disk (it is not in the
+ * index).
+ */
+#define PACK_RECORD_PENDING (0)
+#define PACK_RECORD_INDEXED (1)
+#define PACK_RECORD_FAILED (2)
+
+
+/**
+ * @struct pack_pending_t
+ * @brief A record appended to the segment being written by a data writer
+ *        that waits until one fdatasync() puts it (and every record
+ *        appended with it) on disk before it goes into the index.
+ */
+typedef struct
+{
+    guint8 *hash;                        /**< hash of the block (owned by the data writer)   */
+    guchar value[PACK_INDEX_VALUE_LEN];  /**< encoded location of the record                */
+    gint state;                          /**< PACK_RECORD_PENDING, _INDEXED or _FAILED        */
+} pack_pending_t;
+
+
+/**
+ * @struct pack_backend_t
+ * @brief Structure that contains everything needed by pack backend. Blocks
+ *        are appended by one writer at a time and synced to disk by
+ *        groups while any number of readers read them from their own
+ *        file descriptors.
+ */
+typedef struct
+{
+    gchar *prefix;          /**< Prefix for the path where data are located               */
+    gchar *dirname;         /**< directory of the segments                                */
+    guint64 segment_size;   /**< size above which a new segment is started                */
+    guint64 index_slots;    /**< number of slots a rebuilt index begins with              */
+    hash_index_t *index;    /**< hash -> pack_location_t of every stored block            */
+    GMutex mutex;           /**< protects everything below                                */
+    GCond synced;           /**< signaled each time a group of records has been synced    */
+    gint fd;                /**< segment being written or -1 when there is none           */
+    guint64 write_seq;      /**< sequence number of the segment being written             */
+    guint64 write_size;     /**< number of bytes written in that segment                  */
+    GSList *pending;        /**< pack_pending_t * records waiting for the next sync       */
+    gboolean syncing;       /**< TRUE while a data writer syncs a group of records        */
+} pack_backend_t;
+
+
+/**
+ * Stores meta data into a flat file as file_store_smeta() does.
+ * @param server_struct is the server's main structure where all
+ *        informations needed by the program are stored.
+ * @param smeta the server's structure for file meta data. It contains the
+ *        hostname that sent it.
+ */
+extern void pack_store_smeta(server_struct_t *server_struct, server_meta_data_t *smeta);
+
+
+/**
+ * Inits the backend: creates its directories, opens its index (and
+ * checks it against the segments written since the checkpoint) or
+ * rebuilds it from the segments and starts a new segment.
+ * @param server_struct is the server's main structure where all
+ *        informations needed by the program are stored.
+ * @returns TRUE if the backend is ready and FALSE when its index could
+ *          be neither opened nor rebuilt.
+ */
+extern gboolean pack_init_backend(server_struct_t *server_struct);
+
+
+/**
+ * Appends a block to the segment being written and records where it is
+ * in the index. Blocks already stored and blocks of zeros are dropped.
+ * @param server_struct is the server's main structure where all
+ *        informations needed by the program are stored.
+ * @param hash_data is a hash_data_t * structure that contains the hash and
+ *        the corresponding data in a binary form. It is freed here.
+ */
+extern void pack_store_data(server_struct_t *server_struct, hash_data_t *hash_data);
+
+
+/**
+ * Builds a list of hashs that the server needs (those that are not in
+ * the index).
+ * @param server_struct is the server's main structure where all
+ *        informations needed by the program are stored.
+ * @param hash_data_list is the list of hashs that we have to check for.
+ * @returns a list of hashs in no specific order for which the server
+ *          needs the data.
+ */
+extern GList *pack_build_needed_hash_list(server_struct_t *server_struct, GList *hash_data_list);
+
+
+/**
+ * Gets the list of all saved files as file_get_list_of_files() does.
+ * @param server_struct is the structure that contains all data for the
+ *        server.
+ * @param query is the structure that contains everything about the
+ *        requested query.
+ * @returns a JSON string containing all filenames requested
+ */
+extern gchar *pack_get_list_of_files(server_struct_t *server_struct, query_t *query);
+
+
+/**
+ * Retrieves a block from its segment.
+ * @param server_struct is the server's main structure where all
+ *        informations needed by the program are stored.
+ * @param hex_hash is a gchar * hash in hexadecimal format as retrieved
+ *        from the url.
+ * @returns a newly allocated hash_data_t or NULL if the block is not
+ *          stored or could not be read.
+ */
+extern hash_data_t *pack_retrieve_data(server_struct_t *server_struct, gchar *hex_hash);
+
+
+/**
+ * Syncs and closes the segment being written, writes the checkpoint,
+ * closes the index cleanly and frees the backend. Nothing must be stored
+ * anymore.
+ * @param server_struct is the server's main structure.
+ */
+extern void pack_terminate_backend(server_struct_t *server_struct);
+
+/**
+ * Builds the filename of a segment of the pack backend.
+ * @param pack_backend is the pack backend structure.
+ * @param seq is the sequence number of a segment.
+ * @returns a newly allocated filename for this segment that may be
+ *          freed when no longer needed.
+ */
+extern gchar *get_pack_segment_filename(pack_backend_t *pack_backend, guint64 seq);
+
+
+/**
+ * Encodes a location into the value kept with a hash in the index.
+ * @param location is the location of a block.
+ * @param[out] value is a buffer of PACK_INDEX_VALUE_LEN bytes.
+ */
+extern void encode_pack_location(pack_location_t *location, guchar *value);
+
+
+/**
+ * Decodes the value kept with a hash in the index.
+ * @param value is a buffer of PACK_INDEX_VALUE_LEN bytes.
+ * @param[out] location is the location of the block.
+ */
+extern void decode_pack_location(guchar *value, pack_location_t *location);
+
+
+/**
+ * Encodes the header of the record of a block.
+ * @param hash_data is the block (hash, data, read, cmptype and uncmplen).
+ * @param[out] header is a buffer of PACK_RECORD_HEADER_LEN bytes.
+ */
+extern void encode_record_header(hash_data_t *hash_data, guchar *header);
+
+
+/**
+ * Decodes the header of a record.
+ * @param header is a buffer of PACK_RECORD_HEADER_LEN bytes.
+ * @param[out] hash is a buffer of HASH_LEN bytes for the hash of the
+ *             block.
+ * @param[out] crc is the crc32 of the data.
+ * @param[out] location gets the length, cmptype and uncmplen of the
+ *             block (segment and offset are left untouched).
+ * @returns TRUE if header begins with PACK_RECORD_MAGIC and FALSE
+ *          otherwise.
+ */
+extern gboolean decode_record_header(guchar *header, guint8 *hash, guint32 *crc, pack_location_t *location);
+
+
+/**
+ * Reads the checkpoint of the index (see write_pack_checkpoint()).
+ * @param pack_backend is the pack backend structure.
+ * @returns the sequence number of the first segment that is not known to
+ *          be in the index file (0 when there is no checkpoint: every
+ *          segment has to be checked).
+ */
+extern guint64 read_pack_checkpoint(pack_backend_t *pack_backend);
+
+
+#endif /* #ifndef _SERVER_PACK_BACKEND_H_ */
@@ -29,25 +29,35 @@
 
 #include "server.h"
 
-static void free_server_struct_t(server_struct_t *server_struct);
 static gboolean int_signal_handler(gpointer user_data);
-static server_struct_t *init_server_main_structure(int argc, char **argv);
 static gchar *get_data_from_a_specific_hash(server_struct_t *server_struct, gchar *hash);
 static gchar *get_argument_value_from_key(struct MHD_Connection *connection, gchar *key, gboolean encoded);
 static gboolean get_boolean_argument_value_from_key(struct MHD_Connection *connection, gchar *key);
 static gchar *get_a_list_of_files(server_struct_t *server_struct, struct MHD_Connection *connection);
 static gchar *get_data_from_a_list_of_hashs(server_struct_t *server_struct, struct MHD_Connection *connection);
+static guchar *get_frames_from_a_list_of_hashs(server_struct_t *server_struct, struct MHD_Connection *connection, gsize *length, gchar **error_answer);
 static json_t *fills_json_with_get_stats(json_t *get, req_get_t *get_stats);
 static json_t *fills_json_with_post_stats(json_t *post, req_post_t *post_stats);
 static gchar *get_json_answer(server_struct_t *server_struct, struct MHD_Connection *connection, const char *url);
 static gchar *get_unformatted_answer(server_struct_t *server_struct, const char *url);
+static guchar *get_binary_answer(server_struct_t *server_struct, struct MHD_Connection *connection, const char *url, gsize *length, gchar **error_answer);
 static int create_MHD_response(struct MHD_Connection *connection, gchar *answer, gchar *content_type);
+static int create_MHD_binary_response(struct MHD_Connection *connection, guchar *answer, gsize length);
+static upload_t *new_upload_t(struct MHD_Connection *connection, guint64 size, gboolean get);
+static void free_upload_t(upload_t *pp);
+static int create_MHD_upload_response(struct MHD_Connection *connection, upload_t *pp, const char *url);
+static void answer_get_request(server_struct_t *server_struct, upload_t *pp, const char *url);
 static int process_get_request(server_struct_t *server_struct, struct MHD_Connection *connection, const char *url, void **con_cls);
 static json_t *find_needed_hashs(server_struct_t *server_struct, GList *hash_data_list);
-static int answer_meta_json_post_request(server_struct_t *server_struct, struct MHD_Connection *connection, guchar *received_data, guint64 length);
-static int answer_hash_array_post_request(server_struct_t *server_struct, struct MHD_Connection *connection, guchar *received_data);
+static gchar *answer_meta_json_post_request(server_struct_t *server_struct, guchar *received_data, guint64 length);
+static gchar *answer_hash_array_post_request(server_struct_t *server_struct, guchar *received_data, gchar **content_type);
 static void print_received_data_for_hash(guint8 *hash, gssize read);
-static int process_received_data(server_struct_t *server_struct, struct MHD_Connection *connection, const char *url, guchar *received_data, guint64 length);
+static gchar *answer_data_post_request(server_struct_t *server_struct, guchar *received_data);
+static gchar *answer_data_array_post_request(server_struct_t *server_struct, guchar *received_data);
+static gchar *answer_data_array_bin_post_request(server_struct_t *server_struct, guchar *received_data, guint64 length);
+static gchar *process_received_data(server_struct_t *server_struct, const char *url, guchar *received_data, guint64 length, gchar **content_type);
+static void process_request_in_pool(gpointer data, gpointer user_data);
+static gboolean push_to_request_pool(server_struct_t *server_struct, upload_t *pp, const char *url);
 static guint64 get_header_content_length(struct MHD_Connection *connection, gchar *header, guint64 default_value);
 static int process_post_request(server_struct_t *server_struct, struct MHD_Connection *connection, const char *url, void **con_cls, const char *upload_data, size_t *upload_data_size);
 static int print_out_key(void *cls, enum MHD_ValueKind kind, const char *key, const char *value);
@@ -55,28 +65,67 @@ static void print_headers(struct MHD_Connection *connection);
 static int ahc(void *cls, struct MHD_Connection *connection, const char *url, const char *method, const char *version, const char *upload_data, size_t *upload_data_size, void **con_cls);
 static gpointer meta_data_thread(gpointer user_data);
 static gpointer data_thread(gpointer user_data);
-static void install_server_signal_traps(server_struct_t *server_struct);
+static void start_data_writers(server_struct_t *server_struct);
+static void push_to_data_writer(server_struct_t *server_struct, hash_data_t *hash_data);
+static void stop_storing_threads(server_struct_t *server_struct);
+static struct MHD_Daemon *start_MHD_daemon(server_struct_t *server_struct);
 
 
 /**
- * Frees server's structure
+ * Frees server's structure. libmicrohttpd stops accepting connections
+ * before the request workers are stopped and is stopped once they are
+ * done with the requests they had. The meta data and data threads store
+ * what they were given and end before the backend is terminated.
  * @param server_struct is the structure to be freed
  */
 void free_server_struct_t(server_struct_t *server_struct)
 {
+    GThreadPool *request_pool = NULL;
+    MHD_socket listen_socket = MHD_INVALID_SOCKET;
 
     if (server_struct != NULL)
         {
+            if (server_struct->d != NULL)
+                {
+                    /* No new connection: the ones already opened still call ahc() */
+                    listen_socket = MHD_quiesce_daemon(server_struct->d);
+                    print_debug(_("\tMHD daemon quiesced.\n"));
+                }
+
+            g_mutex_lock(&server_struct->request_mutex);
+            request_pool = server_struct->request_pool;
+            server_struct->request_pool = NULL;
+            g_mutex_unlock(&server_struct->request_mutex);
+
+            if (request_pool != NULL)
+                {
+                    /* Suspended connections are resumed by the requests still
+                     * in the pool. Requests that come next are processed by
+                     * libmicrohttpd's threads (request_pool is NULL). */
+                    g_thread_pool_free(request_pool, FALSE, TRUE);
+                    print_debug(_("\trequest workers stopped.\n"));
+                }
+
             MHD_stop_daemon(server_struct->d);
+
+            if (listen_socket != MHD_INVALID_SOCKET)
+                {
+                    close(listen_socket);
+                }
+
             print_debug(_("\tMHD daemon stopped.\n"));
-            free_variable(server_struct->backend); /** we need a backend function to be called to free the backend structure */
-            print_debug(_("\tbackend variable freed.\n"));
-            g_thread_unref(server_struct->data_thread);
-            print_debug(_("\tdata thread unreferenced.\n"));
-            g_thread_unref(server_struct->meta_thread);
-            print_debug(_("\tmeta thread unreferenced.\n"));
+            stop_storing_threads(server_struct);
+            print_debug(_("\tmeta and data threads stopped.\n"));
+
+            if (server_struct->backend != NULL && server_struct->backend->terminate_backend != NULL)
+                {
+                    server_struct->backend->terminate_backend(server_struct);
+                }
+            free_variable(server_struct->backend);
+            print_debug(_("\tbackend terminated.\n"));
             free_options_t(server_struct->opt);
             print_debug(_("\toption structure freed.\n"));
+            g_mutex_clear(&server_struct->request_mutex);
             free_variable(server_struct);
             print_debug(_("\tmain structure freed.\n"));
         }
@@ -113,7 +162,7 @@ static gboolean int_signal_handler(gpointer user_data)
  * @returns a server_struct_t * structure that contains everything that is
  *          needed for 'cdpfglserver' program.
  */
-static server_struct_t *init_server_main_structure(int argc, char **argv)
+server_struct_t *init_server_main_structure(int argc, char **argv)
 {
     server_struct_t *server_struct = NULL;  /** main structure for 'server' program. */
 
@@ -121,19 +170,33 @@ static server_struct_t *init_server_main_structure(int argc, char **argv)
     g_assert_nonnull(server_struct);
 
 
-    server_struct->data_thread = NULL;
+    server_struct->data_writers = NULL;
     server_struct->meta_thread = NULL;
     server_struct->opt = do_what_is_needed_from_command_line_options(argc, argv);
     server_struct->d = NULL;            /* libmicrohttpd daemon pointer */
     server_struct->meta_queue = g_async_queue_new();
-    server_struct->data_queue = g_async_queue_new();
+    server_struct->request_pool = NULL;
+    g_mutex_init(&server_struct->request_mutex);
     server_struct->loop = NULL;
 
     /* server statistics */
     server_struct->stats = new_stats_t();
 
-    /* default backend (file_backend) */
-    server_struct->backend = init_backend_structure(file_store_smeta, file_store_data, file_init_backend, file_build_needed_hash_list, file_get_list_of_files, file_retrieve_data);
+    if (g_strcmp0(server_struct->opt->backend, "pack") == 0)
+        {
+            /* pack_backend: blocks are appended to segment files */
+            server_struct->backend = init_backend_structure(pack_store_smeta, pack_store_data, pack_init_backend, pack_build_needed_hash_list, pack_get_list_of_files, pack_retrieve_data, pack_terminate_backend);
+        }
+    else
+        {
+            /* default backend (file_backend) */
+            if (g_strcmp0(server_struct->opt->backend, "file") != 0)
+                {
+                    print_error(__FILE__, __LINE__, _("Unknown backend %s: using file backend.\n"), server_struct->opt->backend);
+                }
+
+            server_struct->backend = init_backend_structure(file_store_smeta, file_store_data, file_init_backend, file_build_needed_hash_list, file_get_list_of_files, file_retrieve_data, file_terminate_backend);
+        }
 
     return server_struct;
 }
@@ -151,13 +214,28 @@ static gchar *get_data_from_a_specific_hash(server_struct_t *server_struct, gcha
     gchar *message = NULL;
     backend_t *backend = NULL;
     hash_data_t *hash_data = NULL;
+    guint8 *a_hash = NULL;
 
     g_assert_nonnull(server_struct);
     g_assert_nonnull(server_struct->backend);
 
     backend = server_struct->backend;
+    a_hash = string_to_hash(hash);
 
-    if (backend->retrieve_data != NULL)
+    if (is_zero_block_hash(a_hash) == TRUE && is_zero_block_length_valid(a_hash) == FALSE)
+        {
+            message = g_strdup_printf(_("Invalid hash %s: block of zeros longer than %d bytes"), hash, BLOCK_MAX_SIZE);
+            answer = answer_json_error_string(MHD_HTTP_BAD_REQUEST, message);
+            free_variable(message);
+        }
+    else if (is_zero_block_hash(a_hash) == TRUE)
+        {
+            /* Blocks of zeros are not stored */
+            hash_data = new_zero_block_hash_data_t(a_hash);
+            answer = convert_hash_data_t_to_string(hash_data);
+            free_hash_data_t(hash_data);
+        }
+    else if (backend->retrieve_data != NULL)
         {
             hash_data = backend->retrieve_data(server_struct, hash);
             answer = convert_hash_data_t_to_string(hash_data);
@@ -177,6 +255,8 @@ static gchar *get_data_from_a_specific_hash(server_struct_t *server_struct, gcha
             free_variable(message);
         }
 
+    free_variable(a_hash);
+
     return answer;
 }
 
@@ -334,6 +414,8 @@ static gchar *get_data_from_a_list_of_hashs(server_struct_t *server_struct, stru
     a_clock_t *a_clock = NULL;
     compress_t *compress = NULL;
     guint8 *a_hash = NULL;
+    gchar *message = NULL;
+    gboolean refused = FALSE;
 
 
     a_clock = new_clock_t();
@@ -343,12 +425,26 @@ static gchar *get_data_from_a_list_of_hashs(server_struct_t *server_struct, stru
 
     a_clock = new_clock_t();
     head = header_hdl;
-    while (header_hdl != NULL)
+    while (header_hdl != NULL && refused == FALSE)
         {
             header_hd = header_hdl->data;
-            hash = hash_to_string(header_hd->hash);
-            hash_data = backend->retrieve_data(server_struct, hash);
-            free_variable(hash);
+
+            if (is_zero_block_hash(header_hd->hash) == TRUE && is_zero_block_length_valid(header_hd->hash) == FALSE)
+                {
+                    refused = TRUE;
+                    hash_data = NULL;
+                }
+            else if (is_zero_block_hash(header_hd->hash) == TRUE)
+                {
+                    /* Blocks of zeros are not stored */
+                    hash_data = new_zero_block_hash_data_t(header_hd->hash);
+                }
+            else
+                {
+                    hash = hash_to_string(header_hd->hash);
+                    hash_data = backend->retrieve_data(server_struct, hash);
+                    free_variable(hash);
+                }
 
             if (hash_data != NULL)
                 {
@@ -386,14 +482,116 @@ static gchar *get_data_from_a_list_of_hashs(server_struct_t *server_struct, stru
     g_list_free_full(head, free_hdt_struct);
     end_clock(a_clock, "Read all files");
 
+    if (refused == TRUE)
+        {
+            message = g_strdup_printf(_("Invalid hash list: a block of zeros is longer than %d bytes"), BLOCK_MAX_SIZE);
+            answer = answer_json_error_string(MHD_HTTP_BAD_REQUEST, message);
+            free_variable(message);
+            free_variable(final_buffer);
+        }
+    else
+        {
+            a_clock = new_clock_t();
+
+            a_hash = calculate_hash_for_string(final_buffer, size);
+            hash_data = new_hash_data_t_as_is((guchar *) final_buffer, size, a_hash, COMPRESS_NONE_TYPE, size);
+            answer = convert_hash_data_t_to_string(hash_data);
+            free_hash_data_t(hash_data);
+
+            end_clock(a_clock, "Transformed into a JSON string");
+        }
+
+    return answer;
+}
+
+
+/**
+ * Gets the blocks of a list of hashs as binary frames (see framing.h).
+ * Unlike get_data_from_a_list_of_hashs() blocks are sent as they are
+ * stored (compressed or not) and are neither concatenated nor base64
+ * encoded: the client uncompresses them. Blocks of zeros are sent as
+ * frames without data.
+ * @param server_struct is the main structure for the server.
+ * @param connection is the connection in MHD
+ * @param[out] length is the length of the returned buffer.
+ * @param[out] error_answer is set to the json error (the same as the one
+ *             of get_data_from_a_list_of_hashs()) to be sent back to the
+ *             client when NULL is returned.
+ * @returns a newlly allocated guchar * framed body to be sent back to
+ *          the client or NULL when a block of zeros is longer than
+ *          BLOCK_MAX_SIZE.
+ */
+static guchar *get_frames_from_a_list_of_hashs(server_struct_t *server_struct, struct MHD_Connection *connection, gsize *length, gchar **error_answer)
+{
+    const char *header = NULL;
+    gchar *message = NULL;
+    gchar *hash = NULL;
+    guint8 *a_hash = NULL;
+    guchar *answer = NULL;
+    GList *head = NULL;
+    GList *header_hdl = NULL;
+    GList *frames = NULL;
+    hash_data_t *header_hd = NULL;
+    hash_data_t *hash_data = NULL;
+    backend_t *backend = server_struct->backend;
+    a_clock_t *a_clock = NULL;
+    gboolean refused = FALSE;
+
     a_clock = new_clock_t();
+    header = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, X_GET_HASH_ARRAY);
+    header_hdl = make_hash_data_list_from_string((gchar *)header);
+    head = header_hdl;
+
+    while (header_hdl != NULL && refused == FALSE)
+        {
+            header_hd = header_hdl->data;
+
+            if (is_zero_block_hash(header_hd->hash) == TRUE && is_zero_block_length_valid(header_hd->hash) == FALSE)
+                {
+                    /* The client would allocate that much memory */
+                    refused = TRUE;
+                    hash_data = NULL;
+                }
+            else if (is_zero_block_hash(header_hd->hash) == TRUE)
+                {
+                    /* Blocks of zeros are not stored: their frame has no data */
+                    a_hash = (guint8 *) g_malloc(HASH_LEN);
+                    g_assert_nonnull(a_hash);
+                    memcpy(a_hash, header_hd->hash, HASH_LEN);
+                    hash_data = new_hash_data_t_as_is(NULL, 0, a_hash, COMPRESS_NONE_TYPE, get_zero_block_hash_length(a_hash));
+                }
+            else
+                {
+                    hash = hash_to_string(header_hd->hash);
+                    hash_data = backend->retrieve_data(server_struct, hash);
+                    free_variable(hash);
+                }
+
+            if (hash_data != NULL)
+                {
+                    frames = g_list_prepend(frames, hash_data);
+                }
 
-    a_hash = calculate_hash_for_string(final_buffer, size);
-    hash_data = new_hash_data_t_as_is((guchar *) final_buffer, size, a_hash, COMPRESS_NONE_TYPE, size);
-    answer = convert_hash_data_t_to_string(hash_data);
-    free_hash_data_t(hash_data);
+            header_hdl = g_list_next(header_hdl);
+        }
 
-    end_clock(a_clock, "Transformed into a JSON string");
+    g_list_free_full(head, free_hdt_struct);
+
+    if (refused == FALSE)
+        {
+            frames = g_list_reverse(frames);
+            answer = convert_hash_data_list_to_frames(frames, length);
+        }
+    else
+        {
+            message = g_strdup_printf(_("Invalid hash list: a block of zeros is longer than %d bytes"), BLOCK_MAX_SIZE);
+            *error_answer = answer_json_error_string(MHD_HTTP_BAD_REQUEST, message);
+            free_variable(message);
+        }
+
+    g_list_free_full(frames, free_hdt_struct);
+
+    end_clock(a_clock, "Read all blocks into frames");
 
     return answer;
 }
@@ -606,6 +804,39 @@ static gchar *get_unformatted_answer(server_struct_t *server_struct, const char
 }
 
 
+/**
+ * Function to answer to get requests whose answer is made of binary
+ * frames (urls ending with .bin).
+ * @param server_struct is the main structure for the server.
+ * @param connection is the connection in MHD
+ * @param url is the requested url
+ * @param[out] length is the length of the returned buffer.
+ * @param[out] error_answer may be set to a json error to be sent back to
+ *             the client when NULL is returned.
+ * @returns a newlly allocated guchar * buffer that contains the anwser
+ *          to be sent back to the client or NULL if url is unknown or
+ *          the request is invalid.
+ */
+static guchar *get_binary_answer(server_struct_t *server_struct, struct MHD_Connection *connection, const char *url, gsize *length, gchar **error_answer)
+{
+    guchar *answer = NULL;
+
+    g_assert_nonnull(server_struct);
+
+    if (g_str_has_prefix(url, "/Data/Hash_Array.bin"))
+        {
+            add_one_to_get_url_data_hash_array(server_struct->stats);
+            answer = get_frames_from_a_list_of_hashs(server_struct, connection, length, error_answer);
+        }
+    else
+        {
+            add_one_to_get_url_unknown(server_struct->stats, FALSE);
+        }
+
+    return answer;
+}
+
+
 /**
  * Creates a response sent to the client via MHD_queue_response
  * @param connection is the MHD_Connection connection
@@ -637,7 +868,162 @@ static int create_MHD_response(struct MHD_Connection *connection, gchar *answer,
 
 
 /**
- * Function to process get requests received from clients.
+ * Creates a binary response (CT_BINARY) sent to the client via
+ * MHD_queue_response
+ * @param connection is the MHD_Connection connection
+ * @param answer is the buffer to be sent (MHD frees it).
+ * @param length is the number of bytes of answer.
+ */
+static int create_MHD_binary_response(struct MHD_Connection *connection, guchar *answer, gsize length)
+{
+    struct MHD_Response *response = NULL;
+    int success = MHD_NO;
+
+    response = MHD_create_response_from_buffer(length, (void *) answer, MHD_RESPMEM_MUST_FREE);
+    MHD_add_response_header(response, "Content-Type", CT_BINARY);
+    success = MHD_queue_response(connection, MHD_HTTP_OK, response);
+    MHD_destroy_response(response);
+
+    return success;
+}
+
+
+/**
+ * @param connection is the connection in MHD.
+ * @param size is the size of the buffer for the body of a POST request.
+ * @param get is TRUE for a GET request (no buffer) and FALSE for a POST
+ *        request.
+ * @returns a newly allocated upload_t structure for a request.
+ */
+static upload_t *new_upload_t(struct MHD_Connection *connection, guint64 size, gboolean get)
+{
+    upload_t *pp = NULL;
+
+    pp = (upload_t *) g_malloc(sizeof(upload_t));
+    g_assert_nonnull(pp);
+
+    pp->pos = 0;
+    pp->number = 0;
+    pp->connection = connection;
+    pp->get = get;
+    pp->url = NULL;
+    pp->answer = NULL;
+    pp->binary = NULL;
+    pp->binary_len = 0;
+    pp->content_type = NULL;
+    pp->done = FALSE;
+
+    if (get == TRUE)
+        {
+            pp->size = 0;
+            pp->buffer = NULL;
+        }
+    else
+        {
+            pp->size = size;
+            pp->buffer = g_malloc(sizeof(gchar) * (size + 1));  /* not using g_malloc0 here because it's 1000 times slower */
+        }
+
+    return pp;
+}
+
+
+/**
+ * Frees an upload_t structure but not its answer (MHD frees it once it
+ * has been sent).
+ * @param pp is the upload_t structure to be freed.
+ */
+static void free_upload_t(upload_t *pp)
+{
+    if (pp != NULL)
+        {
+            free_variable(pp->url);
+            free_variable(pp->buffer);
+            free_variable(pp);
+        }
+}
+
+
+/**
+ * Queues the answer of a request (binary or not) and frees the upload_t
+ * structure of that request. A request without any answer gets a json
+ * error (500).
+ * @param connection is the MHD_Connection connection
+ * @param pp is the upload_t structure of the request.
+ * @param url is the requested url.
+ * @returns an int that is either MHD_NO or MHD_YES upon failure or not.
+ */
+static int create_MHD_upload_response(struct MHD_Connection *connection, upload_t *pp, const char *url)
+{
+    int success = MHD_NO;
+    gchar *message = NULL;
+
+    if (pp->binary != NULL)
+        {
+            /* Do not free binary variable as MHD will do it for us ! */
+            success = create_MHD_binary_response(connection, pp->binary, pp->binary_len);
+        }
+    else
+        {
+            if (pp->answer == NULL)
+                {
+                    message = g_strdup_printf(_("Error: could not process %s request for url: %s\n"), pp->get == TRUE ? "GET" : "POST", url);
+                    pp->answer = answer_json_error_string(MHD_HTTP_INTERNAL_SERVER_ERROR, message);
+                    pp->content_type = CT_JSON;
+                    free_variable(message);
+                }
+
+            /* Do not free answer variable as MHD will do it for us ! */
+            success = create_MHD_response(connection, pp->answer, pp->content_type);
+        }
+
+    free_upload_t(pp);
+
+    return success;
+}
+
+
+/**
+ * Makes the answer of a GET request (it may read blocks from the
+ * backend).
+ * @param server_struct is the main structure for the server.
+ * @param pp is the upload_t structure of the GET request whose answer,
+ *        binary, binary_len and content_type are filled.
+ * @param url is the requested url
+ */
+static void answer_get_request(server_struct_t *server_struct, upload_t *pp, const char *url)
+{
+    if (g_str_has_suffix(url, ".json"))
+        { /* A json format answer was requested */
+            pp->answer = get_json_answer(server_struct, pp->connection, url);
+            pp->content_type = CT_JSON;
+        }
+    else if (g_str_has_suffix(url, ".bin"))
+        { /* A binary framed answer was requested (errors are in json) */
+            pp->binary = get_binary_answer(server_struct, pp->connection, url, &pp->binary_len, &pp->answer);
+
+            if (pp->binary != NULL)
+                {
+                    pp->content_type = CT_BINARY;
+                }
+            else
+                {
+                    pp->content_type = CT_JSON;
+                }
+        }
+    else
+        { /* An "unformatted" answer was requested */
+            pp->answer = get_unformatted_answer(server_struct, url);
+            pp->content_type = CT_PLAIN;
+        }
+}
+
+
+/**
+ * Function to process get requests received from clients. When
+ * libmicrohttpd uses epoll threads the answer is made by a request
+ * worker (reading blocks from the backend would block the connections
+ * polled by that thread) while the connection is suspended.
  * @param server_struct is the main structure for the server.
  * @param connection is the connection in MHD
  * @param url is the requested url
@@ -648,20 +1034,18 @@ static int process_get_request(server_struct_t *server_struct, struct MHD_Connec
 {
     static int aptr = 0;
     int success = MHD_NO;
-    gchar *answer = NULL;
-    gchar *content_type = NULL;
-    gchar * message = NULL;
+    upload_t *pp = NULL;
 
     g_assert_nonnull(server_struct);
 
-    if (&aptr != *con_cls)
+    if (*con_cls == NULL)
         {
             /* do never respond on first call */
             *con_cls = &aptr;
 
             success = MHD_YES;
         }
-    else
+    else if (*con_cls == &aptr)
         {
             add_one_get_request(server_struct->stats);
 
@@ -671,35 +1055,30 @@ static int process_get_request(server_struct_t *server_struct, struct MHD_Connec
                     print_headers(connection);
                 }
 
-            if (g_str_has_suffix(url, ".json"))
-                { /* A json format answer was requested */
-                    answer = get_json_answer(server_struct, connection, url);
-                    content_type = CT_JSON;
+            pp = new_upload_t(connection, 0, TRUE);
+            *con_cls = pp;
+
+            if (push_to_request_pool(server_struct, pp, url) == TRUE)
+                {
+                    success = MHD_YES;
                 }
             else
-                { /* An "unformatted" answer was requested */
-                    answer = get_unformatted_answer(server_struct, url);
-                    content_type = CT_PLAIN;
-                }
-
-            /* reset when done */
-            *con_cls = NULL;
-
-            if (answer == NULL)
                 {
-                    message = g_strdup_printf(_("Error: could not process GET request for url: %s\n"), url);
-                    answer = answer_json_error_string(MHD_HTTP_INTERNAL_SERVER_ERROR, message);
-                    free_variable(message);
+                    /* reset when done */
+                    *con_cls = NULL;
+                    answer_get_request(server_struct, pp, url);
+                    success = create_MHD_upload_response(connection, pp, url);
                 }
-
-            /* Do not free answer variable as MHD will do it for us ! */
-            success = create_MHD_response(connection, answer, content_type);
-
-
+        }
+    else
+        {
+            /* Called again once the request worker resumed the connection */
+            pp = (upload_t *) *con_cls;
+            *con_cls = NULL;
+            success = create_MHD_upload_response(connection, pp, url);
         }
 
     return success;
-
 }
 
 
@@ -715,6 +1094,8 @@ static json_t *find_needed_hashs(server_struct_t *server_struct, GList *hash_dat
 {
     json_t *array = NULL;   /** json_t *array is the array that will receive base64 encoded needed hashs */
     GList *needed = NULL;   /** GList that contains needed hashs as answered by the backend if any       */
+    GList *stored = NULL;   /** hash_data_list without blocks of zeros (elements are not copied)          */
+    GList *head = NULL;
 
     /**
      * Creating a json_t * array with the hashs that are needed. If
@@ -724,31 +1105,44 @@ static json_t *find_needed_hashs(server_struct_t *server_struct, GList *hash_dat
     g_assert_nonnull(server_struct);
     g_assert_nonnull(server_struct->backend);
 
+    /* Blocks of zeros are never stored so they are never needed */
+    for (head = hash_data_list; head != NULL; head = g_list_next(head))
+        {
+            if (is_zero_block_hash(((hash_data_t *) head->data)->hash) == FALSE)
+                {
+                    stored = g_list_prepend(stored, head->data);
+                }
+        }
+
+    stored = g_list_reverse(stored);
+
     if (server_struct->backend->build_needed_hash_list != NULL)
         {
-            needed = server_struct->backend->build_needed_hash_list(server_struct, hash_data_list);
+            needed = server_struct->backend->build_needed_hash_list(server_struct, stored);
             array = convert_hash_list_to_json(needed);
             g_list_free_full(needed, free_hdt_struct);
         }
     else
         {
-            array = convert_hash_list_to_json(hash_data_list);
+            array = convert_hash_list_to_json(stored);
         }
 
+    g_list_free(stored);
+
     return array;
 }
 
 
 /**
- * Answers /Meta.json POST request by storing data and answering to the
- * client.
+ * Answers /Meta.json POST request by storing data and making the answer
+ * to the client.
  * @param server_struct is the main structure for the server.
- * @param connection is the connection in MHD
  * @param received_data is a guchar * string to the data that was received
  *        by the POST request.
  * @param length is the total length of POST request in bytes
+ * @returns the JSON (CT_JSON) answer to be sent to the client.
  */
-static int answer_meta_json_post_request(server_struct_t *server_struct, struct MHD_Connection *connection, guchar *received_data, guint64 length)
+static gchar *answer_meta_json_post_request(server_struct_t *server_struct, guchar *received_data, guint64 length)
 {
     server_meta_data_t *smeta = NULL; /** server_meta_data_t *smeta stores meta data along with hostname of the client */
     gchar *answer = NULL;             /** gchar *answer : Do not free answer variable as MHD will do it for us !       */
@@ -791,7 +1185,7 @@ static int answer_meta_json_post_request(server_struct_t *server_struct, struct
             answer = answer_json_error_string(MHD_HTTP_INTERNAL_SERVER_ERROR, _("Error: could not convert json to metadata\n"));
         }
 
-    return create_MHD_response(connection, answer, CT_JSON);
+    return answer;
 }
 
 
@@ -799,21 +1193,21 @@ static int answer_meta_json_post_request(server_struct_t *server_struct, struct
  * Answers /Hash_Array.json POST request by answering to the client needed
  * hashs
  * @param server_struct is the main structure for the server.
- * @param connection is the connection in MHD
  * @param received_data is a guchar * string to the data that was received
  *        by the POST request.
+ * @param[out] content_type is the content type of the returned answer.
+ * @returns the answer to be sent to the client.
  */
-static int answer_hash_array_post_request(server_struct_t *server_struct, struct MHD_Connection *connection, guchar *received_data)
+static gchar *answer_hash_array_post_request(server_struct_t *server_struct, guchar *received_data, gchar **content_type)
 {
     gchar *answer = NULL;         /** gchar *answer : Do not free answer variable as MHD will do it for us !  */
     json_t *root = NULL;          /** json_t *root is the root that will contain all meta data json formatted */
     json_t *array = NULL;         /** json_t *array is the array that will receive base64 encoded hashs       */
     GList *hash_data_list = NULL;
-    gchar *content_type = NULL;
 
     g_assert_nonnull(server_struct);
 
-    if (connection != NULL && received_data != NULL)
+    if (received_data != NULL)
         {
 
             root = load_json((gchar *)received_data);
@@ -830,18 +1224,18 @@ static int answer_hash_array_post_request(server_struct_t *server_struct, struct
             answer = json_dumps(root, 0);
             json_decref(root);
             g_list_free_full(hash_data_list, free_hdt_struct);
-            content_type = CT_JSON;
+            *content_type = CT_JSON;
         }
     else
         {
             answer = answer_json_error_string(MHD_HTTP_INTERNAL_SERVER_ERROR, _("Error: could not convert json to metadata\n"));
-            content_type = CT_PLAIN;
+            *content_type = CT_PLAIN;
         }
 
     /* Here we will try to answer which hashs are needed and then
      * send thoses hashs back in the answer
      */
-    return create_MHD_response(connection, answer, content_type);
+    return answer;
 }
 
 
@@ -872,15 +1266,14 @@ static void print_received_data_for_hash(guint8 *hash, gssize size_read)
 /**
  * Answers /Data.json POST request by answering to the client 'Ok'.
  * @param server_struct is the main structure for the server.
- * @param connection is the connection in MHD
  * @param received_data is a guchar * string to the data that was received
  *        by the POST request.
+ * @returns the answer (CT_PLAIN) to be sent to the client.
  */
-static int answer_data_post_request(server_struct_t *server_struct, struct MHD_Connection *connection, guchar *received_data)
+static gchar *answer_data_post_request(server_struct_t *server_struct, guchar *received_data)
 {
     gchar *answer = NULL;                   /** gchar *answer : Do not free answer variable as MHD will do it for us ! */
     hash_data_t *hash_data = NULL;
-    int success = MHD_NO;
 
     hash_data = convert_string_to_hash_data((gchar *)received_data);
     add_hash_size_to_dedup_bytes(server_struct->stats, hash_data);
@@ -895,29 +1288,27 @@ static int answer_data_post_request(server_struct_t *server_struct, struct MHD_C
      * the corresponding thread. hash_data is freed by data_thread
      * and should not be used after this "call" here.
      */
-    g_async_queue_push(server_struct->data_queue, hash_data);
+    push_to_data_writer(server_struct, hash_data);
 
     /**
      * creating an answer for the client to say that everything went Ok!
      */
     answer = answer_json_success_string(MHD_HTTP_OK, _("Ok!"));
-    success = create_MHD_response(connection, answer, CT_PLAIN);
 
-    return success;
+    return answer;
 }
 
 /**
  * Answers /Data_Array.json POST request by answering to the client 'Ok'.
  * @param server_struct is the main structure for the server.
- * @param connection is the connection in MHD
  * @param received_data is a guchar * string to the data that was received
  *        by the POST request.
+ * @returns the answer (CT_PLAIN) to be sent to the client.
  */
-static int answer_data_array_post_request(server_struct_t *server_struct, struct MHD_Connection *connection, guchar *received_data)
+static gchar *answer_data_array_post_request(server_struct_t *server_struct, guchar *received_data)
 {
     gchar *answer = NULL;                   /** gchar *answer : Do not free answer variable as MHD will do it for us ! */
     hash_data_t *hash_data = NULL;
-    int success = MHD_NO;
     a_clock_t *elapsed = NULL;
     json_t *root = NULL;
     GList *hash_data_list = NULL;
@@ -943,8 +1334,8 @@ static int answer_data_array_post_request(server_struct_t *server_struct, struct
                     print_received_data_for_hash(hash_data->hash, hash_data->read);
                 }
 
-            /** Sending hash_data into the queue. */
-            g_async_queue_push(server_struct->data_queue, hash_data);
+            /** Sending hash_data into the queue of its writer. */
+            push_to_data_writer(server_struct, hash_data);
             hash_data_list = g_list_next(hash_data_list);
         }
 
@@ -955,52 +1346,111 @@ static int answer_data_array_post_request(server_struct_t *server_struct, struct
      */
 
     answer = answer_json_success_string(MHD_HTTP_OK, _("Ok!"));
-    success = create_MHD_response(connection, answer, CT_PLAIN);
 
-    return success;
+    return answer;
+
+}
+
+
+/**
+ * Answers /Data_Array.bin POST request by answering to the client 'Ok'.
+ * Blocks are read from binary frames (see framing.h) and are pushed as
+ * is into the data queue: nothing has to be base64 decoded nor parsed.
+ * @param server_struct is the main structure for the server.
+ * @param received_data is the framed body received by the POST request.
+ * @param length is received_data length (in bytes)
+ * @returns the answer (CT_PLAIN) to be sent to the client.
+ */
+static gchar *answer_data_array_bin_post_request(server_struct_t *server_struct, guchar *received_data, guint64 length)
+{
+    gchar *answer = NULL;                   /** gchar *answer : Do not free answer variable as MHD will do it for us ! */
+    hash_data_t *hash_data = NULL;
+    GList *hash_data_list = NULL;
+    GList *head = NULL;
+    gboolean debug = FALSE;
+
+    hash_data_list = convert_frames_to_hash_data_list(received_data, length);
+    head = hash_data_list;
+    debug = get_debug_mode();
+
+    while (hash_data_list != NULL)
+        {
+            hash_data = hash_data_list->data;
+            add_hash_size_to_dedup_bytes(server_struct->stats, hash_data);
+
+            if (debug == TRUE)
+                {
+                    /* Only for debugging ! */
+                    print_received_data_for_hash(hash_data->hash, hash_data->read);
+                }
+
+            /** Sending hash_data into the queue of its writer. */
+            push_to_data_writer(server_struct, hash_data);
+            hash_data_list = g_list_next(hash_data_list);
+        }
+
+    if (head != NULL || length == FRAMES_PREAMBLE_LEN)
+        {
+            answer = answer_json_success_string(MHD_HTTP_OK, _("Ok!"));
+        }
+    else
+        {
+            answer = answer_json_error_string(MHD_HTTP_BAD_REQUEST, _("Invalid framed body!\n"));
+        }
 
+    g_list_free(head);
+
+    return answer;
 }
 
 
 /**
  * Function that process the received data from the POST command and
- * answers to the client.
+ * makes the answer to the client.
  * Here we may do something with this data (we may want to store it
- * somewhere).
+ * somewhere). It may be called by a request worker (see
+ * process_request_in_pool) and therefore must not use the connection.
  *
  * @param server_struct is the main structure for the server.
- * @param connection is the connection in MHD
  * @param url is the requested url
  * @param received_data is a guchar * string to the data that was received
  *        by the POST request.
  * @param length is received_data length (in bytes)
+ * @param[out] content_type is the content type of the returned answer.
+ * @returns the answer to be sent to the client.
  */
-static int process_received_data(server_struct_t *server_struct, struct MHD_Connection *connection, const char *url, guchar *received_data, guint64 length)
+static gchar *process_received_data(server_struct_t *server_struct, const char *url, guchar *received_data, guint64 length, gchar **content_type)
 {
     gchar *answer = NULL;                   /** gchar *answer : Do not free answer variable as MHD will do it for us ! */
-    int success = MHD_NO;
 
     add_one_post_request(server_struct->stats);
+    *content_type = CT_PLAIN;
 
     if (g_str_has_prefix(url, "/Meta.json") && received_data != NULL)
         {
             add_length_and_one_to_post_url_meta(server_struct->stats, length);
-            success = answer_meta_json_post_request(server_struct, connection, received_data, length);
+            answer = answer_meta_json_post_request(server_struct, received_data, length);
+            *content_type = CT_JSON;
         }
     else if (g_str_has_prefix(url, "/Hash_Array.json") && received_data != NULL)
         {
             add_one_to_post_url_hash_array(server_struct->stats);
-            success = answer_hash_array_post_request(server_struct, connection, received_data);
+            answer = answer_hash_array_post_request(server_struct, received_data, content_type);
         }
     else if (g_str_has_prefix(url, "/Data.json") && received_data != NULL)
         {
             add_one_to_post_url_data(server_struct->stats);
-            success = answer_data_post_request(server_struct, connection, received_data);
+            answer = answer_data_post_request(server_struct, received_data);
         }
     else if (g_str_has_prefix(url, "/Data_Array.json") && received_data != NULL)
         {
             add_one_to_post_url_data_array(server_struct->stats);
-            success = answer_data_array_post_request(server_struct, connection, received_data);
+            answer = answer_data_array_post_request(server_struct, received_data);
+        }
+    else if (g_str_has_prefix(url, "/Data_Array.bin") && received_data != NULL)
+        {
+            add_one_to_post_url_data_array(server_struct->stats);
+            answer = answer_data_array_bin_post_request(server_struct, received_data, length);
         }
     else
         {
@@ -1008,11 +1458,80 @@ static int process_received_data(server_struct_t *server_struct, struct MHD_Conn
             add_one_to_post_url_unknown(server_struct->stats);
             print_error(__FILE__, __LINE__, "Error: invalid url: %s\n", url);
             answer = answer_json_error_string(MHD_HTTP_BAD_REQUEST, _("Invalid url!\n"));
-            success = create_MHD_response(connection, answer, CT_PLAIN);
         }
 
 
-    return success;
+    return answer;
+}
+
+
+/**
+ * Processes the body of a POST request in a request worker. The
+ * connection has been suspended by process_post_request: it is resumed
+ * once the answer is made and libmicrohttpd calls the access handler
+ * again to send it.
+ * @param data is the upload_t * of the request.
+ * @param user_data is the server_struct_t * main structure for the
+ *        server.
+ */
+static void process_request_in_pool(gpointer data, gpointer user_data)
+{
+    upload_t *pp = (upload_t *) data;
+    server_struct_t *server_struct = (server_struct_t *) user_data;
+
+    g_assert_nonnull(pp);
+    g_assert_nonnull(server_struct);
+
+    if (pp->get == TRUE)
+        {
+            answer_get_request(server_struct, pp, pp->url);
+        }
+    else
+        {
+            pp->answer = process_received_data(server_struct, pp->url, pp->buffer, pp->pos, &pp->content_type);
+        }
+
+    /* Never pushed again even without any answer (see create_MHD_upload_response()) */
+    pp->done = TRUE;
+    MHD_resume_connection(pp->connection);
+}
+
+
+/**
+ * Hands a GET request or the body of a POST request over to the request
+ * workers. The connection is suspended until a worker resumes it with
+ * the answer. request_mutex is held so that the pool is not freed
+ * meanwhile (see free_server_struct_t()).
+ * @param server_struct is the main structure for the server.
+ * @param pp is the upload_t structure of the request (whose body has
+ *        been entirely received for a POST request).
+ * @param url is the requested url.
+ * @returns TRUE if a request worker will process the request and FALSE
+ *          when there is no request worker (the request has then to be
+ *          processed by the caller).
+ */
+static gboolean push_to_request_pool(server_struct_t *server_struct, upload_t *pp, const char *url)
+{
+    gboolean pushed = FALSE;
+
+    g_mutex_lock(&server_struct->request_mutex);
+
+    if (server_struct->request_pool != NULL)
+        {
+            if (pp->buffer != NULL)
+                {
+                    pp->buffer[pp->pos] = '\0';
+                }
+
+            pp->url = g_strdup(url);
+            MHD_suspend_connection(pp->connection);
+            g_thread_pool_push(server_struct->request_pool, pp, NULL);
+            pushed = TRUE;
+        }
+
+    g_mutex_unlock(&server_struct->request_mutex);
+
+    return pushed;
 }
 
 
@@ -1049,7 +1568,10 @@ static guint64 get_header_content_length(struct MHD_Connection *connection, gcha
 
 
 /**
- * Function to process post requests.
+ * Function to process post requests. When libmicrohttpd uses epoll
+ * threads the body is processed by a request worker while the
+ * connection is suspended so that JSON parsing and backend work never
+ * block the threads that poll connections.
  * @param server_struct is the main structure for the server.
  * @param connection is the connection in MHD
  * @param url is the requested url
@@ -1072,16 +1594,20 @@ static int process_post_request(server_struct_t *server_struct, struct MHD_Conne
             /* print_headers(connection); */ /* Used for debugging */
             /* Initializing the structure at first connection       */
             len = get_header_content_length(connection, "Content-Length", DEFAULT_SERVER_BUFFER_SIZE);
-            pp = (upload_t *) g_malloc(sizeof(upload_t));
-            pp->pos = 0;
-            pp->buffer = g_malloc(sizeof(gchar) * (len + 1));  /* not using g_malloc0 here because it's 1000 times slower */
-            pp->number = 0;
+            pp = new_upload_t(connection, len, FALSE);
             *con_cls = pp;
 
             success = MHD_YES;
         }
     else if (*upload_data_size != 0)
         {
+            if (pp->pos + *upload_data_size > pp->size)
+                {
+                    /* Chunked bodies have no length: the buffer doubles when it is full */
+                    pp->size = MAX(pp->size * 2, pp->pos + *upload_data_size);
+                    pp->buffer = g_realloc(pp->buffer, sizeof(gchar) * (pp->size + 1));
+                }
+
             /* Getting data whatever they are */
             memcpy(pp->buffer + pp->pos, upload_data, *upload_data_size);
             pp->pos = pp->pos + *upload_data_size;
@@ -1093,24 +1619,35 @@ static int process_post_request(server_struct_t *server_struct, struct MHD_Conne
 
             success = MHD_YES;
         }
-    else
+    else if (pp->done == TRUE)
         {
-            /* reset when done */
+            /* Called again once the request worker resumed the connection */
             *con_cls = NULL;
-            pp->buffer[pp->pos] = '\0';
-
+            success = create_MHD_upload_response(connection, pp, url);
+        }
+    else
+        {
             if (get_debug_mode() == TRUE)
                 {
                     print_debug(_("Requested POST url: %s (%ld bytes)\n"), url, pp->pos);
                     print_headers(connection);
                 }
 
+            /* The whole body is here: a request worker processes it */
+            if (push_to_request_pool(server_struct, pp, url) == TRUE)
+                {
+                    success = MHD_YES;
+                }
+            else
+                {
+                    /* reset when done */
+                    *con_cls = NULL;
+                    pp->buffer[pp->pos] = '\0';
 
-            /* Do something with received_data */
-            success = process_received_data(server_struct, connection, url, pp->buffer, pp->pos);
-
-            free_variable(pp->buffer);
-            free_variable(pp);
+                    /* Do something with received_data */
+                    pp->answer = process_received_data(server_struct, url, pp->buffer, pp->pos, &pp->content_type);
+                    success = create_MHD_upload_response(connection, pp, url);
+                }
         }
 
     return success;
@@ -1194,10 +1731,11 @@ static gpointer meta_data_thread(gpointer user_data)
             if (server_struct->backend->store_smeta != NULL)
                 {
 
-                    while (TRUE)
-                        {
-                            smeta = g_async_queue_pop(server_struct->meta_queue);
+                    smeta = g_async_queue_pop(server_struct->meta_queue);
 
+                    /* stop_storing_threads() pushes server_struct itself to end this thread */
+                    while (smeta != (gpointer) server_struct)
+                        {
                             if (smeta != NULL && smeta->meta != NULL)
                                 {
                                     print_debug(_("meta_data_thread: received from %s meta for file %s\n"), smeta->hostname, smeta->meta->name);
@@ -1208,6 +1746,8 @@ static gpointer meta_data_thread(gpointer user_data)
                                 {
                                     print_error(__FILE__, __LINE__, _("Error: received a NULL pointer.\n"));
                                 }
+
+                            smeta = g_async_queue_pop(server_struct->meta_queue);
                         }
                 }
             else
@@ -1225,32 +1765,40 @@ static gpointer meta_data_thread(gpointer user_data)
 
 
 /**
- * Thread whose aim is to store data according to the selected backend
- * @param data : server_struct_t * structure.
+ * Thread whose aim is to store data according to the selected backend.
+ * Each data writer runs one such thread on its own queue.
+ * @param data : data_writer_t * structure.
  * @returns NULL to fullfill the template needed to create a GThread
  */
 static gpointer data_thread(gpointer user_data)
 {
-    server_struct_t *dt_server_struct = user_data;
+    data_writer_t *writer = (data_writer_t *) user_data;
+    server_struct_t *dt_server_struct = NULL;
     hash_data_t *hash_data = NULL;
 
-    g_assert_nonnull(dt_server_struct);
-    g_assert_nonnull(dt_server_struct->backend);
+    g_assert_nonnull(writer);
+    g_assert_nonnull(writer->server_struct);
+    g_assert_nonnull(writer->server_struct->backend);
 
-    if (dt_server_struct->meta_queue != NULL)
+    dt_server_struct = writer->server_struct;
+
+    if (writer->queue != NULL)
         {
 
             if (dt_server_struct->backend->store_data != NULL)
                 {
 
-                    while (TRUE)
-                        {
-                            hash_data = g_async_queue_pop(dt_server_struct->data_queue);
+                    hash_data = g_async_queue_pop(writer->queue);
 
+                    /* stop_storing_threads() pushes the writer itself to end this thread */
+                    while (hash_data != (gpointer) writer)
+                        {
                             if (hash_data != NULL)
                                 {
                                     dt_server_struct->backend->store_data(dt_server_struct, hash_data);
                                 }
+
+                            hash_data = g_async_queue_pop(writer->queue);
                         }
                 }
             else
@@ -1268,13 +1816,114 @@ static gpointer data_thread(gpointer user_data)
 }
 
 
+/**
+ * Starts opt->data_writers data writers, each one with its own queue
+ * and thread.
+ * @param server_struct is the main structure for the server.
+ */
+static void start_data_writers(server_struct_t *server_struct)
+{
+    data_writer_t *writer = NULL;
+    gint i = 0;
+
+    g_assert_nonnull(server_struct);
+    g_assert_nonnull(server_struct->opt);
+
+    server_struct->data_writers = g_ptr_array_sized_new(server_struct->opt->data_writers);
+
+    for (i = 0; i < server_struct->opt->data_writers; i++)
+        {
+            writer = (data_writer_t *) g_malloc0(sizeof(data_writer_t));
+            g_assert_nonnull(writer);
+
+            writer->server_struct = server_struct;
+            writer->queue = g_async_queue_new();
+            g_ptr_array_add(server_struct->data_writers, writer);
+        }
+
+    /* Every queue exists before any block may be pushed */
+    for (i = 0; i < server_struct->opt->data_writers; i++)
+        {
+            writer = g_ptr_array_index(server_struct->data_writers, i);
+            writer->thread = g_thread_new("data", data_thread, writer);
+        }
+
+    print_debug(_("%d data writer(s) started\n"), server_struct->opt->data_writers);
+}
+
+
+/**
+ * Gives a block to the data writer of its hash: the first two bytes of
+ * the hash choose the writer so that two copies of a block are never
+ * stored at the same time by two writers.
+ * @param server_struct is the main structure for the server.
+ * @param hash_data is the block to be stored. It is freed by the writer.
+ */
+static void push_to_data_writer(server_struct_t *server_struct, hash_data_t *hash_data)
+{
+    data_writer_t *writer = NULL;
+    guint shard = 0;
+
+    g_assert_nonnull(server_struct);
+    g_assert_nonnull(server_struct->data_writers);
+
+    if (hash_data != NULL && hash_data->hash != NULL)
+        {
+            shard = ((guint) hash_data->hash[0] << 8) | (guint) hash_data->hash[1];
+        }
+
+    writer = g_ptr_array_index(server_struct->data_writers, shard % server_struct->data_writers->len);
+    g_async_queue_push(writer->queue, hash_data);
+}
+
+
+/**
+ * Ends the meta data thread and the data writers once they have stored
+ * everything that is in their queues and frees the data writers. Nothing
+ * must be pushed into those queues anymore (libmicrohttpd is stopped).
+ * @param server_struct is the main structure for the server.
+ */
+static void stop_storing_threads(server_struct_t *server_struct)
+{
+    data_writer_t *writer = NULL;
+    guint i = 0;
+
+    if (server_struct->meta_thread != NULL)
+        {
+            g_async_queue_push(server_struct->meta_queue, server_struct);
+            g_thread_join(server_struct->meta_thread);
+            server_struct->meta_thread = NULL;
+        }
+
+    for (i = 0; server_struct->data_writers != NULL && i < server_struct->data_writers->len; i++)
+        {
+            writer = g_ptr_array_index(server_struct->data_writers, i);
+            g_async_queue_push(writer->queue, writer);
+        }
+
+    for (i = 0; server_struct->data_writers != NULL && i < server_struct->data_writers->len; i++)
+        {
+            writer = g_ptr_array_index(server_struct->data_writers, i);
+            g_thread_join(writer->thread);
+            g_async_queue_unref(writer->queue);
+            free_variable(writer);
+        }
+
+    if (server_struct->data_writers != NULL)
+        {
+            g_ptr_array_free(server_struct->data_writers, TRUE);
+            server_struct->data_writers = NULL;
+        }
+}
+
+
 /**
  * Installs signals traps in order to be able to close the program as
  * as cleanly as we can.
  * @param main_struct is the main structure of the program it must not
  *        be NULL;
  */
-static void install_server_signal_traps(server_struct_t *server_struct)
+void install_server_signal_traps(server_struct_t *server_struct)
 {
     guint id_int = 0;
     guint id_term = 0;
@@ -1295,65 +1944,84 @@ static void install_server_signal_traps(server_struct_t *server_struct)
 
 
 /**
- * Main function
- * @param argc : number of arguments given on the command line.
- * @param argv : an array of strings that contains command line arguments.
- * @returns always 0
+ * Starts the libmicrohttpd daemon. With opt->http_threads set to 0 it
+ * starts one thread per connection. Otherwise opt->http_threads threads
+ * poll connections (with epoll when libmicrohttpd supports it) and
+ * requests are processed by opt->request_workers threads.
+ * @param server_struct is the main structure for the server.
+ * @returns the started daemon or NULL on error.
  */
-int main(int argc, char **argv)
+static struct MHD_Daemon *start_MHD_daemon(server_struct_t *server_struct)
 {
-    server_struct_t *server_struct = NULL;  /** main structure for 'server' program.           */
-
-
-    #if !GLIB_CHECK_VERSION(2, 36, 0)
-        g_type_init();  /** g_type_init() is deprecated since glib 2.36 */
-    #endif
-
-    ignore_sigpipe(); /** into order to get libmicrohttpd portable */
+    options_t *opt = NULL;
+    struct MHD_Daemon *d = NULL;
+    unsigned int flags = 0;
+    GError *error = NULL;
 
-    init_international_languages();
+    g_assert_nonnull(server_struct);
+    g_assert_nonnull(server_struct->opt);
 
-    server_struct = init_server_main_structure(argc, argv);
+    opt = server_struct->opt;
 
-    if (server_struct != NULL && server_struct->opt != NULL && server_struct->backend != NULL)
+    if (opt->http_threads > 0)
         {
-            server_struct->loop = g_main_loop_new(g_main_context_default(), FALSE);
-
-            install_server_signal_traps(server_struct);
+            server_struct->request_pool = g_thread_pool_new(process_request_in_pool, server_struct, opt->request_workers, FALSE, &error);
 
-            /* Initializing the choosen backend by calling it's function */
-            if (server_struct->backend->init_backend != NULL)
+            if (error != NULL)
                 {
-                   server_struct->backend->init_backend(server_struct);
+                    print_error(__FILE__, __LINE__, _("Unable to start request workers: %s\n"), error->message);
+                    free_error(error);
+                    return NULL;
                 }
 
-            /* Before starting anything else, start the threads */
-            server_struct->meta_thread = g_thread_new("meta-data", meta_data_thread, server_struct);
-            server_struct->data_thread = g_thread_new("data", data_thread, server_struct);
-
-            /* Starting the libmicrohttpd daemon */
-            server_struct->d = MHD_start_daemon(MHD_USE_THREAD_PER_CONNECTION | MHD_USE_DEBUG, server_struct->opt->port, NULL, NULL, &ahc, server_struct, MHD_OPTION_CONNECTION_MEMORY_LIMIT, (size_t) 131070 , MHD_OPTION_CONNECTION_TIMEOUT, (unsigned int) 120, MHD_OPTION_END);
-
-            if (server_struct->d == NULL)
+            if (MHD_is_feature_supported(MHD_FEATURE_EPOLL) == MHD_YES)
+                {
+                    flags = MHD_USE_SELECT_INTERNALLY | MHD_USE_EPOLL_LINUX_ONLY;
+                }
+            else
                 {
-                    print_error(__FILE__, __LINE__, _("Error while spawning libmicrohttpd daemon\n"));
-                    return 1;
+                    flags = MHD_USE_POLL_INTERNALLY;
                 }
-            else {
-                    print_debug(_("Now listening on port %d\n"), server_struct->opt->port);
-                 }
 
-            /**
-             * main program stops here (until we exit main loop)
-             * somewhere else in the program.
-             */
-            g_main_loop_run(server_struct->loop);
+            print_debug(_("%d HTTP threads and %d request workers\n"), opt->http_threads, opt->request_workers);
 
+            d = MHD_start_daemon(flags | MHD_USE_SUSPEND_RESUME | MHD_USE_PIPE_FOR_SHUTDOWN | MHD_USE_DEBUG, opt->port, NULL, NULL, &ahc, server_struct, MHD_OPTION_THREAD_POOL_SIZE, (unsigned int) opt->http_threads, MHD_OPTION_CONNECTION_MEMORY_LIMIT, (size_t) opt->connection_memory_limit, MHD_OPTION_CONNECTION_TIMEOUT, (unsigned int) opt->connection_timeout, MHD_OPTION_END);
         }
     else
         {
-            print_error(__FILE__, __LINE__, _("Error: initialization failed.\n"));
+            d = MHD_start_daemon(MHD_USE_THREAD_PER_CONNECTION | MHD_USE_PIPE_FOR_SHUTDOWN | MHD_USE_DEBUG, opt->port, NULL, NULL, &ahc, server_struct, MHD_OPTION_CONNECTION_MEMORY_LIMIT, (size_t) opt->connection_memory_limit, MHD_OPTION_CONNECTION_TIMEOUT, (unsigned int) opt->connection_timeout, MHD_OPTION_END);
         }
 
-    return 0;
+    return d;
+}
+
+
+/**
+ * Starts the threads that store meta data and data and then the
+ * libmicrohttpd daemon that answers requests.
+ * @param server_struct is the main structure for the server whose
+ *        backend has been initialized.
+ * @returns TRUE if the server answers requests and FALSE on error.
+ */
+gboolean start_server(server_struct_t *server_struct)
+{
+    g_assert_nonnull(server_struct);
+
+    /* Before starting anything else, start the threads */
+    server_struct->meta_thread = g_thread_new("meta-data", meta_data_thread, server_struct);
+    start_data_writers(server_struct);
+
+    /* Starting the libmicrohttpd daemon */
+    server_struct->d = start_MHD_daemon(server_struct);
+
+    if (server_struct->d == NULL)
+        {
+            print_error(__FILE__, __LINE__, _("Error while spawning libmicrohttpd daemon\n"));
+            return FALSE;
+        }
+    else
+        {
+            print_debug(_("Now listening on port %d\n"), server_struct->opt->port);
+            return TRUE;
+        }
 }
@@ -47,6 +47,7 @@
 #include <glib/gi18n-lib.h>
 #include <glib-unix.h>
 #include <sys/inotify.h>
+#include <sys/mman.h>
 #include <errno.h>
 #include <math.h>
 
@@ -83,10 +84,45 @@
 /**
  * @def DEFAULT_SERVER_BUFFER_SIZE
  * Defines default server buffer size used in MHD callbacks to reassemble
- * POST data. Default is 8MB.
+ * POST data when the request has no Content-Length header (chunked
+ * transfer encoding). The buffer grows if needed. Default is 8MB.
  */
 #define DEFAULT_SERVER_BUFFER_SIZE (8388608)
 
+
+/**
+ * @def SERVER_DEFAULT_HTTP_THREADS
+ * Default number of libmicrohttpd threads polling connections with
+ * epoll. 0 means that libmicrohttpd starts one thread per connection.
+ *
+ * @def SERVER_DEFAULT_CONNECTION_MEMORY_LIMIT
+ * Default number of bytes that libmicrohttpd may use for each connection
+ * (headers and buffers).
+ *
+ * @def SERVER_DEFAULT_CONNECTION_TIMEOUT
+ * Default number of seconds after which an inactive connection is closed.
+ */
+#define SERVER_DEFAULT_HTTP_THREADS (0)
+#define SERVER_DEFAULT_CONNECTION_MEMORY_LIMIT (131070)
+#define SERVER_DEFAULT_CONNECTION_TIMEOUT (120)
+
+
+/**
+ * @def SERVER_DATA_WRITERS_MAX
+ * Maximum number of data writers (blocks are sharded with the first two
+ * bytes of their hash).
+ */
+#define SERVER_DATA_WRITERS_MAX (256)
+
+
+/**
+ * @def SERVER_DEFAULT_BACKEND
+ * Name of the backend used when none is configured: "file" stores each
+ * block in its own file and "pack" appends blocks to segment files.
+ */
+#define SERVER_DEFAULT_BACKEND ("file")
+
+
 /**
  * @struct server_struct_t
  * @brief Structure that contains everything needed by the program.
@@ -101,29 +137,99 @@ typedef struct
     backend_t *backend;
     GAsyncQueue *meta_queue;  /**< An asynchronous queue where smeta data will
                                *   be transmitted as it arrives                    */
-    GAsyncQueue *data_queue;  /**< An asynchronous queue where data will be
-                               *   transmitted as it arrives                       */
-    GThread *data_thread;     /**< Thread that will take care of storing data      */
+    GPtrArray *data_writers;  /**< data_writer_t * threads that will take care of
+                               *   storing data (sharded by hash)                  */
     GThread *meta_thread;     /**< Thread that will take care of storing meta data */
+    GThreadPool *request_pool; /**< Threads that process requests when
+                                *   libmicrohttpd uses epoll threads (NULL
+                                *   when it uses a thread per connection or
+                                *   once the server is stopping)           */
+    GMutex request_mutex;     /**< protects request_pool                           */
     GMainLoop* loop;          /**< Main loop in glib                               */
     stats_t *stats;           /**< Keeps some stats about server usage             */
 } server_struct_t;
 
 
+/**
+ * @struct data_writer_t
+ * @brief A thread that stores the blocks of its own queue. Blocks are
+ *        given to a writer according to the first bytes of their hash
+ *        so that the same hash is always stored by the same writer.
+ */
+typedef struct
+{
+    server_struct_t *server_struct; /**< main structure of the server                     */
+    GAsyncQueue *queue;             /**< hash_data_t * blocks to be stored by this writer */
+    GThread *thread;                /**< thread running data_thread() for this writer     */
+} data_writer_t;
+
+
 /**
  * @struct upload_t
- * @brief Structure to manage uploads of data in POST command.
+ * @brief Structure to manage uploads of data in POST command. It is also
+ *        the request handed over to a request worker for GET requests
+ *        (without any buffer then).
  *
  */
 typedef struct
 {
     guchar *buffer;  /**< buffer that will grab all upload_data from MHD_ahc callback       */
+    guint64 size;    /**< allocated size of buffer (without the final \0)                   */
     guint64 pos;     /**< position in the buffer (at the end it is the size of that buffer) */
     guint64 number;  /**< number of upload_data buffers received                            */
+    struct MHD_Connection *connection; /**< connection suspended while a request worker processes buffer */
+    gboolean get;        /**< TRUE for a GET request (buffer is then NULL)                      */
+    gchar *url;          /**< requested url (kept for the request worker)                       */
+    gchar *answer;       /**< answer made by the request worker                                 */
+    guchar *binary;      /**< binary answer of a GET request (answer is then NULL)              */
+    gsize binary_len;    /**< length of binary                                                  */
+    gchar *content_type; /**< content type of answer                                            */
+    gboolean done;       /**< TRUE once the request worker has made the answer                  */
 } upload_t;
 
 
+/**
+ * Inits main server's structure
+ * @param argc : number of arguments given on the command line.
+ * @param argv : an array of strings that contains command line arguments.
+ * @returns a server_struct_t * structure that contains everything that is
+ *          needed for 'cdpfglserver' program.
+ */
+extern server_struct_t *init_server_main_structure(int argc, char **argv);
+
+
+/**
+ * Installs signals traps in order to be able to close the program as
+ * as cleanly as we can.
+ * @param server_struct is the main structure of the program it must not
+ *        be NULL;
+ */
+extern void install_server_signal_traps(server_struct_t *server_struct);
+
+
+/**
+ * Starts the threads that store meta data and data and then the
+ * libmicrohttpd daemon that answers requests.
+ * @param server_struct is the main structure for the server whose
+ *        backend has been initialized.
+ * @returns TRUE if the server answers requests and FALSE on error.
+ */
+extern gboolean start_server(server_struct_t *server_struct);
+
+
+/**
+ * Frees server's structure. libmicrohttpd stops accepting connections
+ * before the request workers are stopped and is stopped once they are
+ * done with the requests they had. The meta data and data threads store
+ * what they were given and end before the backend is terminated.
+ * @param server_struct is the structure to be freed
+ */
+extern void free_server_struct_t(server_struct_t *server_struct);
+
+
+#include "hash_index.h"
 #include "file_backend.h"
+#include "pack_backend.h"
 #include "stats.h"
 
 #endif /* #ifndef _SERVER_H_ */
@@ -0,0 +1,450 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    test_file_backend.c
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file test_file_backend.c
+ *
+ * Tests of the header of the file backend's block files: headers
+ * encoded and decoded, .meta files of older blocks, conversion of those
+ * blocks by --migrate-blocks (even when it was interrupted) and blocks
+ * retrieved whatever the way they were stored.
+ */
+
+#include "server.h"
+#include "test_helpers.h"
+#include "test_server.h"
+
+/**
+ * @def TEST_DIRECTORY
+ * Template of the name of the temporary directory of each test.
+ */
+#define TEST_DIRECTORY ("cdpfgl-file-XXXXXX")
+
+static void write_test_meta(gchar *filename, gshort cmptype, gssize uncmplen);
+static void assert_file_contents(gchar *filename, gchar *expected, gsize length);
+static server_struct_t *new_test_server(gchar *dirname);
+static void free_test_server(server_struct_t *server_struct);
+static gchar *make_test_block_filename(gchar *dirname, gchar *hex_hash);
+static void assert_retrieved(server_struct_t *server_struct, gchar *hex_hash, gchar *data, gsize length, gshort cmptype, gssize uncmplen);
+static void test_block_header(void);
+static void test_header_as_in_meta(void);
+static void test_values_from_meta(void);
+static void test_migrate_block_file(void);
+static void test_retrieve_data(void);
+static void test_migrate_blocks(void);
+
+
+/**
+ * Writes the .meta file of a block as older versions of the backend did.
+ * @param filename is the block file.
+ * @param cmptype is the compression type of the block.
+ * @param uncmplen is the uncompressed length of the block.
+ */
+static void write_test_meta(gchar *filename, gshort cmptype, gssize uncmplen)
+{
+    gchar *filename_meta = NULL;
+    gchar *contents = NULL;
+
+    filename_meta = g_strdup_printf("%s.meta", filename);
+    contents = g_strdup_printf("[%s]\n%s=%d\n%s=%" G_GSSIZE_FORMAT "\n", GN_META, KN_CMPTYPE, cmptype, KN_UNCMPLEN, uncmplen);
+    g_assert(g_file_set_contents(filename_meta, contents, -1, NULL) == TRUE);
+
+    free_variable(contents);
+    free_variable(filename_meta);
+}
+
+
+/**
+ * Asserts what a file contains.
+ * @param filename is the file.
+ * @param expected is what the file should contain.
+ * @param length is the length of expected.
+ */
+static void assert_file_contents(gchar *filename, gchar *expected, gsize length)
+{
+    gchar *contents = NULL;
+    gsize contents_len = 0;
+
+    g_assert(g_file_get_contents(filename, &contents, &contents_len, NULL) == TRUE);
+    g_assert_cmpuint(contents_len, ==, length);
+    g_assert(memcmp(contents, expected, length) == 0);
+
+    free_variable(contents);
+}
+
+
+/**
+ * @param dirname is the directory of the backend.
+ * @returns a newly allocated server structure with a file backend of
+ *          one level in dirname and without hash index.
+ */
+static server_struct_t *new_test_server(gchar *dirname)
+{
+    server_struct_t *server_struct = NULL;
+    file_backend_t *file_backend = NULL;
+
+    file_backend = (file_backend_t *) g_malloc0(sizeof(file_backend_t));
+    file_backend->prefix = g_strdup(dirname);
+    file_backend->level = 1;
+    file_backend->index = NULL;
+
+    server_struct = new_test_server_struct(dirname, NULL);
+    server_struct->backend->user_data = file_backend;
+
+    return server_struct;
+}
+
+
+/**
+ * Frees a server structure made by new_test_server().
+ * @param server_struct is the server structure.
+ */
+static void free_test_server(server_struct_t *server_struct)
+{
+    file_backend_t *file_backend = server_struct->backend->user_data;
+
+    free_variable(file_backend->prefix);
+    free_variable(file_backend);
+    free_test_server_struct(server_struct);
+}
+
+
+/**
+ * Makes the directory of a block in a backend of one level.
+ * @param dirname is the directory of the backend.
+ * @param hex_hash is the hash of the block in hexadecimal.
+ * @returns the newly allocated filename of the block.
+ */
+static gchar *make_test_block_filename(gchar *dirname, gchar *hex_hash)
+{
+    gchar *first = NULL;
+    gchar *path = NULL;
+    gchar *filename = NULL;
+
+    first = g_strndup(hex_hash, 2);
+    path = g_build_filename(dirname, "data", first, NULL);
+    g_assert_cmpint(g_mkdir_with_parents(path, 0700), ==, 0);
+    filename = g_build_filename(path, hex_hash + 2, NULL);
+
+    free_variable(path);
+    free_variable(first);
+
+    return filename;
+}
+
+
+/**
+ * Asserts what is retrieved for a block.
+ * @param server_struct is the server structure.
+ * @param hex_hash is the hash of the block in hexadecimal.
+ * @param data is the expected data.
+ * @param length is the length of data.
+ * @param cmptype is the expected compression type.
+ * @param uncmplen is the expected uncompressed length.
+ */
+static void assert_retrieved(server_struct_t *server_struct, gchar *hex_hash, gchar *data, gsize length, gshort cmptype, gssize uncmplen)
+{
+    hash_data_t *hash_data = NULL;
+
+    hash_data = file_retrieve_data(server_struct, hex_hash);
+
+    g_assert_nonnull(hash_data);
+    g_assert_cmpint(hash_data->read, ==, (gssize) length);
+    g_assert(memcmp(hash_data->data, data, length) == 0);
+    g_assert_cmpint(hash_data->cmptype, ==, cmptype);
+    g_assert_cmpint(hash_data->uncmplen, ==, uncmplen);
+
+    free_hash_data_t(hash_data);
+}
+
+
+/**
+ * Headers are decoded as they were encoded. The magic alone does not
+ * make a header: unused bytes must be 0 and the compression type must be
+ * a known one.
+ */
+static void test_block_header(void)
+{
+    guchar header[FILE_BLOCK_HEADER_LEN];
+    gshort cmptype = 0;
+    gssize uncmplen = 0;
+
+    encode_block_header(header, COMPRESS_ZLIB_TYPE, 16384);
+    g_assert(memcmp(header, FILE_BLOCK_MAGIC, 4) == 0);
+    g_assert(decode_block_header(header, FILE_BLOCK_HEADER_LEN, &cmptype, &uncmplen) == TRUE);
+    g_assert_cmpint(cmptype, ==, COMPRESS_ZLIB_TYPE);
+    g_assert_cmpint(uncmplen, ==, 16384);
+
+    /* Too short */
+    g_assert(decode_block_header(header, FILE_BLOCK_HEADER_LEN - 1, &cmptype, &uncmplen) == FALSE);
+
+    header[6] = 1;
+    g_assert(decode_block_header(header, FILE_BLOCK_HEADER_LEN, &cmptype, &uncmplen) == FALSE);
+    header[6] = 0;
+    header[7] = 1;
+    g_assert(decode_block_header(header, FILE_BLOCK_HEADER_LEN, &cmptype, &uncmplen) == FALSE);
+    header[7] = 0;
+
+    /* Unknown compression type */
+    header[5] = 0x7f;
+    g_assert(decode_block_header(header, FILE_BLOCK_HEADER_LEN, &cmptype, &uncmplen) == FALSE);
+
+    header[5] = COMPRESS_ZLIB_TYPE;
+    header[0] = 'X';
+    g_assert(decode_block_header(header, FILE_BLOCK_HEADER_LEN, &cmptype, &uncmplen) == FALSE);
+
+    /* An unknown compression type is never written */
+    encode_block_header(header, 0x7f, 100);
+    g_assert(decode_block_header(header, FILE_BLOCK_HEADER_LEN, &cmptype, &uncmplen) == TRUE);
+    g_assert_cmpint(cmptype, ==, COMPRESS_NONE_TYPE);
+}
+
+
+/**
+ * Only a header with the values of the .meta file is taken for the
+ * header written by an interrupted conversion.
+ */
+static void test_header_as_in_meta(void)
+{
+    guchar header[FILE_BLOCK_HEADER_LEN];
+
+    encode_block_header(header, COMPRESS_ZLIB_TYPE, 16384);
+
+    g_assert(is_block_header_as_in_meta(header, FILE_BLOCK_HEADER_LEN, COMPRESS_ZLIB_TYPE, 16384) == TRUE);
+    g_assert(is_block_header_as_in_meta(header, FILE_BLOCK_HEADER_LEN, COMPRESS_NONE_TYPE, 16384) == FALSE);
+    g_assert(is_block_header_as_in_meta(header, FILE_BLOCK_HEADER_LEN, COMPRESS_ZLIB_TYPE, 16383) == FALSE);
+    g_assert(is_block_header_as_in_meta((guchar *) "data", 4, COMPRESS_ZLIB_TYPE, 16384) == FALSE);
+}
+
+
+/**
+ * Values are read from the .meta file of a block. Unknown compression
+ * types are read as COMPRESS_NONE_TYPE.
+ */
+static void test_values_from_meta(void)
+{
+    gchar *dirname = NULL;
+    gchar *filename = NULL;
+    gshort cmptype = 0;
+    gssize uncmplen = 0;
+
+    dirname = make_test_directory(TEST_DIRECTORY);
+    filename = g_build_filename(dirname, "block", NULL);
+
+    g_assert(get_values_from_file_meta(filename, &cmptype, &uncmplen) == FALSE);
+    g_assert_cmpint(cmptype, ==, COMPRESS_NONE_TYPE);
+    g_assert_cmpint(uncmplen, ==, 0);
+
+    write_test_meta(filename, COMPRESS_ZLIB_TYPE, 5000);
+    g_assert(get_values_from_file_meta(filename, &cmptype, &uncmplen) == TRUE);
+    g_assert_cmpint(cmptype, ==, COMPRESS_ZLIB_TYPE);
+    g_assert_cmpint(uncmplen, ==, 5000);
+
+    write_test_meta(filename, 42, 5000);
+    g_assert(get_values_from_file_meta(filename, &cmptype, &uncmplen) == TRUE);
+    g_assert_cmpint(cmptype, ==, COMPRESS_NONE_TYPE);
+
+    free_variable(filename);
+    remove_test_directory(dirname);
+    free_variable(dirname);
+}
+
+
+/**
+ * A block file with a .meta file gets a header and its .meta file is
+ * removed. A conversion interrupted after writing the header only
+ * removes the .meta file and data that begins with another header is
+ * kept as data.
+ */
+static void test_migrate_block_file(void)
+{
+    guchar expected[FILE_BLOCK_HEADER_LEN + 5];
+    guchar other[FILE_BLOCK_HEADER_LEN];
+    guchar converted[2 * FILE_BLOCK_HEADER_LEN];
+    gchar *dirname = NULL;
+    gchar *filename = NULL;
+    gchar *filename_meta = NULL;
+
+    dirname = make_test_directory(TEST_DIRECTORY);
+    filename = g_build_filename(dirname, "block", NULL);
+    filename_meta = g_strdup_printf("%s.meta", filename);
+
+    encode_block_header(expected, COMPRESS_ZLIB_TYPE, 5000);
+    memcpy(expected + FILE_BLOCK_HEADER_LEN, "hello", 5);
+
+    /* Block stored with a .meta file */
+    g_assert(g_file_set_contents(filename, "hello", 5, NULL) == TRUE);
+    write_test_meta(filename, COMPRESS_ZLIB_TYPE, 5000);
+    g_assert(migrate_block_file(filename) == TRUE);
+    g_assert(g_file_test(filename_meta, G_FILE_TEST_EXISTS) == FALSE);
+    assert_file_contents(filename, (gchar *) expected, sizeof(expected));
+
+    /* Interrupted before the .meta file was removed */
+    write_test_meta(filename, COMPRESS_ZLIB_TYPE, 5000);
+    g_assert(migrate_block_file(filename) == TRUE);
+    g_assert(g_file_test(filename_meta, G_FILE_TEST_EXISTS) == FALSE);
+    assert_file_contents(filename, (gchar *) expected, sizeof(expected));
+
+    /* Data that begins with a header of other values */
+    encode_block_header(other, COMPRESS_NONE_TYPE, FILE_BLOCK_HEADER_LEN);
+    g_assert(g_file_set_contents(filename, (gchar *) other, FILE_BLOCK_HEADER_LEN, NULL) == TRUE);
+    write_test_meta(filename, COMPRESS_ZLIB_TYPE, 5000);
+    g_assert(migrate_block_file(filename) == TRUE);
+    encode_block_header(converted, COMPRESS_ZLIB_TYPE, 5000);
+    memcpy(converted + FILE_BLOCK_HEADER_LEN, other, FILE_BLOCK_HEADER_LEN);
+    assert_file_contents(filename, (gchar *) converted, sizeof(converted));
+
+    /* Without a .meta file there is nothing to convert */
+    g_assert(migrate_block_file(filename) == FALSE);
+
+    free_variable(filename_meta);
+    free_variable(filename);
+    remove_test_directory(dirname);
+    free_variable(dirname);
+}
+
+
+/**
+ * Blocks are retrieved without their header. A block that has a .meta
+ * file only has a header when it is the one an interrupted migration
+ * wrote from it: otherwise the data that looks like a header is kept.
+ * Blocks without a valid header get their values from their .meta file.
+ */
+static void test_retrieve_data(void)
+{
+    server_struct_t *server_struct = NULL;
+    guchar block[FILE_BLOCK_HEADER_LEN + 10];
+    gchar *dirname = NULL;
+    gchar *filename = NULL;
+    gchar *with_header = "0102030405060708091011121314151617181920212223242526272829303132";
+    gchar *with_both = "a1a2a3a4a5a6a7a8a9b0b1b2b3b4b5b6b7b8b9c0c1c2c3c4c5c6c7c8c9d0d1d2";
+    gchar *interrupted = "b1b2b3b4b5b6b7b8b9c0c1c2c3c4c5c6c7c8c9d0d1d2d3d4d5d6d7d8d9e0e1e2";
+    gchar *with_meta = "e1e2e3e4e5e6e7e8e9f0f1f2f3f4f5f6f7f8f9a0a1a2a3a4a5a6a7a8a9b0b1b2";
+    gchar *without = "ff02030405060708091011121314151617181920212223242526272829303132";
+
+    dirname = make_test_directory(TEST_DIRECTORY);
+    server_struct = new_test_server(dirname);
+
+    encode_block_header(block, COMPRESS_ZLIB_TYPE, 5000);
+    memcpy(block + FILE_BLOCK_HEADER_LEN, "compressed", 10);
+
+    filename = make_test_block_filename(dirname, with_header);
+    g_assert(g_file_set_contents(filename, (gchar *) block, sizeof(block), NULL) == TRUE);
+    assert_retrieved(server_struct, with_header, "compressed", 10, COMPRESS_ZLIB_TYPE, 5000);
+    free_variable(filename);
+
+    filename = make_test_block_filename(dirname, with_both);
+    g_assert(g_file_set_contents(filename, (gchar *) block, sizeof(block), NULL) == TRUE);
+    write_test_meta(filename, COMPRESS_NONE_TYPE, sizeof(block));
+    assert_retrieved(server_struct, with_both, (gchar *) block, sizeof(block), COMPRESS_NONE_TYPE, sizeof(block));
+    free_variable(filename);
+
+    filename = make_test_block_filename(dirname, interrupted);
+    g_assert(g_file_set_contents(filename, (gchar *) block, sizeof(block), NULL) == TRUE);
+    write_test_meta(filename, COMPRESS_ZLIB_TYPE, 5000);
+    assert_retrieved(server_struct, interrupted, "compressed", 10, COMPRESS_ZLIB_TYPE, 5000);
+    free_variable(filename);
+
+    filename = make_test_block_filename(dirname, with_meta);
+    g_assert(g_file_set_contents(filename, "compressed", 10, NULL) == TRUE);
+    write_test_meta(filename, COMPRESS_ZLIB_TYPE, 5000);
+    assert_retrieved(server_struct, with_meta, "compressed", 10, COMPRESS_ZLIB_TYPE, 5000);
+    free_variable(filename);
+
+    filename = make_test_block_filename(dirname, without);
+    g_assert(g_file_set_contents(filename, "raw", 3, NULL) == TRUE);
+    assert_retrieved(server_struct, without, "raw", 3, COMPRESS_NONE_TYPE, 0);
+    free_variable(filename);
+
+    free_test_server(server_struct);
+    remove_test_directory(dirname);
+    free_variable(dirname);
+}
+
+
+/**
+ * A tree is only marked as migrated once every block has been converted.
+ * .meta files of a tree marked as migrated are ignored.
+ */
+static void test_migrate_blocks(void)
+{
+    server_struct_t *server_struct = NULL;
+    file_backend_t *file_backend = NULL;
+    gchar *dirname = NULL;
+    gchar *filename = NULL;
+    gchar *corrupted = NULL;
+    gchar *filename_meta = NULL;
+    gchar *marker = NULL;
+    gchar *with_meta = "e1e2e3e4e5e6e7e8e9f0f1f2f3f4f5f6f7f8f9a0a1a2a3a4a5a6a7a8a9b0b1b2";
+    gchar *with_bad_meta = "c1c2c3c4c5c6c7c8c9d0d1d2d3d4d5d6d7d8d9e0e1e2e3e4e5e6e7e8e9f0f1f2";
+
+    dirname = make_test_directory(TEST_DIRECTORY);
+    server_struct = new_test_server(dirname);
+    file_backend = server_struct->backend->user_data;
+    marker = g_build_filename(dirname, "data", FILE_BACKEND_MIGRATED, NULL);
+
+    filename = make_test_block_filename(dirname, with_meta);
+    g_assert(g_file_set_contents(filename, "compressed", 10, NULL) == TRUE);
+    write_test_meta(filename, COMPRESS_ZLIB_TYPE, 5000);
+
+    corrupted = make_test_block_filename(dirname, with_bad_meta);
+    g_assert(g_file_set_contents(corrupted, "raw", 3, NULL) == TRUE);
+    filename_meta = g_strdup_printf("%s.meta", corrupted);
+    g_assert(g_file_set_contents(filename_meta, "not a key file", -1, NULL) == TRUE);
+
+    file_migrate_blocks(server_struct);
+    g_assert(file_exists(marker) == FALSE);
+    g_assert(file_backend->migrated == FALSE);
+    assert_retrieved(server_struct, with_meta, "compressed", 10, COMPRESS_ZLIB_TYPE, 5000);
+
+    g_assert_cmpint(unlink(filename_meta), ==, 0);
+    file_migrate_blocks(server_struct);
+    g_assert(file_exists(marker) == TRUE);
+    g_assert(file_backend->migrated == TRUE);
+
+    /* The header is trusted: this .meta file must not be read */
+    write_test_meta(filename, COMPRESS_NONE_TYPE, 0);
+    assert_retrieved(server_struct, with_meta, "compressed", 10, COMPRESS_ZLIB_TYPE, 5000);
+
+    free_variable(marker);
+    free_variable(filename_meta);
+    free_variable(corrupted);
+    free_variable(filename);
+    free_test_server(server_struct);
+    remove_test_directory(dirname);
+    free_variable(dirname);
+}
+
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/file_backend/block_header", test_block_header);
+    g_test_add_func("/file_backend/header_as_in_meta", test_header_as_in_meta);
+    g_test_add_func("/file_backend/values_from_meta", test_values_from_meta);
+    g_test_add_func("/file_backend/migrate_block_file", test_migrate_block_file);
+    g_test_add_func("/file_backend/retrieve_data", test_retrieve_data);
+    g_test_add_func("/file_backend/migrate_blocks", test_migrate_blocks);
+
+    return g_test_run();
+}
@@ -0,0 +1,610 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    test_hash_index.c
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file test_hash_index.c
+ *
+ * Tests of the index of the hashs of stored blocks: values kept with the
+ * hashs, removals in runs of colliding slots, growth, index files opened
+ * again and index rebuilt from a data tree.
+ */
+
+#include "server.h"
+#include "test_helpers.h"
+
+/**
+ * @def TEST_DIRECTORY
+ * Template of the name of the temporary directory of each test.
+ */
+#define TEST_DIRECTORY ("cdpfgl-index-XXXXXX")
+
+
+/**
+ * @def TEST_THREADS
+ * Number of threads that insert hashs at once into the same index.
+ *
+ * @def TEST_HASHS_PER_THREAD
+ * Number of hashs inserted by each of those threads.
+ */
+#define TEST_THREADS (4)
+#define TEST_HASHS_PER_THREAD (250)
+
+
+/**
+ * @struct test_inserter_t
+ * @brief A thread that inserts hashs into an index.
+ */
+typedef struct
+{
+    hash_index_t *index;   /**< index where hashs are inserted               */
+    guint8 number;         /**< number of the thread, put in its hashs       */
+} test_inserter_t;
+
+static void make_test_hash(guint8 *hash, guint64 first_slot, guint8 id);
+static hash_index_t *new_test_index(gchar *dirname, guint64 slots, guint value_len);
+static gboolean is_test_slot_empty(hash_index_t *index, guint64 position);
+static void crash_test_index(hash_index_t *index);
+static gboolean is_test_hash_id(guint8 *hash, guchar *value, gpointer user_data);
+static void test_values(void);
+static void test_remove_in_run(void);
+static void test_grow(void);
+static void make_thread_test_hash(guint8 *hash, guint8 number, guint id);
+static gpointer insert_test_hashs(gpointer user_data);
+static void test_grow_concurrently(void);
+static void test_reopen(void);
+static void test_rebuild(void);
+static void test_rebuild_grow(void);
+static void test_not_closed_cleanly(void);
+
+
+/**
+ * Makes a hash whose first slot is known (in an index of less than 256
+ * slots). Byte 8 is never 0 so that the hash is never the one of a block
+ * of zeros.
+ * @param[out] hash is a buffer of HASH_LEN bytes.
+ * @param first_slot is the first slot where the hash may be.
+ * @param id is the last byte of the hash that tells it apart.
+ */
+static void make_test_hash(guint8 *hash, guint64 first_slot, guint8 id)
+{
+    memset(hash, 0, HASH_LEN);
+    hash[7] = (guint8) first_slot;
+    hash[8] = 0xAA;
+    hash[HASH_LEN - 1] = id;
+}
+
+
+/**
+ * @param dirname is the directory of the index file.
+ * @param slots is the number of slots of the index.
+ * @param value_len is the number of bytes kept with each hash.
+ * @returns a newly allocated empty index of slots slots.
+ */
+static hash_index_t *new_test_index(gchar *dirname, guint64 slots, guint value_len)
+{
+    hash_index_t *index = NULL;
+    gchar *filename = NULL;
+
+    filename = g_build_filename(dirname, HASH_INDEX_FILENAME, NULL);
+    index = create_hash_index_file(filename, slots, value_len);
+    g_assert_nonnull(index);
+    free_variable(filename);
+
+    return index;
+}
+
+
+/**
+ * @param index is a mapped hash index.
+ * @param position is the number of a slot.
+ * @returns TRUE if that slot is empty (its hash is only zeros).
+ */
+static gboolean is_test_slot_empty(hash_index_t *index, guint64 position)
+{
+    static const guchar empty[HASH_LEN] = {0};
+    guchar *slot = NULL;
+
+    slot = index->map + HASH_INDEX_HEADER_LEN + position * (HASH_LEN + index->value_len);
+
+    return memcmp(slot, empty, HASH_LEN) == 0;
+}
+
+
+/**
+ * Frees an index as a program that crashes would: its file is unmapped
+ * and closed without being flushed nor marked as closed cleanly.
+ * @param index is the hash index to be freed.
+ */
+static void crash_test_index(hash_index_t *index)
+{
+    munmap(index->map, index->map_len);
+    close(index->fd);
+    index->map = NULL;
+    index->fd = -1;
+    free_hash_index_t(index);
+}
+
+
+/**
+ * hash_index_filter_func that selects the hashs made by make_test_hash()
+ * with a given id.
+ * @param hash is the hash of the entry.
+ * @param value is the value kept with that hash.
+ * @param user_data is a guint8 * id.
+ * @returns TRUE if hash has this id.
+ */
+static gboolean is_test_hash_id(guint8 *hash, guchar *value, gpointer user_data)
+{
+    guint8 *id = (guint8 *) user_data;
+
+    return hash[HASH_LEN - 1] == *id;
+}
+
+
+/**
+ * Values are kept with their hashs, a hash inserted again keeps its
+ * first value and hashs of blocks of zeros are never inserted.
+ */
+static void test_values(void)
+{
+    hash_index_t *index = NULL;
+    gchar *dirname = NULL;
+    guint8 hash[HASH_LEN];
+    guint8 zero_hash[HASH_LEN];
+    guchar value[8];
+
+    dirname = make_test_directory(TEST_DIRECTORY);
+    index = new_test_index(dirname, 16, 8);
+
+    make_test_hash(hash, 3, 1);
+    g_assert(is_hash_in_index(index, hash) == FALSE);
+    insert_value_into_hash_index(index, hash, (guchar *) "12345678");
+    insert_value_into_hash_index(index, hash, (guchar *) "abcdefgh");
+    g_assert_cmpuint(index->count, ==, 1);
+
+    g_assert(get_value_from_hash_index(index, hash, value) == TRUE);
+    g_assert(memcmp(value, "12345678", 8) == 0);
+
+    /* No value means a value of zeros */
+    make_test_hash(hash, 3, 2);
+    insert_into_hash_index(index, hash);
+    g_assert(get_value_from_hash_index(index, hash, value) == TRUE);
+    g_assert(memcmp(value, "\0\0\0\0\0\0\0\0", 8) == 0);
+
+    make_zero_block_hash(zero_hash, 4096);
+    insert_into_hash_index(index, zero_hash);
+    g_assert(is_hash_in_index(index, zero_hash) == FALSE);
+    g_assert_cmpuint(index->count, ==, 2);
+
+    free_hash_index_t(index);
+    remove_test_directory(dirname);
+    free_variable(dirname);
+}
+
+
+/**
+ * Removing a hash in the middle of a run of used slots (that wraps
+ * around the end of the index) keeps every other hash of the run.
+ */
+static void test_remove_in_run(void)
+{
+    hash_index_t *index = NULL;
+    gchar *dirname = NULL;
+    guint8 hash[HASH_LEN];
+    guint8 id = 2;
+
+    dirname = make_test_directory(TEST_DIRECTORY);
+    index = new_test_index(dirname, 16, 0);
+
+    /* Slots 15, 0 and 1 for the first three and 2 for the last one */
+    make_test_hash(hash, 15, 1);
+    insert_into_hash_index(index, hash);
+    make_test_hash(hash, 15, 2);
+    insert_into_hash_index(index, hash);
+    make_test_hash(hash, 15, 3);
+    insert_into_hash_index(index, hash);
+    make_test_hash(hash, 0, 4);
+    insert_into_hash_index(index, hash);
+
+    g_assert_cmpuint(remove_from_hash_index_if(index, is_test_hash_id, &id), ==, 1);
+    g_assert_cmpuint(index->count, ==, 3);
+
+    make_test_hash(hash, 15, 1);
+    g_assert(is_hash_in_index(index, hash) == TRUE);
+    make_test_hash(hash, 15, 2);
+    g_assert(is_hash_in_index(index, hash) == FALSE);
+    make_test_hash(hash, 15, 3);
+    g_assert(is_hash_in_index(index, hash) == TRUE);
+    make_test_hash(hash, 0, 4);
+    g_assert(is_hash_in_index(index, hash) == TRUE);
+
+    /* The run is now slots 15, 0 and 1 */
+    g_assert(is_test_slot_empty(index, 1) == FALSE);
+    g_assert(is_test_slot_empty(index, 2) == TRUE);
+
+    free_hash_index_t(index);
+    remove_test_directory(dirname);
+    free_variable(dirname);
+}
+
+
+/**
+ * An index that is HASH_INDEX_MAX_LOAD percent full doubles its size and
+ * keeps its hashs and their values.
+ */
+static void test_grow(void)
+{
+    hash_index_t *index = NULL;
+    gchar *dirname = NULL;
+    guint8 hash[HASH_LEN];
+    guchar value[4];
+    guint8 i = 0;
+
+    dirname = make_test_directory(TEST_DIRECTORY);
+    index = new_test_index(dirname, 8, 4);
+
+    for (i = 1; i <= 20; i++)
+        {
+            make_test_hash(hash, i % 8, i);
+            memset(value, i, 4);
+            insert_value_into_hash_index(index, hash, value);
+        }
+
+    g_assert_cmpuint(index->slots, ==, 32);
+    g_assert_cmpuint(index->count, ==, 20);
+
+    for (i = 1; i <= 20; i++)
+        {
+            make_test_hash(hash, i % 8, i);
+            g_assert(get_value_from_hash_index(index, hash, value) == TRUE);
+            g_assert_cmpuint(value[0], ==, i);
+            g_assert_cmpuint(value[3], ==, i);
+        }
+
+    free_hash_index_t(index);
+    remove_test_directory(dirname);
+    free_variable(dirname);
+}
+
+
+/**
+ * Makes a hash that is unique for a thread and an id.
+ * @param[out] hash is a buffer of HASH_LEN bytes.
+ * @param number is the number of the thread.
+ * @param id tells the hashs of a thread apart.
+ */
+static void make_thread_test_hash(guint8 *hash, guint8 number, guint id)
+{
+    guint32 be_id = GUINT32_TO_BE(id);
+
+    memset(hash, 0, HASH_LEN);
+    hash[3] = number;
+    memcpy(hash + 4, &be_id, 4);
+    hash[8] = 0xAA;
+}
+
+
+/**
+ * Inserts TEST_HASHS_PER_THREAD hashs into an index.
+ * @param user_data MUST be a test_inserter_t * pointer.
+ * @returns NULL.
+ */
+static gpointer insert_test_hashs(gpointer user_data)
+{
+    test_inserter_t *inserter = (test_inserter_t *) user_data;
+    guint8 hash[HASH_LEN];
+    guint id = 0;
+
+    for (id = 0; id < TEST_HASHS_PER_THREAD; id++)
+        {
+            make_thread_test_hash(hash, inserter->number, id);
+            g_assert(insert_into_hash_index(inserter->index, hash) == TRUE);
+            g_assert(is_hash_in_index(inserter->index, hash) == TRUE);
+        }
+
+    return NULL;
+}
+
+
+/**
+ * Threads that insert hashs while the index grows several times lose
+ * none of them.
+ */
+static void test_grow_concurrently(void)
+{
+    test_inserter_t inserters[TEST_THREADS];
+    GThread *threads[TEST_THREADS];
+    hash_index_t *index = NULL;
+    gchar *dirname = NULL;
+    guint8 hash[HASH_LEN];
+    guint id = 0;
+    guint8 i = 0;
+
+    dirname = make_test_directory(TEST_DIRECTORY);
+    index = new_test_index(dirname, 8, 0);
+
+    for (i = 0; i < TEST_THREADS; i++)
+        {
+            inserters[i].index = index;
+            inserters[i].number = i;
+            threads[i] = g_thread_new("insert_test_hashs", insert_test_hashs, &inserters[i]);
+        }
+
+    for (i = 0; i < TEST_THREADS; i++)
+        {
+            g_thread_join(threads[i]);
+        }
+
+    g_assert_cmpuint(index->count, ==, TEST_THREADS * TEST_HASHS_PER_THREAD);
+    g_assert_cmpuint(index->slots, >, 8);
+
+    for (i = 0; i < TEST_THREADS; i++)
+        {
+            for (id = 0; id < TEST_HASHS_PER_THREAD; id++)
+                {
+                    make_thread_test_hash(hash, i, id);
+                    g_assert(is_hash_in_index(index, hash) == TRUE);
+                }
+        }
+
+    free_hash_index_t(index);
+    remove_test_directory(dirname);
+    free_variable(dirname);
+}
+
+
+/**
+ * An index file opened again has the same hashs. Index files with other
+ * values or a wrong header are refused.
+ */
+static void test_reopen(void)
+{
+    hash_index_t *index = NULL;
+    gchar *dirname = NULL;
+    gchar *filename = NULL;
+    guint8 hash[HASH_LEN];
+    gint fd = -1;
+
+    dirname = make_test_directory(TEST_DIRECTORY);
+    filename = g_build_filename(dirname, HASH_INDEX_FILENAME, NULL);
+
+    index = new_test_index(dirname, 16, 8);
+    make_test_hash(hash, 5, 1);
+    insert_value_into_hash_index(index, hash, (guchar *) "location");
+    free_hash_index_t(index);
+
+    index = open_hash_index_file(filename, 8);
+    g_assert_nonnull(index);
+    g_assert(index->clean == TRUE);
+    g_assert_cmpuint(index->slots, ==, 16);
+    g_assert_cmpuint(index->count, ==, 1);
+    g_assert(is_hash_in_index(index, hash) == TRUE);
+    free_hash_index_t(index);
+
+    g_assert_null(open_hash_index_file(filename, 0));
+
+    /* Wrong magic */
+    fd = open(filename, O_RDWR);
+    g_assert_cmpint(fd, >=, 0);
+    g_assert_cmpint(pwrite(fd, "XXXX", 4, 0), ==, 4);
+    close(fd);
+    g_assert_null(open_hash_index_file(filename, 8));
+
+    free_variable(filename);
+    remove_test_directory(dirname);
+    free_variable(dirname);
+}
+
+
+/**
+ * An index that is missing is rebuilt from the block files of the data
+ * tree (.meta files and other names are ignored) and its file is then
+ * opened as is.
+ */
+static void test_rebuild(void)
+{
+    hash_index_t *index = NULL;
+    gchar *dirname = NULL;
+    gchar *data_dir = NULL;
+    gchar *block_dir = NULL;
+    gchar *filename = NULL;
+    gchar *meta_filename = NULL;
+    gchar *index_filename = NULL;
+    guint8 *hash = NULL;
+    guint8 *meta_hash = NULL;
+    gchar *hex = "abcd0123456789abcdef0123456789abcdef0123456789abcdef0123456789ab";
+    gchar *meta_hex = "abcdffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff";
+
+    dirname = make_test_directory(TEST_DIRECTORY);
+    data_dir = g_build_filename(dirname, "data", NULL);
+    block_dir = g_build_filename(data_dir, "ab", "cd", NULL);
+    g_assert_cmpint(g_mkdir_with_parents(block_dir, 0700), ==, 0);
+
+    filename = g_build_filename(block_dir, hex + 4, NULL);
+    g_assert(g_file_set_contents(filename, "block", -1, NULL) == TRUE);
+    free_variable(filename);
+
+    meta_filename = g_strconcat(meta_hex + 4, ".meta", NULL);
+    filename = g_build_filename(block_dir, meta_filename, NULL);
+    g_assert(g_file_set_contents(filename, "meta", -1, NULL) == TRUE);
+    free_variable(filename);
+
+    filename = g_build_filename(data_dir, "not-hex", NULL);
+    g_assert(g_file_set_contents(filename, "other", -1, NULL) == TRUE);
+    free_variable(filename);
+
+    hash = string_to_hash(hex);
+    meta_hash = string_to_hash(meta_hex);
+
+    index = open_hash_index(dirname, data_dir, 2);
+    g_assert_nonnull(index);
+    g_assert_cmpuint(index->count, ==, 1);
+    g_assert(is_hash_in_index(index, hash) == TRUE);
+    g_assert(is_hash_in_index(index, meta_hash) == FALSE);
+    free_hash_index_t(index);
+
+    index_filename = g_build_filename(dirname, HASH_INDEX_FILENAME, NULL);
+    index = open_hash_index_file(index_filename, 0);
+    g_assert_nonnull(index);
+    g_assert(is_hash_in_index(index, hash) == TRUE);
+    free_hash_index_t(index);
+
+    free_variable(index_filename);
+    free_variable(meta_hash);
+    free_variable(hash);
+    free_variable(meta_filename);
+    free_variable(block_dir);
+    free_variable(data_dir);
+    remove_test_directory(dirname);
+    free_variable(dirname);
+}
+
+
+/**
+ * An index that grows while it is rebuilt grows in its temporary file:
+ * the grown index replaces the index file (that was not closed cleanly)
+ * and no other file is left.
+ */
+static void test_rebuild_grow(void)
+{
+    hash_index_t *index = NULL;
+    gchar *dirname = NULL;
+    gchar *filename = NULL;
+    gchar *tmp_filename = NULL;
+    guint8 stale[HASH_LEN];
+    guint8 hash[HASH_LEN];
+    guchar value[4];
+    guint8 i = 0;
+
+    dirname = make_test_directory(TEST_DIRECTORY);
+    filename = g_build_filename(dirname, HASH_INDEX_FILENAME, NULL);
+    tmp_filename = g_strdup_printf("%s.rebuild", filename);
+
+    index = new_test_index(dirname, 8, 4);
+    make_test_hash(stale, 3, 0xFF);
+    insert_value_into_hash_index(index, stale, NULL);
+    crash_test_index(index);
+
+    index = new_hash_index_to_rebuild(filename, 8, 4);
+    g_assert_nonnull(index);
+    g_assert(g_file_test(tmp_filename, G_FILE_TEST_EXISTS) == TRUE);
+
+    for (i = 1; i <= 20; i++)
+        {
+            make_test_hash(hash, i % 8, i);
+            memset(value, i, 4);
+            g_assert(insert_value_into_hash_index(index, hash, value) == TRUE);
+        }
+
+    g_assert_cmpuint(index->slots, ==, 32);
+    g_assert(finish_hash_index_rebuild(index) == TRUE);
+    g_assert_cmpstr(index->path, ==, filename);
+    g_assert(g_file_test(tmp_filename, G_FILE_TEST_EXISTS) == FALSE);
+    free_hash_index_t(index);
+
+    index = open_hash_index_file(filename, 4);
+    g_assert_nonnull(index);
+    g_assert(index->clean == TRUE);
+    g_assert_cmpuint(index->slots, ==, 32);
+    g_assert_cmpuint(index->count, ==, 20);
+    g_assert(is_hash_in_index(index, stale) == FALSE);
+
+    for (i = 1; i <= 20; i++)
+        {
+            make_test_hash(hash, i % 8, i);
+            g_assert(get_value_from_hash_index(index, hash, value) == TRUE);
+            g_assert_cmpuint(value[0], ==, i);
+        }
+
+    free_hash_index_t(index);
+
+    free_variable(tmp_filename);
+    free_variable(filename);
+    remove_test_directory(dirname);
+    free_variable(dirname);
+}
+
+
+/**
+ * An index file stays marked as not closed cleanly while it is opened:
+ * after a crash it is rebuilt from the data tree and hashs of blocks
+ * that are not there anymore are dropped.
+ */
+static void test_not_closed_cleanly(void)
+{
+    hash_index_t *index = NULL;
+    gchar *dirname = NULL;
+    gchar *data_dir = NULL;
+    gchar *filename = NULL;
+    guint8 hash[HASH_LEN];
+
+    dirname = make_test_directory(TEST_DIRECTORY);
+    data_dir = g_build_filename(dirname, "data", NULL);
+    g_assert_cmpint(g_mkdir_with_parents(data_dir, 0700), ==, 0);
+    filename = g_build_filename(dirname, HASH_INDEX_FILENAME, NULL);
+
+    index = new_test_index(dirname, 16, 0);
+    make_test_hash(hash, 5, 1);
+    insert_into_hash_index(index, hash);
+
+    /* The program ends without closing the index */
+    crash_test_index(index);
+
+    index = open_hash_index_file(filename, 0);
+    g_assert_nonnull(index);
+    g_assert(index->clean == FALSE);
+    g_assert(is_hash_in_index(index, hash) == TRUE);
+    crash_test_index(index);
+
+    index = open_hash_index(dirname, data_dir, 0);
+    g_assert_nonnull(index);
+    g_assert_cmpuint(index->count, ==, 0);
+    g_assert(is_hash_in_index(index, hash) == FALSE);
+    free_hash_index_t(index);
+
+    index = open_hash_index_file(filename, 0);
+    g_assert_nonnull(index);
+    g_assert(index->clean == TRUE);
+    free_hash_index_t(index);
+
+    free_variable(filename);
+    free_variable(data_dir);
+    remove_test_directory(dirname);
+    free_variable(dirname);
+}
+
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/hash_index/values", test_values);
+    g_test_add_func("/hash_index/remove_in_run", test_remove_in_run);
+    g_test_add_func("/hash_index/grow", test_grow);
+    g_test_add_func("/hash_index/grow_concurrently", test_grow_concurrently);
+    g_test_add_func("/hash_index/reopen", test_reopen);
+    g_test_add_func("/hash_index/rebuild", test_rebuild);
+    g_test_add_func("/hash_index/rebuild_grow", test_rebuild_grow);
+    g_test_add_func("/hash_index/not_closed_cleanly", test_not_closed_cleanly);
+
+    return g_test_run();
+}
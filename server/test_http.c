@@ -0,0 +1,665 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    test_http.c
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file test_http.c
+ *
+ * Tests of the server's HTTP layer when libmicrohttpd uses epoll threads
+ * and request workers: a chunked POST body bigger than the buffer first
+ * allocated for it, a server stopped while requests are processed by
+ * the request workers and blocks still queued for the data writers when
+ * it stops. The backend is a stub that answers that every hash is
+ * needed and records which thread stored each block.
+ */
+
+#include <netinet/in.h>
+#include "server.h"
+#include "test_helpers.h"
+
+/**
+ * @def TEST_PADDING_LEN
+ * Number of spaces put into the chunked body so that it does not fit
+ * in the buffer first allocated for it.
+ *
+ * @def TEST_CURL_TIMEOUT
+ * Seconds after which a request of the tests is given up.
+ */
+#define TEST_PADDING_LEN (DEFAULT_SERVER_BUFFER_SIZE + 65536)
+#define TEST_CURL_TIMEOUT (60)
+
+
+/**
+ * @def TEST_DATA_WRITERS
+ * Number of data writers of the server that stores blocks.
+ *
+ * @def TEST_BLOCKS
+ * Number of different blocks sent to that server (each one twice).
+ */
+#define TEST_DATA_WRITERS (4)
+#define TEST_BLOCKS (32)
+
+
+/**
+ * @struct test_backend_t
+ * @brief State of the stub backend: its build_needed_hash_list function
+ *        may hold requests until the test releases them.
+ */
+typedef struct
+{
+    GMutex mutex;        /**< protects everything below                                 */
+    GCond cond;          /**< signaled when a request enters or is released             */
+    gboolean hold;       /**< TRUE while requests have to wait in the backend           */
+    guint entered;       /**< number of requests that entered the backend               */
+    guint done;          /**< number of requests that left the backend                  */
+    guint stored;        /**< number of blocks stored                                   */
+    GHashTable *writers; /**< hex hash of a stored block -> GThread * that stored it    */
+    gboolean same_writer; /**< FALSE once two copies of a block were stored by two threads */
+} test_backend_t;
+
+
+/**
+ * @struct test_request_t
+ * @brief A POST request sent by a client thread.
+ */
+typedef struct
+{
+    gint port;           /**< port of the server                                        */
+    gchar *url;          /**< requested url                                             */
+    GString *body;       /**< body of the request                                       */
+    gsize sent;          /**< bytes of body already given to libcurl                    */
+    GString *answer;     /**< body of the answer                                        */
+    glong status;        /**< HTTP status of the answer (0 when there is none)          */
+    CURLcode result;     /**< result of the transfer                                    */
+} test_request_t;
+
+
+static void test_store_smeta(void *user_data, server_meta_data_t *smeta);
+static void test_store_data(void *user_data, hash_data_t *hash_data);
+static GList *test_build_needed_hash_list(void *user_data, GList *hash_data_list);
+static server_struct_t *start_test_server(test_backend_t *test_backend, gint request_workers, gint data_writers, gint *port);
+static gchar *encode_test_hash(guchar fill);
+static GString *new_hash_array_body(gchar *first, gchar *second, gsize padding);
+static GString *new_data_body(guchar fill);
+static size_t read_test_body(char *buffer, size_t size, size_t nitems, void *userdata);
+static size_t write_test_answer(char *buffer, size_t size, size_t nmemb, void *userdata);
+static test_request_t *new_test_request(gint port, gchar *url, GString *body);
+static void free_test_request(test_request_t *request);
+static gpointer send_test_request(gpointer data);
+static gpointer stop_test_server(gpointer data);
+static void test_chunked_post(void);
+static void test_stop_in_flight(void);
+static void test_stop_stores_queued_blocks(void);
+
+
+/**
+ * Stub of store_smeta: meta data are not stored.
+ * @param user_data is the server_struct_t * structure.
+ * @param smeta is freed by meta_data_thread().
+ */
+static void test_store_smeta(void *user_data, server_meta_data_t *smeta)
+{
+}
+
+
+/**
+ * Stub of store_data: blocks are counted, the thread that stores
+ * each one is recorded and they are freed.
+ * @param user_data is the server_struct_t * structure.
+ * @param hash_data is the block to be freed.
+ */
+static void test_store_data(void *user_data, hash_data_t *hash_data)
+{
+    server_struct_t *server_struct = (server_struct_t *) user_data;
+    test_backend_t *test_backend = (test_backend_t *) server_struct->backend->user_data;
+    gchar *hex_hash = NULL;
+    gpointer writer = NULL;
+
+    /* Stores slowly so that blocks are still queued when the server stops */
+    g_usleep(G_USEC_PER_SEC / 100);
+
+    hex_hash = hash_to_string(hash_data->hash);
+
+    g_mutex_lock(&test_backend->mutex);
+
+    test_backend->stored = test_backend->stored + 1;
+
+    if (test_backend->writers != NULL)
+        {
+            writer = g_hash_table_lookup(test_backend->writers, hex_hash);
+
+            if (writer == NULL)
+                {
+                    g_hash_table_insert(test_backend->writers, hex_hash, g_thread_self());
+                    hex_hash = NULL;
+                }
+            else if (writer != (gpointer) g_thread_self())
+                {
+                    test_backend->same_writer = FALSE;
+                }
+        }
+
+    g_mutex_unlock(&test_backend->mutex);
+
+    free_variable(hex_hash);
+    free_hash_data_t(hash_data);
+}
+
+
+/**
+ * Stub of build_needed_hash_list: every hash is needed. A request
+ * waits here while test_backend->hold is TRUE.
+ * @param user_data is the server_struct_t * structure.
+ * @param hash_data_list is the list of the hashs of the request.
+ * @returns a newly allocated copy of the hashs of hash_data_list.
+ */
+static GList *test_build_needed_hash_list(void *user_data, GList *hash_data_list)
+{
+    server_struct_t *server_struct = (server_struct_t *) user_data;
+    test_backend_t *test_backend = (test_backend_t *) server_struct->backend->user_data;
+    hash_data_t *hash_data = NULL;
+    GList *needed = NULL;
+    guint8 *hash = NULL;
+
+    g_mutex_lock(&test_backend->mutex);
+
+    test_backend->entered = test_backend->entered + 1;
+    g_cond_broadcast(&test_backend->cond);
+
+    while (test_backend->hold == TRUE)
+        {
+            g_cond_wait(&test_backend->cond, &test_backend->mutex);
+        }
+
+    g_mutex_unlock(&test_backend->mutex);
+
+    while (hash_data_list != NULL)
+        {
+            hash_data = (hash_data_t *) hash_data_list->data;
+
+            hash = (guint8 *) g_malloc(HASH_LEN);
+            memcpy(hash, hash_data->hash, HASH_LEN);
+            needed = g_list_prepend(needed, new_hash_data_t_as_is(NULL, 0, hash, COMPRESS_NONE_TYPE, 0));
+
+            hash_data_list = g_list_next(hash_data_list);
+        }
+
+    g_mutex_lock(&test_backend->mutex);
+    test_backend->done = test_backend->done + 1;
+    g_cond_broadcast(&test_backend->cond);
+    g_mutex_unlock(&test_backend->mutex);
+
+    return g_list_reverse(needed);
+}
+
+
+/**
+ * Starts a server with 2 epoll threads and the stub backend on a port
+ * chosen by the system.
+ * @param test_backend is the state of the stub backend.
+ * @param request_workers is the number of request workers.
+ * @param data_writers is the number of data writers.
+ * @param[out] port is the port on which the server listens.
+ * @returns the started server to be freed with free_server_struct_t().
+ */
+static server_struct_t *start_test_server(test_backend_t *test_backend, gint request_workers, gint data_writers, gint *port)
+{
+    server_struct_t *server_struct = NULL;
+    const union MHD_DaemonInfo *info = NULL;
+    struct sockaddr_in address;
+    socklen_t address_len = sizeof(address);
+
+    server_struct = new_test_server_struct(NULL, NULL);
+
+    server_struct->opt->port = 0;
+    server_struct->opt->http_threads = 2;
+    server_struct->opt->request_workers = request_workers;
+    server_struct->opt->connection_memory_limit = SERVER_DEFAULT_CONNECTION_MEMORY_LIMIT;
+    server_struct->opt->connection_timeout = SERVER_DEFAULT_CONNECTION_TIMEOUT;
+    server_struct->opt->data_writers = data_writers;
+
+    server_struct->backend->store_smeta = test_store_smeta;
+    server_struct->backend->store_data = test_store_data;
+    server_struct->backend->build_needed_hash_list = test_build_needed_hash_list;
+    server_struct->backend->user_data = test_backend;
+
+    server_struct->meta_queue = g_async_queue_new();
+    server_struct->stats = new_stats_t();
+    g_mutex_init(&server_struct->request_mutex);
+
+    g_assert_true(start_server(server_struct));
+
+    info = MHD_get_daemon_info(server_struct->d, MHD_DAEMON_INFO_LISTEN_FD);
+    g_assert_nonnull(info);
+    g_assert_cmpint(getsockname(info->listen_fd, (struct sockaddr *) &address, &address_len), ==, 0);
+    *port = ntohs(address.sin_port);
+
+    return server_struct;
+}
+
+
+/**
+ * @param fill is the byte that makes the block whose hash is encoded.
+ * @returns a newly allocated base64 encoded hash.
+ */
+static gchar *encode_test_hash(guchar fill)
+{
+    hash_data_t *hash_data = NULL;
+    gchar *encoded_hash = NULL;
+
+    hash_data = new_test_block(64, fill);
+    encoded_hash = g_base64_encode(hash_data->hash, HASH_LEN);
+    free_hash_data_t(hash_data);
+
+    return encoded_hash;
+}
+
+
+/**
+ * Makes the body of a /Hash_Array.json request whose second hash comes
+ * after padding spaces (JSON allows them) so that the request is only
+ * answered correctly when the whole body has been received.
+ * @param first is the first base64 encoded hash.
+ * @param second is the second base64 encoded hash.
+ * @param padding is the number of spaces between the two hashs.
+ * @returns a newly allocated GString.
+ */
+static GString *new_hash_array_body(gchar *first, gchar *second, gsize padding)
+{
+    GString *body = NULL;
+    gsize i = 0;
+
+    body = g_string_sized_new(padding + 256);
+
+    g_string_append_printf(body, "{\"hash_list\": [\"%s\",", first);
+
+    for (i = 0; i < padding; i++)
+        {
+            g_string_append_c(body, ' ');
+        }
+
+    g_string_append_printf(body, "\"%s\"]}", second);
+
+    return body;
+}
+
+
+/**
+ * Makes the body of a /Data.json request.
+ * @param fill is the byte that makes the block.
+ * @returns a newly allocated GString.
+ */
+static GString *new_data_body(guchar fill)
+{
+    hash_data_t *hash_data = NULL;
+    gchar *json_str = NULL;
+    GString *body = NULL;
+
+    hash_data = new_test_block(64, fill);
+    json_str = convert_hash_data_t_to_string(hash_data);
+    body = g_string_new(json_str);
+
+    free_variable(json_str);
+    free_hash_data_t(hash_data);
+
+    return body;
+}
+
+
+/**
+ * CURLOPT_READFUNCTION that gives the body of a request by pieces.
+ * @param buffer is where to copy the body.
+ * @param size times nitems is the size of buffer.
+ * @param userdata is the test_request_t * request.
+ * @returns the number of bytes copied (0 at the end of the body).
+ */
+static size_t read_test_body(char *buffer, size_t size, size_t nitems, void *userdata)
+{
+    test_request_t *request = (test_request_t *) userdata;
+    size_t len = 0;
+
+    len = MIN(size * nitems, request->body->len - request->sent);
+    memcpy(buffer, request->body->str + request->sent, len);
+    request->sent = request->sent + len;
+
+    return len;
+}
+
+
+/**
+ * CURLOPT_WRITEFUNCTION that keeps the answer of a request.
+ * @param buffer is a piece of the answer.
+ * @param size times nmemb is the size of buffer.
+ * @param userdata is the test_request_t * request.
+ * @returns the number of bytes kept.
+ */
+static size_t write_test_answer(char *buffer, size_t size, size_t nmemb, void *userdata)
+{
+    test_request_t *request = (test_request_t *) userdata;
+
+    g_string_append_len(request->answer, buffer, size * nmemb);
+
+    return size * nmemb;
+}
+
+
+/**
+ * @param port is the port of the server.
+ * @param url is the requested url.
+ * @param body is the body of the request (owned by the request).
+ * @returns a newly allocated request.
+ */
+static test_request_t *new_test_request(gint port, gchar *url, GString *body)
+{
+    test_request_t *request = NULL;
+
+    request = (test_request_t *) g_malloc0(sizeof(test_request_t));
+    g_assert_nonnull(request);
+
+    request->port = port;
+    request->url = g_strdup(url);
+    request->body = body;
+    request->sent = 0;
+    request->answer = g_string_new("");
+    request->status = 0;
+    request->result = CURLE_OK;
+
+    return request;
+}
+
+
+/**
+ * Frees a request.
+ * @param request is the request to be freed.
+ */
+static void free_test_request(test_request_t *request)
+{
+    if (request != NULL)
+        {
+            free_variable(request->url);
+            g_string_free(request->body, TRUE);
+            g_string_free(request->answer, TRUE);
+            free_variable(request);
+        }
+}
+
+
+/**
+ * Sends a POST request with a chunked body (no Content-Length).
+ * @param data is the test_request_t * request.
+ * @returns NULL once the transfer has ended.
+ */
+static gpointer send_test_request(gpointer data)
+{
+    test_request_t *request = (test_request_t *) data;
+    struct curl_slist *headers = NULL;
+    gchar *real_url = NULL;
+    CURL *curl = NULL;
+
+    curl = curl_easy_init();
+    g_assert_nonnull(curl);
+
+    real_url = g_strdup_printf("http://127.0.0.1:%d%s", request->port, request->url);
+    headers = curl_slist_append(headers, "Transfer-Encoding: chunked");
+    headers = curl_slist_append(headers, "Content-Type: application/json; charset=utf-8");
+    headers = curl_slist_append(headers, "Expect:");
+
+    curl_easy_setopt(curl, CURLOPT_URL, real_url);
+    curl_easy_setopt(curl, CURLOPT_POST, 1L);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl, CURLOPT_READFUNCTION, read_test_body);
+    curl_easy_setopt(curl, CURLOPT_READDATA, request);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_test_answer);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, request);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, (long) TEST_CURL_TIMEOUT);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+
+    request->result = curl_easy_perform(curl);
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &request->status);
+
+    curl_slist_free_all(headers);
+    curl_easy_cleanup(curl);
+    free_variable(real_url);
+
+    return NULL;
+}
+
+
+/**
+ * Stops a server.
+ * @param data is the server_struct_t * structure of the server.
+ * @returns NULL once the server is stopped and freed.
+ */
+static gpointer stop_test_server(gpointer data)
+{
+    free_server_struct_t((server_struct_t *) data);
+
+    return NULL;
+}
+
+
+/**
+ * A chunked body has no Content-Length: the buffer first allocated
+ * (DEFAULT_SERVER_BUFFER_SIZE) grows until the whole body is received
+ * and the request worker gets all of it.
+ */
+static void test_chunked_post(void)
+{
+    test_backend_t test_backend;
+    server_struct_t *server_struct = NULL;
+    test_request_t *request = NULL;
+    GAsyncQueue *meta_queue = NULL;
+    stats_t *stats = NULL;
+    gchar *first = NULL;
+    gchar *second = NULL;
+    gint port = 0;
+
+    memset(&test_backend, 0, sizeof(test_backend));
+    g_mutex_init(&test_backend.mutex);
+    g_cond_init(&test_backend.cond);
+
+    server_struct = start_test_server(&test_backend, 2, 1, &port);
+    meta_queue = server_struct->meta_queue;
+    stats = server_struct->stats;
+
+    first = encode_test_hash('a');
+    second = encode_test_hash('b');
+    request = new_test_request(port, "/Hash_Array.json", new_hash_array_body(first, second, TEST_PADDING_LEN));
+    g_assert_cmpuint(request->body->len, >, DEFAULT_SERVER_BUFFER_SIZE);
+
+    send_test_request(request);
+
+    g_assert_cmpint(request->result, ==, CURLE_OK);
+    g_assert_cmpint(request->status, ==, MHD_HTTP_OK);
+    g_assert_cmpuint(request->sent, ==, request->body->len);
+    g_assert_nonnull(strstr(request->answer->str, first));
+    g_assert_nonnull(strstr(request->answer->str, second));
+    g_assert_cmpuint(test_backend.done, ==, 1);
+
+    free_server_struct_t(server_struct);
+
+    free_test_request(request);
+    free_variable(first);
+    free_variable(second);
+    free_stats_t(stats);
+    g_async_queue_unref(meta_queue);
+    g_cond_clear(&test_backend.cond);
+    g_mutex_clear(&test_backend.mutex);
+}
+
+
+/**
+ * The server is stopped while one request is processed by the only
+ * request worker and another one waits for it: stopping waits for both
+ * of them to be processed and then returns. Answers may not reach the
+ * clients (libmicrohttpd closes the connections) but the clients are
+ * not left waiting.
+ */
+static void test_stop_in_flight(void)
+{
+    test_backend_t test_backend;
+    server_struct_t *server_struct = NULL;
+    test_request_t *requests[2] = {NULL, NULL};
+    GThread *clients[2] = {NULL, NULL};
+    GThread *stopper = NULL;
+    GAsyncQueue *meta_queue = NULL;
+    stats_t *stats = NULL;
+    gchar *first = NULL;
+    gchar *second = NULL;
+    gint port = 0;
+    guint i = 0;
+
+    memset(&test_backend, 0, sizeof(test_backend));
+    g_mutex_init(&test_backend.mutex);
+    g_cond_init(&test_backend.cond);
+    test_backend.hold = TRUE;
+
+    server_struct = start_test_server(&test_backend, 1, 1, &port);
+    meta_queue = server_struct->meta_queue;
+    stats = server_struct->stats;
+
+    first = encode_test_hash('c');
+    second = encode_test_hash('d');
+
+    for (i = 0; i < 2; i++)
+        {
+            requests[i] = new_test_request(port, "/Hash_Array.json", new_hash_array_body(first, second, 16));
+            clients[i] = g_thread_new("client", send_test_request, requests[i]);
+        }
+
+    /* The first request is held in the backend by the only request worker */
+    g_mutex_lock(&test_backend.mutex);
+    while (test_backend.entered == 0)
+        {
+            g_cond_wait(&test_backend.cond, &test_backend.mutex);
+        }
+    g_mutex_unlock(&test_backend.mutex);
+
+    /* The second request waits in the request workers' queue */
+    g_mutex_lock(&server_struct->request_mutex);
+    while (g_thread_pool_unprocessed(server_struct->request_pool) == 0)
+        {
+            g_mutex_unlock(&server_struct->request_mutex);
+            g_usleep(G_USEC_PER_SEC / 100);
+            g_mutex_lock(&server_struct->request_mutex);
+        }
+    g_mutex_unlock(&server_struct->request_mutex);
+
+    /* Stopping waits for the request workers: it is not done before they are released */
+    stopper = g_thread_new("stopper", stop_test_server, server_struct);
+    g_usleep(G_USEC_PER_SEC / 5);
+
+    g_mutex_lock(&test_backend.mutex);
+    g_assert_cmpuint(test_backend.done, ==, 0);
+    test_backend.hold = FALSE;
+    g_cond_broadcast(&test_backend.cond);
+    g_mutex_unlock(&test_backend.mutex);
+
+    g_thread_join(stopper);
+
+    /* Every request that reached the request workers has been processed */
+    g_assert_cmpuint(test_backend.done, ==, test_backend.entered);
+    g_assert_cmpuint(test_backend.done, ==, 2);
+
+    for (i = 0; i < 2; i++)
+        {
+            g_thread_join(clients[i]);
+            g_assert_true(requests[i]->result != CURLE_OPERATION_TIMEDOUT);
+            free_test_request(requests[i]);
+        }
+
+    free_variable(first);
+    free_variable(second);
+    free_stats_t(stats);
+    g_async_queue_unref(meta_queue);
+    g_cond_clear(&test_backend.cond);
+    g_mutex_clear(&test_backend.mutex);
+}
+
+
+/**
+ * Blocks are answered before they are stored: the ones still queued for
+ * the data writers when the server stops are all stored before stopping
+ * returns. The two copies of a block are stored by the same writer.
+ */
+static void test_stop_stores_queued_blocks(void)
+{
+    test_backend_t test_backend;
+    server_struct_t *server_struct = NULL;
+    test_request_t *request = NULL;
+    GAsyncQueue *meta_queue = NULL;
+    stats_t *stats = NULL;
+    gint port = 0;
+    guint i = 0;
+
+    memset(&test_backend, 0, sizeof(test_backend));
+    g_mutex_init(&test_backend.mutex);
+    g_cond_init(&test_backend.cond);
+    test_backend.writers = g_hash_table_new_full(g_str_hash, g_str_equal, free_variable, NULL);
+    test_backend.same_writer = TRUE;
+
+    server_struct = start_test_server(&test_backend, 2, TEST_DATA_WRITERS, &port);
+    meta_queue = server_struct->meta_queue;
+    stats = server_struct->stats;
+
+    for (i = 0; i < 2 * TEST_BLOCKS; i++)
+        {
+            request = new_test_request(port, "/Data.json", new_data_body((guchar) (i % TEST_BLOCKS)));
+            send_test_request(request);
+
+            g_assert_cmpint(request->result, ==, CURLE_OK);
+            g_assert_cmpint(request->status, ==, MHD_HTTP_OK);
+
+            free_test_request(request);
+        }
+
+    free_server_struct_t(server_struct);
+
+    g_assert_cmpuint(test_backend.stored, ==, 2 * TEST_BLOCKS);
+    g_assert_cmpuint(g_hash_table_size(test_backend.writers), ==, TEST_BLOCKS);
+    g_assert_true(test_backend.same_writer);
+
+    g_hash_table_destroy(test_backend.writers);
+    free_stats_t(stats);
+    g_async_queue_unref(meta_queue);
+    g_cond_clear(&test_backend.cond);
+    g_mutex_clear(&test_backend.mutex);
+}
+
+
+int main(int argc, char **argv)
+{
+    int result = 0;
+
+    g_test_init(&argc, &argv, NULL);
+    ignore_sigpipe();
+    curl_global_init(CURL_GLOBAL_ALL);
+
+    g_test_add_func("/http/chunked_post", test_chunked_post);
+    g_test_add_func("/http/stop_in_flight", test_stop_in_flight);
+    g_test_add_func("/http/stop_stores_queued_blocks", test_stop_stores_queued_blocks);
+
+    result = g_test_run();
+
+    curl_global_cleanup();
+
+    return result;
+}
@@ -0,0 +1,770 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    test_pack_backend.c
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file test_pack_backend.c
+ *
+ * Tests of the pack backend: records and index values encoded and
+ * decoded, blocks stored and retrieved, new segments, and what is
+ * recovered when the server starts again after a crash (torn or corrupted
+ * records at the end of the segments written since the checkpoint, index
+ * missing).
+ */
+
+#include "server.h"
+#include "test_helpers.h"
+#include "test_server.h"
+
+/**
+ * @def TEST_DIRECTORY
+ * Template of the name of the temporary directory of each test.
+ */
+#define TEST_DIRECTORY ("cdpfgl-pack-XXXXXX")
+
+/**
+ * @def TEST_SEGMENT_SIZE
+ * Size of the segments of the tests (the smallest one accepted).
+ */
+#define TEST_SEGMENT_SIZE (PACK_MIN_SEGMENT_SIZE)
+
+/**
+ * @def TEST_INDEX_SLOTS
+ * Number of slots the index of the tests begins with: it grows while
+ * the tests store blocks or rebuild it.
+ *
+ * @def TEST_GROW_BLOCKS
+ * Number of blocks of test_rebuild_grow(): enough to grow an index of
+ * TEST_INDEX_SLOTS slots twice.
+ */
+#define TEST_INDEX_SLOTS (16)
+#define TEST_GROW_BLOCKS (40)
+
+/**
+ * @def TEST_WRITERS
+ * Number of data writers that store blocks concurrently.
+ *
+ * @def TEST_WRITER_BLOCKS
+ * Number of blocks stored by each of them.
+ */
+#define TEST_WRITERS (8)
+#define TEST_WRITER_BLOCKS (200)
+
+
+/**
+ * @struct test_writer_t
+ * @brief A data writer of test_concurrent_writers().
+ */
+typedef struct
+{
+    server_struct_t *server_struct;   /**< server structure of the backend         */
+    guchar fill;                      /**< byte used to make the writer's blocks   */
+} test_writer_t;
+
+static server_struct_t *new_test_server(gchar *dirname);
+static void free_test_server(server_struct_t *server_struct);
+static gchar *store_test_block(server_struct_t *server_struct, gsize len, guchar fill);
+static void assert_block(server_struct_t *server_struct, gchar *hex_hash, gsize len, guchar fill);
+static void assert_location(server_struct_t *server_struct, gchar *hex_hash, guint64 segment, guint64 offset);
+static gchar *get_test_segment_filename(server_struct_t *server_struct, guint64 seq);
+static gpointer store_test_blocks(gpointer user_data);
+static void test_location_round_trip(void);
+static void test_record_header(void);
+static void test_store_and_retrieve(void);
+static void test_new_segment(void);
+static void test_torn_tail(void);
+static void test_corrupted_record(void);
+static void test_rebuild(void);
+static void test_rebuild_grow(void);
+static void test_concurrent_writers(void);
+static void test_checkpoint(void);
+static void test_terminate(void);
+
+
+/**
+ * Starts a pack backend in a directory as the server does (with a
+ * configuration file).
+ * @param dirname is the directory of the backend (and of its
+ *        configuration file).
+ * @returns a newly allocated server structure whose backend is ready.
+ */
+static server_struct_t *new_test_server(gchar *dirname)
+{
+    server_struct_t *server_struct = NULL;
+    gchar *contents = NULL;
+
+    contents = g_strdup_printf("[%s]\n%s=%s\n%s=%d\n%s=%d\n", GN_PACK_BACKEND, KN_PACK_DIRECTORY, dirname, KN_SEGMENT_SIZE, TEST_SEGMENT_SIZE, KN_INDEX_SLOTS, TEST_INDEX_SLOTS);
+    server_struct = new_test_server_struct(dirname, contents);
+    free_variable(contents);
+
+    g_assert(pack_init_backend(server_struct) == TRUE);
+
+    return server_struct;
+}
+
+
+/**
+ * Stops a pack backend as a crash would (the segment being written is
+ * only closed) and frees the server structure. A backend already
+ * terminated by pack_terminate_backend() is not stopped again.
+ * @param server_struct is the server structure made by new_test_server().
+ */
+static void free_test_server(server_struct_t *server_struct)
+{
+    pack_backend_t *pack_backend = server_struct->backend->user_data;
+
+    if (pack_backend != NULL)
+        {
+            if (pack_backend->fd >= 0)
+                {
+                    close(pack_backend->fd);
+                }
+
+            free_hash_index_t(pack_backend->index);
+            g_cond_clear(&pack_backend->synced);
+            g_mutex_clear(&pack_backend->mutex);
+            free_variable(pack_backend->prefix);
+            free_variable(pack_backend->dirname);
+            free_variable(pack_backend);
+        }
+
+    free_test_server_struct(server_struct);
+}
+
+
+/**
+ * Stores a block made by new_test_block().
+ * @param server_struct is the server structure.
+ * @param len is the length of the block's data.
+ * @param fill is the byte used to make the data.
+ * @returns the newly allocated hash of the block in hexadecimal.
+ */
+static gchar *store_test_block(server_struct_t *server_struct, gsize len, guchar fill)
+{
+    hash_data_t *hash_data = NULL;
+    gchar *hex_hash = NULL;
+
+    hash_data = new_test_block(len, fill);
+    hex_hash = hash_to_string(hash_data->hash);
+    pack_store_data(server_struct, hash_data);
+
+    return hex_hash;
+}
+
+
+/**
+ * Asserts that a block made by new_test_block() is retrieved.
+ * @param server_struct is the server structure.
+ * @param hex_hash is the hash of the block in hexadecimal.
+ * @param len is the length of the block's data.
+ * @param fill is the byte used to make the data.
+ */
+static void assert_block(server_struct_t *server_struct, gchar *hex_hash, gsize len, guchar fill)
+{
+    hash_data_t *expected = NULL;
+    hash_data_t *hash_data = NULL;
+
+    expected = new_test_block(len, fill);
+    hash_data = pack_retrieve_data(server_struct, hex_hash);
+
+    g_assert_nonnull(hash_data);
+    g_assert_cmpint(hash_data->read, ==, (gssize) len);
+    g_assert_cmpint(hash_data->uncmplen, ==, (gssize) len);
+    g_assert_cmpint(hash_data->cmptype, ==, COMPRESS_NONE_TYPE);
+    g_assert(memcmp(hash_data->hash, expected->hash, HASH_LEN) == 0);
+    g_assert(memcmp(hash_data->data, expected->data, len) == 0);
+
+    free_hash_data_t(hash_data);
+    free_hash_data_t(expected);
+}
+
+
+/**
+ * Asserts where a block is according to the index.
+ * @param server_struct is the server structure.
+ * @param hex_hash is the hash of the block in hexadecimal.
+ * @param segment is the expected segment of the block.
+ * @param offset is the expected offset of its record.
+ */
+static void assert_location(server_struct_t *server_struct, gchar *hex_hash, guint64 segment, guint64 offset)
+{
+    pack_backend_t *pack_backend = server_struct->backend->user_data;
+    pack_location_t location;
+    guchar value[PACK_INDEX_VALUE_LEN];
+    guint8 *hash = NULL;
+
+    hash = string_to_hash(hex_hash);
+    g_assert(get_value_from_hash_index(pack_backend->index, hash, value) == TRUE);
+    decode_pack_location(value, &location);
+
+    g_assert_cmpuint(location.segment, ==, segment);
+    g_assert_cmpuint(location.offset, ==, offset);
+
+    free_variable(hash);
+}
+
+
+/**
+ * @param server_struct is the server structure.
+ * @param seq is the sequence number of a segment.
+ * @returns the newly allocated filename of that segment.
+ */
+static gchar *get_test_segment_filename(server_struct_t *server_struct, guint64 seq)
+{
+    return get_pack_segment_filename(server_struct->backend->user_data, seq);
+}
+
+
+/**
+ * Stores TEST_WRITER_BLOCKS blocks of 1 to TEST_WRITER_BLOCKS bytes as
+ * a data writer does.
+ * @param user_data is the test_writer_t * structure of the writer.
+ * @returns NULL.
+ */
+static gpointer store_test_blocks(gpointer user_data)
+{
+    test_writer_t *writer = (test_writer_t *) user_data;
+    guint i = 0;
+
+    for (i = 1; i <= TEST_WRITER_BLOCKS; i++)
+        {
+            free_variable(store_test_block(writer->server_struct, i, writer->fill));
+        }
+
+    return NULL;
+}
+
+
+/**
+ * Locations kept in the index are decoded as they were encoded.
+ */
+static void test_location_round_trip(void)
+{
+    pack_location_t location;
+    pack_location_t decoded;
+    guchar value[PACK_INDEX_VALUE_LEN];
+
+    location.segment = G_GUINT64_CONSTANT(0x0102030405060708);
+    location.offset = G_GUINT64_CONSTANT(0x1112131415161718);
+    location.length = 0x21222324;
+    location.cmptype = COMPRESS_ZLIB_TYPE;
+    location.uncmplen = G_GUINT64_CONSTANT(0x3132333435363738);
+
+    encode_pack_location(&location, value);
+
+    /* Big endian */
+    g_assert_cmpuint(value[0], ==, 0x01);
+    g_assert_cmpuint(value[15], ==, 0x18);
+    g_assert_cmpuint(value[16], ==, 0x21);
+
+    decode_pack_location(value, &decoded);
+    g_assert_cmpuint(decoded.segment, ==, location.segment);
+    g_assert_cmpuint(decoded.offset, ==, location.offset);
+    g_assert_cmpuint(decoded.length, ==, location.length);
+    g_assert_cmpint(decoded.cmptype, ==, location.cmptype);
+    g_assert_cmpuint(decoded.uncmplen, ==, location.uncmplen);
+}
+
+
+/**
+ * Record headers are decoded as they were encoded. Headers without the
+ * magic or with a length that does not fit in 32 bits are refused.
+ */
+static void test_record_header(void)
+{
+    hash_data_t *hash_data = NULL;
+    pack_location_t location;
+    guchar header[PACK_RECORD_HEADER_LEN];
+    guint8 hash[HASH_LEN];
+    guint32 crc = 0;
+
+    hash_data = new_test_block(1000, 'a');
+    encode_record_header(hash_data, header);
+
+    g_assert(memcmp(header, PACK_RECORD_MAGIC, 4) == 0);
+    g_assert(decode_record_header(header, hash, &crc, &location) == TRUE);
+    g_assert(memcmp(hash, hash_data->hash, HASH_LEN) == 0);
+    g_assert_cmpuint(crc, ==, crc32(crc32(0L, Z_NULL, 0), hash_data->data, 1000));
+    g_assert_cmpuint(location.length, ==, 1000);
+    g_assert_cmpuint(location.uncmplen, ==, 1000);
+    g_assert_cmpint(location.cmptype, ==, COMPRESS_NONE_TYPE);
+
+    /* A length of 2^32 */
+    header[11] = 1;
+    g_assert(decode_record_header(header, hash, &crc, &location) == FALSE);
+
+    header[11] = 0;
+    header[0] = 'X';
+    g_assert(decode_record_header(header, hash, &crc, &location) == FALSE);
+
+    free_hash_data_t(hash_data);
+}
+
+
+/**
+ * Stored blocks are retrieved. A block already stored is not appended
+ * again and blocks of zeros are never stored.
+ */
+static void test_store_and_retrieve(void)
+{
+    server_struct_t *server_struct = NULL;
+    pack_backend_t *pack_backend = NULL;
+    hash_data_t *zeros = NULL;
+    gchar *dirname = NULL;
+    gchar *first = NULL;
+    gchar *second = NULL;
+    guint8 *zero_hash = NULL;
+
+    dirname = make_test_directory(TEST_DIRECTORY);
+    server_struct = new_test_server(dirname);
+    pack_backend = server_struct->backend->user_data;
+
+    first = store_test_block(server_struct, 1000, 'a');
+    second = store_test_block(server_struct, 1, 'b');
+    free_variable(store_test_block(server_struct, 1000, 'a'));
+
+    zero_hash = (guint8 *) g_malloc(HASH_LEN);
+    make_zero_block_hash(zero_hash, 4096);
+    zeros = new_hash_data_t_as_is(NULL, 4096, zero_hash, COMPRESS_NONE_TYPE, 4096);
+    pack_store_data(server_struct, zeros);
+
+    g_assert_cmpuint(pack_backend->write_size, ==, 2 * PACK_RECORD_HEADER_LEN + 1000 + 1);
+    g_assert_cmpuint(pack_backend->index->count, ==, 2);
+
+    assert_block(server_struct, first, 1000, 'a');
+    assert_block(server_struct, second, 1, 'b');
+    assert_location(server_struct, first, 0, 0);
+    assert_location(server_struct, second, 0, PACK_RECORD_HEADER_LEN + 1000);
+
+    free_variable(second);
+    free_variable(first);
+    free_test_server(server_struct);
+    remove_test_directory(dirname);
+    free_variable(dirname);
+}
+
+
+/**
+ * A block that would make the segment grow above its size goes to a new
+ * segment and the server started again writes after the last segment.
+ */
+static void test_new_segment(void)
+{
+    server_struct_t *server_struct = NULL;
+    pack_backend_t *pack_backend = NULL;
+    gchar *dirname = NULL;
+    gchar *first = NULL;
+    gchar *second = NULL;
+    gchar *third = NULL;
+
+    dirname = make_test_directory(TEST_DIRECTORY);
+    server_struct = new_test_server(dirname);
+
+    first = store_test_block(server_struct, TEST_SEGMENT_SIZE / 3, 'a');
+    second = store_test_block(server_struct, TEST_SEGMENT_SIZE / 3, 'b');
+    third = store_test_block(server_struct, TEST_SEGMENT_SIZE / 3, 'c');
+
+    assert_location(server_struct, first, 0, 0);
+    assert_location(server_struct, second, 0, PACK_RECORD_HEADER_LEN + TEST_SEGMENT_SIZE / 3);
+    assert_location(server_struct, third, 1, 0);
+    assert_block(server_struct, third, TEST_SEGMENT_SIZE / 3, 'c');
+    free_test_server(server_struct);
+
+    server_struct = new_test_server(dirname);
+    pack_backend = server_struct->backend->user_data;
+    g_assert_cmpuint(pack_backend->write_seq, ==, 2);
+    g_assert_cmpuint(pack_backend->index->count, ==, 3);
+    assert_block(server_struct, first, TEST_SEGMENT_SIZE / 3, 'a');
+
+    free_variable(third);
+    free_variable(second);
+    free_variable(first);
+    free_test_server(server_struct);
+    remove_test_directory(dirname);
+    free_variable(dirname);
+}
+
+
+/**
+ * A record torn by a crash at the end of the last segment is removed
+ * from the index when the server starts again: it is then asked again
+ * to the clients and written in a new segment.
+ */
+static void test_torn_tail(void)
+{
+    server_struct_t *server_struct = NULL;
+    gchar *dirname = NULL;
+    gchar *filename = NULL;
+    gchar *first = NULL;
+    gchar *second = NULL;
+    gchar *hex_hash = NULL;
+    struct stat buf;
+
+    dirname = make_test_directory(TEST_DIRECTORY);
+    server_struct = new_test_server(dirname);
+    first = store_test_block(server_struct, 1000, 'a');
+    second = store_test_block(server_struct, 2000, 'b');
+    filename = get_test_segment_filename(server_struct, 0);
+    free_test_server(server_struct);
+
+    g_assert_cmpint(stat(filename, &buf), ==, 0);
+    g_assert_cmpint(truncate(filename, buf.st_size - 10), ==, 0);
+
+    server_struct = new_test_server(dirname);
+    assert_block(server_struct, first, 1000, 'a');
+    g_assert_null(pack_retrieve_data(server_struct, second));
+
+    /* Stored again after the torn segment */
+    hex_hash = store_test_block(server_struct, 2000, 'b');
+    g_assert_cmpstr(hex_hash, ==, second);
+    assert_location(server_struct, second, 1, 0);
+    assert_block(server_struct, second, 2000, 'b');
+
+    free_variable(hex_hash);
+    free_variable(filename);
+    free_variable(second);
+    free_variable(first);
+    free_test_server(server_struct);
+    remove_test_directory(dirname);
+    free_variable(dirname);
+}
+
+
+/**
+ * A record whose data does not match its crc32 ends the valid records
+ * of the last segment: it and the records after it are removed from the
+ * index.
+ */
+static void test_corrupted_record(void)
+{
+    server_struct_t *server_struct = NULL;
+    pack_backend_t *pack_backend = NULL;
+    gchar *dirname = NULL;
+    gchar *filename = NULL;
+    gchar *first = NULL;
+    gchar *second = NULL;
+    gchar *third = NULL;
+    gint fd = -1;
+
+    dirname = make_test_directory(TEST_DIRECTORY);
+    server_struct = new_test_server(dirname);
+    first = store_test_block(server_struct, 1000, 'a');
+    second = store_test_block(server_struct, 1000, 'b');
+    third = store_test_block(server_struct, 1000, 'c');
+    filename = get_test_segment_filename(server_struct, 0);
+    free_test_server(server_struct);
+
+    /* Changes a byte of the second record's data */
+    fd = open(filename, O_RDWR);
+    g_assert_cmpint(fd, >=, 0);
+    g_assert_cmpint(pwrite(fd, "X", 1, 2 * PACK_RECORD_HEADER_LEN + 1000 + 10), ==, 1);
+    close(fd);
+
+    server_struct = new_test_server(dirname);
+    pack_backend = server_struct->backend->user_data;
+    g_assert_cmpuint(pack_backend->index->count, ==, 1);
+    assert_block(server_struct, first, 1000, 'a');
+    g_assert_null(pack_retrieve_data(server_struct, second));
+    g_assert_null(pack_retrieve_data(server_struct, third));
+
+    free_variable(filename);
+    free_variable(third);
+    free_variable(second);
+    free_variable(first);
+    free_test_server(server_struct);
+    remove_test_directory(dirname);
+    free_variable(dirname);
+}
+
+
+/**
+ * A missing index is rebuilt from the valid records of every segment.
+ */
+static void test_rebuild(void)
+{
+    server_struct_t *server_struct = NULL;
+    pack_backend_t *pack_backend = NULL;
+    gchar *dirname = NULL;
+    gchar *filename = NULL;
+    gchar *first = NULL;
+    gchar *second = NULL;
+    gchar *third = NULL;
+
+    dirname = make_test_directory(TEST_DIRECTORY);
+    server_struct = new_test_server(dirname);
+    first = store_test_block(server_struct, TEST_SEGMENT_SIZE / 2, 'a');
+    second = store_test_block(server_struct, TEST_SEGMENT_SIZE / 2, 'b');
+    third = store_test_block(server_struct, 1000, 'c');
+    pack_backend = server_struct->backend->user_data;
+    filename = g_build_filename(pack_backend->dirname, PACK_INDEX_FILENAME, NULL);
+    free_test_server(server_struct);
+
+    g_assert_cmpint(g_unlink(filename), ==, 0);
+
+    server_struct = new_test_server(dirname);
+    pack_backend = server_struct->backend->user_data;
+    g_assert(g_file_test(filename, G_FILE_TEST_EXISTS) == TRUE);
+    g_assert_cmpuint(pack_backend->index->count, ==, 3);
+    assert_location(server_struct, second, 1, 0);
+    assert_location(server_struct, third, 1, PACK_RECORD_HEADER_LEN + TEST_SEGMENT_SIZE / 2);
+    assert_block(server_struct, first, TEST_SEGMENT_SIZE / 2, 'a');
+    assert_block(server_struct, third, 1000, 'c');
+
+    free_variable(filename);
+    free_variable(third);
+    free_variable(second);
+    free_variable(first);
+    free_test_server(server_struct);
+    remove_test_directory(dirname);
+    free_variable(dirname);
+}
+
+
+/**
+ * An index that grows while it is rebuilt is the one that replaces the
+ * index file: once the checkpoint has moved after the segments, the
+ * index file alone tells where every block is.
+ */
+static void test_rebuild_grow(void)
+{
+    server_struct_t *server_struct = NULL;
+    pack_backend_t *pack_backend = NULL;
+    hash_data_t *hash_data = NULL;
+    gchar *dirname = NULL;
+    gchar *filename = NULL;
+    gchar *tmp_filename = NULL;
+    gchar *hex_hash = NULL;
+    guint i = 0;
+
+    dirname = make_test_directory(TEST_DIRECTORY);
+    server_struct = new_test_server(dirname);
+
+    for (i = 1; i <= TEST_GROW_BLOCKS; i++)
+        {
+            free_variable(store_test_block(server_struct, i, 'g'));
+        }
+
+    pack_backend = server_struct->backend->user_data;
+    filename = g_build_filename(pack_backend->dirname, PACK_INDEX_FILENAME, NULL);
+    tmp_filename = g_strdup_printf("%s.rebuild", filename);
+    free_test_server(server_struct);
+
+    g_assert_cmpint(g_unlink(filename), ==, 0);
+
+    server_struct = new_test_server(dirname);
+    pack_backend = server_struct->backend->user_data;
+    g_assert_cmpuint(pack_backend->index->slots, >, TEST_INDEX_SLOTS);
+    g_assert_cmpuint(pack_backend->index->count, ==, TEST_GROW_BLOCKS);
+    g_assert_cmpuint(read_pack_checkpoint(pack_backend), ==, pack_backend->write_seq);
+    g_assert(g_file_test(tmp_filename, G_FILE_TEST_EXISTS) == FALSE);
+    pack_terminate_backend(server_struct);
+    free_test_server(server_struct);
+
+    /* The segments are not scanned again: only the index file is read */
+    server_struct = new_test_server(dirname);
+    pack_backend = server_struct->backend->user_data;
+    g_assert(pack_backend->index->clean == TRUE);
+    g_assert_cmpuint(pack_backend->index->count, ==, TEST_GROW_BLOCKS);
+
+    for (i = 1; i <= TEST_GROW_BLOCKS; i++)
+        {
+            hash_data = new_test_block(i, 'g');
+            hex_hash = hash_to_string(hash_data->hash);
+            assert_block(server_struct, hex_hash, i, 'g');
+            free_variable(hex_hash);
+            free_hash_data_t(hash_data);
+        }
+
+    free_variable(tmp_filename);
+    free_variable(filename);
+    free_test_server(server_struct);
+    remove_test_directory(dirname);
+    free_variable(dirname);
+}
+
+
+/**
+ * Blocks stored by concurrent data writers are all synced and indexed
+ * (by groups) and found again when the server starts again.
+ */
+static void test_concurrent_writers(void)
+{
+    server_struct_t *server_struct = NULL;
+    pack_backend_t *pack_backend = NULL;
+    test_writer_t writers[TEST_WRITERS];
+    GThread *threads[TEST_WRITERS];
+    hash_data_t *hash_data = NULL;
+    gchar *dirname = NULL;
+    gchar *hex_hash = NULL;
+    guint w = 0;
+    guint i = 0;
+
+    dirname = make_test_directory(TEST_DIRECTORY);
+    server_struct = new_test_server(dirname);
+
+    for (w = 0; w < TEST_WRITERS; w++)
+        {
+            writers[w].server_struct = server_struct;
+            writers[w].fill = (guchar) (w * 16);
+            threads[w] = g_thread_new("test-writer", store_test_blocks, &writers[w]);
+        }
+
+    for (w = 0; w < TEST_WRITERS; w++)
+        {
+            g_thread_join(threads[w]);
+        }
+
+    pack_backend = server_struct->backend->user_data;
+    g_assert_null(pack_backend->pending);
+    g_assert(pack_backend->syncing == FALSE);
+    g_assert_cmpuint(pack_backend->index->count, ==, TEST_WRITERS * TEST_WRITER_BLOCKS);
+    free_test_server(server_struct);
+
+    server_struct = new_test_server(dirname);
+    pack_backend = server_struct->backend->user_data;
+    g_assert_cmpuint(pack_backend->index->count, ==, TEST_WRITERS * TEST_WRITER_BLOCKS);
+
+    for (w = 0; w < TEST_WRITERS; w++)
+        {
+            for (i = 1; i <= TEST_WRITER_BLOCKS; i++)
+                {
+                    hash_data = new_test_block(i, writers[w].fill);
+                    hex_hash = hash_to_string(hash_data->hash);
+                    assert_block(server_struct, hex_hash, i, writers[w].fill);
+                    free_variable(hex_hash);
+                    free_hash_data_t(hash_data);
+                }
+        }
+
+    free_test_server(server_struct);
+    remove_test_directory(dirname);
+    free_variable(dirname);
+}
+
+
+/**
+ * The checkpoint moves after each closed segment and after the segments
+ * have been checked. Every segment from the checkpoint on is checked
+ * when the server starts again and not only the last one.
+ */
+static void test_checkpoint(void)
+{
+    server_struct_t *server_struct = NULL;
+    pack_backend_t *pack_backend = NULL;
+    gchar *dirname = NULL;
+    gchar *filename = NULL;
+    gchar *first = NULL;
+    gchar *second = NULL;
+    gchar *third = NULL;
+    gchar *empty = NULL;
+    struct stat buf;
+
+    dirname = make_test_directory(TEST_DIRECTORY);
+    server_struct = new_test_server(dirname);
+    pack_backend = server_struct->backend->user_data;
+    g_assert_cmpuint(read_pack_checkpoint(pack_backend), ==, 0);
+
+    first = store_test_block(server_struct, TEST_SEGMENT_SIZE / 2, 'a');
+    second = store_test_block(server_struct, TEST_SEGMENT_SIZE / 2, 'b');
+    g_assert_cmpuint(read_pack_checkpoint(pack_backend), ==, 1);
+    third = store_test_block(server_struct, 1000, 'c');
+    filename = get_test_segment_filename(server_struct, 1);
+    empty = get_test_segment_filename(server_struct, 2);
+    free_test_server(server_struct);
+
+    /* The end of segment 1 is lost and segment 2 was left empty by a
+     * server that stopped right after it started */
+    g_assert_cmpint(stat(filename, &buf), ==, 0);
+    g_assert_cmpint(truncate(filename, buf.st_size - 10), ==, 0);
+    g_assert(g_file_set_contents(empty, "", 0, NULL) == TRUE);
+
+    server_struct = new_test_server(dirname);
+    pack_backend = server_struct->backend->user_data;
+    g_assert_cmpuint(pack_backend->write_seq, ==, 3);
+    g_assert_cmpuint(read_pack_checkpoint(pack_backend), ==, 3);
+    g_assert_cmpuint(pack_backend->index->count, ==, 2);
+    assert_block(server_struct, first, TEST_SEGMENT_SIZE / 2, 'a');
+    assert_block(server_struct, second, TEST_SEGMENT_SIZE / 2, 'b');
+    g_assert_null(pack_retrieve_data(server_struct, third));
+
+    free_variable(empty);
+    free_variable(filename);
+    free_variable(third);
+    free_variable(second);
+    free_variable(first);
+    free_test_server(server_struct);
+    remove_test_directory(dirname);
+    free_variable(dirname);
+}
+
+
+/**
+ * A terminated backend has synced and closed its segment, moved its
+ * checkpoint after it and closed its index cleanly.
+ */
+static void test_terminate(void)
+{
+    server_struct_t *server_struct = NULL;
+    pack_backend_t *pack_backend = NULL;
+    gchar *dirname = NULL;
+    gchar *hex_hash = NULL;
+
+    dirname = make_test_directory(TEST_DIRECTORY);
+    server_struct = new_test_server(dirname);
+
+    hex_hash = store_test_block(server_struct, 1000, 'a');
+    pack_terminate_backend(server_struct);
+    g_assert_null(server_struct->backend->user_data);
+    free_test_server(server_struct);
+
+    server_struct = new_test_server(dirname);
+    pack_backend = server_struct->backend->user_data;
+    g_assert(pack_backend->index->clean == TRUE);
+    g_assert_cmpuint(pack_backend->write_seq, ==, 1);
+    g_assert_cmpuint(read_pack_checkpoint(pack_backend), ==, 1);
+    g_assert_cmpuint(pack_backend->index->count, ==, 1);
+    assert_block(server_struct, hex_hash, 1000, 'a');
+
+    free_variable(hex_hash);
+    free_test_server(server_struct);
+    remove_test_directory(dirname);
+    free_variable(dirname);
+}
+
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/pack_backend/location_round_trip", test_location_round_trip);
+    g_test_add_func("/pack_backend/record_header", test_record_header);
+    g_test_add_func("/pack_backend/store_and_retrieve", test_store_and_retrieve);
+    g_test_add_func("/pack_backend/new_segment", test_new_segment);
+    g_test_add_func("/pack_backend/torn_tail", test_torn_tail);
+    g_test_add_func("/pack_backend/corrupted_record", test_corrupted_record);
+    g_test_add_func("/pack_backend/rebuild", test_rebuild);
+    g_test_add_func("/pack_backend/rebuild_grow", test_rebuild_grow);
+    g_test_add_func("/pack_backend/concurrent_writers", test_concurrent_writers);
+    g_test_add_func("/pack_backend/checkpoint", test_checkpoint);
+    g_test_add_func("/pack_backend/terminate", test_terminate);
+
+    return g_test_run();
+}
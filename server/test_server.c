@@ -0,0 +1,73 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *    test_server.c
+ *    This file is part of "Sauvegarde" project.
+ *
+ *    (C) Copyright 2019 Olivier Delhomme
+ *     e-mail : olivier.delhomme@free.fr
+ *
+ *    "Sauvegarde" is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    "Sauvegarde" is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with "Sauvegarde".  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file test_server.c
+ *
+ * Helpers shared by the unit tests of the server's backends.
+ */
+
+#include "server.h"
+#include "test_server.h"
+
+
+/**
+ * Makes a server structure with an empty backend structure and, when
+ * contents is not NULL, its configuration file in dirname.
+ * @param dirname is the directory of the test.
+ * @param contents is the contents of the configuration file (may be
+ *        NULL).
+ * @returns a newly allocated server structure.
+ */
+server_struct_t *new_test_server_struct(gchar *dirname, gchar *contents)
+{
+    server_struct_t *server_struct = NULL;
+
+    server_struct = (server_struct_t *) g_malloc0(sizeof(server_struct_t));
+    server_struct->opt = (options_t *) g_malloc0(sizeof(options_t));
+    server_struct->backend = (backend_t *) g_malloc0(sizeof(backend_t));
+
+    if (contents != NULL)
+        {
+            server_struct->opt->configfile = g_build_filename(dirname, TEST_CONFIGFILE, NULL);
+            g_assert(g_file_set_contents(server_struct->opt->configfile, contents, -1, NULL) == TRUE);
+        }
+
+    return server_struct;
+}
+
+
+/**
+ * Frees a server structure made by new_test_server_struct(). The
+ * backend's user_data must already be freed.
+ * @param server_struct is the server structure.
+ */
+void free_test_server_struct(server_struct_t *server_struct)
+{
+    if (server_struct != NULL)
+        {
+            free_variable(server_struct->backend);
+            free_variable(server_struct->opt->configfile);
+            free_variable(server_struct->opt);
+            free_variable(server_struct);
+        }
+}